@@ -89,6 +89,20 @@ LOCAL_SRC_FILES := \
 	audio_extn/ext_speaker.c \
 	audio_extn/audio_extn.c \
 	audio_extn/utils.c \
+	audio_extn/pcm_kernels.c \
+	audio_extn/route_trace.c \
+	audio_extn/perf_stats.c \
+	audio_extn/rt_latency.c \
+	audio_extn/mmap_timing.c \
+	audio_extn/amp_service.c \
+	audio_extn/haptic_writer.c \
+	audio_extn/capture_resampler.c \
+	audio_extn/call_trace.c \
+	audio_extn/metrics_shm.c \
+	audio_extn/volume_coalescer.c \
+	audio_extn/thread_policy.c \
+	audio_extn/object_pool.c \
+	audio_extn/ec_ref_tap.c \
 	$(AUDIO_PLATFORM)/platform.c \
         acdb.c
 
@@ -106,6 +120,15 @@ ifeq ($(strip $(AUDIO_FEATURE_ENABLED_USB_SIDETONE_VOLUME)),true)
     LOCAL_CFLAGS += -DUSB_SIDETONE_VOLUME
 endif
 
+# need decoder support for the codec in the kernel compress headers and the DSP
+ifeq ($(strip $(AUDIO_FEATURE_ENABLED_FLAC_OFFLOAD)),true)
+    LOCAL_CFLAGS += -DFLAC_OFFLOAD_ENABLED
+endif
+
+ifeq ($(strip $(AUDIO_FEATURE_ENABLED_ALAC_OFFLOAD)),true)
+    LOCAL_CFLAGS += -DALAC_OFFLOAD_ENABLED
+endif
+
 LOCAL_SHARED_LIBRARIES := \
 	libaudioutils \
 	liblog \
@@ -256,4 +279,6 @@ LOCAL_MODULE := audio_headers
 LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)/audio_extn
 include $(BUILD_HEADER_LIBRARY)
 
+include $(LOCAL_PATH)/tools/Android.mk
+
 endif
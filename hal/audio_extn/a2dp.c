@@ -21,12 +21,14 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <cutils/log.h>
 #include <cutils/str_parms.h>
 #include <cutils/properties.h>
 #include <hardware/audio.h>
+#include <utils/Timers.h>
 
 #include "audio_hw.h"
 #include "audio_extn.h"
@@ -81,6 +83,10 @@
 #define SYSPROP_A2DP_OFFLOAD_DISABLED  "persist.bluetooth.a2dp_offload.disabled"
 #define SYSPROP_BLUETOOTH_AUDIO_HAL_DISABLED  "persist.bluetooth.bluetooth_audio_hal.disabled"
 #define SYSPROP_A2DP_CODEC_LATENCIES   "vendor.audio.a2dp.codec.latency"
+#define SYSPROP_A2DP_ENC_CACHE_DISABLED "vendor.audio.a2dp.enc_cache.disabled"
+
+// get_parameters key returning the A2DP encoder counters
+#define AUDIO_PARAMETER_A2DP_STATS     "a2dp_stats"
 
 // Default encoder bit width
 #define DEFAULT_ENCODER_BIT_FORMAT 16
@@ -104,6 +110,11 @@
 #define DEFAULT_SINK_LATENCY_SBC       140
 #define DEFAULT_SINK_LATENCY_PCM       140
 
+// Sink latency reported by Bluetooth stack is sampled at most this often
+// and smoothed over A2DP_SINK_LATENCY_SMOOTHING samples
+#define A2DP_SINK_LATENCY_POLL_MS      500
+#define A2DP_SINK_LATENCY_SMOOTHING    4
+
 // Slimbus Tx sample rate for ABR feedback channel
 #define ABR_TX_SAMPLE_RATE             "KHZ_8"
 
@@ -191,6 +202,63 @@ struct a2dp_abr_config {
     uint32_t imc_instance;
 };
 
+/* Encoder configuration last programmed on DSP.
+ * While valid, the encoder, decoder and backend mixer controls still hold
+ * the configuration derived from the Bluetooth codec config identified by
+ * (codec_type, hash), so a resume on the same headset can skip them.
+ */
+struct a2dp_enc_cache {
+    bool enabled;
+    bool valid;
+    /* Backend and scrambler controls have been set for this config */
+    bool backend_set;
+    enc_codec_t codec_type;
+    uint32_t hash;
+    /* State restored from the cache on a hit */
+    enc_codec_t bt_encoder_format;
+    uint32_t enc_sampling_rate;
+    uint32_t enc_channels;
+    bool is_abr_enabled;
+    uint32_t imc_instance;
+};
+
+/* Output latency model used for presentation position */
+struct a2dp_latency_model {
+    pthread_mutex_t lock;
+    /* Codec latencies from SYSPROP_A2DP_CODEC_LATENCIES, read on connect */
+    bool has_offsets;
+    int sbc_offset;
+    int aptx_offset;
+    int aptxhd_offset;
+    int aac_offset;
+    int ldac_offset;
+    /* Smoothed sink latency, 0 until reported by Bluetooth stack */
+    int64_t sink_latency_us;
+    int64_t last_poll_ns;
+};
+
+/* Encoder and ABR counters reported by get_parameters and dumpsys.
+ * Updated under adev->lock together with the rest of the A2DP state.
+ */
+struct a2dp_stats {
+    /* Bluetooth stream starts and controller start failures */
+    uint32_t stream_starts;
+    uint32_t stream_start_failures;
+    /* Encoder configs written to DSP, reused from cache or failed */
+    uint32_t enc_config_writes;
+    uint32_t enc_config_reuses;
+    uint32_t enc_config_failures;
+    /* Bitrate requested by Bluetooth stack for the encoder */
+    uint32_t bitrate;
+    uint32_t bitrate_changes;
+    uint32_t suspends;
+    /* ABR feedback path */
+    uint32_t abr_starts;
+    uint32_t abr_start_failures;
+    int64_t abr_start_ns;
+    int64_t abr_active_ns;
+};
+
 static uint32_t instance_id = MAX_INSTANCE_ID;
 
 /* Data structure used to:
@@ -248,9 +316,17 @@ struct a2dp_data {
     bool is_aptx_dual_mono_supported;
     /* Adaptive bitrate config for A2DP codecs */
     struct a2dp_abr_config abr_config;
+    /* Encoder configuration currently held by DSP */
+    struct a2dp_enc_cache enc_cache;
+    /* Latency reported through presentation position */
+    struct a2dp_latency_model latency;
+    /* Encoder and ABR counters */
+    struct a2dp_stats stats;
 };
 
-struct a2dp_data a2dp;
+struct a2dp_data a2dp = {
+    .latency.lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 /* Adaptive bitrate (ABR) is supported by certain Bluetooth codecs.
  * Structures sent to configure DSP for ABR are defined below.
@@ -571,6 +647,10 @@ static int stop_abr()
     /* This function can be used if !abr_started for clean up */
     ALOGV("%s: enter", __func__);
 
+    if (a2dp.abr_config.abr_started)
+        a2dp.stats.abr_active_ns +=
+                systemTime(SYSTEM_TIME_MONOTONIC) - a2dp.stats.abr_start_ns;
+
     // Close hostless front end
     if (a2dp.abr_config.abr_tx_handle != NULL) {
         pcm_close(a2dp.abr_config.abr_tx_handle);
@@ -665,15 +745,79 @@ static int start_abr()
     if (ret < 0)
         goto fail;
     a2dp.abr_config.abr_started = true;
+    a2dp.stats.abr_starts++;
+    a2dp.stats.abr_start_ns = systemTime(SYSTEM_TIME_MONOTONIC);
 
     return ret;
 
 fail:
     ALOGE("%s: %s", __func__, pcm_get_error(a2dp.abr_config.abr_tx_handle));
+    a2dp.stats.abr_start_failures++;
     stop_abr();
     return -ENOSYS;
 }
 
+static void a2dp_latency_load_offsets()
+{
+    struct a2dp_latency_model *model = &a2dp.latency;
+    char value[PROPERTY_VALUE_MAX];
+
+    memset(value, '\0', sizeof(char) * PROPERTY_VALUE_MAX);
+    model->has_offsets = false;
+    if (property_get(SYSPROP_A2DP_CODEC_LATENCIES, value, NULL) > 0) {
+        if (sscanf(value, "%d/%d/%d/%d/%d",
+            &model->sbc_offset, &model->aptx_offset, &model->aptxhd_offset,
+            &model->aac_offset, &model->ldac_offset) != 5) {
+            ALOGI("%s: Failed to parse avsync offset params from '%s'.", __func__, value);
+        } else {
+            model->has_offsets = true;
+        }
+    }
+}
+
+/* Forget the sink latency estimate, the next query samples it afresh */
+static void a2dp_latency_reset()
+{
+    pthread_mutex_lock(&a2dp.latency.lock);
+    a2dp.latency.sink_latency_us = 0;
+    a2dp.latency.last_poll_ns = 0;
+    pthread_mutex_unlock(&a2dp.latency.lock);
+}
+
+/* Returns the filtered sink latency, polling Bluetooth stack at most
+ * every A2DP_SINK_LATENCY_POLL_MS so presentation position queries stay
+ * cheap and a single noisy report does not make the position jump.
+ */
+static uint32_t a2dp_latency_get_sink_ms(uint32_t default_ms)
+{
+    struct a2dp_latency_model *model = &a2dp.latency;
+    const int64_t now_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint32_t sample_ms = 0;
+    uint32_t latency_ms;
+
+    pthread_mutex_lock(&model->lock);
+    if (model->last_poll_ns == 0 ||
+            now_ns - model->last_poll_ns >= A2DP_SINK_LATENCY_POLL_MS * 1000000LL) {
+        model->last_poll_ns = now_ns;
+        if (a2dp.audio_get_a2dp_sink_latency && a2dp.bt_state != A2DP_STATE_DISCONNECTED)
+            sample_ms = a2dp.audio_get_a2dp_sink_latency();
+        if (sample_ms == 0) {
+            model->sink_latency_us = 0;
+        } else if (model->sink_latency_us == 0) {
+            model->sink_latency_us = sample_ms * 1000;
+        } else {
+            model->sink_latency_us +=
+                ((int64_t)sample_ms * 1000 - model->sink_latency_us) /
+                A2DP_SINK_LATENCY_SMOOTHING;
+        }
+    }
+    latency_ms = model->sink_latency_us == 0 ?
+                     default_ms : (model->sink_latency_us + 500) / 1000;
+    pthread_mutex_unlock(&model->lock);
+
+    return latency_ms;
+}
+
 /* API to open Bluetooth IPC library to start IPC communication */
 static int open_a2dp_output()
 {
@@ -739,6 +883,8 @@ static int open_a2dp_output()
             return ret;
         }
         a2dp.bt_state = A2DP_STATE_CONNECTED;
+        a2dp_latency_load_offsets();
+        a2dp_latency_reset();
     } else {
         ALOGE("%s: A2DP handle is not identified, Ignoring open request", __func__);
         a2dp.bt_state = A2DP_STATE_DISCONNECTED;
@@ -1335,6 +1481,107 @@ exit:
     return is_configured;
 }
 
+static void a2dp_stats_update_bitrate(enc_codec_t codec_type, const void *codec_info)
+{
+    uint32_t bitrate;
+
+    if (codec_info == NULL)
+        return;
+
+    switch (codec_type) {
+        case ENC_CODEC_TYPE_SBC:
+            bitrate = ((const audio_sbc_encoder_config *)codec_info)->bitrate;
+            break;
+        case ENC_CODEC_TYPE_APTX:
+        case ENC_CODEC_TYPE_APTX_HD:
+            bitrate = ((const audio_aptx_default_config *)codec_info)->bitrate;
+            break;
+        case ENC_CODEC_TYPE_AAC:
+            bitrate = ((const audio_aac_encoder_config *)codec_info)->bitrate;
+            break;
+        case ENC_CODEC_TYPE_LDAC:
+            bitrate = ((const audio_ldac_encoder_config *)codec_info)->bit_rate;
+            break;
+        default:
+            return;
+    }
+
+    if (a2dp.stats.bitrate != 0 && a2dp.stats.bitrate != bitrate) {
+        ALOGD("%s: encoder bitrate %u -> %u", __func__, a2dp.stats.bitrate, bitrate);
+        a2dp.stats.bitrate_changes++;
+    }
+    a2dp.stats.bitrate = bitrate;
+}
+
+/* FNV-1a hash of the codec config blob returned by Bluetooth IPC library */
+static uint32_t a2dp_codec_config_hash(enc_codec_t codec_type, const void *codec_info)
+{
+    const uint8_t *data = (const uint8_t *)codec_info;
+    uint32_t hash = 2166136261u;
+    size_t size, i;
+
+    switch (codec_type) {
+        case ENC_CODEC_TYPE_SBC:
+            size = sizeof(audio_sbc_encoder_config);
+            break;
+        case ENC_CODEC_TYPE_APTX:
+        case ENC_CODEC_TYPE_APTX_HD:
+            size = sizeof(audio_aptx_default_config);
+            break;
+        case ENC_CODEC_TYPE_AAC:
+            size = sizeof(audio_aac_encoder_config);
+            break;
+        case ENC_CODEC_TYPE_LDAC:
+            size = sizeof(audio_ldac_encoder_config);
+            break;
+        default:
+            size = 0;
+            break;
+    }
+
+    for (i = 0; data != NULL && i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void a2dp_enc_cache_invalidate()
+{
+    a2dp.enc_cache.valid = false;
+    a2dp.enc_cache.backend_set = false;
+}
+
+static void a2dp_enc_cache_store(enc_codec_t codec_type, uint32_t hash)
+{
+    struct a2dp_enc_cache *cache = &a2dp.enc_cache;
+
+    cache->codec_type = codec_type;
+    cache->hash = hash;
+    cache->bt_encoder_format = a2dp.bt_encoder_format;
+    cache->enc_sampling_rate = a2dp.enc_sampling_rate;
+    cache->enc_channels = a2dp.enc_channels;
+    cache->is_abr_enabled = a2dp.abr_config.is_abr_enabled;
+    cache->imc_instance = a2dp.abr_config.imc_instance;
+    cache->backend_set = false;
+    cache->valid = cache->enabled;
+}
+
+static bool a2dp_enc_cache_restore(enc_codec_t codec_type, uint32_t hash)
+{
+    struct a2dp_enc_cache *cache = &a2dp.enc_cache;
+
+    if (!cache->valid || cache->codec_type != codec_type || cache->hash != hash)
+        return false;
+
+    a2dp.bt_encoder_format = cache->bt_encoder_format;
+    a2dp.enc_sampling_rate = cache->enc_sampling_rate;
+    a2dp.enc_channels = cache->enc_channels;
+    a2dp.abr_config.is_abr_enabled = cache->is_abr_enabled;
+    a2dp.abr_config.imc_instance = cache->imc_instance;
+    return true;
+}
+
 bool configure_a2dp_encoder_format()
 {
     void *codec_info = NULL;
@@ -1342,6 +1589,7 @@ bool configure_a2dp_encoder_format()
     enc_codec_t codec_type = ENC_CODEC_TYPE_INVALID;
     bool is_configured = false;
     audio_aptx_encoder_config aptx_encoder_cfg;
+    uint32_t hash;
 
     if (!a2dp.audio_get_codec_config) {
         ALOGE("%s: A2DP handle is not identified, ignoring A2DP encoder config", __func__);
@@ -1351,6 +1599,17 @@ bool configure_a2dp_encoder_format()
     codec_info = a2dp.audio_get_codec_config(&multi_cast, &num_dev,
                                &codec_type);
 
+    a2dp_stats_update_bitrate(codec_type, codec_info);
+
+    // DSP still holds the encoder config for this codec config
+    hash = a2dp_codec_config_hash(codec_type, codec_info);
+    if (codec_info != NULL && a2dp_enc_cache_restore(codec_type, hash)) {
+        ALOGD("%s: Reusing encoder config for codec type %d", __func__, codec_type);
+        a2dp.stats.enc_config_reuses++;
+        return true;
+    }
+    a2dp_enc_cache_invalidate();
+
     // ABR disabled by default for all codecs
     a2dp.abr_config.is_abr_enabled = false;
 
@@ -1396,6 +1655,12 @@ bool configure_a2dp_encoder_format()
             is_configured = false;
             break;
     }
+    if (is_configured) {
+        a2dp_enc_cache_store(codec_type, hash);
+        a2dp.stats.enc_config_writes++;
+    } else {
+        a2dp.stats.enc_config_failures++;
+    }
     return is_configured;
 }
 
@@ -1423,11 +1688,14 @@ int audio_extn_a2dp_start_playback()
         ret =  a2dp.audio_stream_start();
         if (ret != 0 ) {
            ALOGE("%s: Bluetooth controller start failed", __func__);
+           a2dp.stats.stream_start_failures++;
            a2dp.a2dp_started = false;
            ret = -ETIMEDOUT;
         } else {
+           a2dp.stats.stream_starts++;
            if (configure_a2dp_encoder_format() == true) {
                 a2dp.a2dp_started = true;
+                a2dp_latency_reset();
                 ret = 0;
                 ALOGD("%s: Start playback successful to Bluetooth IPC library", __func__);
            } else {
@@ -1440,8 +1708,11 @@ int audio_extn_a2dp_start_playback()
 
     if (a2dp.a2dp_started) {
         a2dp.a2dp_total_active_session_request++;
-        a2dp_check_and_set_scrambler();
-        a2dp_set_backend_cfg();
+        if (!a2dp.enc_cache.backend_set) {
+            a2dp_check_and_set_scrambler();
+            a2dp.enc_cache.backend_set = a2dp.enc_cache.valid &&
+                                         a2dp_set_backend_cfg() == 0;
+        }
         if (a2dp.abr_config.is_abr_enabled)
             start_abr();
     }
@@ -1499,6 +1770,7 @@ static int reset_a2dp_dec_config_params()
 }
 
 static void reset_a2dp_config() {
+    a2dp_enc_cache_invalidate();
     reset_a2dp_enc_config_params();
     reset_a2dp_dec_config_params();
     a2dp_reset_backend_cfg();
@@ -1507,6 +1779,21 @@ static void reset_a2dp_config() {
     a2dp.abr_config.is_abr_enabled = false;
 }
 
+/* Stop the session but leave the encoder config on DSP for a quick resume.
+ * A different codec config on the next start simply overwrites it, a
+ * disconnect or suspend still goes through reset_a2dp_config().
+ */
+static void release_a2dp_config() {
+    if (!a2dp.enc_cache.valid) {
+        reset_a2dp_config();
+        return;
+    }
+    if (a2dp.abr_config.is_abr_enabled && a2dp.abr_config.abr_started)
+        stop_abr();
+    a2dp.abr_config.is_abr_enabled = false;
+    a2dp.bt_encoder_format = ENC_MEDIA_FMT_NONE;
+}
+
 int audio_extn_a2dp_stop_playback()
 {
     int ret = 0;
@@ -1530,7 +1817,7 @@ int audio_extn_a2dp_stop_playback()
         else
             ALOGV("%s: stop steam to Bluetooth IPC lib successful", __func__);
         if (!a2dp.a2dp_suspended)
-            reset_a2dp_config();
+            release_a2dp_config();
         a2dp.a2dp_started = false;
     }
     ALOGD("%s: Stop A2DP playback total active sessions :%d", __func__,
@@ -1586,6 +1873,7 @@ int audio_extn_a2dp_set_parameters(struct str_parms *parms, bool *reconfig)
                 }
                 ALOGD("%s: Setting A2DP to suspend state", __func__);
                 a2dp.a2dp_suspended = true;
+                a2dp.stats.suspends++;
                 list_for_each(node, &a2dp.adev->usecase_list) {
                     uc_info = node_to_item(node, struct audio_usecase, list);
                     if (uc_info->type == PCM_PLAYBACK &&
@@ -1628,8 +1916,10 @@ int audio_extn_a2dp_set_parameters(struct str_parms *parms, bool *reconfig)
                         status =  a2dp.audio_stream_start();
                         if (status != 0) {
                             ALOGE("%s: Bluetooth controller start failed", __func__);
+                            a2dp.stats.stream_start_failures++;
                             a2dp.a2dp_started = false;
                         } else {
+                            a2dp.stats.stream_starts++;
                             if (!configure_a2dp_encoder_format()) {
                                 ALOGE("%s: Encoder params configuration failed post suspend", __func__);
                                 a2dp.a2dp_started = false;
@@ -1720,6 +2010,10 @@ void audio_extn_a2dp_init(void *adev)
   a2dp.is_a2dp_offload_enabled = false;
   a2dp.is_handoff_in_progress = false;
   a2dp.is_aptx_dual_mono_supported = false;
+  a2dp.enc_cache.enabled =
+            !property_get_bool(SYSPROP_A2DP_ENC_CACHE_DISABLED, false);
+  a2dp_enc_cache_invalidate();
+  a2dp_latency_load_offsets();
   reset_a2dp_enc_config_params();
   reset_a2dp_dec_config_params();
   update_offload_codec_support();
@@ -1727,48 +2021,29 @@ void audio_extn_a2dp_init(void *adev)
 
 uint32_t audio_extn_a2dp_get_encoder_latency()
 {
+    const struct a2dp_latency_model *model = &a2dp.latency;
     uint32_t latency_ms = 0;
-    int avsync_runtime_prop = 0;
-    int sbc_offset = 0, aptx_offset = 0, aptxhd_offset = 0,
-        aac_offset = 0, ldac_offset = 0;
-    char value[PROPERTY_VALUE_MAX];
-
-    memset(value, '\0', sizeof(char) * PROPERTY_VALUE_MAX);
-    avsync_runtime_prop = property_get(SYSPROP_A2DP_CODEC_LATENCIES, value, NULL);
-    if (avsync_runtime_prop > 0) {
-        if (sscanf(value, "%d/%d/%d/%d/%d",
-            &sbc_offset, &aptx_offset, &aptxhd_offset, &aac_offset,
-            &ldac_offset) != 5) {
-            ALOGI("%s: Failed to parse avsync offset params from '%s'.", __func__, value);
-            avsync_runtime_prop = 0;
-        }
-    }
-
-    uint32_t slatency_ms = 0;
-    if (a2dp.audio_get_a2dp_sink_latency && a2dp.bt_state != A2DP_STATE_DISCONNECTED) {
-        slatency_ms = a2dp.audio_get_a2dp_sink_latency();
-    }
 
     switch (a2dp.bt_encoder_format) {
         case ENC_CODEC_TYPE_SBC:
-            latency_ms = (avsync_runtime_prop > 0) ? sbc_offset : ENCODER_LATENCY_SBC;
-            latency_ms += (slatency_ms == 0) ? DEFAULT_SINK_LATENCY_SBC : slatency_ms;
+            latency_ms = model->has_offsets ? model->sbc_offset : ENCODER_LATENCY_SBC;
+            latency_ms += a2dp_latency_get_sink_ms(DEFAULT_SINK_LATENCY_SBC);
             break;
         case ENC_CODEC_TYPE_APTX:
-            latency_ms = (avsync_runtime_prop > 0) ? aptx_offset : ENCODER_LATENCY_APTX;
-            latency_ms += (slatency_ms == 0) ? DEFAULT_SINK_LATENCY_APTX : slatency_ms;
+            latency_ms = model->has_offsets ? model->aptx_offset : ENCODER_LATENCY_APTX;
+            latency_ms += a2dp_latency_get_sink_ms(DEFAULT_SINK_LATENCY_APTX);
             break;
         case ENC_CODEC_TYPE_APTX_HD:
-            latency_ms = (avsync_runtime_prop > 0) ? aptxhd_offset : ENCODER_LATENCY_APTX_HD;
-            latency_ms += (slatency_ms == 0) ? DEFAULT_SINK_LATENCY_APTX_HD : slatency_ms;
+            latency_ms = model->has_offsets ? model->aptxhd_offset : ENCODER_LATENCY_APTX_HD;
+            latency_ms += a2dp_latency_get_sink_ms(DEFAULT_SINK_LATENCY_APTX_HD);
             break;
         case ENC_CODEC_TYPE_AAC:
-            latency_ms = (avsync_runtime_prop > 0) ? aac_offset : ENCODER_LATENCY_AAC;
-            latency_ms += (slatency_ms == 0) ? DEFAULT_SINK_LATENCY_AAC : slatency_ms;
+            latency_ms = model->has_offsets ? model->aac_offset : ENCODER_LATENCY_AAC;
+            latency_ms += a2dp_latency_get_sink_ms(DEFAULT_SINK_LATENCY_AAC);
             break;
         case ENC_CODEC_TYPE_LDAC:
-            latency_ms = (avsync_runtime_prop > 0) ? ldac_offset : ENCODER_LATENCY_LDAC;
-            latency_ms += (slatency_ms == 0) ? DEFAULT_SINK_LATENCY_LDAC : slatency_ms;
+            latency_ms = model->has_offsets ? model->ldac_offset : ENCODER_LATENCY_LDAC;
+            latency_ms += a2dp_latency_get_sink_ms(DEFAULT_SINK_LATENCY_LDAC);
             break;
         case ENC_CODEC_TYPE_PCM:
             latency_ms = ENCODER_LATENCY_PCM;
@@ -1795,6 +2070,50 @@ int audio_extn_a2dp_get_parameters(struct str_parms *query,
         ALOGV("%s: called ... isReconfigA2dpSupported %d", __func__, val);
     }
 
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_A2DP_STATS,
+                            value, sizeof(value));
+    if (ret >= 0) {
+        char stats[256];
+        const struct a2dp_stats *st = &a2dp.stats;
+        int64_t abr_active_ns = st->abr_active_ns;
+
+        if (a2dp.abr_config.abr_started)
+            abr_active_ns += systemTime(SYSTEM_TIME_MONOTONIC) - st->abr_start_ns;
+        snprintf(stats, sizeof(stats),
+                 "codec:%d,bitrate:%u,bitrate_changes:%u,starts:%u,start_failures:%u,"
+                 "enc_writes:%u,enc_reuses:%u,enc_failures:%u,suspends:%u,"
+                 "abr_starts:%u,abr_failures:%u,abr_active_ms:%lld",
+                 a2dp.bt_encoder_format, st->bitrate, st->bitrate_changes,
+                 st->stream_starts, st->stream_start_failures,
+                 st->enc_config_writes, st->enc_config_reuses, st->enc_config_failures,
+                 st->suspends, st->abr_starts, st->abr_start_failures,
+                 (long long)(abr_active_ns / 1000000));
+        str_parms_add_str(reply, AUDIO_PARAMETER_A2DP_STATS, stats);
+    }
+
     return 0;
 }
+
+void audio_extn_a2dp_dump(int fd)
+{
+    const struct a2dp_stats *st = &a2dp.stats;
+
+    if (!a2dp.is_a2dp_offload_enabled)
+        return;
+
+    dprintf(fd, "  A2DP offload:\n");
+    dprintf(fd, "    state=%d codec=%d rate=%u channels=%u started=%d suspended=%d sessions=%d\n",
+            a2dp.bt_state, a2dp.bt_encoder_format, a2dp.enc_sampling_rate,
+            a2dp.enc_channels, a2dp.a2dp_started, a2dp.a2dp_suspended,
+            a2dp.a2dp_total_active_session_request);
+    dprintf(fd, "    stream starts=%u failures=%u suspends=%u\n",
+            st->stream_starts, st->stream_start_failures, st->suspends);
+    dprintf(fd, "    encoder writes=%u reuses=%u failures=%u bitrate=%u changes=%u\n",
+            st->enc_config_writes, st->enc_config_reuses, st->enc_config_failures,
+            st->bitrate, st->bitrate_changes);
+    dprintf(fd, "    abr enabled=%d started=%d starts=%u failures=%u active=%lldms\n",
+            a2dp.abr_config.is_abr_enabled, a2dp.abr_config.abr_started,
+            st->abr_starts, st->abr_start_failures,
+            (long long)(st->abr_active_ns / 1000000));
+}
 #endif // A2DP_OFFLOAD_ENABLED
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_amp_service"
+/*#define LOG_NDEBUG 0*/
+
+/* Shared worker for speaker amp housekeeping.
+
+   Amp backends describe calibration, temperature polling and failure
+   detection as amp tasks instead of starting a thread for each. A task has
+   a run callback and optionally a buffer that is allocated once and handed
+   to every run. Queued tasks are kept in due time order and run one at a
+   time on a single background priority thread, which sleeps until the next
+   deadline or until the queue changes. A run returns the delay before it
+   wants to run again, or a negative value when it is done. Runs only take
+   adev->lock for short routing steps, never across a sleep, so a preempted
+   background run cannot stall the stream paths.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <log/log.h>
+#include <utils/Timers.h>
+#include <audio_utils/clock.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;       /* queue changed or exit requested */
+    pthread_cond_t done_cond;  /* a run finished */
+    struct listnode tasks;     /* queued tasks, earliest due first */
+    pthread_t thread;
+    bool started;
+    bool exit;
+} amp;
+
+static pthread_once_t amp_once = PTHREAD_ONCE_INIT;
+
+static void amp_service_once(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&amp.lock, (const pthread_mutexattr_t *) NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&amp.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&amp.done_cond, (const pthread_condattr_t *) NULL);
+    list_init(&amp.tasks);
+}
+
+static void queue_task_l(struct amp_task *task)
+{
+    struct listnode *node;
+
+    list_for_each(node, &amp.tasks) {
+        if (node_to_item(node, struct amp_task, list)->due_ns > task->due_ns)
+            break;
+    }
+    /* inserts before node, or at the tail when none is due later */
+    list_add_tail(node, &task->list);
+    task->queued = true;
+}
+
+static void dequeue_task_l(struct amp_task *task)
+{
+    if (task->queued) {
+        list_remove(&task->list);
+        task->queued = false;
+    }
+}
+
+/* called and returns with the lock held, drops it around the run */
+static void run_task_l(struct amp_task *task)
+{
+    int64_t delay_ns;
+
+    dequeue_task_l(task);
+    task->running = true;
+    pthread_mutex_unlock(&amp.lock);
+
+    delay_ns = task->run(task);
+
+    pthread_mutex_lock(&amp.lock);
+    task->running = false;
+    /* a schedule or cancel issued while running takes precedence */
+    if (delay_ns >= 0 && !task->queued && !task->cancelled) {
+        task->due_ns = systemTime(SYSTEM_TIME_MONOTONIC) + delay_ns;
+        queue_task_l(task);
+        pthread_cond_signal(&amp.cond);
+    }
+    pthread_cond_broadcast(&amp.done_cond);
+}
+
+static bool on_worker_l(void)
+{
+    return amp.started && pthread_equal(amp.thread, pthread_self());
+}
+
+static void *amp_service_loop(void *context __unused)
+{
+    struct amp_task *task;
+    struct timespec ts;
+    int64_t now_ns;
+
+    audio_extn_thread_policy_apply(AUDIO_THREAD_BACKGROUND, "Amp Service");
+
+    pthread_mutex_lock(&amp.lock);
+    while (!amp.exit) {
+        if (list_empty(&amp.tasks)) {
+            pthread_cond_wait(&amp.cond, &amp.lock);
+            continue;
+        }
+        task = node_to_item(list_head(&amp.tasks), struct amp_task, list);
+        now_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (task->due_ns > now_ns) {
+            ts.tv_sec = task->due_ns / NANOS_PER_SECOND;
+            ts.tv_nsec = task->due_ns % NANOS_PER_SECOND;
+            pthread_cond_timedwait(&amp.cond, &amp.lock, &ts);
+            continue;
+        }
+        run_task_l(task);
+    }
+    pthread_mutex_unlock(&amp.lock);
+    return NULL;
+}
+
+int audio_extn_amp_task_init(struct amp_task *task, const char *name,
+                             amp_task_run_t run, void *context, size_t buffer_size)
+{
+    memset(task, 0, sizeof(*task));
+    task->name = name;
+    task->run = run;
+    task->context = context;
+    if (buffer_size > 0) {
+        task->buffer = calloc(1, buffer_size);
+        if (task->buffer == NULL) {
+            ALOGE("%s: %s: failed to allocate %zu bytes", __func__, name, buffer_size);
+            return -ENOMEM;
+        }
+        task->buffer_size = buffer_size;
+    }
+    return 0;
+}
+
+int audio_extn_amp_task_schedule(struct amp_task *task, int64_t delay_ns)
+{
+    int ret = 0;
+
+    pthread_once(&amp_once, amp_service_once);
+
+    pthread_mutex_lock(&amp.lock);
+    if (!amp.started) {
+        amp.exit = false;
+        ret = pthread_create(&amp.thread, (const pthread_attr_t *) NULL,
+                             amp_service_loop, NULL);
+        if (ret != 0) {
+            ALOGE("%s: failed to start amp service (%d)", __func__, ret);
+            pthread_mutex_unlock(&amp.lock);
+            return -ret;
+        }
+        amp.started = true;
+    }
+    task->cancelled = false;
+    dequeue_task_l(task);
+    task->due_ns = systemTime(SYSTEM_TIME_MONOTONIC) + (delay_ns > 0 ? delay_ns : 0);
+    queue_task_l(task);
+    pthread_cond_signal(&amp.cond);
+    pthread_mutex_unlock(&amp.lock);
+
+    ALOGV("%s: %s in %lld ms", __func__, task->name, (long long)(delay_ns / 1000000));
+    return 0;
+}
+
+void audio_extn_amp_task_cancel(struct amp_task *task)
+{
+    pthread_once(&amp_once, amp_service_once);
+
+    pthread_mutex_lock(&amp.lock);
+    task->cancelled = true;
+    dequeue_task_l(task);
+    /* a task cancelling itself from its run has nothing to wait for */
+    while (task->running && !on_worker_l())
+        pthread_cond_wait(&amp.done_cond, &amp.lock);
+    pthread_mutex_unlock(&amp.lock);
+}
+
+/* runs a queued task now on the caller, or waits for a running one */
+void audio_extn_amp_task_flush(struct amp_task *task)
+{
+    pthread_once(&amp_once, amp_service_once);
+
+    pthread_mutex_lock(&amp.lock);
+    while (task->running && !on_worker_l())
+        pthread_cond_wait(&amp.done_cond, &amp.lock);
+    if (task->queued)
+        run_task_l(task);
+    pthread_mutex_unlock(&amp.lock);
+}
+
+void audio_extn_amp_task_release(struct amp_task *task)
+{
+    audio_extn_amp_task_cancel(task);
+    free(task->buffer);
+    task->buffer = NULL;
+    task->buffer_size = 0;
+}
+
+void audio_extn_amp_service_deinit(void)
+{
+    pthread_once(&amp_once, amp_service_once);
+
+    pthread_mutex_lock(&amp.lock);
+    if (!amp.started) {
+        pthread_mutex_unlock(&amp.lock);
+        return;
+    }
+    ALOGW_IF(!list_empty(&amp.tasks), "%s: stopping with tasks queued", __func__);
+    amp.exit = true;
+    pthread_cond_broadcast(&amp.cond);
+    pthread_mutex_unlock(&amp.lock);
+
+    pthread_join(amp.thread, (void **) NULL);
+
+    pthread_mutex_lock(&amp.lock);
+    while (!list_empty(&amp.tasks))
+        dequeue_task_l(node_to_item(list_head(&amp.tasks), struct amp_task, list));
+    amp.started = false;
+    pthread_mutex_unlock(&amp.lock);
+}
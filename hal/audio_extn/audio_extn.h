@@ -19,6 +19,8 @@
 
 #include <cutils/str_parms.h>
 
+#include "call_trace.h"
+
 #define HW_INFO_ARRAY_MAX_SIZE 32
 
 struct snd_card_split {
@@ -43,6 +45,10 @@ void audio_extn_set_snd_card_split(const char* in_snd_card_name);
 #define audio_extn_spkr_prot_is_enabled() (false)
 #define audio_extn_get_spkr_prot_snd_device(snd_device) (snd_device)
 #define audio_extn_spkr_prot_deinit(adev)       (0)
+#define audio_extn_spkr_prot_stream_open_begin(adev) (0)
+#define audio_extn_spkr_prot_stream_open_end(adev)   (0)
+#define audio_extn_spkr_prot_screen_state_changed()  (0)
+#define audio_extn_spkr_prot_dump(fd)                (0)
 #else
 void audio_extn_spkr_prot_init(void *adev);
 int audio_extn_spkr_prot_start_processing(snd_device_t snd_device);
@@ -51,6 +57,10 @@ bool audio_extn_spkr_prot_is_enabled();
 int audio_extn_get_spkr_prot_snd_device(snd_device_t snd_device);
 void audio_extn_spkr_prot_calib_cancel(void *adev);
 void audio_extn_spkr_prot_deinit(void *adev);
+void audio_extn_spkr_prot_stream_open_begin(void *adev);
+void audio_extn_spkr_prot_stream_open_end(void *adev);
+void audio_extn_spkr_prot_screen_state_changed();
+void audio_extn_spkr_prot_dump(int fd);
 
 #endif
 
@@ -59,6 +69,7 @@ void audio_extn_spkr_prot_deinit(void *adev);
 #define audio_extn_hfp_get_usecase()                    (-1)
 #define audio_extn_hfp_set_parameters(adev, params)     (0)
 #define audio_extn_hfp_set_mic_mute(adev, state)        (0)
+#define audio_extn_hfp_deinit()                         (0)
 
 #else
 bool audio_extn_hfp_is_active(struct audio_device *adev);
@@ -68,6 +79,7 @@ audio_usecase_t audio_extn_hfp_get_usecase();
 void audio_extn_hfp_set_parameters(struct audio_device *adev,
                                     struct str_parms *parms);
 int audio_extn_hfp_set_mic_mute(struct audio_device *adev, bool state);
+void audio_extn_hfp_deinit(void);
 
 #endif
 
@@ -160,6 +172,7 @@ int audio_extn_sound_trigger_read(struct stream_in *in, void *buffer,
 #define audio_extn_a2dp_get_encoder_latency()            (0)
 #define audio_extn_a2dp_is_ready()                       (0)
 #define audio_extn_a2dp_is_suspended()                   (0)
+#define audio_extn_a2dp_dump(fd)                         (0)
 #else
 void audio_extn_a2dp_init(void *adev);
 int audio_extn_a2dp_start_playback();
@@ -173,6 +186,7 @@ void audio_extn_a2dp_get_sample_rate(int *sample_rate);
 uint32_t audio_extn_a2dp_get_encoder_latency();
 bool audio_extn_a2dp_is_ready();
 bool audio_extn_a2dp_is_suspended();
+void audio_extn_a2dp_dump(int fd);
 #endif
 
 #ifndef DSM_FEEDBACK_ENABLED
@@ -236,4 +250,179 @@ bool audio_extn_utils_resolve_config_file(char[]);
 int audio_extn_utils_get_platform_info(const char* snd_card_name,
                                        char* platform_info_file);
 int audio_extn_utils_get_snd_card_num();
+void audio_extn_utils_mixer_ctl_cache_init(struct mixer *mixer);
+void audio_extn_utils_mixer_ctl_cache_deinit(void);
+void audio_extn_utils_mixer_ctl_cache_invalidate(void);
+struct mixer_ctl *audio_extn_utils_get_mixer_ctl(struct mixer *mixer,
+                                                 const char *name);
+
+typedef enum {
+    ROUTE_TRACE_SELECT_DEVICES,
+    ROUTE_TRACE_MIXER_PATH,
+    ROUTE_TRACE_ACDB,
+    ROUTE_TRACE_BACKEND_CFG,
+    ROUTE_TRACE_SPKR_PROT,
+    ROUTE_TRACE_PHASE_MAX,
+} route_trace_phase_t;
+
+int64_t audio_extn_route_trace_begin(void);
+void audio_extn_route_trace_end(route_trace_phase_t phase, const char *name,
+                                int64_t start_ns);
+void audio_extn_route_trace_get_parameters(struct str_parms *query,
+                                           struct str_parms *reply);
+void audio_extn_route_trace_dump(int fd);
+
+int64_t audio_extn_perf_stats_cpu_ns(void);
+void audio_extn_perf_stats_log_call(audio_usecase_t usecase, int64_t wall_ns,
+                                    int64_t cpu_ns, int64_t media_ns);
+void audio_extn_perf_stats_log_start(audio_usecase_t usecase, int64_t ns);
+void audio_extn_perf_stats_log_underrun(audio_usecase_t usecase);
+void audio_extn_perf_stats_set_parameters(struct str_parms *parms);
+void audio_extn_perf_stats_get_parameters(struct str_parms *query,
+                                          struct str_parms *reply);
+void audio_extn_perf_stats_dump(int fd);
+
+typedef enum {
+    PERF_KERNEL_DOWNMIX,                 /* VOIP and in call music stereo to mono */
+    PERF_KERNEL_HAPTIC_SPLIT,
+    PERF_KERNEL_OUT_CONVERT,             /* out_convert_format() */
+    PERF_KERNEL_IN_CONVERT,              /* 24 bit capture conversion */
+    PERF_KERNEL_MAX,
+} perf_kernel_t;
+
+int64_t audio_extn_perf_stats_kernel_begin(void);
+void audio_extn_perf_stats_log_kernel(perf_kernel_t kernel, int64_t start_ns, size_t samples);
+/* one shot platform info XML parse at boot, kept across resets */
+void audio_extn_perf_stats_log_platform_info(int64_t start_ns);
+
+void *audio_extn_rt_latency_out_write(struct stream_out *out, const void *buffer,
+                                      size_t bytes);
+void audio_extn_rt_latency_in_read(struct stream_in *in, const void *buffer,
+                                   size_t bytes);
+void audio_extn_rt_latency_set_parameters(struct str_parms *parms);
+void audio_extn_rt_latency_get_parameters(struct str_parms *query,
+                                          struct str_parms *reply);
+
+void audio_extn_mmap_timing_init(struct mmap_timing *t, uint32_t rate,
+                                 uint32_t burst_frames, bool is_output,
+                                 audio_devices_t devices);
+void audio_extn_mmap_timing_save(struct mmap_timing *t);
+int32_t audio_extn_mmap_timing_recommended_frames(bool is_output, audio_devices_t devices);
+int64_t audio_extn_mmap_timing_update(struct mmap_timing *t, int64_t frames,
+                                      int64_t time_ns);
+
+struct amp_task;
+/* returns the delay in ns before the next run, negative when done */
+typedef int64_t (*amp_task_run_t)(struct amp_task *task);
+
+struct amp_task {
+    struct listnode list;
+    const char *name;
+    amp_task_run_t run;
+    void *context;
+    void *buffer;        /* allocated once, reused by every run */
+    size_t buffer_size;
+    int64_t due_ns;
+    bool queued;
+    bool running;
+    bool cancelled;
+};
+
+int audio_extn_amp_task_init(struct amp_task *task, const char *name,
+                             amp_task_run_t run, void *context, size_t buffer_size);
+int audio_extn_amp_task_schedule(struct amp_task *task, int64_t delay_ns);
+void audio_extn_amp_task_cancel(struct amp_task *task);
+void audio_extn_amp_task_flush(struct amp_task *task);
+void audio_extn_amp_task_release(struct amp_task *task);
+void audio_extn_amp_service_deinit(void);
+
+typedef enum {
+    AUDIO_THREAD_URGENT,      /* feeds a pcm in step with the mixer */
+    AUDIO_THREAD_AUDIO,       /* on the path of a stream, not per buffer */
+    AUDIO_THREAD_BACKGROUND,  /* housekeeping */
+    AUDIO_THREAD_CLASS_MAX,
+} audio_thread_class_t;
+
+/* names the calling thread and applies the policy of its class */
+void audio_extn_thread_policy_apply(audio_thread_class_t thread_class, const char *name);
+
+struct object_pool;
+struct object_pool *audio_extn_object_pool_create(const char *name, size_t object_size,
+                                                  size_t count);
+/* falls back to calloc(object_size) when the pool is empty or NULL */
+void *audio_extn_object_pool_alloc(struct object_pool *pool, size_t object_size);
+void audio_extn_object_pool_free(struct object_pool *pool, void *object);
+void audio_extn_object_pool_destroy(struct object_pool *pool);
+
+typedef void (*volume_coalescer_apply_t)(void *context);
+
+struct volume_coalescer;
+/* NULL when coalescing is disabled, the other calls accept it */
+struct volume_coalescer *audio_extn_volume_coalescer_create(const char *name,
+                                                            volume_coalescer_apply_t apply,
+                                                            void *context);
+bool audio_extn_volume_coalescer_apply_now(struct volume_coalescer *coalescer);
+bool audio_extn_volume_coalescer_take(struct volume_coalescer *coalescer);
+void audio_extn_volume_coalescer_destroy(struct volume_coalescer *coalescer);
+
+struct haptic_writer;
+struct haptic_writer *audio_extn_haptic_writer_create(struct pcm *pcm, size_t write_bytes,
+                                                      size_t frame_size);
+/* returns 0 or the error of an earlier haptic pcm_write() */
+int audio_extn_haptic_writer_push(struct haptic_writer *writer, const void *data,
+                                  size_t bytes);
+void audio_extn_haptic_writer_destroy(struct haptic_writer *writer);
+
+struct capture_resampler;
+struct capture_resampler *audio_extn_capture_resampler_create(uint32_t pcm_rate,
+                                                              uint32_t rate,
+                                                              uint32_t channels,
+                                                              size_t period_frames);
+/* reads frames at the stream rate, returns 0 or the pcm_read() error */
+int audio_extn_capture_resampler_read(struct capture_resampler *resampler, struct pcm *pcm,
+                                      void *buffer, size_t frames);
+size_t audio_extn_capture_resampler_pending_frames(struct capture_resampler *resampler);
+void audio_extn_capture_resampler_reset(struct capture_resampler *resampler);
+void audio_extn_capture_resampler_destroy(struct capture_resampler *resampler);
+
+void audio_extn_call_trace_init(void);
+void audio_extn_call_trace_deinit(void);
+void audio_extn_call_trace_set_parameters(struct str_parms *parms);
+void audio_extn_call_trace_log(call_trace_call_t call, int32_t handle,
+                               int64_t arg0, int64_t arg1,
+                               const void *data, size_t size);
+
+typedef enum {
+    METRICS_SHM_STATE_CLOSED,
+    METRICS_SHM_STATE_STANDBY,
+    METRICS_SHM_STATE_ACTIVE,
+} metrics_shm_state_t;
+
+struct metrics_shm_stream;
+void audio_extn_metrics_shm_init(void);
+void audio_extn_metrics_shm_deinit(void);
+/* NULL when disabled or out of slots, the other calls accept it */
+struct metrics_shm_stream *audio_extn_metrics_shm_open(int32_t handle, bool is_output,
+                                                       audio_usecase_t usecase);
+void audio_extn_metrics_shm_close(struct metrics_shm_stream *metrics);
+void audio_extn_metrics_shm_update(struct metrics_shm_stream *metrics,
+                                   metrics_shm_state_t state, audio_devices_t devices,
+                                   int64_t frames, int64_t xruns, double start_latency_ms,
+                                   bool error);
+
+void audio_extn_ec_ref_tap_init(void);
+void audio_extn_ec_ref_tap_deinit(void);
+int audio_extn_ec_ref_tap_get_fd(void);
+void audio_extn_ec_ref_tap_attach(int32_t handle, uint32_t sample_rate, size_t frame_size);
+void audio_extn_ec_ref_tap_detach(void);
+void audio_extn_ec_ref_tap_write(int32_t handle, const void *buffer, size_t bytes,
+                                 int64_t unplayed_frames, int64_t time_ns);
+
+void audio_extn_utils_latency_hist_log(struct latency_hist *hist, int64_t ns);
+void audio_extn_utils_latency_hist_dump(struct latency_hist *hist, int fd,
+                                        const char *name);
+void audio_extn_utils_cpufreq_init(void);
+void audio_extn_utils_underrun_log(struct underrun_log *log, int64_t frames,
+                                   audio_usecase_t usecase, audio_devices_t devices);
+void audio_extn_utils_underrun_log_dump(struct underrun_log *log, int fd);
 #endif /* AUDIO_EXTN_H */
@@ -17,10 +17,21 @@
 #define LOG_TAG "audio_hw_audiozoom"
 /*#define LOG_NDEBUG 0*/
 
+/* Zoom requests arrive continuously during a camera pinch gesture. The
+   encoded parameter for every zoom step is built once when the config is
+   parsed, and a request only records the latest step for the sender
+   thread. The sender delivers at most one step every
+   AUDIOZOOM_MIN_INTERVAL_NS, always the most recent one, and drops steps
+   already delivered for the same device and app type.
+*/
 #include <errno.h>
 #include <log/log.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <expat.h>
+#include <utils/Timers.h>
+#include <audio_utils/clock.h>
 #include <audio_hw.h>
 #include <system/audio.h>
 #include <platform_api.h>
@@ -44,6 +55,40 @@ typedef struct qdsp_audiozoom_cfg {
 
 static qdsp_audiozoom_cfg_t qdsp_audiozoom;
 
+/* zoom values are quantized to this many steps across [0, 1] */
+#define AUDIOZOOM_ZOOM_STEPS 101
+
+/* spacing between two zoom parameter sends */
+#define AUDIOZOOM_MIN_INTERVAL_NS (40 * 1000000LL)
+
+/* The encoding process in b64_ntop represents 24-bit groups of input bits
+   as output strings of 4 encoded characters. */
+#define AUDIOZOOM_BLOB_SIZE (((sizeof(float) + 2) / 3) * 4 + 1)
+
+static char zoom_blobs[AUDIOZOOM_ZOOM_STEPS][AUDIOZOOM_BLOB_SIZE];
+static bool zoom_table_ready;
+
+struct zoom_target {
+    int devid;
+    int app_type;
+    int step;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool started;
+    bool exit;
+    bool pending;
+    struct audio_device *adev;
+    struct zoom_target next;    /* latest request, valid when pending */
+    struct zoom_target sent;    /* last delivered, step -1 when none */
+    int64_t sent_ns;
+} zoom_sender;
+
+static pthread_once_t zoom_sender_once = PTHREAD_ONCE_INIT;
+
 static void start_tag(void *userdata __unused, const XML_Char *tag_name,
                       const XML_Char **attr)
 {
@@ -184,40 +229,137 @@ int audio_extn_audiozoom_set_microphone_direction(
     return 0;
 }
 
-static int audio_extn_audiozoom_set_microphone_field_dimension_zoom(
-    struct stream_in *in, float zoom)
+static void zoom_sender_init_once(void)
 {
-    struct audio_device *adev = in->dev;
-    struct str_parms *parms = str_parms_create();
-    /* The encoding process in b64_ntop represents 24-bit groups of input bits
-       as output strings of 4 encoded characters. */
-    char data[((sizeof(zoom) + 2) / 3) * 4 + 1] = {0};
-    int32_t ret;
+    pthread_condattr_t attr;
+
+    pthread_mutex_init(&zoom_sender.lock, (const pthread_mutexattr_t *) NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&zoom_sender.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    zoom_sender.sent.step = -1;
+}
 
-    if (zoom > 1.0 || zoom < 0)
-        return -EINVAL;
+static int build_zoom_table(void)
+{
+    int i;
 
-    if (qdsp_audiozoom.topo_id == 0 || qdsp_audiozoom.module_id == 0 ||
-        qdsp_audiozoom.zoom_param_id == 0)
-        return -ENOSYS;
+    for (i = 0; i < AUDIOZOOM_ZOOM_STEPS; i++) {
+        float zoom = (float)i / (AUDIOZOOM_ZOOM_STEPS - 1);
 
-    str_parms_add_int(parms, "cal_devid", in->device);
-    str_parms_add_int(parms, "cal_apptype", in->app_type_cfg.app_type);
+        if (b64_ntop((uint8_t *)&zoom, sizeof(zoom), zoom_blobs[i],
+                     sizeof(zoom_blobs[i])) <= 0) {
+            ALOGE("%s: failed to encode zoom step %d", __func__, i);
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static void send_zoom_step(struct audio_device *adev, const struct zoom_target *target)
+{
+    struct str_parms *parms = str_parms_create();
+
+    if (parms == NULL)
+        return;
+
+    str_parms_add_int(parms, "cal_devid", target->devid);
+    str_parms_add_int(parms, "cal_apptype", target->app_type);
     str_parms_add_int(parms, "cal_topoid", qdsp_audiozoom.topo_id);
     str_parms_add_int(parms, "cal_moduleid", qdsp_audiozoom.module_id);
     str_parms_add_int(parms, "cal_instanceid", qdsp_audiozoom.instance_id);
     str_parms_add_int(parms, "cal_paramid", qdsp_audiozoom.zoom_param_id);
+    str_parms_add_str(parms, "cal_data", zoom_blobs[target->step]);
 
-    ret = b64_ntop((uint8_t*)&zoom, sizeof(zoom), data, sizeof(data));
-    if (ret > 0) {
-        str_parms_add_str(parms, "cal_data", data);
+    ALOGV("%s: step %d devid %d app_type %d", __func__, target->step,
+          target->devid, target->app_type);
+    pthread_mutex_lock(&adev->lock);
+    platform_set_parameters(adev->platform, parms);
+    pthread_mutex_unlock(&adev->lock);
 
-        platform_set_parameters(adev->platform, parms);
-    } else {
-        ALOGE("%s: failed to convert data to string, ret %d", __func__, ret);
+    str_parms_destroy(parms);
+}
+
+static void *zoom_sender_loop(void *context __unused)
+{
+    struct zoom_target target;
+    struct audio_device *adev;
+    struct timespec ts;
+    int64_t due_ns;
+
+    audio_extn_thread_policy_apply(AUDIO_THREAD_BACKGROUND, "Zoom Sender");
+    pthread_mutex_lock(&zoom_sender.lock);
+    while (!zoom_sender.exit) {
+        if (!zoom_sender.pending) {
+            pthread_cond_wait(&zoom_sender.cond, &zoom_sender.lock);
+            continue;
+        }
+        due_ns = zoom_sender.sent_ns + AUDIOZOOM_MIN_INTERVAL_NS;
+        if (zoom_sender.sent_ns && due_ns > systemTime(SYSTEM_TIME_MONOTONIC)) {
+            ts.tv_sec = due_ns / NANOS_PER_SECOND;
+            ts.tv_nsec = due_ns % NANOS_PER_SECOND;
+            pthread_cond_timedwait(&zoom_sender.cond, &zoom_sender.lock, &ts);
+            continue;
+        }
+        /* recorded as sent now so a repeat of it while sending is dropped */
+        target = zoom_sender.next;
+        adev = zoom_sender.adev;
+        zoom_sender.pending = false;
+        zoom_sender.sent = target;
+        zoom_sender.sent_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+        pthread_mutex_unlock(&zoom_sender.lock);
+
+        send_zoom_step(adev, &target);
+
+        pthread_mutex_lock(&zoom_sender.lock);
     }
+    pthread_mutex_unlock(&zoom_sender.lock);
+    return NULL;
+}
 
-    str_parms_destroy(parms);
+static int audio_extn_audiozoom_set_microphone_field_dimension_zoom(
+    struct stream_in *in, float zoom, bool force)
+{
+    struct zoom_target target;
+    int ret;
+
+    if (zoom > 1.0 || zoom < 0)
+        return -EINVAL;
+
+    if (!zoom_table_ready)
+        return -ENOSYS;
+
+    target.devid = in->device;
+    target.app_type = in->app_type_cfg.app_type;
+    target.step = (int)(zoom * (AUDIOZOOM_ZOOM_STEPS - 1) + 0.5f);
+
+    pthread_once(&zoom_sender_once, zoom_sender_init_once);
+
+    pthread_mutex_lock(&zoom_sender.lock);
+    if (!zoom_sender.started) {
+        zoom_sender.exit = false;
+        ret = pthread_create(&zoom_sender.thread, (const pthread_attr_t *) NULL,
+                             zoom_sender_loop, NULL);
+        if (ret != 0) {
+            ALOGE("%s: failed to start zoom sender (%d)", __func__, ret);
+            pthread_mutex_unlock(&zoom_sender.lock);
+            return -ret;
+        }
+        zoom_sender.started = true;
+    }
+    if (force)
+        zoom_sender.sent.step = -1;
+    zoom_sender.adev = in->dev;
+    if (memcmp(&target, &zoom_sender.sent, sizeof(target)) == 0) {
+        /* back to what the DSP already has, drop anything newer */
+        zoom_sender.pending = false;
+    } else {
+        zoom_sender.next = target;
+        zoom_sender.pending = true;
+        pthread_cond_signal(&zoom_sender.cond);
+    }
+    pthread_mutex_unlock(&zoom_sender.lock);
 
     return 0;
 }
@@ -237,7 +379,7 @@ int audio_extn_audiozoom_set_microphone_field_dimension(
         return -EINVAL;
 
     if (zoom >= 0 && zoom <= 1.0)
-        return audio_extn_audiozoom_set_microphone_field_dimension_zoom(in, zoom);
+        return audio_extn_audiozoom_set_microphone_field_dimension_zoom(in, zoom, false);
 
     if (zoom >= -1.0 && zoom <= 0)
         return audio_extn_audiozoom_set_microphone_field_dimension_wide_angle(in, zoom);
@@ -245,6 +387,17 @@ int audio_extn_audiozoom_set_microphone_field_dimension(
     return 0;
 }
 
+/* the session was just set up, so the last delivered step cannot be trusted */
+int audio_extn_audiozoom_start_input_stream(struct stream_in *in)
+{
+    audio_extn_audiozoom_set_microphone_direction(in, in->direction);
+
+    if (in->zoom >= 0 && in->zoom <= 1.0)
+        return audio_extn_audiozoom_set_microphone_field_dimension_zoom(in, in->zoom, true);
+
+    return audio_extn_audiozoom_set_microphone_field_dimension_wide_angle(in, in->zoom);
+}
+
 int audio_extn_audiozoom_init()
 {
     audio_extn_audiozoom_parse_info(AUDIOZOOM_PRESET_FILE);
@@ -253,5 +406,32 @@ int audio_extn_audiozoom_init()
         __func__, qdsp_audiozoom.topo_id, qdsp_audiozoom.module_id, qdsp_audiozoom.instance_id,
         qdsp_audiozoom.zoom_param_id, qdsp_audiozoom.dir_param_id,qdsp_audiozoom.app_type);
 
+    zoom_table_ready = qdsp_audiozoom.topo_id != 0 && qdsp_audiozoom.module_id != 0 &&
+                       qdsp_audiozoom.zoom_param_id != 0 && build_zoom_table() == 0;
+
     return 0;
 }
+
+void audio_extn_audiozoom_deinit()
+{
+    pthread_once(&zoom_sender_once, zoom_sender_init_once);
+
+    pthread_mutex_lock(&zoom_sender.lock);
+    if (!zoom_sender.started) {
+        pthread_mutex_unlock(&zoom_sender.lock);
+        return;
+    }
+    zoom_sender.exit = true;
+    zoom_sender.pending = false;
+    pthread_cond_signal(&zoom_sender.cond);
+    pthread_mutex_unlock(&zoom_sender.lock);
+
+    pthread_join(zoom_sender.thread, (void **) NULL);
+
+    pthread_mutex_lock(&zoom_sender.lock);
+    zoom_sender.started = false;
+    zoom_sender.adev = NULL;
+    zoom_sender.sent.step = -1;
+    zoom_sender.sent_ns = 0;
+    pthread_mutex_unlock(&zoom_sender.lock);
+}
@@ -19,10 +19,14 @@
 
 #ifndef AUDIOZOOM_QDSP_ENABLED
 #define audio_extn_audiozoom_init()                                          (0)
+#define audio_extn_audiozoom_deinit()                                        do {} while (0)
+#define audio_extn_audiozoom_start_input_stream(stream)                      (-ENOSYS)
 #define audio_extn_audiozoom_set_microphone_direction(stream, dir)           (-ENOSYS)
 #define audio_extn_audiozoom_set_microphone_field_dimension(stream, zoom)    (-ENOSYS)
 #else
 int audio_extn_audiozoom_init();
+void audio_extn_audiozoom_deinit();
+int audio_extn_audiozoom_start_input_stream(struct stream_in *stream);
 int audio_extn_audiozoom_set_microphone_direction(struct stream_in *stream,
                                            audio_microphone_direction_t dir);
 int audio_extn_audiozoom_set_microphone_field_dimension(struct stream_in *stream, float zoom);
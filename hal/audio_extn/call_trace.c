@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_call_trace"
+/*#define LOG_NDEBUG 0*/
+
+/* Binary trace of the HAL entry points, for replaying a device's load.
+
+   With vendor.audio.call_trace set at boot, or after "call_trace=start",
+   every traced adev_*, out_* and in_* call appends a record to
+   CALL_TRACE_PATH. The file starts with a struct call_trace_header and
+   holds struct call_trace_record entries, each followed by data_size
+   bytes: the kvpairs of set_parameters, the audio_config of an open, or
+   with vendor.audio.call_trace.payload the buffer of a write. Streams are
+   identified by their io handle, so opens and closes pair up on replay.
+
+   Callers only append to a memory buffer. A full buffer is handed to a
+   background thread that writes it out, and records that find both
+   buffers busy are dropped and counted rather than blocking the caller.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <log/log.h>
+#include <cutils/properties.h>
+#include <cutils/str_parms.h>
+#include <utils/Timers.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+#define CALL_TRACE_BUFFER_SIZE (64 * 1024)
+
+#define AUDIO_PARAMETER_KEY_CALL_TRACE "call_trace"
+
+struct call_trace_buffer {
+    uint8_t data[CALL_TRACE_BUFFER_SIZE];
+    size_t used;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;         /* a buffer is full or exit requested */
+    atomic_bool enabled;
+    bool payload;
+    bool exit;
+    bool started;
+    int fd;
+    pthread_t thread;
+    struct call_trace_buffer buffers[2];
+    struct call_trace_buffer *active; /* filled by callers */
+    struct call_trace_buffer *full;   /* waiting for the writer, or NULL */
+    uint32_t dropped;
+} call_trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+};
+
+static void write_buffer(struct call_trace_buffer *b)
+{
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < b->used) {
+        ret = write(call_trace.fd, b->data + done, b->used - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("%s: write failed: %s", __func__, strerror(errno));
+            break;
+        }
+        done += ret;
+    }
+    b->used = 0;
+}
+
+static void *call_trace_loop(void *context __unused)
+{
+    struct call_trace_buffer *b;
+
+    audio_extn_thread_policy_apply(AUDIO_THREAD_BACKGROUND, "Call Trace");
+
+    pthread_mutex_lock(&call_trace.lock);
+    while (!call_trace.exit) {
+        if (call_trace.full == NULL) {
+            pthread_cond_wait(&call_trace.cond, &call_trace.lock);
+            continue;
+        }
+        b = call_trace.full;
+        pthread_mutex_unlock(&call_trace.lock);
+        write_buffer(b);
+        pthread_mutex_lock(&call_trace.lock);
+        call_trace.full = NULL;
+    }
+    pthread_mutex_unlock(&call_trace.lock);
+    return NULL;
+}
+
+static void call_trace_start(void)
+{
+    struct call_trace_header header = {
+        .magic = CALL_TRACE_MAGIC,
+        .version = CALL_TRACE_VERSION,
+    };
+    int ret;
+
+    pthread_mutex_lock(&call_trace.lock);
+    if (call_trace.started)
+        goto done;
+
+    call_trace.fd = open(CALL_TRACE_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (call_trace.fd < 0) {
+        ALOGE("%s: cannot open %s: %s", __func__, CALL_TRACE_PATH, strerror(errno));
+        goto done;
+    }
+    call_trace.active = &call_trace.buffers[0];
+    call_trace.full = NULL;
+    call_trace.active->used = 0;
+    call_trace.dropped = 0;
+    call_trace.exit = false;
+    call_trace.payload = property_get_bool("vendor.audio.call_trace.payload", false);
+
+    header.start_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    memcpy(call_trace.active->data, &header, sizeof(header));
+    call_trace.active->used = sizeof(header);
+
+    ret = pthread_create(&call_trace.thread, (const pthread_attr_t *) NULL,
+                         call_trace_loop, NULL);
+    if (ret != 0) {
+        ALOGE("%s: failed to start the trace writer (%d)", __func__, ret);
+        close(call_trace.fd);
+        call_trace.fd = -1;
+        goto done;
+    }
+    call_trace.started = true;
+    atomic_store_explicit(&call_trace.enabled, true, memory_order_release);
+    ALOGI("%s: tracing HAL calls to %s%s", __func__, CALL_TRACE_PATH,
+          call_trace.payload ? " with payload" : "");
+done:
+    pthread_mutex_unlock(&call_trace.lock);
+}
+
+static void call_trace_stop(void)
+{
+    pthread_mutex_lock(&call_trace.lock);
+    if (!call_trace.started) {
+        pthread_mutex_unlock(&call_trace.lock);
+        return;
+    }
+    atomic_store_explicit(&call_trace.enabled, false, memory_order_relaxed);
+    call_trace.exit = true;
+    pthread_cond_signal(&call_trace.cond);
+    pthread_mutex_unlock(&call_trace.lock);
+    pthread_join(call_trace.thread, (void **) NULL);
+
+    /* the writer has exited, what it left behind is written here */
+    pthread_mutex_lock(&call_trace.lock);
+    if (call_trace.full != NULL)
+        write_buffer(call_trace.full);
+    write_buffer(call_trace.active);
+    call_trace.full = NULL;
+    close(call_trace.fd);
+    call_trace.fd = -1;
+    call_trace.started = false;
+    ALOGW_IF(call_trace.dropped, "%s: %u records dropped", __func__, call_trace.dropped);
+    pthread_mutex_unlock(&call_trace.lock);
+}
+
+void audio_extn_call_trace_init(void)
+{
+    if (property_get_bool("vendor.audio.call_trace", false))
+        call_trace_start();
+}
+
+void audio_extn_call_trace_deinit(void)
+{
+    call_trace_stop();
+}
+
+void audio_extn_call_trace_set_parameters(struct str_parms *parms)
+{
+    char value[32];
+
+    if (str_parms_get_str(parms, AUDIO_PARAMETER_KEY_CALL_TRACE, value, sizeof(value)) < 0)
+        return;
+    if (strcmp(value, "start") == 0)
+        call_trace_start();
+    else if (strcmp(value, "stop") == 0)
+        call_trace_stop();
+}
+
+void audio_extn_call_trace_log(call_trace_call_t call, int32_t handle,
+                               int64_t arg0, int64_t arg1,
+                               const void *data, size_t size)
+{
+    struct call_trace_record record;
+    struct call_trace_buffer *b;
+
+    if (!atomic_load_explicit(&call_trace.enabled, memory_order_acquire))
+        return;
+
+    if (call == CALL_TRACE_OUT_WRITE && !call_trace.payload)
+        size = 0;
+    if (data == NULL)
+        size = 0;
+    else if (size > CALL_TRACE_MAX_DATA_SIZE)
+        size = CALL_TRACE_MAX_DATA_SIZE;
+
+    record.time_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.handle = handle;
+    record.call = call;
+    record.data_size = size;
+
+    pthread_mutex_lock(&call_trace.lock);
+    if (!call_trace.started)
+        goto done;
+    b = call_trace.active;
+    if (b->used + sizeof(record) + size > CALL_TRACE_BUFFER_SIZE) {
+        if (call_trace.full != NULL) {
+            call_trace.dropped++;
+            goto done;
+        }
+        call_trace.full = b;
+        b = call_trace.active = (b == &call_trace.buffers[0]) ? &call_trace.buffers[1] :
+                                                               &call_trace.buffers[0];
+        pthread_cond_signal(&call_trace.cond);
+    }
+    memcpy(b->data + b->used, &record, sizeof(record));
+    b->used += sizeof(record);
+    if (size > 0) {
+        memcpy(b->data + b->used, data, size);
+        b->used += size;
+    }
+done:
+    pthread_mutex_unlock(&call_trace.lock);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_EXTN_CALL_TRACE_H
+#define AUDIO_EXTN_CALL_TRACE_H
+
+/* On disk format of the HAL call trace, shared by the HAL and the replay
+   tool. The file starts with a struct call_trace_header followed by
+   struct call_trace_record entries, each followed by data_size bytes.
+*/
+#include <stdint.h>
+
+#define CALL_TRACE_PATH "/data/vendor/audio/hal_calls.trace"
+#define CALL_TRACE_MAGIC 0x54434841 /* "AHCT" */
+#define CALL_TRACE_VERSION 1
+/* longer data is truncated, a record always fits an empty buffer */
+#define CALL_TRACE_MAX_DATA_SIZE (16 * 1024)
+
+/* args of each record, volumes in millionths */
+typedef enum {
+    CALL_TRACE_ADEV_SET_PARAMETERS,      /* data: kvpairs */
+    CALL_TRACE_ADEV_SET_MODE,            /* mode */
+    CALL_TRACE_ADEV_SET_VOICE_VOLUME,    /* volume */
+    CALL_TRACE_ADEV_SET_MIC_MUTE,        /* state */
+    CALL_TRACE_ADEV_OPEN_OUTPUT_STREAM,  /* devices, flags, data: audio_config */
+    CALL_TRACE_ADEV_CLOSE_OUTPUT_STREAM,
+    CALL_TRACE_ADEV_OPEN_INPUT_STREAM,   /* devices, source << 32 | flags, data: audio_config */
+    CALL_TRACE_ADEV_CLOSE_INPUT_STREAM,
+    CALL_TRACE_OUT_WRITE,                /* bytes, data: optional payload */
+    CALL_TRACE_OUT_STANDBY,
+    CALL_TRACE_OUT_SET_PARAMETERS,       /* data: kvpairs */
+    CALL_TRACE_OUT_SET_VOLUME,           /* left, right */
+    CALL_TRACE_OUT_GET_PRESENTATION_POSITION,
+    CALL_TRACE_IN_READ,                  /* bytes */
+    CALL_TRACE_IN_STANDBY,
+    CALL_TRACE_IN_SET_PARAMETERS,        /* data: kvpairs */
+    CALL_TRACE_CALL_MAX,
+} call_trace_call_t;
+
+struct call_trace_header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t start_ns;            /* CLOCK_MONOTONIC */
+};
+
+struct call_trace_record {
+    int64_t time_ns;             /* CLOCK_MONOTONIC on entry */
+    int64_t args[2];             /* see call_trace_call_t */
+    int32_t handle;              /* stream io handle, 0 for the device */
+    uint16_t call;
+    uint16_t data_size;
+};
+
+#endif /* AUDIO_EXTN_CALL_TRACE_H */
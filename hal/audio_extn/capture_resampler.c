@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_capture_resampler"
+/*#define LOG_NDEBUG 0*/
+
+/* Resampler for fast capture at non native rates.
+
+   The low latency capture path only runs at the native rate, so a fast
+   client asking for another rate used to get a normal latency input and
+   AudioFlinger's resampler on top. With vendor.audio.capture.fast_resampler
+   set the pcm is opened at the native rate instead and in_read() pulls
+   periods from it through the audio_utils polyphase resampler, which keeps
+   its filter state across reads. Only 16 bit capture is resampled.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <log/log.h>
+#include <audio_utils/resampler.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+/* above RESAMPLER_QUALITY_DEFAULT, still cheap enough for a fast capture */
+#define CAPTURE_RESAMPLER_QUALITY 6
+
+struct capture_resampler {
+    struct resampler_buffer_provider provider; /* first, the callbacks cast back */
+    struct resampler_itfe *resampler;
+    struct pcm *pcm;         /* pcm of the read in progress */
+    int16_t *buffer;         /* one period read from the pcm */
+    size_t period_frames;
+    size_t frames;           /* frames in buffer */
+    size_t consumed;         /* frames of buffer handed to the resampler */
+    size_t channels;
+    int error;               /* pcm_read() failure of the read in progress */
+};
+
+static int get_next_buffer(struct resampler_buffer_provider *provider,
+                           struct resampler_buffer *buffer)
+{
+    struct capture_resampler *r = (struct capture_resampler *)provider;
+    size_t avail;
+
+    if (r->consumed == r->frames) {
+        if (pcm_read(r->pcm, r->buffer, r->period_frames * r->channels * sizeof(int16_t))) {
+            r->error = -errno;
+            buffer->raw = NULL;
+            buffer->frame_count = 0;
+            return r->error;
+        }
+        r->frames = r->period_frames;
+        r->consumed = 0;
+    }
+
+    avail = r->frames - r->consumed;
+    if (buffer->frame_count > avail)
+        buffer->frame_count = avail;
+    buffer->i16 = r->buffer + r->consumed * r->channels;
+    return 0;
+}
+
+static void release_buffer(struct resampler_buffer_provider *provider,
+                           struct resampler_buffer *buffer)
+{
+    struct capture_resampler *r = (struct capture_resampler *)provider;
+
+    r->consumed += buffer->frame_count;
+}
+
+struct capture_resampler *audio_extn_capture_resampler_create(uint32_t pcm_rate,
+                                                              uint32_t rate,
+                                                              uint32_t channels,
+                                                              size_t period_frames)
+{
+    struct capture_resampler *r;
+    int ret;
+
+    if (pcm_rate == 0 || rate == 0 || channels == 0 || period_frames == 0)
+        return NULL;
+
+    r = (struct capture_resampler *)calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    r->buffer = (int16_t *)calloc(period_frames * channels, sizeof(int16_t));
+    if (r->buffer == NULL) {
+        free(r);
+        return NULL;
+    }
+    r->period_frames = period_frames;
+    r->channels = channels;
+    r->provider.get_next_buffer = get_next_buffer;
+    r->provider.release_buffer = release_buffer;
+
+    ret = create_resampler(pcm_rate, rate, channels, CAPTURE_RESAMPLER_QUALITY,
+                           &r->provider, &r->resampler);
+    if (ret != 0) {
+        ALOGE("%s: %u -> %u Hz resampler failed (%d)", __func__, pcm_rate, rate, ret);
+        free(r->buffer);
+        free(r);
+        return NULL;
+    }
+    ALOGV("%s: %u -> %u Hz, %u channels", __func__, pcm_rate, rate, channels);
+    return r;
+}
+
+int audio_extn_capture_resampler_read(struct capture_resampler *r, struct pcm *pcm,
+                                      void *buffer, size_t frames)
+{
+    size_t out_frames = frames;
+
+    r->pcm = pcm;
+    r->error = 0;
+    r->resampler->resample_from_provider(r->resampler, (int16_t *)buffer, &out_frames);
+    r->pcm = NULL;
+    if (r->error != 0)
+        return r->error;
+    /* only short when the provider failed, but never hand back stale data */
+    if (out_frames < frames)
+        memset((int16_t *)buffer + out_frames * r->channels, 0,
+               (frames - out_frames) * r->channels * sizeof(int16_t));
+    return 0;
+}
+
+/* frames read from the pcm that the resampler has not consumed yet */
+size_t audio_extn_capture_resampler_pending_frames(struct capture_resampler *r)
+{
+    return r->frames - r->consumed;
+}
+
+/* drops the buffered period and the filter history, for standby */
+void audio_extn_capture_resampler_reset(struct capture_resampler *r)
+{
+    r->frames = 0;
+    r->consumed = 0;
+    r->resampler->reset(r->resampler);
+}
+
+void audio_extn_capture_resampler_destroy(struct capture_resampler *r)
+{
+    if (r == NULL)
+        return;
+    release_resampler(r->resampler);
+    free(r->buffer);
+    free(r);
+}
@@ -40,9 +40,20 @@
 struct cirrus_playback_session {
     void *adev_handle;
     pthread_mutex_t fb_prot_mutex;
-    pthread_t calibration_thread;
+    /* calibration/config and failure detection run on the amp service */
+    struct amp_task calibration_task;
+#ifdef CIRRUS_FACTORY_CALIBRATION
+    uint32_t platform_retries;
+#endif
 #ifdef ENABLE_CIRRUS_DETECTION
-    pthread_t failure_detect_thread;
+    struct amp_task failure_detect_task;
+    struct mixer_ctl *fail_det_ctl;
+    int fail_det_file;
+    bool fail_det_monitoring;
+    bool left_cal_done;
+    bool right_cal_done;
+    int ambL;
+    int ambR;
 #endif
     struct pcm *pcm_rx;
     struct pcm *pcm_tx;
@@ -116,8 +127,9 @@ struct crus_rx_run_case_ctrl_t {
 
 #define CRUS_AFE_PARAM_ID_ENABLE 0x00010203
 
-#define FAIL_DETECT_INIT_WAIT_US 500000
-#define FAIL_DETECT_LOOP_WAIT_US 300000
+#define FAIL_DETECT_INIT_WAIT_NS (500 * 1000000LL)
+#define FAIL_DETECT_LOOP_WAIT_NS (300 * 1000000LL)
+#define PLATFORM_WAIT_NS (1000 * 1000000LL)
 
 #define CRUS_DEFAULT_CAL_L 0x2A11
 #define CRUS_DEFAULT_CAL_R 0x29CB
@@ -156,19 +168,22 @@ static struct pcm_config pcm_config_cirrus_rx = {
 static struct cirrus_playback_session handle;
 
 #ifdef CIRRUS_FACTORY_CALIBRATION
-static void *audio_extn_cirrus_calibration_thread();
+static int64_t audio_extn_cirrus_calibration_run(struct amp_task *task);
 #else
-static void *audio_extn_cirrus_config_thread();
+static int64_t audio_extn_cirrus_config_run(struct amp_task *task);
 #endif
 
 #ifdef ENABLE_CIRRUS_DETECTION
-static void *audio_extn_cirrus_failure_detect_thread();
+static int64_t audio_extn_cirrus_failure_detect_run(struct amp_task *task);
 #endif
 
 void audio_extn_spkr_prot_init(void *adev) {
     ALOGI("%s: Initialize Cirrus Logic Playback module", __func__);
 
     memset(&handle, 0, sizeof(handle));
+#ifdef ENABLE_CIRRUS_DETECTION
+    handle.fail_det_file = -1;
+#endif
     if (!adev) {
         ALOGE("%s: Invalid params", __func__);
         return;
@@ -179,38 +194,49 @@ void audio_extn_spkr_prot_init(void *adev) {
 
     pthread_mutex_init(&handle.fb_prot_mutex, NULL);
 
+#ifdef ENABLE_CIRRUS_DETECTION
+    (void)audio_extn_amp_task_init(&handle.failure_detect_task, "cirrus_failure_detect",
+                                   audio_extn_cirrus_failure_detect_run, &handle,
+                                   CRUS_PARAM_TEMP_MAX_LENGTH);
+#endif
+
 #ifdef CIRRUS_FACTORY_CALIBRATION
-    (void)pthread_create(&handle.calibration_thread,
-                (const pthread_attr_t *) NULL,
-                audio_extn_cirrus_calibration_thread, &handle);
+    handle.platform_retries = 5;
+    (void)audio_extn_amp_task_init(&handle.calibration_task, "cirrus_calibration",
+                                   audio_extn_cirrus_calibration_run, &handle,
+                                   CRUS_PARAM_TEMP_MAX_LENGTH);
 #else
-    (void)pthread_create(&handle.calibration_thread,
-                (const pthread_attr_t *) NULL,
-                audio_extn_cirrus_config_thread, &handle);
+    (void)audio_extn_amp_task_init(&handle.calibration_task, "cirrus_config",
+                                   audio_extn_cirrus_config_run, &handle, 0);
 #endif
+    (void)audio_extn_amp_task_schedule(&handle.calibration_task, 0);
 }
 
 void audio_extn_spkr_prot_deinit(void *adev __unused) {
     ALOGV("%s: Entry", __func__);
 
 #ifdef ENABLE_CIRRUS_DETECTION
-    pthread_join(handle.failure_detect_thread, NULL);
+    audio_extn_amp_task_release(&handle.failure_detect_task);
+    if (handle.fail_det_file >= 0) {
+        close(handle.fail_det_file);
+        handle.fail_det_file = -1;
+    }
 #endif
-    pthread_join(handle.calibration_thread, NULL);
+    audio_extn_amp_task_release(&handle.calibration_task);
+    audio_extn_amp_service_deinit();
     pthread_mutex_destroy(&handle.fb_prot_mutex);
 
     ALOGV("%s: Exit", __func__);
 }
 
 #ifdef CIRRUS_FACTORY_CALIBRATION
-static int audio_extn_cirrus_run_calibration() {
+static int audio_extn_cirrus_run_calibration(char *buffer) {
     struct audio_device *adev = handle.adev_handle;
     struct crus_sp_ioctl_header header;
     struct cirrus_cal_result_t result;
     struct mixer_ctl *ctl = NULL;
     FILE *cal_file = NULL;
     int ret = 0, dev_file = -1;
-    char *buffer = NULL;
     uint32_t option = 1;
 
     ALOGI("%s: Running speaker calibration", __func__);
@@ -223,9 +249,8 @@ static int audio_extn_cirrus_run_calibration() {
         goto exit;
     }
 
-    buffer = calloc(1, CRUS_PARAM_TEMP_MAX_LENGTH);
     if (!buffer) {
-        ALOGE("%s: allocate memory failed", __func__);
+        ALOGE("%s: no temperature buffer", __func__);
         ret = -ENOMEM;
         goto exit;
     }
@@ -378,7 +403,6 @@ static int audio_extn_cirrus_run_calibration() {
 exit:
     if (dev_file >= 0)
         close(dev_file);
-    free(buffer);
     ALOGV("%s: Exit", __func__);
 
     return ret;
@@ -455,47 +479,48 @@ exit:
     return ret;
 }
 
-static void *audio_extn_cirrus_calibration_thread() {
+static int64_t audio_extn_cirrus_calibration_run(struct amp_task *task) {
     struct audio_device *adev = handle.adev_handle;
     struct audio_usecase *uc_info_rx = NULL;
     int ret = 0;
     int32_t pcm_dev_rx_id, prev_state;
-    uint32_t retries = 5;
-
-    ALOGI("%s: PCM Stream thread", __func__);
 
-    while (!adev->platform && retries) {
-        sleep(1);
+    if (!adev->platform && handle.platform_retries) {
         ALOGI("%s: Waiting...", __func__);
-        retries--;
+        handle.platform_retries--;
+        return PLATFORM_WAIT_NS;
     }
 
+    ALOGI("%s: PCM Stream", __func__);
+
     prev_state = handle.state;
     handle.state = CALIBRATING;
 
-    uc_info_rx = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    uc_info_rx = alloc_usecase(adev);
     if (!uc_info_rx) {
         ALOGE("%s: rx usecase can not be found", __func__);
         goto exit;
     }
-    pthread_mutex_lock(&adev->lock);
 
+    /* adev->lock only covers the routing; the PCM belongs to this task and
+       the calibration sleeps for seconds, so neither holds the lock */
+    pthread_mutex_lock(&adev->lock);
     uc_info_rx->id = USECASE_AUDIO_PLAYBACK_DEEP_BUFFER;
     uc_info_rx->type = PCM_PLAYBACK;
     uc_info_rx->in_snd_device = SND_DEVICE_NONE;
     uc_info_rx->stream.out = adev->primary_output;
     uc_info_rx->out_snd_device = SND_DEVICE_OUT_SPEAKER;
-    list_add_tail(&adev->usecase_list, &uc_info_rx->list);
+    add_usecase_to_list(adev, uc_info_rx);
 
     enable_snd_device(adev, SND_DEVICE_OUT_SPEAKER);
     enable_audio_route(adev, uc_info_rx);
-    pcm_dev_rx_id = platform_get_pcm_device_id(uc_info_rx->id, PCM_PLAYBACK);
+    pthread_mutex_unlock(&adev->lock);
 
+    pcm_dev_rx_id = platform_get_pcm_device_id(uc_info_rx->id, PCM_PLAYBACK);
     if (pcm_dev_rx_id < 0) {
         ALOGE("%s: Invalid pcm device for usecase (%d)",
               __func__, uc_info_rx->id);
-        pthread_mutex_unlock(&adev->lock);
-        goto exit;
+        goto close_stream;
     }
 
     handle.pcm_rx = pcm_open(adev->snd_card, pcm_dev_rx_id,
@@ -504,56 +529,49 @@ static void *audio_extn_cirrus_calibration_thread() {
     if (handle.pcm_rx && !pcm_is_ready(handle.pcm_rx)) {
         ALOGE("%s: PCM device not ready: %s", __func__,
               pcm_get_error(handle.pcm_rx));
-        pthread_mutex_unlock(&adev->lock);
         goto close_stream;
     }
 
     if (pcm_start(handle.pcm_rx) < 0) {
         ALOGE("%s: pcm start for RX failed; error = %s", __func__,
               pcm_get_error(handle.pcm_rx));
-        pthread_mutex_unlock(&adev->lock);
         goto close_stream;
     }
-    pthread_mutex_unlock(&adev->lock);
     ALOGI("%s: PCM thread streaming", __func__);
 
-    ret = audio_extn_cirrus_run_calibration();
+    ret = audio_extn_cirrus_run_calibration((char *)task->buffer);
     ALOGE_IF(ret < 0, "%s: Calibration procedure failed (%d)", __func__, ret);
 
     ret = audio_extn_cirrus_load_usecase_configs();
     ALOGE_IF(ret < 0, "%s: Set tuning configs failed (%d)", __func__, ret);
 
 close_stream:
-    pthread_mutex_lock(&adev->lock);
     if (handle.pcm_rx) {
         ALOGI("%s: pcm_rx_close", __func__);
         pcm_close(handle.pcm_rx);
         handle.pcm_rx = NULL;
     }
+    pthread_mutex_lock(&adev->lock);
     disable_audio_route(adev, uc_info_rx);
     disable_snd_device(adev, SND_DEVICE_OUT_SPEAKER);
-    list_remove(&uc_info_rx->list);
-    free(uc_info_rx);
+    remove_usecase_from_list(adev, uc_info_rx);
+    free_usecase(adev, uc_info_rx);
     pthread_mutex_unlock(&adev->lock);
 exit:
     handle.state = (prev_state == PLAYBACK) ? PLAYBACK : IDLE;
 
 #ifdef ENABLE_CIRRUS_DETECTION
     if (handle.state == PLAYBACK)
-        (void)pthread_create(&handle.failure_detect_thread,
-                    (const pthread_attr_t *) NULL,
-                    audio_extn_cirrus_failure_detect_thread,
-                    &handle);
+        (void)audio_extn_amp_task_schedule(&handle.failure_detect_task,
+                                           FAIL_DETECT_INIT_WAIT_NS);
 #endif
 
     ALOGV("%s: Exit", __func__);
-
-    pthread_exit(0);
-    return NULL;
+    return -1;
 }
 
 #else
-static void *audio_extn_cirrus_config_thread(void) {
+static int64_t audio_extn_cirrus_config_run(struct amp_task *task __unused) {
     struct audio_device *adev = handle.adev_handle;
     struct crus_sp_ioctl_header header;
     struct cirrus_cal_result_t result;
@@ -631,48 +649,37 @@ exit:
         fclose(cal_file);
 
     ALOGI("%s: ret: %d --", __func__, ret);
-    return NULL;
+    return -1;
 }
 #endif
 
 #ifdef ENABLE_CIRRUS_DETECTION
-void *audio_extn_cirrus_failure_detect_thread() {
+static void audio_extn_cirrus_failure_detect_stop(void) {
+    if (handle.fail_det_file >= 0)
+        close(handle.fail_det_file);
+    handle.fail_det_file = -1;
+    handle.fail_det_monitoring = false;
+    ALOGI("%s: Exit ", __func__);
+}
+
+/* reads the calibration results the first time, then polls every
+   FAIL_DETECT_LOOP_WAIT_NS for as long as playback and detection last */
+static int64_t audio_extn_cirrus_failure_detect_run(struct amp_task *task) {
     struct audio_device *adev = handle.adev_handle;
     struct crus_sp_ioctl_header header;
-    struct mixer_ctl *ctl = NULL;
     const int32_t r_scale_factor = 100000000;
     const int32_t t_scale_factor = 100000;
     const int32_t r_err_range = 70000000;
     const int32_t t_err_range = 210000;
     const int32_t amp_factor = 71498;
     const int32_t material = 250;
-    int32_t *buffer = NULL;
-    int ret = 0, dev_file = -1, out_cal0 = 0, out_cal1 = 0;
+    int32_t *buffer = (int32_t *)task->buffer;
+    int ret = 0, out_cal0 = 0, out_cal1 = 0;
     int rL = 0, rR = 0, zL = 0, zR = 0, tL = 0, tR = 0;
-    int rdL = 0, rdR = 0, tdL = 0, tdR = 0, ambL = 0, ambR = 0;
-    bool left_cal_done = false, right_cal_done = false;
-    bool det_en = false;
+    int rdL = 0, rdR = 0, tdL = 0, tdR = 0;
 
-    ALOGI("%s: Entry", __func__);
-
-    ctl = mixer_get_ctl_by_name(adev->mixer, CRUS_SP_FAIL_DET_MIXER);
-    det_en = mixer_ctl_get_value(ctl, 0);
-
-    if (!det_en)
-        goto exit;
-
-    dev_file = open(CRUS_SP_FILE, O_RDWR | O_NONBLOCK);
-    if (dev_file < 0) {
-        ALOGE("%s: Failed to open Cirrus Playback IOCTL (%d)",
-                __func__, dev_file);
-        goto exit;
-    }
-
-    buffer = calloc(1, CRUS_PARAM_TEMP_MAX_LENGTH);
-    if (!buffer) {
-        ALOGE("%s: allocate memory failed", __func__);
-        goto exit;
-    }
+    if (!buffer || handle.state != PLAYBACK)
+        goto stop;
 
     header.size = sizeof(header);
     header.module_id = CRUS_MODULE_ID_RX;
@@ -680,62 +687,17 @@ void *audio_extn_cirrus_failure_detect_thread() {
     header.data_length = CRUS_PARAM_TEMP_MAX_LENGTH;
     header.data = buffer;
 
-    usleep(FAIL_DETECT_INIT_WAIT_US);
-
-    pthread_mutex_lock(&handle.fb_prot_mutex);
-    ret = ioctl(dev_file, CRUS_SP_IOCTL_GET, &header);
-    pthread_mutex_unlock(&handle.fb_prot_mutex);
-    if (ret < 0) {
-        ALOGE("%s: Cirrus SP IOCTL failure (%d)",
-               __func__, ret);
-        goto exit;
-    }
-
-    zL = buffer[2] * amp_factor;
-    zR = buffer[4] * amp_factor;
-
-    ambL = buffer[10];
-    ambR = buffer[6];
-
-    out_cal0 = buffer[12];
-    out_cal1 = buffer[13];
-
-    left_cal_done = (out_cal0 == 2) && (out_cal1 == 2) &&
-                    (buffer[2] != CRUS_DEFAULT_CAL_L);
-
-    out_cal0 = buffer[14];
-    out_cal1 = buffer[15];
-
-    right_cal_done = (out_cal0 == 2) && (out_cal1 == 2) &&
-                     (buffer[4] != CRUS_DEFAULT_CAL_R);
-
-    if (left_cal_done) {
-        ALOGI("%s: L Speaker Impedance: %d.%08d ohms", __func__,
-              zL / r_scale_factor, abs(zL) % r_scale_factor);
-        ALOGI("%s: L Calibration Temperature: %d C", __func__, ambL);
-    } else
-        ALOGE("%s: Left speaker uncalibrated", __func__);
-
-    if (right_cal_done) {
-        ALOGI("%s: R Speaker Impedance: %d.%08d ohms", __func__,
-               zR / r_scale_factor, abs(zR) % r_scale_factor);
-        ALOGI("%s: R Calibration Temperature: %d C", __func__, ambR);
-    } else
-        ALOGE("%s: Right speaker uncalibrated", __func__);
-
-    if (!left_cal_done && !right_cal_done)
-        goto exit;
+    if (handle.fail_det_monitoring) {
+        if (!mixer_ctl_get_value(handle.fail_det_ctl, 0))
+            goto stop;
 
-    ALOGI("%s: Monitoring speaker impedance & temperature...", __func__);
-
-    while ((handle.state == PLAYBACK) && det_en) {
         pthread_mutex_lock(&handle.fb_prot_mutex);
-        ret = ioctl(dev_file, CRUS_SP_IOCTL_GET, &header);
+        ret = ioctl(handle.fail_det_file, CRUS_SP_IOCTL_GET, &header);
         pthread_mutex_unlock(&handle.fb_prot_mutex);
         if (ret < 0) {
             ALOGE("%s: Cirrus SP IOCTL failure (%d)",
                   __func__, ret);
-            goto loop;
+            return FAIL_DETECT_LOOP_WAIT_NS;
         }
 
         rL = buffer[3];
@@ -745,7 +707,7 @@ void *audio_extn_cirrus_failure_detect_thread() {
         zR = buffer[4];
 
         if ((zL == 0) || (zR == 0))
-            goto loop;
+            return FAIL_DETECT_LOOP_WAIT_NS;
 
         tdL = (material * t_scale_factor * (rL-zL) / zL);
         tdR = (material * t_scale_factor * (rR-zR) / zR);
@@ -756,45 +718,101 @@ void *audio_extn_cirrus_failure_detect_thread() {
         zL *= amp_factor;
         zR *= amp_factor;
 
-        tL = tdL + (ambL * t_scale_factor);
-        tR = tdR + (ambR * t_scale_factor);
+        tL = tdL + (handle.ambL * t_scale_factor);
+        tR = tdR + (handle.ambR * t_scale_factor);
 
         rdL = abs(zL - rL);
         rdR = abs(zR - rR);
 
-        if (left_cal_done && (rL != 0) && (rdL > r_err_range))
+        if (handle.left_cal_done && (rL != 0) && (rdL > r_err_range))
             ALOGI("%s: Left speaker impedance out of range (%d.%08d ohms)",
                   __func__, rL / r_scale_factor,
                   abs(rL % r_scale_factor));
 
-        if (right_cal_done && (rR != 0) && (rdR > r_err_range))
+        if (handle.right_cal_done && (rR != 0) && (rdR > r_err_range))
             ALOGI("%s: Right speaker impedance out of range (%d.%08d ohms)",
                   __func__, rR / r_scale_factor,
                   abs(rR % r_scale_factor));
 
-        if (left_cal_done && (rL != 0) && (tdL > t_err_range))
+        if (handle.left_cal_done && (rL != 0) && (tdL > t_err_range))
             ALOGI("%s: Left speaker temperature out of range (%d.%05d C)",
                   __func__, tL / t_scale_factor,
                   abs(tL % t_scale_factor));
 
-        if (right_cal_done && (rR != 0) && (tdR > t_err_range))
+        if (handle.right_cal_done && (rR != 0) && (tdR > t_err_range))
             ALOGI("%s: Right speaker temperature out of range (%d.%05d C)",
                   __func__, tR / t_scale_factor,
                   abs(tR % t_scale_factor));
 
-loop:
-        det_en = mixer_ctl_get_value(ctl, 0);
-        usleep(FAIL_DETECT_LOOP_WAIT_US);
+        return FAIL_DETECT_LOOP_WAIT_NS;
     }
 
-exit:
-    if (dev_file >= 0)
-        close(dev_file);
-    free(buffer);
-    ALOGI("%s: Exit ", __func__);
+    ALOGI("%s: Entry", __func__);
+
+    handle.fail_det_ctl = mixer_get_ctl_by_name(adev->mixer, CRUS_SP_FAIL_DET_MIXER);
+    if (!handle.fail_det_ctl || !mixer_ctl_get_value(handle.fail_det_ctl, 0))
+        goto stop;
+
+    if (handle.fail_det_file < 0) {
+        handle.fail_det_file = open(CRUS_SP_FILE, O_RDWR | O_NONBLOCK);
+        if (handle.fail_det_file < 0) {
+            ALOGE("%s: Failed to open Cirrus Playback IOCTL (%d)",
+                    __func__, handle.fail_det_file);
+            goto stop;
+        }
+    }
+
+    pthread_mutex_lock(&handle.fb_prot_mutex);
+    ret = ioctl(handle.fail_det_file, CRUS_SP_IOCTL_GET, &header);
+    pthread_mutex_unlock(&handle.fb_prot_mutex);
+    if (ret < 0) {
+        ALOGE("%s: Cirrus SP IOCTL failure (%d)",
+               __func__, ret);
+        goto stop;
+    }
+
+    zL = buffer[2] * amp_factor;
+    zR = buffer[4] * amp_factor;
+
+    handle.ambL = buffer[10];
+    handle.ambR = buffer[6];
+
+    out_cal0 = buffer[12];
+    out_cal1 = buffer[13];
+
+    handle.left_cal_done = (out_cal0 == 2) && (out_cal1 == 2) &&
+                           (buffer[2] != CRUS_DEFAULT_CAL_L);
+
+    out_cal0 = buffer[14];
+    out_cal1 = buffer[15];
+
+    handle.right_cal_done = (out_cal0 == 2) && (out_cal1 == 2) &&
+                            (buffer[4] != CRUS_DEFAULT_CAL_R);
+
+    if (handle.left_cal_done) {
+        ALOGI("%s: L Speaker Impedance: %d.%08d ohms", __func__,
+              zL / r_scale_factor, abs(zL) % r_scale_factor);
+        ALOGI("%s: L Calibration Temperature: %d C", __func__, handle.ambL);
+    } else
+        ALOGE("%s: Left speaker uncalibrated", __func__);
+
+    if (handle.right_cal_done) {
+        ALOGI("%s: R Speaker Impedance: %d.%08d ohms", __func__,
+               zR / r_scale_factor, abs(zR) % r_scale_factor);
+        ALOGI("%s: R Calibration Temperature: %d C", __func__, handle.ambR);
+    } else
+        ALOGE("%s: Right speaker uncalibrated", __func__);
+
+    if (!handle.left_cal_done && !handle.right_cal_done)
+        goto stop;
+
+    ALOGI("%s: Monitoring speaker impedance & temperature...", __func__);
+    handle.fail_det_monitoring = true;
+    return FAIL_DETECT_LOOP_WAIT_NS;
 
-    pthread_exit(0);
-    return NULL;
+stop:
+    audio_extn_cirrus_failure_detect_stop();
+    return -1;
 }
 #endif
 
@@ -810,7 +828,7 @@ int audio_extn_spkr_prot_start_processing(snd_device_t snd_device) {
         return -EINVAL;
     }
 
-    uc_info_tx = (struct audio_usecase *)calloc(1, sizeof(*uc_info_tx));
+    uc_info_tx = alloc_usecase(adev);
     if (!uc_info_tx) {
         ALOGE("%s: allocate memory failed", __func__);
         return -ENOMEM;
@@ -826,7 +844,7 @@ int audio_extn_spkr_prot_start_processing(snd_device_t snd_device) {
     uc_info_tx->out_snd_device = SND_DEVICE_NONE;
     handle.pcm_tx = NULL;
 
-    list_add_tail(&adev->usecase_list, &uc_info_tx->list);
+    add_usecase_to_list(adev, uc_info_tx);
 
     enable_snd_device(adev, SND_DEVICE_IN_CAPTURE_VI_FEEDBACK);
     enable_audio_route(adev, uc_info_tx);
@@ -858,11 +876,10 @@ int audio_extn_spkr_prot_start_processing(snd_device_t snd_device) {
     }
 
 #ifdef ENABLE_CIRRUS_DETECTION
+    /* a monitor still running from the last playback just carries on */
     if (handle.state == IDLE)
-        (void)pthread_create(&handle.failure_detect_thread,
-                    (const pthread_attr_t *) NULL,
-                    audio_extn_cirrus_failure_detect_thread,
-                    &handle);
+        (void)audio_extn_amp_task_schedule(&handle.failure_detect_task,
+                                           FAIL_DETECT_INIT_WAIT_NS);
 #endif
 
     handle.state = PLAYBACK;
@@ -877,8 +894,8 @@ exit:
 
         disable_audio_route(adev, uc_info_tx);
         disable_snd_device(adev, SND_DEVICE_IN_CAPTURE_VI_FEEDBACK);
-        list_remove(&uc_info_tx->list);
-        free(uc_info_tx);
+        remove_usecase_from_list(adev, uc_info_tx);
+        free_usecase(adev, uc_info_tx);
     }
 
     pthread_mutex_unlock(&handle.fb_prot_mutex);
@@ -906,8 +923,8 @@ void audio_extn_spkr_prot_stop_processing(snd_device_t snd_device) {
 
         disable_audio_route(adev, uc_info_tx);
         disable_snd_device(adev, SND_DEVICE_IN_CAPTURE_VI_FEEDBACK);
-        list_remove(&uc_info_tx->list);
-        free(uc_info_tx);
+        remove_usecase_from_list(adev, uc_info_tx);
+        free_usecase(adev, uc_info_tx);
 
         audio_route_reset_path(adev->audio_route,
                                platform_get_snd_device_name(snd_device));
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_ec_ref_tap"
+/*#define LOG_NDEBUG 0*/
+
+/* Echo reference for software AEC, without a loopback capture.
+
+   With vendor.audio.ec_ref_tap set, adev_open() creates an ashmem region.
+   While a capture stream has the echo reference routed, the output chosen
+   as reference copies each buffer it writes into the region, so an AEC
+   running in the HAL process can read the far end signal straight from
+   the shared mapping instead of opening a second PCM. The capture stream
+   returns the region fd for the "ec_ref_tap" key of get_parameters; the
+   fd is only valid in this process.
+
+   The region is a struct ec_ref_tap_header followed at data_offset by a
+   ring of data_size bytes holding whole frames of the reference output in
+   its own format. Frame p (counted from start_pos) is at byte
+   ((p - start_pos) % (data_size / frame_size)) * frame_size of the ring,
+   and was presented at about anchor_ns + (p - anchor_pos) / sample_rate
+   seconds, on the CLOCK_MONOTONIC timeline of the capture timestamps.
+   The header and the ring are covered by a seqlock: a reader copies what
+   it needs and retries when seq was odd or changed meanwhile.
+*/
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <log/log.h>
+#include <cutils/ashmem.h>
+#include <cutils/properties.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+#include "seqlock.h"
+
+#define EC_REF_TAP_MAGIC 0x52434541 /* "AECR" */
+#define EC_REF_TAP_VERSION 1
+#define EC_REF_TAP_DATA_OFFSET 4096
+/* about 1.3 s of 48 kHz stereo 16 bit */
+#define EC_REF_TAP_DATA_SIZE (256 * 1024)
+
+struct ec_ref_tap_header {
+    uint32_t magic;
+    uint32_t version;
+    atomic_uint seq;             /* odd while the header or ring changes */
+    uint32_t data_offset;        /* start of the ring in the region */
+    uint32_t data_size;
+    int32_t handle;              /* io handle of the reference output, 0 for none */
+    uint32_t sample_rate;
+    uint32_t frame_size;         /* bytes, 0 while no output is attached */
+    uint64_t start_pos;          /* first frame of the current output */
+    uint64_t write_pos;          /* frames written since the region was created */
+    uint64_t anchor_pos;         /* frame presented at anchor_ns */
+    int64_t anchor_ns;           /* 0 until the output reports a position */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    atomic_int handle;           /* read without the lock on every write */
+    int fd;
+    size_t size;
+    struct ec_ref_tap_header *header;
+    uint8_t *data;
+    uint32_t capacity;           /* frames in the ring */
+} tap = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+void audio_extn_ec_ref_tap_init(void)
+{
+    void *map;
+
+    if (!property_get_bool("vendor.audio.ec_ref_tap", false))
+        return;
+
+    pthread_mutex_lock(&tap.lock);
+    if (tap.header != NULL)
+        goto done;
+
+    tap.size = EC_REF_TAP_DATA_OFFSET + EC_REF_TAP_DATA_SIZE;
+    tap.fd = ashmem_create_region("audio_hw_ec_ref_tap", tap.size);
+    if (tap.fd < 0) {
+        ALOGE("%s: cannot create region: %s", __func__, strerror(errno));
+        goto done;
+    }
+    map = mmap(NULL, tap.size, PROT_READ | PROT_WRITE, MAP_SHARED, tap.fd, 0);
+    if (map == MAP_FAILED) {
+        ALOGE("%s: mmap failed: %s", __func__, strerror(errno));
+        close(tap.fd);
+        tap.fd = -1;
+        goto done;
+    }
+    tap.header = (struct ec_ref_tap_header *)map;
+    tap.data = (uint8_t *)map + EC_REF_TAP_DATA_OFFSET;
+    tap.header->data_offset = EC_REF_TAP_DATA_OFFSET;
+    tap.header->data_size = EC_REF_TAP_DATA_SIZE;
+    tap.header->version = EC_REF_TAP_VERSION;
+    /* a reader seeing the magic sees a complete header */
+    atomic_thread_fence(memory_order_release);
+    tap.header->magic = EC_REF_TAP_MAGIC;
+    ALOGI("%s: %d byte echo reference ring", __func__, EC_REF_TAP_DATA_SIZE);
+done:
+    pthread_mutex_unlock(&tap.lock);
+}
+
+void audio_extn_ec_ref_tap_deinit(void)
+{
+    pthread_mutex_lock(&tap.lock);
+    if (tap.header != NULL) {
+        atomic_store_explicit(&tap.handle, 0, memory_order_relaxed);
+        munmap(tap.header, tap.size);
+        tap.header = NULL;
+        tap.data = NULL;
+        close(tap.fd);
+        tap.fd = -1;
+    }
+    pthread_mutex_unlock(&tap.lock);
+}
+
+/* -ENODEV when the tap is disabled */
+int audio_extn_ec_ref_tap_get_fd(void)
+{
+    return tap.fd >= 0 ? tap.fd : -ENODEV;
+}
+
+/* handle, sample_rate and frame_size of the output now used as echo reference */
+void audio_extn_ec_ref_tap_attach(int32_t handle, uint32_t sample_rate, size_t frame_size)
+{
+    struct ec_ref_tap_header *h;
+
+    if (frame_size == 0 || frame_size > EC_REF_TAP_DATA_SIZE)
+        return;
+
+    pthread_mutex_lock(&tap.lock);
+    h = tap.header;
+    if (h == NULL)
+        goto done;
+    if (h->handle == handle && h->sample_rate == sample_rate && h->frame_size == frame_size)
+        goto done;
+    audio_extn_seqlock_write_begin(&h->seq);
+    h->handle = handle;
+    h->sample_rate = sample_rate;
+    h->frame_size = frame_size;
+    h->start_pos = h->write_pos;
+    h->anchor_pos = h->write_pos;
+    h->anchor_ns = 0;
+    audio_extn_seqlock_write_end(&h->seq);
+    tap.capacity = EC_REF_TAP_DATA_SIZE / frame_size;
+    atomic_store_explicit(&tap.handle, handle, memory_order_relaxed);
+    ALOGV("%s: handle %d, %u Hz, %zu byte frames", __func__, handle, sample_rate, frame_size);
+done:
+    pthread_mutex_unlock(&tap.lock);
+}
+
+void audio_extn_ec_ref_tap_detach(void)
+{
+    pthread_mutex_lock(&tap.lock);
+    if (tap.header != NULL && tap.header->handle != 0) {
+        atomic_store_explicit(&tap.handle, 0, memory_order_relaxed);
+        audio_extn_seqlock_write_begin(&tap.header->seq);
+        tap.header->handle = 0;
+        audio_extn_seqlock_write_end(&tap.header->seq);
+    }
+    pthread_mutex_unlock(&tap.lock);
+}
+
+/*
+ * Called with the output stream lock held for each buffer the output is
+ * about to write, still in the client format the output was attached with.
+ * unplayed_frames of the output, the last of them ending this buffer, were
+ * still to be presented at time_ns, the last position the output reported;
+ * time_ns is 0 when unknown.
+ */
+void audio_extn_ec_ref_tap_write(int32_t handle, const void *buffer, size_t bytes,
+                                 int64_t unplayed_frames, int64_t time_ns)
+{
+    struct ec_ref_tap_header *h;
+    const uint8_t *src = (const uint8_t *)buffer;
+    size_t frames, index, chunk;
+
+    if (handle == 0 || atomic_load_explicit(&tap.handle, memory_order_relaxed) != handle)
+        return;
+
+    pthread_mutex_lock(&tap.lock);
+    h = tap.header;
+    if (h == NULL || h->handle != handle)
+        goto done;
+
+    frames = bytes / h->frame_size;
+    audio_extn_seqlock_write_begin(&h->seq);
+    /* a buffer longer than the ring only leaves its tail */
+    if (frames > tap.capacity) {
+        src += (frames - tap.capacity) * h->frame_size;
+        h->write_pos += frames - tap.capacity;
+        frames = tap.capacity;
+    }
+    index = (h->write_pos - h->start_pos) % tap.capacity;
+    chunk = tap.capacity - index;
+    if (chunk > frames)
+        chunk = frames;
+    memcpy(tap.data + index * h->frame_size, src, chunk * h->frame_size);
+    if (frames > chunk)
+        memcpy(tap.data, src + chunk * h->frame_size, (frames - chunk) * h->frame_size);
+    h->write_pos += frames;
+    if (time_ns != 0 && unplayed_frames >= 0) {
+        h->anchor_pos = h->write_pos - unplayed_frames;
+        h->anchor_ns = time_ns;
+    }
+    audio_extn_seqlock_write_end(&h->seq);
+done:
+    pthread_mutex_unlock(&tap.lock);
+}
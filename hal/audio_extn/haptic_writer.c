@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_haptic_writer"
+/*#define LOG_NDEBUG 0*/
+
+/* Writer for the haptic half of audio-with-haptics playback.
+
+   out_write() splits the haptic channels off the client buffer and pushes
+   them into a single producer/single consumer ring. A dedicated thread at
+   the mixer's priority drains the ring into the haptic pcm, so the haptic
+   pcm_write() blocks in parallel with the audio one instead of after it.
+   The ring holds a couple of client writes at most: when the haptic pcm
+   falls further behind, new haptic data is dropped rather than queued, so
+   vibration never lags the audio by more than the ring. A failed haptic
+   write is reported by the next push.
+*/
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <log/log.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+/* client writes the ring can hold */
+#define HAPTIC_WRITER_RING_WRITES 2
+
+struct haptic_writer {
+    struct pcm *pcm;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;     /* data pushed or exit requested */
+    bool exit;
+    uint8_t *ring;
+    size_t size;             /* whole frames */
+    atomic_size_t head;      /* bytes pushed, only advanced by the producer */
+    atomic_size_t tail;      /* bytes written, only advanced by the writer */
+    atomic_int error;        /* pcm_write() failure not reported yet */
+    uint32_t dropped;        /* pushes dropped for lack of room */
+};
+
+static void *haptic_writer_loop(void *context)
+{
+    struct haptic_writer *w = (struct haptic_writer *)context;
+    size_t head, tail, offset, chunk;
+    int ret;
+
+    audio_extn_thread_policy_apply(AUDIO_THREAD_URGENT, "Haptic Writer");
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->exit) {
+        head = atomic_load_explicit(&w->head, memory_order_acquire);
+        tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+        if (head == tail) {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        /* the ring is a whole number of frames, so a wrap never splits one */
+        offset = tail % w->size;
+        chunk = head - tail;
+        if (chunk > w->size - offset)
+            chunk = w->size - offset;
+        ret = pcm_write(w->pcm, w->ring + offset, chunk);
+        if (ret != 0) {
+            ALOGV("%s: pcm_write failed %d", __func__, ret);
+            atomic_store_explicit(&w->error, ret, memory_order_relaxed);
+        }
+        atomic_store_explicit(&w->tail, tail + chunk, memory_order_release);
+
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+struct haptic_writer *audio_extn_haptic_writer_create(struct pcm *pcm, size_t write_bytes,
+                                                      size_t frame_size)
+{
+    struct haptic_writer *w;
+    size_t frames;
+    int ret;
+
+    if (pcm == NULL || write_bytes == 0 || frame_size == 0)
+        return NULL;
+
+    w = (struct haptic_writer *)calloc(1, sizeof(*w));
+    if (w == NULL)
+        return NULL;
+    frames = (write_bytes + frame_size - 1) / frame_size;
+    w->size = frames * frame_size * HAPTIC_WRITER_RING_WRITES;
+    w->ring = (uint8_t *)calloc(1, w->size);
+    if (w->ring == NULL) {
+        free(w);
+        return NULL;
+    }
+    w->pcm = pcm;
+    pthread_mutex_init(&w->lock, (const pthread_mutexattr_t *) NULL);
+    pthread_cond_init(&w->cond, (const pthread_condattr_t *) NULL);
+
+    ret = pthread_create(&w->thread, (const pthread_attr_t *) NULL, haptic_writer_loop, w);
+    if (ret != 0) {
+        ALOGE("%s: failed to start haptic writer (%d)", __func__, ret);
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w->ring);
+        free(w);
+        return NULL;
+    }
+    ALOGV("%s: %zu byte ring", __func__, w->size);
+    return w;
+}
+
+int audio_extn_haptic_writer_push(struct haptic_writer *w, const void *data, size_t bytes)
+{
+    const size_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+    const size_t offset = head % w->size;
+    size_t first;
+    int error;
+
+    error = atomic_exchange_explicit(&w->error, 0, memory_order_relaxed);
+
+    if (bytes > w->size - (head - tail)) {
+        /* log the first drop of a run and then every 100th */
+        ALOGW_IF(w->dropped++ % 100 == 0,
+                 "%s: haptic pcm behind, dropped %zu bytes (%u drops)", __func__,
+                 bytes, w->dropped);
+        return error;
+    }
+
+    first = bytes < w->size - offset ? bytes : w->size - offset;
+    memcpy(w->ring + offset, data, first);
+    memcpy(w->ring, (const uint8_t *)data + first, bytes - first);
+    atomic_store_explicit(&w->head, head + bytes, memory_order_release);
+
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    return error;
+}
+
+/* waits for a pcm_write() in progress, the haptic pcm may be closed after */
+void audio_extn_haptic_writer_destroy(struct haptic_writer *w)
+{
+    if (w == NULL)
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    w->exit = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, (void **) NULL);
+
+    ALOGW_IF(w->dropped, "%s: %u haptic writes dropped", __func__, w->dropped);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->ring);
+    free(w);
+}
@@ -20,7 +20,9 @@
 
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
 #include <log/log.h>
+#include <cutils/properties.h>
 
 #include "audio_hw.h"
 #include "platform.h"
@@ -40,6 +42,11 @@
 #define PLAYBACK_VOLUME_MAX 0x2000
 #define CAPTURE_VOLUME_DEFAULT                (15.0)
 
+/* open the PCMs while the devices are routed instead of after, off by default */
+#define HFP_PARALLEL_OPEN_PROPERTY "vendor.audio.hfp.parallel_open"
+
+#define HFP_PCM_MAX 4
+
 static int32_t start_hfp(struct audio_device *adev,
                                struct str_parms *parms);
 
@@ -56,6 +63,7 @@ struct hfp_module {
     bool   is_hfp_running;
     bool   mic_mute;
     audio_usecase_t ucid;
+    struct volume_coalescer *volume_coalescer; /* under adev->lock */
 };
 
 static struct hfp_module hfpmod = {
@@ -116,7 +124,7 @@ static int32_t hfp_set_volume(struct audio_device *adev, float value)
         ALOGW("%s: Defaulting hfp mixer control to: %s",
                  __func__, hfpmod.hfp_vol_mixer_ctl);
     }
-    ctl = mixer_get_ctl_by_name(adev->mixer, hfpmod.hfp_vol_mixer_ctl);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, hfpmod.hfp_vol_mixer_ctl);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, hfpmod.hfp_vol_mixer_ctl);
@@ -160,7 +168,7 @@ static int hfp_set_mic_volume(struct audio_device *adev, float value)
     memset(mixer_ctl_name, 0, sizeof(mixer_ctl_name));
     snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
              "Playback %d Volume", pcm_device_id);
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -193,7 +201,7 @@ static float hfp_get_mic_volume(struct audio_device *adev)
     memset(mixer_ctl_name, 0, sizeof(mixer_ctl_name));
     snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
              "Playback %d Volume", pcm_device_id);
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -240,12 +248,91 @@ int audio_extn_hfp_set_mic_mute(struct audio_device *adev, bool state)
     return rc;
 }
 
+/* Each HFP PCM is brought up by its own thread: hw/sw params while the
+   devices are routed, prepare and start once routing is done. The PCM
+   ioctls of the four streams then overlap with each other and with the
+   mixer and calibration writes of select_devices(). */
+struct hfp_bringup {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool routed;
+};
+
+struct hfp_pcm_job {
+    pthread_t thread;
+    bool threaded;
+    struct hfp_bringup *bringup;
+    struct pcm **pcm;
+    unsigned int card;
+    unsigned int device;
+    unsigned int flags;
+    int status;
+};
+
+static void *hfp_pcm_bringup(void *context)
+{
+    struct hfp_pcm_job *job = (struct hfp_pcm_job *)context;
+    struct hfp_bringup *bringup = job->bringup;
+
+    ALOGV("%s: Opening PCM %s device card_id(%d) device_id(%d)", __func__,
+          (job->flags & PCM_IN) ? "capture" : "playback", job->card, job->device);
+    *job->pcm = pcm_open(job->card, job->device, job->flags, &pcm_config_hfp);
+    if (*job->pcm && !pcm_is_ready(*job->pcm)) {
+        ALOGE("%s: %s", __func__, pcm_get_error(*job->pcm));
+        job->status = -EIO;
+    }
+
+    pthread_mutex_lock(&bringup->lock);
+    while (!bringup->routed)
+        pthread_cond_wait(&bringup->cond, &bringup->lock);
+    pthread_mutex_unlock(&bringup->lock);
+
+    if (job->status == 0 && *job->pcm && pcm_start(*job->pcm) < 0)
+        ALOGE("%s: device %d: %s", __func__, job->device, pcm_get_error(*job->pcm));
+    return NULL;
+}
+
+static void hfp_add_pcm_job(struct hfp_pcm_job *jobs, int *count,
+                            struct hfp_bringup *bringup, struct pcm **pcm,
+                            unsigned int card, unsigned int device,
+                            unsigned int flags)
+{
+    struct hfp_pcm_job *job = &jobs[(*count)++];
+
+    job->bringup = bringup;
+    job->pcm = pcm;
+    job->card = card;
+    job->device = device;
+    job->flags = flags;
+    job->status = 0;
+    /* without a thread the job runs inline once routing is done */
+    job->threaded = pthread_create(&job->thread, NULL, hfp_pcm_bringup, job) == 0;
+    if (!job->threaded)
+        ALOGW("%s: no thread for device %d, starting it inline", __func__, device);
+}
+
+static void hfp_set_routed(struct hfp_bringup *bringup)
+{
+    pthread_mutex_lock(&bringup->lock);
+    bringup->routed = true;
+    pthread_cond_broadcast(&bringup->cond);
+    pthread_mutex_unlock(&bringup->lock);
+}
+
 static int32_t start_hfp(struct audio_device *adev,
                          struct str_parms *parms __unused)
 {
     int32_t i, ret = 0;
     struct audio_usecase *uc_info;
     int32_t pcm_dev_rx_id, pcm_dev_tx_id, pcm_dev_asm_rx_id, pcm_dev_asm_tx_id;
+    struct hfp_bringup bringup = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .routed = false,
+    };
+    struct hfp_pcm_job jobs[HFP_PCM_MAX];
+    int job_count = 0;
+    bool parallel_open;
 
     ALOGD("%s: enter", __func__);
 
@@ -256,7 +343,7 @@ static int32_t start_hfp(struct audio_device *adev,
     adev->enable_hfp = true;
     platform_set_mic_mute(adev->platform, false);
 
-    uc_info = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    uc_info = alloc_usecase(adev);
     uc_info->id = hfpmod.ucid;
     uc_info->type = PCM_HFP_CALL;
     uc_info->stream.out = adev->primary_output;
@@ -264,12 +351,11 @@ static int32_t start_hfp(struct audio_device *adev,
     uc_info->in_snd_device = SND_DEVICE_NONE;
     uc_info->out_snd_device = SND_DEVICE_NONE;
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    add_usecase_to_list(adev, uc_info);
 
     audio_extn_tfa_98xx_set_mode_bt();
 
-    select_devices(adev, hfpmod.ucid);
-
+    /* the PCM devices only depend on the usecase, not on the routing */
     pcm_dev_rx_id = platform_get_pcm_device_id(uc_info->id, PCM_PLAYBACK);
     pcm_dev_tx_id = platform_get_pcm_device_id(uc_info->id, PCM_CAPTURE);
     pcm_dev_asm_rx_id = HFP_ASM_RX_TX;
@@ -285,56 +371,37 @@ static int32_t start_hfp(struct audio_device *adev,
     ALOGV("%s: HFP PCM devices (hfp rx tx: %d pcm rx tx: %d) for the usecase(%d)",
               __func__, pcm_dev_rx_id, pcm_dev_tx_id, uc_info->id);
 
-    ALOGV("%s: Opening PCM playback device card_id(%d) device_id(%d)",
-          __func__, adev->snd_card, pcm_dev_rx_id);
-    hfpmod.hfp_sco_rx = pcm_open(adev->snd_card,
-                                  pcm_dev_asm_rx_id,
-                                  PCM_OUT, &pcm_config_hfp);
-    if (hfpmod.hfp_sco_rx && !pcm_is_ready(hfpmod.hfp_sco_rx)) {
-        ALOGE("%s: %s", __func__, pcm_get_error(hfpmod.hfp_sco_rx));
-        ret = -EIO;
-        goto exit;
-    }
-    ALOGD("%s: Opening PCM capture device card_id(%d) device_id(%d)",
-          __func__, adev->snd_card, pcm_dev_tx_id);
+    parallel_open = property_get_bool(HFP_PARALLEL_OPEN_PROPERTY, false);
+    if (!parallel_open)
+        select_devices(adev, hfpmod.ucid);
 
+    hfp_add_pcm_job(jobs, &job_count, &bringup, &hfpmod.hfp_sco_rx,
+                    adev->snd_card, pcm_dev_asm_rx_id, PCM_OUT);
+    hfp_add_pcm_job(jobs, &job_count, &bringup, &hfpmod.hfp_sco_tx,
+                    adev->snd_card, pcm_dev_asm_tx_id, PCM_IN);
     if (audio_extn_tfa_98xx_is_supported() == false) {
-        hfpmod.hfp_pcm_rx = pcm_open(adev->snd_card,
-                                       pcm_dev_rx_id,
-                                       PCM_OUT, &pcm_config_hfp);
-        if (hfpmod.hfp_pcm_rx && !pcm_is_ready(hfpmod.hfp_pcm_rx)) {
-            ALOGE("%s: %s", __func__, pcm_get_error(hfpmod.hfp_pcm_rx));
-            ret = -EIO;
-            goto exit;
-        }
-    }
-    hfpmod.hfp_sco_tx = pcm_open(adev->snd_card,
-                                  pcm_dev_asm_tx_id,
-                                  PCM_IN, &pcm_config_hfp);
-    if (hfpmod.hfp_sco_tx && !pcm_is_ready(hfpmod.hfp_sco_tx)) {
-        ALOGE("%s: %s", __func__, pcm_get_error(hfpmod.hfp_sco_tx));
-        ret = -EIO;
+        hfp_add_pcm_job(jobs, &job_count, &bringup, &hfpmod.hfp_pcm_rx,
+                        adev->snd_card, pcm_dev_rx_id, PCM_OUT);
+        hfp_add_pcm_job(jobs, &job_count, &bringup, &hfpmod.hfp_pcm_tx,
+                        adev->snd_card, pcm_dev_tx_id, PCM_IN);
+    }
+
+    if (parallel_open)
+        select_devices(adev, hfpmod.ucid);
+    hfp_set_routed(&bringup);
+
+    for (i = 0; i < job_count; i++) {
+        if (jobs[i].threaded)
+            pthread_join(jobs[i].thread, NULL);
+        else
+            hfp_pcm_bringup(&jobs[i]);
+        if (jobs[i].status != 0)
+            ret = jobs[i].status;
+    }
+    pthread_cond_destroy(&bringup.cond);
+    pthread_mutex_destroy(&bringup.lock);
+    if (ret != 0)
         goto exit;
-    }
-    ALOGV("%s: Opening PCM capture device card_id(%d) device_id(%d)",
-          __func__, adev->snd_card, pcm_dev_tx_id);
-
-    if (audio_extn_tfa_98xx_is_supported() == false) {
-        hfpmod.hfp_pcm_tx = pcm_open(adev->snd_card,
-                                       pcm_dev_tx_id,
-                                       PCM_IN, &pcm_config_hfp);
-        if (hfpmod.hfp_pcm_tx && !pcm_is_ready(hfpmod.hfp_pcm_tx)) {
-            ALOGE("%s: %s", __func__, pcm_get_error(hfpmod.hfp_pcm_tx));
-            ret = -EIO;
-            goto exit;
-        }
-    }
-    pcm_start(hfpmod.hfp_sco_rx);
-    pcm_start(hfpmod.hfp_sco_tx);
-    if (audio_extn_tfa_98xx_is_supported() == false) {
-        pcm_start(hfpmod.hfp_pcm_rx);
-        pcm_start(hfpmod.hfp_pcm_tx);
-    }
 
     audio_extn_tfa_98xx_enable_speaker();
 
@@ -404,8 +471,8 @@ static int32_t stop_hfp(struct audio_device *adev)
     }
     adev->enable_hfp = false;
 
-    list_remove(&uc_info->list);
-    free(uc_info);
+    remove_usecase_from_list(adev, uc_info);
+    free_usecase(adev, uc_info);
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
     return ret;
@@ -427,6 +494,23 @@ audio_usecase_t audio_extn_hfp_get_usecase()
     return hfpmod.ucid;
 }
 
+/* deferred write of the last volume set during a coalescing window */
+static void hfp_apply_volume(void *context)
+{
+    struct audio_device *adev = (struct audio_device *)context;
+
+    pthread_mutex_lock(&adev->lock);
+    if (audio_extn_volume_coalescer_take(hfpmod.volume_coalescer))
+        hfp_set_volume(adev, hfpmod.hfp_volume);
+    pthread_mutex_unlock(&adev->lock);
+}
+
+void audio_extn_hfp_deinit(void)
+{
+    audio_extn_volume_coalescer_destroy(hfpmod.volume_coalescer);
+    hfpmod.volume_coalescer = NULL;
+}
+
 void audio_extn_hfp_set_parameters(struct audio_device *adev, struct str_parms *parms)
 {
     int ret;
@@ -495,7 +579,14 @@ void audio_extn_hfp_set_parameters(struct audio_device *adev, struct str_parms *
             goto exit;
         }
         ALOGD("%s: set_hfp_volume usecase, Vol: [%f]", __func__, vol);
-        hfp_set_volume(adev, vol);
+        if (hfpmod.volume_coalescer == NULL)
+            hfpmod.volume_coalescer = audio_extn_volume_coalescer_create("hfp_volume",
+                                                                         hfp_apply_volume,
+                                                                         adev);
+        if (audio_extn_volume_coalescer_apply_now(hfpmod.volume_coalescer))
+            hfp_set_volume(adev, vol);
+        else
+            hfpmod.hfp_volume = vol;
     }
 
     memset(value, 0, sizeof(value));
@@ -20,7 +20,9 @@
 
 #ifdef HWDEP_CAL_ENABLED
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -81,7 +83,93 @@ static int hw_util_open(int card_no)
     return fd;
 }
 
-static int send_codec_cal(acdb_get_calibration_t acdb_loader_get_calibration, int fd)
+/* cal blobs are packed into one arena at this alignment */
+#define CAL_ARENA_ALIGN 8
+
+static void init_cal_query(struct param_data *calib, int type)
+{
+    memset(calib, 0, sizeof(*calib));
+    if (!strcmp(cal_name_info[type], "mad_cal"))
+        calib->acdb_id = SOUND_TRIGGER_DEVICE_HANDSET_MONO_LOW_POWER_ACDB_ID;
+}
+
+/*
+ * All sizes are queried first so the blobs can share a single allocation,
+ * then everything is fetched and handed to the driver back to back. The
+ * hwdep node takes one cal type per SNDRV_CTL_IOCTL_HWDEP_CAL_TYPE, so that
+ * is one ioctl per type with data; empty types are skipped. Nothing reaches
+ * the driver unless every type was fetched.
+ */
+static int send_codec_cal_batched(acdb_get_calibration_t acdb_loader_get_calibration,
+                                  int fd)
+{
+    struct param_data calib;
+    size_t offset[WCD9XXX_MAX_CAL];
+    int buff_size[WCD9XXX_MAX_CAL];
+    int data_size[WCD9XXX_MAX_CAL];
+    size_t arena_size = 0;
+    uint8_t *arena;
+    int ret = 0, type;
+
+    for (type = WCD9XXX_ANC_CAL; type < WCD9XXX_MAX_CAL; type++) {
+        init_cal_query(&calib, type);
+        calib.get_size = 1;
+        ret = acdb_loader_get_calibration(cal_name_info[type], sizeof(struct param_data),
+                                                                 &calib);
+        if (ret < 0) {
+            ALOGE("%s get_calibration failed\n", __func__);
+            return ret;
+        }
+        buff_size[type] = calib.buff_size > 0 ? calib.buff_size : 0;
+        offset[type] = arena_size;
+        arena_size += (buff_size[type] + CAL_ARENA_ALIGN - 1) & ~(CAL_ARENA_ALIGN - 1);
+    }
+    if (arena_size == 0)
+        return 0;
+
+    arena = (uint8_t *)malloc(arena_size);
+    if (arena == NULL) {
+        ALOGE("%s: failed to allocate %zu bytes of cal", __func__, arena_size);
+        return -ENOMEM;
+    }
+
+    for (type = WCD9XXX_ANC_CAL; type < WCD9XXX_MAX_CAL; type++) {
+        data_size[type] = 0;
+        if (buff_size[type] == 0)
+            continue;
+        init_cal_query(&calib, type);
+        calib.buff_size = buff_size[type];
+        calib.buff = arena + offset[type];
+        ret = acdb_loader_get_calibration(cal_name_info[type],
+                              sizeof(struct param_data), &calib);
+        if (ret < 0) {
+            ALOGE("%s get_calibration failed\n", __func__);
+            goto done;
+        }
+        data_size[type] = calib.data_size;
+    }
+
+    for (type = WCD9XXX_ANC_CAL; type < WCD9XXX_MAX_CAL; type++) {
+        struct wcdcal_ioctl_buffer codec_buffer;
+
+        if (data_size[type] <= 0)
+            continue;
+        codec_buffer.buffer = arena + offset[type];
+        codec_buffer.size = data_size[type];
+        codec_buffer.cal_type = type;
+        if (ioctl(fd, SNDRV_CTL_IOCTL_HWDEP_CAL_TYPE, &codec_buffer) < 0)
+            ALOGE("Failed to call ioctl  for %s err=%d",
+                                  cal_name_info[type], errno);
+        ALOGD("%s cal sent for %s", __func__, cal_name_info[type]);
+    }
+
+done:
+    free(arena);
+    return ret;
+}
+
+/* one fetch and ioctl per type, each into its own buffer */
+static int send_codec_cal_direct(acdb_get_calibration_t acdb_loader_get_calibration, int fd)
 {
     int ret = 0, type;
 
@@ -89,8 +177,7 @@ static int send_codec_cal(acdb_get_calibration_t acdb_loader_get_calibration, in
         struct wcdcal_ioctl_buffer codec_buffer;
         struct param_data calib;
 
-        if (!strcmp(cal_name_info[type], "mad_cal"))
-            calib.acdb_id = SOUND_TRIGGER_DEVICE_HANDSET_MONO_LOW_POWER_ACDB_ID;
+        init_cal_query(&calib, type);
         calib.get_size = 1;
         ret = acdb_loader_get_calibration(cal_name_info[type], sizeof(struct param_data),
                                                                  &calib);
@@ -100,6 +187,8 @@ static int send_codec_cal(acdb_get_calibration_t acdb_loader_get_calibration, in
         }
         calib.get_size = 0;
         calib.buff = malloc(calib.buff_size);
+        if (calib.buff == NULL)
+            return -ENOMEM;
         ret = acdb_loader_get_calibration(cal_name_info[type],
                               sizeof(struct param_data), &calib);
         if (ret < 0) {
@@ -119,6 +208,14 @@ static int send_codec_cal(acdb_get_calibration_t acdb_loader_get_calibration, in
     return ret;
 }
 
+static int send_codec_cal(acdb_get_calibration_t acdb_loader_get_calibration, int fd)
+{
+    if (send_codec_cal_batched(acdb_loader_get_calibration, fd) >= 0)
+        return 0;
+    ALOGW("%s: batched codec cal failed, sending it type by type", __func__);
+    return send_codec_cal_direct(acdb_loader_get_calibration, fd);
+}
+
 
 void audio_extn_hwdep_cal_send(int snd_card, void *acdb_handle)
 {
@@ -136,6 +233,7 @@ void audio_extn_hwdep_cal_send(int snd_card, void *acdb_handle)
     if (acdb_get_calibration == NULL) {
         ALOGE("%s: ERROR. dlsym Error:%s acdb_loader_get_calibration", __func__,
            dlerror());
+        close(fd);
         return;
     }
     if (send_codec_cal(acdb_get_calibration, fd) < 0)
@@ -164,9 +164,25 @@ struct ma_platform_data {
     int dispaly_orientation;
 };
 
+/*
+ * What the library was last given for each usecase, so that only changed
+ * parameters are sent. A route enable starts the usecase's DSP session from
+ * scratch and drops its shadow; a new app type or device does the same.
+ */
+struct ma_shadow {
+    bool valid;
+    unsigned int app_type;
+    unsigned int device;
+    bool vol_valid;
+    struct ma_state vol_table[STREAM_MAX_TYPES];
+    int lr_swap;        /* -1 until sent */
+    int orientation;    /* -1 until sent */
+};
+
 ma_audio_cal_handle_t g_ma_audio_cal_handle = NULL;
 static uint16_t g_supported_dev = 0;
 static struct ma_state ma_cur_state_table[STREAM_MAX_TYPES];
+static struct ma_shadow ma_shadow_table[AUDIO_USECASE_MAX];
 static struct ma_platform_data *my_data = NULL;
 
 static int set_audio_cal(const char *audio_cal)
@@ -284,6 +300,87 @@ static void ma_cal_init(struct ma_audio_cal_settings *ma_cal)
     ma_cal->effect_scope_flag = EFFECTIVE_SCOPE_ALL;
 }
 
+static struct ma_shadow *ma_get_shadow(struct audio_usecase *usecase,
+                                       const struct ma_audio_cal_settings *ma_cal)
+{
+    struct ma_shadow *shadow = &ma_shadow_table[usecase->id];
+
+    if (!shadow->valid || shadow->app_type != ma_cal->common.app_type ||
+        shadow->device != ma_cal->common.device) {
+        shadow->valid = true;
+        shadow->app_type = ma_cal->common.app_type;
+        shadow->device = ma_cal->common.device;
+        shadow->vol_valid = false;
+        shadow->lr_swap = -1;
+        shadow->orientation = -1;
+    }
+    return shadow;
+}
+
+static bool vol_table_changed(const struct ma_shadow *shadow)
+{
+    ma_stream_type_t i;
+
+    if (!shadow->vol_valid)
+        return true;
+    for (i = 0; i < STREAM_MAX_TYPES; i++) {
+        if (shadow->vol_table[i].vol != ma_cur_state_table[i].vol ||
+            shadow->vol_table[i].active != ma_cur_state_table[i].active)
+            return true;
+    }
+    return false;
+}
+
+// already hold lock
+static bool ma_send_volume_table_l(struct audio_usecase *usecase,
+                                   const struct ma_audio_cal_settings *ma_cal)
+{
+    struct ma_shadow *shadow = ma_get_shadow(usecase, ma_cal);
+
+    if (!vol_table_changed(shadow)) {
+        ALOGV("%s: usecase(%d) volume table unchanged", __func__, usecase->id);
+        return true;
+    }
+    if (!ma_set_volume_table_l(ma_cal, STREAM_MAX_TYPES, ma_cur_state_table)) {
+        ALOGE("ma_set_volume_table_l returned with error.");
+        return false;
+    }
+    ALOGV("ma_set_volume_table_l success");
+    print_state_log();
+    memcpy(shadow->vol_table, ma_cur_state_table, sizeof(shadow->vol_table));
+    shadow->vol_valid = true;
+    return true;
+}
+
+static bool ma_send_lr_swap_l(struct ma_shadow *shadow,
+                              const struct ma_audio_cal_settings *ma_cal, bool swap)
+{
+    if (shadow->lr_swap == (int)swap)
+        return true;
+    if (!ma_set_lr_swap_l(ma_cal, swap)) {
+        ALOGE("ma_set_lr_swap_l %s returned with error.", swap ? "enable" : "disable");
+        return false;
+    }
+    ALOGV("ma_set_lr_swap_l %s returned with success.", swap ? "enable" : "disable");
+    shadow->lr_swap = swap;
+    return true;
+}
+
+static bool ma_send_orientation_l(struct ma_shadow *shadow,
+                                  const struct ma_audio_cal_settings *ma_cal,
+                                  int orientation)
+{
+    if (shadow->orientation == orientation)
+        return true;
+    if (!ma_set_orientation_l(ma_cal, orientation)) {
+        ALOGE("ma_set_orientation_l %d returned with error.", orientation);
+        return false;
+    }
+    ALOGV("ma_set_orientation_l %d returned with success.", orientation);
+    shadow->orientation = orientation;
+    return true;
+}
+
 static bool check_and_send_all_audio_cal(struct audio_device *adev, ma_cmd_t cmd)
 {
     int i = 0;
@@ -292,6 +389,7 @@ static bool check_and_send_all_audio_cal(struct audio_device *adev, ma_cmd_t cmd
     struct listnode *node;
     struct audio_usecase *usecase;
     struct ma_audio_cal_settings ma_cal;
+    struct ma_shadow *shadow;
 
     ma_cal_init(&ma_cal);
 
@@ -304,54 +402,31 @@ static bool check_and_send_all_audio_cal(struct audio_device *adev, ma_cmd_t cmd
                       __func__, usecase->id, ma_cal.common.app_type,
                       ma_cal.common.device);
 
+            shadow = ma_get_shadow(usecase, &ma_cal);
+
             switch (cmd) {
                 case MA_CMD_VOL:
-                    ret = ma_set_volume_table_l(&ma_cal, STREAM_MAX_TYPES,
-                                                ma_cur_state_table);
-                    if (ret)
-                        ALOGV("ma_set_volume_table_l success");
-                    else
-                        ALOGE("ma_set_volume_table_l returned with error.");
-                    print_state_log();
+                    ret = ma_send_volume_table_l(usecase, &ma_cal);
                     break;
 
                 case MA_CMD_SWAP_ENABLE:
                     /* lr swap only enable for speaker path */
-                    if (ma_cal.common.device & AUDIO_DEVICE_OUT_SPEAKER) {
-                        ret = ma_set_lr_swap_l(&ma_cal, true);
-                        if (ret)
-                            ALOGV("ma_set_lr_swap_l enable returned with success.");
-                        else
-                            ALOGE("ma_set_lr_swap_l enable returned with error.");
-                    }
+                    if (ma_cal.common.device & AUDIO_DEVICE_OUT_SPEAKER)
+                        ret = ma_send_lr_swap_l(shadow, &ma_cal, true);
                     break;
 
                 case MA_CMD_SWAP_DISABLE:
-                    ret = ma_set_lr_swap_l(&ma_cal, false);
-                    if (ret)
-                        ALOGV("ma_set_lr_swap_l disable returned with success.");
-                    else
-                        ALOGE("ma_set_lr_swap_l disable returned with error.");
+                    ret = ma_send_lr_swap_l(shadow, &ma_cal, false);
                     break;
 
                 case MA_CMD_ROTATE_ENABLE:
-                    if (ma_cal.common.device & AUDIO_DEVICE_OUT_SPEAKER) {
-                        ret = ma_set_orientation_l(&ma_cal, my_data->dispaly_orientation);
-                        if (ret)
-                            ALOGV("ma_set_orientation_l %d returned with success.",
-                                  my_data->dispaly_orientation);
-                        else
-                            ALOGE("ma_set_orientation_l %d returned with error.",
-                                  my_data->dispaly_orientation);
-                    }
+                    if (ma_cal.common.device & AUDIO_DEVICE_OUT_SPEAKER)
+                        ret = ma_send_orientation_l(shadow, &ma_cal,
+                                                    my_data->dispaly_orientation);
                     break;
 
                 case MA_CMD_ROTATE_DISABLE:
-                    ret = ma_set_orientation_l(&ma_cal, 0);
-                    if (ret)
-                        ALOGV("ma_set_orientation_l 0 returned with success.");
-                    else
-                        ALOGE("ma_set_orientation_l 0 returned with error.");
+                    ret = ma_send_orientation_l(shadow, &ma_cal, 0);
                     break;
 
                 default:
@@ -607,6 +682,7 @@ void audio_extn_ma_init(void *platform)
         ma_cur_state_table[i].vol = 0.0;
         ma_cur_state_table[i].active = false;
     }
+    memset(ma_shadow_table, 0, sizeof(ma_shadow_table));
 
     my_data->speaker_lr_swap = false;
     my_data->orientation_used = false;
@@ -709,6 +785,9 @@ void audio_extn_ma_set_device(struct audio_usecase *usecase)
 
     pthread_mutex_lock(&my_data->lock);
 
+    /* the route is being (re)enabled, nothing was sent to it yet */
+    ma_shadow_table[usecase->id].valid = false;
+
     if (is_active()) {
 
         if (ma_cal.common.device & AUDIO_DEVICE_OUT_SPEAKER) {
@@ -724,14 +803,7 @@ void audio_extn_ma_set_device(struct audio_usecase *usecase)
                 ma_set_swap_l(usecase->stream.out->dev, false);
         }
 
-        if (!ma_set_volume_table_l(&ma_cal,
-                                   STREAM_MAX_TYPES,
-                                   ma_cur_state_table))
-            ALOGE("ma_set_volume_table_l returned with error.");
-        else
-            ALOGV("ma_set_volume_table_l success");
-        print_state_log();
-
+        ma_send_volume_table_l(usecase, &ma_cal);
     }
     pthread_mutex_unlock(&my_data->lock);
 }
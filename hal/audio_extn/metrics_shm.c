@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_metrics_shm"
+/*#define LOG_NDEBUG 0*/
+
+/* Per stream counters in a shared memory page for external monitors.
+
+   With vendor.audio.metrics_shm set, adev_open() maps METRICS_SHM_PATH
+   and every stream takes a slot in it for its lifetime. out_write(),
+   in_read() and standby refresh the slot under the stream lock, so a
+   monitor can map the file read only and sample all streams without a
+   binder call and without taking any HAL lock.
+
+   The file is a struct metrics_shm_header followed by slot_count slots of
+   slot_size bytes laid out as struct metrics_shm_stream. Each slot is a
+   seqlock: seq is odd while the HAL updates it, and a reader copies the
+   slot, then retries if seq was odd or changed meanwhile. A slot with
+   handle 0 is free. Fields are only ever added at the end of a slot, with
+   a version bump.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <log/log.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+#include "seqlock.h"
+
+#define METRICS_SHM_PATH "/data/vendor/audio/hal_metrics"
+#define METRICS_SHM_MAGIC 0x4d434841 /* "AHCM" */
+#define METRICS_SHM_VERSION 1
+#define METRICS_SHM_SLOTS 32
+
+struct metrics_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_size;
+};
+
+struct metrics_shm_stream {
+    atomic_uint seq;             /* odd while being updated */
+    int32_t handle;              /* stream io handle, 0 for a free slot */
+    int32_t usecase;             /* audio_usecase_t */
+    uint32_t is_output;
+    uint32_t state;              /* metrics_shm_state_t */
+    uint32_t devices;
+    uint32_t errors;             /* failed writes or reads */
+    uint32_t reserved;
+    int64_t frames;              /* frames moved, bytes for compressed streams */
+    int64_t xruns;               /* underruns for playback, overruns for capture */
+    int64_t start_latency_us;    /* last exit from standby */
+    int64_t update_ns;           /* CLOCK_MONOTONIC of the last update */
+};
+
+static struct {
+    pthread_mutex_t lock;        /* slot allocation */
+    int fd;
+    size_t size;
+    struct metrics_shm_header *header;
+    struct metrics_shm_stream *slots;
+} shm = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+static void write_end(struct metrics_shm_stream *s)
+{
+    s->update_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    audio_extn_seqlock_write_end(&s->seq);
+}
+
+void audio_extn_metrics_shm_init(void)
+{
+    void *map;
+
+    if (!property_get_bool("vendor.audio.metrics_shm", false))
+        return;
+
+    pthread_mutex_lock(&shm.lock);
+    if (shm.header != NULL)
+        goto done;
+
+    shm.size = sizeof(struct metrics_shm_header) +
+               METRICS_SHM_SLOTS * sizeof(struct metrics_shm_stream);
+    /* readable by the monitor, which never writes to it */
+    shm.fd = open(METRICS_SHM_PATH, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (shm.fd < 0) {
+        ALOGE("%s: cannot open %s: %s", __func__, METRICS_SHM_PATH, strerror(errno));
+        goto done;
+    }
+    if (ftruncate(shm.fd, shm.size) != 0) {
+        ALOGE("%s: cannot size %s: %s", __func__, METRICS_SHM_PATH, strerror(errno));
+        goto err;
+    }
+    map = mmap(NULL, shm.size, PROT_READ | PROT_WRITE, MAP_SHARED, shm.fd, 0);
+    if (map == MAP_FAILED) {
+        ALOGE("%s: mmap failed: %s", __func__, strerror(errno));
+        goto err;
+    }
+    shm.header = (struct metrics_shm_header *)map;
+    shm.slots = (struct metrics_shm_stream *)(shm.header + 1);
+    shm.header->slot_count = METRICS_SHM_SLOTS;
+    shm.header->slot_size = sizeof(struct metrics_shm_stream);
+    shm.header->version = METRICS_SHM_VERSION;
+    /* a monitor seeing the magic sees a complete header */
+    atomic_thread_fence(memory_order_release);
+    shm.header->magic = METRICS_SHM_MAGIC;
+    ALOGI("%s: %u stream slots in %s", __func__, METRICS_SHM_SLOTS, METRICS_SHM_PATH);
+    goto done;
+
+err:
+    close(shm.fd);
+    shm.fd = -1;
+done:
+    pthread_mutex_unlock(&shm.lock);
+}
+
+/* all streams are closed by now, their slots are gone with the mapping */
+void audio_extn_metrics_shm_deinit(void)
+{
+    pthread_mutex_lock(&shm.lock);
+    if (shm.header != NULL) {
+        munmap(shm.header, shm.size);
+        shm.header = NULL;
+        shm.slots = NULL;
+        close(shm.fd);
+        shm.fd = -1;
+    }
+    pthread_mutex_unlock(&shm.lock);
+}
+
+struct metrics_shm_stream *audio_extn_metrics_shm_open(int32_t handle, bool is_output,
+                                                       audio_usecase_t usecase)
+{
+    struct metrics_shm_stream *s = NULL;
+    int i;
+
+    pthread_mutex_lock(&shm.lock);
+    if (shm.slots == NULL)
+        goto done;
+    for (i = 0; i < METRICS_SHM_SLOTS; i++) {
+        if (shm.slots[i].handle == 0) {
+            s = &shm.slots[i];
+            break;
+        }
+    }
+    if (s == NULL) {
+        ALOGW("%s: no free slot for handle %d", __func__, handle);
+        goto done;
+    }
+    audio_extn_seqlock_write_begin(&s->seq);
+    s->handle = handle;
+    s->usecase = usecase;
+    s->is_output = is_output;
+    s->state = METRICS_SHM_STATE_STANDBY;
+    s->devices = 0;
+    s->errors = 0;
+    s->frames = 0;
+    s->xruns = 0;
+    s->start_latency_us = 0;
+    write_end(s);
+done:
+    pthread_mutex_unlock(&shm.lock);
+    return s;
+}
+
+void audio_extn_metrics_shm_close(struct metrics_shm_stream *s)
+{
+    if (s == NULL)
+        return;
+    pthread_mutex_lock(&shm.lock);
+    audio_extn_seqlock_write_begin(&s->seq);
+    s->state = METRICS_SHM_STATE_CLOSED;
+    s->handle = 0;
+    write_end(s);
+    pthread_mutex_unlock(&shm.lock);
+}
+
+/* called with the stream lock held, the only writer of the slot */
+void audio_extn_metrics_shm_update(struct metrics_shm_stream *s, metrics_shm_state_t state,
+                                   audio_devices_t devices, int64_t frames, int64_t xruns,
+                                   double start_latency_ms, bool error)
+{
+    if (s == NULL)
+        return;
+    audio_extn_seqlock_write_begin(&s->seq);
+    s->state = state;
+    s->devices = devices;
+    s->frames = frames;
+    s->xruns = xruns;
+    s->start_latency_us = (int64_t)(start_latency_ms * 1000);
+    if (error)
+        s->errors++;
+    write_end(s);
+}
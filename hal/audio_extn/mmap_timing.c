@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_mmap_timing"
+/*#define LOG_NDEBUG 0*/
+
+/* Timing model for MMAP NOIRQ positions.
+
+   The DSP moves hw_ptr in bursts, so the raw hw_ptr/timestamp pairs handed
+   to AAudio jitter by up to a burst. A least squares line over the last
+   MMAP_TIMING_WINDOW pairs gives the rate, the reported time for a position
+   is taken from that line, and the spread of the samples around it gives
+   the offset: the most advanced edge for playback so the client writes
+   ahead of the DSP, the least advanced one for capture so it never reads
+   ahead of it. The offset learnt on the last stream seeds the next one.
+
+   The gaps between get_mmap_position() calls are taken on the monotonic
+   clock when each call arrives, not from the burst quantized hw_ptr times.
+   AAudio polls the position from its service thread rather than from the
+   client callback, so the gaps measure how late that poll runs, which is
+   only a proxy for the client wakeups. Their spread sizes the buffer
+   recommended for the next stream in the same direction on the same
+   devices.
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <log/log.h>
+#include <audio_utils/clock.h>
+#include <utils/Timers.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+/* samples needed before the line is trusted */
+#define MMAP_TIMING_MIN_SAMPLES 8
+
+/* fitted rate must be within this many percent of the nominal rate */
+#define MMAP_TIMING_RATE_TOLERANCE 20
+
+/* longer gaps between queries are pauses, not late polls */
+#define MMAP_TIMING_MAX_GAP_NS (200 * 1000000LL)
+
+/* devices remembered per direction, the oldest entry is replaced */
+#define MMAP_TIMING_DEVICES 8
+
+static atomic_int_fast64_t learned_offset_ns[2]; /* [capture, playback] */
+
+static struct {
+    pthread_mutex_t lock;
+    struct {
+        audio_devices_t devices;
+        int32_t frames;
+    } entry[2][MMAP_TIMING_DEVICES];
+    uint32_t next[2];
+} recommended = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+void audio_extn_mmap_timing_init(struct mmap_timing *t, uint32_t rate,
+                                 uint32_t burst_frames, bool is_output,
+                                 audio_devices_t devices)
+{
+    memset(t, 0, sizeof(*t));
+    t->rate = rate;
+    t->is_output = is_output;
+    t->devices = devices;
+    t->max_offset_ns = rate ? (int64_t)burst_frames * NANOS_PER_SECOND / rate : 0;
+    t->offset_ns = atomic_load_explicit(&learned_offset_ns[is_output],
+                                        memory_order_relaxed);
+}
+
+void audio_extn_mmap_timing_save(struct mmap_timing *t)
+{
+    int64_t frames;
+    uint32_t i;
+
+    if (t->count < MMAP_TIMING_MIN_SAMPLES)
+        return;
+    ALOGV("%s: %s offset %lld us", __func__, t->is_output ? "playback" : "capture",
+          (long long)(t->offset_ns / 1000));
+    atomic_store_explicit(&learned_offset_ns[t->is_output], t->offset_ns,
+                          memory_order_relaxed);
+
+    if (t->min_gap_ns <= 0)
+        return;
+    /* twice the worst poll jitter plus a burst of DSP quantization */
+    frames = (2 * (t->max_gap_ns - t->min_gap_ns) + t->max_offset_ns) * t->rate /
+             NANOS_PER_SECOND;
+    ALOGI("%s: %s devices %#x poll jitter %lld us, %lld frames recommended", __func__,
+          t->is_output ? "playback" : "capture", t->devices,
+          (long long)((t->max_gap_ns - t->min_gap_ns) / 1000), (long long)frames);
+
+    pthread_mutex_lock(&recommended.lock);
+    for (i = 0; i < MMAP_TIMING_DEVICES; i++) {
+        if (recommended.entry[t->is_output][i].frames > 0 &&
+            recommended.entry[t->is_output][i].devices == t->devices)
+            break;
+    }
+    if (i == MMAP_TIMING_DEVICES) {
+        i = recommended.next[t->is_output];
+        recommended.next[t->is_output] = (i + 1) % MMAP_TIMING_DEVICES;
+    }
+    recommended.entry[t->is_output][i].devices = t->devices;
+    recommended.entry[t->is_output][i].frames = (int32_t)frames;
+    pthread_mutex_unlock(&recommended.lock);
+}
+
+/* 0 when no stream in this direction ran on these devices yet */
+int32_t audio_extn_mmap_timing_recommended_frames(bool is_output, audio_devices_t devices)
+{
+    int32_t frames = 0;
+    uint32_t i;
+
+    pthread_mutex_lock(&recommended.lock);
+    for (i = 0; i < MMAP_TIMING_DEVICES; i++) {
+        if (recommended.entry[is_output][i].frames > 0 &&
+            recommended.entry[is_output][i].devices == devices) {
+            frames = recommended.entry[is_output][i].frames;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&recommended.lock);
+    return frames;
+}
+
+int64_t audio_extn_mmap_timing_update(struct mmap_timing *t, int64_t frames,
+                                      int64_t time_ns)
+{
+    const uint32_t n = t->count;
+    double mean_x = 0, mean_y = 0, sxx = 0, sxy = 0;
+    double slope, nominal, intercept, edge = 0;
+    int64_t base_ns, base_frames;
+    uint32_t i, first;
+    const int64_t query_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    if (t->last_query_ns) {
+        const int64_t gap_ns = query_ns - t->last_query_ns;
+        if (gap_ns > 0 && gap_ns < MMAP_TIMING_MAX_GAP_NS) {
+            if (t->min_gap_ns == 0 || gap_ns < t->min_gap_ns)
+                t->min_gap_ns = gap_ns;
+            if (gap_ns > t->max_gap_ns)
+                t->max_gap_ns = gap_ns;
+        }
+    }
+    t->last_query_ns = query_ns;
+
+    /* a stop/start moves the position back, the old line no longer applies */
+    if (n && frames < t->frames[(t->next + MMAP_TIMING_WINDOW - 1) % MMAP_TIMING_WINDOW]) {
+        t->count = 0;
+        t->next = 0;
+    }
+    t->frames[t->next] = frames;
+    t->time_ns[t->next] = time_ns;
+    t->next = (t->next + 1) % MMAP_TIMING_WINDOW;
+    if (t->count < MMAP_TIMING_WINDOW)
+        t->count++;
+    if (t->count < MMAP_TIMING_MIN_SAMPLES || t->rate == 0)
+        return time_ns + t->offset_ns;
+
+    /* work relative to the oldest sample to keep the sums small */
+    first = (t->next + MMAP_TIMING_WINDOW - t->count) % MMAP_TIMING_WINDOW;
+    base_ns = t->time_ns[first];
+    base_frames = t->frames[first];
+    for (i = 0; i < t->count; i++) {
+        const uint32_t idx = (first + i) % MMAP_TIMING_WINDOW;
+        mean_x += t->time_ns[idx] - base_ns;
+        mean_y += t->frames[idx] - base_frames;
+    }
+    mean_x /= t->count;
+    mean_y /= t->count;
+    for (i = 0; i < t->count; i++) {
+        const uint32_t idx = (first + i) % MMAP_TIMING_WINDOW;
+        const double dx = t->time_ns[idx] - base_ns - mean_x;
+        const double dy = t->frames[idx] - base_frames - mean_y;
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+    if (sxx <= 0)
+        return time_ns + t->offset_ns;
+
+    /* frames per ns, a stalled stream gives a flat line that is not used */
+    slope = sxy / sxx;
+    nominal = (double)t->rate / NANOS_PER_SECOND;
+    if (slope < nominal * (100 - MMAP_TIMING_RATE_TOLERANCE) / 100 ||
+        slope > nominal * (100 + MMAP_TIMING_RATE_TOLERANCE) / 100)
+        return time_ns + t->offset_ns;
+    intercept = mean_y - slope * mean_x;
+
+    /* how far each sample's time lies from the time the line reaches its position */
+    for (i = 0; i < t->count; i++) {
+        const uint32_t idx = (first + i) % MMAP_TIMING_WINDOW;
+        const double d = (t->time_ns[idx] - base_ns) -
+                         (t->frames[idx] - base_frames - intercept) / slope;
+        if (i == 0 || (t->is_output ? d < edge : d > edge))
+            edge = d;
+    }
+    if (edge > t->max_offset_ns)
+        edge = t->max_offset_ns;
+    else if (edge < -t->max_offset_ns)
+        edge = -t->max_offset_ns;
+    /* the edge moves with every window, follow it slowly */
+    t->offset_ns += ((int64_t)edge - t->offset_ns) / 8;
+
+    return base_ns + (int64_t)((frames - base_frames - intercept) / slope) + t->offset_ns;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_object_pool"
+/*#define LOG_NDEBUG 0*/
+
+/* Fixed size pools for the bookkeeping objects of stream start and stop.
+
+   Usecases and effect list entries are allocated each time a stream
+   starts or an effect is attached, and freed again on the way down. A
+   pool carves them out of one block allocated at adev_open(), so those
+   paths stay off the heap and out of the allocator locks shared with the
+   rest of audioserver. An empty pool falls back to calloc() and
+   object_pool_free() tells the two apart by address, so a pool only has
+   to be sized for the common case.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <log/log.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+struct pool_node {
+    struct pool_node *next;
+};
+
+struct object_pool {
+    pthread_mutex_t lock;
+    const char *name;
+    size_t object_size;      /* rounded up for alignment */
+    size_t count;
+    uint8_t *storage;
+    struct pool_node *free_list;
+    uint32_t fallbacks;      /* allocations the pool could not serve */
+};
+
+struct object_pool *audio_extn_object_pool_create(const char *name, size_t object_size,
+                                                  size_t count)
+{
+    struct object_pool *pool;
+    struct pool_node *node;
+    size_t i;
+
+    if (object_size == 0 || count == 0)
+        return NULL;
+
+    pool = (struct object_pool *)calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    if (object_size < sizeof(struct pool_node))
+        object_size = sizeof(struct pool_node);
+    pool->object_size = (object_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    pool->storage = (uint8_t *)calloc(count, pool->object_size);
+    if (pool->storage == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pool->name = name;
+    pool->count = count;
+    for (i = count; i > 0; i--) {
+        node = (struct pool_node *)(pool->storage + (i - 1) * pool->object_size);
+        node->next = pool->free_list;
+        pool->free_list = node;
+    }
+    pthread_mutex_init(&pool->lock, (const pthread_mutexattr_t *) NULL);
+    ALOGV("%s: %s: %zu objects of %zu bytes", __func__, name, count, pool->object_size);
+    return pool;
+}
+
+/* zeroed like calloc(), NULL only when the heap fallback fails */
+void *audio_extn_object_pool_alloc(struct object_pool *pool, size_t object_size)
+{
+    struct pool_node *node = NULL;
+
+    if (pool != NULL && object_size <= pool->object_size) {
+        pthread_mutex_lock(&pool->lock);
+        node = pool->free_list;
+        if (node != NULL)
+            pool->free_list = node->next;
+        else
+            ALOGW_IF(pool->fallbacks++ % 100 == 0, "%s: %s exhausted (%u fallbacks)",
+                     __func__, pool->name, pool->fallbacks);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (node == NULL)
+        return calloc(1, object_size);
+    memset(node, 0, pool->object_size);
+    return node;
+}
+
+void audio_extn_object_pool_free(struct object_pool *pool, void *object)
+{
+    struct pool_node *node = (struct pool_node *)object;
+
+    if (object == NULL)
+        return;
+    if (pool == NULL || (uint8_t *)object < pool->storage ||
+            (uint8_t *)object >= pool->storage + pool->count * pool->object_size) {
+        free(object);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    node->next = pool->free_list;
+    pool->free_list = node;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* every pooled object must be back by now */
+void audio_extn_object_pool_destroy(struct object_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    ALOGW_IF(pool->fallbacks, "%s: %s: %u allocations fell back to the heap", __func__,
+             pool->name, pool->fallbacks);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->storage);
+    free(pool);
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Sample format kernels of the stream paths.
+
+   They only depend on the C library and NEON, so besides the HAL the
+   kernel benchmark under hal/tools builds them unchanged.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "pcm_kernels.h"
+
+/*
+ * Averages interleaved stereo 16 bit samples to mono. dst may alias src,
+ * the output is always written behind the input being read.
+ */
+void audio_extn_pcm_downmix_stereo_to_mono_16(int16_t *dst, const int16_t *src,
+                                              size_t frames)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 8 <= frames; i += 8, src += 16, dst += 8) {
+        int16x8x2_t lr = vld2q_s16(src);
+        vst1q_s16(dst, vhaddq_s16(lr.val[0], lr.val[1]));
+    }
+#endif
+    for (; i < frames; i++, dst++, src += 2)
+        *dst = (int16_t)(((int32_t)src[0] + (int32_t)src[1]) >> 1);
+}
+
+/*
+ * The DSP delivers 24 bit capture MSB aligned in 32 bit words (24_8).
+ * Both conversions below keep the sample size so they can run in place.
+ */
+void audio_extn_pcm_convert_24_8_to_8_24(int32_t *dst, const int32_t *src,
+                                         size_t samples)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 8 <= samples; i += 8) {
+        int32x4_t a = vld1q_s32(src + i);
+        int32x4_t b = vld1q_s32(src + i + 4);
+        vst1q_s32(dst + i, vshrq_n_s32(a, 8));
+        vst1q_s32(dst + i + 4, vshrq_n_s32(b, 8));
+    }
+#endif
+    for (; i < samples; i++)
+        dst[i] = src[i] >> 8;
+}
+
+void audio_extn_pcm_convert_24_8_to_float(float *dst, const int32_t *src,
+                                          size_t samples)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 8 <= samples; i += 8) {
+        int32x4_t a = vld1q_s32(src + i);
+        int32x4_t b = vld1q_s32(src + i + 4);
+        vst1q_f32(dst + i, vcvtq_n_f32_s32(a, 31));
+        vst1q_f32(dst + i + 4, vcvtq_n_f32_s32(b, 31));
+    }
+#endif
+    for (; i < samples; i++)
+        dst[i] = (float)src[i] * (1.0f / 2147483648.0f);
+}
+
+/*
+ * Moves the audio samples of each frame to the front of the buffer in place
+ * and the haptic samples to haptic_buf, dropping skip_ch trailing samples.
+ * Always inlined so that the dispatcher below gets copies with constant
+ * sample size and strides the compiler can vectorize.
+ */
+static inline __attribute__((always_inline)) void split_haptics_frames(
+        uint8_t *buf, uint8_t *haptic_buf, size_t frames, size_t bps,
+        size_t audio_ch, size_t haptic_ch, size_t skip_ch)
+{
+    const size_t audio_size = bps * audio_ch;
+    const size_t haptic_size = bps * haptic_ch;
+    const size_t src_size = audio_size + haptic_size + bps * skip_ch;
+    const uint8_t *src = buf;
+
+    for (size_t i = 0; i < frames; i++) {
+        memmove(buf, src, audio_size);
+        memcpy(haptic_buf, src + audio_size, haptic_size);
+        buf += audio_size;
+        haptic_buf += haptic_size;
+        src += src_size;
+    }
+}
+
+#define SPLIT_HAPTICS_KEY(bps, audio_ch, haptic_ch) \
+        (((bps) << 8) | ((audio_ch) << 4) | (haptic_ch))
+#define SPLIT_HAPTICS_CASE(bps, audio_ch, haptic_ch) \
+    case SPLIT_HAPTICS_KEY(bps, audio_ch, haptic_ch): \
+        split_haptics_frames(buf, haptic_buf, frames, bps, audio_ch, haptic_ch, 0); \
+        return
+
+void audio_extn_pcm_split_haptics(uint8_t *buf, uint8_t *haptic_buf, size_t frames,
+                                  size_t bps, size_t audio_ch, size_t haptic_ch,
+                                  size_t skip_ch)
+{
+    if (skip_ch == 0 && audio_ch <= 2 && haptic_ch <= 2) {
+        switch (SPLIT_HAPTICS_KEY(bps, audio_ch, haptic_ch)) {
+        SPLIT_HAPTICS_CASE(2, 1, 1);
+        SPLIT_HAPTICS_CASE(2, 1, 2);
+        SPLIT_HAPTICS_CASE(2, 2, 1);
+        SPLIT_HAPTICS_CASE(2, 2, 2);
+        SPLIT_HAPTICS_CASE(3, 1, 1);
+        SPLIT_HAPTICS_CASE(3, 1, 2);
+        SPLIT_HAPTICS_CASE(3, 2, 1);
+        SPLIT_HAPTICS_CASE(3, 2, 2);
+        SPLIT_HAPTICS_CASE(4, 1, 1);
+        SPLIT_HAPTICS_CASE(4, 1, 2);
+        SPLIT_HAPTICS_CASE(4, 2, 1);
+        SPLIT_HAPTICS_CASE(4, 2, 2);
+        default:
+            break;
+        }
+    }
+    split_haptics_frames(buf, haptic_buf, frames, bps, audio_ch, haptic_ch, skip_ch);
+}
+
+#undef SPLIT_HAPTICS_CASE
+#undef SPLIT_HAPTICS_KEY
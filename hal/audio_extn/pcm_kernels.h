@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PCM_KERNELS_H
+#define PCM_KERNELS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+void audio_extn_pcm_downmix_stereo_to_mono_16(int16_t *dst, const int16_t *src,
+                                              size_t frames);
+void audio_extn_pcm_convert_24_8_to_8_24(int32_t *dst, const int32_t *src,
+                                         size_t samples);
+void audio_extn_pcm_convert_24_8_to_float(float *dst, const int32_t *src,
+                                          size_t samples);
+/* bps bytes per sample, audio_ch + haptic_ch + skip_ch interleaved channels */
+void audio_extn_pcm_split_haptics(uint8_t *buf, uint8_t *haptic_buf, size_t frames,
+                                  size_t bps, size_t audio_ch, size_t haptic_ch,
+                                  size_t skip_ch);
+
+#endif /* PCM_KERNELS_H */
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_perf_stats"
+/*#define LOG_NDEBUG 0*/
+
+/* Per usecase throughput and latency counters.
+
+   Unlike the per stream histograms these outlive the streams, so a test
+   driving the HAL entry points can open and close streams and then read
+   the totals for each usecase with the "perf_stats" get_parameters key.
+   Setting "perf_stats_reset" clears them between runs.
+
+   The CPU heavy kernels on the write and read paths are timed the same
+   way per kernel under the "perf_kernels" key, so a change to one of them
+   can be measured on the device with real buffer sizes and channel
+   counts. The platform info parse runs once per boot, so it is a single
+   duration in the dump rather than a distribution, and a reset keeps it.
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <log/log.h>
+#include <cutils/str_parms.h>
+#include <utils/Timers.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+#define AUDIO_PARAMETER_KEY_PERF_STATS "perf_stats"
+#define AUDIO_PARAMETER_KEY_PERF_STATS_RESET "perf_stats_reset"
+#define AUDIO_PARAMETER_KEY_PERF_KERNELS "perf_kernels"
+
+struct perf_stats_entry {
+    struct latency_hist call_hist;   // wall time of each out_write()/in_read()
+    struct latency_hist start_hist;  // time to leave standby
+    atomic_int_fast64_t cpu_ns;      // thread cpu time spent in those calls
+    atomic_int_fast64_t media_ns;    // duration of the audio they moved
+    atomic_uint_fast32_t underruns;
+};
+
+static struct perf_stats_entry perf_stats[AUDIO_USECASE_MAX];
+
+struct perf_kernel_entry {
+    struct latency_hist hist;        // wall time of each run
+    atomic_int_fast64_t total_ns;
+    atomic_int_fast64_t samples;     // samples processed, over all channels
+};
+
+static struct perf_kernel_entry perf_kernels[PERF_KERNEL_MAX];
+static atomic_int_fast64_t platform_info_ns;
+
+static const char * const kernel_names[PERF_KERNEL_MAX] = {
+    [PERF_KERNEL_DOWNMIX] = "downmix",
+    [PERF_KERNEL_HAPTIC_SPLIT] = "haptic_split",
+    [PERF_KERNEL_OUT_CONVERT] = "out_convert",
+    [PERF_KERNEL_IN_CONVERT] = "in_convert",
+};
+
+int64_t audio_extn_perf_stats_cpu_ns(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void audio_extn_perf_stats_log_call(audio_usecase_t usecase, int64_t wall_ns,
+                                    int64_t cpu_ns, int64_t media_ns)
+{
+    struct perf_stats_entry *entry;
+
+    if (usecase < 0 || usecase >= AUDIO_USECASE_MAX)
+        return;
+    entry = &perf_stats[usecase];
+    audio_extn_utils_latency_hist_log(&entry->call_hist, wall_ns);
+    atomic_fetch_add_explicit(&entry->cpu_ns, cpu_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&entry->media_ns, media_ns, memory_order_relaxed);
+}
+
+void audio_extn_perf_stats_log_start(audio_usecase_t usecase, int64_t ns)
+{
+    if (usecase < 0 || usecase >= AUDIO_USECASE_MAX)
+        return;
+    audio_extn_utils_latency_hist_log(&perf_stats[usecase].start_hist, ns);
+}
+
+void audio_extn_perf_stats_log_underrun(audio_usecase_t usecase)
+{
+    if (usecase < 0 || usecase >= AUDIO_USECASE_MAX)
+        return;
+    atomic_fetch_add_explicit(&perf_stats[usecase].underruns, 1, memory_order_relaxed);
+}
+
+int64_t audio_extn_perf_stats_kernel_begin(void)
+{
+    return systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+void audio_extn_perf_stats_log_kernel(perf_kernel_t kernel, int64_t start_ns, size_t samples)
+{
+    const int64_t ns = systemTime(SYSTEM_TIME_MONOTONIC) - start_ns;
+    struct perf_kernel_entry *entry;
+
+    if (kernel < 0 || kernel >= PERF_KERNEL_MAX)
+        return;
+    entry = &perf_kernels[kernel];
+    audio_extn_utils_latency_hist_log(&entry->hist, ns);
+    atomic_fetch_add_explicit(&entry->total_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&entry->samples, samples, memory_order_relaxed);
+}
+
+void audio_extn_perf_stats_log_platform_info(int64_t start_ns)
+{
+    atomic_store_explicit(&platform_info_ns, systemTime(SYSTEM_TIME_MONOTONIC) - start_ns,
+                          memory_order_relaxed);
+}
+
+static uint32_t hist_count(struct latency_hist *hist)
+{
+    uint32_t total = 0;
+    int i;
+
+    for (i = 0; i < LATENCY_HIST_BUCKETS; i++)
+        total += atomic_load_explicit(&hist->bucket[i], memory_order_relaxed);
+    return total;
+}
+
+/* upper bound in us of the bucket holding the given percentile */
+static uint32_t hist_percentile_us(struct latency_hist *hist, uint32_t total,
+                                   uint32_t percent)
+{
+    uint64_t rank = ((uint64_t)total * percent + 99) / 100;
+    uint64_t seen = 0;
+    int i;
+
+    if (total == 0)
+        return 0;
+    for (i = 0; i < LATENCY_HIST_BUCKETS - 1; i++) {
+        seen += atomic_load_explicit(&hist->bucket[i], memory_order_relaxed);
+        if (seen >= rank)
+            return 1u << i;
+    }
+    /* open ended bucket, the max is the best bound there is */
+    return atomic_load_explicit(&hist->max_ns, memory_order_relaxed) / 1000;
+}
+
+/* cpu time per unit of audio moved, in 1/1000 */
+static uint32_t cpu_permille(struct perf_stats_entry *entry)
+{
+    int64_t media_ns = atomic_load_explicit(&entry->media_ns, memory_order_relaxed);
+
+    if (media_ns <= 0)
+        return 0;
+    return atomic_load_explicit(&entry->cpu_ns, memory_order_relaxed) * 1000 / media_ns;
+}
+
+/* wall time per 1000 samples, in ns */
+static uint32_t kernel_ns_per_ksample(struct perf_kernel_entry *entry)
+{
+    int64_t samples = atomic_load_explicit(&entry->samples, memory_order_relaxed);
+
+    if (samples <= 0)
+        return 0;
+    return atomic_load_explicit(&entry->total_ns, memory_order_relaxed) * 1000 / samples;
+}
+
+static void perf_kernels_get_parameters(struct str_parms *query, struct str_parms *reply)
+{
+    char value[1024];
+    size_t len = 0;
+    int i;
+
+    if (str_parms_get_str(query, AUDIO_PARAMETER_KEY_PERF_KERNELS, value, sizeof(value)) < 0)
+        return;
+
+    /* "kernel:runs:p50:p99:max:ns_per_ksample" with every latency in us,
+       kernels separated by '|' */
+    value[0] = '\0';
+    for (i = 0; i < PERF_KERNEL_MAX && len < sizeof(value); i++) {
+        struct perf_kernel_entry *entry = &perf_kernels[i];
+        uint32_t runs = hist_count(&entry->hist);
+
+        if (runs == 0)
+            continue;
+        len += snprintf(value + len, sizeof(value) - len, "%s%s:%u:%u:%u:%lld:%u",
+                        len ? "|" : "", kernel_names[i], runs,
+                        hist_percentile_us(&entry->hist, runs, 50),
+                        hist_percentile_us(&entry->hist, runs, 99),
+                        (long long)atomic_load_explicit(&entry->hist.max_ns,
+                                                        memory_order_relaxed) / 1000,
+                        kernel_ns_per_ksample(entry));
+    }
+
+    str_parms_add_str(reply, AUDIO_PARAMETER_KEY_PERF_KERNELS, value);
+}
+
+void audio_extn_perf_stats_set_parameters(struct str_parms *parms)
+{
+    int i;
+
+    if (str_parms_has_key(parms, AUDIO_PARAMETER_KEY_PERF_STATS_RESET) <= 0)
+        return;
+
+    /* racing updates from running streams may survive, which is harmless */
+    for (i = 0; i < AUDIO_USECASE_MAX; i++)
+        memset(&perf_stats[i], 0, sizeof(perf_stats[i]));
+    for (i = 0; i < PERF_KERNEL_MAX; i++)
+        memset(&perf_kernels[i], 0, sizeof(perf_kernels[i]));
+    ALOGV("%s: cleared", __func__);
+}
+
+void audio_extn_perf_stats_get_parameters(struct str_parms *query,
+                                          struct str_parms *reply)
+{
+    char value[2048];
+    size_t len = 0;
+    int i;
+    int ret;
+
+    perf_kernels_get_parameters(query, reply);
+
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_KEY_PERF_STATS, value, sizeof(value));
+    if (ret < 0)
+        return;
+
+    /* "usecase:calls:p50:p90:p99:max:underruns:cpu_permille:start_p50:start_max"
+       with every latency in us, usecases separated by '|' */
+    value[0] = '\0';
+    for (i = 0; i < AUDIO_USECASE_MAX && len < sizeof(value); i++) {
+        struct perf_stats_entry *entry = &perf_stats[i];
+        uint32_t calls = hist_count(&entry->call_hist);
+        uint32_t starts = hist_count(&entry->start_hist);
+        const char *name = use_case_table[i] ? use_case_table[i] : "unknown";
+
+        if (calls == 0 && starts == 0)
+            continue;
+        len += snprintf(value + len, sizeof(value) - len,
+                        "%s%s:%u:%u:%u:%u:%lld:%u:%u:%u:%lld",
+                        len ? "|" : "", name, calls,
+                        hist_percentile_us(&entry->call_hist, calls, 50),
+                        hist_percentile_us(&entry->call_hist, calls, 90),
+                        hist_percentile_us(&entry->call_hist, calls, 99),
+                        (long long)atomic_load_explicit(&entry->call_hist.max_ns,
+                                                        memory_order_relaxed) / 1000,
+                        (uint32_t)atomic_load_explicit(&entry->underruns,
+                                                       memory_order_relaxed),
+                        cpu_permille(entry),
+                        hist_percentile_us(&entry->start_hist, starts, 50),
+                        (long long)atomic_load_explicit(&entry->start_hist.max_ns,
+                                                        memory_order_relaxed) / 1000);
+    }
+
+    str_parms_add_str(reply, AUDIO_PARAMETER_KEY_PERF_STATS, value);
+}
+
+void audio_extn_perf_stats_dump(int fd)
+{
+    int i;
+
+    dprintf(fd, "  Usecase performance:\n");
+    for (i = 0; i < AUDIO_USECASE_MAX; i++) {
+        struct perf_stats_entry *entry = &perf_stats[i];
+        uint32_t calls = hist_count(&entry->call_hist);
+
+        if (calls == 0 && hist_count(&entry->start_hist) == 0)
+            continue;
+        dprintf(fd, "    %s: p50=%uus p90=%uus p99=%uus underruns=%u cpu=%u.%u%%\n",
+                use_case_table[i] ? use_case_table[i] : "unknown",
+                hist_percentile_us(&entry->call_hist, calls, 50),
+                hist_percentile_us(&entry->call_hist, calls, 90),
+                hist_percentile_us(&entry->call_hist, calls, 99),
+                (uint32_t)atomic_load_explicit(&entry->underruns, memory_order_relaxed),
+                cpu_permille(entry) / 10, cpu_permille(entry) % 10);
+        audio_extn_utils_latency_hist_dump(&entry->call_hist, fd, "Call latency");
+        audio_extn_utils_latency_hist_dump(&entry->start_hist, fd, "Start latency");
+    }
+
+    dprintf(fd, "  Kernel performance:\n");
+    dprintf(fd, "    platform_info: %lldus at boot\n",
+            (long long)atomic_load_explicit(&platform_info_ns, memory_order_relaxed) / 1000);
+    for (i = 0; i < PERF_KERNEL_MAX; i++) {
+        struct perf_kernel_entry *entry = &perf_kernels[i];
+        uint32_t runs = hist_count(&entry->hist);
+
+        if (runs == 0)
+            continue;
+        dprintf(fd, "    %s: runs=%u p50=%uus p99=%uus %uns/ksample\n", kernel_names[i], runs,
+                hist_percentile_us(&entry->hist, runs, 50),
+                hist_percentile_us(&entry->hist, runs, 99),
+                kernel_ns_per_ksample(entry));
+    }
+}
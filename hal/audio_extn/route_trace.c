@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_route_trace"
+/*#define LOG_NDEBUG 0*/
+
+/* Records how long each phase of a routing transition takes.
+
+   The last ROUTE_TRACE_ENTRIES phases are kept in a ring together with
+   per phase totals. The ring is dumped by adev_dump() and the most recent
+   entries can be queried with the "route_trace" get_parameters key.
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <log/log.h>
+#include <cutils/str_parms.h>
+#include <utils/Timers.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+#define ROUTE_TRACE_ENTRIES 64
+#define ROUTE_TRACE_NAME_LEN 48
+#define ROUTE_TRACE_REPLY_ENTRIES 16
+
+#define AUDIO_PARAMETER_KEY_ROUTE_TRACE "route_trace"
+
+struct route_trace_entry {
+    int64_t start_ns;
+    int64_t duration_ns;
+    route_trace_phase_t phase;
+    char name[ROUTE_TRACE_NAME_LEN];
+};
+
+struct route_trace_stats {
+    uint32_t count;
+    int64_t total_ns;
+    int64_t max_ns;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct route_trace_entry entries[ROUTE_TRACE_ENTRIES];
+    uint32_t next;
+    struct route_trace_stats stats[ROUTE_TRACE_PHASE_MAX];
+} route_trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char * const phase_names[ROUTE_TRACE_PHASE_MAX] = {
+    [ROUTE_TRACE_SELECT_DEVICES] = "select_devices",
+    [ROUTE_TRACE_MIXER_PATH] = "mixer_path",
+    [ROUTE_TRACE_ACDB] = "acdb",
+    [ROUTE_TRACE_BACKEND_CFG] = "backend_cfg",
+    [ROUTE_TRACE_SPKR_PROT] = "spkr_prot",
+};
+
+int64_t audio_extn_route_trace_begin(void)
+{
+    return systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+void audio_extn_route_trace_end(route_trace_phase_t phase, const char *name,
+                                int64_t start_ns)
+{
+    const int64_t duration_ns = systemTime(SYSTEM_TIME_MONOTONIC) - start_ns;
+    struct route_trace_entry *entry;
+    struct route_trace_stats *stats;
+
+    if (phase < 0 || phase >= ROUTE_TRACE_PHASE_MAX)
+        return;
+
+    pthread_mutex_lock(&route_trace.lock);
+    entry = &route_trace.entries[route_trace.next++ % ROUTE_TRACE_ENTRIES];
+    entry->start_ns = start_ns;
+    entry->duration_ns = duration_ns;
+    entry->phase = phase;
+    strlcpy(entry->name, name ? name : "", sizeof(entry->name));
+
+    stats = &route_trace.stats[phase];
+    stats->count++;
+    stats->total_ns += duration_ns;
+    if (duration_ns > stats->max_ns)
+        stats->max_ns = duration_ns;
+    pthread_mutex_unlock(&route_trace.lock);
+}
+
+/* returns the entry that is 'age' entries older than the newest one */
+static const struct route_trace_entry *route_trace_entry_l(uint32_t age)
+{
+    uint32_t filled = route_trace.next < ROUTE_TRACE_ENTRIES ?
+                          route_trace.next : ROUTE_TRACE_ENTRIES;
+
+    if (age >= filled)
+        return NULL;
+    return &route_trace.entries[(route_trace.next - 1 - age) % ROUTE_TRACE_ENTRIES];
+}
+
+void audio_extn_route_trace_get_parameters(struct str_parms *query,
+                                           struct str_parms *reply)
+{
+    char value[ROUTE_TRACE_REPLY_ENTRIES * (ROUTE_TRACE_NAME_LEN + 32)];
+    size_t len = 0;
+    uint32_t i;
+    int ret;
+
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_KEY_ROUTE_TRACE, value, sizeof(value));
+    if (ret < 0)
+        return;
+
+    /* newest first, "phase:name:duration_us" separated by '|' */
+    value[0] = '\0';
+    pthread_mutex_lock(&route_trace.lock);
+    for (i = 0; i < ROUTE_TRACE_REPLY_ENTRIES && len < sizeof(value); i++) {
+        const struct route_trace_entry *entry = route_trace_entry_l(i);
+        if (entry == NULL)
+            break;
+        len += snprintf(value + len, sizeof(value) - len, "%s%s:%s:%lld",
+                        i ? "|" : "", phase_names[entry->phase], entry->name,
+                        (long long)(entry->duration_ns / 1000));
+    }
+    pthread_mutex_unlock(&route_trace.lock);
+
+    str_parms_add_str(reply, AUDIO_PARAMETER_KEY_ROUTE_TRACE, value);
+}
+
+void audio_extn_route_trace_dump(int fd)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&route_trace.lock);
+    dprintf(fd, "  Route transitions:\n");
+    for (i = 0; i < ROUTE_TRACE_PHASE_MAX; i++) {
+        const struct route_trace_stats *stats = &route_trace.stats[i];
+        if (stats->count == 0)
+            continue;
+        dprintf(fd, "    %-14s n=%u avg=%lldus max=%lldus\n", phase_names[i],
+                stats->count, (long long)(stats->total_ns / stats->count / 1000),
+                (long long)(stats->max_ns / 1000));
+    }
+    for (i = ROUTE_TRACE_ENTRIES; i > 0; i--) {
+        const struct route_trace_entry *entry = route_trace_entry_l(i - 1);
+        if (entry == NULL)
+            continue;
+        dprintf(fd, "    %lld.%06lld %-14s %-40s %lldus\n",
+                (long long)(entry->start_ns / 1000000000),
+                (long long)(entry->start_ns / 1000 % 1000000),
+                phase_names[entry->phase], entry->name,
+                (long long)(entry->duration_ns / 1000));
+    }
+    pthread_mutex_unlock(&route_trace.lock);
+}
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_rt_latency"
+/*#define LOG_NDEBUG 0*/
+
+/* Round trip latency measurement.
+
+   "rt_latency_measure=start" arms a measurement. The next 16 bit PCM
+   out_write() writes a copy of its buffer that starts with a maximum
+   length sequence (MLS) burst, and leaves the client buffer alone. A burst
+   longer than one buffer carries on into the following writes. Each
+   in_read() correlates its first channel against the same sequence. The
+   clock stops at the first window that matches it well enough and is
+   loud enough.
+
+   Looping the output back (AFE proxy or acoustically) gives the real
+   output to input latency. The "rt_latency" get_parameters key reports it
+   next to what platform_render_latency() and platform_capture_latency()
+   predict. "rt_latency_measure=apply" moves the difference into the
+   output usecase delay.
+*/
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <log/log.h>
+#include <cutils/str_parms.h>
+#include <utils/Timers.h>
+#include <tinyalsa/asoundlib.h>
+#include <audio_utils/clock.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+#include "platform_api.h"
+
+#define AUDIO_PARAMETER_KEY_RT_LATENCY "rt_latency"
+#define AUDIO_PARAMETER_KEY_RT_LATENCY_MEASURE "rt_latency_measure"
+#define AUDIO_PARAMETER_KEY_RT_LATENCY_THRESHOLD "rt_latency_threshold"
+
+/* order 7 MLS, x^7 + x^6 + 1 */
+#define RT_LATENCY_MLS_ORDER 7
+#define RT_LATENCY_MLS_LEN ((1 << RT_LATENCY_MLS_ORDER) - 1)
+#define RT_LATENCY_MLS_TAPS 0x60
+#define RT_LATENCY_BURST_LEVEL 0x6000
+/* minimum mean amplitude of a matching window */
+#define RT_LATENCY_DEFAULT_THRESHOLD 0x100
+/* minimum normalized correlation, 1.0 is a perfect scaled copy */
+#define RT_LATENCY_MIN_CORRELATION 0.5
+#define RT_LATENCY_TIMEOUT_NS (2 * NANOS_PER_SECOND)
+
+typedef enum {
+    RT_LATENCY_IDLE,
+    RT_LATENCY_ARMED,     /* waiting for an output to carry the burst */
+    RT_LATENCY_INJECTING, /* burst partly written */
+    RT_LATENCY_WAITING,   /* burst written, waiting for it on an input */
+    RT_LATENCY_DONE,
+    RT_LATENCY_TIMEOUT,
+} rt_latency_state_t;
+
+static const char * const state_names[] = {
+    [RT_LATENCY_IDLE] = "idle",
+    [RT_LATENCY_ARMED] = "armed",
+    [RT_LATENCY_INJECTING] = "injecting",
+    [RT_LATENCY_WAITING] = "waiting",
+    [RT_LATENCY_DONE] = "done",
+    [RT_LATENCY_TIMEOUT] = "timeout",
+};
+
+static struct {
+    pthread_mutex_t lock;
+    /* written under lock, read without it by the stream fast paths */
+    _Atomic rt_latency_state_t state;
+    int threshold;
+    int burst_pos;         /* MLS chips already written */
+    audio_usecase_t out_usecase;
+    int64_t inject_ns;     /* when the burst was handed to the driver */
+    int64_t queued_ns;     /* audio already queued ahead of the burst */
+    int64_t render_us;     /* platform_render_latency() of the output */
+    int64_t capture_us;    /* platform_capture_latency() of the input */
+    int64_t measured_ns;   /* burst written to burst seen */
+    /* last RT_LATENCY_MLS_LEN - 1 input samples, so a burst may straddle reads */
+    int32_t history[RT_LATENCY_MLS_LEN - 1];
+    int history_len;
+} rt_latency = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .threshold = RT_LATENCY_DEFAULT_THRESHOLD,
+};
+
+static pthread_once_t mls_once = PTHREAD_ONCE_INIT;
+static int8_t mls[RT_LATENCY_MLS_LEN];
+
+static void mls_init(void)
+{
+    unsigned int lfsr = 1;
+    int i;
+
+    for (i = 0; i < RT_LATENCY_MLS_LEN; i++) {
+        mls[i] = (lfsr & 1) ? 1 : -1;
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & RT_LATENCY_MLS_TAPS);
+    }
+}
+
+static rt_latency_state_t state_get(void)
+{
+    return atomic_load_explicit(&rt_latency.state, memory_order_relaxed);
+}
+
+static void state_set_l(rt_latency_state_t state)
+{
+    atomic_store_explicit(&rt_latency.state, state, memory_order_relaxed);
+}
+
+/* latency of the path itself, without the buffering ahead of the burst */
+static int64_t path_us_l(void)
+{
+    return (rt_latency.measured_ns - rt_latency.queued_ns) / 1000;
+}
+
+/* NULL to write buffer as is, else a copy carrying the burst that the
+   caller writes instead and frees */
+void *audio_extn_rt_latency_out_write(struct stream_out *out, const void *buffer,
+                                      size_t bytes)
+{
+    int16_t *samples = NULL;
+    size_t channels = out->config.channels;
+    size_t frames, i, c;
+    unsigned int avail;
+    struct timespec ts;
+    rt_latency_state_t state = state_get();
+
+    if (state != RT_LATENCY_ARMED && state != RT_LATENCY_INJECTING)
+        return NULL;
+    if (out->format != AUDIO_FORMAT_PCM_16_BIT || out->pcm == NULL ||
+        out->usecase == USECASE_AUDIO_PLAYBACK_WITH_HAPTICS || channels == 0)
+        return NULL;
+
+    pthread_mutex_lock(&rt_latency.lock);
+    state = state_get();
+    if (state != RT_LATENCY_ARMED &&
+        (state != RT_LATENCY_INJECTING || out->usecase != rt_latency.out_usecase))
+        goto done;
+
+    samples = (int16_t *)malloc(bytes);
+    if (samples == NULL)
+        goto done;
+    memcpy(samples, buffer, bytes);
+    frames = bytes / (channels * sizeof(int16_t));
+
+    if (state == RT_LATENCY_ARMED) {
+        rt_latency.queued_ns = 0;
+        if (pcm_get_htimestamp(out->pcm, &avail, &ts) == 0) {
+            unsigned int buffer_frames = pcm_get_buffer_size(out->pcm);
+            if (buffer_frames > avail)
+                rt_latency.queued_ns = (int64_t)(buffer_frames - avail) *
+                                       NANOS_PER_SECOND / out->config.rate;
+        }
+        rt_latency.out_usecase = out->usecase;
+        rt_latency.render_us = platform_render_latency(out);
+        rt_latency.inject_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+        rt_latency.burst_pos = 0;
+        rt_latency.history_len = 0;
+        ALOGV("%s: burst on %s, %lld us queued", __func__, use_case_table[out->usecase],
+              (long long)(rt_latency.queued_ns / 1000));
+    }
+
+    for (i = 0; i < frames && rt_latency.burst_pos < RT_LATENCY_MLS_LEN; i++) {
+        const int16_t sample = mls[rt_latency.burst_pos++] * RT_LATENCY_BURST_LEVEL;
+        for (c = 0; c < channels; c++)
+            samples[i * channels + c] = sample;
+    }
+    state_set_l(rt_latency.burst_pos < RT_LATENCY_MLS_LEN ?
+                RT_LATENCY_INJECTING : RT_LATENCY_WAITING);
+done:
+    pthread_mutex_unlock(&rt_latency.lock);
+    return samples;
+}
+
+/* Index into x of the first chip of the best matching window, or -1.
+   x holds len samples, the window slides over every full overlap. */
+static int correlate_l(const int32_t *x, int len)
+{
+    const int64_t min_energy = (int64_t)rt_latency.threshold * rt_latency.threshold *
+                               RT_LATENCY_MLS_LEN;
+    double best = RT_LATENCY_MIN_CORRELATION * RT_LATENCY_MIN_CORRELATION;
+    int64_t energy = 0;
+    int best_pos = -1;
+    int n, k;
+
+    if (len < RT_LATENCY_MLS_LEN)
+        return -1;
+    for (k = 0; k < RT_LATENCY_MLS_LEN - 1; k++)
+        energy += (int64_t)x[k] * x[k];
+
+    for (n = 0; n + RT_LATENCY_MLS_LEN <= len; n++) {
+        const int32_t *w = &x[n];
+        int64_t corr = 0;
+        double score;
+
+        energy += (int64_t)w[RT_LATENCY_MLS_LEN - 1] * w[RT_LATENCY_MLS_LEN - 1];
+        if (energy >= min_energy) {
+            for (k = 0; k < RT_LATENCY_MLS_LEN; k++)
+                corr += mls[k] * w[k];
+            /* corr^2 / (L * energy) is 1.0 for a scaled copy of the sequence */
+            score = corr > 0 ? (double)corr * corr / ((double)RT_LATENCY_MLS_LEN * energy) : 0;
+            if (score > best) {
+                best = score;
+                best_pos = n;
+            }
+        }
+        energy -= (int64_t)w[0] * w[0];
+    }
+    return best_pos;
+}
+
+void audio_extn_rt_latency_in_read(struct stream_in *in, const void *buffer,
+                                   size_t bytes)
+{
+    const int16_t *samples = (const int16_t *)buffer;
+    size_t channels = audio_channel_count_from_in_mask(in->channel_mask);
+    rt_latency_state_t state = state_get();
+    int32_t *x = NULL;
+    size_t frames, i;
+    int64_t now_ns;
+    int len, pos;
+
+    if (state != RT_LATENCY_INJECTING && state != RT_LATENCY_WAITING)
+        return;
+    if (in->format != AUDIO_FORMAT_PCM_16_BIT || channels == 0 || in->sample_rate == 0)
+        return;
+
+    /* the last frame of the buffer was captured just now */
+    now_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    frames = bytes / (channels * sizeof(int16_t));
+
+    pthread_mutex_lock(&rt_latency.lock);
+    state = state_get();
+    if (state != RT_LATENCY_INJECTING && state != RT_LATENCY_WAITING)
+        goto done;
+
+    /* first channel of this read, behind what is left of the previous ones */
+    x = (int32_t *)malloc((rt_latency.history_len + frames) * sizeof(int32_t));
+    if (x == NULL)
+        goto done;
+    memcpy(x, rt_latency.history, rt_latency.history_len * sizeof(int32_t));
+    for (i = 0; i < frames; i++)
+        x[rt_latency.history_len + i] = samples[i * channels];
+    len = rt_latency.history_len + (int)frames;
+
+    pos = correlate_l(x, len);
+    if (pos >= 0) {
+        const int64_t detect_ns = now_ns - (int64_t)(len - pos) *
+                                           NANOS_PER_SECOND / in->sample_rate;
+        rt_latency.measured_ns = detect_ns - rt_latency.inject_ns;
+        rt_latency.capture_us = platform_capture_latency(in);
+        state_set_l(RT_LATENCY_DONE);
+        ALOGI("%s: round trip %lld us, path %lld us, platform tables %lld us", __func__,
+              (long long)(rt_latency.measured_ns / 1000), (long long)path_us_l(),
+              (long long)(rt_latency.render_us + rt_latency.capture_us));
+    } else if (now_ns - rt_latency.inject_ns > RT_LATENCY_TIMEOUT_NS) {
+        ALOGW("%s: burst not detected", __func__);
+        state_set_l(RT_LATENCY_TIMEOUT);
+    } else {
+        rt_latency.history_len = len < RT_LATENCY_MLS_LEN - 1 ? len : RT_LATENCY_MLS_LEN - 1;
+        memcpy(rt_latency.history, &x[len - rt_latency.history_len],
+               rt_latency.history_len * sizeof(int32_t));
+    }
+done:
+    pthread_mutex_unlock(&rt_latency.lock);
+    free(x);
+}
+
+/* Charge the whole error to the output usecase, the source delay is shared
+   by every capture path and the measurement cannot tell the two apart. */
+static void rt_latency_apply_l(void)
+{
+    const int64_t error_us = path_us_l() - (rt_latency.render_us + rt_latency.capture_us);
+    int64_t delay_ms;
+
+    if (state_get() != RT_LATENCY_DONE) {
+        ALOGW("%s: no measurement to apply", __func__);
+        return;
+    }
+    delay_ms = (platform_get_audio_usecase_delay(rt_latency.out_usecase) + error_us) / 1000;
+    if (delay_ms < 0)
+        delay_ms = 0;
+    ALOGI("%s: %s delay %lld ms", __func__, use_case_table[rt_latency.out_usecase],
+          (long long)delay_ms);
+    platform_set_audio_usecase_delay(rt_latency.out_usecase, (int)delay_ms);
+}
+
+void audio_extn_rt_latency_set_parameters(struct str_parms *parms)
+{
+    char value[32];
+    int val;
+    int ret;
+
+    ret = str_parms_get_int(parms, AUDIO_PARAMETER_KEY_RT_LATENCY_THRESHOLD, &val);
+    if (ret >= 0 && val > 0 && val < 0x8000) {
+        pthread_mutex_lock(&rt_latency.lock);
+        rt_latency.threshold = val;
+        pthread_mutex_unlock(&rt_latency.lock);
+    }
+
+    ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_RT_LATENCY_MEASURE, value, sizeof(value));
+    if (ret < 0)
+        return;
+
+    pthread_mutex_lock(&rt_latency.lock);
+    if (strcmp(value, "start") == 0) {
+        pthread_once(&mls_once, mls_init);
+        rt_latency.measured_ns = 0;
+        state_set_l(RT_LATENCY_ARMED);
+    } else if (strcmp(value, "stop") == 0) {
+        state_set_l(RT_LATENCY_IDLE);
+    } else if (strcmp(value, "apply") == 0) {
+        rt_latency_apply_l();
+    }
+    pthread_mutex_unlock(&rt_latency.lock);
+}
+
+void audio_extn_rt_latency_get_parameters(struct str_parms *query,
+                                          struct str_parms *reply)
+{
+    char value[128];
+    int ret;
+
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_KEY_RT_LATENCY, value, sizeof(value));
+    if (ret < 0)
+        return;
+
+    /* "state:round_trip_us:path_us:platform_us" */
+    pthread_mutex_lock(&rt_latency.lock);
+    if (state_get() == RT_LATENCY_DONE)
+        snprintf(value, sizeof(value), "%s:%lld:%lld:%lld", state_names[RT_LATENCY_DONE],
+                 (long long)(rt_latency.measured_ns / 1000), (long long)path_us_l(),
+                 (long long)(rt_latency.render_us + rt_latency.capture_us));
+    else
+        snprintf(value, sizeof(value), "%s", state_names[state_get()]);
+    pthread_mutex_unlock(&rt_latency.lock);
+
+    str_parms_add_str(reply, AUDIO_PARAMETER_KEY_RT_LATENCY, value);
+}
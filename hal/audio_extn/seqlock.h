@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_EXTN_SEQLOCK_H
+#define AUDIO_EXTN_SEQLOCK_H
+
+/* Sequence lock for state with one writer and lock free readers.
+
+   The writer brackets each update with audio_extn_seqlock_write_begin()
+   and audio_extn_seqlock_write_end(), which leave the count odd while the
+   update is in progress. A reader copies what it needs between
+   audio_extn_seqlock_read_begin() and audio_extn_seqlock_read_retry(), and
+   starts over while the latter returns true. Writers must be serialized
+   by the caller.
+*/
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+static inline void audio_extn_seqlock_write_begin(atomic_uint *seq)
+{
+    unsigned int s = atomic_load_explicit(seq, memory_order_relaxed);
+    atomic_store_explicit(seq, s + 1, memory_order_relaxed);
+    /* the odd count is visible before any of the data stores */
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void audio_extn_seqlock_write_end(atomic_uint *seq)
+{
+    unsigned int s = atomic_load_explicit(seq, memory_order_relaxed);
+    atomic_store_explicit(seq, s + 1, memory_order_release);
+}
+
+static inline unsigned int audio_extn_seqlock_read_begin(const atomic_uint *seq)
+{
+    unsigned int s;
+
+    while ((s = atomic_load_explicit(seq, memory_order_acquire)) & 1)
+        sched_yield();
+    return s;
+}
+
+static inline bool audio_extn_seqlock_read_retry(const atomic_uint *seq,
+                                                 unsigned int s)
+{
+    /* the data loads complete before the count is read again */
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(seq, memory_order_relaxed) != s;
+}
+
+#endif /* AUDIO_EXTN_SEQLOCK_H */
@@ -24,9 +24,12 @@
    Each stream in audio_hal registers for a callback in
    adev_open_*_stream.
 
-   A thread is spawned to poll() on sound card state files in /proc.
-   On observing a sound card state change, this thread invokes the
-   callbacks registered.
+   A thread is spawned to epoll() on sound card state files in /proc.
+   On observing a sound card state change, this thread queues a message
+   which a second thread delivers to the registered callbacks, so a slow
+   listener cannot hold up detection of further state changes.
+   Cards can be added to or dropped from the epoll set at runtime, e.g.
+   a cpe state node that only shows up once the card is back ONLINE.
 
    Callbacks are deregistered in adev_close_*_stream and adev_close
 */
@@ -35,7 +38,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
 #include <pthread.h>
 #include <cutils/list.h>
 #include <cutils/hashmap.h>
@@ -61,12 +64,23 @@
 
 #define AUDIO_PARAMETER_KEY_EXT_AUDIO_DEVICE "ext_audio_device"
 
+#define MAX_EPOLL_EVENTS 8
+#define STATE_BUF_SIZE 32
+
 typedef enum {
     audio_event_on,
     audio_event_off
 } audio_event_status;
 
+/* first member of every object registered in the epoll set */
+typedef enum {
+    WATCH_CTRL,
+    WATCH_SNDCARD,
+    WATCH_DEV_EVENT,
+} watch_type_t;
+
 typedef struct {
+    watch_type_t type;
     int card;
     int fd;
     struct listnode node; // membership in sndcards list
@@ -74,6 +88,7 @@ typedef struct {
 } sndcard_t;
 
 typedef struct {
+    watch_type_t type;
     char * dev;
     int fd;
     int status;
@@ -82,6 +97,11 @@ typedef struct {
 
 typedef void (* notifyfn)(const void * target, const char * msg);
 
+typedef struct {
+    struct listnode node; // membership in pending_msgs list
+    char msg[];
+} snd_mon_msg_t;
+
 typedef struct {
     const void * target;
     notifyfn notify;
@@ -91,40 +111,61 @@ typedef struct {
     unsigned int num_dev_events;
     pthread_t monitor_thread;
     int intpipe[2];
+    int epollfd;
+    watch_type_t ctrl_watch;
+    char state_buf[STATE_BUF_SIZE]; // only used by init and monitor thread
+    pthread_t dispatch_thread;
+    pthread_mutex_t dispatch_lock;
+    pthread_cond_t dispatch_cond;
+    struct listnode pending_msgs;
+    bool dispatch_exit;
     Hashmap * listeners; // from stream * -> callback func
     bool initcheck;
 } sndmonitor_state_t;
 
 static sndmonitor_state_t sndmonitor;
 
-static char * read_state(int fd)
+/* Reads the state file from offset 0 into the shared state buffer, with
+   trailing whitespace trimmed. Reading also rearms the POLLPRI notification,
+   so there is no need to seek back afterwards. */
+static ssize_t read_state(int fd)
 {
-    struct stat buf;
-    if (fstat(fd, &buf) < 0)
-        return NULL;
-
-    off_t pos = lseek(fd, 0, SEEK_CUR);
-    off_t avail = buf.st_size - pos;
-    if (avail <= 0) {
-        ALOGD("avail %ld", avail);
-        return NULL;
-    }
+    char * state = sndmonitor.state_buf;
+    ssize_t bytes = pread(fd, state, STATE_BUF_SIZE - 1, 0);
 
-    char * state = (char *)calloc(avail+1, sizeof(char));
-    if (!state)
-        return NULL;
+    if (bytes < 0)
+        return -errno;
 
-    ssize_t bytes=read(fd, state, avail);
-    if (bytes <= 0)
-        return NULL;
-
-    // trim trailing whitespace
-    while (bytes && isspace(*(state+bytes-1))) {
-        *(state + bytes - 1) = '\0';
+    while (bytes && isspace(state[bytes - 1]))
         --bytes;
+    state[bytes] = '\0';
+    return bytes;
+}
+
+static int watch_fd(int fd, void * item)
+{
+    struct epoll_event ev = {
+        .events = EPOLLPRI | EPOLLERR,
+        .data.ptr = item,
+    };
+
+    if (epoll_ctl(sndmonitor.epollfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ALOGE("epoll add fd %d failed: %s", fd, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+static bool is_card_monitored(int card)
+{
+    struct listnode *node;
+
+    list_for_each(node, &sndmonitor.cards) {
+        sndcard_t * s = node_to_item(node, sndcard_t, node);
+        if (s->card == card)
+            return true;
     }
-    lseek(fd, 0, SEEK_SET);
-    return state;
+    return false;
 }
 
 static int add_new_sndcard(int card, int fd)
@@ -134,22 +175,38 @@ static int add_new_sndcard(int card, int fd)
     if (!s)
         return -1;
 
+    s->type = WATCH_SNDCARD;
     s->card = card;
     s->fd = fd; // dup?
 
-    char * state = read_state(fd);
-    bool online = state && !strcmp(state, "ONLINE");
+    bool online = read_state(fd) > 0 && !strcmp(sndmonitor.state_buf, "ONLINE");
 
-    ALOGV("card %d initial state %s %d", card, state, online);
+    ALOGV("card %d initial state %s %d", card, sndmonitor.state_buf, online);
 
-    if (state)
-        free(state);
+    if (watch_fd(fd, s) < 0) {
+        free(s);
+        return -1;
+    }
 
     s->status = online ? CARD_STATUS_ONLINE : CARD_STATUS_OFFLINE;
     list_add_tail(&sndmonitor.cards, &s->node);
+    sndmonitor.num_cards++;
     return 0;
 }
 
+/* drops a card whose state node went away, the fd is closed here */
+static void remove_sndcard(sndcard_t * s)
+{
+    ALOGW("stop monitoring card %d", s->card);
+    epoll_ctl(sndmonitor.epollfd, EPOLL_CTL_DEL, s->fd, NULL);
+    list_remove(&s->node);
+    sndmonitor.num_cards--;
+    close(s->fd);
+    free(s);
+}
+
+/* May run again on the monitor thread to pick up state nodes that were
+   not present earlier, cards that are already monitored are skipped. */
 static int enum_sndcards()
 {
     const char* cards = "/proc/asound/cards";
@@ -160,7 +217,7 @@ static int enum_sndcards()
     char path[128] = {0};
     char *ptr, *saveptr, *card_id;
     int line_no=0;
-    unsigned int num_cards=0, num_cpe=0;
+    unsigned int num_cpe=0;
     FILE *fp;
     int fd, ret;
 
@@ -200,23 +257,23 @@ static int enum_sndcards()
             continue;
         }
 
-        snprintf(path, sizeof(path), "/proc/asound/card%s/state", ptr);
-        ALOGV("Opening sound card state : %s", path);
+        if (!is_card_monitored(atoi(ptr))) {
+            snprintf(path, sizeof(path), "/proc/asound/card%s/state", ptr);
+            ALOGV("Opening sound card state : %s", path);
 
-        fd = open(path, O_RDONLY);
-        if (fd == -1) {
-            ALOGE("Open %s failed : %s", path, strerror(errno));
-            continue;
-        }
+            fd = open(path, O_RDONLY);
+            if (fd == -1) {
+                ALOGE("Open %s failed : %s", path, strerror(errno));
+                continue;
+            }
 
-        ret = add_new_sndcard(atoi(ptr), fd);
-        if (ret != 0) {
-            close(fd); // card state fd ownership is taken by sndcard on success
-            continue;
+            ret = add_new_sndcard(atoi(ptr), fd);
+            if (ret != 0) {
+                close(fd); // card state fd ownership is taken by sndcard on success
+                continue;
+            }
         }
 
-        num_cards++;
-
         // query cpe state for this card as well
         tries=MAX_CPE_SLEEP_RETRY;
         snprintf(path, sizeof(path), "/proc/asound/card%s/cpe0_state", ptr);
@@ -226,6 +283,11 @@ static int enum_sndcards()
             continue;
         }
 
+        if (is_card_monitored(CPE_MAGIC_NUM+num_cpe)) {
+            num_cpe++;
+            continue;
+        }
+
         ALOGV("Open cpe state card state %s", path);
         while (--tries) {
             if ((fd = open(path, O_RDONLY)) < 0) {
@@ -246,14 +308,15 @@ static int enum_sndcards()
         }
 
         num_cpe++;
-        num_cards++;
     }
     if (line)
         free(line);
     fclose(fp);
 
     /* Add fd to query for SLPI status */
-    if (access(SPLI_STATE_PATH, R_OK) < 0) {
+    if (is_card_monitored(SLPI_MAGIC_NUM)) {
+        ALOGV("%s already monitored", SPLI_STATE_PATH);
+    } else if (access(SPLI_STATE_PATH, R_OK) < 0) {
         ALOGV("access to %s failed: %s", SPLI_STATE_PATH, strerror(errno));
     } else {
         tries = MAX_SLPI_SLEEP_RETRY;
@@ -271,14 +334,11 @@ static int enum_sndcards()
             ret = add_new_sndcard(SLPI_MAGIC_NUM, fd);
             if (ret != 0)
                 close(fd);
-            else
-                num_cards++;
         }
     }
 
-    ALOGV("sndmonitor registerer num_cards %d", num_cards);
-    sndmonitor.num_cards = num_cards;
-    return num_cards ? 0 : -1;
+    ALOGV("sndmonitor registerer num_cards %d", sndmonitor.num_cards);
+    return sndmonitor.num_cards ? 0 : -1;
 }
 
 static void free_sndcards()
@@ -290,6 +350,7 @@ static void free_sndcards()
         close(s->fd);
         free(s);
     }
+    sndmonitor.num_cards = 0;
 }
 
 static int add_new_dev_event(char * d_name, int fd)
@@ -299,8 +360,14 @@ static int add_new_dev_event(char * d_name, int fd)
     if (!d)
         return -1;
 
+    d->type = WATCH_DEV_EVENT;
     d->dev = strdup(d_name);
     d->fd = fd;
+    if (!d->dev || watch_fd(fd, d) < 0) {
+        free(d->dev);
+        free(d);
+        return -1;
+    }
     list_add_tail(&sndmonitor.dev_events, &d->node);
     return 0;
 }
@@ -334,6 +401,8 @@ static int enum_dev_events()
         } else {
             if (!add_new_dev_event(in_file->d_name, fd))
                 num_dev_events++;
+            else
+                close(fd);
         }
     }
     closedir(dp);
@@ -353,6 +422,7 @@ static void free_dev_events()
     }
 }
 
+/* hands the message over to the dispatch thread */
 static int notify(const struct str_parms * params)
 {
     if (!params)
@@ -363,26 +433,64 @@ static int notify(const struct str_parms * params)
     if (!str)
         return -1;
 
-    if (sndmonitor.notify)
-        sndmonitor.notify(sndmonitor.target, str);
+    size_t len = strlen(str);
+    snd_mon_msg_t * m = (snd_mon_msg_t *)malloc(sizeof(snd_mon_msg_t) + len + 1);
+
+    if (!m) {
+        free(str);
+        return -1;
+    }
+
+    memcpy(m->msg, str, len + 1);
+    pthread_mutex_lock(&sndmonitor.dispatch_lock);
+    list_add_tail(&sndmonitor.pending_msgs, &m->node);
+    pthread_cond_signal(&sndmonitor.dispatch_cond);
+    pthread_mutex_unlock(&sndmonitor.dispatch_lock);
 
     ALOGV("%s", str);
     free(str);
     return 0;
 }
 
+void * dispatch_thread_loop(void * args __unused)
+{
+    ALOGV("Start dispatch threadLoop()");
+    audio_extn_thread_policy_apply(AUDIO_THREAD_AUDIO, "Sndmon Dispatch");
+    pthread_mutex_lock(&sndmonitor.dispatch_lock);
+    while (1) {
+        while (list_empty(&sndmonitor.pending_msgs) && !sndmonitor.dispatch_exit)
+            pthread_cond_wait(&sndmonitor.dispatch_cond, &sndmonitor.dispatch_lock);
+
+        // deliver whatever is queued before honouring an exit request
+        if (list_empty(&sndmonitor.pending_msgs))
+            break;
+
+        struct listnode * n = list_head(&sndmonitor.pending_msgs);
+        snd_mon_msg_t * m = node_to_item(n, snd_mon_msg_t, node);
+        list_remove(n);
+        pthread_mutex_unlock(&sndmonitor.dispatch_lock);
+
+        if (sndmonitor.notify)
+            sndmonitor.notify(sndmonitor.target, m->msg);
+        free(m);
+
+        pthread_mutex_lock(&sndmonitor.dispatch_lock);
+    }
+    pthread_mutex_unlock(&sndmonitor.dispatch_lock);
+    return NULL;
+}
+
 int on_dev_event(dev_event_t * dev_event)
 {
-    char state_buf[2];
-    if (read(dev_event->fd, state_buf, 1) <= 0)
+    if (read_state(dev_event->fd) <= 0)
         return -1;
 
-    lseek(dev_event->fd, 0, SEEK_SET);
-    state_buf[1]='\0';
-    if (atoi(state_buf) == dev_event->status)
+    // only the first character carries the switch state
+    sndmonitor.state_buf[1] = '\0';
+    if (atoi(sndmonitor.state_buf) == dev_event->status)
         return 0;
 
-    dev_event->status = atoi(state_buf);
+    dev_event->status = atoi(sndmonitor.state_buf);
 
     struct str_parms * params = str_parms_create();
 
@@ -401,22 +509,22 @@ int on_dev_event(dev_event_t * dev_event)
     return ret;
 }
 
-bool on_sndcard_state_update(sndcard_t * s)
+/* returns -ENODEV when the state node is gone and the card must be dropped */
+int on_sndcard_state_update(sndcard_t * s)
 {
-    char rd_buf[9]={0};
     card_status_t status;
+    ssize_t bytes = read_state(s->fd);
 
-    if (read(s->fd, rd_buf, 8) <= 0)
+    if (bytes == -ENODEV || bytes == -EIO)
+        return -ENODEV;
+    if (bytes <= 0)
         return -1;
 
-    rd_buf[8] = '\0';
-    lseek(s->fd, 0, SEEK_SET);
-
-    ALOGV("card num %d, new state %s", s->card, rd_buf);
+    ALOGV("card num %d, new state %s", s->card, sndmonitor.state_buf);
 
-    if (strstr(rd_buf, "OFFLINE"))
+    if (strstr(sndmonitor.state_buf, "OFFLINE"))
         status = CARD_STATUS_OFFLINE;
-    else if (strstr(rd_buf, "ONLINE"))
+    else if (strstr(sndmonitor.state_buf, "ONLINE"))
         status = CARD_STATUS_ONLINE;
     else {
         ALOGE("unknown state");
@@ -451,106 +559,62 @@ bool on_sndcard_state_update(sndcard_t * s)
 
     int ret = notify(params);
     str_parms_destroy(params);
+
+    // state nodes such as cpe0_state may only appear once the card is up
+    if (status == CARD_STATUS_ONLINE && !is_cpe && !is_slpi)
+        enum_sndcards();
     return ret;
 }
 
 void * monitor_thread_loop(void * args __unused)
 {
     ALOGV("Start threadLoop()");
-    unsigned int num_poll_fds = sndmonitor.num_cards +
-                                sndmonitor.num_dev_events + 1/*pipe*/;
-    struct pollfd * pfd = (struct pollfd *)calloc(sizeof(struct pollfd),
-                                                  num_poll_fds);
-    if (!pfd)
-        return NULL;
-
-    pfd[0].fd = sndmonitor.intpipe[0];
-    pfd[0].events = POLLPRI|POLLIN;
-
-    int i=1;
-    struct listnode *node;
-    list_for_each(node, &sndmonitor.cards) {
-        sndcard_t * s = node_to_item(node, sndcard_t, node);
-        pfd[i].fd = s->fd;
-        pfd[i].events = POLLPRI;
-        ++i;
-    }
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int i, n;
 
-    list_for_each(node, &sndmonitor.dev_events) {
-        dev_event_t * d = node_to_item(node, dev_event_t, node);
-        pfd[i].fd = d->fd;
-        pfd[i].events = POLLPRI;
-        ++i;
-    }
+    audio_extn_thread_policy_apply(AUDIO_THREAD_AUDIO, "Sndmon Monitor");
 
     while (1) {
-        if (poll(pfd, num_poll_fds, -1) < 0) {
+        n = epoll_wait(sndmonitor.epollfd, events, MAX_EPOLL_EVENTS, -1);
+        if (n < 0) {
             int errno_ = errno;
-            ALOGE("poll() failed w/ err %s", strerror(errno));
+            ALOGE("epoll_wait() failed w/ err %s", strerror(errno));
             switch (errno_) {
             case EINTR:
+                continue;
             case ENOMEM:
                 sleep(2);
                 continue;
             default:
                 /* above errors can be caused due to current system
                    state .. any other error is not expected */
-                LOG_ALWAYS_FATAL("unxpected poll() system call failure");
-                break;
-            }
-        }
-        ALOGV("out of poll()");
-
-#define READY_TO_READ(p) ((p)->revents & (POLLIN|POLLPRI))
-#define ERROR_IN_FD(p) ((p)->revents & (POLLERR|POLLHUP|POLLNVAL))
-
-        // check if requested to exit
-        if (READY_TO_READ(&pfd[0])) {
-            char buf[2]={0};
-            read(pfd[0].fd, buf, 1);
-            if (!strcmp(buf, "Q"))
+                LOG_ALWAYS_FATAL("unxpected epoll_wait() system call failure");
                 break;
-        } else if (ERROR_IN_FD(&pfd[0])) {
-            // do not consider for poll again
-            // POLLERR - can this happen?
-            // POLLHUP - adev must not close pipe
-            // POLLNVAL - fd is valid
-            LOG_ALWAYS_FATAL("unxpected error in pipe poll fd 0x%x",
-                             pfd[0].revents);
-            pfd[0].fd *= -1;
-        }
-
-        i=1;
-        list_for_each(node, &sndmonitor.cards) {
-            sndcard_t * s = node_to_item(node, sndcard_t, node);
-            if (READY_TO_READ(&pfd[i]))
-                on_sndcard_state_update(s);
-            else if (ERROR_IN_FD(&pfd[i])) {
-                // do not consider for poll again
-                // POLLERR - can this happen as we are reading from a fs?
-                // POLLHUP - not valid for cardN/state
-                // POLLNVAL - fd is valid
-                LOG_ALWAYS_FATAL("unxpected error in card poll fd 0x%x",
-                                 pfd[i].revents);
-                pfd[i].fd *= -1;
             }
-            ++i;
         }
-
-        list_for_each(node, &sndmonitor.dev_events) {
-            dev_event_t * d = node_to_item(node, dev_event_t, node);
-            if (READY_TO_READ(&pfd[i]))
-                on_dev_event(d);
-            else if (ERROR_IN_FD(&pfd[i])) {
-                // do not consider for poll again
-                // POLLERR - can this happen as we are reading from a fs?
-                // POLLHUP - not valid for switch/state
-                // POLLNVAL - fd is valid
-                LOG_ALWAYS_FATAL("unxpected error in dev poll fd 0x%x",
-                                 pfd[i].revents);
-                pfd[i].fd *= -1;
+        ALOGV("out of epoll_wait() %d", n);
+
+        for (i = 0; i < n; i++) {
+            watch_type_t * type = (watch_type_t *)events[i].data.ptr;
+            uint32_t revents = events[i].events;
+
+            if (*type == WATCH_CTRL) {
+                // check if requested to exit
+                char buf[2]={0};
+                if (!(revents & EPOLLIN))
+                    LOG_ALWAYS_FATAL("unxpected error in pipe fd 0x%x", revents);
+                read(sndmonitor.intpipe[0], buf, 1);
+                if (!strcmp(buf, "Q"))
+                    return NULL;
+            } else if (*type == WATCH_SNDCARD) {
+                sndcard_t * s = (sndcard_t *)type;
+                // state files raise EPOLLERR along with EPOLLPRI on change,
+                // the card is only dropped once its node can't be read.
+                if (on_sndcard_state_update(s) == -ENODEV)
+                    remove_sndcard(s);
+            } else {
+                on_dev_event((dev_event_t *)type);
             }
-            ++i;
         }
     }
 
@@ -624,6 +688,15 @@ static int del_listener(void * stream)
     return 0;
 }
 
+static void stop_dispatch_thread()
+{
+    pthread_mutex_lock(&sndmonitor.dispatch_lock);
+    sndmonitor.dispatch_exit = true;
+    pthread_cond_signal(&sndmonitor.dispatch_cond);
+    pthread_mutex_unlock(&sndmonitor.dispatch_lock);
+    pthread_join(sndmonitor.dispatch_thread, (void **) NULL);
+}
+
 // --- public APIs --- //
 
 int audio_extn_snd_mon_deinit()
@@ -633,9 +706,13 @@ int audio_extn_snd_mon_deinit()
 
     write(sndmonitor.intpipe[1], "Q", 1);
     pthread_join(sndmonitor.monitor_thread, (void **) NULL);
+    stop_dispatch_thread();
+    pthread_cond_destroy(&sndmonitor.dispatch_cond);
+    pthread_mutex_destroy(&sndmonitor.dispatch_lock);
     free_dev_events();
     listeners_deinit();
     free_sndcards();
+    close(sndmonitor.epollfd);
     close(sndmonitor.intpipe[0]);
     close(sndmonitor.intpipe[1]);
 
@@ -649,11 +726,25 @@ int audio_extn_snd_mon_init()
     sndmonitor.target = NULL; // unused for now
     list_init(&sndmonitor.cards);
     list_init(&sndmonitor.dev_events);
+    list_init(&sndmonitor.pending_msgs);
+    sndmonitor.num_cards = 0;
+    sndmonitor.ctrl_watch = WATCH_CTRL;
     sndmonitor.initcheck = false;
 
     if (pipe(sndmonitor.intpipe) < 0)
         goto pipe_error;
 
+    sndmonitor.epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sndmonitor.epollfd < 0)
+        goto epoll_error;
+
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.ptr = &sndmonitor.ctrl_watch,
+    };
+    if (epoll_ctl(sndmonitor.epollfd, EPOLL_CTL_ADD, sndmonitor.intpipe[0], &ev) < 0)
+        goto enum_sncards_error;
+
     if (enum_sndcards() < 0)
         goto enum_sncards_error;
 
@@ -664,9 +755,20 @@ int audio_extn_snd_mon_init()
     enum_dev_events(); // failure here isn't fatal
 #endif
 
-    int ret = pthread_create(&sndmonitor.monitor_thread,
+    pthread_mutex_init(&sndmonitor.dispatch_lock, (const pthread_mutexattr_t *) NULL);
+    pthread_cond_init(&sndmonitor.dispatch_cond, (const pthread_condattr_t *) NULL);
+    sndmonitor.dispatch_exit = false;
+    int ret = pthread_create(&sndmonitor.dispatch_thread,
                              (const pthread_attr_t *) NULL,
-                             monitor_thread_loop, NULL);
+                             dispatch_thread_loop, NULL);
+
+    if (ret) {
+        goto dispatch_thread_create_error;
+    }
+
+    ret = pthread_create(&sndmonitor.monitor_thread,
+                         (const pthread_attr_t *) NULL,
+                         monitor_thread_loop, NULL);
 
     if (ret) {
         goto monitor_thread_create_error;
@@ -675,10 +777,17 @@ int audio_extn_snd_mon_init()
     return 0;
 
 monitor_thread_create_error:
+    stop_dispatch_thread();
+dispatch_thread_create_error:
+    pthread_cond_destroy(&sndmonitor.dispatch_cond);
+    pthread_mutex_destroy(&sndmonitor.dispatch_lock);
+    free_dev_events();
     listeners_deinit();
 listeners_error:
     free_sndcards();
 enum_sncards_error:
+    close(sndmonitor.epollfd);
+epoll_error:
     close(sndmonitor.intpipe[0]);
     close(sndmonitor.intpipe[1]);
 pipe_error:
@@ -24,6 +24,7 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <log/log.h>
+#include <cutils/properties.h>
 #include "audio_hw.h"
 #include "audio_extn.h"
 #include "platform.h"
@@ -145,9 +146,39 @@ do {                                                                      \
  */
 const unsigned int sthal_prop_api_version = STHAL_PROP_API_CURRENT_VERSION;
 
+/* Depth of the look ahead buffer drained in the background once a keyword
+ * was detected and the client opened the capture stream of the session,
+ * 0 keeps reading synchronously from the client thread.
+ */
+#define ST_LAB_PREFETCH_MS_PROPERTY "vendor.audio.sound_trigger.lab_prefetch_ms"
+#define ST_LAB_PREFETCH_MIN_PERIODS 4
+
+/* Ring filled from STHAL by a detached reader thread. Shared by the session
+ * and the reader, the last one to drop its reference frees it.
+ */
+struct st_lab_prefetch {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct sound_trigger_session_info st_ses;
+    uint8_t *ring;
+    size_t ring_size;
+    uint8_t *chunk;
+    size_t chunk_size;
+    /* running byte counts, wr - rd is the fill level */
+    size_t rd;
+    size_t wr;
+    /* first error returned by STHAL, sticky */
+    int status;
+    bool exit;
+    /* reader thread has not returned yet */
+    bool running;
+    int refs;
+};
+
 struct sound_trigger_info  {
     struct sound_trigger_session_info st_ses;
     bool lab_stopped;
+    struct st_lab_prefetch *prefetch;
     struct listnode list;
 };
 
@@ -162,6 +193,165 @@ struct sound_trigger_audio_device {
 
 static struct sound_trigger_audio_device *st_dev;
 
+static void lab_prefetch_put_l(struct st_lab_prefetch *pf)
+{
+    if (--pf->refs > 0) {
+        pthread_mutex_unlock(&pf->lock);
+        return;
+    }
+    pthread_mutex_unlock(&pf->lock);
+    pthread_cond_destroy(&pf->cond);
+    pthread_mutex_destroy(&pf->lock);
+    free(pf->ring);
+    free(pf->chunk);
+    free(pf);
+}
+
+static void *lab_prefetch_thread_loop(void *context)
+{
+    struct st_lab_prefetch *pf = (struct st_lab_prefetch *)context;
+    struct audio_event_info event;
+    size_t offset, len;
+    int ret;
+
+    ALOGV("%s: start capture_handle %d", __func__, pf->st_ses.capture_handle);
+    audio_extn_thread_policy_apply(AUDIO_THREAD_AUDIO, "LAB Prefetch");
+    pthread_mutex_lock(&pf->lock);
+    while (!pf->exit) {
+        if (pf->ring_size - (pf->wr - pf->rd) < pf->chunk_size) {
+            pthread_cond_wait(&pf->cond, &pf->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pf->lock);
+
+        event.u.aud_info.ses_info = &pf->st_ses;
+        event.u.aud_info.buf = pf->chunk;
+        event.u.aud_info.num_bytes = pf->chunk_size;
+        ret = st_dev->st_callback(AUDIO_EVENT_READ_SAMPLES, &event);
+
+        pthread_mutex_lock(&pf->lock);
+        if (ret) {
+            pf->status = ret;
+            break;
+        }
+        offset = pf->wr % pf->ring_size;
+        len = pf->ring_size - offset;
+        if (len > pf->chunk_size)
+            len = pf->chunk_size;
+        memcpy(pf->ring + offset, pf->chunk, len);
+        memcpy(pf->ring, pf->chunk + len, pf->chunk_size - len);
+        pf->wr += pf->chunk_size;
+        pthread_cond_broadcast(&pf->cond);
+    }
+    ALOGV("%s: exit status %d", __func__, pf->status);
+    pf->running = false;
+    pthread_cond_broadcast(&pf->cond);
+    lab_prefetch_put_l(pf);
+    return NULL;
+}
+
+static struct st_lab_prefetch *lab_prefetch_start(
+                                    const struct sound_trigger_session_info *st_ses)
+{
+    struct st_lab_prefetch *pf;
+    pthread_attr_t attr;
+    pthread_t thread;
+    size_t frame_size;
+    int prefetch_ms = property_get_int32(ST_LAB_PREFETCH_MS_PROPERTY, 0);
+
+    if (prefetch_ms <= 0 || !st_ses->config.rate || !st_ses->config.period_size)
+        return NULL;
+
+    pf = (struct st_lab_prefetch *)calloc(1, sizeof(struct st_lab_prefetch));
+    if (!pf)
+        return NULL;
+
+    pf->st_ses = *st_ses;
+    frame_size = st_ses->config.channels * (pcm_format_to_bits(st_ses->config.format) >> 3);
+    pf->chunk_size = st_ses->config.period_size * frame_size;
+    pf->ring_size = (size_t)prefetch_ms * st_ses->config.rate / 1000 * frame_size;
+    if (pf->ring_size < pf->chunk_size * ST_LAB_PREFETCH_MIN_PERIODS)
+        pf->ring_size = pf->chunk_size * ST_LAB_PREFETCH_MIN_PERIODS;
+    pf->ring = (uint8_t *)malloc(pf->ring_size);
+    pf->chunk = (uint8_t *)malloc(pf->chunk_size);
+    if (!pf->ring || !pf->chunk || pf->chunk_size == 0)
+        goto fail;
+
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+    /* one reference for the session, one for the reader */
+    pf->refs = 2;
+    pf->running = true;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, lab_prefetch_thread_loop, pf)) {
+        pthread_attr_destroy(&attr);
+        pthread_cond_destroy(&pf->cond);
+        pthread_mutex_destroy(&pf->lock);
+        goto fail;
+    }
+    pthread_attr_destroy(&attr);
+    ALOGD("%s: capture_handle %d ring %zu bytes", __func__,
+          st_ses->capture_handle, pf->ring_size);
+    return pf;
+
+fail:
+    ALOGE("%s: failed to start LAB prefetch", __func__);
+    free(pf->ring);
+    free(pf->chunk);
+    free(pf);
+    return NULL;
+}
+
+/* Stops further reads from STHAL, buffered data can still be consumed */
+static void lab_prefetch_stop(struct st_lab_prefetch *pf)
+{
+    pthread_mutex_lock(&pf->lock);
+    pf->exit = true;
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+static void lab_prefetch_put(struct st_lab_prefetch *pf)
+{
+    pthread_mutex_lock(&pf->lock);
+    lab_prefetch_put_l(pf);
+}
+
+/* Returns the number of bytes copied, less than requested only once the
+ * reader thread has returned and the ring is drained.
+ */
+static size_t lab_prefetch_read(struct st_lab_prefetch *pf, void *buffer, size_t bytes)
+{
+    uint8_t *dst = (uint8_t *)buffer;
+    size_t copied = 0, offset, len, avail;
+
+    pthread_mutex_lock(&pf->lock);
+    while (copied < bytes) {
+        avail = pf->wr - pf->rd;
+        if (avail == 0) {
+            if (!pf->running)
+                break;
+            pthread_cond_wait(&pf->cond, &pf->lock);
+            continue;
+        }
+        if (avail > bytes - copied)
+            avail = bytes - copied;
+        offset = pf->rd % pf->ring_size;
+        len = pf->ring_size - offset;
+        if (len > avail)
+            len = avail;
+        memcpy(dst + copied, pf->ring + offset, len);
+        memcpy(dst + copied + len, pf->ring, avail - len);
+        copied += avail;
+        pf->rd += avail;
+        pthread_cond_broadcast(&pf->cond);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return copied;
+}
+
 static struct sound_trigger_info *
 get_sound_trigger_info(int capture_handle)
 {
@@ -222,6 +412,7 @@ int audio_hw_call_back(sound_trigger_event_type_t event,
 {
     int status = 0;
     struct sound_trigger_info  *st_ses_info;
+    struct st_lab_prefetch *prefetch = NULL;
 
     if (!st_dev)
        return -EINVAL;
@@ -261,6 +452,7 @@ int audio_hw_call_back(sound_trigger_event_type_t event,
         ALOGV("%s: remove capture_handle %d pcm %p", __func__,
               st_ses_info->st_ses.capture_handle, st_ses_info->st_ses.pcm);
         list_remove(&st_ses_info->list);
+        prefetch = st_ses_info->prefetch;
         free(st_ses_info);
         break;
     default:
@@ -268,6 +460,16 @@ int audio_hw_call_back(sound_trigger_event_type_t event,
         break;
     }
     pthread_mutex_unlock(&st_dev->lock);
+    /* The session is gone once this returns. Not waiting for the reader: it
+     * can be blocked in AUDIO_EVENT_READ_SAMPLES while STHAL holds its
+     * session lock across this callback. The reader checks exit under
+     * pf->lock right before each read, so no read starts after this, and
+     * one already in flight is the same case as a client read in flight.
+     */
+    if (prefetch) {
+        lab_prefetch_stop(prefetch);
+        lab_prefetch_put(prefetch);
+    }
     return status;
 }
 
@@ -276,7 +478,11 @@ int audio_extn_sound_trigger_read(struct stream_in *in, void *buffer,
 {
     int ret = -1;
     struct sound_trigger_info  *st_info = NULL;
+    struct sound_trigger_session_info st_ses;
+    struct st_lab_prefetch *prefetch = NULL;
     struct audio_event_info event;
+    bool found = false;
+    size_t copied = 0;
 
     if (!st_dev)
        return ret;
@@ -290,11 +496,28 @@ int audio_extn_sound_trigger_read(struct stream_in *in, void *buffer,
 
     pthread_mutex_lock(&st_dev->lock);
     st_info = get_sound_trigger_info(in->capture_handle);
-    pthread_mutex_unlock(&st_dev->lock);
+    /* st_info can be freed by a deregister as soon as the lock is dropped */
     if (st_info) {
-        event.u.aud_info.ses_info = &st_info->st_ses;
-        event.u.aud_info.buf = buffer;
-        event.u.aud_info.num_bytes = bytes;
+        st_ses = st_info->st_ses;
+        found = true;
+        if (st_info->prefetch) {
+            prefetch = st_info->prefetch;
+            pthread_mutex_lock(&prefetch->lock);
+            prefetch->refs++;
+            pthread_mutex_unlock(&prefetch->lock);
+        }
+    }
+    pthread_mutex_unlock(&st_dev->lock);
+    if (prefetch) {
+        copied = lab_prefetch_read(prefetch, buffer, bytes);
+        lab_prefetch_put(prefetch);
+        ret = 0;
+    }
+    /* read synchronously what the prefetch could not provide */
+    if (found && copied < bytes) {
+        event.u.aud_info.ses_info = &st_ses;
+        event.u.aud_info.buf = (uint8_t *)buffer + copied;
+        event.u.aud_info.num_bytes = bytes - copied;
         ret = st_dev->st_callback(AUDIO_EVENT_READ_SAMPLES, &event);
     }
 
@@ -313,6 +536,7 @@ exit:
 void audio_extn_sound_trigger_stop_lab(struct stream_in *in)
 {
     struct sound_trigger_info  *st_ses_info = NULL;
+    struct st_lab_prefetch *prefetch = NULL;
     struct audio_event_info event;
 
     if (!st_dev || !in || !in->is_st_session_active)
@@ -320,10 +544,19 @@ void audio_extn_sound_trigger_stop_lab(struct stream_in *in)
 
     pthread_mutex_lock(&st_dev->lock);
     st_ses_info = get_sound_trigger_info(in->capture_handle);
-    pthread_mutex_unlock(&st_dev->lock);
     if (st_ses_info) {
         event.u.ses_info = st_ses_info->st_ses;
-        ALOGV("%s: AUDIO_EVENT_STOP_LAB pcm %p", __func__, st_ses_info->st_ses.pcm);
+        /* the next detection starts a new reader */
+        prefetch = st_ses_info->prefetch;
+        st_ses_info->prefetch = NULL;
+    }
+    pthread_mutex_unlock(&st_dev->lock);
+    if (prefetch) {
+        lab_prefetch_stop(prefetch);
+        lab_prefetch_put(prefetch);
+    }
+    if (st_ses_info) {
+        ALOGV("%s: AUDIO_EVENT_STOP_LAB pcm %p", __func__, event.u.ses_info.pcm);
         st_dev->st_callback(AUDIO_EVENT_STOP_LAB, &event);
         in->is_st_session_active = false;
     }
@@ -349,6 +582,9 @@ void audio_extn_sound_trigger_check_and_get_session(struct stream_in *in)
             in->channel_mask = audio_channel_in_mask_from_count(in->config.channels);
             in->is_st_session = true;
             in->is_st_session_active = true;
+            /* the keyword was detected, LAB data is only readable from now */
+            if (!st_ses_info->prefetch)
+                st_ses_info->prefetch = lab_prefetch_start(&st_ses_info->st_ses);
             ALOGV("%s: capture_handle %d is sound trigger", __func__, in->capture_handle);
             break;
         }
@@ -30,6 +30,7 @@
 #include <dlfcn.h>
 #include <math.h>
 #include <cutils/properties.h>
+#include <utils/Timers.h>
 #include "audio_extn.h"
 #include <linux/msm_audio_calibration.h>
 
@@ -68,6 +69,10 @@
 #define WAIT_FOR_GET_CALIB_STATUS (200)
 #define GET_SPKR_PROT_CAL_TIMEOUT_MSEC (5000)
 
+/*Upper bound for how long the scheduler sleeps before rechecking
+  the idle window when nothing kicks it*/
+#define SPKR_CALIB_SCHED_WAIT_MSEC (WAIT_TIME_SPKR_CALIB / 1000)
+
 /*Speaker states*/
 #define SPKR_NOT_CALIBRATED -1
 #define SPKR_CALIBRATED 1
@@ -108,6 +113,19 @@ struct speaker_prot_session {
     bool spkr_prot_enable;
     bool spkr_in_use;
    struct timespec spkr_last_time_used;
+    /* calibration scheduler, protected by sched_mutex */
+    pthread_mutex_t sched_mutex;
+    pthread_cond_t sched_cond;
+    bool sched_kick;
+    int pending_opens;
+    bool calib_need_screen_off;
+    /* calibration cost metrics, protected by sched_mutex */
+    unsigned int calib_attempts;
+    unsigned int calib_preempted;
+    unsigned int calib_done;
+    int64_t calib_last_ns;
+    int64_t calib_total_ns;
+    int64_t calib_max_ns;
 };
 
 static struct pcm_config pcm_config_skr_prot = {
@@ -124,6 +142,67 @@ static struct pcm_config pcm_config_skr_prot = {
 static struct speaker_prot_session handle;
 static int vi_feed_no_channels;
 
+static void spkr_calib_sched_kick()
+{
+    if (!handle.spkr_prot_enable)
+        return;
+    pthread_mutex_lock(&handle.sched_mutex);
+    handle.sched_kick = true;
+    pthread_cond_signal(&handle.sched_cond);
+    pthread_mutex_unlock(&handle.sched_mutex);
+}
+
+/* sleeps until the idle window may have changed or wait_ms expired */
+static void spkr_calib_sched_wait(int wait_ms)
+{
+    struct timespec ts;
+
+    if (wait_ms > SPKR_CALIB_SCHED_WAIT_MSEC)
+        wait_ms = SPKR_CALIB_SCHED_WAIT_MSEC;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += wait_ms / 1000;
+    ts.tv_nsec += (wait_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&handle.sched_mutex);
+    if (!handle.sched_kick)
+        pthread_cond_timedwait(&handle.sched_cond, &handle.sched_mutex, &ts);
+    handle.sched_kick = false;
+    pthread_mutex_unlock(&handle.sched_mutex);
+}
+
+/* a stream open in flight preempts any calibration */
+static bool spkr_calib_preempted()
+{
+    bool preempted;
+
+    pthread_mutex_lock(&handle.sched_mutex);
+    preempted = handle.pending_opens > 0;
+    pthread_mutex_unlock(&handle.sched_mutex);
+    return preempted;
+}
+
+static void spkr_calib_record(int64_t start_ns, int status, bool preempted)
+{
+    int64_t cost_ns = systemTime(SYSTEM_TIME_MONOTONIC) - start_ns;
+
+    pthread_mutex_lock(&handle.sched_mutex);
+    handle.calib_attempts++;
+    if (!status)
+        handle.calib_done++;
+    if (preempted)
+        handle.calib_preempted++;
+    handle.calib_last_ns = cost_ns;
+    handle.calib_total_ns += cost_ns;
+    if (cost_ns > handle.calib_max_ns)
+        handle.calib_max_ns = cost_ns;
+    pthread_mutex_unlock(&handle.sched_mutex);
+    ALOGD("%s: calibration status %d took %lld ms", __func__, status,
+          (long long)(cost_ns / 1000000));
+}
+
 static void spkr_prot_set_spkrstatus(bool enable)
 {
     struct timespec ts;
@@ -177,6 +256,36 @@ static bool is_speaker_in_use(unsigned long *sec)
      }
 }
 
+/* Returns 0 when calibration may run now, otherwise how long to sleep
+   before the idle window should be checked again. Called with adev->lock
+   held. */
+static int spkr_calib_idle_wait_ms_l(struct audio_device *adev,
+                                     unsigned long min_idle_time)
+{
+    unsigned long sec = 0;
+
+    if (spkr_calib_preempted() || !list_empty(&adev->usecase_list)) {
+        ALOGV("%s: stream active or opening", __func__);
+        return SPKR_CALIB_SCHED_WAIT_MSEC;
+    }
+    if (is_speaker_in_use(&sec)) {
+        ALOGV("%s: speaker in use", __func__);
+        return SPKR_CALIB_SCHED_WAIT_MSEC;
+    }
+    if (handle.calib_need_screen_off && !adev->screen_off) {
+        ALOGV("%s: screen on", __func__);
+        return SPKR_CALIB_SCHED_WAIT_MSEC;
+    }
+    if (sec < min_idle_time) {
+        /* min_idle_time comes from a property, keep the product out of int */
+        int64_t wait_ms = (int64_t)(min_idle_time - sec) * 1000;
+
+        ALOGV("%s: speaker idle %ld min time %ld", __func__, sec, min_idle_time);
+        return wait_ms > SPKR_CALIB_SCHED_WAIT_MSEC ? SPKR_CALIB_SCHED_WAIT_MSEC : (int)wait_ms;
+    }
+    return 0;
+}
+
 
 static int get_spkr_prot_cal(int cal_fd,
 				struct audio_cal_info_msm_spk_prot_status *status)
@@ -305,6 +414,8 @@ static int spkr_calibrate(int t0)
     struct timespec ts;
     int retry_duration;
     int app_type = 0;
+    int64_t start_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    bool preempted = false;
 
     if (!adev) {
         ALOGE("%s: Invalid params", __func__);
@@ -330,7 +441,7 @@ static int spkr_calibrate(int t0)
             goto exit;
         }
     }
-    uc_info_rx = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    uc_info_rx = alloc_usecase(adev);
     if (!uc_info_rx) {
         return -ENOMEM;
     }
@@ -340,7 +451,7 @@ static int spkr_calibrate(int t0)
     uc_info_rx->stream.out = adev->primary_output;
     uc_info_rx->out_snd_device = SND_DEVICE_OUT_SPEAKER_PROTECTED;
     disable_rx = true;
-    list_add_tail(&adev->usecase_list, &uc_info_rx->list);
+    add_usecase_to_list(adev, uc_info_rx);
     enable_snd_device(adev, SND_DEVICE_OUT_SPEAKER_PROTECTED);
     enable_audio_route(adev, uc_info_rx);
 
@@ -361,8 +472,7 @@ static int spkr_calibrate(int t0)
         status.status = -EIO;
         goto exit;
     }
-    uc_info_tx = (struct audio_usecase *)
-    calloc(1, sizeof(struct audio_usecase));
+    uc_info_tx = alloc_usecase(adev);
     if (!uc_info_tx) {
         status.status = -ENOMEM;
         goto exit;
@@ -373,7 +483,7 @@ static int spkr_calibrate(int t0)
     uc_info_tx->out_snd_device = SND_DEVICE_NONE;
 
     disable_tx = true;
-    list_add_tail(&adev->usecase_list, &uc_info_tx->list);
+    add_usecase_to_list(adev, uc_info_tx);
     enable_snd_device(adev, SND_DEVICE_IN_CAPTURE_VI_FEEDBACK);
     enable_audio_route(adev, uc_info_tx);
 
@@ -415,6 +525,7 @@ static int spkr_calibrate(int t0)
     pthread_mutex_lock(&handle.spkr_calib_cancelack_mutex);
     if (handle.cancel_spkr_calib) {
         status.status = -EAGAIN;
+        preempted = true;
         goto exit;
     }
 
@@ -452,6 +563,11 @@ static int spkr_calibrate(int t0)
                 }
                 break;
             } else if (status.status == -EAGAIN) {
+                  if (spkr_calib_preempted()) {
+                      ALOGD("%s: stream open pending, abort calibration", __func__);
+                      preempted = true;
+                      break;
+                  }
                   ALOGD("%s: spkr_prot_thread try again", __func__);
                   usleep(WAIT_FOR_GET_CALIB_STATUS * 1000);
                   retry_duration += WAIT_FOR_GET_CALIB_STATUS;
@@ -504,23 +620,27 @@ exit:
     if (acdb_fd >= 0)
         close(acdb_fd);
 
+    /* cost excludes holding the speaker afterwards until the next stream */
+    if (cleanup)
+        spkr_calib_record(start_ns, status.status, preempted);
+
     if (!handle.cancel_spkr_calib && cleanup) {
         pthread_mutex_unlock(&handle.spkr_calib_cancelack_mutex);
         pthread_cond_wait(&handle.spkr_calib_cancel, &handle.mutex_spkr_prot);
         pthread_mutex_lock(&handle.spkr_calib_cancelack_mutex);
     }
     if (disable_rx) {
-        list_remove(&uc_info_rx->list);
+        remove_usecase_from_list(adev, uc_info_rx);
         disable_snd_device(adev, SND_DEVICE_OUT_SPEAKER_PROTECTED);
         disable_audio_route(adev, uc_info_rx);
     }
     if (disable_tx) {
-        list_remove(&uc_info_tx->list);
+        remove_usecase_from_list(adev, uc_info_tx);
         disable_snd_device(adev, SND_DEVICE_IN_CAPTURE_VI_FEEDBACK);
         disable_audio_route(adev, uc_info_tx);
     }
-    if (uc_info_rx) free(uc_info_rx);
-    if (uc_info_tx) free(uc_info_tx);
+    free_usecase(adev, uc_info_rx);
+    free_usecase(adev, uc_info_tx);
     if (cleanup) {
         if (handle.cancel_spkr_calib)
             pthread_cond_signal(&handle.spkr_calibcancel_ack);
@@ -535,7 +655,6 @@ exit:
 
 static void* spkr_calibration_thread()
 {
-    unsigned long sec = 0;
     int t0;
     bool goahead = false;
     struct audio_cal_info_spk_prot_cfg protCfg;
@@ -554,6 +673,7 @@ static void* spkr_calibration_thread()
     if (atoi(value) > 0)
         min_idle_time = atoi(value);
     handle.speaker_prot_threadid = pthread_self();
+    audio_extn_thread_policy_apply(AUDIO_THREAD_BACKGROUND, "Spkr Calibration");
     ALOGD("spkr_prot_thread enable prot Entry");
     acdb_fd = open("/dev/msm_audio_cal",O_RDWR | O_NONBLOCK);
     if (acdb_fd >= 0) {
@@ -622,6 +742,19 @@ static void* spkr_calibration_thread()
     }
 
     while (1) {
+        int wait_ms;
+
+        /* Only ask the thermal daemon for t0 once the idle window is open,
+           the scheduler is kicked by speaker release, screen state changes
+           and stream opens instead of retrying at a fixed rate. */
+        pthread_mutex_lock(&adev->lock);
+        wait_ms = spkr_calib_idle_wait_ms_l(adev, min_idle_time);
+        pthread_mutex_unlock(&adev->lock);
+        if (wait_ms > 0) {
+            spkr_calib_sched_wait(wait_ms);
+            continue;
+        }
+
         ALOGV("%s: start calibration", __func__);
         if (!handle.thermal_client_request("spkr",1)) {
             ALOGD("%s: wait for callback from thermal daemon", __func__);
@@ -645,24 +778,12 @@ static void* spkr_calibration_thread()
         }
         goahead = false;
         pthread_mutex_lock(&adev->lock);
-        if (is_speaker_in_use(&sec)) {
-            ALOGD("%s: Speaker in use retry calibration", __func__);
+        /* the window may have closed while waiting for t0 */
+        if (spkr_calib_idle_wait_ms_l(adev, min_idle_time) > 0) {
+            ALOGD("%s: idle window closed retry calibration", __func__);
             pthread_mutex_unlock(&adev->lock);
-            continue;
-        } else {
-            ALOGD("%s: speaker idle %ld min time %ld", __func__, sec, min_idle_time);
-            if (sec < min_idle_time) {
-                ALOGD("%s: speaker idle is less retry", __func__);
-                pthread_mutex_unlock(&adev->lock);
-                continue;
-            }
+        } else
             goahead = true;
-        }
-        if (!list_empty(&adev->usecase_list)) {
-            ALOGD("%s: Usecase active re-try calibration", __func__);
-            goahead = false;
-            pthread_mutex_unlock(&adev->lock);
-        }
         if (goahead) {
                 int status;
                 status = spkr_calibrate(t0);
@@ -726,6 +847,14 @@ void audio_extn_spkr_prot_init(void *adev)
     pthread_mutex_init(&handle.mutex_spkr_prot, NULL);
     pthread_mutex_init(&handle.spkr_calib_cancelack_mutex, NULL);
     pthread_mutex_init(&handle.spkr_prot_thermalsync_mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&handle.sched_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&handle.sched_mutex, NULL);
+    handle.calib_need_screen_off =
+        property_get_bool("vendor.audio.spkr_prot.cal_screen_off", true);
     handle.thermal_handle = dlopen(THERMAL_CLIENT_LIBRARY_PATH,
             RTLD_NOW);
     if (!handle.thermal_handle) {
@@ -814,7 +943,7 @@ int audio_extn_spkr_prot_start_processing(snd_device_t snd_device)
     }
     snd_device = audio_extn_get_spkr_prot_snd_device(snd_device);
     spkr_prot_set_spkrstatus(true);
-    uc_info_tx = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    uc_info_tx = alloc_usecase(adev);
     if (!uc_info_tx) {
         return -ENOMEM;
     }
@@ -830,7 +959,7 @@ int audio_extn_spkr_prot_start_processing(snd_device_t snd_device)
         uc_info_tx->in_snd_device = SND_DEVICE_IN_CAPTURE_VI_FEEDBACK;
         uc_info_tx->out_snd_device = SND_DEVICE_NONE;
         handle.pcm_tx = NULL;
-        list_add_tail(&adev->usecase_list, &uc_info_tx->list);
+        add_usecase_to_list(adev, uc_info_tx);
         enable_snd_device(adev, SND_DEVICE_IN_CAPTURE_VI_FEEDBACK);
         enable_audio_route(adev, uc_info_tx);
 
@@ -875,10 +1004,10 @@ exit:
         if (handle.pcm_tx)
             pcm_close(handle.pcm_tx);
         handle.pcm_tx = NULL;
-        list_remove(&uc_info_tx->list);
+        remove_usecase_from_list(adev, uc_info_tx);
         disable_snd_device(adev, SND_DEVICE_IN_CAPTURE_VI_FEEDBACK);
         disable_audio_route(adev, uc_info_tx);
-        free(uc_info_tx);
+        free_usecase(adev, uc_info_tx);
     } else
         handle.spkr_processing_state = SPKR_PROCESSING_IN_PROGRESS;
     pthread_mutex_unlock(&handle.mutex_spkr_prot);
@@ -894,6 +1023,7 @@ void audio_extn_spkr_prot_stop_processing(snd_device_t snd_device)
     ALOGV("%s: Entry", __func__);
     snd_device = audio_extn_get_spkr_prot_snd_device(snd_device);
     spkr_prot_set_spkrstatus(false);
+    spkr_calib_sched_kick();
     pthread_mutex_lock(&handle.mutex_spkr_prot);
     if (adev && handle.spkr_processing_state == SPKR_PROCESSING_IN_PROGRESS) {
         uc_info_tx = get_usecase_from_list(adev, USECASE_AUDIO_SPKR_CALIB_TX);
@@ -902,9 +1032,9 @@ void audio_extn_spkr_prot_stop_processing(snd_device_t snd_device)
         handle.pcm_tx = NULL;
         disable_snd_device(adev, SND_DEVICE_IN_CAPTURE_VI_FEEDBACK);
         if (uc_info_tx) {
-            list_remove(&uc_info_tx->list);
+            remove_usecase_from_list(adev, uc_info_tx);
             disable_audio_route(adev, uc_info_tx);
-            free(uc_info_tx);
+            free_usecase(adev, uc_info_tx);
         }
     }
     handle.spkr_processing_state = SPKR_PROCESSING_IN_IDLE;
@@ -915,6 +1045,56 @@ void audio_extn_spkr_prot_stop_processing(snd_device_t snd_device)
     ALOGV("%s: Exit", __func__);
 }
 
+void audio_extn_spkr_prot_stream_open_begin(void *adev)
+{
+    if (!handle.spkr_prot_enable)
+        return;
+
+    pthread_mutex_lock(&handle.sched_mutex);
+    handle.pending_opens++;
+    pthread_mutex_unlock(&handle.sched_mutex);
+
+    /* tear down a running calibration before the new stream needs the
+       speaker, rather than when its device gets enabled */
+    pthread_mutex_lock(&((struct audio_device *)adev)->lock);
+    audio_extn_spkr_prot_calib_cancel(adev);
+    pthread_mutex_unlock(&((struct audio_device *)adev)->lock);
+}
+
+void audio_extn_spkr_prot_stream_open_end(void *adev __unused)
+{
+    if (!handle.spkr_prot_enable)
+        return;
+
+    pthread_mutex_lock(&handle.sched_mutex);
+    handle.pending_opens--;
+    pthread_mutex_unlock(&handle.sched_mutex);
+    spkr_calib_sched_kick();
+}
+
+void audio_extn_spkr_prot_screen_state_changed()
+{
+    spkr_calib_sched_kick();
+}
+
+void audio_extn_spkr_prot_dump(int fd)
+{
+    if (!handle.spkr_prot_enable)
+        return;
+
+    pthread_mutex_lock(&handle.sched_mutex);
+    dprintf(fd, "  Speaker protection calibration:\n");
+    dprintf(fd, "    mode=%d attempts=%u done=%u preempted=%u\n",
+            handle.spkr_prot_mode, handle.calib_attempts,
+            handle.calib_done, handle.calib_preempted);
+    if (handle.calib_attempts)
+        dprintf(fd, "    cost last=%lldms avg=%lldms max=%lldms\n",
+                (long long)(handle.calib_last_ns / 1000000),
+                (long long)(handle.calib_total_ns / handle.calib_attempts / 1000000),
+                (long long)(handle.calib_max_ns / 1000000));
+    pthread_mutex_unlock(&handle.sched_mutex);
+}
+
 bool audio_extn_spkr_prot_is_enabled()
 {
     return handle.spkr_prot_enable;
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <audio_hw.h>
 #include <dlfcn.h>
+#include <cutils/properties.h>
 #include "audio_extn.h"
 #include <platform.h>
 #include <math.h>
@@ -70,6 +71,14 @@ struct speaker_data {
     int ref_cnt[Audio_Mode_Max];
     int route_cnt[Audio_Mode_Max];
     bool update_ref_cnt;
+    /* mixer paths currently applied, so that unchanged modes are skipped */
+    exTfa98xx_audio_mode_t clock_mode;
+    exTfa98xx_func_mode_t func_mode;
+    /* exTfa98xx_speakeron runs on the amp service while the PCM starts */
+    bool async_speaker_on;
+    struct amp_task speaker_on_task;
+    exTfa98xx_audio_mode_t speaker_on_mode;
+    int speaker_on_status;
 };
 
 struct speaker_data *tfa98xx_speaker_data = NULL;
@@ -130,6 +139,37 @@ static void close_speaker_bundle(struct speaker_data *sd)
     }
 }
 
+static int64_t tfa_98xx_speaker_on_run(struct amp_task *task)
+{
+    struct speaker_data *data = (struct speaker_data *)task->context;
+
+    data->speaker_on_status = data->set_speaker_on(data->speaker_on_mode);
+    if (data->speaker_on_status)
+        ALOGE("%s: exTfa98xx_speakeron failed result = %d\n", __func__,
+              data->speaker_on_status);
+    return -1;
+}
+
+static int tfa_98xx_speaker_on(struct speaker_data *data, exTfa98xx_audio_mode_t audio_mode)
+{
+    data->speaker_on_mode = audio_mode;
+    data->speaker_on_status = 0;
+    if (data->async_speaker_on &&
+        audio_extn_amp_task_schedule(&data->speaker_on_task, 0) == 0)
+        return 0;
+
+    tfa_98xx_speaker_on_run(&data->speaker_on_task);
+    return data->speaker_on_status;
+}
+
+/* the vendor library must see the amp on before anything else is sent */
+static int tfa_98xx_wait_speaker_on(struct speaker_data *data)
+{
+    if (data->async_speaker_on)
+        audio_extn_amp_task_flush(&data->speaker_on_task);
+    return data->speaker_on_status;
+}
+
 static int adev_i2s_clock_operation(int enable, struct audio_device *adev, char *paths)
 {
     int ret = -1;
@@ -246,7 +286,7 @@ static int tfa_98xx_set_func_mode(int enable, struct audio_device *adev, exTfa98
         }
 
         ALOGV("%s: mixer paths is: %s, enable: %d\n", __func__, paths, enable);
-        adev_i2s_clock_operation(enable, adev, paths);
+        return adev_i2s_clock_operation(enable, adev, paths);
     }
     return 0;
 }
@@ -277,6 +317,7 @@ static void tfa_98xx_disable_speaker(void)
     struct speaker_data *data = tfa98xx_speaker_data;
     int ret = 0;
 
+    tfa_98xx_wait_speaker_on(data);
     ret = data->set_speaker_off();
     if (ret) {
         ALOGE("%s: exTfa98xx_speakeroff failed result = %d\n", __func__, ret);
@@ -289,6 +330,9 @@ static void tfa_98xx_disable_speaker(void)
         goto on_error;
     }
     current_audio_mode = Audio_Mode_None;
+    /* the func paths may share controls with the one just reset */
+    data->clock_mode = Audio_Mode_None;
+    data->func_mode = Func_Mode_None;
 on_error:
     return;
 
@@ -338,6 +382,7 @@ void audio_extn_tfa_98xx_disable_speaker(snd_device_t snd_device)
             }
         }
 
+        tfa_98xx_wait_speaker_on(data);
         if (data->adev->enable_hfp)
             data->set_speaker_volume_step(0, 0);
 
@@ -360,6 +405,14 @@ int audio_extn_tfa_98xx_enable_speaker(void)
 
     if (data) {
 
+        if (tfa_98xx_wait_speaker_on(data)) {
+            /* the last pipelined bring-up failed, so the amp is not on */
+            current_audio_mode = Audio_Mode_None;
+            for (i = 0; i < Audio_Mode_Max; i++)
+                data->ref_cnt[i] = 0;
+            data->speaker_on_status = 0;
+        }
+
         new_audio_mode = tfa_98xx_get_audio_mode(data);
         if ((new_audio_mode != Audio_Mode_None) && (data->ref_cnt[new_audio_mode] >= 1)) {
             ALOGD("%s, mode %d already active!", __func__, new_audio_mode);
@@ -367,17 +420,20 @@ int audio_extn_tfa_98xx_enable_speaker(void)
             goto on_exit;
         }
 
-        ret = tfa_98xx_set_audio_mode(I2S_CLOCK_ENABLE, data->adev, new_audio_mode);
-        if (ret) {
-            ALOGE("%s: tfa_98xx_set_audio_mode enable failed return %d\n", __func__, ret);
-            goto on_exit;
+        /* Audio_Mode_None is never cached, set_audio_mode rejects it */
+        if (new_audio_mode == Audio_Mode_None || data->clock_mode != new_audio_mode) {
+            ret = tfa_98xx_set_audio_mode(I2S_CLOCK_ENABLE, data->adev, new_audio_mode);
+            if (ret) {
+                ALOGE("%s: tfa_98xx_set_audio_mode enable failed return %d\n", __func__, ret);
+                goto on_exit;
+            }
+            data->clock_mode = new_audio_mode;
         }
 
-        ret = data->set_speaker_on(new_audio_mode);
-        if (ret) {
-            ALOGE("%s: exTfa98xx_speakeron failed result = %d\n", __func__, ret);
+        /* the I2C traffic to the amp overlaps with the stream starting */
+        ret = tfa_98xx_speaker_on(data, new_audio_mode);
+        if (ret)
             goto on_exit;
-        }
 
         current_audio_mode = new_audio_mode;
         for (i = 0; i < Audio_Mode_Max; i++) {
@@ -409,9 +465,12 @@ void audio_extn_tfa_98xx_set_mode(void)
         if (new_func_mode == Func_Mode_None)
             return;
 
-        ret = tfa_98xx_set_func_mode(I2S_CLOCK_ENABLE, data->adev, new_func_mode);
-        if (ret) {
-            ALOGE("%s: tfa_98xx_set_func_mode enable return %d\n", __func__, ret);
+        if (new_func_mode != data->func_mode) {
+            ret = tfa_98xx_set_func_mode(I2S_CLOCK_ENABLE, data->adev, new_func_mode);
+            if (ret)
+                ALOGE("%s: tfa_98xx_set_func_mode enable return %d\n", __func__, ret);
+            else
+                data->func_mode = new_func_mode;
         }
         data->update_ref_cnt = true;
     }
@@ -424,11 +483,12 @@ void audio_extn_tfa_98xx_set_mode_bt(void)
     struct speaker_data *data = tfa98xx_speaker_data;
     int ret = 0;
 
-    if (data) {
+    if (data && data->func_mode != Func_Mode_BT) {
         ret = tfa_98xx_set_func_mode(I2S_CLOCK_ENABLE, data->adev, Func_Mode_BT);
-        if (ret) {
+        if (ret)
             ALOGE("%s: tfa_98xx_set_func_mode enable return %d\n", __func__, ret);
-        }
+        else
+            data->func_mode = Func_Mode_BT;
     }
 }
 
@@ -482,6 +542,7 @@ void audio_extn_tfa_98xx_set_voice_vol(float vol)
             return;
         }
         ALOGD("%s: vsteps %d\n", __func__, vsteps);
+        tfa_98xx_wait_speaker_on(data);
         data->set_speaker_volume_step(vsteps, vsteps);
     }
 }
@@ -521,6 +582,12 @@ int audio_extn_tfa_98xx_init(struct audio_device *adev)
         }
 
         data->adev = adev;
+        data->clock_mode = Audio_Mode_None;
+        data->func_mode = Func_Mode_None;
+        data->async_speaker_on = property_get_bool("vendor.audio.tfa98xx.async_speaker_on",
+                                                   true);
+        audio_extn_amp_task_init(&data->speaker_on_task, "tfa98xx_speaker_on",
+                                 tfa_98xx_speaker_on_run, data, 0);
         tfa98xx_speaker_data = data;
         ALOGV("%s: exit\n", __func__);
         return 0;
@@ -537,6 +604,8 @@ void audio_extn_tfa_98xx_deinit(void)
     struct speaker_data *data = tfa98xx_speaker_data;
 
     if (data) {
+        tfa_98xx_wait_speaker_on(data);
+        audio_extn_amp_task_release(&data->speaker_on_task);
         data->set_speaker_off();
         close_speaker_bundle(data);
         tfa98xx_speaker_data = NULL;
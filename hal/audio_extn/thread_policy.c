@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_thread_policy"
+/*#define LOG_NDEBUG 0*/
+
+/* Scheduling of the HAL's own worker threads.
+
+   Each worker calls audio_extn_thread_policy_apply() first thing with its
+   class, which names the thread and sets its nice value, cgroup and CPU
+   affinity from the class policy. The defaults keep the priorities the
+   workers always used: only the nice value changes, and urgent and
+   background workers stay in the cgroup of the HAL, since a background
+   worker holding adev->lock must not be starved by the cpuset and
+   schedtune of SP_BACKGROUND. A device moves a class with
+
+     vendor.audio.thread.<class>.priority  nice value
+     vendor.audio.thread.<class>.policy    foreground, background, system
+                                           or top-app cgroup
+     vendor.audio.thread.<class>.cpus      CPU list such as "0-3" or "0,2,4"
+
+   for <class> one of urgent, audio and background, e.g. to pin background
+   housekeeping to the little cluster. Properties are read once.
+*/
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <log/log.h>
+#include <cutils/properties.h>
+#include <processgroup/sched_policy.h>
+#include <system/thread_defs.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+struct thread_policy {
+    const char *name;          /* property infix */
+    int priority;
+    bool has_sched_policy;     /* false keeps the cgroup of the HAL */
+    SchedPolicy sched_policy;
+    bool has_cpus;
+    cpu_set_t cpus;
+};
+
+static struct thread_policy policies[AUDIO_THREAD_CLASS_MAX] = {
+    [AUDIO_THREAD_URGENT] = {
+        .name = "urgent",
+        .priority = ANDROID_PRIORITY_URGENT_AUDIO,
+    },
+    [AUDIO_THREAD_AUDIO] = {
+        .name = "audio",
+        .priority = ANDROID_PRIORITY_AUDIO,
+        .has_sched_policy = true,
+        .sched_policy = SP_FOREGROUND,
+    },
+    [AUDIO_THREAD_BACKGROUND] = {
+        .name = "background",
+        .priority = ANDROID_PRIORITY_BACKGROUND,
+    },
+};
+
+static pthread_once_t policies_once = PTHREAD_ONCE_INIT;
+
+static const struct {
+    const char *name;
+    SchedPolicy policy;
+} sched_policy_names[] = {
+    { "foreground", SP_FOREGROUND },
+    { "background", SP_BACKGROUND },
+    { "system",     SP_SYSTEM },
+    { "top-app",    SP_TOP_APP },
+};
+
+/* "0-3,6" into cpus, false on a malformed or empty list */
+static bool parse_cpus(const char *list, cpu_set_t *cpus)
+{
+    const char *p = list;
+    char *end;
+    long first, last;
+
+    CPU_ZERO(cpus);
+    while (*p) {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return false;
+        last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(++p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return false;
+            p = end;
+        }
+        for (; first <= last; first++)
+            CPU_SET(first, cpus);
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return false;
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+static void policies_load(void)
+{
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    struct thread_policy *policy;
+    size_t i, j;
+
+    for (i = 0; i < AUDIO_THREAD_CLASS_MAX; i++) {
+        policy = &policies[i];
+
+        snprintf(key, sizeof(key), "vendor.audio.thread.%s.priority", policy->name);
+        policy->priority = property_get_int32(key, policy->priority);
+
+        snprintf(key, sizeof(key), "vendor.audio.thread.%s.policy", policy->name);
+        if (property_get(key, value, NULL) > 0) {
+            for (j = 0; j < ARRAY_SIZE(sched_policy_names); j++) {
+                if (!strcmp(value, sched_policy_names[j].name)) {
+                    policy->has_sched_policy = true;
+                    policy->sched_policy = sched_policy_names[j].policy;
+                    break;
+                }
+            }
+            ALOGW_IF(j == ARRAY_SIZE(sched_policy_names), "%s: unknown %s %s",
+                     __func__, key, value);
+        }
+
+        snprintf(key, sizeof(key), "vendor.audio.thread.%s.cpus", policy->name);
+        if (property_get(key, value, NULL) > 0) {
+            policy->has_cpus = parse_cpus(value, &policy->cpus);
+            ALOGW_IF(!policy->has_cpus, "%s: bad %s %s", __func__, key, value);
+        }
+        ALOGV("%s: %s priority %d policy %d%s", __func__, policy->name,
+              policy->priority, policy->has_sched_policy ? policy->sched_policy : -1,
+              policy->has_cpus ? " pinned" : "");
+    }
+}
+
+void audio_extn_thread_policy_apply(audio_thread_class_t thread_class, const char *name)
+{
+    const struct thread_policy *policy;
+
+    if (name != NULL)
+        prctl(PR_SET_NAME, (unsigned long)name, 0, 0, 0);
+    if (thread_class < 0 || thread_class >= AUDIO_THREAD_CLASS_MAX)
+        return;
+
+    pthread_once(&policies_once, policies_load);
+    policy = &policies[thread_class];
+
+    setpriority(PRIO_PROCESS, 0, policy->priority);
+    if (policy->has_sched_policy)
+        set_sched_policy(0, policy->sched_policy);
+    if (policy->has_cpus && sched_setaffinity(0, sizeof(policy->cpus), &policy->cpus) != 0)
+        ALOGW("%s: %s: cannot set affinity: %s", __func__, name, strerror(errno));
+}
@@ -31,10 +31,18 @@
 #include <cutils/properties.h>
 #include <ctype.h>
 #include <math.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <sys/inotify.h>
 
 #ifdef USB_TUNNEL_ENABLED
 #define USB_BUFF_SIZE           2048
+#define USB_BUFF_MAX_SIZE       (64 * 1024)
 #define CHANNEL_NUMBER_STR      "Channels: "
+#define FORMAT_STR              "Format: "
+#define RATES_STR               "Rates: "
 #define PLAYBACK_PROFILE_STR    "Playback:"
 #define CAPTURE_PROFILE_STR     "Capture:"
 #define DATA_PACKET_INTERVAL_STR "Data packet interval: "
@@ -44,6 +52,10 @@
 #define SAMPLE_RATE_11025         11025
 #define DEFAULT_SERVICE_INTERVAL_US    1000
 #define USBID_SIZE                16
+#define USB_PROFILE_CACHE_SIZE    4
+#define USB_POLICY_CACHE_SIZE     4
+#define USB_STREAM_READY_TIMEOUT_MS 3000
+#define USB_STREAM_RECHECK_MS     100
 
 /* TODO: dynamically populate supported sample rates */
 static uint32_t supported_sample_rates[] =
@@ -75,6 +87,17 @@ struct usb_device_config {
     usb_usecase_type_t type;
 };
 
+/* a backend policy decision, requested -> negotiated config */
+struct usb_policy_cache_entry {
+    bool valid;
+    unsigned int req_bit_width;
+    unsigned int req_sample_rate;
+    unsigned int req_channel_count;
+    unsigned int bit_width;
+    unsigned int sample_rate;
+    unsigned int channel_count;
+};
+
 struct usb_card_config {
     struct listnode list;
     audio_devices_t usb_device_type;
@@ -85,6 +108,9 @@ struct usb_card_config {
     int usb_sidetone_vol_min;
     int usb_sidetone_vol_max;
     char usbid[USBID_SIZE];
+    /* dropped with the card in audio_extn_usb_remove_device() */
+    struct usb_policy_cache_entry policy_cache[USB_POLICY_CACHE_SIZE];
+    unsigned int policy_cache_next;
 };
 
 struct usb_module {
@@ -94,7 +120,18 @@ struct usb_module {
     bool is_capture_supported;
 };
 
+/* parsed profiles of recently seen devices, keyed by USB vid:pid */
+struct usb_profile_cache_entry {
+    bool valid;
+    char usbid[USBID_SIZE];
+    usb_usecase_type_t type;
+    uint32_t rates_mask;
+    struct listnode conf_list;
+};
+
 static struct usb_module *usbmod = NULL;
+static struct usb_profile_cache_entry usb_profile_cache[USB_PROFILE_CACHE_SIZE];
+static unsigned int usb_profile_cache_next;
 static bool usb_audio_debug_enable = false;
 static int usb_sidetone_gain = 0;
 
@@ -228,6 +265,8 @@ static int usb_get_sample_rates(int type, char *rates_str,
     uint32_t i;
     char *next_sr_string, *temp_ptr;
     uint32_t sr, min_sr, max_sr, sr_size = 0;
+    /* look before strtok_r() terminates the string after the first rate */
+    const bool continuous = strstr(rates_str, "continuous") != NULL;
 
     /* Sample rate string can be in any of the folloing two bit_widthes:
      * Rates: 8000 - 48000 (continuous)
@@ -240,7 +279,7 @@ static int usb_get_sample_rates(int type, char *rates_str,
         ALOGE("%s: could not find min rates string", __func__);
         return -EINVAL;
     }
-    if (strstr(rates_str, "continuous") != NULL) {
+    if (continuous) {
         min_sr = (uint32_t)atoi(next_sr_string);
         next_sr_string = strtok_r(NULL, " ,.-", &temp_ptr);
         if (next_sr_string == NULL) {
@@ -278,24 +317,14 @@ static int usb_get_sample_rates(int type, char *rates_str,
     return 0;
 }
 
-static int usb_get_service_interval(const char *interval_str_start,
+static int usb_get_service_interval(const char *interval_str,
                                     struct usb_device_config *usb_device_info)
 {
     unsigned long interval = 0;
     char time_unit[8] = {0};
     int multiplier = 0;
-    char *eol = strchr(interval_str_start, '\n');
-    if (!eol) {
-        ALOGE("%s: No EOL found", __func__);
-        return -1;
-    }
-    char *tmp = (char *)calloc(1, eol-interval_str_start+1);
-    if (!tmp) {
-        ALOGE("%s: failed to allocate tmp", __func__);
-        return -1;
-    }
-    memcpy(tmp, interval_str_start, eol-interval_str_start);
-    sscanf(tmp, "%lu %2s", &interval, &time_unit[0]);
+
+    sscanf(interval_str, "%lu %2s", &interval, &time_unit[0]);
     if (!strcmp(time_unit, "us")) {
         multiplier = 1;
     } else if (!strcmp(time_unit, "ms")) {
@@ -310,38 +339,304 @@ static int usb_get_service_interval(const char *interval_str_start,
     interval *= multiplier;
     ALOGV("%s: set service_interval_us %lu", __func__, interval);
     usb_device_info->service_interval_us = interval;
-    free(tmp);
     return 0;
 }
 
+static int64_t usb_monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * The stream file shows up while the USB audio driver registers the card,
+ * at the same time ueventd creates its nodes in /dev/snd. Procfs does not
+ * support inotify, so watch /dev/snd to be woken as soon as the card
+ * appears and fall back to a short recheck period.
+ */
+static int usb_wait_for_stream(const char *path)
+{
+    char events[sizeof(struct inotify_event) + NAME_MAX + 1];
+    int64_t deadline;
+    int fd;
+
+    if (access(path, F_OK) == 0)
+        return 0;
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, "/dev/snd", IN_CREATE) < 0) {
+        close(fd);
+        fd = -1;
+    }
+
+    deadline = usb_monotonic_ms() + USB_STREAM_READY_TIMEOUT_MS;
+    while (access(path, F_OK) < 0) {
+        int64_t wait_ms = deadline - usb_monotonic_ms();
+        if (wait_ms <= 0) {
+            ALOGW("%s: %s did not show up", __func__, path);
+            if (fd >= 0)
+                close(fd);
+            return -ETIMEDOUT;
+        }
+        if (wait_ms > USB_STREAM_RECHECK_MS)
+            wait_ms = USB_STREAM_RECHECK_MS;
+
+        if (fd >= 0) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            if (poll(&pfd, 1, (int)wait_ms) > 0)
+                while (read(fd, events, sizeof(events)) > 0);
+        } else {
+            usleep(wait_ms * 1000);
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    return 0;
+}
+
+/* reads the whole stream file, which can be larger than a page on
+   devices with many alternate settings */
+static char *usb_read_stream_file(const char *path)
+{
+    size_t size = USB_BUFF_SIZE, len = 0;
+    char *buf = NULL, *tmp;
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("%s: error failed to open config file %s error: %d\n",
+              __func__, path, errno);
+        return NULL;
+    }
+
+    for (;;) {
+        if (buf == NULL || len == size) {
+            if (buf != NULL)
+                size *= 2;
+            if (size > USB_BUFF_MAX_SIZE ||
+                    (tmp = (char *)realloc(buf, size + 1)) == NULL) {
+                ALOGE("%s: cannot hold %s", __func__, path);
+                break;
+            }
+            buf = tmp;
+        }
+        n = read(fd, buf + len, size - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    close(fd);
+
+    if (buf != NULL)
+        buf[len] = '\0';
+    return buf;
+}
+
+#define USB_PROFILE_HAS_FORMAT   (1 << 0)
+#define USB_PROFILE_HAS_CHANNELS (1 << 1)
+#define USB_PROFILE_HAS_RATES    (1 << 2)
+#define USB_PROFILE_COMPLETE     (USB_PROFILE_HAS_FORMAT | \
+                                  USB_PROFILE_HAS_CHANNELS | \
+                                  USB_PROFILE_HAS_RATES)
+
+static void usb_finish_profile(struct usb_device_config *usb_device_info,
+                               unsigned int fields, struct listnode *conf_list)
+{
+    if (usb_device_info == NULL)
+        return;
+
+    /* Add to list if every field is valid */
+    if (fields == USB_PROFILE_COMPLETE) {
+        list_add_tail(conf_list, &usb_device_info->list);
+    } else {
+        ALOGI("%s: incomplete altset (fields %#x), dropped", __func__, fields);
+        free(usb_device_info);
+    }
+}
+
+/*
+ * Single pass over the stream file, one line at a time:
+ *
+ * Playback:
+ *   Interface 1
+ *     Altset 1
+ *     Format: S16_LE
+ *     Channels: 2
+ *     Rates: 44100, 48000
+ *     Data packet interval: 1000 us
+ */
+static int usb_parse_stream_profiles(int type, char *read_buf,
+                                     struct listnode *conf_list)
+{
+    const char *section = (type == USB_PLAYBACK) ?
+                          PLAYBACK_PROFILE_STR : CAPTURE_PROFILE_STR;
+    struct usb_device_config *usb_device_info = NULL;
+    unsigned int fields = 0;
+    bool in_section = false, found_section = false;
+    char *line, *saveptr = NULL;
+
+    for (line = strtok_r(read_buf, "\n", &saveptr); line != NULL;
+         line = strtok_r(NULL, "\n", &saveptr)) {
+        while (isspace((unsigned char)*line))
+            line++;
+
+        if (!strncmp(line, PLAYBACK_PROFILE_STR, strlen(PLAYBACK_PROFILE_STR)) ||
+            !strncmp(line, CAPTURE_PROFILE_STR, strlen(CAPTURE_PROFILE_STR))) {
+            usb_finish_profile(usb_device_info, fields, conf_list);
+            usb_device_info = NULL;
+            in_section = !strncmp(line, section, strlen(section));
+            found_section |= in_section;
+            continue;
+        }
+        if (!in_section)
+            continue;
+
+        if (!strncmp(line, "Altset", strlen("Altset"))) {
+            usb_finish_profile(usb_device_info, fields, conf_list);
+            fields = 0;
+            usb_device_info = calloc(1, sizeof(struct usb_device_config));
+            if (usb_device_info == NULL) {
+                ALOGE("%s: error unable to allocate memory", __func__);
+                return -ENOMEM;
+            }
+            usb_device_info->type = type;
+            // Data packet interval is an optional field.
+            // Assume 1ms interval if this cannot be read
+            usb_device_info->service_interval_us = DEFAULT_SERVICE_INTERVAL_US;
+            continue;
+        }
+        if (usb_device_info == NULL)
+            continue;
+
+        if (!strncmp(line, FORMAT_STR, strlen(FORMAT_STR))) {
+            /* 24 bit checks both S24_LE and S24_3LE */
+            if (strstr(line, "S16_LE"))
+                usb_device_info->bit_width = 16;
+            else if (strstr(line, "S24_LE") || strstr(line, "S24_3LE"))
+                usb_device_info->bit_width = 24;
+            else if (strstr(line, "S32_LE"))
+                usb_device_info->bit_width = 32;
+            fields |= USB_PROFILE_HAS_FORMAT;
+        } else if (!strncmp(line, CHANNEL_NUMBER_STR, strlen(CHANNEL_NUMBER_STR))) {
+            usb_device_info->channel_count = atoi(line + strlen(CHANNEL_NUMBER_STR));
+            fields |= USB_PROFILE_HAS_CHANNELS;
+        } else if (!strncmp(line, RATES_STR, strlen(RATES_STR))) {
+            if (usb_get_sample_rates(type, line, usb_device_info) == 0)
+                fields |= USB_PROFILE_HAS_RATES;
+            else
+                ALOGE("%s: error unable to get sample rate values", __func__);
+        } else if (!strncmp(line, DATA_PACKET_INTERVAL_STR,
+                            strlen(DATA_PACKET_INTERVAL_STR))) {
+            usb_get_service_interval(line + strlen(DATA_PACKET_INTERVAL_STR),
+                                     usb_device_info);
+        }
+    }
+    usb_finish_profile(usb_device_info, fields, conf_list);
+
+    if (!found_section) {
+        ALOGE("%s: error %s section not found in usb config file",
+              __func__, section);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void usb_free_profiles(struct listnode *conf_list)
+{
+    struct listnode *node, *temp;
+
+    list_for_each_safe(node, temp, conf_list) {
+        list_remove(node);
+        free(node_to_item(node, struct usb_device_config, list));
+    }
+}
+
+static int usb_copy_profiles(struct listnode *dst, struct listnode *src)
+{
+    struct listnode *node;
+    struct usb_device_config *from, *to;
+
+    list_for_each(node, src) {
+        from = node_to_item(node, struct usb_device_config, list);
+        to = (struct usb_device_config *)malloc(sizeof(*to));
+        if (to == NULL)
+            return -ENOMEM;
+        *to = *from;
+        list_add_tail(dst, &to->list);
+    }
+    return 0;
+}
+
+static struct usb_profile_cache_entry *usb_profile_cache_find(const char *usbid,
+                                                              int type)
+{
+    unsigned int i;
+
+    if (usbid[0] == '\0')
+        return NULL;
+    for (i = 0; i < USB_PROFILE_CACHE_SIZE; i++) {
+        struct usb_profile_cache_entry *entry = &usb_profile_cache[i];
+        if (entry->valid && entry->type == type && !strcmp(entry->usbid, usbid))
+            return entry;
+    }
+    return NULL;
+}
+
+static void usb_profile_cache_store(const char *usbid, int type,
+                                    uint32_t rates_mask,
+                                    struct listnode *conf_list)
+{
+    struct usb_profile_cache_entry *entry;
+
+    if (usbid[0] == '\0' || list_empty(conf_list))
+        return;
+
+    /* replace the oldest entry */
+    entry = &usb_profile_cache[usb_profile_cache_next++ % USB_PROFILE_CACHE_SIZE];
+    if (entry->valid)
+        usb_free_profiles(&entry->conf_list);
+    list_init(&entry->conf_list);
+    entry->valid = false;
+    if (usb_copy_profiles(&entry->conf_list, conf_list) < 0) {
+        usb_free_profiles(&entry->conf_list);
+        return;
+    }
+    strlcpy(entry->usbid, usbid, sizeof(entry->usbid));
+    entry->type = type;
+    entry->rates_mask = rates_mask;
+    entry->valid = true;
+}
 
 static int usb_get_capability(int type,
                               struct usb_card_config *usb_card_info,
                               int card)
 {
-    int32_t size = 0;
-    int32_t fd=-1;
-    int32_t channels_no;
-    char *str_start = NULL;
-    char *str_end = NULL;
-    char *channel_start = NULL;
-    char *bit_width_start = NULL;
-    char *rates_str_start = NULL;
-    char *target = NULL;
+    struct usb_profile_cache_entry *entry;
+    uint32_t rates_mask;
     char *read_buf = NULL;
-    char *rates_str = NULL;
-    char *interval_str_start = NULL;
     char path[128];
     int ret = 0;
-    char *bit_width_str = NULL;
-    struct usb_device_config * usb_device_info;
-    bool check = false;
-    int tries=3;
 
-    memset(path, 0, sizeof(path));
     ALOGV("%s: for %s", __func__, (type == USB_PLAYBACK) ?
           PLAYBACK_PROFILE_STR : CAPTURE_PROFILE_STR);
 
+    /* the same device plugged again, skip waiting for and parsing procfs */
+    entry = usb_profile_cache_find(usb_card_info->usbid, type);
+    if (entry != NULL) {
+        if (usb_copy_profiles(&usb_card_info->usb_device_conf_list,
+                              &entry->conf_list) == 0) {
+            ALOGV("%s: using cached profiles for %s", __func__, entry->usbid);
+            supported_sample_rates_mask[type] |= entry->rates_mask;
+            return 0;
+        }
+        usb_free_profiles(&usb_card_info->usb_device_conf_list);
+    }
+
     /* TODO: convert the below to using alsa_utils */
     ret = snprintf(path, sizeof(path), "/proc/asound/card%u/stream0",
              card);
@@ -351,163 +646,29 @@ static int usb_get_capability(int type,
         goto done;
     }
 
-    // TODO: figure up if this wait is needed any more
-    while (tries--) {
-        if (access(path, F_OK) < 0) {
-            ALOGW("stream %s doesn't exist retrying %d more times\n", path, tries);
-            sleep(1);
-            continue;
-        }
-    }
-
-    fd = open(path, O_RDONLY);
-    if (fd <0) {
-        ALOGE("%s: error failed to open config file %s error: %d\n",
-              __func__, path, errno);
+    if (usb_wait_for_stream(path) < 0) {
         ret = -EINVAL;
         goto done;
     }
 
-    read_buf = (char *)calloc(1, USB_BUFF_SIZE + 1);
-
-    if (!read_buf) {
-        ALOGE("Failed to create read_buf");
-        ret = -ENOMEM;
-        goto done;
-    }
-
-    if(read(fd, read_buf, USB_BUFF_SIZE) < 0) {
-        ALOGE("file read error\n");
-        goto done;
-    }
-    str_start = strstr(read_buf, ((type == USB_PLAYBACK) ?
-                       PLAYBACK_PROFILE_STR : CAPTURE_PROFILE_STR));
-    if (str_start == NULL) {
-        ALOGE("%s: error %s section not found in usb config file",
-               __func__, ((type == USB_PLAYBACK) ?
-               PLAYBACK_PROFILE_STR : CAPTURE_PROFILE_STR));
+    read_buf = usb_read_stream_file(path);
+    if (read_buf == NULL) {
         ret = -EINVAL;
         goto done;
     }
-    str_end = strstr(read_buf, ((type == USB_PLAYBACK) ?
-                       CAPTURE_PROFILE_STR : PLAYBACK_PROFILE_STR));
-    if (str_end > str_start)
-        check = true;
 
-    ALOGV("%s: usb_config = %s, check %d\n", __func__, str_start, check);
-
-    while (str_start != NULL) {
-        str_start = strstr(str_start, "Altset");
-        if ((str_start == NULL) || (check  && (str_start >= str_end))) {
-            ALOGV("%s: done parsing %s\n", __func__, str_start);
-            break;
-        }
-        ALOGV("%s: remaining string %s\n", __func__, str_start);
-        str_start += sizeof("Altset");
-        usb_device_info = calloc(1, sizeof(struct usb_device_config));
-        if (usb_device_info == NULL) {
-            ALOGE("%s: error unable to allocate memory",
-                  __func__);
-            ret = -ENOMEM;
-            break;
-        }
-        usb_device_info->type = type;
-        /* Bit bit_width parsing */
-        bit_width_start = strstr(str_start, "Format: ");
-        if (bit_width_start == NULL) {
-            ALOGI("%s: Could not find bit_width string", __func__);
-            free(usb_device_info);
-            continue;
-        }
-        target = strchr(bit_width_start, '\n');
-        if (target == NULL) {
-            ALOGI("%s:end of line not found", __func__);
-            free(usb_device_info);
-            continue;
-        }
-        size = target - bit_width_start;
-        if ((bit_width_str = (char *)malloc(size + 1)) == NULL) {
-            ALOGE("%s: unable to allocate memory to hold bit width strings",
-                  __func__);
-            ret = -EINVAL;
-            free(usb_device_info);
-            break;
-        }
-        memcpy(bit_width_str, bit_width_start, size);
-        bit_width_str[size] = '\0';
-        if (strstr(bit_width_str, "S16_LE"))
-            usb_device_info->bit_width = 16;
-        else if (strstr(bit_width_str, "S24_LE"))
-            usb_device_info->bit_width = 24;
-        else if (strstr(bit_width_str, "S24_3LE"))
-            usb_device_info->bit_width = 24;
-        else if (strstr(bit_width_str, "S32_LE"))
-            usb_device_info->bit_width = 32;
-
-        if (bit_width_str)
-            free(bit_width_str);
-
-        /* channels parsing */
-        channel_start = strstr(str_start, CHANNEL_NUMBER_STR);
-        if (channel_start == NULL) {
-            ALOGI("%s: could not find Channels string", __func__);
-            free(usb_device_info);
-            continue;
-        }
-        channels_no = atoi(channel_start + strlen(CHANNEL_NUMBER_STR));
-        usb_device_info->channel_count =  channels_no;
-
-        /* Sample rates parsing */
-        rates_str_start = strstr(str_start, "Rates: ");
-        if (rates_str_start == NULL) {
-            ALOGI("%s: cant find rates string", __func__);
-            free(usb_device_info);
-            continue;
-        }
-        target = strchr(rates_str_start, '\n');
-        if (target == NULL) {
-            ALOGI("%s: end of line not found", __func__);
-            free(usb_device_info);
-            continue;
-        }
-        size = target - rates_str_start;
-        if ((rates_str = (char *)malloc(size + 1)) == NULL) {
-            ALOGE("%s: unable to allocate memory to hold sample rate strings",
-                  __func__);
-            ret = -EINVAL;
-            free(usb_device_info);
-            break;
-        }
-        memcpy(rates_str, rates_str_start, size);
-        rates_str[size] = '\0';
-        ret = usb_get_sample_rates(type, rates_str, usb_device_info);
-        if (rates_str)
-            free(rates_str);
-        if (ret < 0) {
-            ALOGE("%s: error unable to get sample rate values",
-                  __func__);
-            free(usb_device_info);
-            continue;
-        }
-        // Data packet interval is an optional field.
-        // Assume 1ms interval if this cannot be read
-        usb_device_info->service_interval_us = DEFAULT_SERVICE_INTERVAL_US;
-        interval_str_start = strstr(str_start, DATA_PACKET_INTERVAL_STR);
-        if (interval_str_start != NULL) {
-            interval_str_start += strlen(DATA_PACKET_INTERVAL_STR);
-            ret = usb_get_service_interval(interval_str_start, usb_device_info);
-            if (ret < 0) {
-                ALOGE("%s: error unable to get service interval, assume default",
-                      __func__);
-            }
-        }
-        /* Add to list if every field is valid */
-        list_add_tail(&usb_card_info->usb_device_conf_list,
-                      &usb_device_info->list);
-    }
+    /* collect the rates of this device only, for the cache */
+    rates_mask = supported_sample_rates_mask[type];
+    supported_sample_rates_mask[type] = 0;
+    ret = usb_parse_stream_profiles(type, read_buf,
+                                    &usb_card_info->usb_device_conf_list);
+    if (ret == 0)
+        usb_profile_cache_store(usb_card_info->usbid, type,
+                                supported_sample_rates_mask[type],
+                                &usb_card_info->usb_device_conf_list);
+    supported_sample_rates_mask[type] |= rates_mask;
 
 done:
-    if (fd >= 0) close(fd);
     if (read_buf) free(read_buf);
     return ret;
 }
@@ -987,10 +1148,37 @@ bool audio_extn_usb_is_config_supported(unsigned int *bit_width,
         /* Currently only apply the first playback sound card configuration */
         if ((is_playback && usb_output_device(card_info->usb_device_type)) ||
             (!is_playback && usb_input_device(card_info->usb_device_type))) {
+            struct usb_policy_cache_entry *entry;
+            unsigned int i;
+
+            for (i = 0; i < USB_POLICY_CACHE_SIZE; i++) {
+                entry = &card_info->policy_cache[i];
+                if (entry->valid &&
+                        entry->req_bit_width == *bit_width &&
+                        entry->req_sample_rate == *sample_rate &&
+                        entry->req_channel_count == *channel_count) {
+                    *bit_width = entry->bit_width;
+                    *sample_rate = entry->sample_rate;
+                    *channel_count = entry->channel_count;
+                    break;
+                }
+            }
+            if (i < USB_POLICY_CACHE_SIZE)
+                break;
+
+            entry = &card_info->policy_cache[card_info->policy_cache_next++ %
+                                             USB_POLICY_CACHE_SIZE];
+            entry->req_bit_width = *bit_width;
+            entry->req_sample_rate = *sample_rate;
+            entry->req_channel_count = *channel_count;
             usb_audio_backend_apply_policy(&card_info->usb_device_conf_list,
                                            bit_width,
                                            sample_rate,
                                            channel_count);
+            entry->bit_width = *bit_width;
+            entry->sample_rate = *sample_rate;
+            entry->channel_count = *channel_count;
+            entry->valid = true;
             break;
         }
     }
@@ -1341,6 +1529,13 @@ exit:
 
 void audio_extn_usb_deinit(void)
 {
+    unsigned int i;
+
+    for (i = 0; i < USB_PROFILE_CACHE_SIZE; i++) {
+        if (usb_profile_cache[i].valid)
+            usb_free_profiles(&usb_profile_cache[i].conf_list);
+        usb_profile_cache[i].valid = false;
+    }
     if (NULL != usbmod){
         free(usbmod);
         usbmod = NULL;
@@ -20,12 +20,18 @@
 #include <errno.h>
 #include <cutils/properties.h>
 #include <cutils/config_utils.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <unistd.h>
 #include <cutils/str_parms.h>
 #include <log/log.h>
 #include <cutils/misc.h>
+#include <utils/Timers.h>
 
 #include "acdb.h"
 #include "audio_hw.h"
@@ -35,6 +41,86 @@
 
 #define MAX_LENGTH_MIXER_CONTROL_IN_INT 128
 
+/* must be a power of 2 */
+#define MIXER_CTL_CACHE_SIZE 256
+
+/* Interned mixer control handles. mixer_get_ctl_by_name() walks the whole
+   control list, which is slow on cards exposing thousands of controls.
+   Failed lookups are cached as well and everything is dropped when the
+   sound card goes through SSR. */
+struct mixer_ctl_cache_entry {
+    char *name;
+    struct mixer_ctl *ctl;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct mixer *mixer;
+    unsigned int used;
+    struct mixer_ctl_cache_entry entries[MIXER_CTL_CACHE_SIZE];
+} mixer_ctl_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+#define APP_TYPE_CFG_CACHE_SIZE 32
+
+/* Last app type config written to each stream control and backend. The
+   driver keeps it across sessions, so a stream leaving standby with an
+   unchanged config skips the write. Dropped with the mixer ctl cache, as
+   an SSR resets the driver state. */
+struct app_type_cfg_cache_entry {
+    bool valid;
+    int pcm_device_id;
+    int stream_type;
+    int be_idx;
+    int app_type;
+    int acdb_dev_id;
+    int sample_rate;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    unsigned int next;          /* replaced when the cache is full */
+    struct app_type_cfg_cache_entry entries[APP_TYPE_CFG_CACHE_SIZE];
+} app_type_cfg_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void app_type_cfg_cache_clear(void)
+{
+    pthread_mutex_lock(&app_type_cfg_cache.lock);
+    memset(app_type_cfg_cache.entries, 0, sizeof(app_type_cfg_cache.entries));
+    app_type_cfg_cache.next = 0;
+    pthread_mutex_unlock(&app_type_cfg_cache.lock);
+}
+
+/* app_type_cfg_cache.lock held, the entry for the control or a free or replaced one */
+static struct app_type_cfg_cache_entry *app_type_cfg_cache_find_l(int pcm_device_id,
+                                                                  int stream_type,
+                                                                  int be_idx)
+{
+    struct app_type_cfg_cache_entry *entry, *free_entry = NULL;
+    int i;
+
+    for (i = 0; i < APP_TYPE_CFG_CACHE_SIZE; i++) {
+        entry = &app_type_cfg_cache.entries[i];
+        if (!entry->valid) {
+            if (free_entry == NULL)
+                free_entry = entry;
+            continue;
+        }
+        if (entry->pcm_device_id == pcm_device_id && entry->stream_type == stream_type &&
+                entry->be_idx == be_idx)
+            return entry;
+    }
+    if (free_entry == NULL) {
+        free_entry = &app_type_cfg_cache.entries[app_type_cfg_cache.next];
+        app_type_cfg_cache.next = (app_type_cfg_cache.next + 1) % APP_TYPE_CFG_CACHE_SIZE;
+        free_entry->valid = false;
+    }
+    return free_entry;
+}
+
 static int set_stream_app_type_mixer_ctrl(struct audio_device *adev,
                                           int pcm_device_id, int app_type,
                                           int acdb_dev_id, int sample_rate,
@@ -46,6 +132,7 @@ static int set_stream_app_type_mixer_ctrl(struct audio_device *adev,
     struct mixer_ctl *ctl;
     int app_type_cfg[MAX_LENGTH_MIXER_CONTROL_IN_INT], len = 0, rc = 0;
     int snd_device_be_idx = -1;
+    struct app_type_cfg_cache_entry *entry;
 
     if (stream_type == PCM_PLAYBACK) {
         snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
@@ -55,7 +142,17 @@ static int set_stream_app_type_mixer_ctrl(struct audio_device *adev,
              "Audio Stream Capture %d App Type Cfg", pcm_device_id);
     }
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    snd_device_be_idx = platform_get_snd_device_backend_index(snd_device);
+
+    pthread_mutex_lock(&app_type_cfg_cache.lock);
+    entry = app_type_cfg_cache_find_l(pcm_device_id, stream_type, snd_device_be_idx);
+    if (entry->valid && entry->app_type == app_type && entry->acdb_dev_id == acdb_dev_id &&
+            entry->sample_rate == sample_rate) {
+        ALOGV("%s: %s unchanged", __func__, mixer_ctl_name);
+        goto exit;
+    }
+
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
              __func__, mixer_ctl_name);
@@ -66,16 +163,24 @@ static int set_stream_app_type_mixer_ctrl(struct audio_device *adev,
     app_type_cfg[len++] = acdb_dev_id;
     app_type_cfg[len++] = sample_rate;
 
-    snd_device_be_idx = platform_get_snd_device_backend_index(snd_device);
     if (snd_device_be_idx > 0)
         app_type_cfg[len++] = snd_device_be_idx;
     ALOGV("%s: stream type %d app_type %d, acdb_dev_id %d "
           "sample rate %d, snd_device_be_idx %d",
           __func__, stream_type, app_type, acdb_dev_id, sample_rate,
           snd_device_be_idx);
-    mixer_ctl_set_array(ctl, app_type_cfg, len);
+    if (mixer_ctl_set_array(ctl, app_type_cfg, len) == 0) {
+        entry->valid = true;
+        entry->pcm_device_id = pcm_device_id;
+        entry->stream_type = stream_type;
+        entry->be_idx = snd_device_be_idx;
+        entry->app_type = app_type;
+        entry->acdb_dev_id = acdb_dev_id;
+        entry->sample_rate = sample_rate;
+    }
 
 exit:
+    pthread_mutex_unlock(&app_type_cfg_cache.lock);
     return rc;
 }
 
@@ -86,7 +191,7 @@ void audio_extn_utils_send_default_app_type_cfg(void *platform, struct mixer *mi
     struct mixer_ctl *ctl = NULL;
     const char *mixer_ctl_name = "App Type Config";
 
-    ctl = mixer_get_ctl_by_name(mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",__func__, mixer_ctl_name);
         return;
@@ -223,7 +328,7 @@ static int derive_capture_app_type_cfg(struct audio_device *adev,
     if (audio_is_usb_in_device(in->device)) {
         platform_check_and_update_copp_sample_rate(adev->platform,
                                                    usecase->in_snd_device,
-                                                   in->sample_rate,
+                                                   in->config.rate,
                                                    sample_rate);
     }
 
@@ -237,7 +342,8 @@ static int derive_capture_app_type_cfg(struct audio_device *adev,
                                  app_type_cfg->sample_rate,
                                  app_type);
     } else if (in->format == AUDIO_FORMAT_PCM_24_BIT_PACKED ||
-               in->format == AUDIO_FORMAT_PCM_8_24_BIT) {
+               in->format == AUDIO_FORMAT_PCM_8_24_BIT ||
+               in->format == AUDIO_FORMAT_PCM_FLOAT) {
         platform_get_app_type_v2(adev->platform,
                                  PCM_CAPTURE,
                                  app_type_cfg->mode,
@@ -318,6 +424,14 @@ static int derive_playback_app_type_cfg(struct audio_device *adev,
                                  32,
                                  *sample_rate,
                                  app_type);
+    } else if (out->format == AUDIO_FORMAT_PCM_FLOAT) {
+        /* converted in the HAL, the DSP sees the pcm format */
+        platform_get_app_type_v2(adev->platform,
+                                 PCM_PLAYBACK,
+                                 app_type_cfg->mode,
+                                 pcm_format_to_bits(out->config.format),
+                                 *sample_rate,
+                                 app_type);
     } else {
         ALOGE("%s bad format\n", __func__);
         return -1;
@@ -422,7 +536,7 @@ int audio_extn_utils_send_app_type_gain(struct audio_device *adev,
     int gain_cfg[4];
     const char *mixer_ctl_name = "App Type Gain";
     struct mixer_ctl *ctl;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get volume ctl mixer %s", __func__,
               mixer_ctl_name);
@@ -627,3 +741,220 @@ done:
 
     return snd_card_num;
 }
+
+void audio_extn_utils_latency_hist_log(struct latency_hist *hist, int64_t ns)
+{
+    uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+    int idx = us ? 64 - __builtin_clzll(us) : 0;
+    int_fast64_t max_ns;
+
+    if (idx >= LATENCY_HIST_BUCKETS)
+        idx = LATENCY_HIST_BUCKETS - 1;
+    atomic_fetch_add_explicit(&hist->bucket[idx], 1, memory_order_relaxed);
+
+    max_ns = atomic_load_explicit(&hist->max_ns, memory_order_relaxed);
+    while (ns > max_ns &&
+           !atomic_compare_exchange_weak_explicit(&hist->max_ns, &max_ns, ns,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+}
+
+void audio_extn_utils_latency_hist_dump(struct latency_hist *hist, int fd,
+                                        const char *name)
+{
+    char buffer[512];
+    size_t len = 0;
+    uint32_t total = 0;
+    int i;
+
+    for (i = 0; i < LATENCY_HIST_BUCKETS && len < sizeof(buffer); i++) {
+        uint32_t count = atomic_load_explicit(&hist->bucket[i],
+                                              memory_order_relaxed);
+        if (count == 0)
+            continue;
+        total += count;
+        if (i == LATENCY_HIST_BUCKETS - 1)
+            len += snprintf(buffer + len, sizeof(buffer) - len, " >=%uus:%u",
+                            1u << (i - 1), count);
+        else
+            len += snprintf(buffer + len, sizeof(buffer) - len, " <%uus:%u",
+                            1u << i, count);
+    }
+    if (total == 0)
+        return;
+
+    dprintf(fd, "      %s: n=%u max=%lldus%s\n", name, total,
+            (long long)atomic_load_explicit(&hist->max_ns,
+                                            memory_order_relaxed) / 1000,
+            buffer);
+}
+
+#define CPUFREQ_MAX_CPUS 16
+
+/* scaling_cur_freq of each cpu, opened once so an underrun only costs a pread() */
+static struct {
+    pthread_once_t once;
+    int fd[CPUFREQ_MAX_CPUS];
+} cpufreq = {
+    .once = PTHREAD_ONCE_INIT,
+};
+
+static void cpufreq_open(void)
+{
+    char path[64];
+    int cpu;
+
+    for (cpu = 0; cpu < CPUFREQ_MAX_CPUS; cpu++) {
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+        cpufreq.fd[cpu] = open(path, O_RDONLY | O_CLOEXEC);
+    }
+}
+
+void audio_extn_utils_cpufreq_init(void)
+{
+    pthread_once(&cpufreq.once, cpufreq_open);
+}
+
+/* current frequency of a cpu in kHz, 0 when cpufreq is not available */
+static uint32_t cpu_cur_freq_khz(int cpu)
+{
+    char value[16];
+    ssize_t len;
+
+    if (cpu < 0 || cpu >= CPUFREQ_MAX_CPUS || cpufreq.fd[cpu] < 0)
+        return 0;
+    len = pread(cpufreq.fd[cpu], value, sizeof(value) - 1, 0);
+    if (len <= 0)
+        return 0;
+    value[len] = '\0';
+    return (uint32_t)strtoul(value, NULL, 10);
+}
+
+void audio_extn_utils_underrun_log(struct underrun_log *log, int64_t frames,
+                                   audio_usecase_t usecase, audio_devices_t devices)
+{
+    struct underrun_event *event = &log->events[log->next++ % UNDERRUN_LOG_ENTRIES];
+
+    event->time_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    event->frames = frames;
+    event->usecase = usecase;
+    event->devices = devices;
+    event->cpu = sched_getcpu();
+    event->cpu_khz = cpu_cur_freq_khz(event->cpu);
+}
+
+void audio_extn_utils_underrun_log_dump(struct underrun_log *log, int fd)
+{
+    uint32_t filled = log->next < UNDERRUN_LOG_ENTRIES ? log->next : UNDERRUN_LOG_ENTRIES;
+    uint32_t i;
+
+    if (filled == 0)
+        return;
+    dprintf(fd, "      Last underruns:\n");
+    for (i = log->next - filled; i != log->next; i++) {
+        const struct underrun_event *event = &log->events[i % UNDERRUN_LOG_ENTRIES];
+        dprintf(fd, "        %lld.%06lld %-24s devices=%#x frames=%lld cpu%d@%ukHz\n",
+                (long long)(event->time_ns / 1000000000),
+                (long long)(event->time_ns / 1000 % 1000000),
+                event->usecase >= 0 && event->usecase < AUDIO_USECASE_MAX &&
+                        use_case_table[event->usecase] ? use_case_table[event->usecase] : "",
+                event->devices, (long long)event->frames, event->cpu, event->cpu_khz);
+    }
+}
+
+static uint32_t mixer_ctl_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* mixer_ctl_cache.lock held */
+static void mixer_ctl_cache_clear_l(void)
+{
+    int i;
+
+    for (i = 0; i < MIXER_CTL_CACHE_SIZE; i++) {
+        free(mixer_ctl_cache.entries[i].name);
+        mixer_ctl_cache.entries[i].name = NULL;
+        mixer_ctl_cache.entries[i].ctl = NULL;
+    }
+    mixer_ctl_cache.used = 0;
+}
+
+void audio_extn_utils_mixer_ctl_cache_init(struct mixer *mixer)
+{
+    app_type_cfg_cache_clear();
+    pthread_mutex_lock(&mixer_ctl_cache.lock);
+    mixer_ctl_cache_clear_l();
+    mixer_ctl_cache.mixer = mixer;
+    pthread_mutex_unlock(&mixer_ctl_cache.lock);
+}
+
+void audio_extn_utils_mixer_ctl_cache_deinit(void)
+{
+    app_type_cfg_cache_clear();
+    pthread_mutex_lock(&mixer_ctl_cache.lock);
+    mixer_ctl_cache_clear_l();
+    mixer_ctl_cache.mixer = NULL;
+    pthread_mutex_unlock(&mixer_ctl_cache.lock);
+}
+
+void audio_extn_utils_mixer_ctl_cache_invalidate(void)
+{
+    app_type_cfg_cache_clear();
+    pthread_mutex_lock(&mixer_ctl_cache.lock);
+    ALOGV("%s: dropping %u cached mixer ctls", __func__, mixer_ctl_cache.used);
+    mixer_ctl_cache_clear_l();
+    pthread_mutex_unlock(&mixer_ctl_cache.lock);
+}
+
+struct mixer_ctl *audio_extn_utils_get_mixer_ctl(struct mixer *mixer,
+                                                 const char *name)
+{
+    struct mixer_ctl_cache_entry *entry = NULL;
+    struct mixer_ctl *ctl;
+    uint32_t idx;
+    int probe;
+
+    if (mixer == NULL || name == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&mixer_ctl_cache.lock);
+    if (mixer != mixer_ctl_cache.mixer) {
+        pthread_mutex_unlock(&mixer_ctl_cache.lock);
+        return mixer_get_ctl_by_name(mixer, name);
+    }
+
+    idx = mixer_ctl_name_hash(name);
+    for (probe = 0; probe < MIXER_CTL_CACHE_SIZE; probe++) {
+        entry = &mixer_ctl_cache.entries[(idx + probe) & (MIXER_CTL_CACHE_SIZE - 1)];
+        if (entry->name == NULL || !strcmp(entry->name, name))
+            break;
+    }
+
+    if (entry->name != NULL && probe < MIXER_CTL_CACHE_SIZE) {
+        ctl = entry->ctl;
+        pthread_mutex_unlock(&mixer_ctl_cache.lock);
+        return ctl;
+    }
+
+    ctl = mixer_get_ctl_by_name(mixer, name);
+    /* keep the table at most 3/4 full so that probing stays short */
+    if (entry->name == NULL &&
+            mixer_ctl_cache.used < MIXER_CTL_CACHE_SIZE * 3 / 4) {
+        entry->name = strdup(name);
+        if (entry->name != NULL) {
+            entry->ctl = ctl;
+            mixer_ctl_cache.used++;
+        }
+    }
+    pthread_mutex_unlock(&mixer_ctl_cache.lock);
+    return ctl;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_volume_coalescer"
+/*#define LOG_NDEBUG 0*/
+
+/* Rate limit for volume mixer ctl writes.
+
+   A volume slider drag sends a new value every few ms and each one used
+   to be written to the DSP under adev->lock. A coalescer lets the first
+   change after a quiet period through right away and keeps the ones that
+   follow within vendor.audio.volume_coalesce_ms for a single deferred
+   write of the latest value, run by the amp service worker at the end of
+   the window.
+
+   The owner stores every new value itself and asks apply_now() with its
+   own lock held whether to write it. The deferred run calls back without
+   any lock; the callback takes the owner's lock and writes the stored
+   value if take() says it is still pending. Mutes do not go through a
+   coalescer.
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <log/log.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
+
+#include "audio_hw.h"
+#include "audio_extn.h"
+
+#define VOLUME_COALESCE_MS_DEFAULT 20
+
+struct volume_coalescer {
+    struct amp_task task;
+    volume_coalescer_apply_t apply;
+    void *context;
+    int64_t window_ns;
+    int64_t last_ns;         /* last write, immediate or deferred */
+    bool pending;            /* a deferred write is scheduled */
+};
+
+static int64_t volume_coalescer_run(struct amp_task *task)
+{
+    struct volume_coalescer *c = (struct volume_coalescer *)task->context;
+
+    c->apply(c->context);
+    return -1;
+}
+
+struct volume_coalescer *audio_extn_volume_coalescer_create(const char *name,
+                                                            volume_coalescer_apply_t apply,
+                                                            void *context)
+{
+    struct volume_coalescer *c;
+    int ms = property_get_int32("vendor.audio.volume_coalesce_ms",
+                                VOLUME_COALESCE_MS_DEFAULT);
+
+    if (ms <= 0)
+        return NULL;
+    c = (struct volume_coalescer *)calloc(1, sizeof(*c));
+    if (c == NULL)
+        return NULL;
+    if (audio_extn_amp_task_init(&c->task, name, volume_coalescer_run, c, 0) != 0) {
+        free(c);
+        return NULL;
+    }
+    c->apply = apply;
+    c->context = context;
+    c->window_ns = ms * 1000000LL;
+    return c;
+}
+
+/* owner's lock held, true when the new value is to be written now */
+bool audio_extn_volume_coalescer_apply_now(struct volume_coalescer *c)
+{
+    int64_t now_ns;
+
+    if (c == NULL)
+        return true;
+    if (c->pending)
+        return false;
+    now_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (now_ns - c->last_ns >= c->window_ns) {
+        c->last_ns = now_ns;
+        return true;
+    }
+    if (audio_extn_amp_task_schedule(&c->task, c->last_ns + c->window_ns - now_ns) != 0)
+        return true;
+    c->pending = true;
+    ALOGV("%s: %s deferred", __func__, c->task.name);
+    return false;
+}
+
+/* owner's lock held, from the apply callback: true when a write is still owed */
+bool audio_extn_volume_coalescer_take(struct volume_coalescer *c)
+{
+    if (c == NULL || !c->pending)
+        return false;
+    c->pending = false;
+    c->last_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    return true;
+}
+
+/* must not be called with the owner's lock held, waits for a running apply */
+void audio_extn_volume_coalescer_destroy(struct volume_coalescer *c)
+{
+    if (c == NULL)
+        return;
+    audio_extn_amp_task_release(&c->task);
+    free(c);
+}
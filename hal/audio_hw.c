@@ -33,6 +33,12 @@
 #include <dlfcn.h>
 #include <sys/resource.h>
 #include <sys/prctl.h>
+#include <sys/eventfd.h>
+#include <sys/utsname.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
 #include <limits.h>
 
 #include <log/log.h>
@@ -47,11 +53,15 @@
 #include <processgroup/sched_policy.h>
 #include <system/thread_defs.h>
 #include <tinyalsa/asoundlib.h>
+#include <sound/asound.h>
 #include <audio_effects/effect_aec.h>
 #include <audio_effects/effect_ns.h>
 #include <audio_utils/clock.h>
+#include <audio_utils/primitives.h>
 #include "audio_hw.h"
 #include "audio_extn.h"
+#include "pcm_kernels.h"
+#include "seqlock.h"
 #include "audio_perf.h"
 #include "platform_api.h"
 #include <platform.h>
@@ -69,6 +79,31 @@
 #define COMPRESS_OFFLOAD_NUM_FRAGMENTS 3
 /* ToDo: Check and update a proper value in msec */
 #define COMPRESS_OFFLOAD_PLAYBACK_LATENCY 96
+/* upper bound for a single sleep while waiting for the WRITE_READY threshold */
+#define COMPRESS_OFFLOAD_WRITE_READY_MAX_WAIT_MS 100
+
+/* decoder configuration sent by the extractor ahead of the first write */
+#define AUDIO_OFFLOAD_CODEC_FLAC_MIN_BLK_SIZE "music_offload_flac_min_blk_size"
+#define AUDIO_OFFLOAD_CODEC_FLAC_MAX_BLK_SIZE "music_offload_flac_max_blk_size"
+#define AUDIO_OFFLOAD_CODEC_FLAC_MIN_FRAME_SIZE "music_offload_flac_min_frame_size"
+#define AUDIO_OFFLOAD_CODEC_FLAC_MAX_FRAME_SIZE "music_offload_flac_max_frame_size"
+#define AUDIO_OFFLOAD_CODEC_ALAC_FRAME_LENGTH "music_offload_alac_frame_length"
+#define AUDIO_OFFLOAD_CODEC_ALAC_COMPATIBLE_VERSION "music_offload_alac_compatible_version"
+#define AUDIO_OFFLOAD_CODEC_ALAC_BIT_DEPTH "music_offload_alac_bit_depth"
+#define AUDIO_OFFLOAD_CODEC_ALAC_PB "music_offload_alac_pb"
+#define AUDIO_OFFLOAD_CODEC_ALAC_MB "music_offload_alac_mb"
+#define AUDIO_OFFLOAD_CODEC_ALAC_KB "music_offload_alac_kb"
+#define AUDIO_OFFLOAD_CODEC_ALAC_NUM_CHANNELS "music_offload_alac_num_channels"
+#define AUDIO_OFFLOAD_CODEC_ALAC_MAX_RUN "music_offload_alac_max_run"
+#define AUDIO_OFFLOAD_CODEC_ALAC_MAX_FRAME_BYTES "music_offload_alac_max_frame_bytes"
+#define AUDIO_OFFLOAD_CODEC_ALAC_AVG_BIT_RATE "music_offload_alac_avg_bit_rate"
+#define AUDIO_OFFLOAD_CODEC_ALAC_SAMPLING_RATE "music_offload_alac_sampling_rate"
+#define AUDIO_OFFLOAD_CODEC_ALAC_CHANNEL_LAYOUT_TAG "music_offload_alac_channel_layout_tag"
+/* a fragment holds a few hundred ms of encoded capture at the default bitrates */
+#define COMPRESS_CAPTURE_FRAGMENT_SIZE (4 * 1024)
+#define COMPRESS_CAPTURE_NUM_FRAGMENTS 8
+#define COMPRESS_CAPTURE_AAC_BITRATE_PER_CHANNEL 64000
+#define COMPRESS_CAPTURE_AMR_WB_BITRATE 23850
 /* treat as unsigned Q1.13 */
 #define APP_TYPE_GAIN_DEFAULT         0x2000
 #define COMPRESS_PLAYBACK_VOLUME_MAX 0x2000
@@ -99,12 +134,16 @@
 
 #define ULL_PERIOD_SIZE (DEFAULT_OUTPUT_SAMPLING_RATE/1000)
 
+/* bounds the deep buffer period used while the screen is off */
+#define DEEP_BUFFER_SCREEN_OFF_MAX_MULTIPLIER 8
+
 static unsigned int configured_low_latency_capture_period_size =
         LOW_LATENCY_CAPTURE_PERIOD_SIZE;
 
 
 #define MMAP_PERIOD_SIZE (DEFAULT_OUTPUT_SAMPLING_RATE/1000)
 #define MMAP_PERIOD_COUNT_MIN 32
+#define MMAP_PERIOD_COUNT_ADAPTIVE_MIN 4
 #define MMAP_PERIOD_COUNT_MAX 512
 #define MMAP_PERIOD_COUNT_DEFAULT (MMAP_PERIOD_COUNT_MAX)
 #define MMAP_MIN_SIZE_FRAMES_MAX 64 * 1024
@@ -292,6 +331,7 @@ const char * const use_case_table[AUDIO_USECASE_MAX] = {
     [USECASE_AUDIO_RECORD_LOW_LATENCY] = "low-latency-record",
     [USECASE_AUDIO_RECORD_MMAP] = "mmap-record",
     [USECASE_AUDIO_RECORD_HIFI] = "hifi-record",
+    [USECASE_AUDIO_RECORD_COMPRESS] = "compress-record",
 
     [USECASE_AUDIO_HFP_SCO] = "hfp-sco",
     [USECASE_AUDIO_HFP_SCO_WB] = "hfp-sco-wb",
@@ -353,6 +393,9 @@ struct in_effect_list {
     effect_handle_t handle;
 };
 
+/* AEC and NS entries of all open inputs, more fall back to the heap */
+#define IN_EFFECT_POOL_SIZE 16
+
 static int set_voice_volume_l(struct audio_device *adev, float volume);
 static struct audio_device *adev = NULL;
 static pthread_mutex_t adev_init_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -363,6 +406,7 @@ static int last_known_cal_step = -1 ;
 static int check_a2dp_restore_l(struct audio_device *adev, struct stream_out *out, bool restore);
 static int out_set_compr_volume(struct audio_stream_out *stream, float left, float right);
 static int out_set_pcm_volume(struct audio_stream_out *stream, float left, float right);
+static void adev_load_offload_effects_l(struct audio_device *adev);
 
 static int in_set_microphone_direction(const struct audio_stream_in *stream,
                                            audio_microphone_direction_t dir);
@@ -433,41 +477,74 @@ static void register_in_stream(struct stream_in *in)
     }
 }
 
-static void request_out_focus(struct stream_out *out, long ns)
+/*
+ * With vendor.audio.adm.focus_burst above 1 focus is held across that many
+ * consecutive transfers instead of being requested and abandoned around
+ * each one. It is renegotiated when the transfer duration changes, and
+ * dropped on standby.
+ */
+static void request_focus(struct audio_device *adev, struct adm_focus *focus,
+                          audio_io_handle_t handle, long ns)
 {
-    struct audio_device *adev = out->dev;
+    if (focus->held) {
+        if (focus->ns == ns)
+            return;
+        if (adev->adm_abandon_focus)
+            adev->adm_abandon_focus(adev->adm_data, handle);
+        focus->held = false;
+    }
 
     if (adev->adm_request_focus_v2) {
-        adev->adm_request_focus_v2(adev->adm_data, out->handle, ns);
+        adev->adm_request_focus_v2(adev->adm_data, handle, ns);
     } else if (adev->adm_request_focus) {
-        adev->adm_request_focus(adev->adm_data, out->handle);
+        adev->adm_request_focus(adev->adm_data, handle);
     }
+    focus->held = adev->adm_focus_burst > 1;
+    focus->transfers = 0;
+    focus->ns = ns;
 }
 
-static void request_in_focus(struct stream_in *in, long ns)
+static void release_focus(struct audio_device *adev, struct adm_focus *focus,
+                          audio_io_handle_t handle)
 {
-    struct audio_device *adev = in->dev;
+    if (focus->held && ++focus->transfers < adev->adm_focus_burst)
+        return;
+    focus->held = false;
 
-    if (adev->adm_request_focus_v2) {
-        adev->adm_request_focus_v2(adev->adm_data, in->capture_handle, ns);
-    } else if (adev->adm_request_focus) {
-        adev->adm_request_focus(adev->adm_data, in->capture_handle);
-    }
+    if (adev->adm_abandon_focus)
+        adev->adm_abandon_focus(adev->adm_data, handle);
 }
 
-static void release_out_focus(struct stream_out *out, long ns __unused)
+/* abandons focus still held from a burst */
+static void drop_focus(struct audio_device *adev, struct adm_focus *focus,
+                       audio_io_handle_t handle)
 {
-    struct audio_device *adev = out->dev;
+    if (!focus->held)
+        return;
+    focus->held = false;
 
     if (adev->adm_abandon_focus)
-        adev->adm_abandon_focus(adev->adm_data, out->handle);
+        adev->adm_abandon_focus(adev->adm_data, handle);
+}
+
+static void request_out_focus(struct stream_out *out, long ns)
+{
+    request_focus(out->dev, &out->adm_focus, out->handle, ns);
+}
+
+static void request_in_focus(struct stream_in *in, long ns)
+{
+    request_focus(in->dev, &in->adm_focus, in->capture_handle, ns);
+}
+
+static void release_out_focus(struct stream_out *out, long ns __unused)
+{
+    release_focus(out->dev, &out->adm_focus, out->handle);
 }
 
 static void release_in_focus(struct stream_in *in, long ns __unused)
 {
-    struct audio_device *adev = in->dev;
-    if (adev->adm_abandon_focus)
-        adev->adm_abandon_focus(adev->adm_data, in->capture_handle);
+    release_focus(in->dev, &in->adm_focus, in->capture_handle);
 }
 
 static int parse_snd_card_status(struct str_parms * parms, int * card,
@@ -570,6 +647,12 @@ static bool is_supported_format(audio_format_t format)
         case AUDIO_FORMAT_AAC_LC:
         case AUDIO_FORMAT_AAC_HE_V1:
         case AUDIO_FORMAT_AAC_HE_V2:
+#ifdef FLAC_OFFLOAD_ENABLED
+        case AUDIO_FORMAT_FLAC:
+#endif
+#ifdef ALAC_OFFLOAD_ENABLED
+        case AUDIO_FORMAT_ALAC:
+#endif
             return true;
         default:
             break;
@@ -606,8 +689,22 @@ static int get_snd_codec_id(audio_format_t format)
         id = SND_AUDIOCODEC_MP3;
         break;
     case AUDIO_FORMAT_AAC:
+    case AUDIO_FORMAT_AAC_ADTS:
         id = SND_AUDIOCODEC_AAC;
         break;
+    case AUDIO_FORMAT_AMR_WB:
+        id = SND_AUDIOCODEC_AMRWB;
+        break;
+#ifdef FLAC_OFFLOAD_ENABLED
+    case AUDIO_FORMAT_FLAC:
+        id = SND_AUDIOCODEC_FLAC;
+        break;
+#endif
+#ifdef ALAC_OFFLOAD_ENABLED
+    case AUDIO_FORMAT_ALAC:
+        id = SND_AUDIOCODEC_ALAC;
+        break;
+#endif
     default:
         ALOGE("%s: Unsupported audio format", __func__);
     }
@@ -621,7 +718,7 @@ static int audio_ssr_status(struct audio_device *adev)
     struct mixer_ctl *ctl;
     const char *mixer_ctl_name = "Audio SSR Status";
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     ret = mixer_ctl_get_value(ctl, 0);
     ALOGD("%s: value: %d", __func__, ret);
     return ret;
@@ -648,6 +745,51 @@ static bool is_a2dp_device(snd_device_t out_snd_device)
    return out_snd_device == SND_DEVICE_OUT_BT_A2DP;
 }
 
+/*
+ * Route batches let a reroute of several usecases reach the mixer in one
+ * audio_route_update_mixer() call instead of one per path, so streams that
+ * are switched together are not muted one after the other. A batch holds
+ * either disables or enables, never both: audio_route would fold a reset
+ * and re-apply of the same path into no change at all, and the backend
+ * would not see the teardown that a forced reroute relies on.
+ * All of these must be called with adev->lock held.
+ */
+static void begin_route_batch(struct audio_device *adev)
+{
+    adev->route_batch_depth++;
+}
+
+static void commit_route_batch(struct audio_device *adev)
+{
+    if (--adev->route_batch_depth > 0 || !adev->route_batch_dirty)
+        return;
+
+    int64_t trace_ns = audio_extn_route_trace_begin();
+    audio_route_update_mixer(adev->audio_route);
+    audio_extn_route_trace_end(ROUTE_TRACE_MIXER_PATH, "batch", trace_ns);
+    adev->route_batch_dirty = false;
+}
+
+static void apply_route_path(struct audio_device *adev, const char *path)
+{
+    if (adev->route_batch_depth > 0) {
+        audio_route_apply_path(adev->audio_route, path);
+        adev->route_batch_dirty = true;
+    } else {
+        audio_route_apply_and_update_path(adev->audio_route, path);
+    }
+}
+
+static void reset_route_path(struct audio_device *adev, const char *path)
+{
+    if (adev->route_batch_depth > 0) {
+        audio_route_reset_path(adev->audio_route, path);
+        adev->route_batch_dirty = true;
+    } else {
+        audio_route_reset_and_update_path(adev->audio_route, path);
+    }
+}
+
 int enable_audio_route(struct audio_device *adev,
                        struct audio_usecase *usecase)
 {
@@ -669,23 +811,30 @@ int enable_audio_route(struct audio_device *adev,
         if (in) {
             if (in->enable_aec || in->enable_ec_port) {
                 audio_devices_t out_device = AUDIO_DEVICE_OUT_SPEAKER;
+                struct stream_out *ec_out = NULL;
                 struct listnode *node;
                 struct audio_usecase *voip_usecase = get_usecase_from_list(adev,
                                                            USECASE_AUDIO_PLAYBACK_VOIP);
                 if (voip_usecase) {
-                    out_device = voip_usecase->stream.out->devices;
+                    ec_out = voip_usecase->stream.out;
                 } else if (adev->primary_output &&
                               !adev->primary_output->standby) {
-                    out_device = adev->primary_output->devices;
+                    ec_out = adev->primary_output;
                 } else {
                     list_for_each(node, &adev->usecase_list) {
                         uinfo = node_to_item(node, struct audio_usecase, list);
                         if (uinfo->type != PCM_CAPTURE) {
-                            out_device = uinfo->stream.out->devices;
+                            ec_out = uinfo->stream.out;
                             break;
                         }
                     }
                 }
+                if (ec_out != NULL) {
+                    out_device = ec_out->devices;
+                    if (audio_is_linear_pcm(ec_out->format))
+                        audio_extn_ec_ref_tap_attach(ec_out->handle, ec_out->sample_rate,
+                                audio_stream_out_frame_size(&ec_out->stream));
+                }
                 platform_set_echo_reference(adev, true, out_device);
                 in->ec_opened = true;
             }
@@ -694,7 +843,9 @@ int enable_audio_route(struct audio_device *adev,
         snd_device = usecase->out_snd_device;
     audio_extn_utils_send_app_type_cfg(adev, usecase);
     audio_extn_ma_set_device(usecase);
+    int64_t trace_ns = audio_extn_route_trace_begin();
     audio_extn_utils_send_audio_calibration(adev, usecase);
+    audio_extn_route_trace_end(ROUTE_TRACE_ACDB, use_case_table[usecase->id], trace_ns);
 
     // we shouldn't truncate mixer_path
     ALOGW_IF(strlcpy(mixer_path, use_case_table[usecase->id], sizeof(mixer_path))
@@ -703,7 +854,9 @@ int enable_audio_route(struct audio_device *adev,
     platform_add_backend_name(adev->platform, mixer_path, snd_device);
 
     ALOGD("%s: usecase(%d) apply and update mixer path: %s", __func__,  usecase->id, mixer_path);
-    audio_route_apply_and_update_path(adev->audio_route, mixer_path);
+    trace_ns = audio_extn_route_trace_begin();
+    apply_route_path(adev, mixer_path);
+    audio_extn_route_trace_end(ROUTE_TRACE_MIXER_PATH, mixer_path, trace_ns);
 
     ALOGV("%s: exit", __func__);
     return 0;
@@ -731,11 +884,14 @@ int disable_audio_route(struct audio_device *adev,
     platform_add_backend_name(adev->platform, mixer_path, snd_device);
     ALOGD("%s: usecase(%d) reset and update mixer path: %s", __func__, usecase->id, mixer_path);
 
-    audio_route_reset_and_update_path(adev->audio_route, mixer_path);
+    int64_t trace_ns = audio_extn_route_trace_begin();
+    reset_route_path(adev, mixer_path);
+    audio_extn_route_trace_end(ROUTE_TRACE_MIXER_PATH, mixer_path, trace_ns);
     if (usecase->type == PCM_CAPTURE) {
         struct stream_in *in = usecase->stream.in;
         if (in && in->ec_opened) {
             platform_set_echo_reference(in->dev, false, AUDIO_DEVICE_NONE);
+            audio_extn_ec_ref_tap_detach();
             in->ec_opened = false;
         }
     }
@@ -751,13 +907,17 @@ int enable_snd_device(struct audio_device *adev,
     int i, num_devices = 0;
     snd_device_t new_snd_devices[2];
     int ret_val = -EINVAL;
+    int64_t trace_ns;
     if (snd_device < SND_DEVICE_MIN ||
         snd_device >= SND_DEVICE_MAX) {
         ALOGE("%s: Invalid sound device %d", __func__, snd_device);
         goto on_error;
     }
 
+    trace_ns = audio_extn_route_trace_begin();
     platform_send_audio_calibration(adev->platform, snd_device);
+    audio_extn_route_trace_end(ROUTE_TRACE_ACDB,
+                               platform_get_snd_device_name(snd_device), trace_ns);
 
     if (adev->snd_dev_ref_cnt[snd_device] >= 1) {
         ALOGV("%s: snd_device(%d: %s) is already active",
@@ -783,7 +943,11 @@ int enable_snd_device(struct audio_device *adev,
         if (platform_get_snd_device_acdb_id(snd_device) < 0) {
             goto on_error;
         }
-        if (audio_extn_spkr_prot_start_processing(snd_device)) {
+        trace_ns = audio_extn_route_trace_begin();
+        int spkr_prot_ret = audio_extn_spkr_prot_start_processing(snd_device);
+        audio_extn_route_trace_end(ROUTE_TRACE_SPKR_PROT,
+                                   platform_get_snd_device_name(snd_device), trace_ns);
+        if (spkr_prot_ret) {
             ALOGE("%s: spkr_start_processing failed", __func__);
             goto on_error;
         }
@@ -812,7 +976,9 @@ int enable_snd_device(struct audio_device *adev,
             }
         }
 
-        audio_route_apply_and_update_path(adev->audio_route, device_name);
+        trace_ns = audio_extn_route_trace_begin();
+        apply_route_path(adev, device_name);
+        audio_extn_route_trace_end(ROUTE_TRACE_MIXER_PATH, device_name, trace_ns);
     }
 on_success:
     adev->snd_dev_ref_cnt[snd_device]++;
@@ -875,7 +1041,9 @@ int disable_snd_device(struct audio_device *adev,
             }
 
             ALOGD("%s: snd_device(%d: %s)", __func__, snd_device, device_name);
-            audio_route_reset_and_update_path(adev->audio_route, device_name);
+            int64_t trace_ns = audio_extn_route_trace_begin();
+            reset_route_path(adev, device_name);
+            audio_extn_route_trace_end(ROUTE_TRACE_MIXER_PATH, device_name, trace_ns);
         }
         audio_extn_sound_trigger_update_device_status(snd_device,
                                         ST_EVENT_SND_DEVICE_FREE);
@@ -893,7 +1061,7 @@ static int send_effect_enable_disable_mixer_ctl(struct audio_device *adev,
     char mixer_ctl_name[] = "Audio Effect";
     long set_values[6];
 
-    struct mixer_ctl *ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    struct mixer_ctl *ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get mixer ctl - %s",
                __func__, mixer_ctl_name);
@@ -1142,9 +1310,12 @@ static void check_and_route_playback_usecases(struct audio_device *adev,
     bool switch_device[AUDIO_USECASE_MAX];
     int i, num_uc_to_switch = 0;
 
+    int64_t trace_ns = audio_extn_route_trace_begin();
     bool force_routing =  platform_check_and_set_playback_backend_cfg(adev,
                                                                       uc_info,
                                                                       snd_device);
+    audio_extn_route_trace_end(ROUTE_TRACE_BACKEND_CFG,
+                               platform_get_snd_device_name(snd_device), trace_ns);
 
     /* For a2dp device reconfigure all active sessions
      * with new AFE encoder format based on a2dp state
@@ -1171,6 +1342,7 @@ static void check_and_route_playback_usecases(struct audio_device *adev,
     for (i = 0; i < AUDIO_USECASE_MAX; i++)
         switch_device[i] = false;
 
+    begin_route_batch(adev);
     list_for_each(node, &adev->usecase_list) {
         usecase = node_to_item(node, struct audio_usecase, list);
         if (usecase->type == PCM_CAPTURE || usecase == uc_info)
@@ -1197,7 +1369,13 @@ static void check_and_route_playback_usecases(struct audio_device *adev,
                 disable_snd_device(adev, usecase->out_snd_device);
             }
         }
+    }
+    /* the teardown reaches the mixer before anything is re-enabled, and
+       speaker protection and calibration in enable_snd_device() see the
+       device path already applied */
+    commit_route_batch(adev);
 
+    if (num_uc_to_switch) {
         snd_device_t d_device;
         list_for_each(node, &adev->usecase_list) {
             usecase = node_to_item(node, struct audio_usecase, list);
@@ -1212,6 +1390,7 @@ static void check_and_route_playback_usecases(struct audio_device *adev,
 
         /* Re-route all the usecases on the shared backend other than the
            specified usecase to new snd devices */
+        begin_route_batch(adev);
         list_for_each(node, &adev->usecase_list) {
             usecase = node_to_item(node, struct audio_usecase, list);
             if (switch_device[usecase->id] ) {
@@ -1224,6 +1403,7 @@ static void check_and_route_playback_usecases(struct audio_device *adev,
                 }
             }
         }
+        commit_route_batch(adev);
     }
 }
 
@@ -1236,7 +1416,10 @@ static void check_and_route_capture_usecases(struct audio_device *adev,
     bool switch_device[AUDIO_USECASE_MAX];
     int i, num_uc_to_switch = 0;
 
+    int64_t trace_ns = audio_extn_route_trace_begin();
     platform_check_and_set_capture_backend_cfg(adev, uc_info, snd_device);
+    audio_extn_route_trace_end(ROUTE_TRACE_BACKEND_CFG,
+                               platform_get_snd_device_name(snd_device), trace_ns);
 
     /*
      * This function is to make sure that all the active capture usecases
@@ -1251,6 +1434,7 @@ static void check_and_route_capture_usecases(struct audio_device *adev,
     for (i = 0; i < AUDIO_USECASE_MAX; i++)
         switch_device[i] = false;
 
+    begin_route_batch(adev);
     list_for_each(node, &adev->usecase_list) {
         usecase = node_to_item(node, struct audio_usecase, list);
         if (usecase->type != PCM_PLAYBACK &&
@@ -1277,7 +1461,10 @@ static void check_and_route_capture_usecases(struct audio_device *adev,
                 disable_snd_device(adev, usecase->in_snd_device);
             }
         }
+    }
+    commit_route_batch(adev);
 
+    if (num_uc_to_switch) {
         list_for_each(node, &adev->usecase_list) {
             usecase = node_to_item(node, struct audio_usecase, list);
             if (switch_device[usecase->id]) {
@@ -1287,6 +1474,7 @@ static void check_and_route_capture_usecases(struct audio_device *adev,
 
         /* Re-route all the usecases on the shared backend other than the
            specified usecase to new snd devices */
+        begin_route_batch(adev);
         list_for_each(node, &adev->usecase_list) {
             usecase = node_to_item(node, struct audio_usecase, list);
             /* Update the in_snd_device only before enabling the audio route */
@@ -1295,6 +1483,7 @@ static void check_and_route_capture_usecases(struct audio_device *adev,
                 enable_audio_route(adev, usecase);
             }
         }
+        commit_route_batch(adev);
     }
 }
 
@@ -1465,33 +1654,69 @@ static bool is_usb_ready(struct audio_device *adev, bool is_playback)
     return ready;
 }
 
-static audio_usecase_t get_voice_usecase_id_from_list(struct audio_device *adev)
+struct audio_usecase *alloc_usecase(struct audio_device *adev)
+{
+    return (struct audio_usecase *)audio_extn_object_pool_alloc(adev->usecase_pool,
+                                                                sizeof(struct audio_usecase));
+}
+
+void free_usecase(struct audio_device *adev, struct audio_usecase *usecase)
+{
+    audio_extn_object_pool_free(adev->usecase_pool, usecase);
+}
+
+/* Every usecase_list change goes through these two so that lookups by id
+   and by type do not have to walk the whole list. The id table points at
+   the oldest entry with that id, as a walk of the list would find. */
+void add_usecase_to_list(struct audio_device *adev, struct audio_usecase *usecase)
+{
+    list_add_tail(&adev->usecase_list, &usecase->list);
+    if (usecase->type < USECASE_TYPE_MAX)
+        list_add_tail(&adev->usecase_type_list[usecase->type], &usecase->type_list);
+    else
+        list_init(&usecase->type_list);
+    if (usecase->id >= 0 && usecase->id < AUDIO_USECASE_MAX &&
+        adev->usecase_table[usecase->id] == NULL)
+        adev->usecase_table[usecase->id] = usecase;
+}
+
+void remove_usecase_from_list(struct audio_device *adev, struct audio_usecase *usecase)
 {
-    struct audio_usecase *usecase;
     struct listnode *node;
 
+    list_remove(&usecase->list);
+    list_remove(&usecase->type_list);
+    if (usecase->id < 0 || usecase->id >= AUDIO_USECASE_MAX ||
+        adev->usecase_table[usecase->id] != usecase)
+        return;
+    adev->usecase_table[usecase->id] = NULL;
     list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type == VOICE_CALL) {
-            ALOGV("%s: usecase id %d", __func__, usecase->id);
-            return usecase->id;
+        struct audio_usecase *other = node_to_item(node, struct audio_usecase, list);
+        if (other->id == usecase->id) {
+            adev->usecase_table[usecase->id] = other;
+            break;
         }
     }
-    return USECASE_INVALID;
 }
 
-struct audio_usecase *get_usecase_from_list(struct audio_device *adev,
-                                            audio_usecase_t uc_id)
+static audio_usecase_t get_voice_usecase_id_from_list(struct audio_device *adev)
 {
     struct audio_usecase *usecase;
-    struct listnode *node;
 
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->id == uc_id)
-            return usecase;
-    }
-    return NULL;
+    if (list_empty(&adev->usecase_type_list[VOICE_CALL]))
+        return USECASE_INVALID;
+    usecase = node_to_item(list_head(&adev->usecase_type_list[VOICE_CALL]),
+                           struct audio_usecase, type_list);
+    ALOGV("%s: usecase id %d", __func__, usecase->id);
+    return usecase->id;
+}
+
+struct audio_usecase *get_usecase_from_list(struct audio_device *adev,
+                                            audio_usecase_t uc_id)
+{
+    if (uc_id < 0 || uc_id >= AUDIO_USECASE_MAX)
+        return NULL;
+    return adev->usecase_table[uc_id];
 }
 
 static bool force_device_switch(struct audio_usecase *usecase)
@@ -1515,19 +1740,19 @@ static bool force_device_switch(struct audio_usecase *usecase)
 struct stream_in *adev_get_active_input(const struct audio_device *adev)
 {
     struct listnode *node;
-    struct stream_in *last_active_in = NULL;
 
     /* Get last added active input.
      * TODO: We may use a priority mechanism to pick highest priority active source */
-    list_for_each(node, &adev->usecase_list)
+    for (node = list_tail(&adev->usecase_type_list[PCM_CAPTURE]);
+         node != &adev->usecase_type_list[PCM_CAPTURE]; node = node->prev)
     {
-        struct audio_usecase *usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type == PCM_CAPTURE && usecase->stream.in != NULL) {
-            last_active_in =  usecase->stream.in;
+        struct audio_usecase *usecase = node_to_item(node, struct audio_usecase, type_list);
+        if (usecase->stream.in != NULL) {
+            return usecase->stream.in;
         }
     }
 
-    return last_active_in;
+    return NULL;
 }
 
 struct stream_in *get_voice_communication_input(const struct audio_device *adev)
@@ -1536,10 +1761,10 @@ struct stream_in *get_voice_communication_input(const struct audio_device *adev)
 
     /* First check active inputs with voice communication source and then
      * any input if audio mode is in communication */
-    list_for_each(node, &adev->usecase_list)
+    list_for_each(node, &adev->usecase_type_list[PCM_CAPTURE])
     {
-        struct audio_usecase *usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type == PCM_CAPTURE && usecase->stream.in != NULL &&
+        struct audio_usecase *usecase = node_to_item(node, struct audio_usecase, type_list);
+        if (usecase->stream.in != NULL &&
             usecase->stream.in->source == AUDIO_SOURCE_VOICE_COMMUNICATION) {
             return usecase->stream.in;
         }
@@ -1588,26 +1813,24 @@ static struct stream_in *get_priority_input(struct audio_device *adev)
     struct stream_in *priority_in = NULL;
     struct stream_in *in;
 
-    list_for_each(node, &adev->usecase_list) {
-        usecase = node_to_item(node, struct audio_usecase, list);
-        if (usecase->type == PCM_CAPTURE) {
-            in = usecase->stream.in;
-            if (!in)
-                continue;
-            priority = source_priority(in->source);
+    list_for_each(node, &adev->usecase_type_list[PCM_CAPTURE]) {
+        usecase = node_to_item(node, struct audio_usecase, type_list);
+        in = usecase->stream.in;
+        if (!in)
+            continue;
+        priority = source_priority(in->source);
 
-            if (priority > last_priority) {
-                last_priority = priority;
-                priority_in = in;
-            }
+        if (priority > last_priority) {
+            last_priority = priority;
+            priority_in = in;
         }
     }
     return priority_in;
 }
 
-int select_devices_with_force_switch(struct audio_device *adev,
-                                     audio_usecase_t uc_id,
-                                     bool force_switch)
+static int do_select_devices(struct audio_device *adev,
+                             audio_usecase_t uc_id,
+                             bool force_switch)
 {
     snd_device_t out_snd_device = SND_DEVICE_NONE;
     snd_device_t in_snd_device = SND_DEVICE_NONE;
@@ -1866,6 +2089,16 @@ int select_devices_with_force_switch(struct audio_device *adev,
     return status;
 }
 
+int select_devices_with_force_switch(struct audio_device *adev,
+                                     audio_usecase_t uc_id,
+                                     bool force_switch)
+{
+    int64_t trace_ns = audio_extn_route_trace_begin();
+    int ret = do_select_devices(adev, uc_id, force_switch);
+    audio_extn_route_trace_end(ROUTE_TRACE_SELECT_DEVICES, use_case_table[uc_id], trace_ns);
+    return ret;
+}
+
 int select_devices(struct audio_device *adev,
                    audio_usecase_t uc_id)
 {
@@ -1900,8 +2133,8 @@ static int stop_input_stream(struct stream_in *in)
     /* 2. Disable the tx device */
     disable_snd_device(adev, uc_info->in_snd_device);
 
-    list_remove(&uc_info->list);
-    free(uc_info);
+    remove_usecase_from_list(adev, uc_info);
+    free_usecase(adev, uc_info);
 
     if (priority_in == in) {
         priority_in = get_priority_input(adev);
@@ -1947,7 +2180,7 @@ int start_input_stream(struct stream_in *in)
         goto error_config;
     }
 
-    uc_info = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    uc_info = alloc_usecase(adev);
     uc_info->id = in->usecase;
     uc_info->type = PCM_CAPTURE;
     uc_info->stream.in = in;
@@ -1955,14 +2188,37 @@ int start_input_stream(struct stream_in *in)
     uc_info->in_snd_device = SND_DEVICE_NONE;
     uc_info->out_snd_device = SND_DEVICE_NONE;
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    add_usecase_to_list(adev, uc_info);
 
     audio_streaming_hint_start();
     audio_extn_perf_lock_acquire();
 
     select_devices(adev, in->usecase);
 
-    if (in->usecase == USECASE_AUDIO_RECORD_MMAP) {
+    if (in->usecase == USECASE_AUDIO_RECORD_COMPRESS) {
+        ALOGV("%s: Opening compress device card_id(%d) device_id(%d)",
+              __func__, adev->snd_card, in->pcm_device_id);
+        in->compr = compress_open(adev->snd_card, in->pcm_device_id,
+                                  COMPRESS_OUT, &in->compr_config);
+        if (in->compr == NULL || !is_compress_ready(in->compr)) {
+            ALOGE("%s: %s", __func__,
+                  in->compr ? compress_get_error(in->compr) : "open failed");
+            if (in->compr != NULL) {
+                compress_close(in->compr);
+                in->compr = NULL;
+            }
+            ret = -EIO;
+            goto error_open;
+        }
+        ret = compress_start(in->compr);
+        if (ret < 0) {
+            ALOGE("%s: compress_start failed %s", __func__, compress_get_error(in->compr));
+            compress_close(in->compr);
+            in->compr = NULL;
+            ret = -EIO;
+            goto error_open;
+        }
+    } else if (in->usecase == USECASE_AUDIO_RECORD_MMAP) {
         if (in->pcm == NULL || !pcm_is_ready(in->pcm)) {
             ALOGE("%s: pcm stream not ready", __func__);
             goto error_open;
@@ -2025,8 +2281,7 @@ int start_input_stream(struct stream_in *in)
     }
     register_in_stream(in);
     check_and_enable_effect(adev);
-    audio_extn_audiozoom_set_microphone_direction(in, in->zoom);
-    audio_extn_audiozoom_set_microphone_field_dimension(in, in->direction);
+    audio_extn_audiozoom_start_input_stream(in);
     audio_streaming_hint_end();
     audio_extn_perf_lock_release();
     ALOGV("%s: exit", __func__);
@@ -2043,6 +2298,31 @@ error_config:
     return ret;
 }
 
+/*
+ * Streams serving SCHED_FIFO clients (FastMixer, FastCapture, AAudio MMAP)
+ * get priority inheriting locks, so a normal priority thread routing or
+ * querying the stream while holding them is boosted instead of making the
+ * realtime thread wait behind it.
+ */
+static void init_stream_locks(pthread_mutex_t *lock, pthread_mutex_t *pre_lock,
+                              bool realtime_client)
+{
+    pthread_mutexattr_t attr;
+
+    if (!realtime_client ||
+            !property_get_bool("vendor.audio.stream.pi_lock", true)) {
+        pthread_mutex_init(lock, (const pthread_mutexattr_t *) NULL);
+        pthread_mutex_init(pre_lock, (const pthread_mutexattr_t *) NULL);
+        return;
+    }
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutex_init(pre_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
 void lock_input_stream(struct stream_in *in)
 {
     pthread_mutex_lock(&in->pre_lock);
@@ -2057,19 +2337,49 @@ void lock_output_stream(struct stream_out *out)
     pthread_mutex_unlock(&out->pre_lock);
 }
 
+static void wake_offload_thread(struct stream_out *out)
+{
+    uint64_t event = 1;
+
+    if (write(out->offload_cmd_fd, &event, sizeof(event)) != sizeof(event))
+        ALOGE("%s: failed to wake offload thread: %s", __func__, strerror(errno));
+}
+
 /* must be called with out->lock locked */
 static int send_offload_cmd_l(struct stream_out* out, int command)
 {
-    struct offload_cmd *cmd = (struct offload_cmd *)calloc(1, sizeof(struct offload_cmd));
+    unsigned int head = atomic_load_explicit(&out->offload_cmd_head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&out->offload_cmd_tail, memory_order_acquire);
 
     ALOGVV("%s %d", __func__, command);
 
-    cmd->cmd = command;
-    list_add_tail(&out->offload_cmd_list, &cmd->node);
-    pthread_cond_signal(&out->offload_cond);
+    /* the last slot is kept for OFFLOAD_CMD_EXIT, which must never be
+       dropped or destroy_offload_callback_thread() joins forever */
+    if (head - tail >= OFFLOAD_CMD_RING_SIZE - (command == OFFLOAD_CMD_EXIT ? 0 : 1)) {
+        ALOGE("%s: command ring full, dropping cmd %d", __func__, command);
+        return -ENOSPC;
+    }
+    out->offload_cmd_ring[head & (OFFLOAD_CMD_RING_SIZE - 1)] = command;
+    atomic_store_explicit(&out->offload_cmd_head, head + 1, memory_order_release);
+
+    wake_offload_thread(out);
     return 0;
 }
 
+/* called from the offload thread only, returns -1 if the ring is empty */
+static int get_offload_cmd(struct stream_out *out)
+{
+    unsigned int tail = atomic_load_explicit(&out->offload_cmd_tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&out->offload_cmd_head, memory_order_acquire);
+    int cmd;
+
+    if (head == tail)
+        return -1;
+    cmd = out->offload_cmd_ring[tail & (OFFLOAD_CMD_RING_SIZE - 1)];
+    atomic_store_explicit(&out->offload_cmd_tail, tail + 1, memory_order_release);
+    return cmd;
+}
+
 /* must be called iwth out->lock locked */
 static void stop_compressed_output_l(struct stream_out *out)
 {
@@ -2078,65 +2388,122 @@ static void stop_compressed_output_l(struct stream_out *out)
     out->send_new_metadata = 1;
     if (out->compr != NULL) {
         compress_stop(out->compr);
+        /* cut short a pending WRITE_READY threshold wait */
+        if (out->offload_thread_blocked)
+            wake_offload_thread(out);
         while (out->offload_thread_blocked) {
             pthread_cond_wait(&out->cond, &out->lock);
         }
     }
 }
 
+/* offload_state is only changed with out->lock held */
+static bool offload_is_playing(struct stream_out *out)
+{
+    bool playing;
+
+    lock_output_stream(out);
+    playing = out->offload_state == OFFLOAD_STATE_PLAYING;
+    pthread_mutex_unlock(&out->lock);
+    return playing;
+}
+
+/*
+ * Called from the offload thread without out->lock held. The driver wakes
+ * us up as soon as one fragment is free, so when a larger WRITE_READY
+ * threshold is configured sleep for the estimated time it takes the DSP to
+ * free the rest. The sleep ends early when a command is queued or the
+ * stream is stopped.
+ */
+static void offload_wait_for_write_ready(struct stream_out *out)
+{
+    struct pollfd pfd = { .fd = out->offload_cmd_fd, .events = POLLIN };
+    unsigned int avail;
+    struct timespec tstamp;
+
+    for (;;) {
+        if (compress_wait(out->compr, -1) < 0)
+            return;
+        if (out->offload_write_ready_bytes == 0 ||
+            out->compr_config.codec->bit_rate == 0 ||
+            !offload_is_playing(out))
+            return;
+        if (compress_get_hpointer(out->compr, &avail, &tstamp) < 0 ||
+            avail >= out->offload_write_ready_bytes)
+            return;
+
+        int64_t wait_ms = (int64_t)(out->offload_write_ready_bytes - avail) * 8 * 1000 /
+                              out->compr_config.codec->bit_rate;
+        if (wait_ms <= 0)
+            return;
+        if (wait_ms > COMPRESS_OFFLOAD_WRITE_READY_MAX_WAIT_MS)
+            wait_ms = COMPRESS_OFFLOAD_WRITE_READY_MAX_WAIT_MS;
+        int ret = poll(&pfd, 1, (int)wait_ms);
+        if (ret < 0)
+            return;
+        if (ret > 0) {
+            uint64_t events;
+
+            if (atomic_load(&out->offload_cmd_head) != atomic_load(&out->offload_cmd_tail) ||
+                !offload_is_playing(out))
+                return;
+            /* stale wakeup left by a command that was already consumed */
+            (void)read(out->offload_cmd_fd, &events, sizeof(events));
+        }
+    }
+}
+
 static void *offload_thread_loop(void *context)
 {
     struct stream_out *out = (struct stream_out *) context;
-    struct listnode *item;
 
-    setpriority(PRIO_PROCESS, 0, ANDROID_PRIORITY_AUDIO);
-    set_sched_policy(0, SP_FOREGROUND);
-    prctl(PR_SET_NAME, (unsigned long)"Offload Callback", 0, 0, 0);
+    audio_extn_thread_policy_apply(AUDIO_THREAD_AUDIO, "Offload Callback");
 
     ALOGV("%s", __func__);
 
     lock_output_stream(out);
     out->offload_state = OFFLOAD_STATE_IDLE;
     out->playback_started = 0;
+    pthread_mutex_unlock(&out->lock);
     for (;;) {
-        struct offload_cmd *cmd = NULL;
         stream_callback_event_t event;
         bool send_callback = false;
+        uint64_t events;
+        int cmd;
 
-        ALOGVV("%s offload_cmd_list %d out->offload_state %d",
-              __func__, list_empty(&out->offload_cmd_list),
-              out->offload_state);
-        if (list_empty(&out->offload_cmd_list)) {
+        /* the ring is drained before sleeping so no wakeup can be lost */
+        cmd = get_offload_cmd(out);
+        if (cmd < 0) {
             ALOGV("%s SLEEPING", __func__);
-            pthread_cond_wait(&out->offload_cond, &out->lock);
+            if (read(out->offload_cmd_fd, &events, sizeof(events)) < 0 && errno != EINTR) {
+                ALOGE("%s: failed to wait for commands: %s", __func__, strerror(errno));
+                break;
+            }
             ALOGV("%s RUNNING", __func__);
             continue;
         }
 
-        item = list_head(&out->offload_cmd_list);
-        cmd = node_to_item(item, struct offload_cmd, node);
-        list_remove(item);
-
+        lock_output_stream(out);
         ALOGVV("%s STATE %d CMD %d out->compr %p",
-               __func__, out->offload_state, cmd->cmd, out->compr);
+               __func__, out->offload_state, cmd, out->compr);
 
-        if (cmd->cmd == OFFLOAD_CMD_EXIT) {
-            free(cmd);
+        if (cmd == OFFLOAD_CMD_EXIT) {
+            pthread_mutex_unlock(&out->lock);
             break;
         }
 
         if (out->compr == NULL) {
             ALOGE("%s: Compress handle is NULL", __func__);
-            free(cmd);
             pthread_cond_signal(&out->cond);
+            pthread_mutex_unlock(&out->lock);
             continue;
         }
         out->offload_thread_blocked = true;
         pthread_mutex_unlock(&out->lock);
         send_callback = false;
-        switch (cmd->cmd) {
+        switch (cmd) {
         case OFFLOAD_CMD_WAIT_FOR_BUFFER:
-            compress_wait(out->compr, -1);
+            offload_wait_for_write_ready(out);
             send_callback = true;
             event = STREAM_CBK_EVENT_WRITE_READY;
             break;
@@ -2158,7 +2525,7 @@ static void *offload_thread_loop(void *context)
             event = STREAM_CBK_EVENT_ERROR;
             break;
         default:
-            ALOGE("%s unknown command received: %d", __func__, cmd->cmd);
+            ALOGE("%s unknown command received: %d", __func__, cmd);
             break;
         }
         lock_output_stream(out);
@@ -2168,15 +2535,14 @@ static void *offload_thread_loop(void *context)
             ALOGVV("%s: sending offload_callback event %d", __func__, event);
             out->offload_callback(event, NULL, out->offload_cookie);
         }
-        free(cmd);
+        pthread_mutex_unlock(&out->lock);
     }
 
+    lock_output_stream(out);
     pthread_cond_signal(&out->cond);
-    while (!list_empty(&out->offload_cmd_list)) {
-        item = list_head(&out->offload_cmd_list);
-        list_remove(item);
-        free(node_to_item(item, struct offload_cmd, node));
-    }
+    /* drop whatever was queued after the exit command */
+    while (get_offload_cmd(out) >= 0)
+        ;
     pthread_mutex_unlock(&out->lock);
 
     return NULL;
@@ -2184,8 +2550,13 @@ static void *offload_thread_loop(void *context)
 
 static int create_offload_callback_thread(struct stream_out *out)
 {
-    pthread_cond_init(&out->offload_cond, (const pthread_condattr_t *) NULL);
-    list_init(&out->offload_cmd_list);
+    out->offload_cmd_fd = eventfd(0, EFD_CLOEXEC);
+    if (out->offload_cmd_fd < 0) {
+        ALOGE("%s: eventfd failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    atomic_init(&out->offload_cmd_head, 0);
+    atomic_init(&out->offload_cmd_tail, 0);
     pthread_create(&out->offload_thread, (const pthread_attr_t *) NULL,
                     offload_thread_loop, out);
     return 0;
@@ -2199,7 +2570,8 @@ static int destroy_offload_callback_thread(struct stream_out *out)
 
     pthread_mutex_unlock(&out->lock);
     pthread_join(out->offload_thread, (void **) NULL);
-    pthread_cond_destroy(&out->offload_cond);
+    close(out->offload_cmd_fd);
+    out->offload_cmd_fd = -1;
 
     return 0;
 }
@@ -2365,7 +2737,7 @@ static int stop_output_stream(struct stream_out *out)
     /* 2. Disable the rx device */
     disable_snd_device(adev, uc_info->out_snd_device);
 
-    list_remove(&uc_info->list);
+    remove_usecase_from_list(adev, uc_info);
 
     audio_extn_extspk_update(adev->extspk);
 
@@ -2403,7 +2775,7 @@ static int stop_output_stream(struct stream_out *out)
         }
     }
 
-    free(uc_info);
+    free_usecase(adev, uc_info);
     ALOGV("%s: exit: status(%d)", __func__, ret);
     return ret;
 }
@@ -2443,6 +2815,18 @@ struct pcm* pcm_open_prepare_helper(unsigned int snd_card, unsigned int pcm_devi
     return pcm;
 }
 
+/* must be called with hw device mutex locked */
+static void close_haptic_pcm(struct audio_device *adev)
+{
+    // stop the writer first, it may be blocked in pcm_write()
+    audio_extn_haptic_writer_destroy(adev->haptic_writer);
+    adev->haptic_writer = NULL;
+    if (adev->haptic_pcm) {
+        pcm_close(adev->haptic_pcm);
+        adev->haptic_pcm = NULL;
+    }
+}
+
 int start_output_stream(struct stream_out *out)
 {
     int ret = 0;
@@ -2490,7 +2874,7 @@ int start_output_stream(struct stream_out *out)
         goto error_config;
     }
 
-    uc_info = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    uc_info = alloc_usecase(adev);
     uc_info->id = out->usecase;
     uc_info->type = PCM_PLAYBACK;
     uc_info->stream.out = out;
@@ -2507,7 +2891,7 @@ int start_output_stream(struct stream_out *out)
            This is eventually done as part of select_devices */
     }
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    add_usecase_to_list(adev, uc_info);
 
     audio_streaming_hint_start();
     audio_extn_perf_lock_acquire();
@@ -2559,6 +2943,7 @@ int start_output_stream(struct stream_out *out)
         if (out->offload_callback)
             compress_nonblock(out->compr, out->non_blocking);
 
+        adev_load_offload_effects_l(adev);
         if (adev->visualizer_start_output != NULL) {
             int capture_device_id =
                 platform_get_pcm_device_id(USECASE_AUDIO_RECORD_AFE_PROXY,
@@ -2581,6 +2966,7 @@ int start_output_stream(struct stream_out *out)
     } else {
         unsigned int flags = PCM_OUT | PCM_MONOTONIC;
         unsigned int pcm_open_retry_count = 0;
+        struct pcm_config config = out->config;
 
         if (out->usecase == USECASE_AUDIO_PLAYBACK_AFE_PROXY) {
             flags |= PCM_MMAP | PCM_NOIRQ;
@@ -2589,25 +2975,38 @@ int start_output_stream(struct stream_out *out)
             flags |= PCM_MMAP | PCM_NOIRQ;
         }
 
+        /*
+         * With the screen off the DSP interrupts once per longer period and
+         * the mixer fills it with back to back writes, so the SoC wakes up
+         * less often. The client buffer size stays the same, only the kernel
+         * buffer grows, and the position is computed against the real one.
+         */
+        out->long_periods = out->screen_off_period_multiplier > 1 && adev->screen_off;
+        if (out->long_periods)
+            config.period_size *= out->screen_off_period_multiplier;
+        out->kernel_buffer_size = config.period_size * config.period_count;
+
         out->pcm = pcm_open_prepare_helper(adev->snd_card, out->pcm_device_id,
                                        flags, pcm_open_retry_count,
-                                       &(out->config));
+                                       &config);
         if (out->pcm == NULL) {
            ret = -EIO;
            goto error_open;
         }
 
         if (out->usecase == USECASE_AUDIO_PLAYBACK_WITH_HAPTICS) {
-            if (adev->haptic_pcm != NULL) {
-                pcm_close(adev->haptic_pcm);
-                adev->haptic_pcm = NULL;
-            }
+            close_haptic_pcm(adev);
             adev->haptic_pcm = pcm_open_prepare_helper(adev->snd_card,
                                    adev->haptic_pcm_device_id,
                                    flags, pcm_open_retry_count,
                                    &(adev->haptics_config));
             // failure to open haptics pcm shouldnt stop audio,
             // so do not close audio pcm in case of error
+            if (adev->haptic_pcm != NULL &&
+                    property_get_bool("vendor.audio.haptics.async_write", true))
+                adev->haptic_writer = audio_extn_haptic_writer_create(adev->haptic_pcm,
+                        adev->haptic_buffer_size,
+                        adev->haptics_config.channels * audio_bytes_per_sample(out->format));
         }
 
         if (out->realtime) {
@@ -2646,10 +3045,7 @@ int start_output_stream(struct stream_out *out)
     ALOGV("%s: exit", __func__);
     return 0;
 error_open:
-    if (adev->haptic_pcm) {
-        pcm_close(adev->haptic_pcm);
-        adev->haptic_pcm = NULL;
-    }
+    close_haptic_pcm(adev);
     audio_streaming_hint_end();
     audio_extn_perf_lock_release();
     stop_output_stream(out);
@@ -2805,74 +3201,248 @@ static int out_set_format(struct audio_stream *stream __unused, audio_format_t f
     return -ENOSYS;
 }
 
-/* must be called with out->lock locked */
-static int out_standby_l(struct audio_stream *stream)
+/* must be called with out->lock and adev->lock locked */
+static void enter_warm_standby_l(struct stream_out *out)
 {
-    struct stream_out *out = (struct stream_out *)stream;
-    struct audio_device *adev = out->dev;
-    bool do_stop = true;
-
-    if (!out->standby) {
-        if (adev->adm_deregister_stream)
-            adev->adm_deregister_stream(adev->adm_data, out->handle);
-        pthread_mutex_lock(&adev->lock);
-        out->standby = true;
-        if (out->usecase != USECASE_AUDIO_PLAYBACK_OFFLOAD) {
-            if (out->pcm) {
-                pcm_close(out->pcm);
-                out->pcm = NULL;
+    out->warm_standby = true;
+    out->warm_standby_deadline_ns =
+            systemTime(SYSTEM_TIME_MONOTONIC) + out->warm_standby_ns;
+    pthread_cond_signal(&out->warm_standby_cond);
+}
 
-                if (out->usecase == USECASE_AUDIO_PLAYBACK_WITH_HAPTICS) {
-                    if (adev->haptic_pcm) {
-                        pcm_close(adev->haptic_pcm);
-                        adev->haptic_pcm = NULL;
-                    }
+/* must be called with out->lock and adev->lock locked */
+static void stop_warm_output_stream_l(struct stream_out *out)
+{
+    if (!out->warm_standby)
+        return;
 
-                    if (adev->haptic_buffer != NULL) {
-                        free(adev->haptic_buffer);
-                        adev->haptic_buffer = NULL;
-                        adev->haptic_buffer_size = 0;
-                    }
-                }
-            }
-            if (out->usecase == USECASE_AUDIO_PLAYBACK_MMAP) {
-                do_stop = out->playback_started;
-                out->playback_started = false;
+    ALOGV("%s: usecase(%d: %s)", __func__, out->usecase, use_case_table[out->usecase]);
+    out->warm_standby = false;
+    if (out->pcm) {
+        pcm_close(out->pcm);
+        out->pcm = NULL;
+    }
+    stop_output_stream(out);
+}
 
-                if (out->mmap_shared_memory_fd >= 0) {
-                    ALOGV("%s: closing mmap_shared_memory_fd = %d",
-                          __func__, out->mmap_shared_memory_fd);
-                    close(out->mmap_shared_memory_fd);
-                    out->mmap_shared_memory_fd = -1;
-                }
+static void *warm_standby_thread_loop(void *context)
+{
+    struct stream_out *out = (struct stream_out *) context;
+    struct audio_device *adev = out->dev;
+    struct timespec ts;
 
-            }
-        } else {
-            stop_compressed_output_l(out);
-            out->gapless_mdata.encoder_delay = 0;
-            out->gapless_mdata.encoder_padding = 0;
-            if (out->compr != NULL) {
-                compress_close(out->compr);
-                out->compr = NULL;
-            }
+    audio_extn_thread_policy_apply(AUDIO_THREAD_BACKGROUND, "Warm Standby");
+    lock_output_stream(out);
+    while (!out->warm_standby_exit) {
+        if (!out->warm_standby) {
+            pthread_cond_wait(&out->warm_standby_cond, &out->lock);
+            continue;
         }
-        if (do_stop) {
-            stop_output_stream(out);
+        if (systemTime(SYSTEM_TIME_MONOTONIC) < out->warm_standby_deadline_ns) {
+            ts.tv_sec = out->warm_standby_deadline_ns / 1000000000LL;
+            ts.tv_nsec = out->warm_standby_deadline_ns % 1000000000LL;
+            pthread_cond_timedwait(&out->warm_standby_cond, &out->lock, &ts);
+            continue;
         }
+        pthread_mutex_lock(&adev->lock);
+        stop_warm_output_stream_l(out);
         pthread_mutex_unlock(&adev->lock);
     }
-    return 0;
+    pthread_mutex_lock(&adev->lock);
+    stop_warm_output_stream_l(out);
+    pthread_mutex_unlock(&adev->lock);
+    pthread_mutex_unlock(&out->lock);
+
+    return NULL;
 }
 
-static int out_standby(struct audio_stream *stream)
+static int create_warm_standby_thread(struct stream_out *out)
 {
-    struct stream_out *out = (struct stream_out *)stream;
+    pthread_condattr_t attr;
+    int ret;
 
-    ALOGV("%s: enter: usecase(%d: %s)", __func__,
-          out->usecase, use_case_table[out->usecase]);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&out->warm_standby_cond, &attr);
+    pthread_condattr_destroy(&attr);
 
-    lock_output_stream(out);
-    out_standby_l(stream);
+    ret = pthread_create(&out->warm_standby_thread, (const pthread_attr_t *) NULL,
+                         warm_standby_thread_loop, out);
+    if (ret != 0) {
+        pthread_cond_destroy(&out->warm_standby_cond);
+        return -ret;
+    }
+    return 0;
+}
+
+static void destroy_warm_standby_thread(struct stream_out *out)
+{
+    lock_output_stream(out);
+    out->warm_standby_exit = true;
+    pthread_cond_signal(&out->warm_standby_cond);
+    pthread_mutex_unlock(&out->lock);
+
+    pthread_join(out->warm_standby_thread, (void **) NULL);
+    pthread_cond_destroy(&out->warm_standby_cond);
+    out->warm_standby_ns = 0;
+}
+
+/* Called with out->lock held, also records the fifo level for out_write() */
+static int out_get_pcm_position_l(struct stream_out *out, uint64_t *frames,
+                                  struct timespec *timestamp)
+{
+    int ret = -ENODATA;
+
+    if (out->pcm) {
+        unsigned int avail;
+        if (pcm_get_htimestamp(out->pcm, &avail, timestamp) == 0) {
+
+            // pcm_get_htimestamp() computes the available frames by comparing
+            // the alsa driver hw_ptr and the appl_ptr levels.
+            // In underrun, the hw_ptr may keep running and report an excessively
+            // large number available number.
+            if (avail > out->kernel_buffer_size) {
+                ALOGW("%s: avail:%u > kernel_buffer_size:%zu clamping!",
+                        __func__, avail, out->kernel_buffer_size);
+                avail = out->kernel_buffer_size;
+                out->last_fifo_frames_remaining = 0;
+            } else {
+                out->last_fifo_frames_remaining = out->kernel_buffer_size - avail;
+            }
+            out->last_fifo_valid = true;
+            out->last_fifo_time_ns = audio_utils_ns_from_timespec(timestamp);
+
+            int64_t signed_frames = out->written - out->last_fifo_frames_remaining;
+
+            ALOGVV("%s: frames:%lld  avail:%u  kernel_buffer_size:%zu",
+                    __func__, (long long)signed_frames, avail, out->kernel_buffer_size);
+
+            // This adjustment accounts for buffering after app processor.
+            // It is based on estimated DSP latency per use case, rather than exact.
+            signed_frames -=
+                (platform_render_latency(out) * out->sample_rate / 1000000LL);
+
+            // Adjustment accounts for A2DP encoder latency with non-offload usecases
+            // Note: Encoder latency is returned in ms, while platform_render_latency in us.
+            if (AUDIO_DEVICE_OUT_ALL_A2DP & out->devices) {
+                signed_frames -=
+                        (audio_extn_a2dp_get_encoder_latency() * out->sample_rate / 1000);
+            }
+
+            // It would be unusual for this value to be negative, but check just in case ...
+            if (signed_frames >= 0) {
+                *frames = signed_frames;
+                ret = 0;
+            }
+        }
+    }
+    return ret;
+}
+
+/* Called with out->lock held after each pcm write */
+static void out_publish_position_l(struct stream_out *out)
+{
+    uint64_t frames = 0;
+    struct timespec timestamp = {0, 0};
+    bool valid = out_get_pcm_position_l(out, &frames, &timestamp) == 0;
+
+    audio_extn_seqlock_write_begin(&out->position_seq);
+    out->position_valid = valid;
+    out->position_frames = frames;
+    out->position_timestamp = timestamp;
+    audio_extn_seqlock_write_end(&out->position_seq);
+}
+
+static void out_invalidate_position_l(struct stream_out *out)
+{
+    audio_extn_seqlock_write_begin(&out->position_seq);
+    out->position_valid = false;
+    audio_extn_seqlock_write_end(&out->position_seq);
+}
+
+/* Called with out->lock held, written counts bytes for offload */
+static void out_publish_metrics_l(struct stream_out *out, bool error)
+{
+    audio_extn_metrics_shm_update(out->metrics,
+                                  out->standby ? METRICS_SHM_STATE_STANDBY :
+                                                 METRICS_SHM_STATE_ACTIVE,
+                                  out->devices, out->written, out->fifo_underruns.n,
+                                  out->start_latency_ms.last, error);
+}
+
+/* must be called with out->lock locked */
+static int out_standby_l(struct audio_stream *stream)
+{
+    struct stream_out *out = (struct stream_out *)stream;
+    struct audio_device *adev = out->dev;
+    bool do_stop = true;
+
+    if (!out->standby) {
+        drop_focus(adev, &out->adm_focus, out->handle);
+        if (adev->adm_deregister_stream)
+            adev->adm_deregister_stream(adev->adm_data, out->handle);
+        pthread_mutex_lock(&adev->lock);
+        out->standby = true;
+        out_invalidate_position_l(out);
+        if (out->warm_standby_ns > 0 && !out->warm_standby_exit && out->pcm) {
+            /* keep the pcm and route, only drop what is queued */
+            pcm_stop(out->pcm);
+            enter_warm_standby_l(out);
+            pthread_mutex_unlock(&adev->lock);
+            out_publish_metrics_l(out, false);
+            return 0;
+        }
+        if (out->usecase != USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+            if (out->pcm) {
+                pcm_close(out->pcm);
+                out->pcm = NULL;
+
+                if (out->usecase == USECASE_AUDIO_PLAYBACK_WITH_HAPTICS)
+                    close_haptic_pcm(adev);
+            }
+            if (out->usecase == USECASE_AUDIO_PLAYBACK_MMAP) {
+                audio_extn_mmap_timing_save(&out->mmap_timing);
+                do_stop = out->playback_started;
+                out->playback_started = false;
+
+                if (out->mmap_shared_memory_fd >= 0) {
+                    ALOGV("%s: closing mmap_shared_memory_fd = %d",
+                          __func__, out->mmap_shared_memory_fd);
+                    close(out->mmap_shared_memory_fd);
+                    out->mmap_shared_memory_fd = -1;
+                }
+
+            }
+        } else {
+            stop_compressed_output_l(out);
+            out->gapless_mdata.encoder_delay = 0;
+            out->gapless_mdata.encoder_padding = 0;
+            if (out->compr != NULL) {
+                compress_close(out->compr);
+                out->compr = NULL;
+            }
+        }
+        if (do_stop) {
+            stop_output_stream(out);
+        }
+        pthread_mutex_unlock(&adev->lock);
+        out_publish_metrics_l(out, false);
+    }
+    return 0;
+}
+
+static int out_standby(struct audio_stream *stream)
+{
+    struct stream_out *out = (struct stream_out *)stream;
+
+    ALOGV("%s: enter: usecase(%d: %s)", __func__,
+          out->usecase, use_case_table[out->usecase]);
+    audio_extn_call_trace_log(CALL_TRACE_OUT_STANDBY, out->handle, 0, 0, NULL, 0);
+
+    lock_output_stream(out);
+    /* the client is done with it, do not bring it back after an SSR */
+    out->ssr_restart = false;
+    out_standby_l(stream);
     pthread_mutex_unlock(&out->lock);
     ALOGV("%s: exit", __func__);
     return 0;
@@ -2891,6 +3461,10 @@ static int out_on_error(struct audio_stream *stream)
             send_offload_cmd_l(out, OFFLOAD_CMD_ERROR);
         } else
             do_standby = true;
+    } else if (out->warm_standby) {
+        pthread_mutex_lock(&adev->lock);
+        stop_warm_output_stream_l(out);
+        pthread_mutex_unlock(&adev->lock);
     }
     pthread_mutex_unlock(&out->lock);
 
@@ -2914,12 +3488,17 @@ static int out_dump(const struct audio_stream *stream, int fd)
     char buffer[256]; // for statistics formatting
     simple_stats_to_string(&out->fifo_underruns, buffer, sizeof(buffer));
     dprintf(fd, "      Fifo frame underruns: %s\n", buffer);
+    audio_extn_utils_underrun_log_dump(&out->underrun_log, fd);
 
     if (out->start_latency_ms.n > 0) {
         simple_stats_to_string(&out->start_latency_ms, buffer, sizeof(buffer));
         dprintf(fd, "      Start latency ms: %s\n", buffer);
     }
 
+    audio_extn_utils_latency_hist_dump(&out->write_hist, fd, "Write latency");
+    audio_extn_utils_latency_hist_dump(&out->lock_hist, fd, "Lock wait");
+    audio_extn_utils_latency_hist_dump(&out->start_hist, fd, "Start latency");
+
     if (locked) {
         pthread_mutex_unlock(&out->lock);
     }
@@ -2963,6 +3542,76 @@ static int parse_compress_metadata(struct stream_out *out, struct str_parms *par
     return 0;
 }
 
+static bool get_codec_param(struct str_parms *parms, const char *key, uint32_t *value)
+{
+    int val;
+
+    if (str_parms_get_int(parms, key, &val) < 0 || val < 0)
+        return false;
+    *value = val;
+    return true;
+}
+
+/*
+ * The lossless decoders need stream parameters the offload info does not
+ * carry. They only reach the DSP with compress_open(), so they are taken
+ * whenever they come and apply from the next start.
+ */
+static void parse_compress_codec_params(struct stream_out *out, struct str_parms *parms)
+{
+    struct snd_codec *codec = out->compr_config.codec;
+    uint32_t val;
+
+    if (codec == NULL)
+        return;
+
+    switch (out->format & AUDIO_FORMAT_MAIN_MASK) {
+#ifdef FLAC_OFFLOAD_ENABLED
+    case AUDIO_FORMAT_FLAC:
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_FLAC_MIN_BLK_SIZE, &val))
+            codec->options.flac_dec.min_blk_size = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_FLAC_MAX_BLK_SIZE, &val))
+            codec->options.flac_dec.max_blk_size = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_FLAC_MIN_FRAME_SIZE, &val))
+            codec->options.flac_dec.min_frame_size = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_FLAC_MAX_FRAME_SIZE, &val))
+            codec->options.flac_dec.max_frame_size = val;
+        break;
+#endif
+#ifdef ALAC_OFFLOAD_ENABLED
+    case AUDIO_FORMAT_ALAC:
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_FRAME_LENGTH, &val))
+            codec->options.alac.frame_length = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_COMPATIBLE_VERSION, &val))
+            codec->options.alac.compatible_version = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_BIT_DEPTH, &val))
+            codec->options.alac.bit_depth = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_PB, &val))
+            codec->options.alac.pb = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_MB, &val))
+            codec->options.alac.mb = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_KB, &val))
+            codec->options.alac.kb = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_NUM_CHANNELS, &val))
+            codec->options.alac.num_channels = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_MAX_RUN, &val))
+            codec->options.alac.max_run = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_MAX_FRAME_BYTES, &val))
+            codec->options.alac.max_frame_bytes = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_AVG_BIT_RATE, &val))
+            codec->options.alac.avg_bit_rate = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_SAMPLING_RATE, &val))
+            codec->options.alac.sample_rate = val;
+        if (get_codec_param(parms, AUDIO_OFFLOAD_CODEC_ALAC_CHANNEL_LAYOUT_TAG, &val))
+            codec->options.alac.channel_layout_tag = val;
+        break;
+#endif
+    default:
+        (void)val;
+        break;
+    }
+}
+
 static bool output_drives_call(struct audio_device *adev, struct stream_out *out)
 {
     return out == adev->primary_output || out == adev->voice_tx_output;
@@ -2991,6 +3640,8 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     bool bypass_a2dp = false;
     bool forced_speaker_fallback = false;
 
+    audio_extn_call_trace_log(CALL_TRACE_OUT_SET_PARAMETERS, out->handle, 0, 0,
+                              kvpairs, kvpairs ? strlen(kvpairs) + 1 : 0);
     ALOGD("%s: enter: usecase(%d: %s) kvpairs: %s",
           __func__, out->usecase, use_case_table[out->usecase], kvpairs);
     parms = str_parms_create_str(kvpairs);
@@ -3095,6 +3746,8 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
          */
         if (new_dev != AUDIO_DEVICE_NONE) {
             bool same_dev = out->devices == new_dev;
+            if (!same_dev)
+                stop_warm_output_stream_l(out);
             out->devices = new_dev;
 
             if (output_drives_call(adev, out)) {
@@ -3185,7 +3838,27 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     }
     routing_fail:
 
+    if (out->warm_standby_ns > 0 &&
+            str_parms_get_str(parms, AUDIO_PARAMETER_KEY_PREWARM, value, sizeof(value)) >= 0) {
+        lock_output_stream(out);
+        if (out->standby && !out->warm_standby) {
+            pthread_mutex_lock(&adev->lock);
+            if (start_output_stream(out) == 0) {
+                /* registered again by the first write */
+                if (adev->adm_deregister_stream)
+                    adev->adm_deregister_stream(adev->adm_data, out->handle);
+                send_gain_dep_calibration_l();
+                enter_warm_standby_l(out);
+            }
+            pthread_mutex_unlock(&adev->lock);
+        }
+        pthread_mutex_unlock(&out->lock);
+    }
+
     if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+        lock_output_stream(out);
+        parse_compress_codec_params(out, parms);
+        pthread_mutex_unlock(&out->lock);
         parse_compress_metadata(out, parms);
     }
 
@@ -3194,118 +3867,206 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     return status;
 }
 
-static bool stream_get_parameter_channels(struct str_parms *query,
-                                          struct str_parms *reply,
-                                          audio_channel_mask_t *supported_channel_masks) {
-    int ret = -1;
-    char value[ARRAY_SIZE(channels_name_to_enum_table) * 32 /* max channel name size */];
+#define STREAM_CAPS_CHANNELS_MAX_LEN \
+        (ARRAY_SIZE(channels_name_to_enum_table) * 32 /* max channel name size */)
+
+static void stream_render_channels(char *value,
+                                   const audio_channel_mask_t *supported_channel_masks) {
     bool first = true;
     size_t i, j;
 
-    if (str_parms_has_key(query, AUDIO_PARAMETER_STREAM_SUP_CHANNELS)) {
-        ret = 0;
-        value[0] = '\0';
-        i = 0;
-        while (supported_channel_masks[i] != 0) {
-            for (j = 0; j < ARRAY_SIZE(channels_name_to_enum_table); j++) {
-                if (channels_name_to_enum_table[j].value == supported_channel_masks[i]) {
-                    if (!first) {
-                        strcat(value, "|");
-                    }
-                    strcat(value, channels_name_to_enum_table[j].name);
-                    first = false;
-                    break;
+    value[0] = '\0';
+    i = 0;
+    while (supported_channel_masks[i] != 0) {
+        for (j = 0; j < ARRAY_SIZE(channels_name_to_enum_table); j++) {
+            if (channels_name_to_enum_table[j].value == supported_channel_masks[i]) {
+                if (!first) {
+                    strcat(value, "|");
                 }
+                strcat(value, channels_name_to_enum_table[j].name);
+                first = false;
+                break;
             }
-            i++;
         }
-        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value);
+        i++;
     }
-    return ret >= 0;
 }
 
-static bool stream_get_parameter_formats(struct str_parms *query,
-                                         struct str_parms *reply,
-                                         audio_format_t *supported_formats) {
-    int ret = -1;
-    char value[256];
-    int i;
+static void stream_render_formats(char *value, const audio_format_t *supported_formats) {
+    value[0] = '\0';
+    switch (supported_formats[0]) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            strcat(value, "AUDIO_FORMAT_PCM_16_BIT");
+            break;
+        case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+            strcat(value, "AUDIO_FORMAT_PCM_24_BIT_PACKED");
+            break;
+        case AUDIO_FORMAT_PCM_32_BIT:
+            strcat(value, "AUDIO_FORMAT_PCM_32_BIT");
+            break;
+        default:
+            ALOGE("%s: unsupported format %#x", __func__,
+                  supported_formats[0]);
+            break;
+    }
+}
 
-    if (str_parms_has_key(query, AUDIO_PARAMETER_STREAM_SUP_FORMATS)) {
-        ret = 0;
-        value[0] = '\0';
-        switch (supported_formats[0]) {
-            case AUDIO_FORMAT_PCM_16_BIT:
-                strcat(value, "AUDIO_FORMAT_PCM_16_BIT");
-                break;
-            case AUDIO_FORMAT_PCM_24_BIT_PACKED:
-                strcat(value, "AUDIO_FORMAT_PCM_24_BIT_PACKED");
-                break;
-            case AUDIO_FORMAT_PCM_32_BIT:
-                strcat(value, "AUDIO_FORMAT_PCM_32_BIT");
-                break;
-            default:
-                ALOGE("%s: unsupported format %#x", __func__,
-                      supported_formats[0]);
-                break;
+static void stream_render_rates(char *value, size_t size,
+                                const uint32_t *supported_sample_rates) {
+    int i = 0;
+    int ret;
+    size_t cursor = 0;
+
+    value[0] = '\0';
+    while (supported_sample_rates[i]) {
+        int avail = size - cursor;
+        ret = snprintf(value + cursor, avail, "%s%d",
+                       cursor > 0 ? "|" : "",
+                       supported_sample_rates[i]);
+        if (ret < 0 || ret >= avail) {
+            // if cursor is at the last element of the array
+            //    overwrite with \0 is duplicate work as
+            //    snprintf already put a \0 in place.
+            // else
+            //    we had space to write the '|' at value[cursor]
+            //    (which will be overwritten) or no space to fill
+            //    the first element (=> cursor == 0)
+            value[cursor] = '\0';
+            break;
         }
-        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_FORMATS, value);
+        cursor += ret;
+        ++i;
     }
-    return ret >= 0;
 }
 
-static bool stream_get_parameter_rates(struct str_parms *query,
-                                       struct str_parms *reply,
-                                       uint32_t *supported_sample_rates) {
+static char *stream_caps_pair(const char *key, const char *value)
+{
+    size_t size = strlen(key) + strlen(value) + 2;
+    char *pair = (char *)malloc(size);
 
-    int i;
-    char value[256];
-    int ret = -1;
-    if (str_parms_has_key(query, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES)) {
-        ret = 0;
-        value[0] = '\0';
-        i=0;
-        int cursor = 0;
-        while (supported_sample_rates[i]) {
-            int avail = sizeof(value) - cursor;
-            ret = snprintf(value + cursor, avail, "%s%d",
-                           cursor > 0 ? "|" : "",
-                           supported_sample_rates[i]);
-            if (ret < 0 || ret >= avail) {
-                // if cursor is at the last element of the array
-                //    overwrite with \0 is duplicate work as
-                //    snprintf already put a \0 in place.
-                // else
-                //    we had space to write the '|' at value[cursor]
-                //    (which will be overwritten) or no space to fill
-                //    the first element (=> cursor == 0)
-                value[cursor] = '\0';
-                break;
-            }
-            cursor += ret;
-            ++i;
-        }
-        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES,
-                          value);
-    }
-    return ret >= 0;
+    if (pair != NULL)
+        snprintf(pair, size, "%s=%s", key, value);
+    return pair;
+}
+
+/* Bumped under adev->lock on every device connect and disconnect. Cached
+   capability replies rendered under an older generation are rendered again. */
+static atomic_uint caps_generation;
+
+/* caps->lock held */
+static void stream_caps_render_l(struct stream_caps *caps)
+{
+    char value[STREAM_CAPS_CHANNELS_MAX_LEN];
+
+    free(caps->channels);
+    free(caps->formats);
+    free(caps->rates);
+    caps->generation = atomic_load_explicit(&caps_generation, memory_order_relaxed);
+    stream_render_channels(value, caps->supported_channel_masks);
+    caps->channels = stream_caps_pair(AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value);
+    stream_render_formats(value, caps->supported_formats);
+    caps->formats = stream_caps_pair(AUDIO_PARAMETER_STREAM_SUP_FORMATS, value);
+    stream_render_rates(value, sizeof(value), caps->supported_sample_rates);
+    caps->rates = stream_caps_pair(AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, value);
+}
+
+/* caps->lock held, renders again after a device connect or disconnect */
+static void stream_caps_refresh_l(struct stream_caps *caps)
+{
+    if (caps->generation != atomic_load_explicit(&caps_generation, memory_order_relaxed))
+        stream_caps_render_l(caps);
+}
+
+/* the lists belong to the stream and must outlive caps */
+static void stream_caps_init(struct stream_caps *caps,
+                             const audio_channel_mask_t *supported_channel_masks,
+                             const audio_format_t *supported_formats,
+                             const uint32_t *supported_sample_rates)
+{
+    pthread_mutex_init(&caps->lock, (const pthread_mutexattr_t *) NULL);
+    caps->supported_channel_masks = supported_channel_masks;
+    caps->supported_formats = supported_formats;
+    caps->supported_sample_rates = supported_sample_rates;
+    stream_caps_render_l(caps);
+}
+
+static void stream_caps_release(struct stream_caps *caps)
+{
+    free(caps->channels);
+    free(caps->formats);
+    free(caps->rates);
+    pthread_mutex_destroy(&caps->lock);
+    memset(caps, 0, sizeof(*caps));
+}
+
+/* AudioFlinger asks for one capability at a time, answer those without
+   parsing the keys or building a reply. The caller frees what
+   get_parameters() returns, so the reply is still a copy. */
+static char *stream_get_cached_caps(struct stream_caps *caps, const char *keys)
+{
+    char **pair = NULL;
+    char *str = NULL;
+
+    if (strcmp(keys, AUDIO_PARAMETER_STREAM_SUP_CHANNELS) == 0)
+        pair = &caps->channels;
+    else if (strcmp(keys, AUDIO_PARAMETER_STREAM_SUP_FORMATS) == 0)
+        pair = &caps->formats;
+    else if (strcmp(keys, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES) == 0)
+        pair = &caps->rates;
+    if (pair == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&caps->lock);
+    stream_caps_refresh_l(caps);
+    if (*pair != NULL)
+        str = strdup(*pair);
+    pthread_mutex_unlock(&caps->lock);
+    return str;
+}
+
+static bool stream_get_parameter_cap(struct str_parms *query,
+                                     struct str_parms *reply,
+                                     const char *key, const char *pair) {
+    if (pair == NULL || !str_parms_has_key(query, key))
+        return false;
+    str_parms_add_str(reply, key, pair + strlen(key) + 1);
+    return true;
+}
+
+static bool stream_get_parameter_caps(struct str_parms *query,
+                                      struct str_parms *reply,
+                                      struct stream_caps *caps) {
+    bool replied = false;
+
+    pthread_mutex_lock(&caps->lock);
+    stream_caps_refresh_l(caps);
+    replied |= stream_get_parameter_cap(query, reply, AUDIO_PARAMETER_STREAM_SUP_CHANNELS,
+                                        caps->channels);
+    replied |= stream_get_parameter_cap(query, reply, AUDIO_PARAMETER_STREAM_SUP_FORMATS,
+                                        caps->formats);
+    replied |= stream_get_parameter_cap(query, reply,
+                                        AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES,
+                                        caps->rates);
+    pthread_mutex_unlock(&caps->lock);
+    return replied;
 }
 
 static char* out_get_parameters(const struct audio_stream *stream, const char *keys)
 {
     struct stream_out *out = (struct stream_out *)stream;
-    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *query;
     char *str;
-    struct str_parms *reply = str_parms_create();
+    struct str_parms *reply;
     bool replied = false;
     ALOGV("%s: enter: keys - %s", __func__, keys);
 
-    replied |= stream_get_parameter_channels(query, reply,
-                                             &out->supported_channel_masks[0]);
-    replied |= stream_get_parameter_formats(query, reply,
-                                            &out->supported_formats[0]);
-    replied |= stream_get_parameter_rates(query, reply,
-                                          &out->supported_sample_rates[0]);
+    str = stream_get_cached_caps(&out->caps, keys);
+    if (str != NULL)
+        return str;
+
+    query = str_parms_create_str(keys);
+    reply = str_parms_create();
+    replied |= stream_get_parameter_caps(query, reply, &out->caps);
     if (replied) {
         str = str_parms_to_str(reply);
     } else {
@@ -3337,6 +4098,8 @@ static uint32_t out_get_latency(const struct audio_stream_out *stream)
 
     latency = (out->config.period_count * out->config.period_size * 1000) /
               (out->config.rate);
+    if (out->long_periods)
+        latency *= out->screen_off_period_multiplier;
 
     if (AUDIO_DEVICE_OUT_ALL_A2DP & out->devices)
         latency += audio_extn_a2dp_get_encoder_latency();
@@ -3360,7 +4123,7 @@ static int out_set_compr_volume(struct audio_stream_out *stream, float left,
 
     snprintf(mixer_ctl_name, sizeof(mixer_ctl_name),
              "Compress Playback %d Volume", pcm_device_id);
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -3377,6 +4140,17 @@ static int out_set_compr_volume(struct audio_stream_out *stream, float left,
     return 0;
 }
 
+/* deferred write of the last volume set during a coalescing window */
+static void out_apply_compr_volume(void *context)
+{
+    struct stream_out *out = (struct stream_out *)context;
+
+    pthread_mutex_lock(&out->compr_mute_lock);
+    if (audio_extn_volume_coalescer_take(out->volume_coalescer) && !out->a2dp_compress_mute)
+        out_set_compr_volume(&out->stream, out->volume_l, out->volume_r);
+    pthread_mutex_unlock(&out->compr_mute_lock);
+}
+
 static int out_set_pcm_volume(struct audio_stream_out *stream, float left,
                               float right)
 {
@@ -3394,7 +4168,7 @@ static int out_set_pcm_volume(struct audio_stream_out *stream, float left,
         struct mixer_ctl *ctl;
         int pcm_device_id = platform_get_pcm_device_id(out->usecase, PCM_PLAYBACK);
         snprintf(mixer_ctl_name, sizeof(mixer_ctl_name), "Playback %d Volume", pcm_device_id);
-        ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+        ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
         if (!ctl) {
             ALOGE("%s : Could not get ctl for mixer cmd - %s", __func__, mixer_ctl_name);
             return -EINVAL;
@@ -3421,6 +4195,8 @@ static int out_set_volume(struct audio_stream_out *stream, float left,
     struct stream_out *out = (struct stream_out *)stream;
     int ret = 0;
 
+    audio_extn_call_trace_log(CALL_TRACE_OUT_SET_VOLUME, out->handle,
+                              (int64_t)(left * 1000000), (int64_t)(right * 1000000), NULL, 0);
     if (out->usecase == USECASE_AUDIO_PLAYBACK_HIFI) {
         /* only take left channel into account: the API is for stereo anyway */
         out->muted = (left == 0.0f);
@@ -3428,7 +4204,8 @@ static int out_set_volume(struct audio_stream_out *stream, float left,
     } else if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
         pthread_mutex_lock(&out->compr_mute_lock);
         ALOGV("%s: compress mute %d", __func__, out->a2dp_compress_mute);
-        if (!out->a2dp_compress_mute)
+        if (!out->a2dp_compress_mute &&
+                audio_extn_volume_coalescer_apply_now(out->volume_coalescer))
             ret = out_set_compr_volume(stream, left, right);
         out->volume_l = left;
         out->volume_r = right;
@@ -3449,6 +4226,50 @@ static int out_set_volume(struct audio_stream_out *stream, float left,
     return -ENOSYS;
 }
 
+/*
+ * Device side of a sound card state change, done once per change by
+ * whichever listener sees it first: the stream listeners may run before
+ * the device one and need the card usable to restart their stream.
+ */
+static void set_card_status_l(struct audio_device *adev, card_status_t status)
+{
+    if (adev->card_status == status)
+        return;
+    adev->card_status = status;
+    audio_extn_utils_mixer_ctl_cache_invalidate();
+    platform_snd_card_update(adev->platform, status);
+    /* streams restarted after an SSR do not go through out_write()'s resend */
+    if (status == CARD_STATUS_ONLINE)
+        send_gain_dep_calibration_l();
+}
+
+/*
+ * Reopens a stream that was playing when the DSP went down, as soon as
+ * the card is back, so the client's next write finds it ready instead of
+ * failing first and paying for the whole start then.
+ */
+static void out_ssr_restart_l(struct stream_out *out)
+{
+    struct audio_device *adev = out->dev;
+    int ret;
+
+    out->ssr_restart = false;
+    if (!out->standby)
+        return;
+
+    pthread_mutex_lock(&adev->lock);
+    if (out->warm_standby)
+        stop_warm_output_stream_l(out);
+    ret = start_output_stream(out);
+    pthread_mutex_unlock(&adev->lock);
+    if (ret != 0) {
+        ALOGW("%s: %s left in standby (%d)", __func__, use_case_table[out->usecase], ret);
+        return;
+    }
+    out->standby = false;
+    out->last_fifo_valid = false;
+}
+
 // note: this call is safe only if the stream_cb is
 // removed first in close_output_stream (as is done now).
 static void out_snd_mon_cb(void * stream, struct str_parms * parms)
@@ -3466,26 +4287,78 @@ static void out_snd_mon_cb(void * stream, struct str_parms * parms)
 
     pthread_mutex_lock(&adev->lock);
     bool valid_cb = (card == adev->snd_card);
+    if (valid_cb && status == CARD_STATUS_ONLINE)
+        set_card_status_l(adev, status);
     pthread_mutex_unlock(&adev->lock);
 
     if (!valid_cb)
         return;
 
     lock_output_stream(out);
+    /* offload and mmap clients restart their streams themselves */
+    const bool was_active = !out->standby &&
+                            out->usecase != USECASE_AUDIO_PLAYBACK_OFFLOAD &&
+                            out->usecase != USECASE_AUDIO_PLAYBACK_MMAP;
     if (out->card_status != status)
         out->card_status = status;
+    if (status == CARD_STATUS_ONLINE && out->ssr_restart)
+        out_ssr_restart_l(out);
     pthread_mutex_unlock(&out->lock);
 
     ALOGW("out_snd_mon_cb for card %d usecase %s, status %s", card,
           use_case_table[out->usecase],
           status == CARD_STATUS_OFFLINE ? "offline" : "online");
 
-    if (status == CARD_STATUS_OFFLINE)
+    if (status == CARD_STATUS_OFFLINE) {
         out_on_error(stream);
+        /* after the standby above, which clears it */
+        if (was_active) {
+            lock_output_stream(out);
+            out->ssr_restart = true;
+            pthread_mutex_unlock(&out->lock);
+        }
+    }
 
     return;
 }
 
+/*
+ * Converts a float client buffer in place to the format the pcm was
+ * opened with and returns the converted size. No target is wider than
+ * float, which the primitives allow to narrow in place.
+ */
+static size_t out_convert_format(struct stream_out *out, void *buffer, size_t bytes)
+{
+    const size_t samples = bytes / sizeof(float);
+    int64_t start_ns;
+
+    if (out->format != AUDIO_FORMAT_PCM_FLOAT)
+        return bytes;
+
+    start_ns = audio_extn_perf_stats_kernel_begin();
+    switch (out->config.format) {
+    case PCM_FORMAT_S16_LE:
+        memcpy_to_i16_from_float((int16_t *)buffer, (const float *)buffer, samples);
+        bytes = samples * sizeof(int16_t);
+        break;
+    case PCM_FORMAT_S24_3LE:
+        memcpy_to_p24_from_float((uint8_t *)buffer, (const float *)buffer, samples);
+        bytes = samples * 3;
+        break;
+    case PCM_FORMAT_S24_LE:
+        memcpy_to_q8_23_from_float_with_clamp((int32_t *)buffer, (const float *)buffer,
+                                              samples);
+        break;
+    case PCM_FORMAT_S32_LE:
+        memcpy_to_i32_from_float((int32_t *)buffer, (const float *)buffer, samples);
+        break;
+    default:
+        return bytes;
+    }
+    audio_extn_perf_stats_log_kernel(PERF_KERNEL_OUT_CONVERT, start_ns, samples);
+    return bytes;
+}
+
 #ifdef NO_AUDIO_OUT
 static ssize_t out_write_for_no_output(struct audio_stream_out *stream,
                                        const void *buffer __unused, size_t bytes)
@@ -3512,7 +4385,12 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
     ssize_t ret = 0;
     int error_code = ERROR_CODE_STANDBY;
 
+    audio_extn_call_trace_log(CALL_TRACE_OUT_WRITE, out->handle, bytes, 0, buffer, bytes);
+    const int64_t lockNs = systemTime(SYSTEM_TIME_MONOTONIC);
+    const int64_t cpuNs = audio_extn_perf_stats_cpu_ns();
     lock_output_stream(out);
+    audio_extn_utils_latency_hist_log(&out->lock_hist,
+                                      systemTime(SYSTEM_TIME_MONOTONIC) - lockNs);
     // this is always nonzero
     const size_t frame_size = audio_stream_out_frame_size(stream);
     const size_t frames = bytes / frame_size;
@@ -3533,7 +4411,14 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
     }
 
     const bool was_in_standby = out->standby;
-    if (out->standby) {
+    if (out->standby && out->warm_standby) {
+        /* pcm is still prepared and routed, the write restarts it */
+        out->standby = false;
+        out->warm_standby = false;
+        register_out_stream(out);
+        simple_stats_log(&out->start_latency_ms, 0);
+        out->last_fifo_valid = false;
+    } else if (out->standby) {
         out->standby = false;
         const int64_t startNs = systemTime(SYSTEM_TIME_MONOTONIC);
 
@@ -3554,8 +4439,10 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
         pthread_mutex_unlock(&adev->lock);
 
         // log startup time in ms.
-        simple_stats_log(
-                &out->start_latency_ms, (systemTime(SYSTEM_TIME_MONOTONIC) - startNs) * 1e-6);
+        const int64_t startDeltaNs = systemTime(SYSTEM_TIME_MONOTONIC) - startNs;
+        simple_stats_log(&out->start_latency_ms, startDeltaNs * 1e-6);
+        audio_extn_utils_latency_hist_log(&out->start_hist, startDeltaNs);
+        audio_extn_perf_stats_log_start(out->usecase, startDeltaNs);
         out->last_fifo_valid = false; // we're coming out of standby, last_fifo isn't valid.
     }
 
@@ -3581,12 +4468,20 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
             if (!was_in_standby && avail == out->kernel_buffer_size) {
                 ALOGW("%s: compressed buffer empty (underrun)", __func__);
                 simple_stats_log(&out->fifo_underruns, 1.); // Note: log one frame for compressed.
+                audio_extn_utils_underrun_log(&out->underrun_log, 1, out->usecase, out->devices);
+                audio_extn_perf_stats_log_underrun(out->usecase);
             }
 
             if (avail > bytes) {
                 avail = bytes;
             }
+            const int64_t writeNs = systemTime(SYSTEM_TIME_MONOTONIC);
             ret = compress_write(out->compr, buffer, avail);
+            audio_extn_utils_latency_hist_log(&out->write_hist,
+                                              systemTime(SYSTEM_TIME_MONOTONIC) - writeNs);
+            audio_extn_perf_stats_log_call(out->usecase,
+                                           systemTime(SYSTEM_TIME_MONOTONIC) - lockNs,
+                                           audio_extn_perf_stats_cpu_ns() - cpuNs, 0);
             ALOGVV("%s: writing buffer (%d bytes) to compress device returned %zd",
                    __func__, avail, ret);
         }
@@ -3604,6 +4499,7 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
         } else {
             out->written += ret; // accumulate bytes written for offload.
         }
+        out_publish_metrics_l(out, ret < 0);
         pthread_mutex_unlock(&out->lock);
         // TODO: consider logging offload pcm
         return ret;
@@ -3614,24 +4510,33 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 
             if (out->muted)
                 memset((void *)buffer, 0, bytes);
+            // the echo reference is the client buffer, before the in-place
+            // downmix, format conversion and haptics split below
+            if (!is_mmap_usecase(out->usecase))
+                audio_extn_ec_ref_tap_write(out->handle, buffer, bytes,
+                        out->position_valid ?
+                                (int64_t)(out->written + frames - out->position_frames) : 0,
+                        out->position_valid ?
+                                audio_utils_ns_from_timespec(&out->position_timestamp) : 0);
             // FIXME: this can be removed once audio flinger mixer supports mono output
             if (out->usecase == USECASE_AUDIO_PLAYBACK_VOIP ||
                 out->usecase == USECASE_INCALL_MUSIC_UPLINK ||
                 out->usecase == USECASE_INCALL_MUSIC_UPLINK2) {
                 size_t channel_count = audio_channel_count_from_out_mask(out->channel_mask);
-                int16_t *src = (int16_t *)buffer;
-                int16_t *dst = (int16_t *)buffer;
 
                 LOG_ALWAYS_FATAL_IF(out->config.channels != 1 || channel_count != 2 ||
                                     out->format != AUDIO_FORMAT_PCM_16_BIT,
                                     "out_write called for VOIP use case with wrong properties");
 
-                for (size_t i = 0; i < frames ; i++, dst++, src += 2) {
-                    *dst = (int16_t)(((int32_t)src[0] + (int32_t)src[1]) >> 1);
-                }
+                int64_t start_ns = audio_extn_perf_stats_kernel_begin();
+                audio_extn_pcm_downmix_stereo_to_mono_16((int16_t *)buffer,
+                                                         (const int16_t *)buffer, frames);
+                audio_extn_perf_stats_log_kernel(PERF_KERNEL_DOWNMIX, start_ns, frames * 2);
                 bytes_to_write /= 2;
             }
 
+            bytes_to_write = out_convert_format(out, (void *)buffer, bytes_to_write);
+
             // Note: since out_get_presentation_position() is called alternating with out_write()
             // by AudioFlinger, we can check underruns using the prior timestamp read.
             // (Alternately we could check if the buffer is empty using pcm_get_htimestamp().
@@ -3644,6 +4549,9 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 
                 if (underrun > 0) {
                     simple_stats_log(&out->fifo_underruns, underrun);
+                    audio_extn_utils_underrun_log(&out->underrun_log, underrun,
+                                                  out->usecase, out->devices);
+                    audio_extn_perf_stats_log_underrun(out->usecase);
 
                     ALOGW("%s: underrun(%lld) "
                             "frames_by_time(%lld) > out->last_fifo_frames_remaining(%lld)",
@@ -3658,9 +4566,14 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
             long ns = (frames * (int64_t) NANOS_PER_SECOND) / out->config.rate;
             request_out_focus(out, ns);
 
+            void *rt_latency_buffer = audio_extn_rt_latency_out_write(out, buffer,
+                                                                      bytes_to_write);
+            const void *pcm_buffer = rt_latency_buffer ? rt_latency_buffer : buffer;
+
             bool use_mmap = is_mmap_usecase(out->usecase) || out->realtime;
+            const int64_t writeNs = systemTime(SYSTEM_TIME_MONOTONIC);
             if (use_mmap) {
-                ret = pcm_mmap_write(out->pcm, (void *)buffer, bytes_to_write);
+                ret = pcm_mmap_write(out->pcm, (void *)pcm_buffer, bytes_to_write);
             } else {
                 if (out->usecase == USECASE_AUDIO_PLAYBACK_WITH_HAPTICS) {
                     size_t channel_count = audio_channel_count_from_out_mask(out->channel_mask);
@@ -3668,68 +4581,75 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
                     size_t frame_size = channel_count * bytes_per_sample;
                     size_t frame_count = bytes_to_write / frame_size;
 
-                    bool force_haptic_path =
-                         property_get_bool("vendor.audio.test_haptic", false);
-
                     // extract Haptics data from Audio buffer
-                    bool   alloc_haptic_buffer = false;
-                    int    haptic_channel_count = adev->haptics_config.channels;
+                    size_t haptic_channel_count = adev->haptics_config.channels;
+                    size_t audio_channel_count = channel_count - haptic_channel_count;
+                    size_t skip_channel_count = 0;
+
+                    // This is required for testing only. This works for stereo data only.
+                    // One channel is fed to audio stream and other to haptic stream for testing.
+                    // Discard haptic channel data.
+                    if (out->force_haptic_path) {
+                        audio_channel_count = haptic_channel_count = 1;
+                        skip_channel_count = channel_count > 2 ? channel_count - 2 : 0;
+                    }
+
                     size_t haptic_frame_size = bytes_per_sample * haptic_channel_count;
-                    size_t audio_frame_size = frame_size - haptic_frame_size;
                     size_t total_haptic_buffer_size = frame_count * haptic_frame_size;
 
-                    if (adev->haptic_buffer == NULL) {
-                        alloc_haptic_buffer = true;
-                    } else if (adev->haptic_buffer_size < total_haptic_buffer_size) {
+                    // The buffer is sized at open for the kernel buffer, only
+                    // grow it if the client writes more than that at once.
+                    if (adev->haptic_buffer_size < total_haptic_buffer_size) {
+                        ALOGW("%s: growing haptic buffer %zu -> %zu", __func__,
+                              adev->haptic_buffer_size, total_haptic_buffer_size);
                         free(adev->haptic_buffer);
-                        adev->haptic_buffer_size = 0;
-                        alloc_haptic_buffer = true;
-                    }
-
-                    if (alloc_haptic_buffer) {
                         adev->haptic_buffer = (uint8_t *)calloc(1, total_haptic_buffer_size);
-                        adev->haptic_buffer_size = total_haptic_buffer_size;
+                        adev->haptic_buffer_size =
+                                adev->haptic_buffer ? total_haptic_buffer_size : 0;
                     }
 
-                    size_t src_index = 0, aud_index = 0, hap_index = 0;
                     uint8_t *audio_buffer = (uint8_t *)buffer;
-                    uint8_t *haptic_buffer  = adev->haptic_buffer;
-
-                    // This is required for testing only. This works for stereo data only.
-                    // One channel is fed to audio stream and other to haptic stream for testing.
-                    if (force_haptic_path) {
-                       audio_frame_size = haptic_frame_size = bytes_per_sample;
+                    if (adev->haptic_buffer != NULL) {
+                        int64_t start_ns = audio_extn_perf_stats_kernel_begin();
+                        audio_extn_pcm_split_haptics(audio_buffer, adev->haptic_buffer,
+                                frame_count, bytes_per_sample, audio_channel_count,
+                                haptic_channel_count, skip_channel_count);
+                        audio_extn_perf_stats_log_kernel(PERF_KERNEL_HAPTIC_SPLIT, start_ns,
+                                frame_count * (audio_channel_count + haptic_channel_count));
                     }
 
-                    for (size_t i = 0; i < frame_count; i++) {
-                        for (size_t j = 0; j < audio_frame_size; j++)
-                            audio_buffer[aud_index++] = audio_buffer[src_index++];
-
-                        for (size_t j = 0; j < haptic_frame_size; j++)
-                            haptic_buffer[hap_index++] = audio_buffer[src_index++];
-                        }
-
-                        // This is required for testing only.
-                        // Discard haptic channel data.
-                        if (force_haptic_path) {
-                            src_index += haptic_frame_size;
+                    // hand the haptic data over first so both pipelines block in parallel
+                    int haptic_ret = 0;
+                    if (adev->haptic_writer && adev->haptic_buffer) {
+                        haptic_ret = audio_extn_haptic_writer_push(adev->haptic_writer,
+                                                                   adev->haptic_buffer,
+                                                                   total_haptic_buffer_size);
                     }
 
                     // write to audio pipeline
                     ret = pcm_write(out->pcm,
                                     (void *)audio_buffer,
-                                    frame_count * audio_frame_size);
+                                    frame_count * audio_channel_count * bytes_per_sample);
 
                     // write to haptics pipeline
-                    if (adev->haptic_pcm)
-                        ret = pcm_write(adev->haptic_pcm,
-                                        (void *)adev->haptic_buffer,
-                                        frame_count * haptic_frame_size);
+                    if (!adev->haptic_writer && adev->haptic_pcm && adev->haptic_buffer) {
+                        haptic_ret = pcm_write(adev->haptic_pcm,
+                                               (void *)adev->haptic_buffer,
+                                               total_haptic_buffer_size);
+                    }
+                    if (ret == 0)
+                        ret = haptic_ret;
 
                 } else {
-                    ret = pcm_write(out->pcm, (void *)buffer, bytes_to_write);
+                    ret = pcm_write(out->pcm, (void *)pcm_buffer, bytes_to_write);
                 }
             }
+            free(rt_latency_buffer);
+            audio_extn_utils_latency_hist_log(&out->write_hist,
+                                              systemTime(SYSTEM_TIME_MONOTONIC) - writeNs);
+            audio_extn_perf_stats_log_call(out->usecase,
+                                           systemTime(SYSTEM_TIME_MONOTONIC) - lockNs,
+                                           audio_extn_perf_stats_cpu_ns() - cpuNs, ns);
             release_out_focus(out, ns);
         } else {
             LOG_ALWAYS_FATAL("out->pcm is NULL after starting output stream");
@@ -3740,6 +4660,8 @@ exit:
     // For PCM we always consume the buffer and return #bytes regardless of ret.
     if (out->usecase != USECASE_AUDIO_PLAYBACK_OFFLOAD) {
         out->written += frames;
+        if (ret == 0 && out->pcm != NULL && !is_mmap_usecase(out->usecase))
+            out_publish_position_l(out);
     }
     long long sleeptime_us = 0;
 
@@ -3752,6 +4674,7 @@ exit:
             // usleep not guaranteed for values over 1 second but we don't limit here.
         }
     }
+    out_publish_metrics_l(out, ret != 0);
 
     pthread_mutex_unlock(&out->lock);
 
@@ -3809,6 +4732,22 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
     int ret = -ENODATA;
     unsigned long dsp_frames;
 
+    audio_extn_call_trace_log(CALL_TRACE_OUT_GET_PRESENTATION_POSITION, out->handle, 0, 0,
+                              NULL, 0);
+    /* PCM outputs answer from what the last out_write() published */
+    if (out->usecase != USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+        unsigned int seq;
+        bool valid;
+        do {
+            seq = audio_extn_seqlock_read_begin(&out->position_seq);
+            valid = out->position_valid;
+            *frames = out->position_frames;
+            *timestamp = out->position_timestamp;
+        } while (audio_extn_seqlock_read_retry(&out->position_seq, seq));
+        if (valid)
+            return 0;
+    }
+
     lock_output_stream(out);
 
     if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
@@ -3831,49 +4770,7 @@ static int out_get_presentation_position(const struct audio_stream_out *stream,
             clock_gettime(CLOCK_MONOTONIC, timestamp);
         }
     } else {
-        if (out->pcm) {
-            unsigned int avail;
-            if (pcm_get_htimestamp(out->pcm, &avail, timestamp) == 0) {
-
-                // pcm_get_htimestamp() computes the available frames by comparing
-                // the alsa driver hw_ptr and the appl_ptr levels.
-                // In underrun, the hw_ptr may keep running and report an excessively
-                // large number available number.
-                if (avail > out->kernel_buffer_size) {
-                    ALOGW("%s: avail:%u > kernel_buffer_size:%zu clamping!",
-                            __func__, avail, out->kernel_buffer_size);
-                    avail = out->kernel_buffer_size;
-                    out->last_fifo_frames_remaining = 0;
-                } else {
-                    out->last_fifo_frames_remaining = out->kernel_buffer_size - avail;
-                }
-                out->last_fifo_valid = true;
-                out->last_fifo_time_ns = audio_utils_ns_from_timespec(timestamp);
-
-                int64_t signed_frames = out->written - out->last_fifo_frames_remaining;
-
-                ALOGVV("%s: frames:%lld  avail:%u  kernel_buffer_size:%zu",
-                        __func__, (long long)signed_frames, avail, out->kernel_buffer_size);
-
-                // This adjustment accounts for buffering after app processor.
-                // It is based on estimated DSP latency per use case, rather than exact.
-                signed_frames -=
-                    (platform_render_latency(out) * out->sample_rate / 1000000LL);
-
-                // Adjustment accounts for A2DP encoder latency with non-offload usecases
-                // Note: Encoder latency is returned in ms, while platform_render_latency in us.
-                if (AUDIO_DEVICE_OUT_ALL_A2DP & out->devices) {
-                    signed_frames -=
-                            (audio_extn_a2dp_get_encoder_latency() * out->sample_rate / 1000);
-                }
-
-                // It would be unusual for this value to be negative, but check just in case ...
-                if (signed_frames >= 0) {
-                    *frames = signed_frames;
-                    ret = 0;
-                }
-            }
-        }
+        ret = out_get_pcm_position_l(out, frames, timestamp);
     }
 
     pthread_mutex_unlock(&out->lock);
@@ -3985,9 +4882,12 @@ static int out_start(const struct audio_stream_out* stream)
     pthread_mutex_lock(&adev->lock);
     if (out->usecase == USECASE_AUDIO_PLAYBACK_MMAP && !out->standby &&
             !out->playback_started && out->pcm != NULL) {
+        const int64_t startNs = systemTime(SYSTEM_TIME_MONOTONIC);
         ret = start_output_stream(out);
         if (ret == 0) {
             out->playback_started = true;
+            audio_extn_perf_stats_log_start(out->usecase,
+                                            systemTime(SYSTEM_TIME_MONOTONIC) - startNs);
         }
     }
     pthread_mutex_unlock(&adev->lock);
@@ -3997,7 +4897,8 @@ static int out_start(const struct audio_stream_out* stream)
 /*
  * Modify config->period_count based on min_size_frames
  */
-static void adjust_mmap_period_count(struct pcm_config *config, int32_t min_size_frames)
+static void adjust_mmap_period_count(struct pcm_config *config, int32_t min_size_frames,
+                                     bool is_output, audio_devices_t devices)
 {
     int periodCountRequested = (min_size_frames + config->period_size - 1)
                                / config->period_size;
@@ -4006,6 +4907,20 @@ static void adjust_mmap_period_count(struct pcm_config *config, int32_t min_size
     ALOGV("%s original config.period_size = %d config.period_count = %d",
           __func__, config->period_size, config->period_count);
 
+    // Start from what the position poll jitter of the previous stream on the
+    // same devices showed to be safe instead of the fixed minimum.
+    if (property_get_bool("vendor.audio.mmap.adaptive_buffer", false)) {
+        int32_t safe_frames = audio_extn_mmap_timing_recommended_frames(is_output, devices);
+        if (safe_frames > 0) {
+            int periodCountSafe = (safe_frames + config->period_size - 1)
+                                  / config->period_size;
+            periodCount = MMAP_PERIOD_COUNT_ADAPTIVE_MIN;
+            while (periodCount < periodCountSafe && periodCount < MMAP_PERIOD_COUNT_MIN) {
+                periodCount *= 2;
+            }
+        }
+    }
+
     while (periodCount < periodCountRequested && (periodCount * 2) < MMAP_PERIOD_COUNT_MAX) {
         periodCount *= 2;
     }
@@ -4060,7 +4975,7 @@ static int out_create_mmap_buffer(const struct audio_stream_out *stream,
         goto exit;
     }
 
-    adjust_mmap_period_count(&out->config, min_size_frames);
+    adjust_mmap_period_count(&out->config, min_size_frames, true, out->devices);
 
     ALOGV("%s: Opening PCM device card_id(%d) device_id(%d), channels %d",
           __func__, adev->snd_card, out->pcm_device_id, out->config.channels);
@@ -4106,6 +5021,8 @@ static int out_create_mmap_buffer(const struct audio_stream_out *stream,
     }
 
     out->mmap_time_offset_nanos = get_mmap_out_time_offset();
+    audio_extn_mmap_timing_init(&out->mmap_timing, out->config.rate,
+                                out->config.period_size, true, out->devices);
 
     out->standby = false;
     ret = 0;
@@ -4150,7 +5067,9 @@ static int out_get_mmap_position(const struct audio_stream_out *stream,
         ALOGE("%s: %s", __func__, pcm_get_error(out->pcm));
         goto exit;
     }
-    position->time_nanoseconds = audio_utils_ns_from_timespec(&ts)
+    position->time_nanoseconds = audio_extn_mmap_timing_update(&out->mmap_timing,
+                                                               position->position_frames,
+                                                               audio_utils_ns_from_timespec(&ts))
             + out->mmap_time_offset_nanos;
 
 exit:
@@ -4164,7 +5083,7 @@ static uint32_t in_get_sample_rate(const struct audio_stream *stream)
 {
     struct stream_in *in = (struct stream_in *)stream;
 
-    return in->config.rate;
+    return in->sample_rate;
 }
 
 static int in_set_sample_rate(struct audio_stream *stream __unused, uint32_t rate __unused)
@@ -4175,6 +5094,9 @@ static int in_set_sample_rate(struct audio_stream *stream __unused, uint32_t rat
 static size_t in_get_buffer_size(const struct audio_stream *stream)
 {
     struct stream_in *in = (struct stream_in *)stream;
+
+    if (in->usecase == USECASE_AUDIO_RECORD_COMPRESS)
+        return in->compr_config.fragment_size;
     return in->config.period_size * in->af_period_multiplier *
         audio_stream_in_frame_size((const struct audio_stream_in *)stream);
 }
@@ -4197,9 +5119,8 @@ static int in_set_format(struct audio_stream *stream __unused, audio_format_t fo
     return -ENOSYS;
 }
 
-static int in_standby(struct audio_stream *stream)
+static int do_in_standby(struct stream_in *in)
 {
-    struct stream_in *in = (struct stream_in *)stream;
     struct audio_device *adev = in->dev;
     int status = 0;
     bool do_stop = true;
@@ -4215,12 +5136,14 @@ static int in_standby(struct audio_stream *stream)
     }
 
     if (!in->standby) {
+        drop_focus(adev, &in->adm_focus, in->capture_handle);
         if (adev->adm_deregister_stream)
             adev->adm_deregister_stream(adev->adm_data, in->capture_handle);
 
         pthread_mutex_lock(&adev->lock);
         in->standby = true;
         if (in->usecase == USECASE_AUDIO_RECORD_MMAP) {
+            audio_extn_mmap_timing_save(&in->mmap_timing);
             do_stop = in->capture_started;
             in->capture_started = false;
 
@@ -4236,6 +5159,12 @@ static int in_standby(struct audio_stream *stream)
             pcm_close(in->pcm);
             in->pcm = NULL;
         }
+        if (in->compr) {
+            compress_close(in->compr);
+            in->compr = NULL;
+        }
+        if (in->resampler)
+            audio_extn_capture_resampler_reset(in->resampler);
 
         if (in->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
             adev->enable_voicerx = false;
@@ -4245,12 +5174,49 @@ static int in_standby(struct audio_stream *stream)
         }
 
         pthread_mutex_unlock(&adev->lock);
+        audio_extn_metrics_shm_update(in->metrics, METRICS_SHM_STATE_STANDBY, in->device,
+                                      in->frames_read, in->fifo_overruns.n,
+                                      in->start_latency_ms.last, false);
     }
     pthread_mutex_unlock(&in->lock);
     ALOGV("%s: exit:  status(%d)", __func__, status);
     return status;
 }
 
+static int in_standby(struct audio_stream *stream)
+{
+    struct stream_in *in = (struct stream_in *)stream;
+
+    audio_extn_call_trace_log(CALL_TRACE_IN_STANDBY, in->capture_handle, 0, 0, NULL, 0);
+    /* the client is done with it, do not bring it back after an SSR */
+    lock_input_stream(in);
+    in->ssr_restart = false;
+    pthread_mutex_unlock(&in->lock);
+
+    return do_in_standby(in);
+}
+
+/* same as out_ssr_restart_l(), for a capture that was running */
+static void in_ssr_restart_l(struct stream_in *in)
+{
+    struct audio_device *adev = in->dev;
+    int ret;
+
+    in->ssr_restart = false;
+    if (!in->standby)
+        return;
+
+    pthread_mutex_lock(&adev->lock);
+    ret = start_input_stream(in);
+    pthread_mutex_unlock(&adev->lock);
+    if (ret != 0) {
+        ALOGW("%s: %s left in standby (%d)", __func__, use_case_table[in->usecase], ret);
+        return;
+    }
+    in->standby = 0;
+    in->last_fifo_valid = false;
+}
+
 static int in_dump(const struct audio_stream *stream, int fd)
 {
     struct stream_in *in = (struct stream_in *)stream;
@@ -4264,11 +5230,18 @@ static int in_dump(const struct audio_stream *stream, int fd)
     dprintf(fd, "      Frames muted: %lld\n", (long long)in->frames_muted);
 
     char buffer[256]; // for statistics formatting
+    simple_stats_to_string(&in->fifo_overruns, buffer, sizeof(buffer));
+    dprintf(fd, "      Fifo frame overruns: %s\n", buffer);
+
     if (in->start_latency_ms.n > 0) {
         simple_stats_to_string(&in->start_latency_ms, buffer, sizeof(buffer));
         dprintf(fd, "      Start latency ms: %s\n", buffer);
     }
 
+    audio_extn_utils_latency_hist_dump(&in->read_hist, fd, "Read latency");
+    audio_extn_utils_latency_hist_dump(&in->lock_hist, fd, "Lock wait");
+    audio_extn_utils_latency_hist_dump(&in->start_hist, fd, "Start latency");
+
     if (locked) {
         pthread_mutex_unlock(&in->lock);
     }
@@ -4290,6 +5263,8 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
     int status = 0;
 
     ALOGV("%s: enter: kvpairs=%s", __func__, kvpairs);
+    audio_extn_call_trace_log(CALL_TRACE_IN_SET_PARAMETERS, in->capture_handle, 0, 0,
+                              kvpairs, kvpairs ? strlen(kvpairs) + 1 : 0);
     parms = str_parms_create_str(kvpairs);
 
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_STREAM_INPUT_SOURCE, value, sizeof(value));
@@ -4348,18 +5323,27 @@ static char* in_get_parameters(const struct audio_stream *stream,
                                const char *keys)
 {
     struct stream_in *in = (struct stream_in *)stream;
-    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *query;
     char *str;
-    struct str_parms *reply = str_parms_create();
+    struct str_parms *reply;
     bool replied = false;
 
     ALOGV("%s: enter: keys - %s", __func__, keys);
-    replied |= stream_get_parameter_channels(query, reply,
-                                             &in->supported_channel_masks[0]);
-    replied |= stream_get_parameter_formats(query, reply,
-                                            &in->supported_formats[0]);
-    replied |= stream_get_parameter_rates(query, reply,
-                                          &in->supported_sample_rates[0]);
+    str = stream_get_cached_caps(&in->caps, keys);
+    if (str != NULL)
+        return str;
+
+    query = str_parms_create_str(keys);
+    reply = str_parms_create();
+    replied |= stream_get_parameter_caps(query, reply, &in->caps);
+    // the fd is only meaningful to an AEC running in this process
+    if (str_parms_has_key(query, AUDIO_PARAMETER_KEY_EC_REF_TAP)) {
+        int fd = in->ec_opened ? audio_extn_ec_ref_tap_get_fd() : -ENODEV;
+        if (fd >= 0) {
+            str_parms_add_int(reply, AUDIO_PARAMETER_KEY_EC_REF_TAP, fd);
+            replied = true;
+        }
+    }
     if (replied) {
         str = str_parms_to_str(reply);
     } else {
@@ -4389,7 +5373,7 @@ static int in_set_gain(struct audio_stream_in *stream, float gain)
 
     snprintf(mixer_ctl_name, sizeof(mixer_ctl_name), "Capture %d Volume", in->pcm_device_id);
 
-    ctl = mixer_get_ctl_by_name(in->dev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(in->dev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGW("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -4421,14 +5405,21 @@ static void in_snd_mon_cb(void * stream, struct str_parms * parms)
 
     pthread_mutex_lock(&adev->lock);
     bool valid_cb = (card == adev->snd_card);
+    if (valid_cb && status == CARD_STATUS_ONLINE)
+        set_card_status_l(adev, status);
     pthread_mutex_unlock(&adev->lock);
 
     if (!valid_cb)
         return;
 
     lock_input_stream(in);
+    const bool was_active = !in->standby &&
+                            in->usecase != USECASE_AUDIO_RECORD_MMAP &&
+                            !(in->flags & AUDIO_INPUT_FLAG_HW_HOTWORD);
     if (in->card_status != status)
         in->card_status = status;
+    if (status == CARD_STATUS_ONLINE && in->ssr_restart)
+        in_ssr_restart_l(in);
     pthread_mutex_unlock(&in->lock);
 
     ALOGW("in_snd_mon_cb for card %d usecase %s, status %s", card,
@@ -4437,22 +5428,110 @@ static void in_snd_mon_cb(void * stream, struct str_parms * parms)
 
     // a better solution would be to report error back to AF and let
     // it put the stream to standby
-    if (status == CARD_STATUS_OFFLINE)
-        in_standby(&in->stream.common);
+    if (status == CARD_STATUS_OFFLINE) {
+        do_in_standby(in);
+        if (was_active) {
+            lock_input_stream(in);
+            in->ssr_restart = true;
+            pthread_mutex_unlock(&in->lock);
+        }
+    }
 
     return;
 }
 
+/*
+ * Converts the data read from the driver to in->format in place.
+ * 24 bit formats are read from the DSP as 24_8 in 32 bit words.
+ */
+static int in_convert_format(struct stream_in *in, void *buffer, size_t bytes)
+{
+    if (in->format != AUDIO_FORMAT_PCM_8_24_BIT &&
+        in->format != AUDIO_FORMAT_PCM_FLOAT)
+        return 0;
+
+    if (bytes % 4 != 0) {
+        ALOGE("%s: !!! something wrong !!! ... data not 32 bit aligned ", __func__);
+        return -EINVAL;
+    }
+
+    if (in->format == AUDIO_FORMAT_PCM_FLOAT && in->config.format != PCM_FORMAT_S24_LE)
+        return 0;
+
+    int64_t start_ns = audio_extn_perf_stats_kernel_begin();
+    switch (in->format) {
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+        audio_extn_pcm_convert_24_8_to_8_24((int32_t *)buffer, (const int32_t *)buffer,
+                                            bytes / 4);
+        break;
+    case AUDIO_FORMAT_PCM_FLOAT:
+        audio_extn_pcm_convert_24_8_to_float((float *)buffer, (const int32_t *)buffer,
+                                             bytes / 4);
+        break;
+    default:
+        break;
+    }
+    audio_extn_perf_stats_log_kernel(PERF_KERNEL_IN_CONVERT, start_ns, bytes / 4);
+    return 0;
+}
+
+static void in_log_overrun_l(struct stream_in *in, int64_t frames, const char *how)
+{
+    simple_stats_log(&in->fifo_overruns, frames);
+    atomic_fetch_add_explicit(&in->frames_lost, (uint32_t)frames, memory_order_relaxed);
+    ALOGW("%s: overrun(%lld) %s lost %lld frames", __func__,
+          (long long)in->fifo_overruns.n, how, (long long)frames);
+}
+
+// Note: the fifo can only overflow between reads, so the level published
+// after the last read plus the time since then tells what was lost.
+static void in_check_overrun_l(struct stream_in *in)
+{
+    if (in->last_fifo_valid) {
+        const int64_t current_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+        const int64_t frames_by_time =
+                (current_ns - in->last_fifo_time_ns) * in->config.rate / NANOS_PER_SECOND;
+        const int64_t overrun = in->last_fifo_frames_available + frames_by_time -
+                                (int64_t)pcm_get_buffer_size(in->pcm);
+
+        if (overrun > 0)
+            in_log_overrun_l(in, overrun, "by time");
+        in->last_fifo_valid = false;
+    }
+}
+
+static void in_update_fifo_l(struct stream_in *in)
+{
+    const unsigned int buffer_frames = pcm_get_buffer_size(in->pcm);
+    unsigned int avail;
+    struct timespec timestamp;
+
+    if (pcm_get_htimestamp(in->pcm, &avail, &timestamp) != 0)
+        return;
+    // the driver let hw_ptr run past the data not read yet
+    if (avail > buffer_frames) {
+        in_log_overrun_l(in, avail - buffer_frames, "by driver");
+        avail = buffer_frames;
+    }
+    in->last_fifo_frames_available = avail;
+    in->last_fifo_time_ns = audio_utils_ns_from_timespec(&timestamp);
+    in->last_fifo_valid = true;
+}
+
 static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
                        size_t bytes)
 {
     struct stream_in *in = (struct stream_in *)stream;
     struct audio_device *adev = in->dev;
     int i, ret = -1;
-    int *int_buf_stream = NULL;
     int error_code = ERROR_CODE_STANDBY; // initial errors are considered coming out of standby.
 
+    audio_extn_call_trace_log(CALL_TRACE_IN_READ, in->capture_handle, bytes, 0, NULL, 0);
+    const int64_t lockNs = systemTime(SYSTEM_TIME_MONOTONIC);
+    const int64_t cpuNs = audio_extn_perf_stats_cpu_ns();
     lock_input_stream(in);
+    audio_extn_utils_latency_hist_log(&in->lock_hist,
+                                      systemTime(SYSTEM_TIME_MONOTONIC) - lockNs);
     const size_t frame_size = audio_stream_in_frame_size(stream);
     const size_t frames = bytes / frame_size;
 
@@ -4479,43 +5558,63 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
             goto exit;
         }
         in->standby = 0;
+        in->last_fifo_valid = false;
 
         // log startup time in ms.
-        simple_stats_log(
-                &in->start_latency_ms, (systemTime(SYSTEM_TIME_MONOTONIC) - startNs) * 1e-6);
+        const int64_t startDeltaNs = systemTime(SYSTEM_TIME_MONOTONIC) - startNs;
+        simple_stats_log(&in->start_latency_ms, startDeltaNs * 1e-6);
+        audio_extn_utils_latency_hist_log(&in->start_hist, startDeltaNs);
+        audio_extn_perf_stats_log_start(in->usecase, startDeltaNs);
     }
 
     // errors that occur here are read errors.
     error_code = ERROR_CODE_READ;
 
+    /* encoded data: no frames to time, mute or convert */
+    if (in->usecase == USECASE_AUDIO_RECORD_COMPRESS) {
+        ret = compress_read(in->compr, buffer, bytes);
+        if (ret < 0) {
+            ALOGE("%s: compress_read failed %s", __func__, compress_get_error(in->compr));
+            ret = -EIO;
+            goto exit;
+        }
+        pthread_mutex_unlock(&in->lock);
+        return ret;
+    }
+
     //what's the duration requested by the client?
     long ns = pcm_bytes_to_frames(in->pcm, bytes)*1000000000LL/
-                                                in->config.rate;
+                                                in->sample_rate;
     request_in_focus(in, ns);
 
     bool use_mmap = is_mmap_usecase(in->usecase) || in->realtime;
     if (in->pcm) {
-        if (use_mmap) {
+        in_check_overrun_l(in);
+        const int64_t readNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (in->resampler) {
+            ret = audio_extn_capture_resampler_read(in->resampler, in->pcm, buffer, frames);
+        } else if (use_mmap) {
             ret = pcm_mmap_read(in->pcm, buffer, bytes);
         } else {
             ret = pcm_read(in->pcm, buffer, bytes);
         }
+        audio_extn_utils_latency_hist_log(&in->read_hist,
+                                          systemTime(SYSTEM_TIME_MONOTONIC) - readNs);
+        audio_extn_perf_stats_log_call(in->usecase,
+                                       systemTime(SYSTEM_TIME_MONOTONIC) - lockNs,
+                                       audio_extn_perf_stats_cpu_ns() - cpuNs, ns);
         if (ret < 0) {
             ALOGE("Failed to read w/err %s", strerror(errno));
-            ret = -errno;
-        }
-        if (!ret && bytes > 0 && (in->format == AUDIO_FORMAT_PCM_8_24_BIT)) {
-            if (bytes % 4 == 0) {
-                /* data from DSP comes in 24_8 format, convert it to 8_24 */
-                int_buf_stream = buffer;
-                for (size_t itt=0; itt < bytes/4 ; itt++) {
-                    int_buf_stream[itt] >>= 8;
-                }
-            } else {
-                ALOGE("%s: !!! something wrong !!! ... data not 32 bit aligned ", __func__);
-                ret = -EINVAL;
+            if (!in->resampler)
+                ret = -errno;
+        } else {
+            in_update_fifo_l(in);
+        }
+        if (!ret && bytes > 0) {
+            ret = in_convert_format(in, buffer, bytes);
+            if (ret != 0)
                 goto exit;
-            }
+            audio_extn_rt_latency_in_read(in, buffer, bytes);
         }
     }
 
@@ -4534,11 +5633,20 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
     }
 
 exit:
+    /* frames_read is advanced by this read below, after the unlock */
+    audio_extn_metrics_shm_update(in->metrics,
+                                  in->standby ? METRICS_SHM_STATE_STANDBY :
+                                                METRICS_SHM_STATE_ACTIVE,
+                                  in->device, in->frames_read + frames, in->fifo_overruns.n,
+                                  in->start_latency_ms.last, ret != 0);
     pthread_mutex_unlock(&in->lock);
 
     if (ret != 0) {
         error_log_log(in->error_log, error_code, audio_utils_get_real_time_ns());
-        in_standby(&in->stream.common);
+        do_in_standby(in);
+        /* silence is not a valid encoded stream, let the client see the error */
+        if (in->usecase == USECASE_AUDIO_RECORD_COMPRESS)
+            return ret;
         ALOGV("%s: read failed - sleeping for buffer duration", __func__);
         usleep(frames * 1000000LL / in_get_sample_rate(&in->stream.common));
         memset(buffer, 0, bytes); // clear return data
@@ -4550,9 +5658,11 @@ exit:
     return bytes;
 }
 
-static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream __unused)
+static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
 {
-    return 0;
+    struct stream_in *in = (struct stream_in *)stream;
+
+    return atomic_exchange_explicit(&in->frames_lost, 0, memory_order_relaxed);
 }
 
 static int in_get_capture_position(const struct audio_stream_in *stream,
@@ -4573,10 +5683,27 @@ static int in_get_capture_position(const struct audio_stream_in *stream,
                  "%s stream in standby but pcm not NULL for non ST session", __func__);
         goto exit;
     }
-    if (in->pcm) {
+    if (in->compr) {
+        unsigned long dsp_frames = 0;
+        unsigned int rate;
+        struct timespec timestamp;
+
+        /* frames encoded so far, at the codec rate */
+        if (compress_get_tstamp(in->compr, &dsp_frames, &rate) == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &timestamp);
+            *frames = dsp_frames;
+            *time = timestamp.tv_sec * 1000000000LL + timestamp.tv_nsec;
+            ret = 0;
+        }
+    } else if (in->pcm) {
         struct timespec timestamp;
         unsigned int avail;
         if (pcm_get_htimestamp(in->pcm, &avail, &timestamp) == 0) {
+            if (in->resampler) {
+                /* what the resampler holds is also captured but not read yet */
+                avail += audio_extn_capture_resampler_pending_frames(in->resampler);
+                avail = (uint64_t)avail * in->sample_rate / in->config.rate;
+            }
             *frames = in->frames_read + avail;
             *time = timestamp.tv_sec * 1000000000LL + timestamp.tv_nsec
                     - platform_capture_latency(in) * 1000LL;
@@ -4588,8 +5715,8 @@ exit:
     return ret;
 }
 
-static int in_update_effect_list(bool add, effect_handle_t effect,
-                            struct listnode *head)
+static int in_update_effect_list(struct stream_in *in, bool add, effect_handle_t effect,
+                                 struct listnode *head)
 {
     struct listnode *node;
     struct in_effect_list *elist = NULL;
@@ -4614,7 +5741,8 @@ static int in_update_effect_list(bool add, effect_handle_t effect,
         }
 
         target = (struct in_effect_list *)
-                     calloc(1, sizeof(struct in_effect_list));
+                     audio_extn_object_pool_alloc(in->dev->effect_pool,
+                                                  sizeof(struct in_effect_list));
 
         if (!target) {
             ALOGE("%s:fail to allocate memory", __func__);
@@ -4626,13 +5754,29 @@ static int in_update_effect_list(bool add, effect_handle_t effect,
     } else {
         if (target) {
             list_remove(&target->list);
-            free(target);
+            audio_extn_object_pool_free(in->dev->effect_pool, target);
         }
     }
 
     return ret;
 }
 
+/* AEC/NS attached to an input are applied by the DSP, tell the effect so
+ * it can skip its per buffer bookkeeping in process() */
+static void set_effect_dsp_offloaded(struct stream_in *in, effect_handle_t effect,
+                                     bool offloaded)
+{
+    effect_offload_param_t param = {
+        .isOffload = offloaded,
+        .ioHandle = in->capture_handle,
+    };
+    int reply = 0;
+    uint32_t reply_size = sizeof(reply);
+
+    (*effect)->command(effect, EFFECT_CMD_OFFLOAD, sizeof(param), &param,
+                       &reply_size, &reply);
+}
+
 static int add_remove_audio_effect(const struct audio_stream *stream,
                                    effect_handle_t effect,
                                    bool enable)
@@ -4655,7 +5799,8 @@ static int add_remove_audio_effect(const struct audio_stream *stream,
             adev->mode == AUDIO_MODE_IN_COMMUNICATION) &&
             (memcmp(&desc.type, FX_IID_AEC, sizeof(effect_uuid_t)) == 0)) {
 
-        in_update_effect_list(enable, effect, &in->aec_list);
+        in_update_effect_list(in, enable, effect, &in->aec_list);
+        set_effect_dsp_offloaded(in, effect, enable);
         enable = !list_empty(&in->aec_list);
         if (enable == in->enable_aec)
             goto exit;
@@ -4680,7 +5825,8 @@ static int add_remove_audio_effect(const struct audio_stream *stream,
     }
     if (memcmp(&desc.type, FX_IID_NS, sizeof(effect_uuid_t)) == 0) {
 
-        in_update_effect_list(enable, effect, &in->ns_list);
+        in_update_effect_list(in, enable, effect, &in->ns_list);
+        set_effect_dsp_offloaded(in, effect, enable);
         enable = !list_empty(&in->ns_list);
         if (enable == in->enable_ns)
             goto exit;
@@ -4743,9 +5889,12 @@ static int in_start(const struct audio_stream_in* stream)
     if (in->usecase == USECASE_AUDIO_RECORD_MMAP && !in->standby &&
             !in->capture_started && in->pcm != NULL) {
         if (!in->capture_started) {
+            const int64_t startNs = systemTime(SYSTEM_TIME_MONOTONIC);
             ret = start_input_stream(in);
             if (ret == 0) {
                 in->capture_started = true;
+                audio_extn_perf_stats_log_start(in->usecase,
+                                                systemTime(SYSTEM_TIME_MONOTONIC) - startNs);
             }
         }
     }
@@ -4800,7 +5949,7 @@ static int in_create_mmap_buffer(const struct audio_stream_in *stream,
         goto exit;
     }
 
-    adjust_mmap_period_count(&in->config, min_size_frames);
+    adjust_mmap_period_count(&in->config, min_size_frames, false, in->device);
 
     ALOGV("%s: Opening PCM device card_id(%d) device_id(%d), channels %d",
           __func__, adev->snd_card, in->pcm_device_id, in->config.channels);
@@ -4848,6 +5997,8 @@ static int in_create_mmap_buffer(const struct audio_stream_in *stream,
     }
 
     in->mmap_time_offset_nanos = in_get_mmap_time_offset();
+    audio_extn_mmap_timing_init(&in->mmap_timing, in->config.rate,
+                                in->config.period_size, false, in->device);
 
     in->standby = false;
     ret = 0;
@@ -4891,7 +6042,9 @@ static int in_get_mmap_position(const struct audio_stream_in *stream,
         ALOGE("%s: %s", __func__, pcm_get_error(in->pcm));
         goto exit;
     }
-    position->time_nanoseconds = audio_utils_ns_from_timespec(&ts)
+    position->time_nanoseconds = audio_extn_mmap_timing_update(&in->mmap_timing,
+                                                               position->position_frames,
+                                                               audio_utils_ns_from_timespec(&ts))
             + in->mmap_time_offset_nanos;
 
 exit:
@@ -5015,7 +6168,7 @@ static int check_and_set_gapless_mode(struct audio_device *adev)
     ALOGV("%s:", __func__);
     gapless_enabled = property_get_bool("vendor.audio.offload.gapless.enabled", false);
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
                                __func__, mixer_ctl_name);
@@ -5047,10 +6200,14 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     bool force_haptic_path =
             property_get_bool("vendor.audio.test_haptic", false);
 
+    audio_extn_call_trace_log(CALL_TRACE_ADEV_OPEN_OUTPUT_STREAM, handle, devices, flags,
+                              config, sizeof(*config));
     if (is_usb_dev && !is_usb_ready(adev, true /* is_playback */)) {
         return -ENOSYS;
     }
 
+    audio_extn_spkr_prot_stream_open_begin(adev);
+
     ALOGV("%s: enter: format(%#x) sample_rate(%d) channel_mask(%#x) devices(%#x) flags(%#x)",
           __func__, config->format, config->sample_rate, config->channel_mask, devices, flags);
 
@@ -5077,6 +6234,12 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         audio_format_t req_format = config->format;
         audio_channel_mask_t req_channel_mask = config->channel_mask;
         uint32_t req_sample_rate = config->sample_rate;
+        /* float is converted to the widest format the USB device takes */
+        const bool convert_float = is_usb_dev && req_format == AUDIO_FORMAT_PCM_FLOAT &&
+                (flags & AUDIO_OUTPUT_FLAG_MMAP_NOIRQ) == 0;
+
+        if (convert_float)
+            config->format = AUDIO_FORMAT_DEFAULT;
 
         pthread_mutex_lock(&adev->lock);
         if (is_hdmi) {
@@ -5139,6 +6302,8 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
                                                          audio_bytes_per_sample(out->format));
         }
         out->config.format = pcm_format_from_audio_format(out->format);
+        if (convert_float)
+            out->format = config->format = AUDIO_FORMAT_PCM_FLOAT;
     } else if (flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) {
         pthread_mutex_lock(&adev->lock);
         bool offline = (adev->card_status == CARD_STATUS_OFFLINE);
@@ -5193,6 +6358,26 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         out->compr_config.codec->ch_in =
                 audio_channel_count_from_out_mask(out->channel_mask);
         out->compr_config.codec->ch_out = out->compr_config.codec->ch_in;
+        /* stream derived defaults, refined by parse_compress_codec_params() */
+        switch (out->format & AUDIO_FORMAT_MAIN_MASK) {
+#ifdef FLAC_OFFLOAD_ENABLED
+        case AUDIO_FORMAT_FLAC:
+            out->compr_config.codec->options.flac_dec.sample_size =
+                    config->offload_info.bit_width ? config->offload_info.bit_width : 16;
+            break;
+#endif
+#ifdef ALAC_OFFLOAD_ENABLED
+        case AUDIO_FORMAT_ALAC:
+            out->compr_config.codec->options.alac.bit_depth =
+                    config->offload_info.bit_width ? config->offload_info.bit_width : 16;
+            out->compr_config.codec->options.alac.num_channels =
+                    out->compr_config.codec->ch_in;
+            out->compr_config.codec->options.alac.sample_rate = out->sample_rate;
+            break;
+#endif
+        default:
+            break;
+        }
 
         if (flags & AUDIO_OUTPUT_FLAG_NON_BLOCKING)
             out->non_blocking = 1;
@@ -5201,7 +6386,14 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
 
         check_and_set_gapless_mode(adev);
 
-        create_offload_callback_thread(out);
+        ret = create_offload_callback_thread(out);
+        if (ret != 0) {
+            free(out->compr_config.codec);
+            goto error_open;
+        }
+        out->volume_coalescer = audio_extn_volume_coalescer_create("compr_volume",
+                                                                   out_apply_compr_volume,
+                                                                   out);
         ALOGV("%s: offloaded output offload_info version %04x bit rate %d",
                 __func__, config->offload_info.version,
                 config->offload_info.bit_rate);
@@ -5437,6 +6629,21 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
             out->format = config->format;
         }
 
+        /*
+         * The mixer's float output is converted to packed 24 bit in
+         * out_write(), on the paths that write it through the normal pcm.
+         */
+        if (out->format == AUDIO_FORMAT_PCM_FLOAT) {
+            if (out->usecase != USECASE_AUDIO_PLAYBACK_DEEP_BUFFER &&
+                out->usecase != USECASE_AUDIO_PLAYBACK_LOW_LATENCY &&
+                out->usecase != USECASE_AUDIO_PLAYBACK_TTS) {
+                config->format = AUDIO_FORMAT_PCM_16_BIT;
+                ret = -EINVAL;
+                goto error_open;
+            }
+            out->config.format = PCM_FORMAT_S24_3LE;
+        }
+
         out->config.rate = out->sample_rate;
 
         if (config->channel_mask & AUDIO_CHANNEL_HAPTIC_ALL) {
@@ -5457,7 +6664,8 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
                     audio_channel_count_from_out_mask(out->channel_mask);
         }
 
-        if (out->format != audio_format_from_pcm_format(out->config.format)) {
+        if (out->format != AUDIO_FORMAT_PCM_FLOAT &&
+            out->format != audio_format_from_pcm_format(out->config.format)) {
             out->config.format = pcm_format_from_audio_format(out->format);
         }
     }
@@ -5528,16 +6736,62 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     else
         out->af_period_multiplier = 1;
 
-    out->kernel_buffer_size = out->config.period_size * out->config.period_count;
+    if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
+        /* compress_get_hpointer() reports the available space in bytes */
+        out->kernel_buffer_size =
+                out->compr_config.fragment_size * out->compr_config.fragments;
+        /* percentage of the DSP buffer that must be free before WRITE_READY */
+        int write_ready_pct =
+                property_get_int32("vendor.audio.offload.write_ready_pct", 0);
+        if (write_ready_pct > 0 && write_ready_pct <= 100)
+            out->offload_write_ready_bytes =
+                    out->kernel_buffer_size * write_ready_pct / 100;
+    } else {
+        out->kernel_buffer_size = out->config.period_size * out->config.period_count;
+    }
+
+    if (out->usecase == USECASE_AUDIO_PLAYBACK_WITH_HAPTICS) {
+        out->force_haptic_path = force_haptic_path;
+        /* preallocate the split buffer so out_write() never allocates */
+        size_t haptic_buffer_size = out->kernel_buffer_size * out->af_period_multiplier *
+                adev->haptics_config.channels * audio_bytes_per_sample(out->format);
+        free(adev->haptic_buffer);
+        adev->haptic_buffer = (uint8_t *)calloc(1, haptic_buffer_size);
+        if (adev->haptic_buffer == NULL) {
+            adev->haptic_buffer_size = 0;
+            ret = -ENOMEM;
+            goto error_open;
+        }
+        adev->haptic_buffer_size = haptic_buffer_size;
+    }
 
     out->standby = 1;
     /* out->muted = false; by calloc() */
     /* out->written = 0; by calloc() */
 
-    pthread_mutex_init(&out->lock, (const pthread_mutexattr_t *) NULL);
-    pthread_mutex_init(&out->pre_lock, (const pthread_mutexattr_t *) NULL);
+    init_stream_locks(&out->lock, &out->pre_lock,
+                      out->realtime ||
+                      (out->flags & (AUDIO_OUTPUT_FLAG_FAST | AUDIO_OUTPUT_FLAG_MMAP_NOIRQ)));
     pthread_cond_init(&out->cond, (const pthread_condattr_t *) NULL);
 
+    if (out->usecase == USECASE_AUDIO_PLAYBACK_LOW_LATENCY ||
+            out->usecase == USECASE_AUDIO_PLAYBACK_DEEP_BUFFER) {
+        int grace_ms = property_get_int32("vendor.audio.out.standby_grace_ms", 0);
+        if (grace_ms > 0) {
+            out->warm_standby_ns = grace_ms * 1000000LL;
+            if (create_warm_standby_thread(out) != 0)
+                out->warm_standby_ns = 0;
+        }
+    }
+
+    if (out->usecase == USECASE_AUDIO_PLAYBACK_DEEP_BUFFER && !out->realtime) {
+        int multiplier = property_get_int32("vendor.audio.deep_buffer.screen_off_multiplier", 1);
+        if (multiplier > DEEP_BUFFER_SCREEN_OFF_MAX_MULTIPLIER)
+            multiplier = DEEP_BUFFER_SCREEN_OFF_MAX_MULTIPLIER;
+        if (multiplier > 1)
+            out->screen_off_period_multiplier = multiplier;
+    }
+
     config->format = out->stream.common.get_format(&out->stream.common);
     config->channel_mask = out->stream.common.get_channels(&out->stream.common);
     config->sample_rate = out->stream.common.get_sample_rate(&out->stream.common);
@@ -5545,6 +6799,8 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     register_format(out->format, out->supported_formats);
     register_channel_mask(out->channel_mask, out->supported_channel_masks);
     register_sample_rate(out->sample_rate, out->supported_sample_rates);
+    stream_caps_init(&out->caps, out->supported_channel_masks, out->supported_formats,
+                     out->supported_sample_rates);
 
     out->error_log = error_log_create(
             ERROR_LOG_ENTRIES,
@@ -5555,6 +6811,8 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
        to update stream's state only after stream's initial state is set to
        adev state.
     */
+    out->metrics = audio_extn_metrics_shm_open(out->handle, true, out->usecase);
+
     lock_output_stream(out);
     audio_extn_snd_mon_register_listener(out, out_snd_mon_cb);
     pthread_mutex_lock(&adev->lock);
@@ -5566,12 +6824,15 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
 
     *stream_out = &out->stream;
 
+    audio_extn_spkr_prot_stream_open_end(adev);
     ALOGV("%s: exit", __func__);
     return 0;
 
 error_open:
+    audio_extn_volume_coalescer_destroy(out->volume_coalescer);
     free(out);
     *stream_out = NULL;
+    audio_extn_spkr_prot_stream_open_end(adev);
     ALOGW("%s: exit: ret %d", __func__, ret);
     return ret;
 }
@@ -5583,18 +6844,31 @@ static void adev_close_output_stream(struct audio_hw_device *dev __unused,
     struct audio_device *adev = out->dev;
 
     ALOGV("%s: enter", __func__);
+    audio_extn_call_trace_log(CALL_TRACE_ADEV_CLOSE_OUTPUT_STREAM, out->handle, 0, 0, NULL, 0);
 
     // must deregister from sndmonitor first to prevent races
     // between the callback and close_stream
     audio_extn_snd_mon_unregister_listener(out);
+    if (out->warm_standby_ns > 0)
+        destroy_warm_standby_thread(out);
     out_standby(&stream->common);
+    audio_extn_metrics_shm_close(out->metrics);
+    out->metrics = NULL;
     if (out->usecase == USECASE_AUDIO_PLAYBACK_OFFLOAD) {
         destroy_offload_callback_thread(out);
+        audio_extn_volume_coalescer_destroy(out->volume_coalescer);
+        out->volume_coalescer = NULL;
 
         if (out->compr_config.codec != NULL)
             free(out->compr_config.codec);
     }
 
+    if (out->usecase == USECASE_AUDIO_PLAYBACK_WITH_HAPTICS) {
+        free(adev->haptic_buffer);
+        adev->haptic_buffer = NULL;
+        adev->haptic_buffer_size = 0;
+    }
+
     out->a2dp_compress_mute = false;
 
     if (adev->voice_tx_output == out)
@@ -5602,6 +6876,7 @@ static void adev_close_output_stream(struct audio_hw_device *dev __unused,
 
     error_log_destroy(out->error_log);
     out->error_log = NULL;
+    stream_caps_release(&out->caps);
 
     pthread_cond_destroy(&out->cond);
     pthread_mutex_destroy(&out->pre_lock);
@@ -5622,6 +6897,8 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
     bool a2dp_reconfig = false;
 
     ALOGV("%s: enter: %s", __func__, kvpairs);
+    audio_extn_call_trace_log(CALL_TRACE_ADEV_SET_PARAMETERS, 0, 0, 0,
+                              kvpairs, kvpairs ? strlen(kvpairs) + 1 : 0);
 
     pthread_mutex_lock(&adev->lock);
 
@@ -5631,6 +6908,10 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
         goto done;
     }
 
+    audio_extn_perf_stats_set_parameters(parms);
+    audio_extn_rt_latency_set_parameters(parms);
+    audio_extn_call_trace_set_parameters(parms);
+
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_BT_NREC, value, sizeof(value));
     if (ret >= 0) {
         /* When set to false, HAL should disable EC and NS */
@@ -5646,6 +6927,7 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
             adev->screen_off = false;
         else
             adev->screen_off = true;
+        audio_extn_spkr_prot_screen_state_changed();
     }
 
     ret = str_parms_get_int(parms, "rotation", &val);
@@ -5699,6 +6981,10 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_DEVICE_CONNECT, value, sizeof(value));
     if (ret >= 0) {
         audio_devices_t device = (audio_devices_t)strtoul(value, NULL, 10);
+        adev_caps_invalidate_l();
+        /* the sink may have changed, its EDID is read again on the next query */
+        if (audio_is_output_device(device) && (device & AUDIO_DEVICE_OUT_AUX_DIGITAL))
+            platform_edid_invalidate(adev->platform);
         if (audio_is_usb_out_device(device)) {
             ret = str_parms_get_str(parms, "card", value, sizeof(value));
             if (ret >= 0) {
@@ -5717,6 +7003,9 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_DEVICE_DISCONNECT, value, sizeof(value));
     if (ret >= 0) {
         audio_devices_t device = (audio_devices_t)strtoul(value, NULL, 10);
+        adev_caps_invalidate_l();
+        if (audio_is_output_device(device) && (device & AUDIO_DEVICE_OUT_AUX_DIGITAL))
+            platform_edid_invalidate(adev->platform);
         if (audio_is_usb_out_device(device)) {
             ret = str_parms_get_str(parms, "card", value, sizeof(value));
             if (ret >= 0) {
@@ -5791,24 +7080,99 @@ done:
     return status;
 }
 
+/* Device keys whose reply only changes when a device is connected or
+   disconnected. Every other key adev_get_parameters() answers reports live
+   call, A2DP or measurement state and is rendered on each query. */
+static const char * const adev_caps_keys[] = {
+    AUDIO_PARAMETER_A2DP_RECONFIG_SUPPORTED,
+};
+
+static struct {
+    pthread_mutex_t lock;
+    unsigned int generation[ARRAY_SIZE(adev_caps_keys)];
+    char *reply[ARRAY_SIZE(adev_caps_keys)];
+} adev_caps = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int adev_caps_index(const char *keys)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(adev_caps_keys); i++) {
+        if (strcmp(keys, adev_caps_keys[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* a copy of the cached reply, or NULL to render it under adev->lock */
+static char *adev_get_cached_caps(int index)
+{
+    char *str = NULL;
+
+    pthread_mutex_lock(&adev_caps.lock);
+    if (adev_caps.reply[index] != NULL &&
+        adev_caps.generation[index] ==
+                atomic_load_explicit(&caps_generation, memory_order_relaxed))
+        str = strdup(adev_caps.reply[index]);
+    pthread_mutex_unlock(&adev_caps.lock);
+    return str;
+}
+
+/* generation was read under adev->lock before the reply was rendered */
+static void adev_cache_caps(int index, unsigned int generation, const char *str)
+{
+    char *copy = strdup(str);
+
+    if (copy == NULL)
+        return;
+    pthread_mutex_lock(&adev_caps.lock);
+    free(adev_caps.reply[index]);
+    adev_caps.reply[index] = copy;
+    adev_caps.generation[index] = generation;
+    pthread_mutex_unlock(&adev_caps.lock);
+}
+
+static void adev_caps_invalidate_l(void)
+{
+    atomic_fetch_add_explicit(&caps_generation, 1, memory_order_relaxed);
+}
+
 static char* adev_get_parameters(const struct audio_hw_device *dev,
                                  const char *keys)
 {
     struct audio_device *adev = (struct audio_device *)dev;
-    struct str_parms *reply = str_parms_create();
-    struct str_parms *query = str_parms_create_str(keys);
+    struct str_parms *reply;
+    struct str_parms *query;
+    const int caps_index = adev_caps_index(keys);
+    unsigned int generation;
     char *str;
 
+    if (caps_index >= 0) {
+        str = adev_get_cached_caps(caps_index);
+        if (str != NULL)
+            return str;
+    }
+
+    reply = str_parms_create();
+    query = str_parms_create_str(keys);
     pthread_mutex_lock(&adev->lock);
+    generation = atomic_load_explicit(&caps_generation, memory_order_relaxed);
 
     voice_get_parameters(adev, query, reply);
     audio_extn_a2dp_get_parameters(query, reply);
+    audio_extn_route_trace_get_parameters(query, reply);
+    audio_extn_perf_stats_get_parameters(query, reply);
+    audio_extn_rt_latency_get_parameters(query, reply);
 
     str = str_parms_to_str(reply);
     str_parms_destroy(query);
     str_parms_destroy(reply);
 
     pthread_mutex_unlock(&adev->lock);
+    if (caps_index >= 0 && str != NULL)
+        adev_cache_caps(caps_index, generation, str);
     ALOGV("%s: exit: returns - %s", __func__, str);
     return str;
 }
@@ -5818,15 +7182,33 @@ static int adev_init_check(const struct audio_hw_device *dev __unused)
     return 0;
 }
 
+/* deferred write of the last volume set during a coalescing window */
+static void adev_apply_voice_volume(void *context)
+{
+    struct audio_device *adev = (struct audio_device *)context;
+
+    pthread_mutex_lock(&adev->lock);
+    if (audio_extn_volume_coalescer_take(adev->voice_volume_coalescer))
+        voice_set_volume(adev, adev->voice.volume);
+    pthread_mutex_unlock(&adev->lock);
+}
+
 static int adev_set_voice_volume(struct audio_hw_device *dev, float volume)
 {
     int ret;
     struct audio_device *adev = (struct audio_device *)dev;
 
+    audio_extn_call_trace_log(CALL_TRACE_ADEV_SET_VOICE_VOLUME, 0,
+                              (int64_t)(volume * 1000000), 0, NULL, 0);
     audio_extn_extspk_set_voice_vol(adev->extspk, volume);
 
     pthread_mutex_lock(&adev->lock);
-    ret = voice_set_volume(adev, volume);
+    if (audio_extn_volume_coalescer_apply_now(adev->voice_volume_coalescer)) {
+        ret = voice_set_volume(adev, volume);
+    } else {
+        adev->voice.volume = volume;
+        ret = 0;
+    }
     pthread_mutex_unlock(&adev->lock);
 
     return ret;
@@ -5857,6 +7239,7 @@ static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
 {
     struct audio_device *adev = (struct audio_device *)dev;
 
+    audio_extn_call_trace_log(CALL_TRACE_ADEV_SET_MODE, 0, mode, 0, NULL, 0);
     pthread_mutex_lock(&adev->lock);
     if (adev->mode != mode) {
         ALOGD("%s: mode %d", __func__, (int)mode);
@@ -5893,6 +7276,7 @@ static int adev_set_mic_mute(struct audio_hw_device *dev, bool state)
     struct audio_device *adev = (struct audio_device *)dev;
 
     ALOGD("%s: state %d", __func__, (int)state);
+    audio_extn_call_trace_log(CALL_TRACE_ADEV_SET_MIC_MUTE, 0, state, 0, NULL, 0);
     pthread_mutex_lock(&adev->lock);
     if (audio_extn_tfa_98xx_is_supported() && adev->enable_hfp) {
         ret = audio_extn_hfp_set_mic_mute(adev, state);
@@ -5977,7 +7361,12 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     int ret = 0, buffer_size, frame_size;
     int channel_count;
     bool is_low_latency = false;
+    bool resample = false;
     bool is_usb_dev = audio_is_usb_in_device(devices);
+    /* encoded in the DSP and read with compress_read() */
+    bool is_compress = !is_usb_dev && (flags & AUDIO_INPUT_FLAG_DIRECT) != 0 &&
+                       (config->format == AUDIO_FORMAT_AAC_ADTS_LC ||
+                        config->format == AUDIO_FORMAT_AMR_WB);
     bool may_use_hifi_record = adev_input_allow_hifi_record(adev,
                                                             devices,
                                                             flags,
@@ -5986,6 +7375,8 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
             " sample_rate %u, channel_mask %#x, format %#x",
             __func__, flags, is_usb_dev, may_use_hifi_record,
             config->sample_rate, config->channel_mask, config->format);
+    audio_extn_call_trace_log(CALL_TRACE_ADEV_OPEN_INPUT_STREAM, handle, devices,
+                              (int64_t)source << 32 | flags, config, sizeof(*config));
     *stream_in = NULL;
 
     if (is_usb_dev && !is_usb_ready(adev, false /* is_playback */)) {
@@ -6002,7 +7393,8 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
 
         channel_count = audio_channel_count_from_in_mask(config->channel_mask);
 
-        if (check_input_parameters(config->sample_rate, config->format, channel_count, false) != 0)
+        if (!is_compress &&
+            check_input_parameters(config->sample_rate, config->format, channel_count, false) != 0)
             return -EINVAL;
     }
 
@@ -6012,9 +7404,6 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
 
     in = (struct stream_in *)calloc(1, sizeof(struct stream_in));
 
-    pthread_mutex_init(&in->lock, (const pthread_mutexattr_t *) NULL);
-    pthread_mutex_init(&in->pre_lock, (const pthread_mutexattr_t *) NULL);
-
     in->stream.common.get_sample_rate = in_get_sample_rate;
     in->stream.common.set_sample_rate = in_set_sample_rate;
     in->stream.common.get_buffer_size = in_get_buffer_size;
@@ -6085,9 +7474,9 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
                config->format == AUDIO_FORMAT_PCM_8_24_BIT) {
         bool ret_error = false;
         /* 24 bit is restricted to UNPROCESSED source only,also format supported
-           from HAL is 8_24
+           from HAL is 8_24 or float, both converted in place from the DSP 24_8 data
            *> In case of UNPROCESSED source, for 24 bit, if format requested is other than
-              8_24 return error indicating supported format is 8_24
+              8_24 or float return error indicating supported format is 8_24
            *> In case of any other source requesting 24 bit or float return error
               indicating format supported is 16 bit only.
 
@@ -6096,7 +7485,8 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
         if (!is_supported_24bits_audiosource(source)) {
             config->format = AUDIO_FORMAT_PCM_16_BIT;
             ret_error = true;
-        } else if (config->format != AUDIO_FORMAT_PCM_8_24_BIT) {
+        } else if (config->format != AUDIO_FORMAT_PCM_8_24_BIT &&
+                   config->format != AUDIO_FORMAT_PCM_FLOAT) {
             config->format = AUDIO_FORMAT_PCM_8_24_BIT;
             ret_error = true;
         }
@@ -6111,7 +7501,50 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->channel_mask = config->channel_mask;
 
     /* Update config params with the requested sample rate and channels */
-    if (in->device == AUDIO_DEVICE_IN_TELEPHONY_RX) {
+    if (is_compress) {
+        bool amr_wb = config->format == AUDIO_FORMAT_AMR_WB;
+
+        if (platform_get_pcm_device_id(USECASE_AUDIO_RECORD_COMPRESS, PCM_CAPTURE) < 0) {
+            ALOGE("%s: no compress capture device on this platform", __func__);
+            ret = -EINVAL;
+            goto err_open;
+        }
+        /* AMR-WB is 16 kHz mono only, the AAC encoder takes up to 48 kHz stereo */
+        if (amr_wb && (config->sample_rate != 16000 || channel_count != 1)) {
+            config->sample_rate = 16000;
+            config->channel_mask = AUDIO_CHANNEL_IN_MONO;
+            ret = -EINVAL;
+            goto err_open;
+        }
+        if (!amr_wb && (config->sample_rate < 8000 || config->sample_rate > 48000 ||
+                        channel_count > 2)) {
+            config->sample_rate = DEFAULT_INPUT_SAMPLING_RATE;
+            config->channel_mask = AUDIO_CHANNEL_IN_STEREO;
+            ret = -EINVAL;
+            goto err_open;
+        }
+
+        in->compr_config.codec = (struct snd_codec *)calloc(1, sizeof(struct snd_codec));
+        if (in->compr_config.codec == NULL) {
+            ret = -ENOMEM;
+            goto err_open;
+        }
+        in->usecase = USECASE_AUDIO_RECORD_COMPRESS;
+        in->compr_config.fragment_size = COMPRESS_CAPTURE_FRAGMENT_SIZE;
+        in->compr_config.fragments = COMPRESS_CAPTURE_NUM_FRAGMENTS;
+        in->compr_config.codec->id = get_snd_codec_id(config->format);
+        in->compr_config.codec->format = amr_wb ? SND_AUDIOSTREAMFORMAT_FSF :
+                                                  SND_AUDIOSTREAMFORMAT_MP4ADTS;
+        in->compr_config.codec->sample_rate = config->sample_rate;
+        in->compr_config.codec->ch_in = channel_count;
+        in->compr_config.codec->ch_out = channel_count;
+        in->compr_config.codec->bit_rate = amr_wb ? COMPRESS_CAPTURE_AMR_WB_BITRATE :
+                channel_count * COMPRESS_CAPTURE_AAC_BITRATE_PER_CHANNEL;
+        /* the pcm config only describes the rate and channels for routing */
+        in->config = pcm_config_audio_capture;
+        in->config.rate = config->sample_rate;
+        in->af_period_multiplier = 1;
+    } else if (in->device == AUDIO_DEVICE_IN_TELEPHONY_RX) {
         if (config->sample_rate == 0)
             config->sample_rate = AFE_PROXY_SAMPLING_RATE;
         if (config->sample_rate != 48000 && config->sample_rate != 16000 &&
@@ -6145,13 +7578,19 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
         in->config.format = pcm_format_from_audio_format(config->format);
     } else {
         in->usecase = USECASE_AUDIO_RECORD;
-        if (config->sample_rate == LOW_LATENCY_CAPTURE_SAMPLE_RATE &&
+        /* fast capture only runs at the native rate, other rates can be resampled here */
+        resample = (in->flags & AUDIO_INPUT_FLAG_FAST) != 0 &&
+                   config->sample_rate != LOW_LATENCY_CAPTURE_SAMPLE_RATE &&
+                   config->format == AUDIO_FORMAT_PCM_16_BIT &&
+                   property_get_bool("vendor.audio.capture.fast_resampler", false);
+        if ((config->sample_rate == LOW_LATENCY_CAPTURE_SAMPLE_RATE || resample) &&
                 (in->flags & AUDIO_INPUT_FLAG_FAST) != 0) {
             is_low_latency = true;
 #if LOW_LATENCY_CAPTURE_USE_CASE
             in->usecase = USECASE_AUDIO_RECORD_LOW_LATENCY;
 #endif
-            in->realtime = may_use_noirq_mode(adev, in->usecase, in->flags);
+            /* the resampler pulls whole periods with pcm_read() */
+            in->realtime = !resample && may_use_noirq_mode(adev, in->usecase, in->flags);
             if (!in->realtime) {
                 in->config = pcm_config_audio_capture;
                 frame_size = audio_stream_in_frame_size(&in->stream);
@@ -6161,7 +7600,8 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
                                                      channel_count,
                                                      is_low_latency);
                 in->config.period_size = buffer_size / frame_size;
-                in->config.rate = config->sample_rate;
+                in->config.rate = resample ? LOW_LATENCY_CAPTURE_SAMPLE_RATE :
+                                             config->sample_rate;
                 in->af_period_multiplier = 1;
             } else {
                 // period size is left untouched for rt mode playback
@@ -6209,17 +7649,33 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
             in->config.rate = config->sample_rate;
             in->af_period_multiplier = 1;
         }
-        if (config->format == AUDIO_FORMAT_PCM_8_24_BIT)
+        if (config->format == AUDIO_FORMAT_PCM_8_24_BIT ||
+            config->format == AUDIO_FORMAT_PCM_FLOAT)
             in->config.format = PCM_FORMAT_S24_LE;
     }
 
     in->config.channels = channel_count;
     in->sample_rate  = in->config.rate;
+    if (resample) {
+        in->sample_rate = config->sample_rate;
+        in->resampler = audio_extn_capture_resampler_create(in->config.rate, in->sample_rate,
+                                                            channel_count,
+                                                            in->config.period_size);
+        if (in->resampler == NULL) {
+            ret = -ENOMEM;
+            goto err_open;
+        }
+    }
 
+    init_stream_locks(&in->lock, &in->pre_lock,
+                      in->realtime ||
+                      (in->flags & (AUDIO_INPUT_FLAG_FAST | AUDIO_INPUT_FLAG_MMAP_NOIRQ)));
 
     register_format(in->format, in->supported_formats);
     register_channel_mask(in->channel_mask, in->supported_channel_masks);
     register_sample_rate(in->sample_rate, in->supported_sample_rates);
+    stream_caps_init(&in->caps, in->supported_channel_masks, in->supported_formats,
+                     in->supported_sample_rates);
 
     in->error_log = error_log_create(
             ERROR_LOG_ENTRIES,
@@ -6232,6 +7688,8 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     if (in->is_st_session)
         in->flags |= AUDIO_INPUT_FLAG_HW_HOTWORD;
 
+    in->metrics = audio_extn_metrics_shm_open(in->capture_handle, false, in->usecase);
+
     lock_input_stream(in);
     audio_extn_snd_mon_register_listener(in, in_snd_mon_cb);
     pthread_mutex_lock(&adev->lock);
@@ -6246,6 +7704,7 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     return 0;
 
 err_open:
+    free(in->compr_config.codec);
     free(in);
     *stream_in = NULL;
     return ret;
@@ -6256,14 +7715,21 @@ static void adev_close_input_stream(struct audio_hw_device *dev __unused,
 {
     struct stream_in *in = (struct stream_in *)stream;
     ALOGV("%s", __func__);
+    audio_extn_call_trace_log(CALL_TRACE_ADEV_CLOSE_INPUT_STREAM, in->capture_handle, 0, 0,
+                              NULL, 0);
 
     // must deregister from sndmonitor first to prevent races
     // between the callback and close_stream
     audio_extn_snd_mon_unregister_listener(stream);
     in_standby(&stream->common);
+    audio_extn_metrics_shm_close(in->metrics);
+    in->metrics = NULL;
 
     error_log_destroy(in->error_log);
     in->error_log = NULL;
+    stream_caps_release(&in->caps);
+    audio_extn_capture_resampler_destroy(in->resampler);
+    free(in->compr_config.codec);
 
     pthread_mutex_destroy(&in->pre_lock);
     pthread_mutex_destroy(&in->lock);
@@ -6273,8 +7739,36 @@ static void adev_close_input_stream(struct audio_hw_device *dev __unused,
     return;
 }
 
-static int adev_dump(const audio_hw_device_t *device __unused, int fd __unused)
+/* the capabilities adev_verify_devices() probed or restored from the cache */
+static void adev_dump_pcm_params_l(struct audio_device *adev, int fd)
+{
+    char info[512];
+    int i;
+
+    for (i = 0; i < AUDIO_USECASE_MAX; i++) {
+        if (adev->use_case_table[i] == NULL)
+            continue;
+        pcm_params_to_string(adev->use_case_table[i], info, ARRAY_SIZE(info));
+        dprintf(fd, "  pcm params %s:\n%s\n", use_case_table[i], info);
+    }
+}
+
+static int adev_dump(const audio_hw_device_t *device, int fd)
 {
+    struct audio_device *adev = (struct audio_device *)device;
+
+    audio_extn_route_trace_dump(fd);
+    audio_extn_perf_stats_dump(fd);
+    audio_extn_spkr_prot_dump(fd);
+    audio_extn_a2dp_dump(fd);
+
+    // setup profiles are only written under adev->lock during a call start,
+    // skip them rather than block the dump behind a stuck one
+    if (pthread_mutex_trylock(&adev->lock) == 0) {
+        voice_dump(adev, fd);
+        adev_dump_pcm_params_l(adev, fd);
+        pthread_mutex_unlock(&adev->lock);
+    }
     return 0;
 }
 
@@ -6283,127 +7777,371 @@ static int adev_dump(const audio_hw_device_t *device __unused, int fd __unused)
  * This verification is required when enabling extended bit-depth or
  * sampling rates, as not all qcom products support it.
  *
- * Suitable for calling only on initialization such as adev_open().
- * It fills the audio_device use_case_table[] array.
+ * Suitable for calling only on initialization such as adev_open(), or
+ * with the hw device lock held while no usecase is active.
+ * It fills the given table, indexed like the audio_device use_case_table[].
  *
  * Has a side-effect that it needs to configure audio routing / devices
  * in order to power up the devices and read the device parameters.
  * It does not acquire any hw device lock. Should restore the devices
  * back to "normal state" upon completion.
  */
-static int adev_verify_devices(struct audio_device *adev)
-{
-    /* enumeration is a bit difficult because one really wants to pull
-     * the use_case, device id, etc from the hidden pcm_device_table[].
-     * In this case there are the following use cases and device ids.
-     *
-     * [USECASE_AUDIO_PLAYBACK_DEEP_BUFFER] = {0, 0},
-     * [USECASE_AUDIO_PLAYBACK_LOW_LATENCY] = {15, 15},
-     * [USECASE_AUDIO_PLAYBACK_HIFI] = {1, 1},
-     * [USECASE_AUDIO_PLAYBACK_OFFLOAD] = {9, 9},
-     * [USECASE_AUDIO_RECORD] = {0, 0},
-     * [USECASE_AUDIO_RECORD_LOW_LATENCY] = {15, 15},
-     * [USECASE_VOICE_CALL] = {2, 2},
-     *
-     * USECASE_AUDIO_PLAYBACK_OFFLOAD, USECASE_AUDIO_PLAYBACK_HIFI omitted.
-     * USECASE_VOICE_CALL omitted, but possible for either input or output.
-     */
-
-    /* should be the usecases enabled in adev_open_input_stream() */
-    static const int test_in_usecases[] = {
-             USECASE_AUDIO_RECORD,
-             USECASE_AUDIO_RECORD_LOW_LATENCY, /* does not appear to be used */
-    };
+/* enumeration is a bit difficult because one really wants to pull
+ * the use_case, device id, etc from the hidden pcm_device_table[].
+ * In this case there are the following use cases and device ids.
+ *
+ * [USECASE_AUDIO_PLAYBACK_DEEP_BUFFER] = {0, 0},
+ * [USECASE_AUDIO_PLAYBACK_LOW_LATENCY] = {15, 15},
+ * [USECASE_AUDIO_PLAYBACK_HIFI] = {1, 1},
+ * [USECASE_AUDIO_PLAYBACK_OFFLOAD] = {9, 9},
+ * [USECASE_AUDIO_RECORD] = {0, 0},
+ * [USECASE_AUDIO_RECORD_LOW_LATENCY] = {15, 15},
+ * [USECASE_VOICE_CALL] = {2, 2},
+ *
+ * USECASE_AUDIO_PLAYBACK_OFFLOAD, USECASE_AUDIO_PLAYBACK_HIFI omitted.
+ * USECASE_VOICE_CALL omitted, but possible for either input or output.
+ */
+static const struct {
+    audio_usecase_t usecase;
+    bool is_input;
+} pcm_params_probe_usecases[] = {
     /* should be the usecases enabled in adev_open_output_stream()*/
-    static const int test_out_usecases[] = {
-            USECASE_AUDIO_PLAYBACK_DEEP_BUFFER,
-            USECASE_AUDIO_PLAYBACK_LOW_LATENCY,
-    };
-    static const usecase_type_t usecase_type_by_dir[] = {
-            PCM_PLAYBACK,
-            PCM_CAPTURE,
-    };
-    static const unsigned flags_by_dir[] = {
-            PCM_OUT,
-            PCM_IN,
-    };
+    { USECASE_AUDIO_PLAYBACK_DEEP_BUFFER, false },
+    { USECASE_AUDIO_PLAYBACK_LOW_LATENCY, false },
+    /* should be the usecases enabled in adev_open_input_stream() */
+    { USECASE_AUDIO_RECORD, true },
+    { USECASE_AUDIO_RECORD_LOW_LATENCY, true }, /* does not appear to be used */
+};
 
-    size_t i;
-    unsigned dir;
+/* Routes a dummy usecase to probe one PCM node, so adev->lock must be held:
+   it owns the usecase list and the mixer while it runs. */
+static void adev_probe_pcm_params_l(struct audio_device *adev, struct pcm_params **table,
+                                    size_t index)
+{
+    const audio_usecase_t audio_usecase = pcm_params_probe_usecases[index].usecase;
+    const bool dir = pcm_params_probe_usecases[index].is_input;
+    const usecase_type_t usecase_type = dir ? PCM_CAPTURE : PCM_PLAYBACK;
+    const unsigned flags_dir = dir ? PCM_IN : PCM_OUT;
+    const audio_devices_t audio_device =
+            dir ? AUDIO_DEVICE_IN_BUILTIN_MIC : AUDIO_DEVICE_OUT_SPEAKER;
     const unsigned card_id = adev->snd_card;
     char info[512]; /* for possible debug info */
+    int device_id;
+    struct pcm_params **pparams;
+    struct stream_out out;
+    struct stream_in in;
+    struct audio_usecase uc_info;
+    int retval;
+
+    pparams = &table[audio_usecase];
+    pcm_params_free(*pparams); /* can accept null input */
+    *pparams = NULL;
+
+    /* find the device ID for the use case (signed, for error) */
+    device_id = platform_get_pcm_device_id(audio_usecase, usecase_type);
+    if (device_id < 0)
+        return;
 
-    for (dir = 0; dir < 2; ++dir) {
-        const usecase_type_t usecase_type = usecase_type_by_dir[dir];
-        const unsigned flags_dir = flags_by_dir[dir];
-        const size_t testsize =
-                dir ? ARRAY_SIZE(test_in_usecases) : ARRAY_SIZE(test_out_usecases);
-        const int *testcases =
-                dir ? test_in_usecases : test_out_usecases;
-        const audio_devices_t audio_device =
-                dir ? AUDIO_DEVICE_IN_BUILTIN_MIC : AUDIO_DEVICE_OUT_SPEAKER;
-
-        for (i = 0; i < testsize; ++i) {
-            const audio_usecase_t audio_usecase = testcases[i];
-            int device_id;
-            snd_device_t snd_device;
-            struct pcm_params **pparams;
-            struct stream_out out;
-            struct stream_in in;
-            struct audio_usecase uc_info;
-            int retval;
-
-            pparams = &adev->use_case_table[audio_usecase];
-            pcm_params_free(*pparams); /* can accept null input */
-            *pparams = NULL;
-
-            /* find the device ID for the use case (signed, for error) */
-            device_id = platform_get_pcm_device_id(audio_usecase, usecase_type);
-            if (device_id < 0)
-                continue;
-
-            /* prepare structures for device probing */
-            memset(&uc_info, 0, sizeof(uc_info));
-            uc_info.id = audio_usecase;
-            uc_info.type = usecase_type;
-            if (dir) {
-                memset(&in, 0, sizeof(in));
-                in.device = audio_device;
-                in.source = AUDIO_SOURCE_VOICE_COMMUNICATION;
-                uc_info.stream.in = &in;
-            }
-            memset(&out, 0, sizeof(out));
-            out.devices = audio_device; /* only field needed in select_devices */
-            uc_info.stream.out = &out;
-            uc_info.devices = audio_device;
-            uc_info.in_snd_device = SND_DEVICE_NONE;
-            uc_info.out_snd_device = SND_DEVICE_NONE;
-            list_add_tail(&adev->usecase_list, &uc_info.list);
-
-            /* select device - similar to start_(in/out)put_stream() */
-            retval = select_devices(adev, audio_usecase);
-            if (retval >= 0) {
-                *pparams = pcm_params_get(card_id, device_id, flags_dir);
+    /* prepare structures for device probing */
+    memset(&uc_info, 0, sizeof(uc_info));
+    uc_info.id = audio_usecase;
+    uc_info.type = usecase_type;
+    if (dir) {
+        memset(&in, 0, sizeof(in));
+        in.device = audio_device;
+        in.source = AUDIO_SOURCE_VOICE_COMMUNICATION;
+        uc_info.stream.in = &in;
+    }
+    memset(&out, 0, sizeof(out));
+    out.devices = audio_device; /* only field needed in select_devices */
+    uc_info.stream.out = &out;
+    uc_info.devices = audio_device;
+    uc_info.in_snd_device = SND_DEVICE_NONE;
+    uc_info.out_snd_device = SND_DEVICE_NONE;
+    add_usecase_to_list(adev, &uc_info);
+
+    /* select device - similar to start_(in/out)put_stream() */
+    retval = select_devices(adev, audio_usecase);
+    if (retval >= 0) {
+        *pparams = pcm_params_get(card_id, device_id, flags_dir);
 #if LOG_NDEBUG == 0
-                if (*pparams) {
-                    ALOGV("%s: (%s) card %d  device %d", __func__,
-                            dir ? "input" : "output", card_id, device_id);
-                    pcm_params_to_string(*pparams, info, ARRAY_SIZE(info));
-                } else {
-                    ALOGV("%s: cannot locate card %d  device %d", __func__, card_id, device_id);
-                }
+        if (*pparams) {
+            ALOGV("%s: (%s) card %d  device %d", __func__,
+                    dir ? "input" : "output", card_id, device_id);
+            pcm_params_to_string(*pparams, info, ARRAY_SIZE(info));
+        } else {
+            ALOGV("%s: cannot locate card %d  device %d", __func__, card_id, device_id);
+        }
 #endif
-            }
+    }
+
+    /* deselect device - similar to stop_(in/out)put_stream() */
+    /* 1. Get and set stream specific mixer controls */
+    retval = disable_audio_route(adev, &uc_info);
+    /* 2. Disable the rx device */
+    retval = disable_snd_device(adev,
+            dir ? uc_info.in_snd_device : uc_info.out_snd_device);
+    remove_usecase_from_list(adev, &uc_info);
+}
+
+static int adev_probe_pcm_params(struct audio_device *adev, struct pcm_params **table)
+{
+    size_t i;
 
-            /* deselect device - similar to stop_(in/out)put_stream() */
-            /* 1. Get and set stream specific mixer controls */
-            retval = disable_audio_route(adev, &uc_info);
-            /* 2. Disable the rx device */
-            retval = disable_snd_device(adev,
-                    dir ? uc_info.in_snd_device : uc_info.out_snd_device);
-            list_remove(&uc_info.list);
+    for (i = 0; i < ARRAY_SIZE(pcm_params_probe_usecases); i++)
+        adev_probe_pcm_params_l(adev, table, i);
+    return 0;
+}
+
+/* The probe above opens every tested PCM node. Its results only change
+   with the sound card or the kernel, so they are kept in a file keyed by
+   both and the probe moves to a background thread that refreshes the file
+   once the device is idle.
+
+   tinyalsa hands out struct snd_pcm_hw_params as struct pcm_params and
+   frees it with free(), which is what lets the entries be stored and
+   restored as raw bytes. */
+#define PCM_PARAMS_CACHE_PROPERTY "persist.vendor.audio.pcm_params.cache"
+#define PCM_PARAMS_CACHE_PATH     "/data/vendor/audio/pcm_params.bin"
+#define PCM_PARAMS_CACHE_MAGIC    0x43505051 /* "QPPC" */
+#define PCM_PARAMS_CACHE_VERSION  1
+/* the device may be busy again by the time the refresh runs, give up then */
+#define PCM_PARAMS_REFRESH_DELAY_MS 2000
+
+struct pcm_params_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t key_hash;       /* sound card name and kernel build */
+    uint32_t params_size;    /* sizeof(struct snd_pcm_hw_params) */
+    uint32_t count;          /* entries following the header */
+};
+
+struct pcm_params_cache_entry {
+    int32_t usecase;
+    uint8_t params[sizeof(struct snd_pcm_hw_params)];
+};
+
+static uint32_t pcm_params_cache_key(struct audio_device *adev)
+{
+    struct utsname uts;
+    const char *card = adev->mixer ? mixer_get_name(adev->mixer) : NULL;
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    const char *parts[3];
+    size_t i;
+
+    if (uname(&uts) < 0)
+        memset(&uts, 0, sizeof(uts));
+    parts[0] = card ? card : "";
+    parts[1] = uts.release;
+    parts[2] = uts.version;
+    for (i = 0; i < ARRAY_SIZE(parts); i++) {
+        const char *c;
+        for (c = parts[i]; *c; c++) {
+            hash ^= (uint8_t)*c;
+            hash *= 16777619u;
+        }
+        hash ^= '\n';
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int pcm_params_cache_load(uint32_t key, struct pcm_params **table)
+{
+    struct pcm_params_cache_header hdr;
+    struct pcm_params_cache_entry entry;
+    int fd, ret = -ESTALE;
+    uint32_t i;
+
+    fd = open(PCM_PARAMS_CACHE_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr.magic != PCM_PARAMS_CACHE_MAGIC ||
+        hdr.version != PCM_PARAMS_CACHE_VERSION ||
+        hdr.key_hash != key ||
+        hdr.params_size != sizeof(entry.params) ||
+        hdr.count > AUDIO_USECASE_MAX)
+        goto done;
+
+    for (i = 0; i < hdr.count; i++) {
+        struct snd_pcm_hw_params *params;
+
+        if (read(fd, &entry, sizeof(entry)) != sizeof(entry) ||
+            entry.usecase < 0 || entry.usecase >= AUDIO_USECASE_MAX)
+            goto done;
+        params = calloc(1, sizeof(*params));
+        if (params == NULL) {
+            ret = -ENOMEM;
+            goto done;
+        }
+        memcpy(params, entry.params, sizeof(*params));
+        pcm_params_free(table[entry.usecase]);
+        table[entry.usecase] = (struct pcm_params *)params;
+    }
+    ret = 0;
+
+done:
+    close(fd);
+    if (ret != 0) {
+        for (i = 0; i < AUDIO_USECASE_MAX; i++) {
+            pcm_params_free(table[i]);
+            table[i] = NULL;
         }
     }
+    return ret;
+}
+
+static void pcm_params_cache_store(uint32_t key, struct pcm_params **table)
+{
+    struct pcm_params_cache_header hdr = {
+        .magic = PCM_PARAMS_CACHE_MAGIC,
+        .version = PCM_PARAMS_CACHE_VERSION,
+        .key_hash = key,
+        .params_size = sizeof(struct snd_pcm_hw_params),
+        .count = 0,
+    };
+    struct pcm_params_cache_entry entry;
+    const char *tmp_path = PCM_PARAMS_CACHE_PATH ".tmp";
+    bool ok;
+    int fd;
+    int i;
+
+    for (i = 0; i < AUDIO_USECASE_MAX; i++)
+        hdr.count += table[i] != NULL;
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        ALOGW("%s: cannot create %s: %s", __func__, tmp_path, strerror(errno));
+        return;
+    }
+    ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr);
+    for (i = 0; ok && i < AUDIO_USECASE_MAX; i++) {
+        if (table[i] == NULL)
+            continue;
+        entry.usecase = i;
+        memcpy(entry.params, table[i], sizeof(entry.params));
+        ok = write(fd, &entry, sizeof(entry)) == sizeof(entry);
+    }
+    if (!ok || fsync(fd) < 0) {
+        ALOGW("%s: failed to write %s", __func__, tmp_path);
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+    close(fd);
+    /* rename is atomic, a reader sees either the old or the new cache */
+    if (rename(tmp_path, PCM_PARAMS_CACHE_PATH) < 0) {
+        ALOGW("%s: failed to rename %s: %s", __func__, tmp_path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+static bool pcm_params_table_equal(struct pcm_params **a, struct pcm_params **b)
+{
+    int i;
+
+    for (i = 0; i < AUDIO_USECASE_MAX; i++) {
+        if ((a[i] == NULL) != (b[i] == NULL))
+            return false;
+        if (a[i] && memcmp(a[i], b[i], sizeof(struct snd_pcm_hw_params)) != 0)
+            return false;
+    }
+    return true;
+}
+
+/* nothing routed, so probing cannot disturb a stream or a call */
+static bool pcm_params_probe_idle_l(struct audio_device *adev)
+{
+    return list_empty(&adev->usecase_list) && adev->mode == AUDIO_MODE_NORMAL &&
+           adev->card_status == CARD_STATUS_ONLINE;
+}
+
+static void *pcm_params_refresh_thread(void *context)
+{
+    struct audio_device *adev = (struct audio_device *)context;
+    struct pcm_params *fresh[AUDIO_USECASE_MAX] = { NULL };
+    const int64_t deadline_ns = systemTime(SYSTEM_TIME_MONOTONIC) +
+                                PCM_PARAMS_REFRESH_DELAY_MS * 1000000LL;
+    struct timespec ts;
+    bool changed = false;
+    int i;
+
+    audio_extn_thread_policy_apply(AUDIO_THREAD_BACKGROUND, "PCM Params");
+
+    pthread_mutex_lock(&adev->lock);
+    /* adev_close() cuts the delay short */
+    ts.tv_sec = deadline_ns / 1000000000LL;
+    ts.tv_nsec = deadline_ns % 1000000000LL;
+    while (!adev->pcm_params_refresh_exit &&
+           systemTime(SYSTEM_TIME_MONOTONIC) < deadline_ns)
+        pthread_cond_timedwait(&adev->pcm_params_refresh_cond, &adev->lock, &ts);
+
+    /* adev->lock is only held while one PCM node is probed, and given up in
+       between so streams and calls are not held off for the whole probe.
+       When one of them is found routed, the probe is abandoned and the
+       table is left as it is. */
+    for (i = 0; i < (int)ARRAY_SIZE(pcm_params_probe_usecases); i++) {
+        if (adev->pcm_params_refresh_exit || !pcm_params_probe_idle_l(adev)) {
+            ALOGV("%s: device busy, keeping the cached pcm params", __func__);
+            break;
+        }
+        adev_probe_pcm_params_l(adev, fresh, i);
+        pthread_mutex_unlock(&adev->lock);
+        sched_yield();
+        pthread_mutex_lock(&adev->lock);
+    }
+    if (i == (int)ARRAY_SIZE(pcm_params_probe_usecases) && !adev->pcm_params_refresh_exit &&
+        pcm_params_probe_idle_l(adev)) {
+        changed = !pcm_params_table_equal(fresh, adev->use_case_table);
+        if (changed) {
+            for (i = 0; i < AUDIO_USECASE_MAX; i++) {
+                struct pcm_params *old = adev->use_case_table[i];
+                adev->use_case_table[i] = fresh[i];
+                fresh[i] = old;
+            }
+        }
+    }
+    pthread_mutex_unlock(&adev->lock);
+
+    /* only this thread and adev_open() write the table, and adev_close()
+       joins this thread before freeing it */
+    if (changed) {
+        ALOGI("%s: pcm params changed, updating the cache", __func__);
+        pcm_params_cache_store(pcm_params_cache_key(adev), adev->use_case_table);
+    }
+
+    for (i = 0; i < AUDIO_USECASE_MAX; i++)
+        pcm_params_free(fresh[i]);
+    return NULL;
+}
+
+static int adev_verify_devices(struct audio_device *adev)
+{
+    pthread_condattr_t attr;
+    uint32_t key;
+    int ret;
+
+    if (!property_get_bool(PCM_PARAMS_CACHE_PROPERTY, false))
+        return adev_probe_pcm_params(adev, adev->use_case_table);
+
+    key = pcm_params_cache_key(adev);
+    if (pcm_params_cache_load(key, adev->use_case_table) != 0) {
+        ret = adev_probe_pcm_params(adev, adev->use_case_table);
+        pcm_params_cache_store(key, adev->use_case_table);
+        return ret;
+    }
+
+    ALOGD("%s: pcm params restored from %s", __func__, PCM_PARAMS_CACHE_PATH);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&adev->pcm_params_refresh_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    adev->pcm_params_refresh_started =
+            pthread_create(&adev->pcm_params_refresh_thread, NULL,
+                           pcm_params_refresh_thread, adev) == 0;
+    if (!adev->pcm_params_refresh_started)
+        pthread_cond_destroy(&adev->pcm_params_refresh_cond);
     return 0;
 }
 
@@ -6416,9 +8154,24 @@ static int adev_close(hw_device_t *device)
         goto done;
 
     if ((--audio_device_ref_count) == 0) {
+        if (adev->pcm_params_refresh_started) {
+            pthread_mutex_lock(&adev->lock);
+            adev->pcm_params_refresh_exit = true;
+            pthread_cond_signal(&adev->pcm_params_refresh_cond);
+            pthread_mutex_unlock(&adev->lock);
+            pthread_join(adev->pcm_params_refresh_thread, NULL);
+            pthread_cond_destroy(&adev->pcm_params_refresh_cond);
+        }
         audio_extn_snd_mon_unregister_listener(adev);
+        audio_extn_call_trace_deinit();
+        audio_extn_metrics_shm_deinit();
+        audio_extn_ec_ref_tap_deinit();
+        audio_extn_volume_coalescer_destroy(adev->voice_volume_coalescer);
+        adev->voice_volume_coalescer = NULL;
+        audio_extn_hfp_deinit();
         audio_extn_tfa_98xx_deinit();
         audio_extn_ma_deinit();
+        audio_extn_audiozoom_deinit();
         audio_route_free(adev->audio_route);
         free(adev->snd_dev_ref_cnt);
         platform_deinit(adev->platform);
@@ -6430,6 +8183,8 @@ static int adev_close(hw_device_t *device)
         }
         if (adev->adm_deinit)
             adev->adm_deinit(adev->adm_data);
+        audio_extn_object_pool_destroy(adev->usecase_pool);
+        audio_extn_object_pool_destroy(adev->effect_pool);
         pthread_mutex_destroy(&adev->lock);
         free(device);
         adev = NULL;
@@ -6474,12 +8229,8 @@ static void adev_snd_mon_cb(void * stream __unused, struct str_parms * parms)
 
     pthread_mutex_lock(&adev->lock);
     bool valid_cb = (card == adev->snd_card);
-    if (valid_cb) {
-        if (adev->card_status != status) {
-            adev->card_status = status;
-            platform_snd_card_update(adev->platform, status);
-        }
-    }
+    if (valid_cb)
+        set_card_status_l(adev, status);
     pthread_mutex_unlock(&adev->lock);
     return;
 }
@@ -6559,10 +8310,166 @@ int check_a2dp_restore(struct audio_device *adev, struct stream_out *out, bool r
     return ret;
 }
 
+/* must be called with hw device mutex locked */
+static void adev_load_offload_effects_l(struct audio_device *adev)
+{
+    if (adev->offload_effects_loaded)
+        return;
+    adev->offload_effects_loaded = true;
+
+    adev->visualizer_lib = dlopen(VISUALIZER_LIBRARY_PATH, RTLD_NOW);
+    if (adev->visualizer_lib == NULL) {
+        ALOGW("%s: DLOPEN failed for %s", __func__, VISUALIZER_LIBRARY_PATH);
+    } else {
+        ALOGV("%s: DLOPEN successful for %s", __func__, VISUALIZER_LIBRARY_PATH);
+        adev->visualizer_start_output =
+                    (int (*)(audio_io_handle_t, int, int, int))dlsym(adev->visualizer_lib,
+                                                    "visualizer_hal_start_output");
+        adev->visualizer_stop_output =
+                    (int (*)(audio_io_handle_t, int))dlsym(adev->visualizer_lib,
+                                                    "visualizer_hal_stop_output");
+    }
+
+    adev->offload_effects_lib = dlopen(OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH, RTLD_NOW);
+    if (adev->offload_effects_lib == NULL) {
+        ALOGW("%s: DLOPEN failed for %s", __func__,
+              OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH);
+    } else {
+        ALOGV("%s: DLOPEN successful for %s", __func__,
+              OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH);
+        adev->offload_effects_start_output =
+                    (int (*)(audio_io_handle_t, int))dlsym(adev->offload_effects_lib,
+                                     "offload_effects_bundle_hal_start_output");
+        adev->offload_effects_stop_output =
+                    (int (*)(audio_io_handle_t, int))dlsym(adev->offload_effects_lib,
+                                     "offload_effects_bundle_hal_stop_output");
+    }
+}
+
+static void *adev_init_adm(void *context)
+{
+    struct audio_device *adev = (struct audio_device *)context;
+
+    adev->adm_lib = dlopen(ADM_LIBRARY_PATH, RTLD_NOW);
+    if (adev->adm_lib == NULL) {
+        ALOGW("%s: DLOPEN failed for %s", __func__, ADM_LIBRARY_PATH);
+    } else {
+        ALOGV("%s: DLOPEN successful for %s", __func__, ADM_LIBRARY_PATH);
+        adev->adm_init = (adm_init_t)
+                                dlsym(adev->adm_lib, "adm_init");
+        adev->adm_deinit = (adm_deinit_t)
+                                dlsym(adev->adm_lib, "adm_deinit");
+        adev->adm_register_input_stream = (adm_register_input_stream_t)
+                                dlsym(adev->adm_lib, "adm_register_input_stream");
+        adev->adm_register_output_stream = (adm_register_output_stream_t)
+                                dlsym(adev->adm_lib, "adm_register_output_stream");
+        adev->adm_deregister_stream = (adm_deregister_stream_t)
+                                dlsym(adev->adm_lib, "adm_deregister_stream");
+        adev->adm_request_focus = (adm_request_focus_t)
+                                dlsym(adev->adm_lib, "adm_request_focus");
+        adev->adm_abandon_focus = (adm_abandon_focus_t)
+                                dlsym(adev->adm_lib, "adm_abandon_focus");
+        adev->adm_set_config = (adm_set_config_t)
+                                    dlsym(adev->adm_lib, "adm_set_config");
+        adev->adm_request_focus_v2 = (adm_request_focus_v2_t)
+                                    dlsym(adev->adm_lib, "adm_request_focus_v2");
+        adev->adm_is_noirq_avail = (adm_is_noirq_avail_t)
+                                    dlsym(adev->adm_lib, "adm_is_noirq_avail");
+        adev->adm_on_routing_change = (adm_on_routing_change_t)
+                                    dlsym(adev->adm_lib, "adm_on_routing_change");
+    }
+
+    if (adev->adm_init)
+        adev->adm_data = adev->adm_init();
+    return NULL;
+}
+
+static void *adev_init_snd_mon(void *context __unused)
+{
+    audio_extn_perf_lock_init();
+    audio_extn_snd_mon_init();
+    return NULL;
+}
+
+/* needs the platform; joined before adev_verify_devices(), whose routing
+   reaches audio_extn_ma_set_device() */
+static void *adev_init_effects(void *context)
+{
+    struct audio_device *adev = (struct audio_device *)context;
+
+    audio_extn_ma_init(adev->platform);
+    audio_extn_audiozoom_init();
+    return NULL;
+}
+
+/* Init stages of adev_open() that can run on their own threads, mostly
+   while platform_init() parses the XML and brings up ACDB. Each stage is
+   started once adev_open() passes start_at and joined before it reaches
+   needed_by, so the table is the whole dependency graph. A stage whose
+   thread cannot be created runs inline. */
+typedef enum {
+    ADEV_INIT_START,          /* adev allocated, lists initialised */
+    ADEV_INIT_PLATFORM,       /* platform_init() succeeded */
+    ADEV_INIT_VERIFY_DEVICES, /* first routing, reaches audio_extn_ma_set_device() */
+    ADEV_INIT_DONE,           /* snd_mon listener registration, then adev_open() returns */
+} adev_init_point_t;
+
+static const struct {
+    const char *name;
+    void *(*fn)(void *);
+    adev_init_point_t start_at;
+    adev_init_point_t needed_by;
+} adev_init_stages[] = {
+    { "adm",     adev_init_adm,     ADEV_INIT_START,    ADEV_INIT_DONE },
+    { "snd_mon", adev_init_snd_mon, ADEV_INIT_START,    ADEV_INIT_DONE },
+    { "effects", adev_init_effects, ADEV_INIT_PLATFORM, ADEV_INIT_VERIFY_DEVICES },
+};
+
+struct adev_init_stage {
+    pthread_t thread;
+    bool running;
+};
+
+/* joins what point needs, then starts what may begin at point */
+static void adev_init_reach(struct adev_init_stage *stages, adev_init_point_t point)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(adev_init_stages); i++) {
+        if (stages[i].running && adev_init_stages[i].needed_by <= point) {
+            pthread_join(stages[i].thread, NULL);
+            stages[i].running = false;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(adev_init_stages); i++) {
+        if (adev_init_stages[i].start_at != point)
+            continue;
+        stages[i].running = pthread_create(&stages[i].thread, NULL,
+                                           adev_init_stages[i].fn, adev) == 0;
+        if (!stages[i].running) {
+            ALOGW("%s: running %s inline", __func__, adev_init_stages[i].name);
+            adev_init_stages[i].fn(adev);
+        }
+    }
+}
+
+/* joins every started stage, for the error path */
+static void adev_init_join_all(struct adev_init_stage *stages)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(adev_init_stages); i++) {
+        if (stages[i].running)
+            pthread_join(stages[i].thread, NULL);
+        stages[i].running = false;
+    }
+}
+
 static int adev_open(const hw_module_t *module, const char *name,
                      hw_device_t **device)
 {
     int i, ret;
+    struct adev_init_stage stages[ARRAY_SIZE(adev_init_stages)];
 
     ALOGD("%s: enter", __func__);
     if (strcmp(name, AUDIO_HARDWARE_INTERFACE) != 0) return -EINVAL;
@@ -6613,13 +8520,31 @@ static int adev_open(const hw_module_t *module, const char *name,
     adev->a2dp_started = false;
     /* adev->cur_hdmi_channels = 0;  by calloc() */
     adev->snd_dev_ref_cnt = calloc(SND_DEVICE_MAX, sizeof(int));
+    /* a usecase id is in the list at most once */
+    adev->usecase_pool = audio_extn_object_pool_create("usecases", sizeof(struct audio_usecase),
+                                                       AUDIO_USECASE_MAX);
+    adev->effect_pool = audio_extn_object_pool_create("in_effects",
+                                                      sizeof(struct in_effect_list),
+                                                      IN_EFFECT_POOL_SIZE);
     voice_init(adev);
     list_init(&adev->usecase_list);
+    for (i = 0; i < USECASE_TYPE_MAX; i++)
+        list_init(&adev->usecase_type_list[i]);
     pthread_mutex_unlock(&adev->lock);
 
+    adev->adm_focus_burst = property_get_int32("vendor.audio.adm.focus_burst", 1);
+    memset(stages, 0, sizeof(stages));
+    adev_init_reach(stages, ADEV_INIT_START);
+
     /* Loads platform specific libraries dynamically */
     adev->platform = platform_init(adev);
     if (!adev->platform) {
+        adev_init_join_all(stages);
+        audio_extn_snd_mon_deinit();
+        if (adev->adm_deinit)
+            adev->adm_deinit(adev->adm_data);
+        audio_extn_object_pool_destroy(adev->usecase_pool);
+        audio_extn_object_pool_destroy(adev->effect_pool);
         free(adev->snd_dev_ref_cnt);
         free(adev);
         ALOGE("%s: Failed to init platform data, aborting.", __func__);
@@ -6627,70 +8552,15 @@ static int adev_open(const hw_module_t *module, const char *name,
         pthread_mutex_unlock(&adev_init_lock);
         return -EINVAL;
     }
+    adev_init_reach(stages, ADEV_INIT_PLATFORM);
     adev->extspk = audio_extn_extspk_init(adev);
 
-    adev->visualizer_lib = dlopen(VISUALIZER_LIBRARY_PATH, RTLD_NOW);
-    if (adev->visualizer_lib == NULL) {
-        ALOGW("%s: DLOPEN failed for %s", __func__, VISUALIZER_LIBRARY_PATH);
-    } else {
-        ALOGV("%s: DLOPEN successful for %s", __func__, VISUALIZER_LIBRARY_PATH);
-        adev->visualizer_start_output =
-                    (int (*)(audio_io_handle_t, int, int, int))dlsym(adev->visualizer_lib,
-                                                    "visualizer_hal_start_output");
-        adev->visualizer_stop_output =
-                    (int (*)(audio_io_handle_t, int))dlsym(adev->visualizer_lib,
-                                                    "visualizer_hal_stop_output");
-    }
-
-    adev->offload_effects_lib = dlopen(OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH, RTLD_NOW);
-    if (adev->offload_effects_lib == NULL) {
-        ALOGW("%s: DLOPEN failed for %s", __func__,
-              OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH);
-    } else {
-        ALOGV("%s: DLOPEN successful for %s", __func__,
-              OFFLOAD_EFFECTS_BUNDLE_LIBRARY_PATH);
-        adev->offload_effects_start_output =
-                    (int (*)(audio_io_handle_t, int))dlsym(adev->offload_effects_lib,
-                                     "offload_effects_bundle_hal_start_output");
-        adev->offload_effects_stop_output =
-                    (int (*)(audio_io_handle_t, int))dlsym(adev->offload_effects_lib,
-                                     "offload_effects_bundle_hal_stop_output");
-    }
-
-    adev->adm_lib = dlopen(ADM_LIBRARY_PATH, RTLD_NOW);
-    if (adev->adm_lib == NULL) {
-        ALOGW("%s: DLOPEN failed for %s", __func__, ADM_LIBRARY_PATH);
-    } else {
-        ALOGV("%s: DLOPEN successful for %s", __func__, ADM_LIBRARY_PATH);
-        adev->adm_init = (adm_init_t)
-                                dlsym(adev->adm_lib, "adm_init");
-        adev->adm_deinit = (adm_deinit_t)
-                                dlsym(adev->adm_lib, "adm_deinit");
-        adev->adm_register_input_stream = (adm_register_input_stream_t)
-                                dlsym(adev->adm_lib, "adm_register_input_stream");
-        adev->adm_register_output_stream = (adm_register_output_stream_t)
-                                dlsym(adev->adm_lib, "adm_register_output_stream");
-        adev->adm_deregister_stream = (adm_deregister_stream_t)
-                                dlsym(adev->adm_lib, "adm_deregister_stream");
-        adev->adm_request_focus = (adm_request_focus_t)
-                                dlsym(adev->adm_lib, "adm_request_focus");
-        adev->adm_abandon_focus = (adm_abandon_focus_t)
-                                dlsym(adev->adm_lib, "adm_abandon_focus");
-        adev->adm_set_config = (adm_set_config_t)
-                                    dlsym(adev->adm_lib, "adm_set_config");
-        adev->adm_request_focus_v2 = (adm_request_focus_v2_t)
-                                    dlsym(adev->adm_lib, "adm_request_focus_v2");
-        adev->adm_is_noirq_avail = (adm_is_noirq_avail_t)
-                                    dlsym(adev->adm_lib, "adm_is_noirq_avail");
-        adev->adm_on_routing_change = (adm_on_routing_change_t)
-                                    dlsym(adev->adm_lib, "adm_on_routing_change");
-    }
-
     adev->bt_wb_speech_enabled = false;
     adev->enable_voicerx = false;
 
     *device = &adev->device.common;
 
+    adev_init_reach(stages, ADEV_INIT_VERIFY_DEVICES);
     if (k_enable_extended_precision)
         adev_verify_devices(adev);
 
@@ -6734,16 +8604,17 @@ static int adev_open(const hw_module_t *module, const char *name,
     }
 
     audio_extn_tfa_98xx_init(adev);
-    audio_extn_ma_init(adev->platform);
-    audio_extn_audiozoom_init();
+    audio_extn_call_trace_init();
+    audio_extn_utils_cpufreq_init();
+    audio_extn_metrics_shm_init();
+    audio_extn_ec_ref_tap_init();
+    adev->voice_volume_coalescer = audio_extn_volume_coalescer_create("voice_volume",
+                                                                      adev_apply_voice_volume,
+                                                                      adev);
 
     pthread_mutex_unlock(&adev_init_lock);
 
-    if (adev->adm_init)
-        adev->adm_data = adev->adm_init();
-
-    audio_extn_perf_lock_init();
-    audio_extn_snd_mon_init();
+    adev_init_reach(stages, ADEV_INIT_DONE);
     pthread_mutex_lock(&adev->lock);
     audio_extn_snd_mon_register_listener(NULL, adev_snd_mon_cb);
     adev->card_status = CARD_STATUS_ONLINE;
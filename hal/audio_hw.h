@@ -17,6 +17,8 @@
 #ifndef QCOM_AUDIO_HW_H
 #define QCOM_AUDIO_HW_H
 
+#include <stdatomic.h>
+
 #include <cutils/str_parms.h>
 #include <cutils/list.h>
 #include <hardware/audio.h>
@@ -57,6 +59,56 @@
 
 #define ERROR_LOG_ENTRIES 16
 
+/* Bucket i holds samples below (1 << i) us, the last bucket is open ended. */
+#define LATENCY_HIST_BUCKETS 16
+
+/*
+ * Fixed bucket latency histogram. Updated with relaxed atomics by the
+ * stream thread so that dump() can read it without taking the stream lock.
+ */
+struct latency_hist {
+    atomic_uint_fast32_t bucket[LATENCY_HIST_BUCKETS];
+    atomic_int_fast64_t max_ns;
+};
+
+#define UNDERRUN_LOG_ENTRIES 16
+
+struct underrun_event {
+    int64_t time_ns;         // CLOCK_MONOTONIC, the clock of the route trace
+    int64_t frames;          // frames lost, 1 for compressed streams
+    audio_usecase_t usecase;
+    audio_devices_t devices;
+    int cpu;
+    uint32_t cpu_khz;        // frequency of that cpu, 0 if unknown
+};
+
+/* Last UNDERRUN_LOG_ENTRIES underruns of a stream, updated with its lock held. */
+struct underrun_log {
+    uint32_t next;
+    struct underrun_event events[UNDERRUN_LOG_ENTRIES];
+};
+
+#define MMAP_TIMING_WINDOW 32
+
+/*
+ * Sliding window of MMAP hw_ptr/timestamp pairs, see audio_extn/mmap_timing.c.
+ * Only touched with the stream lock held.
+ */
+struct mmap_timing {
+    bool is_output;
+    audio_devices_t devices;  // the buffer recommendation is kept per devices
+    uint32_t rate;
+    int64_t max_offset_ns;  // one burst, bounds the learnt offset
+    int64_t offset_ns;
+    uint32_t count;
+    uint32_t next;
+    int64_t last_query_ns;  // gaps between position polls, for buffer sizing
+    int64_t min_gap_ns;
+    int64_t max_gap_ns;
+    int64_t frames[MMAP_TIMING_WINDOW];
+    int64_t time_ns[MMAP_TIMING_WINDOW];
+};
+
 /* Error types for the error log */
 enum {
     ERROR_CODE_STANDBY = 1,
@@ -94,6 +146,7 @@ enum {
     USECASE_AUDIO_RECORD_LOW_LATENCY,
     USECASE_AUDIO_RECORD_MMAP,
     USECASE_AUDIO_RECORD_HIFI,
+    USECASE_AUDIO_RECORD_COMPRESS,
 
     /* Voice extension usecases
      *
@@ -189,17 +242,21 @@ enum {
 #define AUDIO_PARAMETER_VALUE_FRONT "front"
 #define AUDIO_PARAMETER_VALUE_BACK "back"
 
+/* start a warm standby capable output ahead of its first write */
+#define AUDIO_PARAMETER_KEY_PREWARM "prewarm"
+
+/* fd of the echo reference tap of a capture stream with EC routed */
+#define AUDIO_PARAMETER_KEY_EC_REF_TAP "ec_ref_tap"
+
 enum {
     OFFLOAD_STATE_IDLE,
     OFFLOAD_STATE_PLAYING,
     OFFLOAD_STATE_PAUSED,
 };
 
-struct offload_cmd {
-    struct listnode node;
-    int cmd;
-    int data[];
-};
+/* Must be a power of two, see send_offload_cmd_l(); one slot is reserved
+   for OFFLOAD_CMD_EXIT */
+#define OFFLOAD_CMD_RING_SIZE 16
 
 struct stream_app_type_cfg {
     int sample_rate;
@@ -209,6 +266,27 @@ struct stream_app_type_cfg {
     int gain[2];
 };
 
+/* capability replies rendered from the supported lists, as "key=value" so
+   a query for a single key can be answered with a copy. Rendered again
+   after a device connect or disconnect. */
+struct stream_caps {
+    pthread_mutex_t lock;
+    unsigned int generation;
+    const audio_channel_mask_t *supported_channel_masks;
+    const audio_format_t *supported_formats;
+    const uint32_t *supported_sample_rates;
+    char *channels;
+    char *formats;
+    char *rates;
+};
+
+/* ADM focus kept across a burst of writes or reads, see request_focus() */
+struct adm_focus {
+    bool held;
+    int transfers;  /* completed since focus was requested */
+    long ns;        /* duration it was requested for */
+};
+
 struct stream_out {
     struct audio_stream_out stream;
     pthread_mutex_t lock; /* see note below on mutex acquisition order */
@@ -231,19 +309,42 @@ struct stream_out {
     audio_channel_mask_t supported_channel_masks[MAX_SUPPORTED_CHANNEL_MASKS + 1];
     audio_format_t supported_formats[MAX_SUPPORTED_FORMATS + 1];
     uint32_t supported_sample_rates[MAX_SUPPORTED_SAMPLE_RATES + 1];
+    struct stream_caps caps;
     bool muted;
     uint64_t written; /* total frames written, not cleared when entering standby */
     int64_t mmap_time_offset_nanos; /* fudge factor to correct inaccuracies in DSP */
+    struct mmap_timing mmap_timing; /* smooths the reported mmap positions */
     int     mmap_shared_memory_fd; /* file descriptor associated with MMAP NOIRQ shared memory */
     audio_io_handle_t handle;
 
     int non_blocking;
     int playback_started;
     int offload_state;
-    pthread_cond_t offload_cond;
     pthread_t offload_thread;
-    struct listnode offload_cmd_list;
+    /*
+     * Single producer/single consumer command ring. Commands are queued with
+     * out->lock held, so there is only one producer at a time, and consumed
+     * by the offload thread which is woken through offload_cmd_fd (eventfd).
+     */
+    int offload_cmd_ring[OFFLOAD_CMD_RING_SIZE];
+    atomic_uint offload_cmd_head;
+    atomic_uint offload_cmd_tail;
+    int offload_cmd_fd;
     bool offload_thread_blocked;
+    /* free bytes required in the DSP buffer before WRITE_READY, 0 for any */
+    size_t offload_write_ready_bytes;
+
+    /*
+     * Warm standby: after standby the pcm stays prepared and the route stays
+     * enabled for warm_standby_ns so that a write shortly after skips
+     * start_output_stream(). 0 disables it.
+     */
+    int64_t warm_standby_ns;
+    int64_t warm_standby_deadline_ns;
+    bool warm_standby;
+    bool warm_standby_exit;
+    pthread_t warm_standby_thread;
+    pthread_cond_t warm_standby_cond;
 
     stream_callback_t offload_callback;
     void *offload_cookie;
@@ -251,6 +352,11 @@ struct stream_out {
     int send_new_metadata;
     bool realtime;
     int af_period_multiplier;
+    bool force_haptic_path; /* vendor.audio.test_haptic, sampled at open */
+    int screen_off_period_multiplier; /* deep buffer only, sampled at open */
+    bool long_periods; /* pcm opened with the screen off period size */
+    struct adm_focus adm_focus;
+    bool ssr_restart; /* was active when the card went offline */
     struct audio_device *dev;
     card_status_t card_status;
     bool a2dp_compress_mute;
@@ -258,6 +364,7 @@ struct stream_out {
     float volume_r;
     float applied_volume_l;
     float applied_volume_r;
+    struct volume_coalescer *volume_coalescer; /* offload only, under compr_mute_lock */
 
     error_log_t *error_log;
 
@@ -270,8 +377,22 @@ struct stream_out {
     unsigned int last_fifo_frames_remaining;
     int64_t      last_fifo_time_ns;
 
-    simple_stats_t fifo_underruns;  // TODO: keep a list of the last N fifo underrun times.
+    // position published by out_write() for lock free presentation position
+    // queries, position_seq is odd while it is being updated.
+    atomic_uint     position_seq;
+    bool            position_valid;
+    uint64_t        position_frames;
+    struct timespec position_timestamp;
+
+    simple_stats_t fifo_underruns;
+    struct underrun_log underrun_log;  // the last fifo underruns
     simple_stats_t start_latency_ms;
+
+    struct latency_hist write_hist;  // time blocked in pcm/compress write
+    struct latency_hist lock_hist;   // time waiting on pre_lock/lock in out_write()
+    struct latency_hist start_hist;  // time spent in start_output_stream()
+
+    struct metrics_shm_stream *metrics;  // shared memory counters, may be NULL
 };
 
 struct stream_in {
@@ -279,7 +400,9 @@ struct stream_in {
     pthread_mutex_t lock; /* see note below on mutex acquisition order */
     pthread_mutex_t pre_lock; /* acquire before lock to avoid DOS by capture thread */
     struct pcm_config config;
+    struct compr_config compr_config; /* USECASE_AUDIO_RECORD_COMPRESS only */
     struct pcm *pcm;
+    struct compress *compr;
     int standby;
     int source;
     int pcm_device_id;
@@ -296,6 +419,7 @@ struct stream_in {
     int64_t frames_read; /* total frames read, not cleared when entering standby */
     int64_t frames_muted; /* total frames muted, not cleared when entering standby */
     int64_t mmap_time_offset_nanos; /* fudge factor to correct inaccuracies in DSP */
+    struct mmap_timing mmap_timing; /* smooths the reported mmap positions */
     int     mmap_shared_memory_fd; /* file descriptor associated with MMAP NOIRQ shared memory */
 
     audio_io_handle_t capture_handle;
@@ -304,6 +428,9 @@ struct stream_in {
     bool is_st_session_active;
     bool realtime;
     int af_period_multiplier;
+    struct adm_focus adm_focus;
+    bool ssr_restart; /* was active when the card went offline */
+    struct capture_resampler *resampler; /* set when sample_rate differs from config.rate */
     struct audio_device *dev;
     audio_format_t format;
     card_status_t card_status;
@@ -318,10 +445,25 @@ struct stream_in {
     audio_channel_mask_t supported_channel_masks[MAX_SUPPORTED_CHANNEL_MASKS + 1];
     audio_format_t supported_formats[MAX_SUPPORTED_FORMATS + 1];
     uint32_t supported_sample_rates[MAX_SUPPORTED_SAMPLE_RATES + 1];
+    struct stream_caps caps;
 
     error_log_t *error_log;
 
     simple_stats_t start_latency_ms;
+
+    // fifo level after the last in_read(), for overrun detection
+    bool         last_fifo_valid;
+    unsigned int last_fifo_frames_available;
+    int64_t      last_fifo_time_ns;
+
+    simple_stats_t fifo_overruns;
+    atomic_uint_fast32_t frames_lost;  // since the last get_input_frames_lost()
+
+    struct latency_hist read_hist;   // time blocked in pcm read
+    struct latency_hist lock_hist;   // time waiting on pre_lock/lock in in_read()
+    struct latency_hist start_hist;  // time spent in start_input_stream()
+
+    struct metrics_shm_stream *metrics;  // shared memory counters, may be NULL
 };
 
 typedef enum usecase_type_t {
@@ -339,6 +481,7 @@ union stream_ptr {
 
 struct audio_usecase {
     struct listnode list;
+    struct listnode type_list;  /* node in audio_device.usecase_type_list[type] */
     audio_usecase_t id;
     usecase_type_t  type;
     audio_devices_t devices;
@@ -374,9 +517,19 @@ struct audio_device {
     bool screen_off;
     int *snd_dev_ref_cnt;
     struct listnode usecase_list;
+    /* id and type indexes of usecase_list, see add_usecase_to_list() */
+    struct audio_usecase *usecase_table[AUDIO_USECASE_MAX];
+    struct listnode usecase_type_list[USECASE_TYPE_MAX];
+    /* preallocated at open so that stream start and stop stay off the heap */
+    struct object_pool *usecase_pool;
+    struct object_pool *effect_pool;
     struct audio_route *audio_route;
+    /* mixer path changes are only committed when the outermost batch ends */
+    int route_batch_depth;
+    bool route_batch_dirty;
     int acdb_settings;
     struct voice voice;
+    struct volume_coalescer *voice_volume_coalescer;
     unsigned int cur_hdmi_channels;
     bool bt_wb_speech_enabled;
     bool mic_muted;
@@ -391,6 +544,8 @@ struct audio_device {
 
     card_status_t card_status;
 
+    /* visualizer and offload effects bundle are loaded on the first offload start */
+    bool offload_effects_loaded;
     void *visualizer_lib;
     int (*visualizer_start_output)(audio_io_handle_t, int, int, int);
     int (*visualizer_stop_output)(audio_io_handle_t, int);
@@ -402,6 +557,11 @@ struct audio_device {
      * or other capabilities are present for the device corresponding to that usecase.
      */
     struct pcm_params *use_case_table[AUDIO_USECASE_MAX];
+    /* refreshes a use_case_table restored from the pcm params cache */
+    pthread_t pcm_params_refresh_thread;
+    bool pcm_params_refresh_started;
+    bool pcm_params_refresh_exit;
+    pthread_cond_t pcm_params_refresh_cond; /* CLOCK_MONOTONIC, with adev->lock */
     void *offload_effects_lib;
     int (*offload_effects_start_output)(audio_io_handle_t, int);
     int (*offload_effects_stop_output)(audio_io_handle_t, int);
@@ -414,6 +574,7 @@ struct audio_device {
     int    haptic_pcm_device_id;
     uint8_t *haptic_buffer;
     size_t haptic_buffer_size;
+    struct haptic_writer *haptic_writer;  /* NULL when haptics are written inline */
 
     adm_init_t adm_init;
     adm_deinit_t adm_deinit;
@@ -426,6 +587,7 @@ struct audio_device {
     adm_request_focus_v2_t adm_request_focus_v2;
     adm_is_noirq_avail_t adm_is_noirq_avail;
     adm_on_routing_change_t adm_on_routing_change;
+    int adm_focus_burst;  /* vendor.audio.adm.focus_burst, transfers per focus request */
 
     /* logging */
     snd_device_t last_logged_snd_device[AUDIO_USECASE_MAX][2]; /* [out, in] */
@@ -449,6 +611,15 @@ int enable_snd_device(struct audio_device *adev,
 int enable_audio_route(struct audio_device *adev,
                        struct audio_usecase *usecase);
 
+/* zeroed, from adev->usecase_pool */
+struct audio_usecase *alloc_usecase(struct audio_device *adev);
+
+void free_usecase(struct audio_device *adev, struct audio_usecase *usecase);
+
+void add_usecase_to_list(struct audio_device *adev, struct audio_usecase *usecase);
+
+void remove_usecase_from_list(struct audio_device *adev, struct audio_usecase *usecase);
+
 struct audio_usecase *get_usecase_from_list(struct audio_device *adev,
                                             audio_usecase_t uc_id);
 
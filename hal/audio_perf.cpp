@@ -16,7 +16,10 @@
 
 #define LOG_TAG "audio_hw_primary"
 
+#include <chrono>
 #include <cinttypes>
+#include <condition_variable>
+#include <thread>
 
 #include <utils/Log.h>
 #include <utils/Mutex.h>
@@ -88,7 +91,7 @@ static hal_version connectPowerHalLocked() {
     return NONE;
 }
 
-bool audio_streaming_hint_start() {
+static bool sendStreamingHintStart() {
     std::lock_guard<std::mutex> lock(gPowerHalMutex);
     switch(connectPowerHalLocked()) {
         case NONE:
@@ -125,7 +128,7 @@ bool audio_streaming_hint_start() {
     }
 }
 
-bool audio_streaming_hint_end() {
+static bool sendStreamingHintEnd() {
     std::lock_guard<std::mutex> lock(gPowerHalMutex);
     switch(connectPowerHalLocked()) {
         case NONE:
@@ -162,7 +165,7 @@ bool audio_streaming_hint_end() {
     }
 }
 
-bool audio_low_latency_hint_start() {
+static bool sendLowLatencyHintStart() {
     std::lock_guard<std::mutex> lock(gPowerHalMutex);
     switch(connectPowerHalLocked()) {
         case NONE:
@@ -199,7 +202,7 @@ bool audio_low_latency_hint_start() {
     }
 }
 
-bool audio_low_latency_hint_end() {
+static bool sendLowLatencyHintEnd() {
     std::lock_guard<std::mutex> lock(gPowerHalMutex);
     switch(connectPowerHalLocked()) {
         case NONE:
@@ -235,3 +238,101 @@ bool audio_low_latency_hint_end() {
             return false;
     }
 }
+
+// Hints are delivered from a dedicated thread so that a slow Power HAL never
+// delays stream start/stop, which run with adev->lock held. Requests are
+// collected for kCoalesceWindowMs and a start followed by an end for the same
+// hint within that window is dropped altogether.
+enum hint_type {
+    HINT_STREAMING,
+    HINT_LOW_LATENCY,
+    HINT_COUNT,
+};
+
+enum hint_request {
+    REQUEST_NONE,
+    REQUEST_START,
+    REQUEST_END,
+};
+
+static constexpr int kCoalesceWindowMs = 20;
+
+static std::mutex gHintMutex;
+static std::condition_variable gHintCond;
+static hint_request gHintPending[HINT_COUNT];  // protected by gHintMutex
+static bool gHintSent[HINT_COUNT];             // protected by gHintMutex
+static std::once_flag gHintThreadOnce;
+
+static bool sendHint(hint_type type, bool start) {
+    switch (type) {
+        case HINT_STREAMING:
+            return start ? sendStreamingHintStart() : sendStreamingHintEnd();
+        case HINT_LOW_LATENCY:
+            return start ? sendLowLatencyHintStart() : sendLowLatencyHintEnd();
+        default:
+            return false;
+    }
+}
+
+static void hintThreadLoop() {
+    for (;;) {
+        hint_request requests[HINT_COUNT];
+        {
+            std::unique_lock<std::mutex> lock(gHintMutex);
+            gHintCond.wait(lock, [] {
+                for (int i = 0; i < HINT_COUNT; i++) {
+                    if (gHintPending[i] != REQUEST_NONE) return true;
+                }
+                return false;
+            });
+            // let the matching end (or further starts) arrive before sending
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(kCoalesceWindowMs));
+            lock.lock();
+            for (int i = 0; i < HINT_COUNT; i++) {
+                requests[i] = gHintPending[i];
+                if (requests[i] != REQUEST_NONE) {
+                    gHintSent[i] = requests[i] == REQUEST_START;
+                }
+                gHintPending[i] = REQUEST_NONE;
+            }
+        }
+        for (int i = 0; i < HINT_COUNT; i++) {
+            if (requests[i] != REQUEST_NONE) {
+                sendHint(static_cast<hint_type>(i), requests[i] == REQUEST_START);
+            }
+        }
+    }
+}
+
+static bool queueHint(hint_type type, bool start) {
+    std::call_once(gHintThreadOnce, [] {
+        std::thread(hintThreadLoop).detach();
+    });
+
+    std::lock_guard<std::mutex> lock(gHintMutex);
+    if (!start && gHintPending[type] == REQUEST_START && !gHintSent[type]) {
+        // the start never reached the Power HAL, drop both
+        gHintPending[type] = REQUEST_NONE;
+        return true;
+    }
+    gHintPending[type] = start ? REQUEST_START : REQUEST_END;
+    gHintCond.notify_one();
+    return true;
+}
+
+bool audio_streaming_hint_start() {
+    return queueHint(HINT_STREAMING, true);
+}
+
+bool audio_streaming_hint_end() {
+    return queueHint(HINT_STREAMING, false);
+}
+
+bool audio_low_latency_hint_start() {
+    return queueHint(HINT_LOW_LATENCY, true);
+}
+
+bool audio_low_latency_hint_end() {
+    return queueHint(HINT_LOW_LATENCY, false);
+}
@@ -19,6 +19,7 @@
 #define LOG_NDDEBUG 0
 
 #include <stdlib.h>
+#include <pthread.h>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -27,6 +28,7 @@
 #include <cutils/str_parms.h>
 #include <audio_hw.h>
 #include <platform_api.h>
+#include <snd_device_rules.h>
 #include "platform.h"
 #include "audio_extn.h"
 #include "acdb.h"
@@ -141,8 +143,19 @@ typedef int (*acdb_loader_get_calibration_t)(char *attr, int size, void *data);
 acdb_loader_get_calibration_t acdb_loader_get_calibration;
 static int platform_get_meta_info_key_from_list(void *platform, char *mod_name);
 
+/* Audio capabilities of the HDMI sink, parsed from its EDID on the first
+   query after a connect or disconnect, see edid_parse_caps() */
+struct edid_caps {
+    bool valid;
+    int max_channels;        /* LPCM */
+    uint8_t lpcm_rates;      /* SAD byte 1: 32, 44.1, 48, 88.2, 96, 176.4, 192 kHz */
+    uint8_t lpcm_sizes;      /* SAD byte 2: 16, 20, 24 bit */
+    uint16_t formats;        /* bit n set when SAD format code n is listed */
+};
+
 struct platform_data {
     struct audio_device *adev;
+    struct edid_caps edid_caps;
     bool fluence_in_spkr_mode;
     bool fluence_in_voice_call;
     bool fluence_in_voice_rec;
@@ -182,6 +195,7 @@ int pcm_device_table[AUDIO_USECASE_MAX][2] = {
     [USECASE_AUDIO_RECORD] = {AUDIO_RECORD_PCM_DEVICE, AUDIO_RECORD_PCM_DEVICE},
     [USECASE_AUDIO_RECORD_LOW_LATENCY] = {LOWLATENCY_PCM_DEVICE,
                                           LOWLATENCY_PCM_DEVICE},
+    [USECASE_AUDIO_RECORD_COMPRESS] = {-1, -1}, /* pcm ids updated from platform info file */
     [USECASE_AUDIO_HFP_SCO] = {HFP_PCM_RX, HFP_SCO_RX},
     [USECASE_AUDIO_HFP_SCO_WB] = {HFP_PCM_RX, HFP_SCO_RX},
     [USECASE_VOICE_CALL] = {VOICE_CALL_PCM_DEVICE, VOICE_CALL_PCM_DEVICE},
@@ -427,11 +441,6 @@ static int acdb_device_table[SND_DEVICE_MAX] = {
     [SND_DEVICE_IN_SPEAKER_QMIC_AEC_NS] = 129,
 };
 
-struct name_to_index {
-    char name[100];
-    unsigned int index;
-};
-
 #define TO_NAME_INDEX(X)   #X, X
 
 /* Used to get index from parsed sting */
@@ -538,6 +547,7 @@ static struct name_to_index usecase_name_index[AUDIO_USECASE_MAX] = {
     {TO_NAME_INDEX(USECASE_AUDIO_PLAYBACK_ULL)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD_LOW_LATENCY)},
+    {TO_NAME_INDEX(USECASE_AUDIO_RECORD_COMPRESS)},
     {TO_NAME_INDEX(USECASE_VOICE_CALL)},
     {TO_NAME_INDEX(USECASE_VOICE2_CALL)},
     {TO_NAME_INDEX(USECASE_VOLTE_CALL)},
@@ -777,7 +787,7 @@ void get_cvd_version(char *cvd_version, struct audio_device *adev)
     int count;
     int ret = 0;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, CVD_VERSION_MIXER_CTL);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, CVD_VERSION_MIXER_CTL);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",  __func__, CVD_VERSION_MIXER_CTL);
         goto done;
@@ -1124,6 +1134,7 @@ void *platform_init(struct audio_device *adev)
         mixer_close(adev->mixer);
         adev->mixer = NULL;
     }
+    audio_extn_utils_mixer_ctl_cache_init(adev->mixer);
 
     //set max volume step for voice call
     property_get("ro.config.vc_call_vol_steps", value, TOSTRING(MAX_VOL_INDEX));
@@ -1182,8 +1193,10 @@ void *platform_init(struct audio_device *adev)
     /* Initialize ACDB and PCM ID's */
     strlcpy(platform_info_path, PLATFORM_INFO_XML_PATH, MAX_MIXER_XML_PATH);
     resolve_config_file(platform_info_path);
+    int64_t parse_ns = audio_extn_perf_stats_kernel_begin();
     platform_info_init(platform_info_path, my_data,
                        true, &platform_set_parameters);
+    audio_extn_perf_stats_log_platform_info(parse_ns);
 
     my_data->acdb_handle = dlopen(LIB_ACDB_LOADER, RTLD_NOW);
     if (my_data->acdb_handle == NULL) {
@@ -1292,6 +1305,7 @@ void platform_deinit(void *platform)
         free(info_item);
     }
 
+    audio_extn_utils_mixer_ctl_cache_deinit();
     mixer_close(my_data->adev->mixer);
     free(platform);
 }
@@ -1426,54 +1440,61 @@ int platform_get_haptics_pcm_device_id()
     return -1;
 }
 
-static int find_index(struct name_to_index * table, int32_t len, const char * name)
+/* sorted views of the name tables, see snd_device_rules.h */
+static const struct name_to_index *snd_device_name_sorted[SND_DEVICE_MAX];
+static const struct name_to_index *usecase_name_sorted[AUDIO_USECASE_MAX];
+static const struct name_to_index *audio_source_sorted[AUDIO_SOURCE_CNT];
+
+static struct name_to_index_map snd_device_name_map = {
+    snd_device_name_index, SND_DEVICE_MAX, 0, snd_device_name_sorted
+};
+static struct name_to_index_map usecase_name_map = {
+    usecase_name_index, AUDIO_USECASE_MAX, 0, usecase_name_sorted
+};
+static struct name_to_index_map audio_source_map = {
+    audio_source_index, AUDIO_SOURCE_CNT, 0, audio_source_sorted
+};
+
+static pthread_once_t name_to_index_once_ctl = PTHREAD_ONCE_INIT;
+
+static void init_name_to_index_maps(void)
 {
-    int ret = 0;
-    int32_t i;
+    name_to_index_map_sort(&snd_device_name_map);
+    name_to_index_map_sort(&usecase_name_map);
+    name_to_index_map_sort(&audio_source_map);
+}
 
-    if (table == NULL) {
-        ALOGE("%s: table is NULL", __func__);
-        ret = -ENODEV;
-        goto done;
-    }
+static int find_index(struct name_to_index_map *map, const char * name)
+{
+    int ret;
 
     if (name == NULL) {
         ALOGE("null key");
-        ret = -ENODEV;
-        goto done;
+        return -ENODEV;
     }
 
-    for (i=0; i < len; i++) {
-        const char* tn = table[i].name;
-        size_t len = strlen(tn);
-        if (strncmp(tn, name, len) == 0) {
-            if (strlen(name) != len) {
-                continue; // substring
-            }
-            ret = table[i].index;
-            goto done;
-        }
-    }
-    ALOGE("%s: Could not find index for name = %s",
-            __func__, name);
-    ret = -ENODEV;
-done:
+    pthread_once(&name_to_index_once_ctl, init_name_to_index_maps);
+
+    ret = name_to_index_map_find(map, name);
+    if (ret < 0)
+        ALOGE("%s: Could not find index for name = %s",
+                __func__, name);
     return ret;
 }
 
 int platform_get_snd_device_index(char *device_name)
 {
-    return find_index(snd_device_name_index, SND_DEVICE_MAX, device_name);
+    return find_index(&snd_device_name_map, device_name);
 }
 
 int platform_get_usecase_index(const char *usecase_name)
 {
-    return find_index(usecase_name_index, AUDIO_USECASE_MAX, usecase_name);
+    return find_index(&usecase_name_map, usecase_name);
 }
 
 int platform_get_audio_source_index(const char *audio_source_name)
 {
-    return find_index(audio_source_index, AUDIO_SOURCE_CNT, audio_source_name);
+    return find_index(&audio_source_map, audio_source_name);
 }
 
 int platform_get_effect_config_data(snd_device_t snd_device,
@@ -1780,7 +1801,7 @@ int platform_set_voice_volume(void *platform, int volume)
     // But this values don't changed in kernel. So, below change is need.
     vol_index = (int)percent_to_index(volume, MIN_VOL_INDEX, my_data->max_vol_index);
     set_values[0] = vol_index;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1798,7 +1819,7 @@ int platform_set_voice_volume(void *platform, int volume)
         set_values[0] = 0;
     }
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mute_mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mute_mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mute_mixer_ctl_name);
@@ -1824,7 +1845,7 @@ int platform_set_mic_mute(void *platform, bool state)
         mixer_ctl_name = "HFP TX Mute";
 
     set_values[0] = state;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1863,7 +1884,7 @@ int platform_set_device_mute(void *platform, bool state, char *dir)
     }
 
     set_values[0] = state;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -1908,6 +1929,21 @@ int platform_can_split_snd_device(snd_device_t snd_device,
     return ret;
 }
 
+static const struct snd_device_combo_rule out_combo_rules[] = {
+    { AUDIO_DEVICE_OUT_WIRED_HEADPHONE | AUDIO_DEVICE_OUT_WIRED_HEADSET,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES, 0 },
+    { AUDIO_DEVICE_OUT_LINE,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_LINE, 0 },
+    { AUDIO_DEVICE_OUT_AUX_DIGITAL,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_HDMI, 0 },
+    { AUDIO_DEVICE_OUT_ANLG_DOCK_HEADSET,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_USB_HEADSET, 0 },
+    { AUDIO_DEVICE_OUT_ALL_A2DP,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_BT_A2DP, 0 },
+    { AUDIO_DEVICE_OUT_ALL_A2DP,
+      AUDIO_DEVICE_OUT_SPEAKER_SAFE, SND_DEVICE_OUT_SPEAKER_SAFE_AND_BT_A2DP, 0 },
+};
+
 snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devices)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -1923,34 +1959,11 @@ snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devi
     }
 
     if (popcount(devices) == 2) {
-        if (devices == (AUDIO_DEVICE_OUT_WIRED_HEADPHONE |
-                        AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES;
-        } else if (devices == (AUDIO_DEVICE_OUT_LINE |
-                               AUDIO_DEVICE_OUT_SPEAKER)) {
-                snd_device = SND_DEVICE_OUT_SPEAKER_AND_LINE;
-        } else if (devices == (AUDIO_DEVICE_OUT_WIRED_HEADSET |
-                               AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES;
-        } else if (devices == (AUDIO_DEVICE_OUT_AUX_DIGITAL |
-                               AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_HDMI;
-        } else if (devices == (AUDIO_DEVICE_OUT_ANLG_DOCK_HEADSET |
-                               AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_USB_HEADSET;
-        } else if ((devices & AUDIO_DEVICE_OUT_SPEAKER) &&
-                   (devices & AUDIO_DEVICE_OUT_ALL_A2DP)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_BT_A2DP;
-        } else if ((devices & AUDIO_DEVICE_OUT_SPEAKER_SAFE) &&
-                   (devices & AUDIO_DEVICE_OUT_ALL_A2DP)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_SAFE_AND_BT_A2DP;
-        } else {
+        snd_device = snd_device_combo_lookup(out_combo_rules, ARRAY_SIZE(out_combo_rules),
+                                             devices, false);
+        if (snd_device == SND_DEVICE_NONE)
             ALOGE("%s: Invalid combo device(%#x)", __func__, devices);
-            goto exit;
-        }
-        if (snd_device != SND_DEVICE_NONE) {
-            goto exit;
-        }
+        goto exit;
     }
 
     if (popcount(devices) != 1) {
@@ -2423,7 +2436,7 @@ int platform_set_hdmi_channels(void *platform,  int channel_count)
     default:
         channel_cnt_str = "Two"; break;
     }
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -2434,24 +2447,25 @@ int platform_set_hdmi_channels(void *platform,  int channel_count)
     return 0;
 }
 
-int platform_edid_get_max_channels(void *platform)
+/* parses the SAD blocks of the sink into my_data->edid_caps, returns 0 if
+   they could be read */
+static int edid_parse_caps(struct platform_data *my_data)
 {
-    struct platform_data *my_data = (struct platform_data *)platform;
     struct audio_device *adev = my_data->adev;
+    struct edid_caps *caps = &my_data->edid_caps;
     char block[MAX_SAD_BLOCKS * SAD_BLOCK_SIZE];
     char *sad = block;
     int num_audio_blocks;
-    int channel_count;
-    int max_channels = 0;
+    int format, channel_count;
     int i, ret, count;
 
     struct mixer_ctl *ctl;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, AUDIO_DATA_BLOCK_MIXER_CTL);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, AUDIO_DATA_BLOCK_MIXER_CTL);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, AUDIO_DATA_BLOCK_MIXER_CTL);
-        return 0;
+        return -ENODEV;
     }
 
     mixer_ctl_update(ctl);
@@ -2465,28 +2479,55 @@ int platform_edid_get_max_channels(void *platform)
     ret = mixer_ctl_get_array(ctl, block, count);
     if (ret != 0) {
         ALOGE("%s: mixer_ctl_get_array() failed to get EDID info", __func__);
-        return 0;
+        return -EIO;
     }
 
     /* Calculate the number of SAD blocks */
     num_audio_blocks = count / SAD_BLOCK_SIZE;
+    /* the sink announces LPCM at least once it is fully connected */
+    if (num_audio_blocks == 0)
+        return -EAGAIN;
 
-    for (i = 0; i < num_audio_blocks; i++) {
-        /* Only consider LPCM blocks */
-        if ((sad[0] >> 3) != EDID_FORMAT_LPCM) {
-            sad += 3;
+    memset(caps, 0, sizeof(*caps));
+    for (i = 0; i < num_audio_blocks; i++, sad += SAD_BLOCK_SIZE) {
+        format = (sad[0] >> 3) & 0xf;
+        caps->formats |= 1 << format;
+
+        /* Only consider LPCM blocks for channels, rates and sizes */
+        if (format != EDID_FORMAT_LPCM)
             continue;
-        }
 
         channel_count = (sad[0] & 0x7) + 1;
-        if (channel_count > max_channels)
-            max_channels = channel_count;
-
-        /* Advance to next block */
-        sad += 3;
+        if (channel_count > caps->max_channels)
+            caps->max_channels = channel_count;
+        caps->lpcm_rates |= sad[1] & 0x7f;
+        caps->lpcm_sizes |= sad[2] & 0x7;
     }
+    caps->valid = true;
+
+    ALOGI("%s: %d LPCM channels, rates 0x%x, sizes 0x%x, passthrough formats 0x%x", __func__,
+          caps->max_channels, caps->lpcm_rates, caps->lpcm_sizes,
+          caps->formats & ~(1 << EDID_FORMAT_LPCM));
+    return 0;
+}
+
+/* must be called with hw device mutex locked */
+int platform_edid_get_max_channels(void *platform)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+
+    if (!my_data->edid_caps.valid && edid_parse_caps(my_data) != 0)
+        return 0;
+
+    return my_data->edid_caps.max_channels;
+}
+
+/* must be called with hw device mutex locked */
+void platform_edid_invalidate(void *platform)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
 
-    return max_channels;
+    my_data->edid_caps.valid = false;
 }
 
 int platform_set_incall_recording_session_id(void *platform,
@@ -2501,7 +2542,7 @@ int platform_set_incall_recording_session_id(void *platform,
     int num_ctl_values;
     int i;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -2718,8 +2759,10 @@ int ramp_speaker_gain(struct audio_device *adev, bool ramp_up, int target_ramp_u
     const struct mixer_ctl *ctl;
     const char *mixer_ctl_name_gain_left = "Left Speaker Gain";
     const char *mixer_ctl_name_gain_right = "Right Speaker Gain";
-    struct mixer_ctl *ctl_left = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name_gain_left);
-    struct mixer_ctl *ctl_right = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name_gain_right);
+    struct mixer_ctl *ctl_left = audio_extn_utils_get_mixer_ctl(adev->mixer,
+                                                      mixer_ctl_name_gain_left);
+    struct mixer_ctl *ctl_right = audio_extn_utils_get_mixer_ctl(adev->mixer,
+                                                      mixer_ctl_name_gain_right);
     if (!ctl_left || !ctl_right) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s or %s, not applying speaker gain ramp",
                       __func__, mixer_ctl_name_gain_left, mixer_ctl_name_gain_right);
@@ -2792,7 +2835,7 @@ int platform_set_swap_mixer(struct audio_device *adev, bool swap_channels)
         audio_route_apply_and_update_path(adev->audio_route, mixer_path);
     }
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",__func__, mixer_ctl_name);
         return -EINVAL;
@@ -2875,6 +2918,15 @@ int platform_send_audio_calibration_v2(void *platform __unused,
     return -ENOSYS;
 }
 
+int platform_begin_audio_calibration_batch(void *platform __unused)
+{
+    return -ENOSYS;
+}
+
+void platform_end_audio_calibration_batch(void *platform __unused)
+{
+}
+
 void platform_check_and_update_copp_sample_rate(void* platform __unused,
                                                snd_device_t snd_device __unused,
                                                 unsigned int stream_sr __unused,
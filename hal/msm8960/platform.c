@@ -24,6 +24,7 @@
 #include <cutils/properties.h>
 #include <audio_hw.h>
 #include <platform_api.h>
+#include <snd_device_rules.h>
 #include "platform.h"
 #include "audio_extn.h"
 
@@ -108,6 +109,7 @@ static const int pcm_device_table[AUDIO_USECASE_MAX][2] = {
     [USECASE_AUDIO_PLAYBACK_HIFI] = {1, 1},
     [USECASE_AUDIO_RECORD] = {0, 0},
     [USECASE_AUDIO_RECORD_LOW_LATENCY] = {14, 14},
+    [USECASE_AUDIO_RECORD_COMPRESS] = {-1, -1},
     [USECASE_VOICE_CALL] = {12, 12},
 };
 
@@ -657,6 +659,13 @@ int platform_set_device_mute(void *platform __unused, bool state __unused, char
     return -ENOSYS;
 }
 
+static const struct snd_device_combo_rule out_combo_rules[] = {
+    { AUDIO_DEVICE_OUT_WIRED_HEADPHONE | AUDIO_DEVICE_OUT_WIRED_HEADSET,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES, 0 },
+    { AUDIO_DEVICE_OUT_AUX_DIGITAL,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_HDMI, 0 },
+};
+
 snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devices)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -704,22 +713,11 @@ snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devi
     }
 
     if (popcount(devices) == 2) {
-        if (devices == (AUDIO_DEVICE_OUT_WIRED_HEADPHONE |
-                        AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES;
-        } else if (devices == (AUDIO_DEVICE_OUT_WIRED_HEADSET |
-                               AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES;
-        } else if (devices == (AUDIO_DEVICE_OUT_AUX_DIGITAL |
-                               AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_HDMI;
-        } else {
+        snd_device = snd_device_combo_lookup(out_combo_rules, ARRAY_SIZE(out_combo_rules),
+                                             devices, false);
+        if (snd_device == SND_DEVICE_NONE)
             ALOGE("%s: Invalid combo device(%#x)", __func__, devices);
-            goto exit;
-        }
-        if (snd_device != SND_DEVICE_NONE) {
-            goto exit;
-        }
+        goto exit;
     }
 
     if (popcount(devices) != 1) {
@@ -1012,6 +1010,10 @@ int platform_edid_get_max_channels(void *platform __unused)
     return max_channels;
 }
 
+void platform_edid_invalidate(void *platform __unused)
+{
+}
+
 int platform_set_incall_recording_session_id(void *platform __unused,
                                              uint32_t session_id __unused, int rec_mode __unused)
 {
@@ -1400,6 +1402,15 @@ int platform_send_audio_calibration_v2(void *platform __unused, struct audio_use
     return -ENOSYS;
 }
 
+int platform_begin_audio_calibration_batch(void *platform __unused)
+{
+    return -ENOSYS;
+}
+
+void platform_end_audio_calibration_batch(void *platform __unused)
+{
+}
+
 bool platform_supports_app_type_cfg() { return false; }
 
 void platform_add_app_type(const char *uc_type __unused,
@@ -21,12 +21,14 @@
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <log/log.h>
 #include <cutils/str_parms.h>
 #include <cutils/properties.h>
 #include <audio_hw.h>
 #include <platform_api.h>
+#include <snd_device_rules.h>
 #include "acdb.h"
 #include "platform.h"
 #include "audio_extn.h"
@@ -145,8 +147,64 @@ typedef struct acdb_audio_cal_cfg {
 /* Audio calibration related functions */
 typedef void (*acdb_send_audio_cal_v3_t)(int, int, int, int, int);
 
+struct acdb_cal_job {
+    struct listnode list;
+    int acdb_dev_id;
+    int acdb_dev_type;
+    int app_type;
+    int sample_rate;
+    int buff_idx;
+    bool v3;
+};
+
+/*
+ * Calibration sent while a batch is open is queued to a dispatcher thread
+ * instead of being sent inline, so that the device cal of a call setup goes
+ * out while the caller applies the mixer paths. The ACDB loader is not
+ * reentrant, so there is a single dispatcher and every send is serialized
+ * on it. Enabled by vendor.audio.acdb.parallel_cal.
+ */
+struct acdb_cal_dispatcher {
+    bool enabled;
+    bool exit;
+    int batch_depth;
+    int pending;
+    struct listnode jobs;
+    pthread_mutex_t lock;
+    pthread_cond_t job_cond;
+    pthread_cond_t done_cond;
+    pthread_t worker;
+};
+
+/*
+ * Loading the ACDB databases from storage dominates platform_init(), so it
+ * runs on its own thread from the moment the sound card is known, together
+ * with the codec hwdep cal that depends on it. Anything that talks to the
+ * loader waits on acdb_wait_ready() first. Disabled by
+ * vendor.audio.acdb.async_init=false.
+ */
+struct acdb_warmup {
+    pthread_t thread;
+    bool threaded;
+    atomic_bool ready;
+    pthread_mutex_t lock;
+    int snd_card;
+    int result;
+};
+
+/* Audio capabilities of the HDMI sink, parsed from its EDID on the first
+   query after a connect or disconnect, see edid_parse_caps() */
+struct edid_caps {
+    bool valid;
+    int max_channels;        /* LPCM */
+    uint8_t lpcm_rates;      /* SAD byte 1: 32, 44.1, 48, 88.2, 96, 176.4, 192 kHz */
+    uint8_t lpcm_sizes;      /* SAD byte 2: 16, 20, 24 bit */
+    uint16_t formats;        /* bit n set when SAD format code n is listed */
+};
+
 struct platform_data {
     struct audio_device *adev;
+    struct edid_caps edid_caps;
     bool fluence_in_spkr_mode;
     bool fluence_in_voice_call;
     bool fluence_in_voice_comm;
@@ -173,6 +231,8 @@ struct platform_data {
     acdb_send_gain_dep_cal_t   acdb_send_gain_dep_cal;
     acdb_send_custom_top_t     acdb_send_custom_top;
     bool acdb_initialized;
+    struct acdb_cal_dispatcher cal_dispatcher;
+    struct acdb_warmup acdb_warmup;
 
     struct csd_data *csd;
     char ec_ref_mixer_path[64];
@@ -216,6 +276,7 @@ static int pcm_device_table[AUDIO_USECASE_MAX][2] = {
             MMAP_RECORD_PCM_DEVICE},
     [USECASE_AUDIO_RECORD_HIFI] = {MULTIMEDIA2_PCM_DEVICE,
                                    MULTIMEDIA2_PCM_DEVICE},
+    [USECASE_AUDIO_RECORD_COMPRESS] = {-1, -1}, /* pcm ids updated from platform info file */
 
     [USECASE_VOICE_CALL] = {VOICE_CALL_PCM_DEVICE,
                             VOICE_CALL_PCM_DEVICE},
@@ -542,11 +603,6 @@ static int acdb_device_table[SND_DEVICE_MAX] = {
 // Platform specific backend bit width table
 static int backend_bit_width_table[SND_DEVICE_MAX] = {0};
 
-struct name_to_index {
-    char name[100];
-    unsigned int index;
-};
-
 #define TO_NAME_INDEX(X)   #X, X
 
 /* Used to get index from parsed string */
@@ -696,6 +752,7 @@ static const struct name_to_index usecase_name_index[AUDIO_USECASE_MAX] = {
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD_LOW_LATENCY)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD_MMAP)},
     {TO_NAME_INDEX(USECASE_AUDIO_RECORD_HIFI)},
+    {TO_NAME_INDEX(USECASE_AUDIO_RECORD_COMPRESS)},
     {TO_NAME_INDEX(USECASE_VOICE_CALL)},
     {TO_NAME_INDEX(USECASE_VOICE2_CALL)},
     {TO_NAME_INDEX(USECASE_VOLTE_CALL)},
@@ -764,6 +821,11 @@ static pthread_once_t check_op_once_ctl = PTHREAD_ONCE_INIT;
 static bool is_tmus = false;
 
 static int init_be_dai_name_table(struct audio_device *adev);
+static void acdb_cal_dispatcher_init(struct platform_data *my_data);
+static void acdb_cal_dispatcher_deinit(struct platform_data *my_data);
+static void acdb_warmup_start(struct platform_data *my_data, int snd_card);
+static void acdb_wait_ready(struct platform_data *my_data);
+static void snd_device_memo_invalidate(void);
 
 static bool is_usb_snd_dev(snd_device_t snd_device)
 {
@@ -1055,6 +1117,7 @@ static void set_audiocal(void *platform, struct str_parms *parms, char *value, i
                        __func__, cal.acdb_dev_id, cal.snd_dev_id);
             goto done_key_audcal;
         }
+        acdb_wait_ready(my_data);
         if (my_data->acdb_set_audio_cal) {
             ret = my_data->acdb_set_audio_cal((void *)&cal, (void *)dptr, dlen);
         }
@@ -1081,6 +1144,7 @@ bool platform_send_gain_dep_cal(void *platform, int level)
         ALOGE("%s: dlsym error for acdb_send_gain_dep_cal", __func__);
         return ret_val;
     }
+    acdb_wait_ready(my_data);
 
     if (!voice_is_in_call(adev)) {
         ALOGV("%s: Not Voice call usecase, apply new cal for level %d",
@@ -1511,7 +1575,7 @@ void get_cvd_version(char *cvd_version, struct audio_device *adev)
     int count;
     int ret = 0;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, CVD_VERSION_MIXER_CTL);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, CVD_VERSION_MIXER_CTL);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",  __func__, CVD_VERSION_MIXER_CTL);
         goto done;
@@ -1632,7 +1696,7 @@ platform_backend_app_type_cfg_init(struct platform_data *pdata,
     struct mixer_ctl *ctl = NULL;
 
     const char *mixer_ctl_name = "App Type Config";
-    ctl = mixer_get_ctl_by_name(mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",__func__, mixer_ctl_name);
         return -1;
@@ -1690,21 +1754,21 @@ static void configure_flicker_sensor_input(struct mixer *mixer)
     const char* ctl8 = "SLIM_1_TX SampleRate";
     const char* setting8 = "KHZ_8";
 
-    ctl = mixer_get_ctl_by_name(mixer, ctl1);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, ctl1);
     mixer_ctl_set_value(ctl, 0, setting1);
-    ctl = mixer_get_ctl_by_name(mixer, ctl2);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, ctl2);
     mixer_ctl_set_enum_by_string(ctl, setting2);
-    ctl = mixer_get_ctl_by_name(mixer, ctl3);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, ctl3);
     mixer_ctl_set_enum_by_string(ctl, setting3);
-    ctl = mixer_get_ctl_by_name(mixer, ctl4);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, ctl4);
     mixer_ctl_set_enum_by_string(ctl, setting4);
-    ctl = mixer_get_ctl_by_name(mixer, ctl5);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, ctl5);
     mixer_ctl_set_enum_by_string(ctl, setting5);
-    ctl = mixer_get_ctl_by_name(mixer, ctl6);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, ctl6);
     mixer_ctl_set_value(ctl, 0, setting6);
-    ctl = mixer_get_ctl_by_name(mixer, ctl7);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, ctl7);
     mixer_ctl_set_value(ctl, 0, setting7);
-    ctl = mixer_get_ctl_by_name(mixer, ctl8);
+    ctl = audio_extn_utils_get_mixer_ctl(mixer, ctl8);
     mixer_ctl_set_enum_by_string(ctl, setting8);
 }
 
@@ -1741,6 +1805,11 @@ void *platform_init(struct audio_device *adev)
         goto init_failed;
     }
 
+    /* taken before the warmup: acdb_init() there opens and closes the
+       loader, which must not drop the last reference and unload it */
+    my_data->acdb_handle = dlopen(LIB_ACDB_LOADER, RTLD_NOW);
+    acdb_warmup_start(my_data, snd_card_num);
+
     adev->mixer = mixer_open(snd_card_num);
     snd_card_name = mixer_get_name(adev->mixer);
     my_data->hw_info = hw_info_init(snd_card_name);
@@ -1791,8 +1860,10 @@ void *platform_init(struct audio_device *adev)
 
     my_data->declared_mic_count = 0;
     /* Initialize platform specific ids and/or backends*/
+    int64_t parse_ns = audio_extn_perf_stats_kernel_begin();
     platform_info_init(platform_info_file, my_data,
                        true, &platform_set_parameters);
+    audio_extn_perf_stats_log_platform_info(parse_ns);
 
     ALOGD("%s: Loading mixer file: %s", __func__, mixer_xml_file);
     adev->audio_route = audio_route_init(snd_card_num, mixer_xml_file);
@@ -1807,6 +1878,7 @@ void *platform_init(struct audio_device *adev)
     }
     adev->snd_card = snd_card_num;
     ALOGD("%s: Opened sound card:%d", __func__, snd_card_num);
+    audio_extn_utils_mixer_ctl_cache_init(adev->mixer);
 
     //set max volume step for voice call
     property_get("ro.config.vc_call_vol_steps", value, TOSTRING(MAX_VOL_INDEX));
@@ -1881,7 +1953,6 @@ void *platform_init(struct audio_device *adev)
           my_data->fluence_in_voice_call, my_data->fluence_in_voice_comm,
           my_data->fluence_in_voice_rec, my_data->fluence_in_spkr_mode);
 
-    my_data->acdb_handle = dlopen(LIB_ACDB_LOADER, RTLD_NOW);
     if (my_data->acdb_handle == NULL) {
         ALOGE("%s: DLOPEN failed for %s", __func__, LIB_ACDB_LOADER);
     } else {
@@ -1966,15 +2037,8 @@ void *platform_init(struct audio_device *adev)
             ALOGE("%s: Could not find the symbol acdb_set_audio_cal_v2 from %s",
                   __func__, LIB_ACDB_LOADER);
 
-        int result = acdb_init(adev->snd_card);
-        if (!result) {
-            my_data->acdb_initialized = true;
-            ALOGD("ACDB initialized");
-        } else {
-            my_data->acdb_initialized = false;
-            ALOGD("ACDB initialization failed");
-        }
     }
+    acdb_cal_dispatcher_init(my_data);
 
     /* init usb */
     audio_extn_usb_init(adev);
@@ -1984,8 +2048,6 @@ void *platform_init(struct audio_device *adev)
 
     audio_extn_spkr_prot_init(adev);
 
-    audio_extn_hwdep_cal_send(adev->snd_card, my_data->acdb_handle);
-
     /* load csd client */
     platform_csd_init(my_data);
 
@@ -1996,11 +2058,19 @@ void *platform_init(struct audio_device *adev)
     if (platform_supports_app_type_cfg())
         platform_backend_app_type_cfg_init(my_data, adev->mixer);
 
+    /* decisions memoized while the configuration was loading are stale */
+    snd_device_memo_invalidate();
+
     return my_data;
 
 init_failed:
-    if (my_data)
+    if (my_data) {
+        if (my_data->acdb_warmup.threaded)
+            pthread_join(my_data->acdb_warmup.thread, (void **) NULL);
+        if (my_data->acdb_handle)
+            dlclose(my_data->acdb_handle);
         free(my_data);
+    }
     return NULL;
 }
 
@@ -2014,6 +2084,15 @@ void platform_deinit(void *platform)
     struct listnode *node;
 
     struct platform_data *my_data = (struct platform_data *)platform;
+    snd_device_memo_invalidate();
+    if (speaker_ramp.task_init) {
+        audio_extn_amp_task_release(&speaker_ramp.task);
+        speaker_ramp.task_init = false;
+        speaker_ramp.active = false;
+    }
+    acdb_wait_ready(my_data);
+    pthread_mutex_destroy(&my_data->acdb_warmup.lock);
+    acdb_cal_dispatcher_deinit(my_data);
     close_csd_client(my_data->csd);
 
     audio_extn_spkr_prot_deinit(my_data->adev);
@@ -2069,6 +2148,7 @@ void platform_deinit(void *platform)
         free(ap);
     }
 
+    audio_extn_utils_mixer_ctl_cache_deinit();
     mixer_close(my_data->adev->mixer);
     free(platform);
 
@@ -2181,45 +2261,56 @@ int platform_get_haptics_pcm_device_id()
     return HAPTICS_PCM_DEVICE;
 }
 
-static int find_index(const struct name_to_index * table, int32_t len,
-                      const char * name)
+/* sorted views of the name tables, see snd_device_rules.h */
+static const struct name_to_index *snd_device_name_sorted[SND_DEVICE_MAX];
+static const struct name_to_index *usecase_name_sorted[AUDIO_USECASE_MAX];
+static const struct name_to_index *audio_source_sorted[AUDIO_SOURCE_CNT];
+
+static struct name_to_index_map snd_device_name_map = {
+    snd_device_name_index, SND_DEVICE_MAX, 0, snd_device_name_sorted
+};
+static struct name_to_index_map usecase_name_map = {
+    usecase_name_index, AUDIO_USECASE_MAX, 0, usecase_name_sorted
+};
+static struct name_to_index_map audio_source_map = {
+    audio_source_index, AUDIO_SOURCE_CNT, 0, audio_source_sorted
+};
+
+static pthread_once_t name_to_index_once_ctl = PTHREAD_ONCE_INIT;
+
+static void init_name_to_index_maps(void)
 {
-    int ret = 0;
-    int32_t i;
+    name_to_index_map_sort(&snd_device_name_map);
+    name_to_index_map_sort(&usecase_name_map);
+    name_to_index_map_sort(&audio_source_map);
+}
 
-    if (table == NULL) {
-        ALOGE("%s: table is NULL", __func__);
-        ret = -ENODEV;
-        goto done;
-    }
+static int find_index(struct name_to_index_map *map, const char * name)
+{
+    int ret;
 
     if (name == NULL) {
         ALOGE("null key");
-        ret = -ENODEV;
-        goto done;
+        return -ENODEV;
     }
 
-    for (i=0; i < len; i++) {
-        if (!strcmp(table[i].name, name)) {
-            ret = table[i].index;
-            goto done;
-        }
-    }
-    ALOGE("%s: Could not find index for name = %s",
-            __func__, name);
-    ret = -ENODEV;
-done:
+    pthread_once(&name_to_index_once_ctl, init_name_to_index_maps);
+
+    ret = name_to_index_map_find(map, name);
+    if (ret < 0)
+        ALOGE("%s: Could not find index for name = %s",
+                __func__, name);
     return ret;
 }
 
 int platform_get_snd_device_index(char *device_name)
 {
-    return find_index(snd_device_name_index, SND_DEVICE_MAX, device_name);
+    return find_index(&snd_device_name_map, device_name);
 }
 
 int platform_get_usecase_index(const char *usecase_name)
 {
-    return find_index(usecase_name_index, AUDIO_USECASE_MAX, usecase_name);
+    return find_index(&usecase_name_map, usecase_name);
 }
 
 int platform_get_effect_config_data(snd_device_t snd_device,
@@ -2275,7 +2366,7 @@ done:
 
 int platform_get_audio_source_index(const char *audio_source_name)
 {
-    return find_index(audio_source_index, AUDIO_SOURCE_CNT, audio_source_name);
+    return find_index(&audio_source_map, audio_source_name);
 }
 
 void platform_add_operator_specific_device(snd_device_t snd_device,
@@ -2342,6 +2433,7 @@ int platform_set_snd_device_acdb_id(snd_device_t snd_device, unsigned int acdb_i
     ALOGV("%s: acdb_device_table[%s]: old = %d new = %d", __func__,
           platform_get_snd_device_name(snd_device), acdb_device_table[snd_device], acdb_id);
     acdb_device_table[snd_device] = acdb_id;
+    snd_device_memo_invalidate();
 done:
     return ret;
 }
@@ -2399,6 +2491,198 @@ static int platform_get_backend_index(snd_device_t snd_device)
     return port;
 }
 
+static void *acdb_cal_worker_loop(void *context)
+{
+    struct platform_data *my_data = (struct platform_data *)context;
+    struct acdb_cal_dispatcher *d = &my_data->cal_dispatcher;
+    struct acdb_cal_job *job;
+
+    pthread_mutex_lock(&d->lock);
+    while (!d->exit) {
+        if (list_empty(&d->jobs)) {
+            pthread_cond_wait(&d->job_cond, &d->lock);
+            continue;
+        }
+        job = node_to_item(list_head(&d->jobs), struct acdb_cal_job, list);
+        list_remove(&job->list);
+        pthread_mutex_unlock(&d->lock);
+
+        if (job->v3)
+            my_data->acdb_send_audio_cal_v3(job->acdb_dev_id, job->acdb_dev_type,
+                                            job->app_type, job->sample_rate,
+                                            job->buff_idx);
+        else
+            my_data->acdb_send_audio_cal(job->acdb_dev_id, job->acdb_dev_type);
+        free(job);
+
+        pthread_mutex_lock(&d->lock);
+        if (--d->pending == 0)
+            pthread_cond_broadcast(&d->done_cond);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return NULL;
+}
+
+static void acdb_cal_dispatcher_init(struct platform_data *my_data)
+{
+    struct acdb_cal_dispatcher *d = &my_data->cal_dispatcher;
+    list_init(&d->jobs);
+    pthread_mutex_init(&d->lock, (const pthread_mutexattr_t *) NULL);
+    pthread_cond_init(&d->job_cond, (const pthread_condattr_t *) NULL);
+    pthread_cond_init(&d->done_cond, (const pthread_condattr_t *) NULL);
+
+    if (!property_get_bool("vendor.audio.acdb.parallel_cal", false))
+        return;
+
+    if (pthread_create(&d->worker, (const pthread_attr_t *) NULL,
+                       acdb_cal_worker_loop, my_data) != 0) {
+        ALOGE("%s: failed to start calibration worker", __func__);
+        return;
+    }
+    d->enabled = true;
+}
+
+static void acdb_cal_dispatcher_deinit(struct platform_data *my_data)
+{
+    struct acdb_cal_dispatcher *d = &my_data->cal_dispatcher;
+
+    if (d->enabled) {
+        pthread_mutex_lock(&d->lock);
+        d->exit = true;
+        pthread_cond_broadcast(&d->job_cond);
+        pthread_mutex_unlock(&d->lock);
+        pthread_join(d->worker, (void **) NULL);
+    }
+    while (!list_empty(&d->jobs)) {
+        struct listnode *node = list_head(&d->jobs);
+        list_remove(node);
+        free(node_to_item(node, struct acdb_cal_job, list));
+    }
+    pthread_cond_destroy(&d->done_cond);
+    pthread_cond_destroy(&d->job_cond);
+    pthread_mutex_destroy(&d->lock);
+}
+
+static void *acdb_warmup_run(void *context)
+{
+    struct platform_data *my_data = (struct platform_data *)context;
+    struct acdb_warmup *w = &my_data->acdb_warmup;
+
+    w->result = acdb_init(w->snd_card);
+
+    /* the codec cal is read back from the databases just loaded */
+    if (my_data->acdb_handle != NULL)
+        audio_extn_hwdep_cal_send(w->snd_card, my_data->acdb_handle);
+    return NULL;
+}
+
+static void acdb_warmup_start(struct platform_data *my_data, int snd_card)
+{
+    struct acdb_warmup *w = &my_data->acdb_warmup;
+
+    pthread_mutex_init(&w->lock, (const pthread_mutexattr_t *) NULL);
+    w->snd_card = snd_card;
+    w->result = -1;
+
+    if (property_get_bool("vendor.audio.acdb.async_init", true)) {
+        if (pthread_create(&w->thread, (const pthread_attr_t *) NULL,
+                           acdb_warmup_run, my_data) == 0) {
+            w->threaded = true;
+            return;
+        }
+        ALOGW("%s: failed to start ACDB init thread, running inline", __func__);
+    }
+    acdb_warmup_run(my_data);
+    acdb_wait_ready(my_data);
+}
+
+/* completion barrier for everything that needs the ACDB loader initialized */
+static void acdb_wait_ready(struct platform_data *my_data)
+{
+    struct acdb_warmup *w = &my_data->acdb_warmup;
+
+    if (atomic_load_explicit(&w->ready, memory_order_acquire))
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->threaded) {
+        pthread_join(w->thread, (void **) NULL);
+        w->threaded = false;
+    }
+    if (!atomic_load_explicit(&w->ready, memory_order_relaxed)) {
+        my_data->acdb_initialized = w->result == 0;
+        ALOGD("ACDB initialization %s", my_data->acdb_initialized ? "done" : "failed");
+        atomic_store_explicit(&w->ready, true, memory_order_release);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* sends the cal inline unless a calibration batch is open */
+static void send_acdb_cal(struct platform_data *my_data, int acdb_dev_id,
+                          int acdb_dev_type, int app_type, int sample_rate,
+                          int buff_idx, bool v3)
+{
+    struct acdb_cal_dispatcher *d = &my_data->cal_dispatcher;
+    struct acdb_cal_job *job = NULL;
+
+    acdb_wait_ready(my_data);
+    if (d->enabled) {
+        pthread_mutex_lock(&d->lock);
+        if (d->batch_depth > 0)
+            job = (struct acdb_cal_job *)calloc(1, sizeof(struct acdb_cal_job));
+        if (job != NULL) {
+            job->acdb_dev_id = acdb_dev_id;
+            job->acdb_dev_type = acdb_dev_type;
+            job->app_type = app_type;
+            job->sample_rate = sample_rate;
+            job->buff_idx = buff_idx;
+            job->v3 = v3;
+            list_add_tail(&d->jobs, &job->list);
+            d->pending++;
+            pthread_cond_signal(&d->job_cond);
+        }
+        pthread_mutex_unlock(&d->lock);
+        if (job != NULL)
+            return;
+    }
+
+    if (v3)
+        my_data->acdb_send_audio_cal_v3(acdb_dev_id, acdb_dev_type,
+                                        app_type, sample_rate, buff_idx);
+    else
+        my_data->acdb_send_audio_cal(acdb_dev_id, acdb_dev_type);
+}
+
+int platform_begin_audio_calibration_batch(void *platform)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+    struct acdb_cal_dispatcher *d = &my_data->cal_dispatcher;
+
+    if (!d->enabled)
+        return -ENOSYS;
+
+    pthread_mutex_lock(&d->lock);
+    d->batch_depth++;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+void platform_end_audio_calibration_batch(void *platform)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+    struct acdb_cal_dispatcher *d = &my_data->cal_dispatcher;
+
+    if (!d->enabled)
+        return;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->batch_depth > 0 && --d->batch_depth == 0) {
+        while (d->pending > 0)
+            pthread_cond_wait(&d->done_cond, &d->lock);
+    }
+    pthread_mutex_unlock(&d->lock);
+}
+
 int platform_send_audio_calibration(void *platform, snd_device_t snd_device)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -2421,7 +2705,7 @@ int platform_send_audio_calibration(void *platform, snd_device_t snd_device)
             acdb_dev_type = ACDB_DEV_TYPE_OUT;
         else
             acdb_dev_type = ACDB_DEV_TYPE_IN;
-        my_data->acdb_send_audio_cal(acdb_dev_id, acdb_dev_type);
+        send_acdb_cal(my_data, acdb_dev_id, acdb_dev_type, 0, 0, 0, false);
     }
     return 0;
 }
@@ -2470,10 +2754,10 @@ int platform_send_audio_calibration_v2(void *platform, struct audio_usecase *use
             acdb_dev_type = ACDB_DEV_TYPE_IN;
 
         if (my_data->acdb_send_audio_cal_v3) {
-            my_data->acdb_send_audio_cal_v3(acdb_dev_id, acdb_dev_type,
-                                            app_type, sample_rate, i);
+            send_acdb_cal(my_data, acdb_dev_id, acdb_dev_type,
+                          app_type, sample_rate, i, true);
         } else if (my_data->acdb_send_audio_cal) {
-            my_data->acdb_send_audio_cal(acdb_dev_id, acdb_dev_type); // this version differs from internal
+            send_acdb_cal(my_data, acdb_dev_id, acdb_dev_type, 0, 0, 0, false); // this version differs from internal
         }
     }
 
@@ -2536,6 +2820,7 @@ int platform_switch_voice_call_device_post(void *platform,
     if (my_data->acdb_send_voice_cal == NULL) {
         ALOGE("%s: dlsym error for acdb_send_voice_call", __func__);
     } else {
+        acdb_wait_ready(my_data);
         acdb_rx_id = platform_get_snd_device_acdb_id(out_snd_device);
         acdb_tx_id = platform_get_snd_device_acdb_id(in_snd_device);
 
@@ -2611,7 +2896,7 @@ int platform_set_mic_break_det(void *platform, bool enable)
     struct platform_data *my_data = (struct platform_data *)platform;
     struct audio_device *adev = my_data->adev;
     const char *mixer_ctl_name = "Voice Mic Break Enable";
-    struct mixer_ctl *ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    struct mixer_ctl *ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -2694,7 +2979,7 @@ int platform_set_voice_volume(void *platform, int volume)
     vol_index = (int)percent_to_index(volume, MIN_VOL_INDEX, my_data->max_vol_index);
     set_values[0] = vol_index;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -2712,7 +2997,7 @@ int platform_set_voice_volume(void *platform, int volume)
         set_values[0] = 0;
     }
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mute_mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mute_mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mute_mixer_ctl_name);
@@ -2750,7 +3035,7 @@ int platform_set_mic_mute(void *platform, bool state)
         mixer_ctl_name = "HFP Tx Mute";
 
     set_values[0] = state;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -2793,7 +3078,7 @@ int platform_set_device_mute(void *platform, bool state, char *dir)
     }
 
     set_values[0] = state;
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -2904,11 +3189,112 @@ int platform_can_split_snd_device(snd_device_t snd_device,
     return ret;
 }
 
-snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devices)
+/*
+ * The snd device decisions below are memoized on everything they read.
+ * Stream and device state is copied into the key, so a reroute with
+ * nothing relevant changed is a key compare instead of the decision tree.
+ * State that is not worth copying (acdb ids, platform parameters, the
+ * mixer paths and fluence configuration loaded at init) bumps generation.
+ * fluence_type, fluence_in_* and source_mic_type are only written while
+ * platform_init loads the configuration, which invalidates on its way
+ * out, so they are deliberately not part of the key.
+ */
+#define SND_DEVICE_MEMO_ENTRIES 4
+
+struct out_snd_device_key {
+    uint32_t generation;
+    audio_devices_t devices;
+    int tty_mode;
+    bool in_call;
+    bool hfp_active;
+    bool enable_voicerx;
+    bool enable_hfp;
+    bool hac;
+    bool bt_wb_speech_enabled;
+    bool speaker_lr_swap;
+    bool usb_capture;
+    bool ma_usb;
+};
+
+struct in_snd_device_key {
+    uint32_t generation;
+    audio_devices_t out_device;
+    audio_devices_t in_device;
+    audio_source_t source;
+    audio_channel_mask_t channel_mask;
+    audio_mode_t mode;
+    int tty_mode;
+    int camera_orientation;
+    bool has_stream;
+    bool enable_aec;
+    bool enable_ns;
+    bool in_call;
+    bool hfp_active;
+    bool enable_hfp;
+    bool bt_wb_speech_enabled;
+    bool bluetooth_nrec;
+    bool usb_capture;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    uint32_t generation;
+    struct {
+        bool valid;
+        struct out_snd_device_key key;
+        snd_device_t snd_device;
+    } out[SND_DEVICE_MEMO_ENTRIES];
+    struct {
+        bool valid;
+        struct in_snd_device_key key;
+        snd_device_t snd_device;
+        bool ec_port;   /* decision set in->enable_ec_port */
+        bool dmic;      /* decision set DMIC_FLAG in acdb_settings */
+    } in[SND_DEVICE_MEMO_ENTRIES];
+    unsigned int out_next;
+    unsigned int in_next;
+} snd_device_memo = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void snd_device_memo_invalidate(void)
+{
+    pthread_mutex_lock(&snd_device_memo.lock);
+    snd_device_memo.generation++;
+    pthread_mutex_unlock(&snd_device_memo.lock);
+}
+
+static const struct snd_device_combo_rule out_combo_rules[] = {
+    { AUDIO_DEVICE_OUT_WIRED_HEADPHONE | AUDIO_DEVICE_OUT_WIRED_HEADSET,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES, 0 },
+    { AUDIO_DEVICE_OUT_LINE,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_LINE, 0 },
+    { AUDIO_DEVICE_OUT_WIRED_HEADPHONE | AUDIO_DEVICE_OUT_WIRED_HEADSET,
+      AUDIO_DEVICE_OUT_SPEAKER_SAFE, SND_DEVICE_OUT_SPEAKER_SAFE_AND_HEADPHONES, 0 },
+    { AUDIO_DEVICE_OUT_LINE,
+      AUDIO_DEVICE_OUT_SPEAKER_SAFE, SND_DEVICE_OUT_SPEAKER_SAFE_AND_LINE, 0 },
+    { AUDIO_DEVICE_OUT_AUX_DIGITAL,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_HDMI, 0 },
+    { AUDIO_DEVICE_OUT_ALL_SCO,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_BT_SCO,
+      SND_DEVICE_OUT_SPEAKER_AND_BT_SCO_WB },
+    { AUDIO_DEVICE_OUT_ALL_SCO,
+      AUDIO_DEVICE_OUT_SPEAKER_SAFE, SND_DEVICE_OUT_SPEAKER_SAFE_AND_BT_SCO,
+      SND_DEVICE_OUT_SPEAKER_SAFE_AND_BT_SCO_WB },
+    { AUDIO_DEVICE_OUT_USB_DEVICE | AUDIO_DEVICE_OUT_USB_HEADSET,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_USB_HEADSET, 0 },
+    { AUDIO_DEVICE_OUT_USB_DEVICE | AUDIO_DEVICE_OUT_USB_HEADSET,
+      AUDIO_DEVICE_OUT_SPEAKER_SAFE, SND_DEVICE_OUT_SPEAKER_SAFE_AND_USB_HEADSET, 0 },
+    { AUDIO_DEVICE_OUT_ALL_A2DP,
+      AUDIO_DEVICE_OUT_SPEAKER, SND_DEVICE_OUT_SPEAKER_AND_BT_A2DP, 0 },
+    { AUDIO_DEVICE_OUT_ALL_A2DP,
+      AUDIO_DEVICE_OUT_SPEAKER_SAFE, SND_DEVICE_OUT_SPEAKER_SAFE_AND_BT_A2DP, 0 },
+};
+
+static snd_device_t select_output_snd_device(struct platform_data *my_data,
+                                             audio_devices_t devices)
 {
-    struct platform_data *my_data = (struct platform_data *)platform;
     struct audio_device *adev = my_data->adev;
-    audio_mode_t mode = adev->mode;
     snd_device_t snd_device = SND_DEVICE_NONE;
 
     ALOGV("%s: enter: output devices(%#x)", __func__, devices);
@@ -2919,58 +3305,11 @@ snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devi
     }
 
     if (popcount(devices) == 2) {
-        if (devices == (AUDIO_DEVICE_OUT_WIRED_HEADPHONE |
-                        AUDIO_DEVICE_OUT_SPEAKER) ||
-                devices == (AUDIO_DEVICE_OUT_WIRED_HEADSET |
-                            AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_HEADPHONES;
-        } else if (devices == (AUDIO_DEVICE_OUT_LINE |
-                               AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_LINE;
-        } else if (devices == (AUDIO_DEVICE_OUT_WIRED_HEADPHONE |
-                               AUDIO_DEVICE_OUT_SPEAKER_SAFE) ||
-                   devices == (AUDIO_DEVICE_OUT_WIRED_HEADSET |
-                               AUDIO_DEVICE_OUT_SPEAKER_SAFE)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_SAFE_AND_HEADPHONES;
-        } else if (devices == (AUDIO_DEVICE_OUT_LINE |
-                               AUDIO_DEVICE_OUT_SPEAKER_SAFE)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_SAFE_AND_LINE;
-        } else if (devices == (AUDIO_DEVICE_OUT_AUX_DIGITAL |
-                               AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_HDMI;
-        } else if ((devices & AUDIO_DEVICE_OUT_ALL_SCO) &&
-                   ((devices & ~AUDIO_DEVICE_OUT_ALL_SCO) == AUDIO_DEVICE_OUT_SPEAKER)) {
-            snd_device = adev->bt_wb_speech_enabled ?
-                    SND_DEVICE_OUT_SPEAKER_AND_BT_SCO_WB :
-                    SND_DEVICE_OUT_SPEAKER_AND_BT_SCO;
-        } else if ((devices & AUDIO_DEVICE_OUT_ALL_SCO) &&
-                         ((devices & ~AUDIO_DEVICE_OUT_ALL_SCO) == AUDIO_DEVICE_OUT_SPEAKER_SAFE)) {
-            snd_device = adev->bt_wb_speech_enabled ?
-                    SND_DEVICE_OUT_SPEAKER_SAFE_AND_BT_SCO_WB :
-                    SND_DEVICE_OUT_SPEAKER_SAFE_AND_BT_SCO;
-        } else if ((devices == (AUDIO_DEVICE_OUT_USB_DEVICE |
-                               AUDIO_DEVICE_OUT_SPEAKER)) ||
-                (devices == (AUDIO_DEVICE_OUT_USB_HEADSET |
-                                               AUDIO_DEVICE_OUT_SPEAKER))) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_USB_HEADSET;
-        } else if ((devices == (AUDIO_DEVICE_OUT_USB_DEVICE |
-                               AUDIO_DEVICE_OUT_SPEAKER_SAFE)) ||
-                (devices == (AUDIO_DEVICE_OUT_USB_HEADSET |
-                                               AUDIO_DEVICE_OUT_SPEAKER_SAFE))) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_SAFE_AND_USB_HEADSET;
-        } else if ((devices & AUDIO_DEVICE_OUT_SPEAKER) &&
-                   (devices & AUDIO_DEVICE_OUT_ALL_A2DP)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_AND_BT_A2DP;
-        }  else if ((devices & AUDIO_DEVICE_OUT_SPEAKER_SAFE) &&
-                   (devices & AUDIO_DEVICE_OUT_ALL_A2DP)) {
-            snd_device = SND_DEVICE_OUT_SPEAKER_SAFE_AND_BT_A2DP;
-        } else {
+        snd_device = snd_device_combo_lookup(out_combo_rules, ARRAY_SIZE(out_combo_rules),
+                                             devices, adev->bt_wb_speech_enabled);
+        if (snd_device == SND_DEVICE_NONE)
             ALOGE("%s: Invalid combo device(%#x)", __func__, devices);
-            goto exit;
-        }
-        if (snd_device != SND_DEVICE_NONE) {
-            goto exit;
-        }
+        goto exit;
     }
 
     if (popcount(devices) != 1) {
@@ -3223,19 +3562,13 @@ static snd_device_t get_snd_device_for_voice_comm(struct platform_data *my_data,
 }
 #endif //DYNAMIC_ECNS_ENABLED
 
-snd_device_t platform_get_input_snd_device(void *platform,
-                                           struct stream_in *in,
-                                           audio_devices_t out_device)
+static snd_device_t select_input_snd_device(struct platform_data *my_data,
+                                            struct stream_in *in,
+                                            audio_devices_t out_device)
 {
-    struct platform_data *my_data = (struct platform_data *)platform;
     struct audio_device *adev = my_data->adev;
     audio_mode_t mode = adev->mode;
     snd_device_t snd_device = SND_DEVICE_NONE;
-
-    if (in == NULL) {
-        in = adev_get_active_input(adev);
-    }
-
     audio_source_t source = (in == NULL) ? AUDIO_SOURCE_DEFAULT : in->source;
     audio_devices_t in_device =
         ((in == NULL) ? AUDIO_DEVICE_NONE : in->device) & ~AUDIO_DEVICE_BIT_IN;
@@ -3575,6 +3908,151 @@ exit:
     return snd_device;
 }
 
+snd_device_t platform_get_output_snd_device(void *platform, audio_devices_t devices)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+    struct audio_device *adev = my_data->adev;
+    struct out_snd_device_key key;
+    snd_device_t snd_device;
+    unsigned int i;
+
+    /* zeroed so the padding compares equal too */
+    memset(&key, 0, sizeof(key));
+    key.devices = devices;
+    key.tty_mode = adev->voice.tty_mode;
+    key.in_call = voice_is_in_call(adev);
+    key.hfp_active = audio_extn_hfp_is_active(adev);
+    key.enable_voicerx = adev->enable_voicerx;
+    key.enable_hfp = adev->enable_hfp;
+    key.hac = adev->voice.hac;
+    key.bt_wb_speech_enabled = adev->bt_wb_speech_enabled;
+    key.speaker_lr_swap = my_data->speaker_lr_swap;
+    key.usb_capture = audio_extn_usb_is_capture_supported();
+    key.ma_usb = audio_extn_ma_supported_usb();
+
+    pthread_mutex_lock(&snd_device_memo.lock);
+    key.generation = snd_device_memo.generation;
+    for (i = 0; i < SND_DEVICE_MEMO_ENTRIES; i++) {
+        if (snd_device_memo.out[i].valid &&
+            memcmp(&snd_device_memo.out[i].key, &key, sizeof(key)) == 0) {
+            snd_device = snd_device_memo.out[i].snd_device;
+            pthread_mutex_unlock(&snd_device_memo.lock);
+            ALOGV("%s: devices(%#x) memoized snd_device(%s)", __func__, devices,
+                  device_table[snd_device]);
+            return snd_device;
+        }
+    }
+    pthread_mutex_unlock(&snd_device_memo.lock);
+
+    snd_device = select_output_snd_device(my_data, devices);
+
+    pthread_mutex_lock(&snd_device_memo.lock);
+    /* a decision made against an older generation is not kept */
+    if (key.generation == snd_device_memo.generation) {
+        i = snd_device_memo.out_next++ % SND_DEVICE_MEMO_ENTRIES;
+        snd_device_memo.out[i].valid = true;
+        snd_device_memo.out[i].key = key;
+        snd_device_memo.out[i].snd_device = snd_device;
+    }
+    pthread_mutex_unlock(&snd_device_memo.lock);
+    return snd_device;
+}
+
+snd_device_t platform_get_input_snd_device(void *platform,
+                                           struct stream_in *in,
+                                           audio_devices_t out_device)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+    struct audio_device *adev = my_data->adev;
+    struct in_snd_device_key key;
+    snd_device_t snd_device;
+    bool ec_port_before = false, ec_port = false, dmic, cache;
+    int acdb_dmic;
+    unsigned int i;
+
+    if (in == NULL) {
+        in = adev_get_active_input(adev);
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.out_device = out_device;
+    key.mode = adev->mode;
+    key.tty_mode = adev->voice.tty_mode;
+    key.camera_orientation = adev->camera_orientation;
+    key.in_call = voice_is_in_call(adev);
+    key.hfp_active = audio_extn_hfp_is_active(adev);
+    key.enable_hfp = adev->enable_hfp;
+    key.bt_wb_speech_enabled = adev->bt_wb_speech_enabled;
+    key.bluetooth_nrec = adev->bluetooth_nrec;
+    key.usb_capture = audio_extn_usb_is_capture_supported();
+    if (in != NULL) {
+        key.has_stream = true;
+        key.in_device = in->device;
+        key.source = in->source;
+        key.channel_mask = in->channel_mask;
+        key.enable_aec = in->enable_aec;
+        key.enable_ns = in->enable_ns;
+    }
+
+    pthread_mutex_lock(&snd_device_memo.lock);
+    key.generation = snd_device_memo.generation;
+    for (i = 0; i < SND_DEVICE_MEMO_ENTRIES; i++) {
+        if (snd_device_memo.in[i].valid &&
+            memcmp(&snd_device_memo.in[i].key, &key, sizeof(key)) == 0) {
+            snd_device = snd_device_memo.in[i].snd_device;
+            if (snd_device_memo.in[i].ec_port)
+                in->enable_ec_port = true;
+            if (snd_device_memo.in[i].dmic)
+                adev->acdb_settings |= DMIC_FLAG;
+            pthread_mutex_unlock(&snd_device_memo.lock);
+            ALOGV("%s: out_device(%#x) memoized in_snd_device(%s)", __func__, out_device,
+                  device_table[snd_device]);
+            return snd_device;
+        }
+    }
+    pthread_mutex_unlock(&snd_device_memo.lock);
+
+    /*
+     * The decision may also set in->enable_ec_port and DMIC_FLAG. Clear
+     * both around it to see whether it does, so a memo hit can repeat it.
+     */
+    if (in != NULL) {
+        ec_port_before = in->enable_ec_port;
+        in->enable_ec_port = false;
+    }
+    acdb_dmic = adev->acdb_settings & DMIC_FLAG;
+    adev->acdb_settings &= ~DMIC_FLAG;
+
+    snd_device = select_input_snd_device(my_data, in, out_device);
+
+    dmic = (adev->acdb_settings & DMIC_FLAG) != 0;
+    adev->acdb_settings |= acdb_dmic;
+    if (in != NULL) {
+        ec_port = in->enable_ec_port;
+        in->enable_ec_port |= ec_port_before;
+    }
+
+    /*
+     * A hit replays in->enable_ec_port and DMIC_FLAG but nothing else.
+     * The only other side effect in select_input_snd_device is the
+     * platform_set_echo_reference of the HFP speaker mic, so that result
+     * is never memoized and always reruns the decision.
+     */
+    cache = snd_device != SND_DEVICE_IN_VOICE_SPEAKER_MIC_HFP;
+
+    pthread_mutex_lock(&snd_device_memo.lock);
+    if (cache && key.generation == snd_device_memo.generation) {
+        i = snd_device_memo.in_next++ % SND_DEVICE_MEMO_ENTRIES;
+        snd_device_memo.in[i].valid = true;
+        snd_device_memo.in[i].key = key;
+        snd_device_memo.in[i].snd_device = snd_device;
+        snd_device_memo.in[i].ec_port = ec_port;
+        snd_device_memo.in[i].dmic = dmic;
+    }
+    pthread_mutex_unlock(&snd_device_memo.lock);
+    return snd_device;
+}
+
 int platform_set_hdmi_channels(void *platform,  int channel_count)
 {
     struct platform_data *my_data = (struct platform_data *)platform;
@@ -3598,7 +4076,7 @@ int platform_set_hdmi_channels(void *platform,  int channel_count)
     default:
         channel_cnt_str = "Two"; break;
     }
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -3609,24 +4087,25 @@ int platform_set_hdmi_channels(void *platform,  int channel_count)
     return 0;
 }
 
-int platform_edid_get_max_channels(void *platform)
+/* parses the SAD blocks of the sink into my_data->edid_caps, returns 0 if
+   they could be read */
+static int edid_parse_caps(struct platform_data *my_data)
 {
-    struct platform_data *my_data = (struct platform_data *)platform;
     struct audio_device *adev = my_data->adev;
+    struct edid_caps *caps = &my_data->edid_caps;
     char block[MAX_SAD_BLOCKS * SAD_BLOCK_SIZE];
     char *sad = block;
     int num_audio_blocks;
-    int channel_count;
-    int max_channels = 0;
+    int format, channel_count;
     int i, ret, count;
 
     struct mixer_ctl *ctl;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, AUDIO_DATA_BLOCK_MIXER_CTL);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, AUDIO_DATA_BLOCK_MIXER_CTL);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, AUDIO_DATA_BLOCK_MIXER_CTL);
-        return 0;
+        return -ENODEV;
     }
 
     mixer_ctl_update(ctl);
@@ -3640,28 +4119,55 @@ int platform_edid_get_max_channels(void *platform)
     ret = mixer_ctl_get_array(ctl, block, count);
     if (ret != 0) {
         ALOGE("%s: mixer_ctl_get_array() failed to get EDID info", __func__);
-        return 0;
+        return -EIO;
     }
 
     /* Calculate the number of SAD blocks */
     num_audio_blocks = count / SAD_BLOCK_SIZE;
+    /* the sink announces LPCM at least once it is fully connected */
+    if (num_audio_blocks == 0)
+        return -EAGAIN;
 
-    for (i = 0; i < num_audio_blocks; i++) {
-        /* Only consider LPCM blocks */
-        if ((sad[0] >> 3) != EDID_FORMAT_LPCM) {
-            sad += 3;
+    memset(caps, 0, sizeof(*caps));
+    for (i = 0; i < num_audio_blocks; i++, sad += SAD_BLOCK_SIZE) {
+        format = (sad[0] >> 3) & 0xf;
+        caps->formats |= 1 << format;
+
+        /* Only consider LPCM blocks for channels, rates and sizes */
+        if (format != EDID_FORMAT_LPCM)
             continue;
-        }
 
         channel_count = (sad[0] & 0x7) + 1;
-        if (channel_count > max_channels)
-            max_channels = channel_count;
-
-        /* Advance to next block */
-        sad += 3;
+        if (channel_count > caps->max_channels)
+            caps->max_channels = channel_count;
+        caps->lpcm_rates |= sad[1] & 0x7f;
+        caps->lpcm_sizes |= sad[2] & 0x7;
     }
+    caps->valid = true;
+
+    ALOGI("%s: %d LPCM channels, rates 0x%x, sizes 0x%x, passthrough formats 0x%x", __func__,
+          caps->max_channels, caps->lpcm_rates, caps->lpcm_sizes,
+          caps->formats & ~(1 << EDID_FORMAT_LPCM));
+    return 0;
+}
+
+/* must be called with hw device mutex locked */
+int platform_edid_get_max_channels(void *platform)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
 
-    return max_channels;
+    if (!my_data->edid_caps.valid && edid_parse_caps(my_data) != 0)
+        return 0;
+
+    return my_data->edid_caps.max_channels;
+}
+
+/* must be called with hw device mutex locked */
+void platform_edid_invalidate(void *platform)
+{
+    struct platform_data *my_data = (struct platform_data *)platform;
+
+    my_data->edid_caps.valid = false;
 }
 
 int platform_set_incall_recording_session_id(void *platform,
@@ -3675,7 +4181,7 @@ int platform_set_incall_recording_session_id(void *platform,
     int num_ctl_values;
     int i;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
               __func__, mixer_ctl_name);
@@ -3711,7 +4217,7 @@ int platform_set_incall_recording_session_channels(void *platform,
     const char *mixer_ctl_name = "Voc Rec Config";
     int num_ctl_values;
     int i;
-    struct mixer_ctl *ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    struct mixer_ctl *ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
 
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",
@@ -3826,6 +4332,7 @@ int platform_set_parameters(void *platform, struct str_parms *parms)
 
         list_add_tail(&operator_info_list, &info->list);
         ALOGV("%s: add operator[%s] mccmnc[%s]", __func__, info->name, info->mccmnc);
+        snd_device_memo_invalidate();
     }
 
     memset(value, 0, len + 1);
@@ -3992,15 +4499,86 @@ done:
 }
 
 #define DEFAULT_NOMINAL_SPEAKER_GAIN 20
+#define SPEAKER_GAIN_RAMP_STEP_NS 1000000LL
+
+/* Ramp up started by ramp_speaker_gain(), stepped by the amp service so
+ * routing does not wait for it. Only touched by the routing thread while
+ * the task is cancelled or done. */
+static struct {
+    struct amp_task task;
+    bool task_init;
+    bool active;   /* ramp queued or running */
+    struct mixer_ctl *ctl_left;
+    struct mixer_ctl *ctl_right;
+    int gain;      /* next gain to set */
+    int end_gain;
+} speaker_ramp;
+
+static int set_speaker_gain(struct mixer_ctl *ctl_left, struct mixer_ctl *ctl_right, int gain)
+{
+    //ALOGV("setting speaker gain to %d", gain);
+    if (mixer_ctl_set_value(ctl_left, 0, gain)) {
+        ALOGE("%s: error setting left speaker gain to %d", __func__, gain);
+        return -EINVAL;
+    }
+    if (mixer_ctl_set_value(ctl_right, 0, gain)) {
+        ALOGE("%s: error setting right speaker gain to %d", __func__, gain);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+// backup_gain: gain to try to set in case of an error during ramp
+static void ramp_speaker_gain_sync(struct mixer_ctl *ctl_left, struct mixer_ctl *ctl_right,
+                                   int start_gain, int end_gain, int backup_gain)
+{
+    const int step = end_gain >= start_gain ? +1 : -1;
+    int i;
+
+    for (i = start_gain ; i != (end_gain + step) ; i += step) {
+        if (set_speaker_gain(ctl_left, ctl_right, i)) {
+            // an error occured during the ramp, let's still try to go back to a safe volume
+            set_speaker_gain(ctl_left, ctl_right, backup_gain);
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+static int64_t speaker_gain_ramp_run(struct amp_task *task __unused)
+{
+    if (set_speaker_gain(speaker_ramp.ctl_left, speaker_ramp.ctl_right, speaker_ramp.gain)) {
+        set_speaker_gain(speaker_ramp.ctl_left, speaker_ramp.ctl_right, speaker_ramp.end_gain);
+        speaker_ramp.active = false;
+        return -1;
+    }
+    if (speaker_ramp.gain >= speaker_ramp.end_gain) {
+        speaker_ramp.active = false;
+        return -1;
+    }
+    speaker_ramp.gain++;
+    return SPEAKER_GAIN_RAMP_STEP_NS;
+}
+
+/* Ramping down waits for the ramp, the device switch that follows must not
+ * start before the speaker is muted. Ramping up returns right away and
+ * completes on the amp service, until the next ramp cancels it. */
 int ramp_speaker_gain(struct audio_device *adev, bool ramp_up, int target_ramp_up_gain) {
-    // backup_gain: gain to try to set in case of an error during ramp
-    int start_gain, end_gain, step, backup_gain, i;
-    bool error = false;
-    const struct mixer_ctl *ctl;
+    int start_gain, end_gain;
+    bool interrupted = false;
     const char *mixer_ctl_name_gain_left = "Left Speaker Gain";
     const char *mixer_ctl_name_gain_right = "Right Speaker Gain";
-    struct mixer_ctl *ctl_left = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name_gain_left);
-    struct mixer_ctl *ctl_right = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name_gain_right);
+    struct mixer_ctl *ctl_left = audio_extn_utils_get_mixer_ctl(adev->mixer,
+                                                      mixer_ctl_name_gain_left);
+    struct mixer_ctl *ctl_right = audio_extn_utils_get_mixer_ctl(adev->mixer,
+                                                      mixer_ctl_name_gain_right);
+
+    if (speaker_ramp.task_init) {
+        audio_extn_amp_task_cancel(&speaker_ramp.task);
+        interrupted = speaker_ramp.active;
+        speaker_ramp.active = false;
+    }
+
     if (!ctl_left || !ctl_right) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s or %s, not applying speaker gain ramp",
                       __func__, mixer_ctl_name_gain_left, mixer_ctl_name_gain_right);
@@ -4014,40 +4592,31 @@ int ramp_speaker_gain(struct audio_device *adev, bool ramp_up, int target_ramp_u
     if (ramp_up) {
         start_gain = 0;
         end_gain = target_ramp_up_gain > 0 ? target_ramp_up_gain : DEFAULT_NOMINAL_SPEAKER_GAIN;
-        step = +1;
-        backup_gain = end_gain;
+
+        if (!speaker_ramp.task_init &&
+            audio_extn_amp_task_init(&speaker_ramp.task, "speaker gain ramp",
+                                     speaker_gain_ramp_run, NULL, 0) == 0)
+            speaker_ramp.task_init = true;
+        if (speaker_ramp.task_init) {
+            speaker_ramp.ctl_left = ctl_left;
+            speaker_ramp.ctl_right = ctl_right;
+            speaker_ramp.gain = start_gain;
+            speaker_ramp.end_gain = end_gain;
+            speaker_ramp.active = true;
+            if (audio_extn_amp_task_schedule(&speaker_ramp.task, 0) == 0)
+                return start_gain;
+            speaker_ramp.active = false;
+        }
+        ramp_speaker_gain_sync(ctl_left, ctl_right, start_gain, end_gain, end_gain);
     } else {
         // using same gain on left and right
         const int left_gain = mixer_ctl_get_value(ctl_left, 0);
         start_gain = left_gain > 0 ? left_gain : DEFAULT_NOMINAL_SPEAKER_GAIN;
         end_gain = 0;
-        step = -1;
-        backup_gain = start_gain;
-    }
-    for (i = start_gain ; i != (end_gain + step) ; i += step) {
-        //ALOGV("setting speaker gain to %d", i);
-        if (mixer_ctl_set_value(ctl_left, 0, i)) {
-            ALOGE("%s: error setting %s to %d during gain ramp",
-                    __func__, mixer_ctl_name_gain_left, i);
-            error = true;
-            break;
-        }
-        if (mixer_ctl_set_value(ctl_right, 0, i)) {
-            ALOGE("%s: error setting %s to %d during gain ramp",
-                    __func__, mixer_ctl_name_gain_right, i);
-            error = true;
-            break;
-        }
-        usleep(1000);
-    }
-    if (error) {
-        // an error occured during the ramp, let's still try to go back to a safe volume
-        if (mixer_ctl_set_value(ctl_left, 0, backup_gain)) {
-            ALOGE("%s: error restoring left gain to %d", __func__, backup_gain);
-        }
-        if (mixer_ctl_set_value(ctl_right, 0, backup_gain)) {
-            ALOGE("%s: error restoring right gain to %d", __func__, backup_gain);
-        }
+        ramp_speaker_gain_sync(ctl_left, ctl_right, start_gain, end_gain, start_gain);
+        // a cut short ramp up has not reached the gain to restore yet
+        if (interrupted)
+            start_gain = speaker_ramp.end_gain;
     }
     return start_gain;
 }
@@ -4073,7 +4642,7 @@ int platform_set_swap_mixer(struct audio_device *adev, bool swap_channels)
         audio_route_apply_and_update_path(adev->audio_route, mixer_path);
     }
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer cmd - %s",__func__, mixer_ctl_name);
         return -EINVAL;
@@ -4198,6 +4767,7 @@ int platform_snd_card_update(void *platform, card_status_t status)
     struct audio_device *adev = my_data->adev;
 
     if (status == CARD_STATUS_ONLINE) {
+        acdb_wait_ready(my_data);
         if (my_data->acdb_send_custom_top)
             my_data->acdb_send_custom_top();
     }
@@ -4231,7 +4801,7 @@ int platform_set_backend_cfg(const struct audio_device* adev,
         (bit_width != my_data->current_backend_cfg[backend_idx].bit_width)) {
 
         struct  mixer_ctl *ctl = NULL;
-        ctl = mixer_get_ctl_by_name(adev->mixer,
+        ctl = audio_extn_utils_get_mixer_ctl(adev->mixer,
                                     my_data->current_backend_cfg[backend_idx].bitwidth_mixer_ctl);
         if (!ctl) {
             ALOGE("%s:becf: afe: Could not get ctl for mixer command - %s",
@@ -4312,7 +4882,7 @@ int platform_set_backend_cfg(const struct audio_device* adev,
                 break;
         }
 
-        ctl = mixer_get_ctl_by_name(adev->mixer,
+        ctl = audio_extn_utils_get_mixer_ctl(adev->mixer,
                                     my_data->current_backend_cfg[backend_idx].samplerate_mixer_ctl);
         if(!ctl) {
             ALOGE("%s:becf: afe: Could not get ctl for mixer command - %s",
@@ -4351,7 +4921,7 @@ int platform_set_backend_cfg(const struct audio_device* adev,
                 channel_cnt_str = "Two"; break;
         }
 
-        ctl = mixer_get_ctl_by_name(adev->mixer,
+        ctl = audio_extn_utils_get_mixer_ctl(adev->mixer,
                                     my_data->current_backend_cfg[backend_idx].channels_mixer_ctl);
         if (!ctl) {
             ALOGE("%s:becf: afe: Could not get ctl for mixer command - %s",
@@ -4383,6 +4953,22 @@ static int platform_get_snd_device_bit_width(snd_device_t snd_device)
     return backend_bit_width_table[snd_device];
 }
 
+/*
+ * true when the config differs from the one the backend runs at, in the
+ * fields the backend has a mixer control for. A difference in any other
+ * field would force a reroute that writes nothing.
+ */
+static bool backend_cfg_differs(const struct platform_data *my_data, int backend_idx,
+                                unsigned int bit_width, unsigned int sample_rate,
+                                unsigned int channels)
+{
+    const codec_backend_cfg_t *current = &my_data->current_backend_cfg[backend_idx];
+
+    return (current->bitwidth_mixer_ctl && bit_width != current->bit_width) ||
+           (current->samplerate_mixer_ctl && sample_rate != current->sample_rate) ||
+           (current->channels_mixer_ctl && channels != current->channels);
+}
+
 /*
  * return backend_idx on which voice call is active
  */
@@ -4451,9 +5037,7 @@ static bool platform_check_capture_backend_cfg(struct audio_device* adev,
 
     // Force routing if the expected bitwdith or samplerate
     // is not same as current backend comfiguration
-    if ((bit_width != my_data->current_backend_cfg[backend_idx].bit_width) ||
-        (sample_rate != my_data->current_backend_cfg[backend_idx].sample_rate) ||
-        (channels != my_data->current_backend_cfg[backend_idx].channels)) {
+    if (backend_cfg_differs(my_data, backend_idx, bit_width, sample_rate, channels)) {
         backend_cfg->bit_width = bit_width;
         backend_cfg->sample_rate= sample_rate;
         backend_cfg->channels = channels;
@@ -4559,8 +5143,12 @@ static bool platform_check_playback_backend_cfg(struct audio_device* adev,
         bit_width = CODEC_BACKEND_DEFAULT_BIT_WIDTH;
         sample_rate =  CODEC_BACKEND_DEFAULT_SAMPLE_RATE;
         channels = CODEC_BACKEND_DEFAULT_CHANNELS;
-    } else {
+    } else if (backend_idx == USB_AUDIO_RX_BACKEND ||
+               backend_idx == HEADPHONE_BACKEND) {
         /*
+         * The other backends run at a fixed configuration set below, only
+         * these need the scan of the active usecases.
+         *
          * The backend should be configured at highest bit width and/or
          * sample rate amongst all playback usecases.
          * If the selected sample rate and/or bit width differ with
@@ -4614,9 +5202,7 @@ static bool platform_check_playback_backend_cfg(struct audio_device* adev,
 
     // Force routing if the expected bitwdith or samplerate
     // is not same as current backend comfiguration
-    if (bit_width != my_data->current_backend_cfg[backend_idx].bit_width ||
-        sample_rate != my_data->current_backend_cfg[backend_idx].sample_rate ||
-        channels != my_data->current_backend_cfg[backend_idx].channels) {
+    if (backend_cfg_differs(my_data, backend_idx, bit_width, sample_rate, channels)) {
         backend_cfg->bit_width = bit_width;
         backend_cfg->sample_rate = sample_rate;
         backend_cfg->channels = channels;
@@ -4720,7 +5306,7 @@ static int init_be_dai_name_table(struct audio_device *adev)
     int i, j, ret, size;
     bool valid_hw_interface;
 
-    ctl = mixer_get_ctl_by_name(adev->mixer, mixer_ctl_name);
+    ctl = audio_extn_utils_get_mixer_ctl(adev->mixer, mixer_ctl_name);
     if (!ctl) {
         ALOGE("%s: Could not get ctl for mixer name %s\n",
                __func__, mixer_ctl_name);
@@ -5020,6 +5606,7 @@ bool platform_sound_trigger_usecase_needs_event(audio_usecase_t uc_id)
     case USECASE_AUDIO_RECORD_LOW_LATENCY:
     case USECASE_AUDIO_RECORD_MMAP:
     case USECASE_AUDIO_RECORD_HIFI:
+    case USECASE_AUDIO_RECORD_COMPRESS:
     case USECASE_AUDIO_RECORD_VOIP:
     case USECASE_VOICEMMODE1_CALL:
     case USECASE_VOICEMMODE2_CALL:
@@ -5171,7 +5758,7 @@ int platform_set_usb_service_interval(void *platform,
         return -1;
     }
     const char *ctl_name = "USB_AUDIO_RX service_interval";
-    struct mixer_ctl *ctl = mixer_get_ctl_by_name(_platform->adev->mixer,
+    struct mixer_ctl *ctl = audio_extn_utils_get_mixer_ctl(_platform->adev->mixer,
                                                   ctl_name);
     if (!ctl) {
         ALOGV("%s: could not get mixer %s", __func__, ctl_name);
@@ -5202,7 +5789,7 @@ int platform_get_usb_service_interval(void *platform,
         return -1;
     }
     const char *ctl_name = "USB_AUDIO_RX service_interval";
-    struct mixer_ctl *ctl = mixer_get_ctl_by_name(_platform->adev->mixer,
+    struct mixer_ctl *ctl = audio_extn_utils_get_mixer_ctl(_platform->adev->mixer,
                                                   ctl_name);
     if (!ctl) {
         ALOGV("%s: could not get mixer %s", __func__, ctl_name);
@@ -79,6 +79,10 @@ int platform_get_effect_config_data(snd_device_t snd_device,
 int platform_send_audio_calibration(void *platform, snd_device_t snd_device);
 int platform_send_audio_calibration_v2(void *platform, struct audio_usecase *usecase,
                                        int app_type, int sample_rate);
+/* calibration sent until the batch ends may be delivered concurrently,
+   ending the batch waits for all of it */
+int platform_begin_audio_calibration_batch(void *platform);
+void platform_end_audio_calibration_batch(void *platform);
 int platform_set_acdb_metainfo_key(void *platform, char *name, int key);
 int platform_get_default_app_type_v2(void *platform, enum usecase_type_t type, int *app_type);
 int platform_switch_voice_call_device_pre(void *platform);
@@ -107,6 +111,7 @@ snd_device_t platform_get_input_snd_device(void *platform,
                                            audio_devices_t out_device);
 int platform_set_hdmi_channels(void *platform, int channel_count);
 int platform_edid_get_max_channels(void *platform);
+void platform_edid_invalidate(void *platform);
 void platform_add_operator_specific_device(snd_device_t snd_device,
                                            const char *operator,
                                            const char *mixer_path,
@@ -216,6 +221,9 @@ int platform_get_audio_source_index(const char *audio_source_name);
 
 void platform_set_audio_usecase_delay(audio_usecase_t usecase, int delay_ms);
 
+/* Delay in Us */
+int64_t platform_get_audio_usecase_delay(audio_usecase_t usecase);
+
 /* callback functions from platform to common audio HAL */
 struct stream_in *adev_get_active_input(const struct audio_device *adev);
 
@@ -18,9 +18,17 @@
 #define LOG_NDDEBUG 0
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <expat.h>
 #include <log/log.h>
+#include <cutils/properties.h>
 #include <audio_hw.h>
 #include "platform_api.h"
 #include <platform.h>
@@ -35,6 +43,21 @@
  */
 #define MANDATORY_MICROPHONE_CHARACTERISTICS (1 << 10) - 1
 
+/*
+ * Optional cache of the parsed XML element stream. The cache stores the
+ * start/end tag events with their attributes and is replayed through the
+ * same start_tag()/end_tag() handlers, so it skips the expat parse but
+ * applies exactly the same settings. It is keyed by the source file size
+ * and mtime and falls back to the XML when stale or corrupt.
+ */
+#define PLATFORM_INFO_CACHE_PROPERTY    "persist.vendor.audio.platform_info.cache"
+#define PLATFORM_INFO_CACHE_DIR         "/data/vendor/audio"
+#define PLATFORM_INFO_CACHE_MAGIC       0x43495051 /* "QPIC" */
+#define PLATFORM_INFO_CACHE_VERSION     1
+#define PLATFORM_INFO_CACHE_MAX_ATTRS   64
+#define PLATFORM_INFO_CACHE_TAG_START   'S'
+#define PLATFORM_INFO_CACHE_TAG_END     'E'
+
 typedef enum {
     ROOT,
     ACDB,
@@ -1080,6 +1103,254 @@ static void end_tag(void *userdata __unused, const XML_Char *tag_name)
     }
 }
 
+struct platform_info_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t  src_size;
+    int64_t  src_mtime_sec;
+    int64_t  src_mtime_nsec;
+    uint32_t payload_size;
+    uint32_t payload_hash;
+};
+
+struct platform_info_recorder {
+    uint8_t *buf;
+    size_t   size;
+    size_t   capacity;
+    bool     failed;
+};
+
+static uint32_t platform_info_cache_hash(const uint8_t *data, size_t size)
+{
+    uint32_t hash = 2166136261u; /* FNV-1a */
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void platform_info_cache_path(const char *src, char *path, size_t size)
+{
+    snprintf(path, size, "%s/platform_info_%08x.bin", PLATFORM_INFO_CACHE_DIR,
+             platform_info_cache_hash((const uint8_t *)src, strlen(src)));
+}
+
+static void recorder_append(struct platform_info_recorder *rec,
+                            const void *data, size_t size)
+{
+    if (rec->failed)
+        return;
+    if (rec->size + size > rec->capacity) {
+        size_t capacity = rec->capacity ? rec->capacity * 2 : 16 * 1024;
+        while (capacity < rec->size + size)
+            capacity *= 2;
+        uint8_t *buf = realloc(rec->buf, capacity);
+        if (buf == NULL) {
+            rec->failed = true;
+            return;
+        }
+        rec->buf = buf;
+        rec->capacity = capacity;
+    }
+    memcpy(rec->buf + rec->size, data, size);
+    rec->size += size;
+}
+
+/* strings are stored as a 16 bit length followed by the NUL terminated bytes */
+static void recorder_append_string(struct platform_info_recorder *rec, const char *str)
+{
+    size_t len = strlen(str);
+    uint16_t len16 = (uint16_t)len;
+
+    if (len > UINT16_MAX) {
+        rec->failed = true;
+        return;
+    }
+    recorder_append(rec, &len16, sizeof(len16));
+    recorder_append(rec, str, len + 1);
+}
+
+static void recording_start_tag(void *userdata, const XML_Char *tag_name,
+                                const XML_Char **attr)
+{
+    struct platform_info_recorder *rec = (struct platform_info_recorder *)userdata;
+    uint8_t type = PLATFORM_INFO_CACHE_TAG_START;
+    uint8_t count = 0;
+
+    while (attr[count] != NULL) {
+        if (++count >= PLATFORM_INFO_CACHE_MAX_ATTRS) {
+            rec->failed = true;
+            break;
+        }
+    }
+    recorder_append(rec, &type, sizeof(type));
+    recorder_append(rec, &count, sizeof(count));
+    recorder_append_string(rec, tag_name);
+    for (uint8_t i = 0; i < count; i++)
+        recorder_append_string(rec, attr[i]);
+
+    start_tag(NULL, tag_name, attr);
+}
+
+static void recording_end_tag(void *userdata, const XML_Char *tag_name)
+{
+    struct platform_info_recorder *rec = (struct platform_info_recorder *)userdata;
+    uint8_t type = PLATFORM_INFO_CACHE_TAG_END;
+
+    recorder_append(rec, &type, sizeof(type));
+    recorder_append_string(rec, tag_name);
+
+    end_tag(NULL, tag_name);
+}
+
+static const char *cache_read_string(const uint8_t **p, const uint8_t *end)
+{
+    uint16_t len;
+    const char *str;
+
+    if (end - *p < (ptrdiff_t)sizeof(len))
+        return NULL;
+    memcpy(&len, *p, sizeof(len));
+    *p += sizeof(len);
+    if (end - *p < (ptrdiff_t)len + 1 || (*p)[len] != '\0')
+        return NULL;
+    str = (const char *)*p;
+    *p += len + 1;
+    return str;
+}
+
+/*
+ * Walks the cached events, calling the tag handlers only when dispatch is
+ * set. The cache is validated with a first pass so that a truncated file
+ * never applies a partial configuration.
+ */
+static int platform_info_cache_walk(const uint8_t *p, const uint8_t *end, bool dispatch)
+{
+    const XML_Char *attr[PLATFORM_INFO_CACHE_MAX_ATTRS + 1];
+
+    while (p < end) {
+        uint8_t type = *p++;
+        if (type == PLATFORM_INFO_CACHE_TAG_START) {
+            if (p >= end)
+                return -EINVAL;
+            uint8_t count = *p++;
+            if (count >= PLATFORM_INFO_CACHE_MAX_ATTRS)
+                return -EINVAL;
+            const char *tag_name = cache_read_string(&p, end);
+            if (tag_name == NULL)
+                return -EINVAL;
+            for (uint8_t i = 0; i < count; i++) {
+                attr[i] = cache_read_string(&p, end);
+                if (attr[i] == NULL)
+                    return -EINVAL;
+            }
+            attr[count] = NULL;
+            if (dispatch)
+                start_tag(NULL, tag_name, attr);
+        } else if (type == PLATFORM_INFO_CACHE_TAG_END) {
+            const char *tag_name = cache_read_string(&p, end);
+            if (tag_name == NULL)
+                return -EINVAL;
+            if (dispatch)
+                end_tag(NULL, tag_name);
+        } else {
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+/* must be called with my_data.lock held */
+static int platform_info_cache_replay(const char *src, const struct stat *src_st)
+{
+    char path[MIXER_PATH_MAX_LENGTH + 64];
+    struct platform_info_cache_header hdr;
+    struct stat st;
+    const uint8_t *payload;
+    void *map;
+    int fd, ret = -ENOENT;
+
+    platform_info_cache_path(src, path, sizeof(path));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(hdr))
+        goto done;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ret = -errno;
+        goto done;
+    }
+
+    memcpy(&hdr, map, sizeof(hdr));
+    payload = (const uint8_t *)map + sizeof(hdr);
+    if (hdr.magic != PLATFORM_INFO_CACHE_MAGIC ||
+        hdr.version != PLATFORM_INFO_CACHE_VERSION ||
+        hdr.src_size != (int64_t)src_st->st_size ||
+        hdr.src_mtime_sec != (int64_t)src_st->st_mtim.tv_sec ||
+        hdr.src_mtime_nsec != (int64_t)src_st->st_mtim.tv_nsec ||
+        (off_t)hdr.payload_size != st.st_size - (off_t)sizeof(hdr) ||
+        hdr.payload_hash != platform_info_cache_hash(payload, hdr.payload_size) ||
+        platform_info_cache_walk(payload, payload + hdr.payload_size, false) != 0) {
+        ALOGD("%s: cache %s is stale, parsing %s", __func__, path, src);
+        ret = -ESTALE;
+    } else {
+        ret = platform_info_cache_walk(payload, payload + hdr.payload_size, true);
+        ALOGD("%s: applied %s from cache %s", __func__, src, path);
+    }
+    munmap(map, st.st_size);
+
+done:
+    close(fd);
+    return ret;
+}
+
+static void platform_info_cache_store(const char *src, const struct stat *src_st,
+                                      const struct platform_info_recorder *rec)
+{
+    char path[MIXER_PATH_MAX_LENGTH + 64];
+    char tmp_path[MIXER_PATH_MAX_LENGTH + 68];
+    struct platform_info_cache_header hdr = {
+        .magic = PLATFORM_INFO_CACHE_MAGIC,
+        .version = PLATFORM_INFO_CACHE_VERSION,
+        .src_size = src_st->st_size,
+        .src_mtime_sec = src_st->st_mtim.tv_sec,
+        .src_mtime_nsec = src_st->st_mtim.tv_nsec,
+        .payload_size = rec->size,
+        .payload_hash = platform_info_cache_hash(rec->buf, rec->size),
+    };
+    int fd;
+
+    if (rec->failed || rec->size > UINT32_MAX)
+        return;
+
+    platform_info_cache_path(src, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        ALOGW("%s: cannot create %s: %s", __func__, tmp_path, strerror(errno));
+        return;
+    }
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        write(fd, rec->buf, rec->size) != (ssize_t)rec->size ||
+        fsync(fd) < 0) {
+        ALOGW("%s: failed to write %s: %s", __func__, tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return;
+    }
+    close(fd);
+    /* rename is atomic, a reader sees either the old or the new cache */
+    if (rename(tmp_path, path) < 0) {
+        ALOGW("%s: failed to rename %s: %s", __func__, tmp_path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
 int platform_info_init(const char *filename, void *platform,
                        bool do_full_parse, set_parameters_fn fn)
 {
@@ -1090,6 +1361,9 @@ int platform_info_init(const char *filename, void *platform,
     void            *buf;
     static const uint32_t kBufSize = 1024;
     char   platform_info_file_name[MIXER_PATH_MAX_LENGTH]= {0};
+    struct platform_info_recorder recorder = {0};
+    struct stat     src_st;
+    bool            use_cache = property_get_bool(PLATFORM_INFO_CACHE_PROPERTY, false);
 
     if (filename == NULL) {
         strlcpy(platform_info_file_name, PLATFORM_INFO_XML_PATH, MIXER_PATH_MAX_LENGTH);
@@ -1108,6 +1382,9 @@ int platform_info_init(const char *filename, void *platform,
         goto done;
     }
 
+    if (use_cache && fstat(fileno(file), &src_st) < 0)
+        use_cache = false;
+
     parser = XML_ParserCreate(NULL);
     if (!parser) {
         ALOGE("%s: Failed to create XML parser!", __func__);
@@ -1122,7 +1399,15 @@ int platform_info_init(const char *filename, void *platform,
     my_data.kvpairs = str_parms_create();
     my_data.set_parameters = fn;
 
-    XML_SetElementHandler(parser, start_tag, end_tag);
+    if (use_cache) {
+        if (platform_info_cache_replay(platform_info_file_name, &src_st) == 0)
+            goto err_free_parser;
+        section = ROOT;
+        XML_SetUserData(parser, &recorder);
+        XML_SetElementHandler(parser, recording_start_tag, recording_end_tag);
+    } else {
+        XML_SetElementHandler(parser, start_tag, end_tag);
+    }
 
     while (1) {
         buf = XML_GetBuffer(parser, kBufSize);
@@ -1151,7 +1436,11 @@ int platform_info_init(const char *filename, void *platform,
             break;
     }
 
+    if (use_cache)
+        platform_info_cache_store(platform_info_file_name, &src_st, &recorder);
+
 err_free_parser:
+    free(recorder.buf);
     if (my_data.kvpairs != NULL) {
         str_parms_destroy(my_data.kvpairs);
         my_data.kvpairs = NULL;
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SND_DEVICE_RULES_H
+#define SND_DEVICE_RULES_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <system/audio.h>
+
+/* Output device combinations shared by the platform implementations.
+
+   Each platform lists the two device combinations it supports as a const
+   table in its own snd_device_t values and resolves them with
+   snd_device_combo_lookup(), rather than each keeping its own if/else
+   chain. A rule matches when one device of group is selected together
+   with exactly the device in other. Rules are tried in table order.
+*/
+struct snd_device_combo_rule {
+    audio_devices_t group;
+    audio_devices_t other;
+    int snd_device;
+    int snd_device_wb;       /* with wide band BT SCO, 0 for snd_device */
+};
+
+/* devices holds exactly two output devices, 0 (SND_DEVICE_NONE) without a match */
+static inline int snd_device_combo_lookup(const struct snd_device_combo_rule *rules,
+                                          size_t count, audio_devices_t devices,
+                                          bool wb)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if ((devices & rules[i].group) &&
+                (devices & ~rules[i].group) == rules[i].other) {
+            if (wb && rules[i].snd_device_wb)
+                return rules[i].snd_device_wb;
+            return rules[i].snd_device;
+        }
+    }
+    return 0;
+}
+
+/* Name tables of the platform info XML.
+
+   The tables are looked up for every element of the XML, so each platform
+   keeps a sorted view of its tables in a name_to_index_map, sorts it once
+   with name_to_index_map_sort() and binary searches it with
+   name_to_index_map_find() instead of doing a linear strcmp() scan. Empty
+   (unused) table slots are left out of the sorted view.
+*/
+struct name_to_index {
+    char name[100];
+    unsigned int index;
+};
+
+struct name_to_index_map {
+    const struct name_to_index *table;
+    int32_t len;
+    int32_t count;
+    const struct name_to_index **sorted;   /* len entries of storage */
+};
+
+static inline int name_to_index_compare(const void *a, const void *b)
+{
+    const struct name_to_index *l = *(const struct name_to_index * const *)a;
+    const struct name_to_index *r = *(const struct name_to_index * const *)b;
+    int ret = strcmp(l->name, r->name);
+
+    /* keep the first table entry first among duplicate names */
+    if (ret == 0)
+        ret = (l > r) - (l < r);
+    return ret;
+}
+
+static inline void name_to_index_map_sort(struct name_to_index_map *map)
+{
+    int32_t i;
+
+    map->count = 0;
+    for (i = 0; i < map->len; i++) {
+        if (map->table[i].name[0] != '\0')
+            map->sorted[map->count++] = &map->table[i];
+    }
+    qsort(map->sorted, map->count, sizeof(map->sorted[0]), name_to_index_compare);
+}
+
+/* -ENODEV when name is not in the table */
+static inline int name_to_index_map_find(const struct name_to_index_map *map,
+                                         const char *name)
+{
+    int32_t lo = 0, hi = map->count;
+
+    /* lower bound, so duplicates resolve to the first table entry */
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        if (strcmp(map->sorted[mid]->name, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < map->count && !strcmp(map->sorted[lo]->name, name))
+        return map->sorted[lo]->index;
+    return -ENODEV;
+}
+
+#endif /* SND_DEVICE_RULES_H */
@@ -0,0 +1,59 @@
+LOCAL_PATH := $(call my-dir)
+
+audio_kernel_bench_src_files := \
+	audio_kernel_bench.c \
+	../audio_extn/pcm_kernels.c \
+	../../visualizer/visualizer_kernels.c
+audio_kernel_bench_c_includes := \
+	$(LOCAL_PATH)/.. \
+	$(LOCAL_PATH)/../audio_extn \
+	$(LOCAL_PATH)/../../visualizer
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := $(audio_kernel_bench_src_files)
+LOCAL_C_INCLUDES += $(audio_kernel_bench_c_includes)
+LOCAL_HEADER_LIBRARIES := libaudio_system_headers
+LOCAL_MODULE := audio_kernel_bench
+LOCAL_LICENSE_KINDS := SPDX-license-identifier-Apache-2.0
+LOCAL_LICENSE_CONDITIONS := notice
+LOCAL_MODULE_TAGS := debug
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_CFLAGS += -O2 -Werror
+include $(BUILD_EXECUTABLE)
+
+# the same cases on the build host, without NEON
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := $(audio_kernel_bench_src_files)
+LOCAL_C_INCLUDES += $(audio_kernel_bench_c_includes)
+LOCAL_HEADER_LIBRARIES := libaudio_system_headers
+LOCAL_MODULE := audio_kernel_bench_host
+LOCAL_LICENSE_KINDS := SPDX-license-identifier-Apache-2.0
+LOCAL_LICENSE_CONDITIONS := notice
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += -O2 -Werror
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := hal_call_replay.c
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../audio_extn
+LOCAL_HEADER_LIBRARIES := libhardware_headers audio_headers
+LOCAL_SHARED_LIBRARIES := libhardware
+LOCAL_MODULE := hal_call_replay
+LOCAL_LICENSE_KINDS := SPDX-license-identifier-Apache-2.0
+LOCAL_LICENSE_CONDITIONS := notice
+LOCAL_MODULE_TAGS := debug
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_CFLAGS += -Werror
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := hal_stream_bench.c
+LOCAL_HEADER_LIBRARIES := libhardware_headers audio_headers
+LOCAL_SHARED_LIBRARIES := libhardware
+LOCAL_MODULE := hal_stream_bench
+LOCAL_LICENSE_KINDS := SPDX-license-identifier-Apache-2.0
+LOCAL_LICENSE_CONDITIONS := notice
+LOCAL_MODULE_TAGS := debug
+LOCAL_PROPRIETARY_MODULE := true
+LOCAL_CFLAGS += -O2 -Werror
+include $(BUILD_EXECUTABLE)
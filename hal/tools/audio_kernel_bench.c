@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Times the sample kernels and lookups of the HAL and its effects at the
+   buffer sizes their paths use: the out_write() downmix and haptic split,
+   the in_read() 24 bit conversions, the visualizer capture analysis, a
+   clamp16() gain loop as in post_proc and the platform name table lookup.
+   It builds for the device and for the host.
+
+   usage: audio_kernel_bench [-n iterations] [case name prefix]
+
+   Every case runs its kernel once per iteration on the same buffers, which
+   stay in cache as the stream buffers do between writes, and prints the
+   median and the 99th percentile of one call, and the median per frame,
+   or per lookup for the name table. The _ref cases are the loops the
+   kernels replaced, kept as the baseline to compare with.
+*/
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pcm_kernels.h"
+#include "snd_device_rules.h"
+#include "visualizer_kernels.h"
+
+#define DEFAULT_ITERATIONS 2000
+#define WARMUP_ITERATIONS 50
+/* a 20 ms period of 8 channels at 48 kHz, the largest any case uses */
+#define MAX_SAMPLES (960 * 8)
+/* about the size of the snd device name table of a platform */
+#define NAME_TABLE_SIZE 256
+
+struct bench_case {
+    const char *name;
+    size_t frames;          /* per call */
+    void (*run)(size_t frames);
+};
+
+static int16_t s16_in[MAX_SAMPLES];
+static int16_t s16_out[MAX_SAMPLES];
+static int32_t s32_in[MAX_SAMPLES];
+static int32_t s32_out[MAX_SAMPLES];
+static float float_out[MAX_SAMPLES];
+static uint8_t u8_out[MAX_SAMPLES];
+static uint8_t haptic_in[MAX_SAMPLES * 2];
+static uint8_t haptic_out[MAX_SAMPLES * 2];
+static struct name_to_index name_table[NAME_TABLE_SIZE];
+static const struct name_to_index *name_sorted[NAME_TABLE_SIZE];
+static struct name_to_index_map name_map = {
+    name_table, NAME_TABLE_SIZE, 0, name_sorted
+};
+static volatile int sink;
+
+static void downmix_ref(size_t frames)
+{
+    const int16_t *src = s16_in;
+    int16_t *dst = s16_out;
+
+    for (size_t i = 0; i < frames; i++, dst++, src += 2)
+        *dst = (int16_t)(((int32_t)src[0] + (int32_t)src[1]) >> 1);
+}
+
+static void downmix(size_t frames)
+{
+    audio_extn_pcm_downmix_stereo_to_mono_16(s16_out, s16_in, frames);
+}
+
+/* 16 bit audio with haptic channels behind it, the layout out_write() splits */
+static void haptic_split_ref(size_t frames)
+{
+    const size_t audio_frame_size = 2 * 2, haptic_frame_size = 2;
+    size_t src_index = 0, aud_index = 0, hap_index = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        for (size_t j = 0; j < audio_frame_size; j++)
+            haptic_in[aud_index++] = haptic_in[src_index++];
+        for (size_t j = 0; j < haptic_frame_size; j++)
+            haptic_out[hap_index++] = haptic_in[src_index++];
+    }
+}
+
+static void haptic_split(size_t frames)
+{
+    audio_extn_pcm_split_haptics(haptic_in, haptic_out, frames, 2, 2, 1, 0);
+}
+
+static void haptic_split_mono(size_t frames)
+{
+    audio_extn_pcm_split_haptics(haptic_in, haptic_out, frames, 2, 1, 1, 0);
+}
+
+/* stereo 24_8 capture, run out of place so every call sees the same input */
+static void convert_8_24_ref(size_t frames)
+{
+    for (size_t i = 0; i < frames * 2; i++)
+        s32_out[i] = s32_in[i] >> 8;
+}
+
+static void convert_8_24(size_t frames)
+{
+    audio_extn_pcm_convert_24_8_to_8_24(s32_out, s32_in, frames * 2);
+}
+
+static void convert_float_ref(size_t frames)
+{
+    for (size_t i = 0; i < frames * 2; i++)
+        float_out[i] = (float)s32_in[i] / 2147483648.0f;
+}
+
+static void convert_float(size_t frames)
+{
+    audio_extn_pcm_convert_24_8_to_float(float_out, s32_in, frames * 2);
+}
+
+/* what visualizer_process() spends on one capture period */
+static void visualizer(size_t frames)
+{
+    buffer_analysis_t analysis;
+
+    visualizer_analyze_stereo_buffer(s16_in, frames, s16_out, &analysis);
+    visualizer_mono_to_capture(u8_out, s16_out, frames, 8);
+    sink = analysis.max_norm;
+}
+
+/* the saturation of post_proc/volume_listener.c */
+static inline int16_t clamp16(int32_t sample)
+{
+    if ((sample>>15) ^ (sample>>31))
+        sample = 0x7FFF ^ (sample>>31);
+    return sample;
+}
+
+/* a +6 dB Q12 gain on stereo 16 bit, so that half the samples saturate */
+static void volume_clamp16(size_t frames)
+{
+    for (size_t i = 0; i < frames * 2; i++)
+        s16_out[i] = clamp16(((int32_t)s16_in[i] * 8192) >> 12);
+}
+
+/* the linear strcmp() scan find_index() did before the sorted view */
+static void find_index_ref(size_t lookups)
+{
+    for (size_t i = 0; i < lookups; i++) {
+        const char *name = name_table[(i * 97) % NAME_TABLE_SIZE].name;
+
+        for (int j = 0; j < NAME_TABLE_SIZE; j++) {
+            if (!strcmp(name_table[j].name, name)) {
+                sink = name_table[j].index;
+                break;
+            }
+        }
+    }
+}
+
+static void find_index(size_t lookups)
+{
+    for (size_t i = 0; i < lookups; i++)
+        sink = name_to_index_map_find(&name_map,
+                                      name_table[(i * 97) % NAME_TABLE_SIZE].name);
+}
+
+static const struct bench_case cases[] = {
+    /* VOIP at 16 kHz and in-call music at 48 kHz, 20 ms stereo writes */
+    { "downmix_16k_ref", 320, downmix_ref },
+    { "downmix_16k", 320, downmix },
+    { "downmix_48k_ref", 960, downmix_ref },
+    { "downmix_48k", 960, downmix },
+    /* one low latency period of the haptics playback */
+    { "haptic_split_ref", 240, haptic_split_ref },
+    { "haptic_split", 240, haptic_split },
+    { "haptic_split_mono", 240, haptic_split_mono },
+    /* a 20 ms stereo capture read at 48 kHz */
+    { "convert_8_24_ref", 960, convert_8_24_ref },
+    { "convert_8_24", 960, convert_8_24 },
+    { "convert_float_ref", 960, convert_float_ref },
+    { "convert_float", 960, convert_float },
+    /* AUDIO_CAPTURE_PERIOD_SIZE of the offload visualizer */
+    { "visualizer", 768, visualizer },
+    { "volume_clamp16", 960, volume_clamp16 },
+    /* every name of the table once */
+    { "find_index_ref", NAME_TABLE_SIZE, find_index_ref },
+    { "find_index", NAME_TABLE_SIZE, find_index },
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void fill_input(void)
+{
+    uint32_t lfsr = 0x12345678;
+
+    for (size_t i = 0; i < MAX_SAMPLES; i++) {
+        lfsr = lfsr * 1664525 + 1013904223;
+        s16_in[i] = (int16_t)(lfsr >> 16);
+        s32_in[i] = (int32_t)(lfsr & 0xffffff00);
+    }
+    for (size_t i = 0; i < sizeof(haptic_in); i++)
+        haptic_in[i] = (uint8_t)i;
+
+    /* shared prefixes like the real SND_DEVICE_ names, in table order */
+    for (int i = 0; i < NAME_TABLE_SIZE; i++) {
+        snprintf(name_table[i].name, sizeof(name_table[i].name), "SND_DEVICE_%s_%03d",
+                 i < NAME_TABLE_SIZE / 2 ? "OUT" : "IN", (i * 37) % NAME_TABLE_SIZE);
+        name_table[i].index = i;
+    }
+    name_to_index_map_sort(&name_map);
+}
+
+static void run_case(const struct bench_case *c, int iterations, int64_t *ns)
+{
+    int i;
+
+    for (i = 0; i < WARMUP_ITERATIONS; i++)
+        c->run(c->frames);
+    for (i = 0; i < iterations; i++) {
+        const int64_t start = now_ns();
+        c->run(c->frames);
+        ns[i] = now_ns() - start;
+    }
+    qsort(ns, iterations, sizeof(*ns), cmp_int64);
+    printf("%-28s %6zu %10lld %10lld %8.2f\n", c->name, c->frames,
+           (long long)ns[iterations / 2], (long long)ns[iterations * 99 / 100],
+           (double)ns[iterations / 2] / c->frames);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = DEFAULT_ITERATIONS;
+    const char *prefix = NULL;
+    int64_t *ns;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [case name prefix]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+        prefix = argv[optind];
+    if (iterations < 100) {
+        fprintf(stderr, "need at least 100 iterations\n");
+        return EXIT_FAILURE;
+    }
+
+    ns = (int64_t *)calloc(iterations, sizeof(*ns));
+    if (ns == NULL)
+        return EXIT_FAILURE;
+    fill_input();
+
+    printf("%-28s %6s %10s %10s %8s\n", "case", "frames", "median_ns", "p99_ns", "ns/frame");
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (prefix == NULL || strncmp(cases[i].name, prefix, strlen(prefix)) == 0)
+            run_case(&cases[i], iterations, ns);
+    }
+    free(ns);
+    return EXIT_SUCCESS;
+}
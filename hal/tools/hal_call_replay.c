@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Replays a HAL call trace against the primary audio HAL of the device.
+
+   usage: hal_call_replay [-f] [trace file]
+
+   The trace is the one audio_extn/call_trace.c records, CALL_TRACE_PATH
+   by default. Each record is issued to the HAL at the offset it was made
+   at from the start of the trace, or back to back with -f. Streams are
+   opened with the traced handle, devices, flags and config, writes
+   without a traced payload write silence of the traced size, and reads
+   go to a scratch buffer. At the end every call type prints how often it
+   was issued, how often the HAL failed it and how late it could be
+   issued at worst, so a replay shows both the HAL errors and where the
+   HAL blocked the load it was given.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/audio.h>
+#include <hardware/hardware.h>
+
+#include "call_trace.h"
+
+#define MAX_STREAMS 32
+
+/* out and in share storage, a NULL out marks a free slot */
+struct stream_slot {
+    int32_t handle;
+    bool is_output;
+    union {
+        struct audio_stream_out *out;
+        struct audio_stream_in *in;
+    };
+};
+
+struct call_stats {
+    unsigned int calls;
+    unsigned int errors;
+    int64_t max_late_ns;
+};
+
+static const char *call_names[CALL_TRACE_CALL_MAX] = {
+    [CALL_TRACE_ADEV_SET_PARAMETERS] = "adev_set_parameters",
+    [CALL_TRACE_ADEV_SET_MODE] = "adev_set_mode",
+    [CALL_TRACE_ADEV_SET_VOICE_VOLUME] = "adev_set_voice_volume",
+    [CALL_TRACE_ADEV_SET_MIC_MUTE] = "adev_set_mic_mute",
+    [CALL_TRACE_ADEV_OPEN_OUTPUT_STREAM] = "adev_open_output_stream",
+    [CALL_TRACE_ADEV_CLOSE_OUTPUT_STREAM] = "adev_close_output_stream",
+    [CALL_TRACE_ADEV_OPEN_INPUT_STREAM] = "adev_open_input_stream",
+    [CALL_TRACE_ADEV_CLOSE_INPUT_STREAM] = "adev_close_input_stream",
+    [CALL_TRACE_OUT_WRITE] = "out_write",
+    [CALL_TRACE_OUT_STANDBY] = "out_standby",
+    [CALL_TRACE_OUT_SET_PARAMETERS] = "out_set_parameters",
+    [CALL_TRACE_OUT_SET_VOLUME] = "out_set_volume",
+    [CALL_TRACE_OUT_GET_PRESENTATION_POSITION] = "out_get_presentation_position",
+    [CALL_TRACE_IN_READ] = "in_read",
+    [CALL_TRACE_IN_STANDBY] = "in_standby",
+    [CALL_TRACE_IN_SET_PARAMETERS] = "in_set_parameters",
+};
+
+static struct audio_hw_device *dev;
+static struct stream_slot streams[MAX_STREAMS];
+static struct call_stats stats[CALL_TRACE_CALL_MAX];
+static uint8_t data[CALL_TRACE_MAX_DATA_SIZE + 1];
+static uint8_t *scratch;
+static size_t scratch_size;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec = ns / 1000000000LL,
+        .tv_nsec = ns % 1000000000LL,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static int read_full(int fd, void *buf, size_t size)
+{
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < size) {
+        ret = read(fd, (uint8_t *)buf + done, size - done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return done == 0 && ret == 0 ? 0 : -EIO;
+        done += ret;
+    }
+    return 1;
+}
+
+static struct stream_slot *find_stream(int32_t handle, bool is_output)
+{
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        if (streams[i].out != NULL && streams[i].handle == handle &&
+            streams[i].is_output == is_output)
+            return &streams[i];
+    }
+    return NULL;
+}
+
+static struct stream_slot *free_stream(void)
+{
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        if (streams[i].out == NULL)
+            return &streams[i];
+    }
+    return NULL;
+}
+
+/* silence of the traced size when the write payload was not recorded */
+static const void *io_buffer(size_t bytes, bool have_payload)
+{
+    if (have_payload)
+        return data;
+    if (bytes > scratch_size) {
+        uint8_t *p = realloc(scratch, bytes);
+
+        if (p == NULL)
+            return NULL;
+        scratch = p;
+        scratch_size = bytes;
+    }
+    memset(scratch, 0, bytes);
+    return scratch;
+}
+
+static int open_output(const struct call_trace_record *r)
+{
+    struct stream_slot *slot = free_stream();
+    struct audio_config config;
+    int ret;
+
+    if (slot == NULL || r->data_size < sizeof(config))
+        return -EINVAL;
+    memcpy(&config, data, sizeof(config));
+    ret = dev->open_output_stream(dev, r->handle, (audio_devices_t)r->args[0],
+                                  (audio_output_flags_t)r->args[1], &config,
+                                  &slot->out, "");
+    if (ret == 0) {
+        slot->handle = r->handle;
+        slot->is_output = true;
+    }
+    return ret;
+}
+
+static int open_input(const struct call_trace_record *r)
+{
+    struct stream_slot *slot = free_stream();
+    struct audio_config config;
+    int ret;
+
+    if (slot == NULL || r->data_size < sizeof(config))
+        return -EINVAL;
+    memcpy(&config, data, sizeof(config));
+    ret = dev->open_input_stream(dev, r->handle, (audio_devices_t)r->args[0], &config,
+                                 &slot->in, (audio_input_flags_t)(r->args[1] & 0xffffffff),
+                                 "", (audio_source_t)(r->args[1] >> 32));
+    if (ret == 0) {
+        slot->handle = r->handle;
+        slot->is_output = false;
+    }
+    return ret;
+}
+
+static int replay(const struct call_trace_record *r)
+{
+    bool is_output = false;
+    const char *kvpairs = (const char *)data;
+    struct stream_slot *slot = NULL;
+    uint64_t frames;
+    struct timespec ts;
+    const void *buf;
+    ssize_t bytes;
+    int ret;
+
+    data[r->data_size] = '\0';
+    switch (r->call) {
+    case CALL_TRACE_ADEV_CLOSE_OUTPUT_STREAM:
+    case CALL_TRACE_OUT_WRITE:
+    case CALL_TRACE_OUT_STANDBY:
+    case CALL_TRACE_OUT_SET_PARAMETERS:
+    case CALL_TRACE_OUT_SET_VOLUME:
+    case CALL_TRACE_OUT_GET_PRESENTATION_POSITION:
+        is_output = true;
+        /* fall through */
+    case CALL_TRACE_ADEV_CLOSE_INPUT_STREAM:
+    case CALL_TRACE_IN_READ:
+    case CALL_TRACE_IN_STANDBY:
+    case CALL_TRACE_IN_SET_PARAMETERS:
+        /* a stream the replay failed to open has its calls skipped */
+        slot = find_stream(r->handle, is_output);
+        if (slot == NULL)
+            return -ENODEV;
+        break;
+    default:
+        break;
+    }
+
+    switch (r->call) {
+    case CALL_TRACE_ADEV_SET_PARAMETERS:
+        return dev->set_parameters(dev, kvpairs);
+    case CALL_TRACE_ADEV_SET_MODE:
+        return dev->set_mode(dev, (audio_mode_t)r->args[0]);
+    case CALL_TRACE_ADEV_SET_VOICE_VOLUME:
+        return dev->set_voice_volume(dev, r->args[0] / 1000000.0f);
+    case CALL_TRACE_ADEV_SET_MIC_MUTE:
+        return dev->set_mic_mute(dev, r->args[0] != 0);
+    case CALL_TRACE_ADEV_OPEN_OUTPUT_STREAM:
+        return open_output(r);
+    case CALL_TRACE_ADEV_OPEN_INPUT_STREAM:
+        return open_input(r);
+    case CALL_TRACE_ADEV_CLOSE_OUTPUT_STREAM:
+        dev->close_output_stream(dev, slot->out);
+        slot->out = NULL;
+        return 0;
+    case CALL_TRACE_ADEV_CLOSE_INPUT_STREAM:
+        dev->close_input_stream(dev, slot->in);
+        slot->in = NULL;
+        return 0;
+    case CALL_TRACE_OUT_WRITE:
+        buf = io_buffer(r->args[0], r->data_size == r->args[0]);
+        if (buf == NULL)
+            return -ENOMEM;
+        bytes = slot->out->write(slot->out, buf, r->args[0]);
+        return bytes < 0 ? (int)bytes : 0;
+    case CALL_TRACE_OUT_STANDBY:
+        return slot->out->common.standby(&slot->out->common);
+    case CALL_TRACE_OUT_SET_PARAMETERS:
+        return slot->out->common.set_parameters(&slot->out->common, kvpairs);
+    case CALL_TRACE_OUT_SET_VOLUME:
+        return slot->out->set_volume(slot->out, r->args[0] / 1000000.0f,
+                                     r->args[1] / 1000000.0f);
+    case CALL_TRACE_OUT_GET_PRESENTATION_POSITION:
+        /* -ENODATA before the first write is expected, it is not an error */
+        ret = slot->out->get_presentation_position(slot->out, &frames, &ts);
+        return ret == -ENODATA ? 0 : ret;
+    case CALL_TRACE_IN_READ:
+        buf = io_buffer(r->args[0], false);
+        if (buf == NULL)
+            return -ENOMEM;
+        bytes = slot->in->read(slot->in, (void *)buf, r->args[0]);
+        return bytes < 0 ? (int)bytes : 0;
+    case CALL_TRACE_IN_STANDBY:
+        return slot->in->common.standby(&slot->in->common);
+    case CALL_TRACE_IN_SET_PARAMETERS:
+        return slot->in->common.set_parameters(&slot->in->common, kvpairs);
+    default:
+        return -EINVAL;
+    }
+}
+
+static void close_streams(void)
+{
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        if (streams[i].out == NULL)
+            continue;
+        if (streams[i].is_output)
+            dev->close_output_stream(dev, streams[i].out);
+        else
+            dev->close_input_stream(dev, streams[i].in);
+        streams[i].out = NULL;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = CALL_TRACE_PATH;
+    const struct hw_module_t *module;
+    struct call_trace_header header;
+    struct call_trace_record record;
+    int64_t first_ns = -1, start_ns = 0, late_ns;
+    bool fast = false;
+    int opt, fd, ret;
+
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        switch (opt) {
+        case 'f':
+            fast = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-f] [trace file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        path = argv[optind];
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (read_full(fd, &header, sizeof(header)) != 1 ||
+        header.magic != CALL_TRACE_MAGIC || header.version != CALL_TRACE_VERSION) {
+        fprintf(stderr, "%s is not a version %d call trace\n", path, CALL_TRACE_VERSION);
+        close(fd);
+        return 1;
+    }
+
+    ret = hw_get_module_by_class(AUDIO_HARDWARE_MODULE_ID, AUDIO_HARDWARE_MODULE_ID_PRIMARY,
+                                 &module);
+    if (ret == 0)
+        ret = audio_hw_device_open(module, &dev);
+    if (ret != 0) {
+        fprintf(stderr, "cannot open the primary audio HAL: %s\n", strerror(-ret));
+        close(fd);
+        return 1;
+    }
+
+    while ((ret = read_full(fd, &record, sizeof(record))) == 1) {
+        if (record.data_size > CALL_TRACE_MAX_DATA_SIZE ||
+            (record.data_size && read_full(fd, data, record.data_size) != 1)) {
+            ret = -EIO;
+            break;
+        }
+        if (record.call >= CALL_TRACE_CALL_MAX)
+            continue;
+
+        if (first_ns < 0) {
+            first_ns = record.time_ns;
+            start_ns = now_ns();
+        }
+        late_ns = 0;
+        if (!fast) {
+            int64_t due_ns = start_ns + (record.time_ns - first_ns);
+
+            late_ns = now_ns() - due_ns;
+            if (late_ns < 0) {
+                sleep_until(due_ns);
+                late_ns = 0;
+            }
+        }
+
+        stats[record.call].calls++;
+        if (late_ns > stats[record.call].max_late_ns)
+            stats[record.call].max_late_ns = late_ns;
+        if (replay(&record) != 0)
+            stats[record.call].errors++;
+    }
+    if (ret < 0)
+        fprintf(stderr, "%s: truncated record, replay stopped there\n", path);
+
+    close_streams();
+    audio_hw_device_close(dev);
+    close(fd);
+    free(scratch);
+
+    printf("%-32s %8s %8s %12s\n", "call", "count", "errors", "max late ms");
+    for (int i = 0; i < CALL_TRACE_CALL_MAX; i++) {
+        if (stats[i].calls == 0)
+            continue;
+        printf("%-32s %8u %8u %12.2f\n", call_names[i], stats[i].calls, stats[i].errors,
+               stats[i].max_late_ns / 1000000.0);
+    }
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Drives the primary audio HAL through its stream entry points and reports
+   the timing of each usecase.
+
+   usage: hal_stream_bench [-d seconds] [-r restarts] [case name prefix]
+
+   Every case opens one stream with the flags that select its usecase and
+   moves silence through it for the given time: out_write() and in_read()
+   of get_buffer_size() bytes, or for the MMAP cases start() followed by a
+   get_mmap_position() poll every burst. The stream is put in standby
+   restarts times along the way, so start latency is sampled more than
+   once. Each case prints
+   - the wall time of one call, median, p90, p99 and max,
+   - the calling thread's cpu time per call, which is the HAL work done in
+     out_write()/in_read() since the HAL runs in this process,
+   - the start latency, the first call after open or standby, or for MMAP
+     streams the time from start() until the position moves,
+   - the underruns the HAL itself counted for the usecase, from the
+     "perf_stats" parameter that is reset before each case.
+*/
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/audio.h>
+#include <hardware/hardware.h>
+
+#define DEFAULT_SECONDS 10
+#define DEFAULT_RESTARTS 4
+#define MAX_STARTS 64
+/* an MMAP start that never moves the position gives up after this */
+#define MMAP_START_TIMEOUT_NS 1000000000LL
+
+struct bench_case {
+    const char *name;
+    bool is_output;
+    bool mmap;                   /* polled after start() instead of written or read */
+    uint32_t flags;              /* audio_output_flags_t or audio_input_flags_t */
+    audio_source_t source;
+    uint32_t sample_rate;
+    audio_channel_mask_t channel_mask;
+};
+
+struct bench_result {
+    int64_t *call_ns;
+    size_t calls;
+    size_t capacity;
+    int64_t cpu_ns;
+    int64_t start_ns[MAX_STARTS];
+    size_t starts;
+    unsigned int underruns;
+};
+
+static const struct bench_case cases[] = {
+    { "deep_buffer", true, false, AUDIO_OUTPUT_FLAG_DEEP_BUFFER, AUDIO_SOURCE_DEFAULT,
+      48000, AUDIO_CHANNEL_OUT_STEREO },
+    { "low_latency", true, false, AUDIO_OUTPUT_FLAG_FAST, AUDIO_SOURCE_DEFAULT,
+      48000, AUDIO_CHANNEL_OUT_STEREO },
+    { "ull", true, false, AUDIO_OUTPUT_FLAG_FAST | AUDIO_OUTPUT_FLAG_RAW, AUDIO_SOURCE_DEFAULT,
+      48000, AUDIO_CHANNEL_OUT_STEREO },
+    { "mmap", true, true, AUDIO_OUTPUT_FLAG_MMAP_NOIRQ, AUDIO_SOURCE_DEFAULT,
+      48000, AUDIO_CHANNEL_OUT_STEREO },
+    { "voip", true, false, AUDIO_OUTPUT_FLAG_VOIP_RX, AUDIO_SOURCE_DEFAULT,
+      16000, AUDIO_CHANNEL_OUT_MONO },
+    { "record", false, false, AUDIO_INPUT_FLAG_NONE, AUDIO_SOURCE_MIC,
+      48000, AUDIO_CHANNEL_IN_STEREO },
+    { "record_low_latency", false, false, AUDIO_INPUT_FLAG_FAST, AUDIO_SOURCE_MIC,
+      48000, AUDIO_CHANNEL_IN_STEREO },
+    { "record_mmap", false, true, AUDIO_INPUT_FLAG_MMAP_NOIRQ, AUDIO_SOURCE_MIC,
+      48000, AUDIO_CHANNEL_IN_STEREO },
+    { "record_voip", false, false, AUDIO_INPUT_FLAG_VOIP_TX, AUDIO_SOURCE_VOICE_COMMUNICATION,
+      16000, AUDIO_CHANNEL_IN_MONO },
+};
+
+static struct audio_hw_device *dev;
+static audio_io_handle_t next_handle = 1000;
+
+static int64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int log_call(struct bench_result *r, int64_t ns, int64_t cpu_ns)
+{
+    if (r->calls == r->capacity) {
+        size_t capacity = r->capacity ? r->capacity * 2 : 1024;
+        int64_t *p = realloc(r->call_ns, capacity * sizeof(*p));
+
+        if (p == NULL)
+            return -ENOMEM;
+        r->call_ns = p;
+        r->capacity = capacity;
+    }
+    r->call_ns[r->calls++] = ns;
+    r->cpu_ns += cpu_ns;
+    return 0;
+}
+
+static void log_start(struct bench_result *r, int64_t ns)
+{
+    if (r->starts < MAX_STARTS)
+        r->start_ns[r->starts++] = ns;
+}
+
+/* sums the underruns of every usecase, only the case under test ran */
+static unsigned int hal_underruns(void)
+{
+    char *reply = dev->get_parameters(dev, "perf_stats");
+    unsigned int underruns = 0;
+    char *entry, *save = NULL;
+
+    if (reply == NULL)
+        return 0;
+    /* "perf_stats=usecase:calls:p50:p90:p99:max:underruns:..." joined by '|' */
+    entry = strchr(reply, '=');
+    for (entry = entry ? strtok_r(entry + 1, "|", &save) : NULL; entry != NULL;
+         entry = strtok_r(NULL, "|", &save)) {
+        char *field = entry;
+        int i;
+
+        for (i = 0; i < 6 && field != NULL; i++) {
+            field = strchr(field, ':');
+            if (field != NULL)
+                field++;
+        }
+        if (field != NULL)
+            underruns += strtoul(field, NULL, 10);
+    }
+    free(reply);
+    return underruns;
+}
+
+static int open_stream(const struct bench_case *c, struct audio_stream **stream)
+{
+    struct audio_config config = AUDIO_CONFIG_INITIALIZER;
+    int ret;
+
+    config.sample_rate = c->sample_rate;
+    config.channel_mask = c->channel_mask;
+    config.format = AUDIO_FORMAT_PCM_16_BIT;
+    if (c->is_output) {
+        struct audio_stream_out *out = NULL;
+
+        ret = dev->open_output_stream(dev, next_handle++, AUDIO_DEVICE_OUT_SPEAKER,
+                                      (audio_output_flags_t)c->flags, &config, &out, "");
+        *stream = out != NULL ? &out->common : NULL;
+    } else {
+        struct audio_stream_in *in = NULL;
+
+        ret = dev->open_input_stream(dev, next_handle++, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                     &config, &in, (audio_input_flags_t)c->flags, "",
+                                     c->source);
+        *stream = in != NULL ? &in->common : NULL;
+    }
+    if (ret == 0 && *stream == NULL)
+        ret = -ENODEV;
+    return ret;
+}
+
+static void close_stream(const struct bench_case *c, struct audio_stream *stream)
+{
+    if (c->is_output)
+        dev->close_output_stream(dev, (struct audio_stream_out *)stream);
+    else
+        dev->close_input_stream(dev, (struct audio_stream_in *)stream);
+}
+
+static int run_pcm(const struct bench_case *c, struct audio_stream *stream,
+                   int seconds, int restarts, struct bench_result *r)
+{
+    const size_t bytes = stream->get_buffer_size(stream);
+    const int64_t end_ns = clock_ns(CLOCK_MONOTONIC) + seconds * 1000000000LL;
+    const int64_t restart_ns = seconds * 1000000000LL / (restarts + 1);
+    int64_t next_restart_ns = clock_ns(CLOCK_MONOTONIC) + restart_ns;
+    bool starting = true;
+    void *buffer;
+    int ret = 0;
+
+    buffer = calloc(1, bytes);
+    if (buffer == NULL)
+        return -ENOMEM;
+
+    while (ret == 0 && clock_ns(CLOCK_MONOTONIC) < end_ns) {
+        const int64_t cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        const int64_t start_ns = clock_ns(CLOCK_MONOTONIC);
+        ssize_t done;
+
+        if (c->is_output)
+            done = ((struct audio_stream_out *)stream)->write(
+                    (struct audio_stream_out *)stream, buffer, bytes);
+        else
+            done = ((struct audio_stream_in *)stream)->read(
+                    (struct audio_stream_in *)stream, buffer, bytes);
+        if (done < 0) {
+            ret = (int)done;
+            break;
+        }
+
+        const int64_t ns = clock_ns(CLOCK_MONOTONIC) - start_ns;
+        if (starting)
+            log_start(r, ns);
+        else
+            ret = log_call(r, ns, clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_ns);
+        starting = false;
+
+        if (start_ns + ns >= next_restart_ns) {
+            stream->standby(stream);
+            starting = true;
+            next_restart_ns += restart_ns;
+        }
+    }
+    free(buffer);
+    return ret;
+}
+
+enum mmap_op {
+    MMAP_CREATE,
+    MMAP_START,
+    MMAP_STOP,
+    MMAP_POSITION,
+};
+
+static bool has_mmap(const struct bench_case *c, struct audio_stream *stream)
+{
+    if (c->is_output)
+        return ((struct audio_stream_out *)stream)->create_mmap_buffer != NULL;
+    return ((struct audio_stream_in *)stream)->create_mmap_buffer != NULL;
+}
+
+static int mmap_call(const struct bench_case *c, struct audio_stream *stream, enum mmap_op op,
+                     int32_t min_frames, struct audio_mmap_buffer_info *info,
+                     struct audio_mmap_position *position)
+{
+    if (c->is_output) {
+        const struct audio_stream_out *out = (const struct audio_stream_out *)stream;
+
+        switch (op) {
+        case MMAP_CREATE: return out->create_mmap_buffer(out, min_frames, info);
+        case MMAP_START: return out->start(out);
+        case MMAP_STOP: return out->stop(out);
+        default: return out->get_mmap_position(out, position);
+        }
+    } else {
+        const struct audio_stream_in *in = (const struct audio_stream_in *)stream;
+
+        switch (op) {
+        case MMAP_CREATE: return in->create_mmap_buffer(in, min_frames, info);
+        case MMAP_START: return in->start(in);
+        case MMAP_STOP: return in->stop(in);
+        default: return in->get_mmap_position(in, position);
+        }
+    }
+}
+
+static struct timespec to_timespec(int64_t ns)
+{
+    struct timespec ts = {
+        .tv_sec = ns / 1000000000LL,
+        .tv_nsec = ns % 1000000000LL,
+    };
+
+    return ts;
+}
+
+/*
+ * Starts the stream and waits for the position to move. The position may
+ * carry over from before a stop, so moving means two reads that differ.
+ */
+static int mmap_start(const struct bench_case *c, struct audio_stream *stream,
+                      int64_t burst_ns, struct bench_result *r)
+{
+    struct audio_mmap_position position;
+    const struct timespec poll = to_timespec(burst_ns / 4);
+    const int64_t start_ns = clock_ns(CLOCK_MONOTONIC);
+    int64_t first = -1;
+    int ret;
+
+    ret = mmap_call(c, stream, MMAP_START, 0, NULL, NULL);
+    if (ret != 0)
+        return ret;
+    do {
+        ret = mmap_call(c, stream, MMAP_POSITION, 0, NULL, &position);
+        if (ret == 0) {
+            if (first < 0) {
+                first = position.position_frames;
+            } else if (position.position_frames != first) {
+                log_start(r, clock_ns(CLOCK_MONOTONIC) - start_ns);
+                return 0;
+            }
+        }
+        nanosleep(&poll, NULL);
+    } while (clock_ns(CLOCK_MONOTONIC) - start_ns < MMAP_START_TIMEOUT_NS);
+    return ret != 0 ? ret : -ETIMEDOUT;
+}
+
+static int run_mmap(const struct bench_case *c, struct audio_stream *stream,
+                    int seconds, int restarts, struct bench_result *r)
+{
+    struct audio_mmap_buffer_info info;
+    struct audio_mmap_position position;
+    const int64_t end_ns = clock_ns(CLOCK_MONOTONIC) + seconds * 1000000000LL;
+    const int64_t restart_ns = seconds * 1000000000LL / (restarts + 1);
+    int64_t next_restart_ns, burst_ns;
+    int ret;
+
+    if (!has_mmap(c, stream))
+        return -ENOSYS;
+
+    memset(&info, 0, sizeof(info));
+    ret = mmap_call(c, stream, MMAP_CREATE, c->sample_rate / 100, &info, NULL);
+    if (ret != 0)
+        return ret;
+    burst_ns = (int64_t)info.burst_size_frames * 1000000000LL / c->sample_rate;
+    if (burst_ns <= 0)
+        return -EINVAL;
+
+    ret = mmap_start(c, stream, burst_ns, r);
+    next_restart_ns = clock_ns(CLOCK_MONOTONIC) + restart_ns;
+    while (ret == 0 && clock_ns(CLOCK_MONOTONIC) < end_ns) {
+        const struct timespec period = to_timespec(burst_ns);
+        const int64_t cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        const int64_t start_ns = clock_ns(CLOCK_MONOTONIC);
+
+        ret = mmap_call(c, stream, MMAP_POSITION, 0, NULL, &position);
+        if (ret == 0)
+            ret = log_call(r, clock_ns(CLOCK_MONOTONIC) - start_ns,
+                           clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_ns);
+        nanosleep(&period, NULL);
+
+        if (ret == 0 && clock_ns(CLOCK_MONOTONIC) >= next_restart_ns) {
+            mmap_call(c, stream, MMAP_STOP, 0, NULL, NULL);
+            ret = mmap_start(c, stream, burst_ns, r);
+            next_restart_ns += restart_ns;
+        }
+    }
+    mmap_call(c, stream, MMAP_STOP, 0, NULL, NULL);
+    return ret;
+}
+
+static int64_t percentile(const int64_t *sorted, size_t count, int p)
+{
+    return count ? sorted[(count - 1) * p / 100] : 0;
+}
+
+static void run_case(const struct bench_case *c, int seconds, int restarts)
+{
+    struct bench_result r;
+    struct audio_stream *stream;
+    int ret;
+
+    memset(&r, 0, sizeof(r));
+    dev->set_parameters(dev, "perf_stats_reset=1");
+    ret = open_stream(c, &stream);
+    if (ret != 0) {
+        printf("%-20s open failed: %s\n", c->name, strerror(-ret));
+        return;
+    }
+    if (c->mmap)
+        ret = run_mmap(c, stream, seconds, restarts, &r);
+    else
+        ret = run_pcm(c, stream, seconds, restarts, &r);
+    stream->standby(stream);
+    close_stream(c, stream);
+    r.underruns = hal_underruns();
+
+    if (ret != 0) {
+        printf("%-20s stopped: %s\n", c->name, strerror(-ret));
+        if (r.calls == 0 && r.starts == 0) {
+            free(r.call_ns);
+            return;
+        }
+    }
+    qsort(r.call_ns, r.calls, sizeof(r.call_ns[0]), cmp_int64);
+    qsort(r.start_ns, r.starts, sizeof(r.start_ns[0]), cmp_int64);
+    printf("%-20s %7zu %7lld %7lld %7lld %7lld %9u %8lld %7lld %7lld\n", c->name, r.calls,
+           (long long)percentile(r.call_ns, r.calls, 50) / 1000,
+           (long long)percentile(r.call_ns, r.calls, 90) / 1000,
+           (long long)percentile(r.call_ns, r.calls, 99) / 1000,
+           (long long)percentile(r.call_ns, r.calls, 100) / 1000,
+           r.underruns, (long long)(r.calls ? r.cpu_ns / (int64_t)r.calls / 1000 : 0),
+           (long long)percentile(r.start_ns, r.starts, 50) / 1000,
+           (long long)percentile(r.start_ns, r.starts, 100) / 1000);
+    free(r.call_ns);
+}
+
+int main(int argc, char **argv)
+{
+    const struct hw_module_t *module;
+    int seconds = DEFAULT_SECONDS, restarts = DEFAULT_RESTARTS;
+    const char *prefix = NULL;
+    size_t i;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, "d:r:")) != -1) {
+        switch (opt) {
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'r':
+            restarts = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d seconds] [-r restarts] [case name prefix]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+        prefix = argv[optind];
+    if (seconds < 1 || restarts < 0 || restarts >= MAX_STARTS) {
+        fprintf(stderr, "need at least 1 second and fewer than %d restarts\n", MAX_STARTS);
+        return EXIT_FAILURE;
+    }
+
+    ret = hw_get_module_by_class(AUDIO_HARDWARE_MODULE_ID, AUDIO_HARDWARE_MODULE_ID_PRIMARY,
+                                 &module);
+    if (ret == 0)
+        ret = audio_hw_device_open(module, &dev);
+    if (ret != 0) {
+        fprintf(stderr, "cannot open the primary audio HAL: %s\n", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    /* latencies in us, cpu in us per call */
+    printf("%-20s %7s %7s %7s %7s %7s %9s %8s %7s %7s\n", "case", "calls", "p50", "p90",
+           "p99", "max", "underruns", "cpu", "start50", "startmx");
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (prefix == NULL || strncmp(cases[i].name, prefix, strlen(prefix)) == 0)
+            run_case(&cases[i], seconds, restarts);
+    }
+    audio_hw_device_close(dev);
+    return EXIT_SUCCESS;
+}
@@ -18,11 +18,13 @@
 /*#define LOG_NDEBUG 0*/
 #define LOG_NDDEBUG 0
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <math.h>
 #include <log/log.h>
 #include <cutils/str_parms.h>
+#include <utils/Timers.h>
 
 #include "audio_hw.h"
 #include "voice.h"
@@ -31,6 +33,18 @@
 #include "platform_api.h"
 #include "audio_extn/tfa_98xx.h"
 
+#define AUDIO_PARAMETER_KEY_VOICE_SETUP_LATENCY "voice_setup_latency"
+
+static const char * const voice_setup_phase_names[VOICE_SETUP_PHASES] = {
+    [VOICE_SETUP_WAIT] = "wait",
+    [VOICE_SETUP_ROUTING] = "routing",
+    [VOICE_SETUP_CALIBRATION] = "calibration",
+    [VOICE_SETUP_PCM_OPEN] = "pcm_open",
+    [VOICE_SETUP_PCM_START] = "pcm_start",
+    [VOICE_SETUP_CONTROLS] = "controls",
+    [VOICE_SETUP_MODEM] = "modem",
+};
+
 struct pcm_config pcm_config_voice_call = {
     .channels = 1,
     .rate = 8000,
@@ -99,6 +113,53 @@ void voice_set_sidetone(struct audio_device *adev,
     return;
 }
 
+void voice_setup_request(struct voice_session *session)
+{
+    session->setup.request_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+/* closes the phase that started at *mark_ns and starts the next one */
+static void voice_setup_mark(struct voice_setup_profile *setup, int phase,
+                             int64_t *mark_ns)
+{
+    const int64_t now_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    setup->phase_ns[phase] = now_ns - *mark_ns;
+    *mark_ns = now_ns;
+}
+
+static void voice_setup_done(struct voice_session *session, int64_t start_ns,
+                             int status)
+{
+    struct voice_setup_profile *setup = &session->setup;
+    int i;
+
+    if (status != 0) {
+        setup->failures++;
+        setup->request_ns = 0;
+        return;
+    }
+    setup->total_ns = systemTime(SYSTEM_TIME_MONOTONIC) - start_ns;
+    for (i = 0; i < VOICE_SETUP_PHASES; i++) {
+        if (setup->phase_ns[i] > setup->max_phase_ns[i])
+            setup->max_phase_ns[i] = setup->phase_ns[i];
+    }
+    if (setup->total_ns > setup->max_total_ns)
+        setup->max_total_ns = setup->total_ns;
+    setup->count++;
+    setup->request_ns = 0;
+    ALOGI("%s: vsid %x up in %lld us (wait %lld routing %lld cal %lld open %lld "
+          "start %lld controls %lld modem %lld)", __func__, session->vsid,
+          (long long)(setup->total_ns / 1000),
+          (long long)(setup->phase_ns[VOICE_SETUP_WAIT] / 1000),
+          (long long)(setup->phase_ns[VOICE_SETUP_ROUTING] / 1000),
+          (long long)(setup->phase_ns[VOICE_SETUP_CALIBRATION] / 1000),
+          (long long)(setup->phase_ns[VOICE_SETUP_PCM_OPEN] / 1000),
+          (long long)(setup->phase_ns[VOICE_SETUP_PCM_START] / 1000),
+          (long long)(setup->phase_ns[VOICE_SETUP_CONTROLS] / 1000),
+          (long long)(setup->phase_ns[VOICE_SETUP_MODEM] / 1000));
+}
+
 int voice_stop_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
 {
     int i, ret = 0;
@@ -146,8 +207,8 @@ int voice_stop_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
         ALOGD("%s: unMute voice Tx", __func__);
     }
 
-    list_remove(&uc_info->list);
-    free(uc_info);
+    remove_usecase_from_list(adev, uc_info);
+    free_usecase(adev, uc_info);
 
     ALOGD("%s: exit: status(%d)", __func__, ret);
     return ret;
@@ -160,11 +221,16 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
     int pcm_dev_rx_id, pcm_dev_tx_id;
     struct voice_session *session = NULL;
     struct pcm_config voice_config = pcm_config_voice_call;
+    int64_t start_ns, mark_ns;
 
     ALOGD("%s: enter usecase:%s", __func__, use_case_table[usecase_id]);
 
     session = (struct voice_session *)voice_get_session_from_use_case(adev, usecase_id);
-    uc_info = (struct audio_usecase *)calloc(1, sizeof(struct audio_usecase));
+    memset(session->setup.phase_ns, 0, sizeof(session->setup.phase_ns));
+    start_ns = mark_ns = session->setup.request_ns ? session->setup.request_ns :
+                                                     systemTime(SYSTEM_TIME_MONOTONIC);
+    voice_setup_mark(&session->setup, VOICE_SETUP_WAIT, &mark_ns);
+    uc_info = alloc_usecase(adev);
     uc_info->id = usecase_id;
     uc_info->type = VOICE_CALL;
     uc_info->stream.out = adev->current_call_output ;
@@ -173,9 +239,16 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
     uc_info->out_snd_device = SND_DEVICE_NONE;
     adev->use_voice_device_mute = false;
 
-    list_add_tail(&adev->usecase_list, &uc_info->list);
+    add_usecase_to_list(adev, uc_info);
 
+    /* select_devices() applies the device mixer paths while the RX and TX
+       cal are still going out on the dispatcher; ending the batch waits for
+       the cal, which only has to land before the voice pcms are opened */
+    platform_begin_audio_calibration_batch(adev->platform);
     select_devices(adev, usecase_id);
+    voice_setup_mark(&session->setup, VOICE_SETUP_ROUTING, &mark_ns);
+    platform_end_audio_calibration_batch(adev->platform);
+    voice_setup_mark(&session->setup, VOICE_SETUP_CALIBRATION, &mark_ns);
 
     pcm_dev_rx_id = platform_get_pcm_device_id(uc_info->id, PCM_PLAYBACK);
     pcm_dev_tx_id = platform_get_pcm_device_id(uc_info->id, PCM_CAPTURE);
@@ -209,6 +282,8 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
         goto error_start_voice;
     }
 
+    voice_setup_mark(&session->setup, VOICE_SETUP_PCM_OPEN, &mark_ns);
+
     if (adev->mic_break_enabled)
         platform_set_mic_break_det(adev->platform, true);
 
@@ -219,6 +294,7 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
     ret = pcm_start(session->pcm_rx);
     if (ret != 0)
         goto error_start_voice;
+    voice_setup_mark(&session->setup, VOICE_SETUP_PCM_START, &mark_ns);
 
     audio_extn_tfa_98xx_enable_speaker();
 
@@ -227,12 +303,14 @@ int voice_start_usecase(struct audio_device *adev, audio_usecase_t usecase_id)
         voice_set_sidetone(adev, uc_info->out_snd_device, true);
 
     voice_set_volume(adev, adev->voice.volume);
+    voice_setup_mark(&session->setup, VOICE_SETUP_CONTROLS, &mark_ns);
 
     ret = platform_start_voice_call(adev->platform, session->vsid);
     if (ret < 0) {
         ALOGE("%s: platform_start_voice_call error %d\n", __func__, ret);
         goto error_start_voice;
     }
+    voice_setup_mark(&session->setup, VOICE_SETUP_MODEM, &mark_ns);
 
     session->state.current = CALL_ACTIVE;
     goto done;
@@ -241,6 +319,7 @@ error_start_voice:
     voice_stop_usecase(adev, usecase_id);
 
 done:
+    voice_setup_done(session, start_ns, ret);
     ALOGD("%s: exit: status(%d)", __func__, ret);
     return ret;
 }
@@ -462,7 +541,54 @@ void voice_get_parameters(struct audio_device *adev,
                           struct str_parms *query,
                           struct str_parms *reply)
 {
+    char value[512];
+    size_t len = 0;
+    int i, phase;
+
     voice_extn_get_parameters(adev, query, reply);
+
+    if (str_parms_get_str(query, AUDIO_PARAMETER_KEY_VOICE_SETUP_LATENCY,
+                          value, sizeof(value)) < 0)
+        return;
+
+    /* "vsid:count:failures:total:wait:routing:calibration:pcm_open:pcm_start:
+       controls:modem" for the last setup of each session that has one, in us, separated by '|' */
+    value[0] = '\0';
+    for (i = 0; i < MAX_VOICE_SESSIONS && len < sizeof(value); i++) {
+        const struct voice_setup_profile *setup = &adev->voice.session[i].setup;
+
+        if (setup->count == 0 && setup->failures == 0)
+            continue;
+        len += snprintf(value + len, sizeof(value) - len, "%s%x:%u:%u:%lld",
+                        len ? "|" : "", adev->voice.session[i].vsid, setup->count,
+                        setup->failures, (long long)(setup->total_ns / 1000));
+        for (phase = 0; phase < VOICE_SETUP_PHASES && len < sizeof(value); phase++)
+            len += snprintf(value + len, sizeof(value) - len, ":%lld",
+                            (long long)(setup->phase_ns[phase] / 1000));
+    }
+    str_parms_add_str(reply, AUDIO_PARAMETER_KEY_VOICE_SETUP_LATENCY, value);
+}
+
+void voice_dump(struct audio_device *adev, int fd)
+{
+    int i, phase;
+
+    dprintf(fd, "  Voice call setup:\n");
+    for (i = 0; i < MAX_VOICE_SESSIONS; i++) {
+        const struct voice_setup_profile *setup = &adev->voice.session[i].setup;
+
+        if (setup->count == 0 && setup->failures == 0)
+            continue;
+        dprintf(fd, "    vsid %x: %u setups, %u failed, last %lld us, max %lld us\n",
+                adev->voice.session[i].vsid, setup->count, setup->failures,
+                (long long)(setup->total_ns / 1000),
+                (long long)(setup->max_total_ns / 1000));
+        for (phase = 0; phase < VOICE_SETUP_PHASES; phase++)
+            dprintf(fd, "      %-12s last %8lld us max %8lld us\n",
+                    voice_setup_phase_names[phase],
+                    (long long)(setup->phase_ns[phase] / 1000),
+                    (long long)(setup->max_phase_ns[phase] / 1000));
+    }
 }
 
 int voice_set_parameters(struct audio_device *adev, struct str_parms *parms)
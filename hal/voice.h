@@ -47,15 +47,40 @@ struct call_state {
     int new;
 };
 
+/* phases of voice_start_usecase(), in the order they run */
+enum {
+    VOICE_SETUP_WAIT,         /* call state update to voice_start_usecase() */
+    VOICE_SETUP_ROUTING,      /* select_devices() */
+    VOICE_SETUP_CALIBRATION,  /* waiting for the batched device cal */
+    VOICE_SETUP_PCM_OPEN,
+    VOICE_SETUP_PCM_START,
+    VOICE_SETUP_CONTROLS,     /* speaker amp, sidetone and voice volume */
+    VOICE_SETUP_MODEM,        /* platform_start_voice_call(), CSD client on fusion */
+    VOICE_SETUP_PHASES,
+};
+
+struct voice_setup_profile {
+    int64_t request_ns;       /* when the session was asked to go active */
+    int64_t phase_ns[VOICE_SETUP_PHASES];      /* last setup */
+    int64_t max_phase_ns[VOICE_SETUP_PHASES];
+    int64_t total_ns;
+    int64_t max_total_ns;
+    uint32_t count;
+    uint32_t failures;
+};
+
 struct voice_session {
     struct pcm *pcm_rx;
     struct pcm *pcm_tx;
     struct call_state state;
     uint32_t vsid;
+    struct voice_setup_profile setup;
 };
 
 struct voice {
     struct voice_session session[MAX_VOICE_SESSIONS];
+    uint32_t pending_sessions;   /* bit per session whose state.new is not applied */
+    uint32_t in_call_sessions;   /* bit per session not in CALL_INACTIVE */
     int tty_mode;
     bool hac;
     bool mic_mute;
@@ -96,5 +121,7 @@ void voice_set_sidetone(struct audio_device *adev,
                        bool enable);
 bool voice_is_call_state_active(struct audio_device *adev);
 void voice_set_device_mute_flag (struct audio_device *adev, bool state);
+void voice_setup_request(struct voice_session *session);
+void voice_dump(struct audio_device *adev, int fd);
 
 #endif //VOICE_H
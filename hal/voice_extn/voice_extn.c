@@ -82,18 +82,46 @@ static bool is_valid_call_state(int call_state)
         return true;
 }
 
+static int get_session_idx_for_vsid(uint32_t vsid)
+{
+    switch (vsid) {
+    case VOICE_VSID:
+        return VOICE_SESS_IDX;
+    case VOICE2_VSID:
+        return VOICE2_SESS_IDX;
+    case VOLTE_VSID:
+        return VOLTE_SESS_IDX;
+    case QCHAT_VSID:
+        return QCHAT_SESS_IDX;
+    case VOWLAN_VSID:
+        return VOWLAN_SESS_IDX;
+    case VOICEMMODE1_VSID:
+        return MMODE1_SESS_IDX;
+    case VOICEMMODE2_VSID:
+        return MMODE2_SESS_IDX;
+    default:
+        return -1;
+    }
+}
+
 static bool is_valid_vsid(uint32_t vsid)
 {
-    if (vsid == VOICE_VSID ||
-        vsid == VOICE2_VSID ||
-        vsid == VOLTE_VSID ||
-        vsid == QCHAT_VSID ||
-        vsid == VOICEMMODE1_VSID ||
-        vsid == VOICEMMODE2_VSID ||
-        vsid == VOWLAN_VSID)
-        return true;
+    return get_session_idx_for_vsid(vsid) >= 0;
+}
+
+/* voice_start_usecase() and voice_stop_usecase() move state.current
+   themselves, bring the session masks back in line after each step */
+static void sync_session_state(struct audio_device *adev, int index)
+{
+    const struct voice_session *session = &adev->voice.session[index];
+    const uint32_t bit = 1u << index;
+
+    if (session->state.current != CALL_INACTIVE)
+        adev->voice.in_call_sessions |= bit;
     else
-        return false;
+        adev->voice.in_call_sessions &= ~bit;
+    if (session->state.new == session->state.current)
+        adev->voice.pending_sessions &= ~bit;
 }
 
 static audio_usecase_t voice_extn_get_usecase_for_session_idx(const int index)
@@ -140,10 +168,17 @@ static uint32_t get_session_id_with_state(struct audio_device *adev,
                                           int call_state)
 {
     struct voice_session *session = NULL;
-    int i = 0;
+    uint32_t mask;
     uint32_t session_id = 0;
+    int i;
 
-    for (i = 0; i < MAX_VOICE_SESSIONS; i++) {
+    if (call_state == CALL_INACTIVE) {
+        mask = ~adev->voice.in_call_sessions & ((1u << MAX_VOICE_SESSIONS) - 1);
+    } else {
+        mask = adev->voice.in_call_sessions;
+    }
+    for (; mask != 0; mask &= mask - 1) {
+        i = __builtin_ctz(mask);
         session = &adev->voice.session[i];
         if(session->state.current == call_state){
             session_id = session->vsid;
@@ -160,12 +195,15 @@ static int update_calls(struct audio_device *adev)
     audio_usecase_t usecase_id = 0;
     enum voice_lch_mode lch_mode;
     struct voice_session *session = NULL;
+    uint32_t pending;
     int fd = 0;
     int ret = 0;
 
-    ALOGD("%s: enter:", __func__);
+    ALOGD("%s: enter: pending sessions 0x%x", __func__, adev->voice.pending_sessions);
 
-    for (i = 0; i < MAX_VOICE_SESSIONS; i++) {
+    /* sessions whose state already matches the request have nothing to do */
+    for (pending = adev->voice.pending_sessions; pending != 0; pending &= pending - 1) {
+        i = __builtin_ctz(pending);
         usecase_id = voice_extn_get_usecase_for_session_idx(i);
         session = &adev->voice.session[i];
         ALOGD("%s: cur_state=%d new_state=%d vsid=%x",
@@ -216,6 +254,8 @@ static int update_calls(struct audio_device *adev)
             case CALL_HOLD:
             case CALL_LOCAL_HOLD:
                 ALOGD("%s: ACTIVE/HOLD/LOCAL_HOLD -> INACTIVE vsid:%x", __func__, session->vsid);
+                /* voice_stop_usecase() asks whether any other call is still up */
+                adev->voice.in_call_sessions &= ~(1u << i);
                 ret = voice_stop_usecase(adev, usecase_id);
                 if(ret < 0) {
                     ALOGE("%s: voice_stop_usecase() failed for usecase: %d\n",
@@ -282,6 +322,9 @@ static int update_calls(struct audio_device *adev)
         default:
             break;
         } //end out switch loop
+
+        /* a transition that failed stays pending and is retried on the next update */
+        sync_session_state(adev, i);
     } //end for loop
 
     return ret;
@@ -291,18 +334,25 @@ static int update_call_states(struct audio_device *adev,
                                     const uint32_t vsid, const int call_state)
 {
     struct voice_session *session = NULL;
-    int i = 0;
+    int i = get_session_idx_for_vsid(vsid);
     bool is_call_active;
 
-    for (i = 0; i < MAX_VOICE_SESSIONS; i++) {
-        if (vsid == adev->voice.session[i].vsid) {
-            session = &adev->voice.session[i];
-            break;
-        }
-    }
+    if (i >= 0)
+        session = &adev->voice.session[i];
 
     if (session) {
+        if (call_state == CALL_ACTIVE && session->state.current == CALL_INACTIVE &&
+                session->state.new != CALL_ACTIVE)
+            voice_setup_request(session);
         session->state.new = call_state;
+        if (call_state != session->state.current)
+            adev->voice.pending_sessions |= 1u << i;
+        else
+            adev->voice.pending_sessions &= ~(1u << i);
+        if (adev->voice.pending_sessions == 0) {
+            ALOGV("%s: vsid:%x already in state %d", __func__, vsid, call_state);
+            return 0;
+        }
         voice_extn_is_call_state_active(adev, &is_call_active);
         ALOGD("%s is_call_active:%d in_call:%d, mode:%d\n",
               __func__, is_call_active, adev->voice.in_call, adev->mode);
@@ -335,17 +385,7 @@ int voice_extn_get_active_session_id(struct audio_device *adev,
 
 int voice_extn_is_call_state_active(struct audio_device *adev, bool *is_call_active)
 {
-    struct voice_session *session = NULL;
-    int i = 0;
-    *is_call_active = false;
-
-    for (i = 0; i < MAX_VOICE_SESSIONS; i++) {
-        session = &adev->voice.session[i];
-        if(session->state.current != CALL_INACTIVE){
-            *is_call_active = true;
-            break;
-        }
-    }
+    *is_call_active = adev->voice.in_call_sessions != 0;
 
     return 0;
 }
@@ -444,6 +484,7 @@ int voice_extn_stop_call(struct audio_device *adev)
         for (i = 0; i < MAX_VOICE_SESSIONS; i++) {
             adev->voice.session[i].state.new = CALL_INACTIVE;
         }
+        adev->voice.pending_sessions = adev->voice.in_call_sessions;
 
         ret = update_calls(adev);
     }
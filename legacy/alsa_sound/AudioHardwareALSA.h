@@ -336,8 +336,32 @@ public:
     status_t            open(int mode);
     status_t            close();
 
+    // Use case family of the stream, resolved when the stream is created.
+    // Routing may switch mHandle->useCase between its verb and modifier
+    // spelling but never to another family.
+    enum OutUseCase {
+        OUT_USE_CASE_MUSIC,
+        OUT_USE_CASE_MUSIC2,
+        OUT_USE_CASE_LOWLATENCY,
+        OUT_USE_CASE_VOIP,
+        OUT_USE_CASE_LPA,
+        OUT_USE_CASE_TUNNEL,
+        OUT_USE_CASE_OTHER,
+    };
+
+    // write() only routes and opens the device in OUT_STATE_STANDBY
+    enum OutState {
+        OUT_STATE_STANDBY,
+        OUT_STATE_ACTIVE,
+    };
+
 private:
+    void                resolveUseCase();
+    status_t            startFromStandby();
+
     uint32_t            mFrameCount;
+    OutUseCase          mUseCase;
+    OutState            mState;
 
 protected:
     AudioHardwareALSA *     mParent;
@@ -426,17 +450,26 @@ private:
 #ifdef QCOM_SSR_ENABLED
     // Function to read coefficients from files.
     status_t            readCoeffsFromFile();
+    status_t            allocSurroundBuffers(int objSize);
+    void                releaseSurroundBuffers();
+    static bool         surroundSampleFormatSupported(int format);
+    static void         narrowSurroundSamples(int16_t *dst, const void *src,
+                                              int samples, int format);
 
     FILE                *mFp_4ch;
     FILE                *mFp_6ch;
-    int16_t             **mRealCoeffs;
-    int16_t             **mImagCoeffs;
+    int16_t             *mCoeffs;      // private copy, the library may write it
+    int16_t             *mRealCoeffs[COEFF_ARRAY_SIZE];
+    int16_t             *mImagCoeffs[COEFF_ARRAY_SIZE];
     void                *mSurroundObj;
+    int                 mSurroundObjSize;
 
     int16_t             *mSurroundInputBuffer;
     int16_t             *mSurroundOutputBuffer;
     int                 mSurroundInputBufferIdx;
     int                 mSurroundOutputBufferIdx;
+    void                *mSurroundWideBuffer; // one period wider than 16 bit
+    int                 mSurroundWideBufferSize;
 #endif
 
 protected:
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <sys/mman.h>
 
 #define LOG_TAG "AudioStreamInALSA"
 //#define LOG_NDEBUG 0
@@ -62,6 +63,61 @@ namespace android_audio_legacy
 
 // Use AAC/DTS channel mapping as default channel mapping: C,FL,FR,Ls,Rs,LFE
 const int chanMap[] = { 1, 2, 4, 3, 0, 5 };
+
+static const char * const sRealCoeffFiles[COEFF_ARRAY_SIZE] = {
+    SURROUND_FILE_1R, SURROUND_FILE_2R, SURROUND_FILE_3R, SURROUND_FILE_4R,
+};
+static const char * const sImagCoeffFiles[COEFF_ARRAY_SIZE] = {
+    SURROUND_FILE_1I, SURROUND_FILE_2I, SURROUND_FILE_3I, SURROUND_FILE_4I,
+};
+
+// The filter coefficient files are the same for every surround stream: they
+// are mapped once per process, read only. surround_filters_init() takes the
+// coefficients non const, so each stream hands it a private copy refilled
+// from the maps at every start. The copy and the processing buffers of the
+// last stream closed are kept for the next one, so a 5.1 recording start
+// does neither file I/O nor large allocations after the first one.
+static Mutex sSurroundLock;
+static const int16_t *sRealCoeffs[COEFF_ARRAY_SIZE];
+static const int16_t *sImagCoeffs[COEFF_ARRAY_SIZE];
+
+#define COEFF_BLOCK_SIZE (2 * COEFF_ARRAY_SIZE * FILT_SIZE)
+
+static struct {
+    int16_t *coeffs;
+    int16_t *inputBuffer;
+    int16_t *outputBuffer;
+    void *obj;
+    int objSize;
+} sSurroundSpare;
+
+static const int16_t *mapCoeffFile(const char *path)
+{
+    const size_t size = FILT_SIZE * sizeof(int16_t);
+    struct stat st;
+    void *map = MAP_FAILED;
+    int16_t *coeffs;
+    int fd;
+
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Cannot open filter co-efficient file %s", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)size)
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+        ::close(fd);
+        return (const int16_t *)map;
+    }
+
+    // short file: the missing coefficients stay zero
+    coeffs = (int16_t *)calloc(FILT_SIZE, sizeof(int16_t));
+    if (coeffs != NULL && read(fd, coeffs, size) < 0)
+        ALOGW("Error reading filter co-efficient file %s", path);
+    ::close(fd);
+    return coeffs;
+}
 #endif
 
 AudioStreamInALSA::AudioStreamInALSA(AudioHardwareALSA *parent,
@@ -74,13 +130,17 @@ AudioStreamInALSA::AudioStreamInALSA(AudioHardwareALSA *parent,
 #ifdef QCOM_SSR_ENABLED
     , mFp_4ch(NULL),
     mFp_6ch(NULL),
-    mRealCoeffs(NULL),
-    mImagCoeffs(NULL),
+    mCoeffs(NULL),
+    mRealCoeffs(),
+    mImagCoeffs(),
     mSurroundObj(NULL),
+    mSurroundObjSize(0),
     mSurroundOutputBuffer(NULL),
     mSurroundInputBuffer(NULL),
     mSurroundOutputBufferIdx(0),
-    mSurroundInputBufferIdx(0)
+    mSurroundInputBufferIdx(0),
+    mSurroundWideBuffer(NULL),
+    mSurroundWideBufferSize(0)
 #endif
 {
 #ifdef QCOM_SSR_ENABLED
@@ -332,7 +392,27 @@ ssize_t AudioStreamInALSA::read(void *buffer, ssize_t bytes)
         int samples = bytes >> 1;
         void *buffer_start = buffer;
         int period_bytes = mHandle->handle->period_size;
-        int period_samples = period_bytes >> 1;
+
+        // the surround filters take 16 bit samples, wider periods are read
+        // into a scratch buffer and narrowed into the input buffer
+        unsigned sample_bits = mHandle->handle->sample_bits;
+        bool wide = sample_bits && sample_bits != 16;
+        if (wide && !surroundSampleFormatSupported(mHandle->handle->sample_format)) {
+            ALOGE("read: surround capture does not take format %d (%u bits)",
+                  mHandle->handle->sample_format, sample_bits);
+            return -EINVAL;
+        }
+        if (wide && mSurroundWideBufferSize < period_bytes) {
+            void *wide_buffer = realloc(mSurroundWideBuffer, period_bytes);
+            if (wide_buffer == NULL)
+                return -ENOMEM;
+            mSurroundWideBuffer = wide_buffer;
+            mSurroundWideBufferSize = period_bytes;
+        }
+        // samples of all kernel channels delivered by one period
+        int period_samples = mHandle->handle->hw_channels ?
+                             pcm_bytes_to_frames(mHandle->handle, period_bytes) *
+                             mHandle->handle->hw_channels : period_bytes >> 1;
 
         do {
             if (mSurroundOutputBufferIdx > 0) {
@@ -367,7 +447,8 @@ ssize_t AudioStreamInALSA::read(void *buffer, ssize_t bytes)
             read_pending = SSR_INPUT_FRAME_SIZE - mSurroundInputBufferIdx;
             read = mSurroundInputBufferIdx;
             while (mHandle->handle && read_pending > 0) {
-                n = pcm_read(mHandle->handle, &mSurroundInputBuffer[read],
+                n = pcm_read(mHandle->handle,
+                             wide ? mSurroundWideBuffer : &mSurroundInputBuffer[read],
                              period_bytes);
                 ALOGV("pcm_read() returned n = %d buffer:%p size:%d", n, &mSurroundInputBuffer[read], period_bytes);
                 if (n && n != -EAGAIN) {
@@ -379,6 +460,10 @@ ssize_t AudioStreamInALSA::read(void *buffer, ssize_t bytes)
                     return static_cast<ssize_t>(n);
                 }
                 else {
+                    if (wide)
+                        narrowSurroundSamples(&mSurroundInputBuffer[read],
+                                              mSurroundWideBuffer, period_samples,
+                                              mHandle->handle->sample_format);
                     read_pending -= period_samples;
                     read += period_samples;
                 }
@@ -529,37 +614,7 @@ status_t AudioStreamInALSA::close()
 #ifdef QCOM_SSR_ENABLED
     if (mSurroundObj) {
         surround_filters_release(mSurroundObj);
-        if (mSurroundObj)
-            free(mSurroundObj);
-        mSurroundObj = NULL;
-        if (mRealCoeffs){
-            for (int i =0; i<COEFF_ARRAY_SIZE; i++ ) {
-                if (mRealCoeffs[i]) {
-                    free(mRealCoeffs[i]);
-                    mRealCoeffs[i] = NULL;
-                }
-            }
-            free(mRealCoeffs);
-            mRealCoeffs = NULL;
-        }
-        if (mImagCoeffs){
-            for (int i =0; i<COEFF_ARRAY_SIZE; i++ ) {
-                if (mImagCoeffs[i]) {
-                    free(mImagCoeffs[i]);
-                    mImagCoeffs[i] = NULL;
-                }
-            }
-            free(mImagCoeffs);
-            mImagCoeffs = NULL;
-        }
-        if (mSurroundOutputBuffer){
-            free(mSurroundOutputBuffer);
-            mSurroundOutputBuffer = NULL;
-        }
-        if (mSurroundInputBuffer) {
-            free(mSurroundInputBuffer);
-            mSurroundInputBuffer = NULL;
-        }
+        releaseSurroundBuffers();
 
         if ( mFp_4ch ) fclose(mFp_4ch);
         if ( mFp_6ch ) fclose(mFp_6ch);
@@ -628,6 +683,39 @@ status_t AudioStreamInALSA::setAcousticParams(void *params)
 }
 
 #ifdef QCOM_SSR_ENABLED
+// Sample formats read() can narrow to the 16 bit the surround filters take.
+bool AudioStreamInALSA::surroundSampleFormatSupported(int format)
+{
+    switch (format) {
+    case SNDRV_PCM_FORMAT_S24_LE:
+    case SNDRV_PCM_FORMAT_S24_3LE:
+    case SNDRV_PCM_FORMAT_S32_LE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Keeps the top 16 bits of each sample of one period in format.
+void AudioStreamInALSA::narrowSurroundSamples(int16_t *dst, const void *src,
+                                              int samples, int format)
+{
+    int i;
+
+    if (format == SNDRV_PCM_FORMAT_S24_3LE) {
+        const uint8_t *in = (const uint8_t *)src;
+        for (i = 0; i < samples; i++, in += 3)
+            dst[i] = (int16_t)(in[1] | (in[2] << 8));
+        return;
+    }
+
+    const int32_t *in = (const int32_t *)src;
+    // S24_LE carries the sample in the low 24 bits of each word
+    int shift = format == SNDRV_PCM_FORMAT_S24_LE ? 8 : 16;
+    for (i = 0; i < samples; i++)
+        dst[i] = (int16_t)(in[i] >> shift);
+}
+
 status_t AudioStreamInALSA::initSurroundSoundLibrary(unsigned long buffersize)
 {
     int subwoofer = 0;  // subwoofer channel assignment: default as first microphone input channel
@@ -643,38 +731,9 @@ status_t AudioStreamInALSA::initSurroundSoundLibrary(unsigned long buffersize)
         return ALREADY_EXISTS;
     }
 
-    // Allocate memory for input buffer
-    mSurroundInputBuffer = (Word16 *) calloc(2 * SSR_INPUT_FRAME_SIZE,
-                                              sizeof(Word16));
-    if ( !mSurroundInputBuffer ) {
-       ALOGE("Memory allocation failure. Not able to allocate memory for surroundInputBuffer");
-       goto init_fail;
-    }
-
-    // Allocate memory for output buffer
-    mSurroundOutputBuffer = (Word16 *) calloc(2 * SSR_OUTPUT_FRAME_SIZE,
-                                               sizeof(Word16));
-    if ( !mSurroundOutputBuffer ) {
-       ALOGE("Memory allocation failure. Not able to allocate memory for surroundOutputBuffer");
-       goto init_fail;
-    }
-
-    // Allocate memory for real and imag coeffs array
-    mRealCoeffs = (Word16 **) calloc(COEFF_ARRAY_SIZE, sizeof(Word16 *));
-    if ( !mRealCoeffs ) {
-        ALOGE("Memory allocation failure during real Coefficient array");
-        goto init_fail;
-    }
-
-    mImagCoeffs = (Word16 **) calloc(COEFF_ARRAY_SIZE, sizeof(Word16 *));
-    if ( !mImagCoeffs ) {
-        ALOGE("Memory allocation failure during imaginary Coefficient array");
-        goto init_fail;
-    }
-
     if( readCoeffsFromFile() != NO_ERROR) {
         ALOGE("Error while loading coeffs from file");
-        goto init_fail;
+        return NAME_NOT_FOUND;
     }
 
     //calculate the size of data to allocate for mSurroundObj
@@ -688,75 +747,110 @@ status_t AudioStreamInALSA::initSurroundSoundLibrary(unsigned long buffersize)
                   high_freq,
                   NULL);
 
-    if ( ret > 0 ) {
-        ALOGV("Allocating surroundObj size is %d", ret);
-        mSurroundObj = (void *)malloc(ret);
-        memset(mSurroundObj,0,ret);
-        if (NULL != mSurroundObj) {
-            //initialize after allocating the memory for mSurroundObj
-            ret = surround_filters_init(mSurroundObj,
-                        6,
-                        4,
-                        mRealCoeffs,
-                        mImagCoeffs,
-                        subwoofer,
-                        low_freq,
-                        high_freq,
-                        NULL);
-            if (0 != ret) {
-               ALOGE("surround_filters_init failed with ret:%d",ret);
-               surround_filters_release(mSurroundObj);
-               goto init_fail;
-            }
-        } else {
-            ALOGE("Allocationg mSurroundObj failed");
-            goto init_fail;
-        }
-    } else {
+    if ( ret <= 0 ) {
         ALOGE("surround_filters_init(mSurroundObj=Null) failed with ret: %d",ret);
-        goto init_fail;
+        releaseSurroundBuffers();
+        return NO_MEMORY;
+    }
+
+    ALOGV("Allocating surroundObj size is %d", ret);
+    if (allocSurroundBuffers(ret) != NO_ERROR) {
+        ALOGE("Memory allocation failure for surround sound buffers");
+        releaseSurroundBuffers();
+        return NO_MEMORY;
+    }
+
+    //initialize after allocating the memory for mSurroundObj
+    ret = surround_filters_init(mSurroundObj,
+                6,
+                4,
+                mRealCoeffs,
+                mImagCoeffs,
+                subwoofer,
+                low_freq,
+                high_freq,
+                NULL);
+    if (0 != ret) {
+       ALOGE("surround_filters_init failed with ret:%d",ret);
+       surround_filters_release(mSurroundObj);
+       releaseSurroundBuffers();
+       return NO_MEMORY;
     }
 
     (void) surround_filters_set_channel_map(mSurroundObj, chanMap);
 
     return NO_ERROR;
+}
 
-init_fail:
-    if (mSurroundObj) {
-        free(mSurroundObj);
-        mSurroundObj = NULL;
-    }
-    if (mSurroundOutputBuffer) {
+// Takes the spare processing buffers, or allocates new ones when another
+// stream holds them or the filter state has grown. All are zeroed.
+status_t AudioStreamInALSA::allocSurroundBuffers(int objSize)
+{
+    Mutex::Autolock autoLock(sSurroundLock);
+
+    if (sSurroundSpare.obj != NULL && sSurroundSpare.objSize >= objSize) {
+        mSurroundInputBuffer = sSurroundSpare.inputBuffer;
+        mSurroundOutputBuffer = sSurroundSpare.outputBuffer;
+        mSurroundObj = sSurroundSpare.obj;
+        memset(mSurroundInputBuffer, 0, 2 * SSR_INPUT_FRAME_SIZE * sizeof(Word16));
+        memset(mSurroundOutputBuffer, 0, 2 * SSR_OUTPUT_FRAME_SIZE * sizeof(Word16));
+        memset(mSurroundObj, 0, sSurroundSpare.objSize);
+        mSurroundObjSize = sSurroundSpare.objSize;
+        sSurroundSpare.inputBuffer = NULL;
+        sSurroundSpare.outputBuffer = NULL;
+        sSurroundSpare.obj = NULL;
+        sSurroundSpare.objSize = 0;
+        return NO_ERROR;
+    }
+
+    mSurroundInputBuffer = (Word16 *) calloc(2 * SSR_INPUT_FRAME_SIZE, sizeof(Word16));
+    mSurroundOutputBuffer = (Word16 *) calloc(2 * SSR_OUTPUT_FRAME_SIZE, sizeof(Word16));
+    mSurroundObj = calloc(1, objSize);
+    mSurroundObjSize = objSize;
+    if (!mSurroundInputBuffer || !mSurroundOutputBuffer || !mSurroundObj) {
+        free(mSurroundInputBuffer);
         free(mSurroundOutputBuffer);
+        free(mSurroundObj);
+        mSurroundInputBuffer = NULL;
         mSurroundOutputBuffer = NULL;
+        mSurroundObj = NULL;
+        return NO_MEMORY;
     }
-    if (mSurroundInputBuffer) {
+    return NO_ERROR;
+}
+
+// Keeps the buffers as the spare set if there is none yet, frees them otherwise.
+// Also releases the coefficient copy, so it is safe after a partial init.
+void AudioStreamInALSA::releaseSurroundBuffers()
+{
+    Mutex::Autolock autoLock(sSurroundLock);
+
+    if (sSurroundSpare.coeffs == NULL)
+        sSurroundSpare.coeffs = mCoeffs;
+    else
+        free(mCoeffs);
+    mCoeffs = NULL;
+    memset(mRealCoeffs, 0, sizeof(mRealCoeffs));
+    memset(mImagCoeffs, 0, sizeof(mImagCoeffs));
+
+    if (mSurroundObj != NULL && sSurroundSpare.obj == NULL) {
+        sSurroundSpare.inputBuffer = mSurroundInputBuffer;
+        sSurroundSpare.outputBuffer = mSurroundOutputBuffer;
+        sSurroundSpare.obj = mSurroundObj;
+        sSurroundSpare.objSize = mSurroundObjSize;
+    } else {
         free(mSurroundInputBuffer);
-        mSurroundInputBuffer = NULL;
-    }
-    if (mRealCoeffs){
-        for (int i =0; i<COEFF_ARRAY_SIZE; i++ ) {
-            if (mRealCoeffs[i]) {
-                free(mRealCoeffs[i]);
-                mRealCoeffs[i] = NULL;
-            }
-        }
-        free(mRealCoeffs);
-        mRealCoeffs = NULL;
-    }
-    if (mImagCoeffs){
-        for (int i =0; i<COEFF_ARRAY_SIZE; i++ ) {
-            if (mImagCoeffs[i]) {
-                free(mImagCoeffs[i]);
-                mImagCoeffs[i] = NULL;
-            }
-        }
-        free(mImagCoeffs);
-        mImagCoeffs = NULL;
+        free(mSurroundOutputBuffer);
+        free(mSurroundObj);
     }
+    mSurroundInputBuffer = NULL;
+    mSurroundOutputBuffer = NULL;
+    mSurroundObj = NULL;
+    mSurroundObjSize = 0;
 
-    return NO_MEMORY;
-
+    free(mSurroundWideBuffer);
+    mSurroundWideBuffer = NULL;
+    mSurroundWideBufferSize = 0;
 }
 
 
@@ -764,100 +858,36 @@ init_fail:
 // coeff array member variable
 status_t AudioStreamInALSA::readCoeffsFromFile()
 {
-    FILE    *flt1r;
-    FILE    *flt2r;
-    FILE    *flt3r;
-    FILE    *flt4r;
-    FILE    *flt1i;
-    FILE    *flt2i;
-    FILE    *flt3i;
-    FILE    *flt4i;
-
-    if ( (flt1r = fopen(SURROUND_FILE_1R, "rb")) == NULL ) {
-        ALOGE("Cannot open filter co-efficient file %s", SURROUND_FILE_1R);
-        return NAME_NOT_FOUND;
-    }
-
-    if ( (flt2r = fopen(SURROUND_FILE_2R, "rb")) == NULL ) {
-        ALOGE("Cannot open filter co-efficient file %s", SURROUND_FILE_2R);
-        return NAME_NOT_FOUND;
-    }
-
-    if ( (flt3r = fopen(SURROUND_FILE_3R, "rb")) == NULL ) {
-        ALOGE("Cannot open filter co-efficient file %s", SURROUND_FILE_3R);
-        return  NAME_NOT_FOUND;
-    }
-
-    if ( (flt4r = fopen(SURROUND_FILE_4R, "rb")) == NULL ) {
-        ALOGE("Cannot open filter co-efficient file %s", SURROUND_FILE_4R);
-        return  NAME_NOT_FOUND;
-    }
-
-    if ( (flt1i = fopen(SURROUND_FILE_1I, "rb")) == NULL ) {
-        ALOGE("Cannot open filter co-efficient file %s", SURROUND_FILE_1I);
-        return NAME_NOT_FOUND;
-    }
-
-    if ( (flt2i = fopen(SURROUND_FILE_2I, "rb")) == NULL ) {
-        ALOGE("Cannot open filter co-efficient file %s", SURROUND_FILE_2I);
-        return NAME_NOT_FOUND;
-    }
-
-    if ( (flt3i = fopen(SURROUND_FILE_3I, "rb")) == NULL ) {
-        ALOGE("Cannot open filter co-efficient file %s", SURROUND_FILE_3I);
-        return NAME_NOT_FOUND;
-    }
-
-    if ( (flt4i = fopen(SURROUND_FILE_4I, "rb")) == NULL ) {
-        ALOGE("Cannot open filter co-efficient file %s", SURROUND_FILE_4I);
-        return NAME_NOT_FOUND;
-    }
-    ALOGV("readCoeffsFromFile all filter files opened");
-
-    for (int i=0; i<COEFF_ARRAY_SIZE; i++) {
-        mRealCoeffs[i] = (Word16 *)calloc(FILT_SIZE, sizeof(Word16));
-    }
-    for (int i=0; i<COEFF_ARRAY_SIZE; i++) {
-        mImagCoeffs[i] = (Word16 *)calloc(FILT_SIZE, sizeof(Word16));
-    }
-
-    // Read real co-efficients
-    if (NULL != mRealCoeffs[0]) {
-        fread(mRealCoeffs[0], sizeof(int16), FILT_SIZE, flt1r);
-    }
-    if (NULL != mRealCoeffs[0]) {
-        fread(mRealCoeffs[1], sizeof(int16), FILT_SIZE, flt2r);
-    }
-    if (NULL != mRealCoeffs[0]) {
-        fread(mRealCoeffs[2], sizeof(int16), FILT_SIZE, flt3r);
-    }
-    if (NULL != mRealCoeffs[0]) {
-        fread(mRealCoeffs[3], sizeof(int16), FILT_SIZE, flt4r);
-    }
-
-    // read imaginary co-efficients
-    if (NULL != mImagCoeffs[0]) {
-        fread(mImagCoeffs[0], sizeof(int16), FILT_SIZE, flt1i);
-    }
-    if (NULL != mImagCoeffs[0]) {
-        fread(mImagCoeffs[1], sizeof(int16), FILT_SIZE, flt2i);
-    }
-    if (NULL != mImagCoeffs[0]) {
-        fread(mImagCoeffs[2], sizeof(int16), FILT_SIZE, flt3i);
-    }
-    if (NULL != mImagCoeffs[0]) {
-        fread(mImagCoeffs[3], sizeof(int16), FILT_SIZE, flt4i);
-    }
-
-    fclose(flt1r);
-    fclose(flt2r);
-    fclose(flt3r);
-    fclose(flt4r);
-    fclose(flt1i);
-    fclose(flt2i);
-    fclose(flt3i);
-    fclose(flt4i);
+    Mutex::Autolock autoLock(sSurroundLock);
+    status_t err = NO_ERROR;
 
+    // a file that failed before is retried, the ones mapped are kept
+    for (int i = 0; i < COEFF_ARRAY_SIZE; i++) {
+        if (sRealCoeffs[i] == NULL)
+            sRealCoeffs[i] = mapCoeffFile(sRealCoeffFiles[i]);
+        if (sImagCoeffs[i] == NULL)
+            sImagCoeffs[i] = mapCoeffFile(sImagCoeffFiles[i]);
+        if (sRealCoeffs[i] == NULL || sImagCoeffs[i] == NULL)
+            err = NAME_NOT_FOUND;
+    }
+    if (err != NO_ERROR)
+        return err;
+
+    if (mCoeffs == NULL) {
+        mCoeffs = sSurroundSpare.coeffs;
+        sSurroundSpare.coeffs = NULL;
+    }
+    if (mCoeffs == NULL)
+        mCoeffs = (int16_t *)malloc(COEFF_BLOCK_SIZE * sizeof(int16_t));
+    if (mCoeffs == NULL)
+        return NO_MEMORY;
+    for (int i = 0; i < COEFF_ARRAY_SIZE; i++) {
+        mRealCoeffs[i] = mCoeffs + (2 * i) * FILT_SIZE;
+        mImagCoeffs[i] = mCoeffs + (2 * i + 1) * FILT_SIZE;
+        memcpy(mRealCoeffs[i], sRealCoeffs[i], FILT_SIZE * sizeof(int16_t));
+        memcpy(mImagCoeffs[i], sImagCoeffs[i], FILT_SIZE * sizeof(int16_t));
+    }
+    ALOGV("readCoeffsFromFile all filter coefficients loaded");
     return NO_ERROR;
 }
 #endif
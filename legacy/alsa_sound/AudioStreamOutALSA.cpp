@@ -48,6 +48,22 @@ namespace android_audio_legacy
 
 static const int DEFAULT_SAMPLE_RATE = ALSA_DEFAULT_SAMPLE_RATE;
 
+// Verb and modifier spelling of each use case family, indexed by OutUseCase.
+// Only families with flip set are switched between the two spellings by
+// startFromStandby(); LPA and tunnel keep the one they were opened with.
+static const struct {
+    const char *verb;
+    const char *modifier;
+    bool flip;
+} sOutUseCaseNames[] = {
+    { SND_USE_CASE_VERB_HIFI, SND_USE_CASE_MOD_PLAY_MUSIC, true },
+    { SND_USE_CASE_VERB_HIFI2, SND_USE_CASE_MOD_PLAY_MUSIC2, true },
+    { SND_USE_CASE_VERB_HIFI_LOWLATENCY_MUSIC, SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC, true },
+    { SND_USE_CASE_VERB_IP_VOICECALL, SND_USE_CASE_MOD_PLAY_VOIP, true },
+    { SND_USE_CASE_VERB_HIFI_LOW_POWER, SND_USE_CASE_MOD_PLAY_LPA, false },
+    { SND_USE_CASE_VERB_HIFI_TUNNEL, SND_USE_CASE_MOD_PLAY_TUNNEL, false },
+};
+
 // ----------------------------------------------------------------------------
 
 AudioStreamOutALSA::AudioStreamOutALSA(AudioHardwareALSA *parent, alsa_handle_t *handle) :
@@ -55,6 +71,27 @@ AudioStreamOutALSA::AudioStreamOutALSA(AudioHardwareALSA *parent, alsa_handle_t
     mParent(parent),
     mFrameCount(0)
 {
+    resolveUseCase();
+}
+
+void AudioStreamOutALSA::resolveUseCase()
+{
+    unsigned i;
+
+    mUseCase = OUT_USE_CASE_OTHER;
+    for (i = 0; i < sizeof(sOutUseCaseNames) / sizeof(sOutUseCaseNames[0]); i++) {
+        if (!strcmp(mHandle->useCase, sOutUseCaseNames[i].verb) ||
+            !strcmp(mHandle->useCase, sOutUseCaseNames[i].modifier)) {
+            mUseCase = (OutUseCase)i;
+            break;
+        }
+    }
+    // VoIP is started by AudioHardwareALSA, write() never opens it
+    if (mUseCase == OUT_USE_CASE_VOIP || mHandle->handle != NULL)
+        mState = OUT_STATE_ACTIVE;
+    else
+        mState = OUT_STATE_STANDBY;
+    ALOGV("resolveUseCase: %s family %d state %d", mHandle->useCase, mUseCase, mState);
 }
 
 AudioStreamOutALSA::~AudioStreamOutALSA()
@@ -84,33 +121,74 @@ status_t AudioStreamOutALSA::setVolume(float left, float right)
     }
     vol = lrint((volume * 0x2000)+0.5);
 
-    if(!strcmp(mHandle->useCase, SND_USE_CASE_VERB_HIFI_LOW_POWER) ||
-       !strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_LPA)) {
+    if (mUseCase == OUT_USE_CASE_LPA) {
         ALOGV("setLpaVolume(%f)\n", volume);
         ALOGV("Setting LPA volume to %d (available range is 0 to 100)\n", vol);
         mHandle->module->setLpaVolume(vol);
         return status;
     }
-    else if(!strcmp(mHandle->useCase, SND_USE_CASE_VERB_HIFI_TUNNEL) ||
-            !strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_TUNNEL)) {
+    else if (mUseCase == OUT_USE_CASE_TUNNEL) {
         ALOGV("setCompressedVolume(%f)\n", volume);
         ALOGV("Setting Compressed volume to %d (available range is 0 to 100)\n", vol);
         mHandle->module->setCompressedVolume(vol);
         return status;
     }
-    else if(!strncmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL,
-            sizeof(mHandle->useCase)) || !strncmp(mHandle->useCase,
-            SND_USE_CASE_MOD_PLAY_VOIP, sizeof(mHandle->useCase))) {
+    else if (mUseCase == OUT_USE_CASE_VOIP) {
         ALOGV("Avoid Software volume by returning success\n");
         return status;
     }
     return INVALID_OPERATION;
 }
 
+// Routes and opens the device for the first write after standby
+status_t AudioStreamOutALSA::startFromStandby()
+{
+    Mutex::Autolock autoLock(mParent->mLock);
+    char *use_case;
+    bool verbIdle, flip;
+
+    ALOGD("mHandle->useCase: %s", mHandle->useCase);
+    snd_use_case_get(mHandle->ucMgr, "_verb", (const char **)&use_case);
+    verbIdle = (use_case == NULL) || (!strcmp(use_case, SND_USE_CASE_VERB_INACTIVE));
+    free(use_case);
+    flip = mUseCase != OUT_USE_CASE_OTHER && sOutUseCaseNames[mUseCase].flip;
+    if (flip) {
+        strlcpy(mHandle->useCase, verbIdle ? sOutUseCaseNames[mUseCase].verb :
+                sOutUseCaseNames[mUseCase].modifier, sizeof(mHandle->useCase));
+    }
+
+#ifdef QCOM_USBAUDIO_ENABLED
+    if((mDevices & AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET)||
+       (mDevices & AudioSystem::DEVICE_OUT_DGTL_DOCK_HEADSET)||
+       (mDevices & AudioSystem::DEVICE_OUT_PROXY)) {
+        mDevices |= AudioSystem::DEVICE_OUT_PROXY;
+    }
+#endif
+    mHandle->module->route(mHandle, mDevices , mParent->mode());
+    if (verbIdle && flip) {
+        snd_use_case_set(mHandle->ucMgr, "_verb", mHandle->useCase);
+    } else {
+        snd_use_case_set(mHandle->ucMgr, "_enamod", mHandle->useCase);
+    }
+    mHandle->module->open(mHandle);
+    if(mHandle->handle == NULL) {
+        ALOGE("write:: device open failed");
+        return NO_INIT;
+    }
+#ifdef QCOM_USBAUDIO_ENABLED
+    if((mHandle->devices == AudioSystem::DEVICE_IN_ANLG_DOCK_HEADSET)||
+       (mHandle->devices == AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET)){
+        mParent->startUsbPlaybackIfNotStarted();
+        mParent->musbPlaybackState |= USBPLAYBACKBIT_MUSIC;
+    }
+#endif
+    mState = OUT_STATE_ACTIVE;
+    return NO_ERROR;
+}
+
 ssize_t AudioStreamOutALSA::write(const void *buffer, size_t bytes)
 {
     int period_size;
-    char *use_case;
 
     ALOGV("write:: buffer %p, bytes %d", buffer, bytes);
 
@@ -120,99 +198,13 @@ ssize_t AudioStreamOutALSA::write(const void *buffer, size_t bytes)
 
     int write_pending = bytes;
 
-    if((mHandle->handle == NULL) && (mHandle->rxHandle == NULL) &&
-         (strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL)) &&
-         (strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP))) {
-        mParent->mLock.lock();
-
-        ALOGD("mHandle->useCase: %s", mHandle->useCase);
-        snd_use_case_get(mHandle->ucMgr, "_verb", (const char **)&use_case);
-        if ((use_case == NULL) || (!strcmp(use_case, SND_USE_CASE_VERB_INACTIVE))) {
-            if(!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP)){
-                strlcpy(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL,
-                        sizeof(SND_USE_CASE_VERB_IP_VOICECALL));
-            } else if(!strcmp(mHandle->useCase,SND_USE_CASE_MOD_PLAY_MUSIC2)) {
-                strlcpy(mHandle->useCase, SND_USE_CASE_VERB_HIFI2,
-                        sizeof(SND_USE_CASE_MOD_PLAY_MUSIC2));
-            } else if (!strcmp(mHandle->useCase,SND_USE_CASE_MOD_PLAY_MUSIC)){
-                strlcpy(mHandle->useCase, SND_USE_CASE_VERB_HIFI,
-                        sizeof(SND_USE_CASE_MOD_PLAY_MUSIC));
-            } else if(!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC)) {
-                strlcpy(mHandle->useCase, SND_USE_CASE_VERB_HIFI_LOWLATENCY_MUSIC,
-                        sizeof(SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC));
-            }
-        } else {
-            if(!strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL)){
-                strlcpy(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP,
-                        sizeof(SND_USE_CASE_MOD_PLAY_VOIP));
-            } else if(!strcmp(mHandle->useCase,SND_USE_CASE_VERB_HIFI2)) {
-                strlcpy(mHandle->useCase, SND_USE_CASE_MOD_PLAY_MUSIC2,
-                        sizeof(SND_USE_CASE_MOD_PLAY_MUSIC2));
-            } else if (!strcmp(mHandle->useCase,SND_USE_CASE_VERB_HIFI)){
-                strlcpy(mHandle->useCase, SND_USE_CASE_MOD_PLAY_MUSIC,
-                        sizeof(SND_USE_CASE_MOD_PLAY_MUSIC));
-            } else if(!strcmp(mHandle->useCase, SND_USE_CASE_VERB_HIFI_LOWLATENCY_MUSIC)) {
-                strlcpy(mHandle->useCase, SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC,
-                        sizeof(SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC));
-            }
-        }
-        free(use_case);
-        if((!strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL)) ||
-           (!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP))) {
-#ifdef QCOM_USBAUDIO_ENABLED
-            if((mDevices & AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET)||
-                  (mDevices & AudioSystem::DEVICE_OUT_DGTL_DOCK_HEADSET)||
-                  (mDevices & AudioSystem::DEVICE_OUT_PROXY)) {
-                mDevices |= AudioSystem::DEVICE_OUT_PROXY;
-                mHandle->module->route(mHandle, mDevices , mParent->mode());
-            }else
-#endif
-            {
-              mHandle->module->route(mHandle, mDevices , AudioSystem::MODE_IN_COMMUNICATION);
-            }
-#ifdef QCOM_USBAUDIO_ENABLED
-        } else if((mDevices & AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET)||
-                  (mDevices & AudioSystem::DEVICE_OUT_DGTL_DOCK_HEADSET)||
-                  (mDevices & AudioSystem::DEVICE_OUT_PROXY)) {
-            mDevices |= AudioSystem::DEVICE_OUT_PROXY;
-            mHandle->module->route(mHandle, mDevices , mParent->mode());
-#endif
-        } else {
-            mHandle->module->route(mHandle, mDevices , mParent->mode());
-        }
-        if (!strcmp(mHandle->useCase, SND_USE_CASE_VERB_HIFI) ||
-            !strcmp(mHandle->useCase, SND_USE_CASE_VERB_HIFI2) ||
-            !strcmp(mHandle->useCase, SND_USE_CASE_VERB_HIFI_LOWLATENCY_MUSIC) ||
-            !strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL)) {
-            snd_use_case_set(mHandle->ucMgr, "_verb", mHandle->useCase);
-        } else {
-            snd_use_case_set(mHandle->ucMgr, "_enamod", mHandle->useCase);
-        }
-        if((!strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL)) ||
-          (!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP))) {
-             err = mHandle->module->startVoipCall(mHandle);
-        }
-        else
-             mHandle->module->open(mHandle);
-        if(mHandle->handle == NULL) {
-            ALOGE("write:: device open failed");
-            mParent->mLock.unlock();
+    if (mState == OUT_STATE_STANDBY) {
+        if (mHandle->handle != NULL) {
+            // reopened by a routing change while in standby
+            mState = OUT_STATE_ACTIVE;
+        } else if (startFromStandby() != NO_ERROR) {
             return bytes;
         }
-#ifdef QCOM_USBAUDIO_ENABLED
-        if((mHandle->devices == AudioSystem::DEVICE_IN_ANLG_DOCK_HEADSET)||
-               (mHandle->devices == AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET)){
-            if((!strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL)) ||
-               (!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP))) {
-                mParent->musbPlaybackState |= USBPLAYBACKBIT_VOIPCALL;
-            } else {
-                mParent->startUsbPlaybackIfNotStarted();
-                mParent->musbPlaybackState |= USBPLAYBACKBIT_MUSIC;
-            }
-        }
-#endif
-
-        mParent->mLock.unlock();
     }
 
 #ifdef QCOM_USBAUDIO_ENABLED
@@ -222,8 +214,7 @@ ssize_t AudioStreamOutALSA::write(const void *buffer, size_t bytes)
         mParent->mLock.lock();
         mParent->startUsbPlaybackIfNotStarted();
         ALOGV("Starting playback on USB");
-        if(!strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL) ||
-           !strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP)) {
+        if (mUseCase == OUT_USE_CASE_VOIP) {
             ALOGD("Setting VOIPCALL bit here, musbPlaybackState %d", mParent->musbPlaybackState);
             mParent->musbPlaybackState |= USBPLAYBACKBIT_VOIPCALL;
         }else{
@@ -254,8 +245,7 @@ ssize_t AudioStreamOutALSA::write(const void *buffer, size_t bytes)
                 ALOGE("pcm_write returned error %d, trying to recover\n", n);
                 pcm_close(mHandle->handle);
                 mHandle->handle = NULL;
-                if((!strncmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL, strlen(SND_USE_CASE_VERB_IP_VOICECALL))) ||
-                  (!strncmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP, strlen(SND_USE_CASE_MOD_PLAY_VOIP)))) {
+                if (mUseCase == OUT_USE_CASE_VOIP) {
                      pcm_close(mHandle->rxHandle);
                      mHandle->rxHandle = NULL;
                      mHandle->module->startVoipCall(mHandle);
@@ -264,6 +254,8 @@ ssize_t AudioStreamOutALSA::write(const void *buffer, size_t bytes)
                     mHandle->module->open(mHandle);
                 if(mHandle->handle == NULL) {
                    ALOGE("write:: device re-open failed");
+                   if (mUseCase != OUT_USE_CASE_VOIP)
+                       mState = OUT_STATE_STANDBY;
                    mParent->mLock.unlock();
                    return bytes;
                 }
@@ -279,6 +271,10 @@ ssize_t AudioStreamOutALSA::write(const void *buffer, size_t bytes)
 
     } while ((mHandle->handle||(mHandle->rxHandle && mParent->mVoipStreamCount)) && sent < bytes);
 
+    // the device was closed under us, route and open it again next time
+    if (mHandle->handle == NULL && mUseCase != OUT_USE_CASE_VOIP)
+        mState = OUT_STATE_STANDBY;
+
     return sent;
 }
 
@@ -290,8 +286,11 @@ status_t AudioStreamOutALSA::dump(int fd, const Vector<String16>& args)
 status_t AudioStreamOutALSA::open(int mode)
 {
     Mutex::Autolock autoLock(mParent->mLock);
+    status_t err;
 
-    return ALSAStreamOps::open(mode);
+    err = ALSAStreamOps::open(mode);
+    resolveUseCase();
+    return err;
 }
 
 status_t AudioStreamOutALSA::close()
@@ -299,8 +298,7 @@ status_t AudioStreamOutALSA::close()
     Mutex::Autolock autoLock(mParent->mLock);
 
     ALOGV("close");
-    if((!strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL)) ||
-        (!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP))) {
+    if (mUseCase == OUT_USE_CASE_VOIP) {
          if((mParent->mVoipStreamCount)) {
 #ifdef QCOM_USBAUDIO_ENABLED
              if(mParent->mVoipStreamCount == 1) {
@@ -317,8 +315,7 @@ status_t AudioStreamOutALSA::close()
          mParent->mVoipStreamCount = 0;
     }
 #ifdef QCOM_USBAUDIO_ENABLED
-      else if((!strcmp(mHandle->useCase, SND_USE_CASE_VERB_HIFI_LOW_POWER)) ||
-              (!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_LPA))) {
+      else if (mUseCase == OUT_USE_CASE_LPA) {
         mParent->musbPlaybackState &= ~USBPLAYBACKBIT_LPA;
     } else {
         mParent->musbPlaybackState &= ~USBPLAYBACKBIT_MUSIC;
@@ -338,14 +335,12 @@ status_t AudioStreamOutALSA::standby()
 
     ALOGV("standby");
 
-    if((!strcmp(mHandle->useCase, SND_USE_CASE_VERB_IP_VOICECALL)) ||
-      (!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_VOIP))) {
+    if (mUseCase == OUT_USE_CASE_VOIP) {
         return NO_ERROR;
     }
 
 #ifdef QCOM_USBAUDIO_ENABLED
-    if((!strcmp(mHandle->useCase, SND_USE_CASE_VERB_HIFI_LOW_POWER)) ||
-        (!strcmp(mHandle->useCase, SND_USE_CASE_MOD_PLAY_LPA))) {
+    if (mUseCase == OUT_USE_CASE_LPA) {
         ALOGV("Deregistering LPA bit");
         mParent->musbPlaybackState &= ~USBPLAYBACKBIT_LPA;
     } else {
@@ -355,6 +350,7 @@ status_t AudioStreamOutALSA::standby()
 #endif
 
     mHandle->module->standby(mHandle);
+    mState = OUT_STATE_STANDBY;
 
 #ifdef QCOM_USBAUDIO_ENABLED
     mParent->closeUsbPlaybackIfNothingActive();
@@ -429,6 +429,17 @@ void AudioUsbALSA::RecordingThreadEntry() {
     bufsize = musbRecordingHandle->period_size;
     pfdProxyRecording[0].fd = mproxyRecordingHandle->fd;
     pfdProxyRecording[0].events = POLLOUT;
+
+    if (useBridge(musbRecordingHandle, mproxyRecordingHandle)) {
+        mnfdsRecording = nfds;
+        bridgeDevices(musbRecordingHandle, mproxyRecordingHandle, &mkillRecordingThread,
+                      &AudioUsbALSA::pollForUsbDataForRecording,
+                      &AudioUsbALSA::pollForProxyDataForRecording);
+        closeDevice(mproxyRecordingHandle);
+        closeDevice(musbRecordingHandle);
+        ALOGD("Exiting USB Recording thread");
+        return;
+    }
     frames = (musbRecordingHandle->flags & PCM_MONO) ? (bufsize / 2) : (bufsize / 4);
     x.frames = (musbRecordingHandle->flags & PCM_MONO) ? (bufsize / 2) : (bufsize / 4);
 
@@ -765,6 +776,197 @@ void AudioUsbALSA::pollForUsbData(){
     }
 }
 
+void AudioUsbALSA::pollForUsbDataForRecording(){
+    poll(pfdUsbRecording, mnfdsRecording, TIMEOUT_INFINITE);
+}
+
+void AudioUsbALSA::pollForProxyDataForRecording(){
+    poll(pfdProxyRecording, mnfdsRecording, TIMEOUT_INFINITE);
+}
+
+/*
+    Bridge mode moves the audio from the capture side mmap buffer straight
+    into the playback side mmap buffer, skipping the intermediate period
+    buffers. Both ends are opened with the same rate and channel count, so
+    only the frame size has to agree.
+*/
+bool AudioUsbALSA::useBridge(pcm *src, pcm *dst)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("persist.audio.usb.bridge", value, "0");
+    if (!atoi(value)) {
+        return false;
+    }
+    if (!src->addr || !dst->addr || pcm_frame_size(src) != pcm_frame_size(dst)) {
+        ALOGW("Bridge not possible, frame size %u/%u",
+              pcm_frame_size(src), pcm_frame_size(dst));
+        return false;
+    }
+    return true;
+}
+
+void AudioUsbALSA::copyFrames(pcm *src, pcm *dst, unsigned frames)
+{
+    unsigned frameSize = pcm_frame_size(src);
+    unsigned srcFrames = pcm_bytes_to_frames(src, src->buffer_size);
+    unsigned dstFrames = pcm_bytes_to_frames(dst, dst->buffer_size);
+    unsigned srcOffset, dstOffset, count, done = 0;
+
+    //the boundary is a multiple of the buffer size, so the offsets stay
+    //valid across an appl_ptr wrap
+    while (done < frames) {
+        srcOffset = (src->sync_ptr->c.control.appl_ptr + done) % srcFrames;
+        dstOffset = (dst->sync_ptr->c.control.appl_ptr + done) % dstFrames;
+        count = frames - done;
+        if (count > srcFrames - srcOffset)
+            count = srcFrames - srcOffset;
+        if (count > dstFrames - dstOffset)
+            count = dstFrames - dstOffset;
+        memcpy((u_int8_t *)dst->addr + dstOffset * frameSize,
+               (u_int8_t *)src->addr + srcOffset * frameSize, count * frameSize);
+        done += count;
+    }
+}
+
+void AudioUsbALSA::advanceApplPtr(pcm *handle, unsigned frames)
+{
+    handle->sync_ptr->c.control.appl_ptr += frames;
+    if (handle->sync_ptr->c.control.appl_ptr >= handle->sw_p->boundary)
+        handle->sync_ptr->c.control.appl_ptr -= handle->sw_p->boundary;
+    handle->sync_ptr->flags = 0;
+}
+
+void AudioUsbALSA::updateBridgeDrift(pcm *src, pcm *dst, struct bridgeDrift *drift)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    long long srcDelta, dstDelta;
+
+    if (!drift->startNs) {
+        drift->startNs = now;
+        drift->lastLogNs = now;
+        drift->srcHwPtr = src->sync_ptr->s.status.hw_ptr;
+        drift->dstHwPtr = dst->sync_ptr->s.status.hw_ptr;
+        return;
+    }
+    if (now - drift->lastLogNs < USB_BRIDGE_DRIFT_INTERVAL_NS) {
+        return;
+    }
+    drift->lastLogNs = now;
+
+    srcDelta = (long long)src->sync_ptr->s.status.hw_ptr - drift->srcHwPtr;
+    if (srcDelta < 0)
+        srcDelta += src->sw_p->boundary;
+    dstDelta = (long long)dst->sync_ptr->s.status.hw_ptr - drift->dstHwPtr;
+    if (dstDelta < 0)
+        dstDelta += dst->sw_p->boundary;
+    if (dstDelta > 0) {
+        ALOGD("Bridge drift %lld ppm over %lld ms, %lu frames dropped",
+              (srcDelta - dstDelta) * 1000000 / dstDelta,
+              (long long)((now - drift->startNs) / 1000000), drift->droppedFrames);
+    }
+}
+
+void AudioUsbALSA::bridgeDevices(pcm *src, pcm *dst, bool *killThread,
+                                 void (AudioUsbALSA::*pollSrc)(),
+                                 void (AudioUsbALSA::*pollDst)())
+{
+    struct bridgeDrift drift;
+    unsigned srcFrames = pcm_bytes_to_frames(src, src->buffer_size);
+    unsigned dstFrames = pcm_bytes_to_frames(dst, dst->buffer_size);
+    unsigned startThreshold = dst->sw_p->start_threshold;
+    long srcAvail, dstAvail, frames;
+    int err;
+
+    if (startThreshold > dstFrames)
+        startThreshold = dstFrames;
+    memset(&drift, 0, sizeof(drift));
+    ALOGD("Bridging %p to %p, buffers %u/%u frames", src, dst, srcFrames, dstFrames);
+
+    while (!*killThread) {
+        if ((!src->running && pcm_prepare(src)) ||
+            (!dst->running && pcm_prepare(dst))) {
+            ALOGE("ERROR: pcm_prepare failed for bridge");
+            *killThread = true;
+            break;
+        }
+        if (!src->start) {
+            err = startDevice(src, killThread);
+            if (err == EPIPE) {
+                continue;
+            } else if (err != NO_ERROR) {
+                *killThread = true;
+                break;
+            }
+        }
+
+        src->sync_ptr->flags = SNDRV_PCM_SYNC_PTR_APPL | SNDRV_PCM_SYNC_PTR_AVAIL_MIN;
+        dst->sync_ptr->flags = SNDRV_PCM_SYNC_PTR_APPL | SNDRV_PCM_SYNC_PTR_AVAIL_MIN;
+        err = syncPtr(src, killThread);
+        if (err == NO_ERROR)
+            err = syncPtr(dst, killThread);
+        if (err == EPIPE) {
+            drift.startNs = 0;
+            continue;
+        } else if (err != NO_ERROR) {
+            *killThread = true;
+            break;
+        }
+
+        srcAvail = pcm_avail(src);
+        if (srcAvail < (long)src->sw_p->avail_min) {
+            (this->*pollSrc)();
+            continue;
+        }
+        dstAvail = pcm_avail(dst);
+        if (dstAvail < (long)dst->sw_p->avail_min) {
+            //The playback clock runs slower than the capture clock. Once
+            //half of the capture buffer is queued drop the oldest frames
+            //rather than letting the capture side overrun.
+            if (dst->start && srcAvail > (long)srcFrames / 2) {
+                frames = srcAvail - src->sw_p->avail_min;
+                advanceApplPtr(src, frames);
+                drift.droppedFrames += frames;
+                err = syncPtr(src, killThread);
+                if (err != NO_ERROR && err != EPIPE) {
+                    *killThread = true;
+                    break;
+                }
+                continue;
+            }
+            (this->*pollDst)();
+            continue;
+        }
+
+        frames = srcAvail < dstAvail ? srcAvail : dstAvail;
+        copyFrames(src, dst, frames);
+        advanceApplPtr(src, frames);
+        advanceApplPtr(dst, frames);
+        err = syncPtr(src, killThread);
+        if (err == NO_ERROR)
+            err = syncPtr(dst, killThread);
+        if (err == EPIPE) {
+            drift.startNs = 0;
+            continue;
+        } else if (err != NO_ERROR) {
+            *killThread = true;
+            break;
+        }
+
+        if (!dst->start) {
+            if (dstFrames - pcm_avail(dst) >= startThreshold) {
+                err = startDevice(dst, killThread);
+                if (err != NO_ERROR && err != EPIPE) {
+                    *killThread = true;
+                    break;
+                }
+            }
+        } else {
+            updateBridgeDrift(src, dst, &drift);
+        }
+    }
+}
+
 void AudioUsbALSA::PlaybackThreadEntry() {
     ALOGD("PlaybackThreadEntry");
     mnfdsPlayback = 2;
@@ -836,6 +1038,17 @@ void AudioUsbALSA::PlaybackThreadEntry() {
         pfdProxyPlayback[1].events = (POLLIN | POLLOUT| POLLERR | POLLNVAL);
     }
 
+    if (useBridge(mproxyPlaybackHandle, musbPlaybackHandle)) {
+        bridgeDevices(mproxyPlaybackHandle, musbPlaybackHandle, &mkillPlayBackThread,
+                      &AudioUsbALSA::pollForProxyData, &AudioUsbALSA::pollForUsbData);
+        mproxypfdPlayback = -1;
+        musbpfdPlayback = -1;
+        closeDevice(mproxyPlaybackHandle);
+        closeDevice(musbPlaybackHandle);
+        ALOGD("Exiting USB Playback Thread");
+        return;
+    }
+
     frames = (mproxyPlaybackHandle->flags & PCM_MONO) ? (proxyPeriod / 2) : (proxyPeriod / 4);
     x.frames = (mproxyPlaybackHandle->flags & PCM_MONO) ? (proxyPeriod / 2) : (proxyPeriod / 4);
     int usbframes = (musbPlaybackHandle->flags & PCM_MONO) ? (usbPeriod / 2) : (usbPeriod / 4);
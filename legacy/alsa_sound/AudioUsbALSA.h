@@ -38,6 +38,7 @@ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 #include <system/audio.h>
 #include <hardware/audio.h>
 #include <utils/threads.h>
+#include <utils/Timers.h>
 
 #define DEFAULT_BUFFER_SIZE   2048
 #define POLL_TIMEOUT   3000
@@ -51,6 +52,9 @@ IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.*/
 
 #define PATH "/proc/asound/card1/stream0"
 
+// Interval at which the clock drift of a bridge is reported
+#define USB_BRIDGE_DRIFT_INTERVAL_NS 5000000000LL
+
 extern "C" {
    #include <sound/asound.h>
    #include "alsa_audio.h"
@@ -86,6 +90,15 @@ private:
     pthread_t mRecordingUsb;
     snd_use_case_mgr_t *mUcMgr;
 
+    //Clock drift between the two ends of a bridge
+    struct bridgeDrift {
+        nsecs_t startNs;
+        nsecs_t lastLogNs;
+        unsigned srcHwPtr;
+        unsigned dstHwPtr;
+        unsigned long droppedFrames;
+    };
+
     //Helper functions
     struct pcm * configureDevice(unsigned flags, char* hw, int sampleRate, int channelCount, int periodSize, bool playback);
     status_t syncPtr(struct pcm *handle, bool *killThread);
@@ -100,6 +113,15 @@ private:
 
     status_t startDevice(pcm *handle, bool *killThread);
 
+    //bridge mode, copies straight between the two mmap buffers
+    bool useBridge(pcm *src, pcm *dst);
+    void bridgeDevices(pcm *src, pcm *dst, bool *killThread,
+                       void (AudioUsbALSA::*pollSrc)(),
+                       void (AudioUsbALSA::*pollDst)());
+    void copyFrames(pcm *src, pcm *dst, unsigned frames);
+    void advanceApplPtr(pcm *handle, unsigned frames);
+    void updateBridgeDrift(pcm *src, pcm *dst, struct bridgeDrift *drift);
+
     void PlaybackThreadEntry();
     static void *PlaybackThreadWrapper(void *me);
 
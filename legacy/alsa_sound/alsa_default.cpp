@@ -671,6 +671,15 @@ static status_t s_open(alsa_handle_t *handle)
         (!strcmp(handle->useCase, SND_USE_CASE_MOD_PLAY_MUSIC))) {
         ALOGV("Music case");
         flags = PCM_OUT;
+        if ((!strcmp(handle->useCase, SND_USE_CASE_VERB_HIFI_LOWLATENCY_MUSIC)) ||
+            (!strcmp(handle->useCase, SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC))) {
+            char value[PROPERTY_VALUE_MAX];
+            property_get("persist.audio.lowlatency.timer", value, "0");
+            if (atoi(value)) {
+                // sleep on the period timer rather than in WRITEI_FRAMES
+                flags |= PCM_TIMER;
+            }
+        }
     } else {
         flags = PCM_IN;
     }
@@ -53,6 +53,7 @@ LOCAL_LICENSE_CONDITIONS:= notice restricted
 LOCAL_MODULE_TAGS := optional
 LOCAL_SHARED_LIBRARIES:= libc libcutils #libutils #libmedia libhardware_legacy
 LOCAL_CFLAGS := -DQC_PROP -DCONFIG_DIR=\"/system/etc/snd_soc_msm/\"
+LOCAL_CFLAGS += -DUCM_CACHE_DIR=\"/data/misc/audio/\"
 
 LOCAL_SHARED_LIBRARIES += libdl
 include $(BUILD_SHARED_LIBRARY)
@@ -42,6 +42,17 @@ struct pcm {
     int card_no;
     int device_no;
     int start;
+    /* appl_ptr in sync_ptr matches the kernel since the last prepare */
+    int appl_synced;
+    /* status/control pages, NULL when the kernel does not map them */
+    struct snd_pcm_mmap_status *mmap_status;
+    struct snd_pcm_mmap_control *mmap_control;
+    /* frame geometry from param_set_hw_params(), 0 until then */
+    unsigned hw_channels;
+    unsigned sample_bits;
+    unsigned frame_size;
+    /* SNDRV_PCM_FORMAT_* from hw_params, -1 until then */
+    int sample_format;
 };
 
 enum decoder_alias {
@@ -67,6 +78,9 @@ enum decoder_alias {
 #define PCM_MMAP       0x00010000
 #define PCM_NMMAP      0x00000000
 
+/* Wake on the PCM period timer instead of blocking in read/write */
+#define PCM_TIMER      0x20000000
+
 #define DEBUG_ON       0x00000001
 #define DEBUG_OFF      0x00000000
 
@@ -87,6 +101,8 @@ struct mixer_ctl {
     struct mixer *mixer;
     struct snd_ctl_elem_info *info;
     char **ename;
+    /* last value written to the control, NULL if unknown */
+    struct snd_ctl_elem_value *shadow;
 };
 
 #define __snd_alloca(ptr,type) do { *ptr = (type *) alloca(sizeof(type)); memset(*ptr, 0, sizeof(type)); } while (0)
@@ -129,6 +145,8 @@ struct mixer {
     struct snd_ctl_elem_info *info;
     struct mixer_ctl *ctl;
     unsigned count;
+    /* value change events are subscribed, control shadows can be used */
+    int subscribed;
 };
 
 int get_format(const char* name);
@@ -162,6 +180,13 @@ const char *pcm_error(struct pcm *pcm);
 int pcm_buffer_size(struct snd_pcm_hw_params *params);
 int pcm_period_size(struct snd_pcm_hw_params *params);
 
+/* Frame size in bytes as negotiated in hw_params. Falls back to 16 bit
+ * samples and the PCM_MONO/PCM_QUAD/PCM_5POINT1 flags before that.
+ */
+unsigned pcm_frame_size(struct pcm *pcm);
+unsigned pcm_bytes_to_frames(struct pcm *pcm, unsigned bytes);
+unsigned pcm_frames_to_bytes(struct pcm *pcm, unsigned frames);
+
 /* Write data to the fifo.
  * Will start playback on the first write or on a write that
  * occurs after a fifo underrun.
@@ -169,6 +194,19 @@ int pcm_period_size(struct snd_pcm_hw_params *params);
 int pcm_write(struct pcm *pcm, void *data, unsigned count);
 int pcm_read(struct pcm *pcm, void *data, unsigned count);
 
+/* Copy data into the mmap buffer of a PCM_MMAP playback stream and commit
+ * it, waiting for room as needed. Takes a single pointer sync per chunk,
+ * none when the kernel maps the status and control pages.
+ */
+int pcm_mmap_write(struct pcm *pcm, const void *data, unsigned count);
+
+/* Sleep until at least avail_min frames can be transferred or timeout ms
+ * pass (TIMEOUT_INFINITE to wait forever). Wakes once per period on the
+ * PCM timer when the stream was opened with PCM_MMAP or PCM_TIMER.
+ * Returns the available frames, 0 on timeout, -EPIPE on xrun or -errno.
+ */
+long pcm_wait(struct pcm *pcm, int timeout);
+
 struct mixer;
 struct mixer_ctl;
 
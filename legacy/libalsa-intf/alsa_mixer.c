@@ -139,6 +139,7 @@ void mixer_close(struct mixer *mixer)
                     free(mixer->ctl[n].ename[m]);
                 free(mixer->ctl[n].ename);
             }
+            free(mixer->ctl[n].shadow);
         }
         free(mixer->ctl);
     }
@@ -216,6 +217,16 @@ struct mixer *mixer_open(const char *device)
     }
 
     free(eid);
+
+    /* Other clients may write the controls as well, their changes are
+     * picked up from the value events before a shadow is trusted.
+     */
+    n = 1;
+    if (ioctl(fd, SNDRV_CTL_IOCTL_SUBSCRIBE_EVENTS, &n) < 0 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+        ALOGV("no control events, mixer writes are not filtered\n");
+    else
+        mixer->subscribed = 1;
     return mixer;
 
 fail:
@@ -296,6 +307,79 @@ struct mixer_ctl *mixer_get_control(struct mixer *mixer,
     return 0;
 }
 
+static struct mixer_ctl *mixer_get_control_by_numid(struct mixer *mixer,
+                                                     unsigned numid)
+{
+    unsigned n;
+
+    if (!mixer->count)
+        return NULL;
+    /* numids are normally handed out in list order */
+    n = numid - mixer->info[0].id.numid;
+    if (n < mixer->count && mixer->info[n].id.numid == numid)
+        return mixer->ctl + n;
+    for (n = 0; n < mixer->count; n++) {
+        if (mixer->info[n].id.numid == numid)
+            return mixer->ctl + n;
+    }
+    return NULL;
+}
+
+/* Brings the shadows of controls changed since the last call up to date */
+static void mixer_read_events(struct mixer *mixer)
+{
+    struct snd_ctl_event event;
+    struct mixer_ctl *ctl;
+
+    while (read(mixer->fd, &event, sizeof(event)) == sizeof(event)) {
+        if (event.type != SNDRV_CTL_EVENT_ELEM)
+            continue;
+        ctl = mixer_get_control_by_numid(mixer, event.data.elem.id.numid);
+        if (!ctl || !ctl->shadow)
+            continue;
+        if (event.data.elem.mask == SNDRV_CTL_EVENT_MASK_REMOVE ||
+            ioctl(mixer->fd, SNDRV_CTL_IOCTL_ELEM_READ, ctl->shadow) < 0) {
+            free(ctl->shadow);
+            ctl->shadow = NULL;
+        }
+    }
+}
+
+/* Writes ev to the control unless it holds that value already.
+ * UCM transitions replay whole control lists, so most writes of a
+ * device switch repeat the current value; the last known value of
+ * each written control is kept to skip those. Volatile controls can
+ * change without an event and are always written.
+ */
+static int mixer_ctl_write(struct mixer_ctl *ctl, struct snd_ctl_elem_value *ev)
+{
+    int ret;
+
+    if (!ctl->mixer->subscribed ||
+        (ctl->info->access & SNDRV_CTL_ELEM_ACCESS_VOLATILE))
+        return ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, ev);
+
+    mixer_read_events(ctl->mixer);
+    if (ctl->shadow &&
+        !memcmp(&ctl->shadow->value, &ev->value, sizeof(ev->value))) {
+        ALOGV("%s unchanged, skipping write\n", ctl->info->id.name);
+        return 0;
+    }
+
+    ret = ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, ev);
+    if (ret < 0) {
+        /* the control may have been partially updated */
+        free(ctl->shadow);
+        ctl->shadow = NULL;
+        return ret;
+    }
+    if (!ctl->shadow)
+        ctl->shadow = malloc(sizeof(*ctl->shadow));
+    if (ctl->shadow)
+        memcpy(ctl->shadow, ev, sizeof(*ctl->shadow));
+    return ret;
+}
+
 struct mixer_ctl *mixer_get_nth_control(struct mixer *mixer, unsigned n)
 {
     if (n < mixer->count)
@@ -516,7 +600,7 @@ int mixer_ctl_mulvalues(struct mixer_ctl *ctl, int count, char ** argv)
         return errno;
     }
 
-    return ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &ev);
+    return mixer_ctl_write(ctl, &ev);
 }
 
 int mixer_ctl_set(struct mixer_ctl *ctl, unsigned percent)
@@ -600,7 +684,7 @@ int mixer_ctl_set(struct mixer_ctl *ctl, unsigned percent)
         return errno;
     }
 
-    return ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &ev);
+    return mixer_ctl_write(ctl, &ev);
 }
 
 /* the api parses the mixer control input to extract
@@ -681,7 +765,7 @@ static int set_volume_simple(struct mixer_ctl *ctl,
     }
 
     ALOGV("\n");
-    return ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &ev);
+    return mixer_ctl_write(ctl, &ev);
 
 skip:
         if (*p == ',')
@@ -741,7 +825,7 @@ int mixer_ctl_select(struct mixer_ctl *ctl, const char *value)
             memset(&ev, 0, sizeof(ev));
             ev.value.enumerated.item[0] = n;
             ev.id.numid = ctl->info->id.numid;
-            if (ioctl(ctl->mixer->fd, SNDRV_CTL_IOCTL_ELEM_WRITE, &ev) < 0)
+            if (mixer_ctl_write(ctl, &ev) < 0)
                 return -1;
             return 0;
         }
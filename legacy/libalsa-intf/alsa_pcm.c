@@ -333,13 +333,58 @@ int param_set_hw_refine(struct pcm *pcm, struct snd_pcm_hw_params *params)
 
 int param_set_hw_params(struct pcm *pcm, struct snd_pcm_hw_params *params)
 {
+    struct snd_mask *formats;
+    unsigned frame_bits;
+    int format;
+
     if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_HW_PARAMS, params)) {
         return -EPERM;
     }
     pcm->hw_p = params;
+
+    /* the kernel has narrowed every interval down to the chosen value */
+    pcm->hw_channels = param_to_interval(params, SNDRV_PCM_HW_PARAM_CHANNELS)->min;
+    pcm->sample_bits = param_to_interval(params, SNDRV_PCM_HW_PARAM_SAMPLE_BITS)->min;
+    frame_bits = param_to_interval(params, SNDRV_PCM_HW_PARAM_FRAME_BITS)->min;
+    formats = param_to_mask(params, SNDRV_PCM_HW_PARAM_FORMAT);
+    pcm->sample_format = -1;
+    for (format = 0; format <= (int)SNDRV_PCM_FORMAT_LAST; format++) {
+        if (formats->bits[format >> 5] & (1U << (format & 31))) {
+            pcm->sample_format = format;
+            break;
+        }
+    }
+    if (!frame_bits)
+        frame_bits = pcm->hw_channels * pcm->sample_bits;
+    pcm->frame_size = frame_bits / 8;
     return 0;
 }
 
+unsigned pcm_frame_size(struct pcm *pcm)
+{
+    if (pcm->frame_size)
+        return pcm->frame_size;
+
+    /* hw_params not set through param_set_hw_params(), assume 16 bit */
+    if (pcm->flags & PCM_MONO)
+        return 2;
+    else if (pcm->flags & PCM_QUAD)
+        return 8;
+    else if (pcm->flags & PCM_5POINT1)
+        return 12;
+    return 4;
+}
+
+unsigned pcm_bytes_to_frames(struct pcm *pcm, unsigned bytes)
+{
+    return bytes / pcm_frame_size(pcm);
+}
+
+unsigned pcm_frames_to_bytes(struct pcm *pcm, unsigned frames)
+{
+    return frames * pcm_frame_size(pcm);
+}
+
 int param_set_sw_params(struct pcm *pcm, struct snd_pcm_sw_params *sparams)
 {
     if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_SW_PARAMS, sparams)) {
@@ -405,7 +450,8 @@ long pcm_avail(struct pcm *pcm)
                 avail += pcm->sw_p->boundary;
         return avail;
      } else {
-         long avail = sync_ptr->s.status.hw_ptr - sync_ptr->c.control.appl_ptr + ((pcm->flags & PCM_MONO) ? pcm->buffer_size/2 : pcm->buffer_size/4);
+         long avail = sync_ptr->s.status.hw_ptr - sync_ptr->c.control.appl_ptr +
+                      pcm_bytes_to_frames(pcm, pcm->buffer_size);
          if (avail < 0)
               avail += pcm->sw_p->boundary;
          else if ((unsigned long) avail >= pcm->sw_p->boundary)
@@ -427,22 +473,59 @@ int sync_ptr(struct pcm *pcm)
     return 0;
 }
 
+/*
+ * Map the status and control pages so the mmap write path can read hw_ptr
+ * and publish appl_ptr without SNDRV_PCM_IOCTL_SYNC_PTR. Kernels that do
+ * not allow it leave both NULL and the sync_ptr ioctl is used instead.
+ */
+static void mmap_status_control(struct pcm *pcm)
+{
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    void *status, *control;
+
+    status = mmap(NULL, page_size, PROT_READ, MAP_FILE | MAP_SHARED,
+                  pcm->fd, SNDRV_PCM_MMAP_OFFSET_STATUS);
+    if (status == MAP_FAILED)
+        return;
+    control = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED,
+                   pcm->fd, SNDRV_PCM_MMAP_OFFSET_CONTROL);
+    if (control == MAP_FAILED) {
+        munmap(status, page_size);
+        return;
+    }
+    pcm->mmap_status = status;
+    pcm->mmap_control = control;
+}
+
+static void munmap_status_control(struct pcm *pcm)
+{
+    long page_size = sysconf(_SC_PAGE_SIZE);
+
+    if (pcm->mmap_status)
+        munmap(pcm->mmap_status, page_size);
+    if (pcm->mmap_control)
+        munmap(pcm->mmap_control, page_size);
+    pcm->mmap_status = NULL;
+    pcm->mmap_control = NULL;
+}
+
 int mmap_buffer(struct pcm *pcm)
 {
     int err, i;
     char *ptr;
     unsigned size;
     struct snd_pcm_channel_info ch;
-    int channels = (pcm->flags & PCM_MONO) ? 1 : 2;
 
     size = pcm->buffer_size;
     if (pcm->flags & DEBUG_ON)
         ALOGV("size = %d\n", size);
     pcm->addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED,
                            pcm->fd, 0);
-    if (pcm->addr)
+    if (pcm->addr) {
+         if (!(pcm->flags & PCM_IN))
+             mmap_status_control(pcm);
          return 0;
-    else
+    } else
          return -errno;
 }
 
@@ -458,7 +541,7 @@ u_int8_t *dst_address(struct pcm *pcm)
     struct snd_pcm_sync_ptr *sync_ptr = pcm->sync_ptr;
     unsigned int appl_ptr = 0;
 
-    appl_ptr = (pcm->flags & PCM_MONO) ? sync_ptr->c.control.appl_ptr*2 : sync_ptr->c.control.appl_ptr*4;
+    appl_ptr = pcm_frames_to_bytes(pcm, sync_ptr->c.control.appl_ptr);
     pcm_offset = (appl_ptr % (unsigned long)pcm->buffer_size);
     return pcm->addr + pcm_offset;
 
@@ -471,11 +554,10 @@ int mmap_transfer(struct pcm *pcm, void *data, unsigned offset,
     unsigned size;
     u_int8_t *dst_addr, *mmaped_addr;
     u_int8_t *src_addr = data;
-    int channels = (pcm->flags & PCM_MONO) ? 1 : 2;
 
     dst_addr = dst_address(pcm);
 
-    frames = frames * channels *2 ;
+    frames = pcm_frames_to_bytes(pcm, frames);
 
     while (frames-- > 0) {
         *(u_int8_t*)dst_addr = *(const u_int8_t*)src_addr;
@@ -493,13 +575,12 @@ int mmap_transfer_capture(struct pcm *pcm, void *data, unsigned offset,
     unsigned size;
     u_int8_t *dst_addr, *mmaped_addr;
     u_int8_t *src_addr;
-    int channels = (pcm->flags & PCM_MONO) ? 1 : 2;
-    unsigned int tmp = (pcm->flags & PCM_MONO) ? sync_ptr->c.control.appl_ptr*2 : sync_ptr->c.control.appl_ptr*4;
+    unsigned int tmp = pcm_frames_to_bytes(pcm, sync_ptr->c.control.appl_ptr);
 
     pcm_offset = (tmp % (unsigned long)pcm->buffer_size);
     dst_addr = data;
     src_addr = pcm->addr + pcm_offset;
-    frames = frames * channels *2 ;
+    frames = pcm_frames_to_bytes(pcm, frames);
 
     while (frames-- > 0) {
         *(u_int8_t*)dst_addr = *(const u_int8_t*)src_addr;
@@ -516,36 +597,72 @@ int pcm_prepare(struct pcm *pcm)
            return -errno;
     }
     pcm->running = 1;
+    pcm->appl_synced = 0;
     return 0;
 }
 
-static int pcm_write_mmap(struct pcm *pcm, void *data, unsigned count)
+/*
+ * Refresh pcm->sync_ptr from the kernel, publishing appl_ptr unless
+ * SNDRV_PCM_SYNC_PTR_APPL is set in flags. Uses the mapped status and
+ * control pages when available.
+ */
+static int mmap_sync(struct pcm *pcm, unsigned flags)
+{
+    struct snd_pcm_sync_ptr *sp = pcm->sync_ptr;
+
+    if (!pcm->mmap_status || !pcm->mmap_control) {
+        sp->flags = flags;
+        return sync_ptr(pcm);
+    }
+
+    if (flags & SNDRV_PCM_SYNC_PTR_APPL)
+        sp->c.control.appl_ptr = pcm->mmap_control->appl_ptr;
+    else
+        pcm->mmap_control->appl_ptr = sp->c.control.appl_ptr;
+    if (flags & SNDRV_PCM_SYNC_PTR_AVAIL_MIN)
+        sp->c.control.avail_min = pcm->mmap_control->avail_min;
+    sp->s.status.state = pcm->mmap_status->state;
+    sp->s.status.hw_ptr = pcm->mmap_status->hw_ptr;
+    if (sp->s.status.state == SNDRV_PCM_STATE_XRUN)
+        return EPIPE;
+    return 0;
+}
+
+static void mmap_xrun(struct pcm *pcm)
+{
+    /* we failed to make our window -- try to restart */
+    pcm->underruns++;
+    pcm->running = 0;
+    pcm->start = 0;
+    pcm_prepare(pcm);
+}
+
+/*
+ * Advance appl_ptr by frames already placed in the mmap area. appl_ptr is
+ * only moved by this process, so it is read back from the kernel once
+ * after prepare and a single sync publishes it afterwards.
+ */
+static int pcm_mmap_commit(struct pcm *pcm, long frames)
 {
-    long frames;
     int err;
     int bytes_written;
 
-    frames = (pcm->flags & PCM_MONO) ? (count / 2) : (count / 4);
-
-    pcm->sync_ptr->flags = SNDRV_PCM_SYNC_PTR_APPL | SNDRV_PCM_SYNC_PTR_AVAIL_MIN;
-    err = sync_ptr(pcm);
-    if (err == EPIPE) {
-        ALOGE("Failed in sync_ptr\n");
-        /* we failed to make our window -- try to restart */
-        pcm->underruns++;
-        pcm->running = 0;
-        pcm_prepare(pcm);
+    if (!pcm->appl_synced) {
+        err = mmap_sync(pcm, SNDRV_PCM_SYNC_PTR_APPL | SNDRV_PCM_SYNC_PTR_AVAIL_MIN);
+        if (err == EPIPE) {
+            ALOGE("Failed in sync_ptr\n");
+            mmap_xrun(pcm);
+            return 0;
+        }
+        pcm->appl_synced = 1;
     }
     pcm->sync_ptr->c.control.appl_ptr += frames;
-    pcm->sync_ptr->flags = 0;
 
-    err = sync_ptr(pcm);
+    err = mmap_sync(pcm, 0);
     if (err == EPIPE) {
         ALOGE("Failed in sync_ptr 2 \n");
-        /* we failed to make our window -- try to restart */
-        pcm->underruns++;
-        pcm->running = 0;
-        pcm_prepare(pcm);
+        mmap_xrun(pcm);
+        return 0;
     }
     bytes_written = pcm->sync_ptr->c.control.appl_ptr - pcm->sync_ptr->s.status.hw_ptr;
     if ((bytes_written >= pcm->sw_p->start_threshold) && (!pcm->start)) {
@@ -569,21 +686,211 @@ static int pcm_write_mmap(struct pcm *pcm, void *data, unsigned count)
     return 0;
 }
 
+/* Caller has already filled the mmap area at dst_address() */
+static int pcm_write_mmap(struct pcm *pcm, void *data, unsigned count)
+{
+    return pcm_mmap_commit(pcm, pcm_bytes_to_frames(pcm, count));
+}
+
+int pcm_mmap_write(struct pcm *pcm, const void *data, unsigned count)
+{
+    const u_int8_t *src = data;
+    unsigned frame_size = pcm_frame_size(pcm);
+    unsigned buffer_frames = pcm->buffer_size / frame_size;
+    long frames = count / frame_size;
+    long avail, chunk, offset, first;
+    struct pollfd pfd;
+    int underruns;
+    int err;
+
+    if ((pcm->flags & PCM_IN) || !(pcm->flags & PCM_MMAP) || !pcm->addr)
+        return -EINVAL;
+
+    pfd.fd = pcm->fd;
+    pfd.events = POLLOUT | POLLERR | POLLNVAL;
+
+    while (frames > 0) {
+        if (!pcm->running) {
+            if (pcm_prepare(pcm))
+                return -errno;
+        }
+        if (!pcm->appl_synced) {
+            err = mmap_sync(pcm, SNDRV_PCM_SYNC_PTR_APPL | SNDRV_PCM_SYNC_PTR_AVAIL_MIN);
+            if (err == EPIPE) {
+                mmap_xrun(pcm);
+                continue;
+            }
+            pcm->appl_synced = 1;
+        }
+        /* hw_ptr from the last commit is usually enough to go on */
+        avail = pcm_avail(pcm);
+        if (avail <= 0) {
+            err = mmap_sync(pcm, SNDRV_PCM_SYNC_PTR_APPL);
+            if (err == EPIPE) {
+                mmap_xrun(pcm);
+                continue;
+            }
+            avail = pcm_avail(pcm);
+        }
+        if (avail <= 0) {
+            if (!pcm->start) {
+                /* buffer full before start threshold, let commit start it */
+                err = pcm_mmap_commit(pcm, 0);
+                if (err)
+                    return err;
+            }
+            if (poll(&pfd, 1, TIMEOUT_INFINITE) < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -errno;
+            }
+            if (pfd.revents & POLLNVAL)
+                return -EBADF;
+            if (pfd.revents & POLLERR)
+                mmap_xrun(pcm);
+            continue;
+        }
+
+        chunk = frames < avail ? frames : avail;
+        offset = pcm->sync_ptr->c.control.appl_ptr % buffer_frames;
+        first = buffer_frames - offset;
+        if (first > chunk)
+            first = chunk;
+        memcpy((u_int8_t *)pcm->addr + offset * frame_size, src, first * frame_size);
+        memcpy(pcm->addr, src + first * frame_size, (chunk - first) * frame_size);
+
+        underruns = pcm->underruns;
+        err = pcm_mmap_commit(pcm, chunk);
+        if (err)
+            return err;
+        if (pcm->underruns != underruns)
+            continue; /* prepared again after an xrun, rewrite the chunk */
+        src += chunk * frame_size;
+        frames -= chunk;
+    }
+    return 0;
+}
+
+/* Discard the timer ticks queued since the last wakeup */
+static void drain_timer(struct pcm *pcm)
+{
+    struct snd_timer_tread tr[4];
+
+    while (read(pcm->timer_fd, tr, sizeof(tr)) > 0)
+        ;
+}
+
+/*
+ * Sleep until at least min_frames can be transferred, woken by the PCM
+ * period timer when it is enabled and by the pcm fd otherwise. Returns the
+ * available frames, 0 on timeout or -EPIPE on xrun.
+ */
+static long pcm_wait_frames(struct pcm *pcm, long min_frames, int timeout)
+{
+    struct pollfd pfd;
+    struct timespec now, deadline;
+    int wait_ms = timeout;
+    long avail;
+    int err;
+
+    if (pcm->timer_fd >= 0) {
+        pfd.fd = pcm->timer_fd;
+        pfd.events = POLLIN;
+    } else {
+        pfd.fd = pcm->fd;
+        pfd.events = ((pcm->flags & PCM_IN) ? POLLIN : POLLOUT) | POLLERR | POLLNVAL;
+    }
+    if (timeout > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (timeout % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    for (;;) {
+        err = mmap_sync(pcm, SNDRV_PCM_SYNC_PTR_HWSYNC | SNDRV_PCM_SYNC_PTR_APPL |
+                        SNDRV_PCM_SYNC_PTR_AVAIL_MIN);
+        if (err == EPIPE || pcm->sync_ptr->s.status.state == SNDRV_PCM_STATE_XRUN)
+            return -EPIPE;
+        if (err)
+            return -err;
+        avail = pcm_avail(pcm);
+        if (avail >= min_frames)
+            return avail;
+
+        if (timeout == 0)
+            return 0;
+        if (timeout > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            wait_ms = (deadline.tv_sec - now.tv_sec) * 1000 +
+                      (deadline.tv_nsec - now.tv_nsec) / 1000000;
+            if (wait_ms <= 0)
+                return 0;
+        }
+        if (poll(&pfd, 1, wait_ms) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (pfd.revents & POLLNVAL)
+            return -EBADF;
+        if (pfd.fd == pcm->timer_fd)
+            drain_timer(pcm);
+        else if (pfd.revents & POLLERR)
+            return -EPIPE;
+    }
+}
+
+long pcm_wait(struct pcm *pcm, int timeout)
+{
+    long avail_min;
+
+    if (!pcm_ready(pcm) || !pcm->sw_p)
+        return -EBADFD;
+    avail_min = pcm->sw_p->avail_min ? pcm->sw_p->avail_min : 1;
+    return pcm_wait_frames(pcm, avail_min, timeout);
+}
+
+/* With PCM_TIMER, sleep until the transfer fits instead of blocking in it */
+static int pcm_wait_xfer(struct pcm *pcm, snd_pcm_uframes_t frames)
+{
+    long buffer_frames = pcm_bytes_to_frames(pcm, pcm->buffer_size);
+    long avail;
+
+    if (!(pcm->flags & PCM_TIMER) || pcm->timer_fd < 0)
+        return 0;
+    avail = pcm_wait_frames(pcm, (long)frames < buffer_frames ? (long)frames : buffer_frames,
+                            TIMEOUT_INFINITE);
+    return avail < 0 ? avail : 0;
+}
+
 static int pcm_write_nmmap(struct pcm *pcm, void *data, unsigned count)
 {
+    int err;
     struct snd_xferi x;
-    int channels = (pcm->flags & PCM_MONO) ? 1 : ((pcm->flags & PCM_5POINT1)? 6 : 2 );
 
     if (pcm->flags & PCM_IN)
         return -EINVAL;
     x.buf = data;
-    x.frames =  (count / (channels * 2)) ;
+    x.frames = pcm_bytes_to_frames(pcm, count);
 
     for (;;) {
         if (!pcm->running) {
             if (pcm_prepare(pcm))
                 return -errno;
         }
+        err = pcm_wait_xfer(pcm, x.frames);
+        if (err == -EPIPE) {
+            ALOGE("Underrun Error\n");
+            pcm->underruns++;
+            pcm->running = 0;
+            continue;
+        }
+        if (err)
+            return err;
         if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_WRITEI_FRAMES, &x)) {
             if (errno == EPIPE) {
                     /* we failed to make our window -- try to restart */
@@ -611,20 +918,13 @@ int pcm_write(struct pcm *pcm, void *data, unsigned count)
 int pcm_read(struct pcm *pcm, void *data, unsigned count)
 {
     struct snd_xferi x;
+    int err;
 
     if (!(pcm->flags & PCM_IN))
         return -EINVAL;
 
     x.buf = data;
-    if (pcm->flags & PCM_MONO) {
-        x.frames = (count / 2);
-    } else if (pcm->flags & PCM_QUAD) {
-        x.frames = (count / 8);
-    } else if (pcm->flags & PCM_5POINT1) {
-        x.frames = (count / 12);
-    } else {
-        x.frames = (count / 4);
-    }
+    x.frames = pcm_bytes_to_frames(pcm, count);
 
     for (;;) {
         if (!pcm->running) {
@@ -636,6 +936,15 @@ int pcm_read(struct pcm *pcm, void *data, unsigned count)
             }
             pcm->running = 1;
         }
+        err = pcm_wait_xfer(pcm, x.frames);
+        if (err == -EPIPE) {
+            ALOGE("Arec:Overrun Error\n");
+            pcm->underruns++;
+            pcm->running = 0;
+            continue;
+        }
+        if (err)
+            return err;
         if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_READI_FRAMES, &x)) {
             if (errno == EPIPE) {
                 /* we failed to make our window -- try to restart */
@@ -653,15 +962,17 @@ int pcm_read(struct pcm *pcm, void *data, unsigned count)
 
 static struct pcm bad_pcm = {
     .fd = -1,
+    .timer_fd = -1,
 };
 
 static int enable_timer(struct pcm *pcm) {
+    int err;
 
     pcm->timer_fd = open("/dev/snd/timer", O_RDWR | O_NONBLOCK);
     if (pcm->timer_fd < 0) {
-       close(pcm->fd);
+       err = errno;
        ALOGE("cannot open timer device 'timer'");
-       return &bad_pcm;
+       return -err;
     }
     int arg = 1;
     struct snd_timer_params timer_param;
@@ -687,10 +998,12 @@ static int enable_timer(struct pcm *pcm) {
         ALOGD("sel.id.subdevice = %d\n", sel.id.subdevice);
     }
     if (ioctl(pcm->timer_fd, SNDRV_TIMER_IOCTL_SELECT, &sel) < 0) {
+          /* close() and the log may both overwrite errno */
+          err = errno;
           ALOGE("SNDRV_TIMER_IOCTL_SELECT failed.\n");
           close(pcm->timer_fd);
-          close(pcm->fd);
-          return &bad_pcm;
+          pcm->timer_fd = -1;
+          return -err;
     }
     memset(&timer_param, 0, sizeof(struct snd_timer_params));
     timer_param.flags |= SNDRV_TIMER_PSFLG_AUTO;
@@ -702,17 +1015,20 @@ static int enable_timer(struct pcm *pcm) {
     }
     if (ioctl(pcm->timer_fd, SNDRV_TIMER_IOCTL_START) < 0) {
            close(pcm->timer_fd);
+           pcm->timer_fd = -1;
            ALOGE("SNDRV_TIMER_IOCTL_START failed\n");
     }
     return 0;
 }
 
 static int disable_timer(struct pcm *pcm) {
-     if (pcm == &bad_pcm)
+     if (pcm == &bad_pcm || pcm->timer_fd < 0)
          return 0;
      if (ioctl(pcm->timer_fd, SNDRV_TIMER_IOCTL_STOP) < 0)
          ALOGE("SNDRV_TIMER_IOCTL_STOP failed\n");
-     return close(pcm->timer_fd);
+     close(pcm->timer_fd);
+     pcm->timer_fd = -1;
+     return 0;
 }
 
 int pcm_close(struct pcm *pcm)
@@ -720,14 +1036,15 @@ int pcm_close(struct pcm *pcm)
     if (pcm == &bad_pcm)
         return 0;
 
+    disable_timer(pcm);
     if (pcm->flags & PCM_MMAP) {
-        disable_timer(pcm);
         if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_DROP) < 0) {
             ALOGE("Reset failed");
         }
 
         if (munmap(pcm->addr, pcm->buffer_size))
             ALOGE("munmap failed");
+        munmap_status_control(pcm);
 
         if (ioctl(pcm->fd, SNDRV_PCM_IOCTL_HW_FREE) < 0) {
             ALOGE("HW_FREE failed");
@@ -768,6 +1085,7 @@ struct pcm *pcm_open(unsigned flags, char *device)
     pcm = calloc(1, sizeof(struct pcm));
     if (!pcm)
         return &bad_pcm;
+    pcm->sample_format = -1;
 
     tmp = device+4;
     if ((strncmp(device, "hw:",3) != 0) || (strncmp(tmp, ",",1) != 0)){
@@ -832,7 +1150,9 @@ struct pcm *pcm_open(unsigned flags, char *device)
         return &bad_pcm;
     }
 
-    if (pcm->flags & PCM_MMAP)
+    /* the PCM timer ticks once per period */
+    pcm->timer_fd = -1;
+    if (pcm->flags & (PCM_MMAP | PCM_TIMER))
         enable_timer(pcm);
 
     if (pcm->flags & DEBUG_ON)
@@ -267,7 +267,7 @@ int snd_use_case_get(snd_use_case_mgr_t *uc_mgr,
     card_mctrl_t *ctrl_list;
     use_case_verb_t *verb_list;
     char ident[MAX_STR_LEN], *ident1, *ident2, *temp_ptr;
-    int index, verb_index = 0, ret = 0;
+    int index, verb_index = 0, ctrl_list_type, ret = 0;
 
     pthread_mutex_lock(&uc_mgr->card_ctxt_ptr->card_lock);
     if ((uc_mgr->snd_card_index >= (int)MAX_NUM_CARDS) ||
@@ -309,7 +309,8 @@ int snd_use_case_get(snd_use_case_mgr_t *uc_mgr,
             if (ident2 != NULL) {
                 verb_index = uc_mgr->card_ctxt_ptr->current_verb_index;
                 verb_list = uc_mgr->card_ctxt_ptr->use_case_verb_list;
-                if((get_usecase_type(uc_mgr, ident2)) == CTRL_LIST_VERB) {
+                ctrl_list_type = get_usecase_type(uc_mgr, ident2);
+                if(ctrl_list_type == CTRL_LIST_VERB) {
                     ctrl_list = verb_list[verb_index].verb_ctrls;
                 } else {
                     ctrl_list = verb_list[verb_index].mod_ctrls;
@@ -322,16 +323,11 @@ int snd_use_case_get(snd_use_case_mgr_t *uc_mgr,
                     pthread_mutex_unlock(&uc_mgr->card_ctxt_ptr->card_lock);
                     return -EINVAL;
                 }
-                while(strncmp(ctrl_list[index].case_name, ident2,
-                    (strlen(ident2)+1))) {
-                    if (!strncmp(ctrl_list[index].case_name,
-                        SND_UCM_END_OF_LIST, strlen(SND_UCM_END_OF_LIST))){
-                        *value = NULL;
-                        ret = -EINVAL;
-                        break;
-                    } else {
-                        index++;
-                    }
+                index = snd_ucm_find_case(uc_mgr, verb_index, ctrl_list,
+                            ctrl_list_type, ident2);
+                if (index < 0) {
+                    *value = NULL;
+                    ret = -EINVAL;
                 }
             } else {
                 ret = -EINVAL;
@@ -385,16 +381,10 @@ int snd_use_case_get(snd_use_case_mgr_t *uc_mgr,
             }
             ctrl_list = verb_list[verb_index].device_ctrls;
             if (ident2 != NULL) {
-                while(strncmp(ctrl_list[index].case_name, ident2,
-                    MAX_LEN(ctrl_list[index].case_name,ident2))) {
-                    if (!strncmp(ctrl_list[index].case_name, SND_UCM_END_OF_LIST,
-                        strlen(SND_UCM_END_OF_LIST))){
-                        ret = -EINVAL;
-                        break;
-                    } else {
-                        index++;
-                    }
-                }
+                index = snd_ucm_find_case(uc_mgr, verb_index, ctrl_list,
+                            CTRL_LIST_DEVICE, ident2);
+                if (index < 0)
+                    ret = -EINVAL;
             }
             if (ret < 0) {
                 ALOGE("No valid device/modifier found with given identifier: %s",
@@ -421,15 +411,10 @@ int snd_use_case_get(snd_use_case_mgr_t *uc_mgr,
             }
             ctrl_list = verb_list[verb_index].device_ctrls;
             if (ident2 != NULL) {
-                while(strncmp(ctrl_list[index].case_name, ident2, strlen(ident2)+1)) {
-                    if (!strncmp(ctrl_list[index].case_name, SND_UCM_END_OF_LIST,
-                        strlen(SND_UCM_END_OF_LIST))){
-                        ret = -EINVAL;
-                        break;
-                    } else {
-                        index++;
-                    }
-                }
+                index = snd_ucm_find_case(uc_mgr, verb_index, ctrl_list,
+                            CTRL_LIST_DEVICE, ident2);
+                if (index < 0)
+                    ret = -EINVAL;
             }
             if (ret < 0) {
                 ALOGE("No valid device/modifier found with given identifier: %s",
@@ -464,8 +449,8 @@ int snd_use_case_geti(snd_use_case_mgr_t *uc_mgr,
               const char *identifier,
               long *value)
 {
-    char ident[MAX_STR_LEN], *ident1, *ident2, *ident_value, *temp_ptr;
-    int index, list_size, ret = -EINVAL;
+    char ident[MAX_STR_LEN], *ident1, *ident2, *temp_ptr;
+    int ret = -EINVAL;
 
     pthread_mutex_lock(&uc_mgr->card_ctxt_ptr->card_lock);
     if ((uc_mgr->snd_card_index >= (int)MAX_NUM_CARDS) ||
@@ -484,47 +469,17 @@ int snd_use_case_geti(snd_use_case_mgr_t *uc_mgr,
         if (!strncmp(ident1, "_devstatus", 10)) {
             ident2 = strtok_r(NULL, "/", &temp_ptr);
             if (ident2 != NULL) {
-                list_size =
-                snd_ucm_get_size_of_list(uc_mgr->card_ctxt_ptr->dev_list_head);
-                for (index = 0; index < list_size; index++) {
-                if ((ident_value =
-                snd_ucm_get_value_at_index(uc_mgr->card_ctxt_ptr->dev_list_head,
-                index))) {
-                        if (!strncmp(ident2, ident_value,
-                            (strlen(ident_value)+1))) {
-                            *value = 1;
-                            free(ident_value);
-                            ident_value = NULL;
-                            break;
-                        } else {
-                            free(ident_value);
-                            ident_value = NULL;
-                        }
-                    }
-                }
+                if (snd_ucm_get_status_at_index(
+                    uc_mgr->card_ctxt_ptr->dev_list_head, ident2) >= 0)
+                    *value = 1;
                 ret = 0;
             }
         } else if (!strncmp(ident1, "_modstatus", 10)) {
             ident2 = strtok_r(NULL, "/", &temp_ptr);
             if (ident2 != NULL) {
-                list_size =
-                snd_ucm_get_size_of_list(uc_mgr->card_ctxt_ptr->mod_list_head);
-                for (index = 0; index < list_size; index++) {
-                if((ident_value =
-                snd_ucm_get_value_at_index(uc_mgr->card_ctxt_ptr->mod_list_head,
-                index))) {
-                        if (!strncmp(ident2, ident_value,
-                            (strlen(ident_value)+1))) {
-                            *value = 1;
-                            free(ident_value);
-                            ident_value = NULL;
-                            break;
-                        } else {
-                            free(ident_value);
-                            ident_value = NULL;
-                        }
-                    }
-                }
+                if (snd_ucm_get_status_at_index(
+                    uc_mgr->card_ctxt_ptr->mod_list_head, ident2) >= 0)
+                    *value = 1;
                 ret = 0;
             }
         } else {
@@ -699,12 +654,189 @@ int use_case_index)
     return ret;
 }
 
+/* Name lookup tables
+ * Verb names and the case names of every verb's control lists are hashed
+ * into open addressing tables once parsing completes, so resolving a name
+ * on a routing change no longer scans the lists. Until the tables exist
+ * the lookups fall back to the linear scans.
+ */
+static unsigned snd_ucm_name_hash(const char *name)
+{
+    unsigned hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static const char *snd_ucm_verb_name_at(const void *list, int index)
+{
+    return ((char * const *)list)[index];
+}
+
+static const char *snd_ucm_case_name_at(const void *list, int index)
+{
+    return ((const card_mctrl_t *)list)[index].case_name;
+}
+
+static int snd_ucm_name_index_build(struct snd_ucm_name_index *idx,
+const void *list, int count, const char *(*name_at)(const void *, int))
+{
+    const char *name;
+    int size = 8, index, slot;
+
+    while (size < count * 2)
+        size <<= 1;
+    idx->slots = (int *)calloc(size, sizeof(int));
+    if (idx->slots == NULL)
+        return -ENOMEM;
+    idx->size = size;
+    for (index = 0; index < count; index++) {
+        if ((name = name_at(list, index)) == NULL)
+            continue;
+        slot = snd_ucm_name_hash(name) & (size - 1);
+        /* first entry wins for duplicated names, as with the linear scan */
+        while (idx->slots[slot] &&
+               strcmp(name_at(list, idx->slots[slot] - 1), name))
+            slot = (slot + 1) & (size - 1);
+        if (!idx->slots[slot])
+            idx->slots[slot] = index + 1;
+    }
+    return 0;
+}
+
+/* Returns index of name in list, -EINVAL if not present */
+static int snd_ucm_name_index_find(const struct snd_ucm_name_index *idx,
+const void *list, const char *name, const char *(*name_at)(const void *, int))
+{
+    int slot = snd_ucm_name_hash(name) & (idx->size - 1);
+
+    while (idx->slots[slot]) {
+        if (!strcmp(name_at(list, idx->slots[slot] - 1), name))
+            return idx->slots[slot] - 1;
+        slot = (slot + 1) & (idx->size - 1);
+    }
+    return -EINVAL;
+}
+
+static void snd_ucm_free_lookup(card_ctxt_t *ctxt)
+{
+    int index, type;
+
+    if (ctxt->case_lookup) {
+        for (index = 0; index < ctxt->lookup_verb_count; index++) {
+            for (type = CTRL_LIST_VERB; type <= CTRL_LIST_MODIFIER; type++)
+                free(ctxt->case_lookup[index][type].slots);
+        }
+        free(ctxt->case_lookup);
+        ctxt->case_lookup = NULL;
+    }
+    free(ctxt->verb_lookup.slots);
+    ctxt->verb_lookup.slots = NULL;
+    ctxt->verb_lookup.size = 0;
+    ctxt->lookup_verb_count = 0;
+}
+
+/* Build the lookup tables, called once all verbs are parsed */
+static void snd_ucm_build_lookup(snd_use_case_mgr_t *uc_mgr)
+{
+    card_ctxt_t *ctxt = uc_mgr->card_ctxt_ptr;
+    struct snd_ucm_name_index (*case_lookup)[CTRL_LIST_MODIFIER + 1];
+    use_case_verb_t *verb;
+    int verb_count = 0, index, ret;
+
+    pthread_mutex_lock(&ctxt->card_lock);
+    snd_ucm_free_lookup(ctxt);
+    while (strncmp(ctxt->verb_list[verb_count], SND_UCM_END_OF_LIST, 3))
+        verb_count++;
+    case_lookup = calloc(verb_count ? verb_count : 1, sizeof(*case_lookup));
+    if (case_lookup == NULL)
+        goto error;
+    ctxt->case_lookup = case_lookup;
+    ctxt->lookup_verb_count = verb_count;
+    for (index = 0; index < verb_count; index++) {
+        verb = &ctxt->use_case_verb_list[index];
+        if ((verb->verb_ctrls && snd_ucm_name_index_build(
+                 &case_lookup[index][CTRL_LIST_VERB], verb->verb_ctrls,
+                 verb->verb_count, snd_ucm_case_name_at) < 0) ||
+            (verb->device_ctrls && snd_ucm_name_index_build(
+                 &case_lookup[index][CTRL_LIST_DEVICE], verb->device_ctrls,
+                 verb->device_count, snd_ucm_case_name_at) < 0) ||
+            (verb->mod_ctrls && snd_ucm_name_index_build(
+                 &case_lookup[index][CTRL_LIST_MODIFIER], verb->mod_ctrls,
+                 verb->mod_count, snd_ucm_case_name_at) < 0))
+            goto error;
+    }
+    /* verb table last, its presence marks the tables as complete */
+    ret = snd_ucm_name_index_build(&ctxt->verb_lookup, ctxt->verb_list,
+              verb_count, snd_ucm_verb_name_at);
+    if (ret < 0)
+        goto error;
+    pthread_mutex_unlock(&ctxt->card_lock);
+    return;
+
+error:
+    ALOGE("Failed to allocate UCM lookup tables, using linear lookups");
+    snd_ucm_free_lookup(ctxt);
+    pthread_mutex_unlock(&ctxt->card_lock);
+}
+
+/* Returns index of verb in verb list, negative error code otherwise */
+static int snd_ucm_find_verb(snd_use_case_mgr_t *uc_mgr, const char *verb)
+{
+    card_ctxt_t *ctxt = uc_mgr->card_ctxt_ptr;
+    int index = 0;
+
+    if (ctxt->verb_lookup.slots)
+        return snd_ucm_name_index_find(&ctxt->verb_lookup, ctxt->verb_list,
+                   verb, snd_ucm_verb_name_at);
+    while (strncmp(ctxt->verb_list[index], SND_UCM_END_OF_LIST,
+           strlen(SND_UCM_END_OF_LIST))) {
+        if (!strncmp(ctxt->verb_list[index], verb, (strlen(verb)+1)))
+            return index;
+        index++;
+    }
+    return -EINVAL;
+}
+
+/* Returns index of use case in the given control list of a verb,
+ * negative error code otherwise
+ */
+static int snd_ucm_find_case(snd_use_case_mgr_t *uc_mgr, int verb_index,
+card_mctrl_t *ctrl_list, int ctrl_list_type, const char *use_case)
+{
+    card_ctxt_t *ctxt = uc_mgr->card_ctxt_ptr;
+    int index = 0;
+
+    if (ctrl_list == NULL)
+        return -EINVAL;
+    if (ctxt->verb_lookup.slots && verb_index < ctxt->lookup_verb_count &&
+        ctxt->case_lookup[verb_index][ctrl_list_type].slots)
+        return snd_ucm_name_index_find(
+                   &ctxt->case_lookup[verb_index][ctrl_list_type], ctrl_list,
+                   use_case, snd_ucm_case_name_at);
+    while(strncmp(ctrl_list[index].case_name, use_case, (strlen(use_case)+1))) {
+        if (!strncmp(ctrl_list[index].case_name, SND_UCM_END_OF_LIST,
+            strlen(SND_UCM_END_OF_LIST)))
+            return -EINVAL;
+        index++;
+        if (ctrl_list[index].case_name == NULL) {
+            ALOGE("Invalid case_name at index %d", index);
+            return -EINVAL;
+        }
+    }
+    return index;
+}
+
+
 int get_use_case_index(snd_use_case_mgr_t *uc_mgr, const char *use_case,
 int ctrl_list_type)
 {
     use_case_verb_t *verb_list;
     card_mctrl_t *ctrl_list;
-    int ret = 0, index = 0, verb_index;
+    int index = 0, verb_index;
 
     verb_list = uc_mgr->card_ctxt_ptr->use_case_verb_list;
     verb_index = uc_mgr->card_ctxt_ptr->current_verb_index;
@@ -727,24 +859,8 @@ int ctrl_list_type)
                 uc_mgr->card_ctxt_ptr->current_verb, verb_index);
         return -EINVAL;
     }
-    while(strncmp(ctrl_list[index].case_name, use_case, (strlen(use_case)+1))) {
-        if (!strncmp(ctrl_list[index].case_name, SND_UCM_END_OF_LIST,
-            strlen(SND_UCM_END_OF_LIST))) {
-            ret = -EINVAL;
-            break;
-        }
-        index++;
-        if (ctrl_list[index].case_name == NULL) {
-            ALOGE("Invalid case_name at index %d", index);
-            ret = -EINVAL;
-            break;
-        }
-    }
-    if (ret < 0) {
-        return ret;
-    } else {
-        return index;
-    }
+    return snd_ucm_find_case(uc_mgr, verb_index, ctrl_list, ctrl_list_type,
+               use_case);
 }
 
 /* Apply the required mixer controls for specific use case
@@ -874,78 +990,80 @@ const char *use_case, int enable, int ctrl_list_type, int uc_index)
     return ret;
 }
 
+/* Capability of the known verbs and modifiers, see getUseCaseType() */
+static const struct use_case_type {
+    const char *name;
+    int type;
+} use_case_types[] = {
+    { SND_USE_CASE_VERB_HIFI, CAP_RX },
+    { SND_USE_CASE_VERB_HIFI_LOWLATENCY_MUSIC, CAP_RX },
+    { SND_USE_CASE_VERB_HIFI_LOW_POWER, CAP_RX },
+    { SND_USE_CASE_VERB_HIFI_TUNNEL, CAP_RX },
+    { SND_USE_CASE_VERB_HIFI2, CAP_RX },
+    { SND_USE_CASE_VERB_DIGITAL_RADIO, CAP_RX },
+    { SND_USE_CASE_MOD_PLAY_MUSIC, CAP_RX },
+    { SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC, CAP_RX },
+    { SND_USE_CASE_MOD_PLAY_MUSIC2, CAP_RX },
+    { SND_USE_CASE_MOD_PLAY_LPA, CAP_RX },
+    { SND_USE_CASE_MOD_PLAY_TUNNEL, CAP_RX },
+    { SND_USE_CASE_MOD_PLAY_FM, CAP_RX },
+    { SND_USE_CASE_VERB_HIFI_REC, CAP_TX },
+    { SND_USE_CASE_VERB_FM_REC, CAP_TX },
+    { SND_USE_CASE_VERB_FM_A2DP_REC, CAP_TX },
+    { SND_USE_CASE_MOD_CAPTURE_MUSIC, CAP_TX },
+    { SND_USE_CASE_VERB_HIFI_LOWLATENCY_REC, CAP_TX },
+    { SND_USE_CASE_MOD_CAPTURE_LOWLATENCY_MUSIC, CAP_TX },
+    { SND_USE_CASE_MOD_CAPTURE_FM, CAP_TX },
+    { SND_USE_CASE_MOD_CAPTURE_A2DP_FM, CAP_TX },
+    { SND_USE_CASE_VERB_VOICECALL, CAP_VOICE },
+    { SND_USE_CASE_VERB_IP_VOICECALL, CAP_VOICE },
+    { SND_USE_CASE_VERB_DL_REC, CAP_VOICE },
+    { SND_USE_CASE_VERB_UL_DL_REC, CAP_VOICE },
+    { SND_USE_CASE_VERB_INCALL_REC, CAP_VOICE },
+    { SND_USE_CASE_MOD_PLAY_VOICE, CAP_VOICE },
+    { SND_USE_CASE_MOD_PLAY_VOIP, CAP_VOICE },
+    { SND_USE_CASE_MOD_CAPTURE_VOICE_DL, CAP_VOICE },
+    { SND_USE_CASE_MOD_CAPTURE_VOICE_UL_DL, CAP_VOICE },
+    { SND_USE_CASE_VERB_VOLTE, CAP_VOICE },
+    { SND_USE_CASE_MOD_PLAY_VOLTE, CAP_VOICE },
+};
+
+static struct snd_ucm_name_index use_case_type_lookup;
+static pthread_once_t use_case_type_once = PTHREAD_ONCE_INIT;
+
+static const char *use_case_type_name_at(const void *list, int index)
+{
+    return ((const struct use_case_type *)list)[index].name;
+}
+
+static void use_case_type_lookup_init(void)
+{
+    if (snd_ucm_name_index_build(&use_case_type_lookup, use_case_types,
+            sizeof(use_case_types)/sizeof(use_case_types[0]),
+            use_case_type_name_at) < 0)
+        ALOGE("Failed to allocate use case type table");
+}
+
 int getUseCaseType(const char *useCase)
 {
+    int index = -EINVAL;
+
     ALOGV("getUseCaseType: use case is %s\n", useCase);
-    if (!strncmp(useCase, SND_USE_CASE_VERB_HIFI,
-           MAX_LEN(useCase,SND_USE_CASE_VERB_HIFI)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_HIFI_LOWLATENCY_MUSIC,
-           MAX_LEN(useCase,SND_USE_CASE_VERB_HIFI_LOWLATENCY_MUSIC)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_HIFI_LOW_POWER,
-           MAX_LEN(useCase,SND_USE_CASE_VERB_HIFI_LOW_POWER)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_HIFI_TUNNEL,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_HIFI_TUNNEL)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_HIFI2,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_HIFI2)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_DIGITAL_RADIO,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_DIGITAL_RADIO)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_MUSIC,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_PLAY_MUSIC)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_PLAY_LOWLATENCY_MUSIC)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_MUSIC2,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_PLAY_MUSIC2)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_LPA,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_PLAY_LPA)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_TUNNEL,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_PLAY_TUNNEL)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_FM,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_PLAY_FM))) {
-        return CAP_RX;
-    } else if (!strncmp(useCase, SND_USE_CASE_VERB_HIFI_REC,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_HIFI_REC)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_FM_REC,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_FM_REC)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_FM_A2DP_REC,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_FM_A2DP_REC)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_CAPTURE_MUSIC,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_CAPTURE_MUSIC)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_HIFI_LOWLATENCY_REC,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_HIFI_LOWLATENCY_REC)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_CAPTURE_LOWLATENCY_MUSIC,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_CAPTURE_LOWLATENCY_MUSIC)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_CAPTURE_FM,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_CAPTURE_FM)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_CAPTURE_A2DP_FM,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_CAPTURE_A2DP_FM))) {
-        return CAP_TX;
-    } else if (!strncmp(useCase, SND_USE_CASE_VERB_VOICECALL,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_VOICECALL)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_IP_VOICECALL,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_IP_VOICECALL)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_DL_REC,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_DL_REC)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_UL_DL_REC,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_UL_DL_REC)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_INCALL_REC,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_INCALL_REC)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_VOICE,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_PLAY_VOICE)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_VOIP,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_PLAY_VOIP)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_CAPTURE_VOICE_DL,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_CAPTURE_VOICE_DL)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_CAPTURE_VOICE_UL_DL,
-            MAX_LEN(useCase,SND_USE_CASE_MOD_CAPTURE_VOICE_UL_DL)) ||
-        !strncmp(useCase, SND_USE_CASE_VERB_VOLTE,
-            MAX_LEN(useCase,SND_USE_CASE_VERB_VOLTE)) ||
-        !strncmp(useCase, SND_USE_CASE_MOD_PLAY_VOLTE,
-            MAX_LEN(useCase, SND_USE_CASE_MOD_PLAY_VOLTE))) {
-        return CAP_VOICE;
+    pthread_once(&use_case_type_once, use_case_type_lookup_init);
+    if (use_case_type_lookup.slots) {
+        index = snd_ucm_name_index_find(&use_case_type_lookup, use_case_types,
+                    useCase, use_case_type_name_at);
     } else {
-        ALOGE("unknown use case %s, returning voice capablity", useCase);
-        return CAP_VOICE;
+        for (index = (int)(sizeof(use_case_types)/sizeof(use_case_types[0])) - 1;
+             index >= 0; index--) {
+            if (!strcmp(use_case_types[index].name, useCase))
+                break;
+        }
     }
+    if (index >= 0)
+        return use_case_types[index].type;
+    ALOGE("unknown use case %s, returning voice capablity", useCase);
+    return CAP_VOICE;
 }
 
 /* Set/Reset mixer controls of specific use case for all current devices
@@ -957,9 +1075,10 @@ int getUseCaseType(const char *useCase)
 static int set_controls_of_usecase_for_all_devices(snd_use_case_mgr_t *uc_mgr,
 const char *ident, int enable, int ctrl_list_type)
 {
+    struct snd_ucm_ident_node *dev_node;
     card_mctrl_t *dev_list, *uc_list;
     char *current_device, use_case[MAX_UC_LEN];
-    int list_size, index, uc_index, ret = 0, intdev_flag = 0;
+    int uc_index, ret = 0, intdev_flag = 0;
     int verb_index, capability = 0, ident_cap = 0, dev_cap =0;
 
     ALOGV("set_use_case_ident_for_all_devices(): %s", ident);
@@ -977,11 +1096,10 @@ const char *ident, int enable, int ctrl_list_type)
         uc_list = NULL;
     }
     ident_cap = getUseCaseType(ident);
-    list_size = snd_ucm_get_size_of_list(uc_mgr->card_ctxt_ptr->dev_list_head);
-    for (index = 0; index < list_size; index++) {
-        current_device =
-        snd_ucm_get_value_at_index(uc_mgr->card_ctxt_ptr->dev_list_head, index);
-        if (current_device != NULL) {
+    for (dev_node = uc_mgr->card_ctxt_ptr->dev_list_head; dev_node != NULL;
+         dev_node = dev_node->next) {
+        current_device = dev_node->ident;
+        {
             uc_index = get_use_case_index(uc_mgr, current_device,
                        CTRL_LIST_DEVICE);
             dev_cap = dev_list[uc_index].capability;
@@ -1023,7 +1141,6 @@ const char *ident, int enable, int ctrl_list_type)
                       }
                  }
                  use_case[0] = 0;
-                 free(current_device);
              }
         }
     }
@@ -1111,10 +1228,11 @@ const char *ident, const char *device, int enable, int ctrl_list_type)
 static int set_controls_of_device_for_all_usecases(snd_use_case_mgr_t *uc_mgr,
 const char *device, int enable)
 {
+    struct snd_ucm_ident_node *mod_node;
     card_mctrl_t *dev_list, *uc_list;
     char *ident_value, use_case[MAX_UC_LEN];
     int verb_index, uc_index, dev_index, capability = 0;
-    int list_size, index = 0, ret = -ENODEV, flag = 0, intdev_flag = 0;
+    int ret = -ENODEV, flag = 0, intdev_flag = 0;
 
     ALOGV("set_controls_of_device_for_all_usecases: %s", device);
     if ((verb_index = uc_mgr->card_ctxt_ptr->current_verb_index) < 0)
@@ -1195,11 +1313,10 @@ const char *device, int enable)
     snd_ucm_print_list(uc_mgr->card_ctxt_ptr->mod_list_head);
     uc_list =
         uc_mgr->card_ctxt_ptr->use_case_verb_list[verb_index].mod_ctrls;
-    list_size = snd_ucm_get_size_of_list(uc_mgr->card_ctxt_ptr->mod_list_head);
-    for (index = 0; index < list_size; index++) {
-        if ((ident_value =
-            snd_ucm_get_value_at_index(uc_mgr->card_ctxt_ptr->mod_list_head,
-            index))) {
+    for (mod_node = uc_mgr->card_ctxt_ptr->mod_list_head; mod_node != NULL;
+         mod_node = mod_node->next) {
+        ident_value = mod_node->ident;
+        {
             if (capability == CAP_VOICE ||
                 getUseCaseType(ident_value) == CAP_VOICE ||
                 capability == getUseCaseType(ident_value)) {
@@ -1261,7 +1378,6 @@ const char *device, int enable)
                 intdev_flag = 0;
             }
             use_case[0] = 0;
-            free(ident_value);
         }
     }
     if (!enable) {
@@ -1281,18 +1397,7 @@ const char *device, int enable)
  */
 static int get_usecase_type(snd_use_case_mgr_t *uc_mgr, const char *usecase)
 {
-    int ret = -EINVAL, index = 0;
-
-    while (strncmp(uc_mgr->card_ctxt_ptr->verb_list[index],
-        SND_UCM_END_OF_LIST, strlen(SND_UCM_END_OF_LIST))) {
-        if (!strncmp(uc_mgr->card_ctxt_ptr->verb_list[index], usecase,
-            (strlen(usecase)+1))) {
-            ret = 0;
-            break;
-        }
-        index++;
-    }
-    if (ret == 0)
+    if (snd_ucm_find_verb(uc_mgr, usecase) >= 0)
         return CTRL_LIST_VERB;
     else
         return CTRL_LIST_MODIFIER;
@@ -1383,7 +1488,7 @@ int snd_use_case_set(snd_use_case_mgr_t *uc_mgr,
 {
     use_case_verb_t *verb_list;
     char ident[MAX_STR_LEN], *ident1, *ident2, *temp_ptr;
-    int verb_index, list_size, index = 0, ret = -EINVAL;
+    int verb_index, index = 0, ret = -EINVAL;
 
     pthread_mutex_lock(&uc_mgr->card_ctxt_ptr->card_lock);
     if ((uc_mgr->snd_card_index >= (int)MAX_NUM_CARDS) || (value == NULL) ||
@@ -1456,21 +1561,13 @@ int snd_use_case_set(snd_use_case_mgr_t *uc_mgr,
 
     if (!strncmp(identifier, "_verb", 5)) {
         /* Check if value is valid verb */
-        while (strncmp(uc_mgr->card_ctxt_ptr->verb_list[index],
-               SND_UCM_END_OF_LIST, strlen(SND_UCM_END_OF_LIST))) {
-            if (!strncmp(uc_mgr->card_ctxt_ptr->verb_list[index], value,
-                (strlen(value)+1))) {
-                ret = 0;
-                break;
-            }
-            index++;
-        }
+        if ((index = snd_ucm_find_verb(uc_mgr, value)) >= 0)
+            ret = 0;
         if ((ret < 0) && (strncmp(value, SND_USE_CASE_VERB_INACTIVE,
             strlen(SND_USE_CASE_VERB_INACTIVE)))) {
             ALOGE("Invalid verb identifier value");
         } else {
-            ALOGV("Index:%d Verb:%s", index,
-                uc_mgr->card_ctxt_ptr->verb_list[index]);
+            ALOGV("Index:%d Verb:%s", index, value);
             /* Disable the mixer controls for current use case
              * for all the enabled devices */
             if (strncmp(uc_mgr->card_ctxt_ptr->current_verb,
@@ -1494,23 +1591,12 @@ int snd_use_case_set(snd_use_case_mgr_t *uc_mgr,
             }
         }
     } else if (!strncmp(identifier, "_enadev", 7)) {
-        index = 0; ret = 0;
-        list_size =
-            snd_ucm_get_size_of_list(uc_mgr->card_ctxt_ptr->dev_list_head);
-        for (index = 0; index < list_size; index++) {
-            if ((ident1 =
-                snd_ucm_get_value_at_index(uc_mgr->card_ctxt_ptr->dev_list_head,
-                index))) {
-                if (!strncmp(ident1, value, (strlen(value)+1))) {
-                    ALOGV("Ignore enable as %s device is already part of \
-                         enabled list", value);
-                    free(ident1);
-                    break;
-                }
-                free(ident1);
-            }
-        }
-        if (index == list_size) {
+        ret = 0;
+        if (snd_ucm_get_status_at_index(uc_mgr->card_ctxt_ptr->dev_list_head,
+            value) >= 0) {
+            ALOGV("Ignore enable as %s device is already part of \
+                 enabled list", value);
+        } else {
             ALOGV("enadev: device value to be enabled: %s", value);
             snd_ucm_add_ident_to_list(&uc_mgr->card_ctxt_ptr->dev_list_head,
                 value);
@@ -1554,15 +1640,10 @@ int snd_use_case_set(snd_use_case_mgr_t *uc_mgr,
             ALOGV("Index:%d Verb:%s", verb_index,
                  uc_mgr->card_ctxt_ptr->verb_list[verb_index]);
             verb_list = uc_mgr->card_ctxt_ptr->use_case_verb_list;
-            while(strncmp(verb_list[verb_index].modifier_list[index], value,
-                  (strlen(value)+1))) {
-                if (!strncmp(verb_list[verb_index].modifier_list[index],
-                    SND_UCM_END_OF_LIST, strlen(SND_UCM_END_OF_LIST))){
-                    ret = -EINVAL;
-                    break;
-                }
-                index++;
-            }
+            if (snd_ucm_find_case(uc_mgr, verb_index,
+                    verb_list[verb_index].mod_ctrls, CTRL_LIST_MODIFIER,
+                    value) < 0)
+                ret = -EINVAL;
             if (ret < 0) {
                 ALOGE("Invalid modifier identifier value");
             } else {
@@ -1608,7 +1689,7 @@ int snd_use_case_set_case(snd_use_case_mgr_t *uc_mgr,
 {
     use_case_verb_t *verb_list;
     char ident[MAX_STR_LEN], *ident1, *ident2, *temp_ptr;
-    int verb_index, list_size, index = 0, ret = -EINVAL;
+    int verb_index, index = 0, ret = -EINVAL;
 
     pthread_mutex_lock(&uc_mgr->card_ctxt_ptr->card_lock);
     if ((uc_mgr->snd_card_index >= (int)MAX_NUM_CARDS) || (value == NULL) ||
@@ -1681,21 +1762,13 @@ int snd_use_case_set_case(snd_use_case_mgr_t *uc_mgr,
 
     if (!strncmp(identifier, "_verb", 5)) {
         /* Check if value is valid verb */
-        while (strncmp(uc_mgr->card_ctxt_ptr->verb_list[index],
-               SND_UCM_END_OF_LIST, MAX_STR_LEN)) {
-            if (!strncmp(uc_mgr->card_ctxt_ptr->verb_list[index],
-                value, MAX_STR_LEN)) {
-                ret = 0;
-                break;
-            }
-            index++;
-        }
+        if ((index = snd_ucm_find_verb(uc_mgr, value)) >= 0)
+            ret = 0;
         if ((ret < 0) && (strncmp(value, SND_USE_CASE_VERB_INACTIVE,
             MAX_STR_LEN))) {
             ALOGE("Invalid verb identifier value");
         } else {
-            ALOGV("Index:%d Verb:%s", index,
-                 uc_mgr->card_ctxt_ptr->verb_list[index]);
+            ALOGV("Index:%d Verb:%s", index, value);
             /* Disable the mixer controls for current use case
              * for specified device */
             if (strncmp(uc_mgr->card_ctxt_ptr->current_verb,
@@ -1713,22 +1786,10 @@ int snd_use_case_set_case(snd_use_case_mgr_t *uc_mgr,
             if (strncmp(uc_mgr->card_ctxt_ptr->current_verb,
                 SND_USE_CASE_VERB_INACTIVE, MAX_STR_LEN)) {
                uc_mgr->card_ctxt_ptr->current_verb_index = index;
-               index = 0;
-               list_size =
-               snd_ucm_get_size_of_list(uc_mgr->card_ctxt_ptr->dev_list_head);
-               for (index = 0; index < list_size; index++) {
-                   if ((ident1 = snd_ucm_get_value_at_index(
-                       uc_mgr->card_ctxt_ptr->dev_list_head, index))) {
-                       if (!strncmp(ident1, usecase, MAX_STR_LEN)) {
-                           ALOGV("Device already part of enabled list: %s",
-                               usecase);
-                           free(ident1);
-                           break;
-                       }
-                       free(ident1);
-                   }
-               }
-               if (index == list_size) {
+               if (snd_ucm_get_status_at_index(
+                   uc_mgr->card_ctxt_ptr->dev_list_head, usecase) >= 0) {
+                   ALOGV("Device already part of enabled list: %s", usecase);
+               } else {
                    ALOGV("enadev: device value to be enabled: %s", usecase);
                    snd_ucm_add_ident_to_list(&uc_mgr->card_ctxt_ptr->dev_list_head,
                         usecase);
@@ -1739,22 +1800,11 @@ int snd_use_case_set_case(snd_use_case_mgr_t *uc_mgr,
             }
         }
     } else if (!strncmp(identifier, "_enadev", 7)) {
-        index = 0; ret = 0;
-        list_size =
-            snd_ucm_get_size_of_list(uc_mgr->card_ctxt_ptr->dev_list_head);
-        for (index = 0; index < list_size; index++) {
-            if ((ident1 =
-                snd_ucm_get_value_at_index(uc_mgr->card_ctxt_ptr->dev_list_head,
-                index))) {
-                if (!strncmp(ident1, value, MAX_STR_LEN)) {
-                    ALOGV("Device already part of enabled list: %s", value);
-                    free(ident1);
-                    break;
-                }
-                free(ident1);
-            }
-        }
-        if (index == list_size) {
+        ret = 0;
+        if (snd_ucm_get_status_at_index(uc_mgr->card_ctxt_ptr->dev_list_head,
+            value) >= 0) {
+            ALOGV("Device already part of enabled list: %s", value);
+        } else {
             ALOGV("enadev: device value to be enabled: %s", value);
             snd_ucm_add_ident_to_list(&uc_mgr->card_ctxt_ptr->dev_list_head,
                 value);
@@ -1794,16 +1844,9 @@ int snd_use_case_set_case(snd_use_case_mgr_t *uc_mgr,
             ALOGE("Invalid use case verb value");
             ret = -EINVAL;
         } else {
-            ret = 0;
-            while(strncmp(uc_mgr->card_ctxt_ptr->verb_list[index],
-                  uc_mgr->card_ctxt_ptr->current_verb, MAX_STR_LEN)) {
-                if (!strncmp(uc_mgr->card_ctxt_ptr->verb_list[index],
-                    SND_UCM_END_OF_LIST, MAX_STR_LEN)){
-                    ret = -EINVAL;
-                    break;
-                }
-                index++;
-            }
+            index = snd_ucm_find_verb(uc_mgr,
+                        uc_mgr->card_ctxt_ptr->current_verb);
+            ret = (index < 0) ? -EINVAL : 0;
         }
         if (ret < 0) {
             ALOGE("Invalid verb identifier value");
@@ -1812,34 +1855,17 @@ int snd_use_case_set_case(snd_use_case_mgr_t *uc_mgr,
             verb_list = uc_mgr->card_ctxt_ptr->use_case_verb_list;
             ALOGV("Index:%d Verb:%s", verb_index,
                  uc_mgr->card_ctxt_ptr->verb_list[verb_index]);
-            while(strncmp(verb_list[verb_index].modifier_list[index],
-                value, MAX_STR_LEN)) {
-                if (!strncmp(verb_list[verb_index].modifier_list[index],
-                    SND_UCM_END_OF_LIST, MAX_STR_LEN)){
-                    ret = -EINVAL;
-                    break;
-                }
-                index++;
-            }
+            if (snd_ucm_find_case(uc_mgr, verb_index,
+                    verb_list[verb_index].mod_ctrls, CTRL_LIST_MODIFIER,
+                    value) < 0)
+                ret = -EINVAL;
             if (ret < 0) {
                 ALOGE("Invalid modifier identifier value");
             } else {
-                index = 0;
-                list_size =
-                snd_ucm_get_size_of_list(uc_mgr->card_ctxt_ptr->dev_list_head);
-                for (index = 0; index < list_size; index++) {
-                    if ((ident1 = snd_ucm_get_value_at_index(
-                        uc_mgr->card_ctxt_ptr->dev_list_head, index))) {
-                        if (!strncmp(ident1, usecase, MAX_STR_LEN)) {
-                            ALOGV("Device already part of enabled list: %s",
-                                usecase);
-                            free(ident1);
-                            break;
-                        }
-                        free(ident1);
-                    }
-                }
-                if (index == list_size) {
+                if (snd_ucm_get_status_at_index(
+                    uc_mgr->card_ctxt_ptr->dev_list_head, usecase) >= 0) {
+                    ALOGV("Device already part of enabled list: %s", usecase);
+                } else {
                     ALOGV("enadev: device value to be enabled: %s", usecase);
                     snd_ucm_add_ident_to_list(&uc_mgr->card_ctxt_ptr->dev_list_head,
                          usecase);
@@ -2019,6 +2045,7 @@ int snd_use_case_mgr_close(snd_use_case_mgr_t *uc_mgr)
     uc_mgr->current_rx_device = -1;
     free(uc_mgr->card_ctxt_ptr->control_device);
     free(uc_mgr->card_ctxt_ptr->card_name);
+    free(uc_mgr->card_ctxt_ptr->file_stamps);
     free(uc_mgr->card_ctxt_ptr);
     uc_mgr->card_ctxt_ptr = NULL;
     free(uc_mgr);
@@ -2254,6 +2281,10 @@ void *second_stage_parsing_thread(void *uc_mgr_ptr)
 #endif
     if(ret < 0)
         ALOGE("Failed to parse config files: %d", ret);
+    else {
+        snd_ucm_build_lookup(*uc_mgr);
+        snd_ucm_cache_store(*uc_mgr);
+    }
     ALOGE("Exiting parsing thread uc_mgr %p\n", uc_mgr);
     return NULL;
 }
@@ -2266,10 +2297,566 @@ int snd_use_case_mgr_wait_for_parsing(snd_use_case_mgr_t *uc_mgr)
 {
     int ret;
 
+    /* nothing to wait for if the lists came from the cache */
+    if (!uc_mgr->thr_created)
+        return 0;
     ret = pthread_join(uc_mgr->thr, NULL);
+    uc_mgr->thr_created = false;
+    return ret;
+}
+
+/* UCM cache
+ * The verb, device and modifier control lists of a card are serialized
+ * once both parsing stages complete. Pointers are stored as offsets from
+ * the start of the file, so on the next open the file only needs to be
+ * mapped privately and relocated in place instead of re-parsed. The cache
+ * records the size, mtime and inode of every config file it was built from
+ * and is ignored as soon as any of them changes.
+ */
+struct snd_ucm_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ptr_size;
+    uint32_t layout;
+    uint32_t total_size;
+    uint32_t stamp_count;
+    uint32_t stamps_off;
+    uint32_t verb_count;
+    uint32_t verb_list_off;
+    uint32_t use_case_verb_list_off;
+};
+
+struct snd_ucm_cache_writer {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int err;
+};
+
+#define UCM_CACHE_LAYOUT ((uint32_t)(sizeof(use_case_verb_t) << 16 | \
+                          sizeof(card_mctrl_t) << 8 | sizeof(mixer_control_t)))
+
+static void snd_ucm_cache_path(snd_use_case_mgr_t *uc_mgr, char *path,
+size_t len)
+{
+    snprintf(path, len, "%s%s.cache", UCM_CACHE_DIR,
+        uc_mgr->card_ctxt_ptr->card_name);
+}
+
+/* Remember a config file the parsed lists depend on */
+static void snd_ucm_add_file_stamp(snd_use_case_mgr_t *uc_mgr,
+const char *path, const struct stat *st)
+{
+    card_ctxt_t *ctxt = uc_mgr->card_ctxt_ptr;
+    struct snd_ucm_file_stamp *stamps, *stamp;
+
+    stamps = (struct snd_ucm_file_stamp *)realloc(ctxt->file_stamps,
+                 (ctxt->file_stamp_count + 1) * sizeof(*stamps));
+    if (stamps == NULL) {
+        ALOGE("Failed to allocate memory for file stamp of %s", path);
+        return;
+    }
+    ctxt->file_stamps = stamps;
+    stamp = &stamps[ctxt->file_stamp_count++];
+    memset(stamp, 0, sizeof(*stamp));
+    strlcpy(stamp->path, path, sizeof(stamp->path));
+    stamp->size = st->st_size;
+    stamp->mtime = st->st_mtime;
+    stamp->ino = st->st_ino;
+}
+
+static int snd_ucm_file_stamp_valid(const struct snd_ucm_file_stamp *stamp)
+{
+    struct stat st;
+
+    if (memchr(stamp->path, '\0', sizeof(stamp->path)) == NULL)
+        return 0;
+    if (stat(stamp->path, &st) < 0)
+        return 0;
+    return (stamp->size == (int64_t)st.st_size &&
+            stamp->mtime == (int64_t)st.st_mtime &&
+            stamp->ino == (uint64_t)st.st_ino);
+}
+
+/* Reserve zeroed space in the cache image, returns its offset or 0 */
+static size_t ucm_cache_alloc(struct snd_ucm_cache_writer *w, size_t size)
+{
+    size_t off, cap;
+    char *buf;
+
+    if (w->err)
+        return 0;
+    off = (w->len + 7) & ~(size_t)7;
+    if (off + size > w->cap) {
+        cap = w->cap ? w->cap : 16384;
+        while (off + size > cap)
+            cap *= 2;
+        buf = (char *)realloc(w->buf, cap);
+        if (buf == NULL) {
+            w->err = -ENOMEM;
+            return 0;
+        }
+        w->buf = buf;
+        w->cap = cap;
+    }
+    memset(w->buf + w->len, 0, off + size - w->len);
+    w->len = off + size;
+    return off;
+}
+
+static uintptr_t ucm_cache_put_str(struct snd_ucm_cache_writer *w,
+const char *str)
+{
+    size_t off, len;
+
+    if (str == NULL)
+        return 0;
+    len = strlen(str) + 1;
+    off = ucm_cache_alloc(w, len);
+    if (off)
+        memcpy(w->buf + off, str, len);
+    return off;
+}
+
+/* list terminated by a SND_UCM_END_OF_LIST entry */
+static uintptr_t ucm_cache_put_strv(struct snd_ucm_cache_writer *w,
+char **list)
+{
+    size_t off;
+    uintptr_t str;
+    int count = 0, index;
+
+    if (list == NULL)
+        return 0;
+    while (list[count] && strncmp(list[count], SND_UCM_END_OF_LIST, 3))
+        count++;
+    if (list[count] == NULL) {
+        w->err = -EINVAL;
+        return 0;
+    }
+    off = ucm_cache_alloc(w, (count + 1) * sizeof(uintptr_t));
+    for (index = 0; index <= count && !w->err; index++) {
+        str = ucm_cache_put_str(w, list[index]);
+        if (!w->err)
+            ((uintptr_t *)(w->buf + off))[index] = str;
+    }
+    return w->err ? 0 : off;
+}
+
+static uintptr_t ucm_cache_put_controls(struct snd_ucm_cache_writer *w,
+const mixer_control_t *ctls, int count)
+{
+    mixer_control_t *dst;
+    uintptr_t name, string, mulval, str;
+    size_t off;
+    int index;
+    unsigned mindex;
+
+    if (ctls == NULL || count <= 0)
+        return 0;
+    off = ucm_cache_alloc(w, count * sizeof(mixer_control_t));
+    for (index = 0; index < count && !w->err; index++) {
+        name = ucm_cache_put_str(w, ctls[index].control_name);
+        string = 0;
+        mulval = 0;
+        if (ctls[index].type == TYPE_STR) {
+            string = ucm_cache_put_str(w, ctls[index].string);
+        } else if (ctls[index].type == TYPE_MULTI_VAL && ctls[index].mulval) {
+            mulval = ucm_cache_alloc(w, ctls[index].value * sizeof(uintptr_t));
+            for (mindex = 0; mindex < ctls[index].value && !w->err; mindex++) {
+                str = ucm_cache_put_str(w, ctls[index].mulval[mindex]);
+                if (!w->err)
+                    ((uintptr_t *)(w->buf + mulval))[mindex] = str;
+            }
+        }
+        if (w->err)
+            break;
+        dst = (mixer_control_t *)(w->buf + off) + index;
+        dst->control_name = (char *)name;
+        dst->type = ctls[index].type;
+        dst->value = ctls[index].value;
+        dst->string = (char *)string;
+        dst->mulval = (char **)mulval;
+    }
+    return w->err ? 0 : off;
+}
+
+/* count entries followed by the SND_UCM_END_OF_LIST entry */
+static uintptr_t ucm_cache_put_mctrls(struct snd_ucm_cache_writer *w,
+const card_mctrl_t *list, int count)
+{
+    card_mctrl_t *dst;
+    uintptr_t fields[6];
+    size_t off;
+    int index;
+
+    if (list == NULL)
+        return 0;
+    off = ucm_cache_alloc(w, (count + 1) * sizeof(card_mctrl_t));
+    for (index = 0; index <= count && !w->err; index++) {
+        memset(fields, 0, sizeof(fields));
+        fields[0] = ucm_cache_put_str(w, list[index].case_name);
+        if (index < count) {
+            fields[1] = ucm_cache_put_controls(w, list[index].ena_mixer_list,
+                            list[index].ena_mixer_count);
+            fields[2] = ucm_cache_put_controls(w, list[index].dis_mixer_list,
+                            list[index].dis_mixer_count);
+            fields[3] = ucm_cache_put_str(w, list[index].playback_dev_name);
+            fields[4] = ucm_cache_put_str(w, list[index].capture_dev_name);
+            fields[5] = ucm_cache_put_str(w, list[index].effects_mixer_ctl);
+        }
+        if (w->err)
+            break;
+        dst = (card_mctrl_t *)(w->buf + off) + index;
+        dst->case_name = (char *)fields[0];
+        if (index < count) {
+            dst->ena_mixer_count = fields[1] ? list[index].ena_mixer_count : 0;
+            dst->ena_mixer_list = (mixer_control_t *)fields[1];
+            dst->dis_mixer_count = fields[2] ? list[index].dis_mixer_count : 0;
+            dst->dis_mixer_list = (mixer_control_t *)fields[2];
+            dst->playback_dev_name = (char *)fields[3];
+            dst->capture_dev_name = (char *)fields[4];
+            dst->acdb_id = list[index].acdb_id;
+            dst->capability = list[index].capability;
+            dst->effects_mixer_ctl = (char *)fields[5];
+        }
+    }
+    return w->err ? 0 : off;
+}
+
+/* Serialize the fully parsed lists of the card and write them to the cache */
+static int snd_ucm_cache_store(snd_use_case_mgr_t *uc_mgr)
+{
+    card_ctxt_t *ctxt = uc_mgr->card_ctxt_ptr;
+    struct snd_ucm_cache_writer w;
+    struct snd_ucm_cache_header *hdr;
+    use_case_verb_t *src, *dst;
+    uintptr_t fields[7];
+    size_t hdr_off, verbs_off, stamps_off, verb_list_off;
+    char path[UCM_CACHE_PATH_LEN], tmp_path[UCM_CACHE_PATH_LEN + 4];
+    int index, prev, verb_count = 0, fd, ret;
+    ssize_t written;
+
+    if (ctxt->file_stamp_count == 0)
+        return -EINVAL;
+    memset(&w, 0, sizeof(w));
+    pthread_mutex_lock(&ctxt->card_lock);
+    while (strncmp(ctxt->verb_list[verb_count], SND_UCM_END_OF_LIST, 3))
+        verb_count++;
+    src = ctxt->use_case_verb_list;
+
+    hdr_off = ucm_cache_alloc(&w, sizeof(*hdr));
+    stamps_off = ucm_cache_alloc(&w,
+                     ctxt->file_stamp_count * sizeof(struct snd_ucm_file_stamp));
+    if (!w.err)
+        memcpy(w.buf + stamps_off, ctxt->file_stamps,
+            ctxt->file_stamp_count * sizeof(struct snd_ucm_file_stamp));
+    verb_list_off = ucm_cache_put_strv(&w, ctxt->verb_list);
+    verbs_off = ucm_cache_alloc(&w, (verb_count + 1) * sizeof(use_case_verb_t));
+    for (index = 0; index < verb_count && !w.err; index++) {
+        memset(fields, 0, sizeof(fields));
+        /* single config format verbs share device and modifier lists */
+        for (prev = 0; prev < index; prev++) {
+            dst = (use_case_verb_t *)(w.buf + verbs_off) + prev;
+            if (src[prev].device_list == src[index].device_list)
+                fields[1] = (uintptr_t)dst->device_list;
+            if (src[prev].modifier_list == src[index].modifier_list)
+                fields[2] = (uintptr_t)dst->modifier_list;
+            if (src[prev].device_ctrls == src[index].device_ctrls)
+                fields[4] = (uintptr_t)dst->device_ctrls;
+            if (src[prev].mod_ctrls == src[index].mod_ctrls)
+                fields[5] = (uintptr_t)dst->mod_ctrls;
+        }
+        fields[0] = ucm_cache_put_str(&w, src[index].use_case_name);
+        if (!fields[1])
+            fields[1] = ucm_cache_put_strv(&w, src[index].device_list);
+        if (!fields[2])
+            fields[2] = ucm_cache_put_strv(&w, src[index].modifier_list);
+        fields[3] = ucm_cache_put_mctrls(&w, src[index].verb_ctrls,
+                        src[index].verb_count);
+        if (!fields[4])
+            fields[4] = ucm_cache_put_mctrls(&w, src[index].device_ctrls,
+                            src[index].device_count);
+        if (!fields[5])
+            fields[5] = ucm_cache_put_mctrls(&w, src[index].mod_ctrls,
+                            src[index].mod_count);
+        if (w.err)
+            break;
+        dst = (use_case_verb_t *)(w.buf + verbs_off) + index;
+        dst->use_case_name = (char *)fields[0];
+        dst->device_list = (char **)fields[1];
+        dst->modifier_list = (char **)fields[2];
+        dst->verb_count = src[index].verb_count;
+        dst->device_count = src[index].device_count;
+        dst->mod_count = src[index].mod_count;
+        dst->verb_ctrls = (card_mctrl_t *)fields[3];
+        dst->device_ctrls = (card_mctrl_t *)fields[4];
+        dst->mod_ctrls = (card_mctrl_t *)fields[5];
+    }
+    pthread_mutex_unlock(&ctxt->card_lock);
+    if (w.err) {
+        ALOGE("Failed to serialize UCM lists: %d", w.err);
+        free(w.buf);
+        return w.err;
+    }
+
+    hdr = (struct snd_ucm_cache_header *)(w.buf + hdr_off);
+    hdr->magic = UCM_CACHE_MAGIC;
+    hdr->version = UCM_CACHE_VERSION;
+    hdr->ptr_size = sizeof(void *);
+    hdr->layout = UCM_CACHE_LAYOUT;
+    hdr->total_size = w.len;
+    hdr->stamp_count = ctxt->file_stamp_count;
+    hdr->stamps_off = stamps_off;
+    hdr->verb_count = verb_count;
+    hdr->verb_list_off = verb_list_off;
+    hdr->use_case_verb_list_off = verbs_off;
+
+    /* write a temporary file first so a reader never sees a partial cache */
+    snd_ucm_cache_path(uc_mgr, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ALOGV("Cannot create UCM cache %s error %d", tmp_path, errno);
+        free(w.buf);
+        return -errno;
+    }
+    written = write(fd, w.buf, w.len);
+    ret = (written == (ssize_t)w.len) ? 0 : -EIO;
+    if (close(fd) < 0)
+        ret = -EIO;
+    if (!ret && rename(tmp_path, path) < 0)
+        ret = -errno;
+    if (ret) {
+        ALOGE("Failed to write UCM cache %s: %d", path, ret);
+        unlink(tmp_path);
+    } else {
+        ALOGD("UCM cache %s written, %zu bytes", path, w.len);
+    }
+    free(w.buf);
     return ret;
 }
 
+struct snd_ucm_cache_reader {
+    char *base;
+    size_t size;
+};
+
+/* Turn a stored offset back into a pointer covering len bytes */
+static int ucm_cache_reloc(struct snd_ucm_cache_reader *r, void **field,
+size_t len)
+{
+    uintptr_t off = (uintptr_t)*field;
+
+    if (off == 0)
+        return 0;
+    if (off >= r->size || len > r->size - off)
+        return -EINVAL;
+    *field = r->base + off;
+    return 0;
+}
+
+static int ucm_cache_reloc_str(struct snd_ucm_cache_reader *r, char **field)
+{
+    uintptr_t off = (uintptr_t)*field;
+
+    if (ucm_cache_reloc(r, (void **)field, 1) < 0)
+        return -EINVAL;
+    if (off && memchr(*field, '\0', r->size - off) == NULL)
+        return -EINVAL;
+    return 0;
+}
+
+static int ucm_cache_reloc_strv(struct snd_ucm_cache_reader *r, char ***field)
+{
+    char **list;
+    int index;
+
+    if (ucm_cache_reloc(r, (void **)field, sizeof(char *)) < 0)
+        return -EINVAL;
+    list = *field;
+    if (list == NULL)
+        return 0;
+    for (index = 0; ; index++) {
+        if ((size_t)((char *)&list[index + 1] - r->base) > r->size)
+            return -EINVAL;
+        if (ucm_cache_reloc_str(r, &list[index]) < 0 || list[index] == NULL)
+            return -EINVAL;
+        if (!strncmp(list[index], SND_UCM_END_OF_LIST, 3))
+            break;
+    }
+    return 0;
+}
+
+static int ucm_cache_reloc_controls(struct snd_ucm_cache_reader *r,
+mixer_control_t **field, int count)
+{
+    mixer_control_t *ctl;
+    int index;
+    unsigned mindex;
+
+    if (count < 0 || ucm_cache_reloc(r, (void **)field,
+            count * sizeof(mixer_control_t)) < 0)
+        return -EINVAL;
+    for (index = 0; *field && index < count; index++) {
+        ctl = &(*field)[index];
+        if (ucm_cache_reloc_str(r, &ctl->control_name) < 0 ||
+            ucm_cache_reloc_str(r, &ctl->string) < 0)
+            return -EINVAL;
+        if (ctl->mulval == NULL)
+            continue;
+        if (ctl->value > r->size / sizeof(char *) ||
+            ucm_cache_reloc(r, (void **)&ctl->mulval,
+                ctl->value * sizeof(char *)) < 0)
+            return -EINVAL;
+        for (mindex = 0; mindex < ctl->value; mindex++) {
+            if (ucm_cache_reloc_str(r, &ctl->mulval[mindex]) < 0)
+                return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static int ucm_cache_reloc_mctrls(struct snd_ucm_cache_reader *r,
+card_mctrl_t **field, int count)
+{
+    card_mctrl_t *list;
+    int index;
+
+    if (count < 0 || ucm_cache_reloc(r, (void **)field,
+            (count + 1) * sizeof(card_mctrl_t)) < 0)
+        return -EINVAL;
+    for (index = 0; *field && index <= count; index++) {
+        list = &(*field)[index];
+        if (ucm_cache_reloc_str(r, &list->case_name) < 0 ||
+            ucm_cache_reloc_controls(r, &list->ena_mixer_list,
+                list->ena_mixer_count) < 0 ||
+            ucm_cache_reloc_controls(r, &list->dis_mixer_list,
+                list->dis_mixer_count) < 0 ||
+            ucm_cache_reloc_str(r, &list->playback_dev_name) < 0 ||
+            ucm_cache_reloc_str(r, &list->capture_dev_name) < 0 ||
+            ucm_cache_reloc_str(r, &list->effects_mixer_ctl) < 0)
+            return -EINVAL;
+    }
+    return 0;
+}
+
+/* Point field at the already relocated list of an earlier verb when both
+ * were stored at the same offset
+ */
+static int ucm_cache_find_shared(struct snd_ucm_cache_reader *r, void **field,
+void *prev, int found)
+{
+    if (found || *field == NULL || prev == NULL)
+        return found;
+    if ((uintptr_t)((char *)prev - r->base) != (uintptr_t)*field)
+        return 0;
+    *field = prev;
+    return 1;
+}
+
+/* Map the cache and point the card context at it if it is still valid
+ * Returns 0 on sucess, negative error code otherwise
+ */
+static int snd_ucm_cache_load(snd_use_case_mgr_t *uc_mgr)
+{
+    card_ctxt_t *ctxt = uc_mgr->card_ctxt_ptr;
+    struct snd_ucm_cache_reader r;
+    struct snd_ucm_cache_header *hdr;
+    struct snd_ucm_file_stamp *stamps;
+    use_case_verb_t *verbs, *prev;
+    char path[UCM_CACHE_PATH_LEN];
+    struct stat st;
+    uint32_t index, pindex;
+    int fd, shared[4];
+
+    snd_ucm_cache_path(uc_mgr, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -ENOENT;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*hdr)) {
+        close(fd);
+        return -EINVAL;
+    }
+    r.size = st.st_size;
+    r.base = (char *)mmap(0, r.size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                 fd, 0);
+    close(fd);
+    if (r.base == MAP_FAILED)
+        return -errno;
+
+    hdr = (struct snd_ucm_cache_header *)r.base;
+    if (hdr->magic != UCM_CACHE_MAGIC || hdr->version != UCM_CACHE_VERSION ||
+        hdr->ptr_size != sizeof(void *) || hdr->layout != UCM_CACHE_LAYOUT ||
+        hdr->total_size != r.size || hdr->stamp_count == 0 ||
+        hdr->stamp_count > r.size / sizeof(*stamps))
+        goto invalid;
+    stamps = (struct snd_ucm_file_stamp *)(uintptr_t)hdr->stamps_off;
+    if (ucm_cache_reloc(&r, (void **)&stamps,
+            hdr->stamp_count * sizeof(*stamps)) < 0 || stamps == NULL)
+        goto invalid;
+    for (index = 0; index < hdr->stamp_count; index++) {
+        if (!snd_ucm_file_stamp_valid(&stamps[index])) {
+            ALOGD("UCM cache is stale, %s changed", stamps[index].path);
+            goto invalid;
+        }
+    }
+
+    ctxt->verb_list = (char **)(uintptr_t)hdr->verb_list_off;
+    verbs = (use_case_verb_t *)(uintptr_t)hdr->use_case_verb_list_off;
+    if (hdr->verb_count > r.size / sizeof(*verbs) ||
+        ucm_cache_reloc_strv(&r, &ctxt->verb_list) < 0 ||
+        ctxt->verb_list == NULL ||
+        ucm_cache_reloc(&r, (void **)&verbs,
+            (hdr->verb_count + 1) * sizeof(*verbs)) < 0 || verbs == NULL)
+        goto invalid;
+    for (index = 0; index < hdr->verb_count; index++) {
+        if (ucm_cache_reloc_str(&r, &verbs[index].use_case_name) < 0 ||
+            ucm_cache_reloc_mctrls(&r, &verbs[index].verb_ctrls,
+                verbs[index].verb_count) < 0)
+            goto invalid;
+        /* relocate lists shared with an earlier verb only once */
+        memset(shared, 0, sizeof(shared));
+        for (pindex = 0; pindex < index; pindex++) {
+            prev = &verbs[pindex];
+            shared[0] |= ucm_cache_find_shared(&r,
+                             (void **)&verbs[index].device_list,
+                             prev->device_list, shared[0]);
+            shared[1] |= ucm_cache_find_shared(&r,
+                             (void **)&verbs[index].modifier_list,
+                             prev->modifier_list, shared[1]);
+            shared[2] |= ucm_cache_find_shared(&r,
+                             (void **)&verbs[index].device_ctrls,
+                             prev->device_ctrls, shared[2]);
+            shared[3] |= ucm_cache_find_shared(&r,
+                             (void **)&verbs[index].mod_ctrls,
+                             prev->mod_ctrls, shared[3]);
+        }
+        if ((!shared[0] &&
+             ucm_cache_reloc_strv(&r, &verbs[index].device_list) < 0) ||
+            (!shared[1] &&
+             ucm_cache_reloc_strv(&r, &verbs[index].modifier_list) < 0) ||
+            (!shared[2] &&
+             ucm_cache_reloc_mctrls(&r, &verbs[index].device_ctrls,
+                 verbs[index].device_count) < 0) ||
+            (!shared[3] &&
+             ucm_cache_reloc_mctrls(&r, &verbs[index].mod_ctrls,
+                 verbs[index].mod_count) < 0))
+            goto invalid;
+    }
+
+    ctxt->use_case_verb_list = verbs;
+    ctxt->ucm_cache = r.base;
+    ctxt->ucm_cache_size = r.size;
+    ALOGD("UCM lists loaded from cache %s, %u verbs", path, hdr->verb_count);
+    return 0;
+
+invalid:
+    ctxt->verb_list = NULL;
+    munmap(r.base, r.size);
+    return -EINVAL;
+}
+
 /* Parse config files and update mixer controls for the use cases
  * 1st stage parsing done to parse HiFi config file
  * uc_mgr - use case manager structure
@@ -2284,6 +2871,11 @@ static int snd_ucm_parse(snd_use_case_mgr_t **uc_mgr)
     char *file_name = NULL, *temp_ptr;
     char path[200];
 
+    /* No parsing at all if nothing changed since the lists were cached */
+    if (!snd_ucm_cache_load(*uc_mgr)) {
+        snd_ucm_build_lookup(*uc_mgr);
+        return 0;
+    }
     strlcpy(path, CONFIG_DIR, (strlen(CONFIG_DIR)+1));
     strlcat(path, (*uc_mgr)->card_ctxt_ptr->card_name, sizeof(path));
     ALOGV("master config file path:%s", path);
@@ -2297,6 +2889,7 @@ static int snd_ucm_parse(snd_use_case_mgr_t **uc_mgr)
         close(fd);
         return -EINVAL;
     }
+    snd_ucm_add_file_stamp(*uc_mgr, path, &st);
     read_buf = (char *) mmap(0, st.st_size, PROT_READ | PROT_WRITE,
                MAP_PRIVATE, fd, 0);
     if (read_buf == MAP_FAILED) {
@@ -2327,6 +2920,10 @@ static int snd_ucm_parse(snd_use_case_mgr_t **uc_mgr)
         ret = parse_single_config_format(uc_mgr, current_str, verb_count);
         munmap(read_buf, st.st_size);
         close(fd);
+        if (!ret) {
+            snd_ucm_build_lookup(*uc_mgr);
+            snd_ucm_cache_store(*uc_mgr);
+        }
         return ret;
     }
     while (*current_str != (char)EOF)  {
@@ -2430,6 +3027,7 @@ static int snd_ucm_parse(snd_use_case_mgr_t **uc_mgr)
         if(rc < 0) {
             ALOGE("Failed to create parsing thread rc %d errno %d\n", rc, errno);
         } else {
+            (*uc_mgr)->thr_created = true;
             ALOGV("Prasing thread created successfully\n");
         }
     }
@@ -2904,6 +3502,8 @@ const char *file_name, int index)
             close(fd);
             return -EINVAL;
         }
+        if (parse_count == 0)
+            snd_ucm_add_file_stamp(*uc_mgr, path, &st);
         read_buf = (char *) mmap(0, st.st_size, PROT_READ | PROT_WRITE,
                    MAP_PRIVATE, fd, 0);
         if (read_buf == MAP_FAILED) {
@@ -3649,6 +4249,17 @@ void snd_ucm_free_mixer_list(snd_use_case_mgr_t **uc_mgr)
     int index = 0, verb_index = 0;
 
     pthread_mutex_lock(&(*uc_mgr)->card_ctxt_ptr->card_lock);
+    snd_ucm_free_lookup((*uc_mgr)->card_ctxt_ptr);
+    /* lists loaded from the cache all live in its mapping */
+    if ((*uc_mgr)->card_ctxt_ptr->ucm_cache) {
+        munmap((*uc_mgr)->card_ctxt_ptr->ucm_cache,
+            (*uc_mgr)->card_ctxt_ptr->ucm_cache_size);
+        (*uc_mgr)->card_ctxt_ptr->ucm_cache = NULL;
+        (*uc_mgr)->card_ctxt_ptr->use_case_verb_list = NULL;
+        (*uc_mgr)->card_ctxt_ptr->verb_list = NULL;
+        pthread_mutex_unlock(&(*uc_mgr)->card_ctxt_ptr->card_lock);
+        return;
+    }
     verb_list = (*uc_mgr)->card_ctxt_ptr->use_case_verb_list;
     while(strncmp((*uc_mgr)->card_ctxt_ptr->verb_list[verb_index],
           SND_UCM_END_OF_LIST, 3)) {
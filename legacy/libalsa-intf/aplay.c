@@ -49,6 +49,7 @@ static int period = 0;
 static int compressed = 0;
 static char *compr_codec;
 static int piped = 0;
+static int timer_wakeup = 0;
 
 static struct option long_options[] =
 {
@@ -60,6 +61,7 @@ static struct option long_options[] =
     {"channel", 1, 0, 'C'},
     {"format", 1, 0, 'F'},
     {"period", 1, 0, 'B'},
+    {"timer", 0, 0, 'W'},
     {"compressed", 0, 0, 'T'},
     {0, 0, 0, 0}
 };
@@ -171,12 +173,10 @@ static int play_file(unsigned rate, unsigned channels, int fd,
     char *data;
     long avail;
     long frames;
-    int nfds = 1;
     struct snd_xferi x;
     unsigned offset = 0;
     int err;
     static int start = 0;
-    struct pollfd pfd[1];
     int remainingData = 0;
 
     flags |= PCM_OUT;
@@ -275,9 +275,6 @@ static int play_file(unsigned rate, unsigned channels, int fd,
         if (debug)
           fprintf(stderr, "Aplay:bufsize = %d\n", bufsize);
 
-        pfd[0].fd = pcm->timer_fd;
-        pfd[0].events = POLLIN;
-
         frames = (pcm->flags & PCM_MONO) ? (bufsize / 2) : (bufsize / 4);
         for (;;) {
              if (!pcm->running) {
@@ -310,7 +307,7 @@ static int play_file(unsigned rate, unsigned channels, int fd,
                  return avail;
              }
              if (avail < pcm->sw_p->avail_min) {
-                 poll(pfd, nfds, TIMEOUT_INFINITE);
+                 pcm_wait(pcm, TIMEOUT_INFINITE);
                  continue;
              }
              /*
@@ -422,7 +419,7 @@ start_done:
                            pcm->sync_ptr->c.control.appl_ptr);
                 break;
             } else
-                poll(pfd, nfds, TIMEOUT_INFINITE);
+                pcm_wait(pcm, TIMEOUT_INFINITE);
         }
     } else {
         if (pcm_prepare(pcm)) {
@@ -489,6 +486,8 @@ int play_raw(const char *fg, int rate, int ch, const char *device, const char *f
         flag = PCM_MMAP;
     else if (!strncmp(fg, "N", sizeof("N")))
         flag = PCM_NMMAP;
+    if (timer_wakeup)
+        flag |= PCM_TIMER;
 
     fprintf(stderr, "aplay: Playing '%s': format %s ch = %d\n",
 		    fn, get_format_desc(format), ch );
@@ -551,6 +550,8 @@ ignore_header:
         flag = PCM_MMAP;
     else if (!strncmp(fg, "N", sizeof("N")))
         flag = PCM_NMMAP;
+    if (timer_wakeup)
+        flag |= PCM_TIMER;
     fprintf(stderr, "aplay: Playing '%s':%s\n", fn, get_format_desc(format) );
 
     return play_file(hdr.sample_rate, hdr.num_channels, fd, flag, device, hdr.data_sz);
@@ -578,6 +579,7 @@ int main(int argc, char **argv)
                 "-V		-- verbose\n"
 		"-F             -- Format\n"
                 "-B             -- Period\n"
+                "-W             -- Wake on the period timer\n"
                 "-T <MP3, AAC, AC3_PASS_THROUGH>  -- Compressed\n"
                 "<file> \n");
            fprintf(stderr, "Formats Supported:\n");
@@ -587,7 +589,7 @@ int main(int argc, char **argv)
            fprintf(stderr, "\nSome of these may not be available on selected hardware\n");
            return 0;
      }
-     while ((c = getopt_long(argc, argv, "PVMD:R:C:F:B:T:", long_options, &option_index)) != -1) {
+     while ((c = getopt_long(argc, argv, "PVMWD:R:C:F:B:T:", long_options, &option_index)) != -1) {
        switch (c) {
        case 'P':
           pcm_flag = 0;
@@ -598,6 +600,9 @@ int main(int argc, char **argv)
        case 'M':
           mmap = "M";
           break;
+       case 'W':
+          timer_wakeup = 1;
+          break;
        case 'D':
           device = optarg;
           break;
@@ -630,6 +635,7 @@ int main(int argc, char **argv)
 		"-R             -- Rate\n"
 		"-F             -- Format\n"
                 "-B             -- Period\n"
+                "-W             -- Wake on the period timer\n"
                 "-T             -- Compressed\n"
                 "<file> \n");
            fprintf(stderr, "Formats Supported:\n");
@@ -53,6 +53,7 @@ static char *data;
 static int format = SNDRV_PCM_FORMAT_S16_LE;
 static int period = 0;
 static int piped = 0;
+static int timer_wakeup = 0;
 
 static struct option long_options[] =
 {
@@ -65,6 +66,7 @@ static struct option long_options[] =
     {"duration", 1, 0, 'T'},
     {"format", 1, 0, 'F'},
     {"period", 1, 0, 'B'},
+    {"timer", 0, 0, 'W'},
     {0, 0, 0, 0}
 };
 
@@ -142,19 +144,8 @@ static int set_params(struct pcm *pcm)
     sparams->tstamp_mode = SNDRV_PCM_TSTAMP_NONE;
     sparams->period_step = 1;
 
-    if (pcm->flags & PCM_MONO) {
-        sparams->avail_min = pcm->period_size/2;
-        sparams->xfer_align = pcm->period_size/2;
-    } else if (pcm->flags & PCM_QUAD) {
-        sparams->avail_min = pcm->period_size/8;
-        sparams->xfer_align = pcm->period_size/8;
-    } else if (pcm->flags & PCM_5POINT1) {
-        sparams->avail_min = pcm->period_size/12;
-        sparams->xfer_align = pcm->period_size/12;
-    } else {
-        sparams->avail_min = pcm->period_size/4;
-        sparams->xfer_align = pcm->period_size/4;
-    }
+    sparams->avail_min = pcm_bytes_to_frames(pcm, pcm->period_size);
+    sparams->xfer_align = pcm_bytes_to_frames(pcm, pcm->period_size);
 
     sparams->start_threshold = 1;
     sparams->stop_threshold = INT_MAX;
@@ -179,13 +170,11 @@ int record_file(unsigned rate, unsigned channels, int fd, unsigned count,  unsig
 {
     unsigned xfer, bufsize;
     int r, avail;
-    int nfds = 1;
     static int start = 0;
     struct snd_xferi x;
     long frames;
     unsigned offset = 0;
     int err;
-    struct pollfd pfd[1];
     int rec_size = 0;
 
     flags |= PCM_IN;
@@ -261,19 +250,8 @@ int record_file(unsigned rate, unsigned channels, int fd, unsigned count,  unsig
 		}
         }
 
-        pfd[0].fd = pcm->fd;
-        pfd[0].events = POLLIN;
-
         hdr.data_sz = 0;
-        if (pcm->flags & PCM_MONO) {
-                frames = bufsize / 2;
-        } else if (pcm->flags & PCM_QUAD) {
-                frames = bufsize / 8;
-        } else if (pcm->flags & PCM_5POINT1) {
-                frames = bufsize / 12;
-        } else{
-                frames = bufsize / 4;
-        }
+        frames = pcm_bytes_to_frames(pcm, bufsize);
         x.frames = frames;
         for(;;) {
 		if (!pcm->running) {
@@ -301,7 +279,7 @@ int record_file(unsigned rate, unsigned channels, int fd, unsigned count,  unsig
                 if (avail < 0)
                         return avail;
                 if (avail < pcm->sw_p->avail_min) {
-                        poll(pfd, nfds, TIMEOUT_INFINITE);
+                        pcm_wait(pcm, TIMEOUT_INFINITE);
                         continue;
                 }
 	 	if (x.frames > avail)
@@ -418,6 +396,8 @@ int rec_raw(const char *fg, const char *device, int rate, int ch,
     } else if (!strncmp(fg, "N", sizeof("N"))) {
         flag = PCM_NMMAP;
     }
+    if (timer_wakeup)
+        flag |= PCM_TIMER;
     return record_file(rate, ch, fd, count, flag, device);
 }
 
@@ -479,6 +459,8 @@ int rec_wav(const char *fg, const char *device, int rate, int ch, const char *fn
     } else if (!strncmp(fg, "N", sizeof("N"))) {
         flag = PCM_NMMAP;
     }
+    if (timer_wakeup)
+        flag |= PCM_TIMER;
     return record_file(hdr.sample_rate, hdr.num_channels, fd, count, flag, device);
 }
 
@@ -532,6 +514,7 @@ int main(int argc, char **argv)
                 "-T		-- Time in seconds for recording\n"
 		"-F             -- Format\n"
                 "-B             -- Period\n"
+                "-W             -- Wake on the period timer\n"
                 "<file> \n");
            for (i = 0; i < SNDRV_PCM_FORMAT_LAST; ++i)
                if (get_format_name(i))
@@ -539,7 +522,7 @@ int main(int argc, char **argv)
            fprintf(stderr, "\nSome of these may not be available on selected hardware\n");
           return 0;
     }
-    while ((c = getopt_long(argc, argv, "PVMD:R:C:T:F:B:", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "PVMWD:R:C:T:F:B:", long_options, &option_index)) != -1) {
        switch (c) {
        case 'P':
           pcm_flag = 0;
@@ -550,6 +533,9 @@ int main(int argc, char **argv)
        case 'M':
           mmap = "M";
           break;
+       case 'W':
+          timer_wakeup = 1;
+          break;
        case 'D':
           device = optarg;
           break;
@@ -580,6 +566,7 @@ int main(int argc, char **argv)
                 "-T		-- Time in seconds for recording\n"
 		"-F             -- Format\n"
                 "-B             -- Period\n"
+                "-W             -- Wake on the period timer\n"
                 "<file> \n");
            for (i = 0; i < SNDRV_PCM_FORMAT_LAST; ++i)
                if (get_format_name(i))
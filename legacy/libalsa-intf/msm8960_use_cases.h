@@ -36,7 +36,9 @@ extern "C" {
 #include "alsa_ucm.h"
 #include "alsa_audio.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <sys/stat.h>
 #define SND_UCM_END_OF_LIST "end"
 
 /* ACDB Device ID macros */
@@ -122,6 +124,28 @@ typedef struct card_mctrl {
     char *effects_mixer_ctl;
 }card_mctrl_t;
 
+/* UCM cache file, see snd_ucm_cache_store() */
+#ifndef UCM_CACHE_DIR
+#define UCM_CACHE_DIR "/data/misc/audio/"
+#endif
+#define UCM_CACHE_MAGIC 0x434d4355
+#define UCM_CACHE_VERSION 1
+#define UCM_CACHE_PATH_LEN 200
+
+/* config file the parsed lists were built from */
+struct snd_ucm_file_stamp {
+    char path[UCM_CACHE_PATH_LEN];
+    int64_t size;
+    int64_t mtime;
+    uint64_t ino;
+};
+
+/* open addressing name table, see snd_ucm_build_lookup() */
+struct snd_ucm_name_index {
+    int size;
+    int *slots; /* list index + 1, 0 if empty */
+};
+
 /* identifier node structure for identifier list*/
 struct snd_ucm_ident_node {
     int active;
@@ -158,6 +182,15 @@ typedef struct card_ctxt {
     int current_verb_index;
     use_case_verb_t *use_case_verb_list;
     char **verb_list;
+    /* mapped UCM cache the lists above point into, NULL if parsed */
+    void *ucm_cache;
+    size_t ucm_cache_size;
+    struct snd_ucm_file_stamp *file_stamps;
+    int file_stamp_count;
+    /* name lookup tables, NULL until parsing is complete */
+    struct snd_ucm_name_index verb_lookup;
+    struct snd_ucm_name_index (*case_lookup)[CTRL_LIST_MODIFIER + 1];
+    int lookup_verb_count;
 }card_ctxt_t;
 
 /** use case manager structure */
@@ -171,6 +204,7 @@ struct snd_use_case_mgr {
     int current_rx_device;
     card_ctxt_t *card_ctxt_ptr;
     pthread_t thr;
+    bool thr_created;
     void *acdb_handle;
     bool isFusion3Platform;
 };
@@ -314,6 +348,16 @@ static int snd_ucm_extract_dev_name(char *buf, char **dev_name);
 static int snd_ucm_extract_controls(char *buf, mixer_control_t **mixer_list, int count);
 static int snd_ucm_print(snd_use_case_mgr_t *uc_mgr);
 static void snd_ucm_free_mixer_list(snd_use_case_mgr_t **uc_mgr);
+/* UCM cache functions */
+static void snd_ucm_add_file_stamp(snd_use_case_mgr_t *uc_mgr, const char *path, const struct stat *st);
+static int snd_ucm_cache_store(snd_use_case_mgr_t *uc_mgr);
+static int snd_ucm_cache_load(snd_use_case_mgr_t *uc_mgr);
+/* Name lookup functions */
+static void snd_ucm_build_lookup(snd_use_case_mgr_t *uc_mgr);
+static void snd_ucm_free_lookup(card_ctxt_t *ctxt);
+static int snd_ucm_find_verb(snd_use_case_mgr_t *uc_mgr, const char *verb);
+static int snd_ucm_find_case(snd_use_case_mgr_t *uc_mgr, int verb_index,
+card_mctrl_t *ctrl_list, int ctrl_list_type, const char *use_case);
 #ifdef __cplusplus
 }
 #endif
@@ -16,7 +16,8 @@ LOCAL_SRC_FILES:= \
 	bass_boost.c \
 	virtualizer.c \
 	reverb.c \
-	effect_api.c
+	effect_api.c \
+	effect_registry.c
 
 LOCAL_CFLAGS += $(qcom_post_proc_common_cflags)
 
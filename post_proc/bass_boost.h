@@ -53,4 +53,6 @@ int bassboost_start(effect_context_t *context, output_context_t *output);
 
 int bassboost_stop(effect_context_t *context, output_context_t *output);
 
+int bassboost_send_params(effect_context_t *context, unsigned param_send_flags);
+
 #endif /* OFFLOAD_EFFECT_BASS_BOOST_H_ */
@@ -17,16 +17,20 @@
 #define LOG_TAG "offload_effect_bundle"
 //#define LOG_NDEBUG 0
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <cutils/list.h>
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include <system/thread_defs.h>
 #include <tinyalsa/asoundlib.h>
 #include <hardware/audio_effect.h>
 
 #include "bundle.h"
+#include "effect_registry.h"
 #include "equalizer.h"
 #include "bass_boost.h"
 #include "virtualizer.h"
@@ -63,23 +67,141 @@ struct listnode created_effects_list;
  * and offload_effects_bundle_hal_stop_output()
  */
 struct listnode active_outputs_list;
+/*
+ * created_effects_list entries by effect handle and active_outputs_list
+ * entries by io handle, so command dispatch does not walk the lists.
+ */
+struct effect_registry created_effects_index;
+struct effect_registry active_outputs_index;
 /*
  * lock must be held when modifying or accessing
- * created_effects_list or active_outputs_list
+ * created_effects_list or active_outputs_list and their indexes
  */
 pthread_mutex_t lock;
+/*
+ * DSP parameter updates queued by the effects of an output are merged and
+ * written at most once per PARAMS_FLUSH_PERIOD_MS by params_thread.
+ * params_cond is signaled when an output gets its first pending update.
+ */
+#define PARAMS_FLUSH_PERIOD_MS 20
+pthread_t params_thread;
+pthread_cond_t params_cond;
+/*
+ * Continuous controls (EQ band levels, reverb levels) are debounced: each
+ * change postpones the flush by params_debounce_ms, but queued values are
+ * never held longer than params_debounce_max_ms.
+ */
+#define PARAMS_DEBOUNCE_MS_DEFAULT 50
+#define PARAMS_DEBOUNCE_MAX_MS_DEFAULT 200
+int params_debounce_ms;
+int params_debounce_max_ms;
 
 
 /*
  *  Local functions
  */
+static int timespec_cmp(const struct timespec *a, const struct timespec *b)
+{
+    if (a->tv_sec != b->tv_sec)
+        return a->tv_sec < b->tv_sec ? -1 : 1;
+    if (a->tv_nsec != b->tv_nsec)
+        return a->tv_nsec < b->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static void timespec_add_ms(struct timespec *ts, int ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000LL;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void flush_effect_params_l(effect_context_t *context)
+{
+    unsigned flags = context->pending_send_flags;
+
+    if (flags == 0)
+        return;
+
+    list_remove(&context->pending_node);
+    context->pending_send_flags = 0;
+    if (context->ops.send_params)
+        context->ops.send_params(context, flags);
+}
+
+static void flush_output_params_l(output_context_t *output)
+{
+    while (!list_empty(&output->pending_params_list)) {
+        effect_context_t *fx_ctxt = node_to_item(list_head(&output->pending_params_list),
+                                                 effect_context_t,
+                                                 pending_node);
+        flush_effect_params_l(fx_ctxt);
+    }
+}
+
+static void *params_thread_loop(void *arg __unused)
+{
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        struct listnode *node;
+        struct timespec now;
+        struct timespec next;
+        bool pending = false;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        list_for_each(node, &active_outputs_list) {
+            output_context_t *out_ctxt = node_to_item(node,
+                                                      output_context_t,
+                                                      outputs_list_node);
+            if (list_empty(&out_ctxt->pending_params_list))
+                continue;
+            if (timespec_cmp(&out_ctxt->params_flush_time, &now) <= 0) {
+                flush_output_params_l(out_ctxt);
+            } else if (!pending || timespec_cmp(&out_ctxt->params_flush_time, &next) < 0) {
+                next = out_ctxt->params_flush_time;
+                pending = true;
+            }
+        }
+
+        if (pending)
+            pthread_cond_timedwait(&params_cond, &lock, &next);
+        else
+            pthread_cond_wait(&params_cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
 static void init_once() {
+    pthread_condattr_t attr;
+
     list_init(&created_effects_list);
     list_init(&active_outputs_list);
 
     pthread_mutex_init(&lock, NULL);
-
-    init_status = 0;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&params_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    params_debounce_ms = property_get_int32("vendor.audio.offload.effects.debounce_ms",
+                                            PARAMS_DEBOUNCE_MS_DEFAULT);
+    params_debounce_max_ms = property_get_int32("vendor.audio.offload.effects.debounce_max_ms",
+                                                PARAMS_DEBOUNCE_MAX_MS_DEFAULT);
+    if (params_debounce_ms < 0)
+        params_debounce_ms = 0;
+    if (params_debounce_max_ms < params_debounce_ms)
+        params_debounce_max_ms = params_debounce_ms;
+
+    init_status = pthread_create(&params_thread, (const pthread_attr_t *) NULL,
+                                 params_thread_loop, NULL);
+    if (init_status != 0) {
+        ALOGE("%s: failed to create params thread %d", __func__, init_status);
+        init_status = -init_status;
+    }
 }
 
 int lib_init()
@@ -90,45 +212,21 @@ int lib_init()
 
 bool effect_exists(effect_context_t *context)
 {
-    struct listnode *node;
-
-    list_for_each(node, &created_effects_list) {
-        effect_context_t *fx_ctxt = node_to_item(node,
-                                                 effect_context_t,
-                                                 effects_list_node);
-        if (fx_ctxt == context) {
-            return true;
-        }
-    }
-    return false;
+    return effect_registry_find(&created_effects_index, (uintptr_t)context) != NULL;
 }
 
 output_context_t *get_output(audio_io_handle_t output)
 {
-    struct listnode *node;
-
-    list_for_each(node, &active_outputs_list) {
-        output_context_t *out_ctxt = node_to_item(node,
-                                                  output_context_t,
-                                                  outputs_list_node);
-        if (out_ctxt->handle == output)
-            return out_ctxt;
-    }
-    return NULL;
+    return (output_context_t *)effect_registry_find(&active_outputs_index,
+                                                    (uintptr_t)output);
 }
 
 void add_effect_to_output(output_context_t * output, effect_context_t *context)
 {
-    struct listnode *fx_node;
-
-    list_for_each(fx_node, &output->effects_list) {
-        effect_context_t *fx_ctxt = node_to_item(fx_node,
-                                                 effect_context_t,
-                                                 output_node);
-        if (fx_ctxt == context)
-            return;
-    }
+    if (context->output == output)
+        return;
     list_add_tail(&output->effects_list, &context->output_node);
+    context->output = output;
     if (context->ops.start)
         context->ops.start(context, output);
 
@@ -137,41 +235,14 @@ void add_effect_to_output(output_context_t * output, effect_context_t *context)
 void remove_effect_from_output(output_context_t * output,
                                effect_context_t *context)
 {
-    struct listnode *fx_node;
-
-    list_for_each(fx_node, &output->effects_list) {
-        effect_context_t *fx_ctxt = node_to_item(fx_node,
-                                                 effect_context_t,
-                                                 output_node);
-        if (fx_ctxt == context) {
-            if (context->ops.stop)
-                context->ops.stop(context, output);
-            list_remove(&context->output_node);
-            return;
-        }
-    }
-}
-
-bool effects_enabled()
-{
-    struct listnode *out_node;
-
-    list_for_each(out_node, &active_outputs_list) {
-        struct listnode *fx_node;
-        output_context_t *out_ctxt = node_to_item(out_node,
-                                                  output_context_t,
-                                                  outputs_list_node);
-
-        list_for_each(fx_node, &out_ctxt->effects_list) {
-            effect_context_t *fx_ctxt = node_to_item(fx_node,
-                                                     effect_context_t,
-                                                     output_node);
-            if ((fx_ctxt->state == EFFECT_STATE_ACTIVE) &&
-                (fx_ctxt->ops.process != NULL))
-                return true;
-        }
-    }
-    return false;
+    if (context->output != output)
+        return;
+    /* the queued updates belong to this output */
+    flush_effect_params_l(context);
+    if (context->ops.stop)
+        context->ops.stop(context, output);
+    list_remove(&context->output_node);
+    context->output = NULL;
 }
 
 
@@ -226,6 +297,14 @@ int offload_effects_bundle_hal_start_output(audio_io_handle_t output, int pcm_id
     }
 
     list_init(&out_ctxt->effects_list);
+    list_init(&out_ctxt->pending_params_list);
+
+    if (effect_registry_add(&active_outputs_index, (uintptr_t)output, out_ctxt) != 0) {
+        mixer_close(out_ctxt->mixer);
+        free(out_ctxt);
+        ret = -ENOMEM;
+        goto exit;
+    }
 
     list_for_each(node, &created_effects_list) {
         effect_context_t *fx_ctxt = node_to_item(node,
@@ -235,6 +314,7 @@ int offload_effects_bundle_hal_start_output(audio_io_handle_t output, int pcm_id
             if (fx_ctxt->ops.start)
                 fx_ctxt->ops.start(fx_ctxt, out_ctxt);
             list_add_tail(&out_ctxt->effects_list, &fx_ctxt->output_node);
+            fx_ctxt->output = out_ctxt;
         }
     }
     list_add_tail(&active_outputs_list, &out_ctxt->outputs_list_node);
@@ -265,6 +345,8 @@ int offload_effects_bundle_hal_stop_output(audio_io_handle_t output, int pcm_id)
         goto exit;
     }
 
+    flush_output_params_l(out_ctxt);
+
     if (out_ctxt->mixer)
         mixer_close(out_ctxt->mixer);
 
@@ -274,9 +356,11 @@ int offload_effects_bundle_hal_stop_output(audio_io_handle_t output, int pcm_id)
                                                  output_node);
         if (fx_ctxt->ops.stop)
             fx_ctxt->ops.stop(fx_ctxt, out_ctxt);
+        fx_ctxt->output = NULL;
     }
 
     list_remove(&out_ctxt->outputs_list_node);
+    effect_registry_remove(&active_outputs_index, (uintptr_t)output);
 
     free(out_ctxt);
 
@@ -345,6 +429,7 @@ int effect_lib_create(const effect_uuid_t *uuid,
         context->ops.disable = equalizer_disable;
         context->ops.start = equalizer_start;
         context->ops.stop = equalizer_stop;
+        context->ops.send_params = equalizer_send_params;
 
         context->desc = &equalizer_descriptor;
         eq_ctxt->ctl = NULL;
@@ -362,6 +447,7 @@ int effect_lib_create(const effect_uuid_t *uuid,
         context->ops.disable = bassboost_disable;
         context->ops.start = bassboost_start;
         context->ops.stop = bassboost_stop;
+        context->ops.send_params = bassboost_send_params;
 
         context->desc = &bassboost_descriptor;
         bass_ctxt->ctl = NULL;
@@ -379,6 +465,7 @@ int effect_lib_create(const effect_uuid_t *uuid,
         context->ops.disable = virtualizer_disable;
         context->ops.start = virtualizer_start;
         context->ops.stop = virtualizer_stop;
+        context->ops.send_params = virtualizer_send_params;
 
         context->desc = &virtualizer_descriptor;
         virt_ctxt->ctl = NULL;
@@ -402,6 +489,7 @@ int effect_lib_create(const effect_uuid_t *uuid,
         context->ops.disable = reverb_disable;
         context->ops.start = reverb_start;
         context->ops.stop = reverb_stop;
+        context->ops.send_params = reverb_send_params;
 
         if (memcmp(uuid, &aux_env_reverb_descriptor.uuid,
                    sizeof(effect_uuid_t)) == 0) {
@@ -439,6 +527,13 @@ int effect_lib_create(const effect_uuid_t *uuid,
     context->state = EFFECT_STATE_INITIALIZED;
 
     pthread_mutex_lock(&lock);
+    if (effect_registry_add(&created_effects_index, (uintptr_t)context, context) != 0) {
+        pthread_mutex_unlock(&lock);
+        if (context->ops.release)
+            context->ops.release(context);
+        free(context);
+        return -ENOMEM;
+    }
     list_add_tail(&created_effects_list, &context->effects_list_node);
     output_context_t *out_ctxt = get_output(ioId);
     if (out_ctxt != NULL)
@@ -469,6 +564,7 @@ int effect_lib_release(effect_handle_t handle)
         if (out_ctxt != NULL)
             remove_effect_from_output(out_ctxt, context);
         list_remove(&context->effects_list_node);
+        effect_registry_remove(&created_effects_index, (uintptr_t)context);
         if (context->ops.release)
             context->ops.release(context);
         free(context);
@@ -736,19 +832,91 @@ int effect_get_descriptor(effect_handle_t   self,
                           effect_descriptor_t *descriptor)
 {
     effect_context_t *context = (effect_context_t *)self;
+    int status = 0;
 
+    pthread_mutex_lock(&lock);
     if (!effect_exists(context) || (descriptor == NULL))
-        return -EINVAL;
-
-    *descriptor = *context->desc;
+        status = -EINVAL;
+    else
+        *descriptor = *context->desc;
+    pthread_mutex_unlock(&lock);
 
-    return 0;
+    return status;
 }
 
 bool effect_is_active(effect_context_t * ctxt) {
     return ctxt->state == EFFECT_STATE_ACTIVE;
 }
 
+static void queue_params_l(effect_context_t *context, unsigned param_send_flags,
+                           bool debounce)
+{
+    output_context_t *out_ctxt = get_output(context->out_handle);
+    struct timespec now;
+    struct timespec flush_time;
+
+    if (param_send_flags == 0)
+        return;
+
+    if (out_ctxt == NULL) {
+        /* output is being started, nothing to merge with */
+        if (context->ops.send_params)
+            context->ops.send_params(context, param_send_flags);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    flush_time = now;
+    timespec_add_ms(&flush_time, debounce ? params_debounce_ms : PARAMS_FLUSH_PERIOD_MS);
+
+    if (list_empty(&out_ctxt->pending_params_list)) {
+        out_ctxt->params_queue_time = now;
+        out_ctxt->params_flush_time = flush_time;
+        out_ctxt->params_debounced = debounce;
+        pthread_cond_signal(&params_cond);
+    } else if (debounce) {
+        /* only postpone while nothing but debounced updates is pending */
+        if (out_ctxt->params_debounced) {
+            struct timespec max_time = out_ctxt->params_queue_time;
+
+            timespec_add_ms(&max_time, params_debounce_max_ms);
+            if (timespec_cmp(&flush_time, &max_time) > 0)
+                flush_time = max_time;
+            if (timespec_cmp(&flush_time, &out_ctxt->params_flush_time) > 0)
+                out_ctxt->params_flush_time = flush_time;
+        }
+    } else {
+        out_ctxt->params_debounced = false;
+        if (timespec_cmp(&flush_time, &out_ctxt->params_flush_time) < 0) {
+            out_ctxt->params_flush_time = flush_time;
+            pthread_cond_signal(&params_cond);
+        }
+    }
+
+    if (context->pending_send_flags == 0)
+        list_add_tail(&out_ctxt->pending_params_list, &context->pending_node);
+    context->pending_send_flags |= param_send_flags;
+}
+
+/*
+ * Called with lock held by the effects instead of writing the mixer control
+ * directly: updates queued within one flush period are merged per effect and
+ * sent with the values current at flush time.
+ */
+void offload_effects_queue_params(effect_context_t *context, unsigned param_send_flags)
+{
+    queue_params_l(context, param_send_flags, false);
+}
+
+/*
+ * Same as offload_effects_queue_params() for controls apps animate, where only
+ * the latest value matters: see params_debounce_ms.
+ */
+void offload_effects_debounce_params(effect_context_t *context, unsigned param_send_flags)
+{
+    queue_params_l(context, param_send_flags, true);
+}
+
 /* effect_handle_t interface implementation for offload effects */
 const struct effect_interface_s effect_interface = {
     effect_process,
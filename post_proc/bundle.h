@@ -17,6 +17,7 @@
 #ifndef OFFLOAD_EFFECT_BUNDLE_H
 #define OFFLOAD_EFFECT_BUNDLE_H
 
+#include <time.h>
 #include <tinyalsa/asoundlib.h>
 #include <sound/audio_effects.h>
 #include "effect_api.h"
@@ -45,6 +46,14 @@ struct output_context_s {
     int pcm_device_id;
     struct mixer *mixer;
     struct mixer_ctl *ctl;
+    /* effects with DSP parameter updates queued, see offload_effects_queue_params() */
+    struct listnode pending_params_list;
+    /* CLOCK_MONOTONIC time the queued updates are sent at */
+    struct timespec params_flush_time;
+    /* CLOCK_MONOTONIC time the oldest queued update was queued at */
+    struct timespec params_queue_time;
+    /* true when only debounced updates are pending */
+    bool params_debounced;
 };
 
 /* effect specific operations.
@@ -63,6 +72,8 @@ struct effect_ops_s {
     int (*set_parameter)(effect_context_t *context, effect_param_t *param, uint32_t size);
     int (*get_parameter)(effect_context_t *context, effect_param_t *param, uint32_t *size);
     int (*set_device)(effect_context_t *context, uint32_t device);
+    /* writes the current value of the parameters selected by the OFFLOAD_SEND_* flags */
+    int (*send_params)(effect_context_t *context, unsigned param_send_flags);
     int (*command)(effect_context_t *context, uint32_t cmdCode, uint32_t cmdSize,
             void *pCmdData, uint32_t *replySize, void *pReplyData);
 };
@@ -73,12 +84,17 @@ struct effect_context_s {
     struct listnode effects_list_node;
     /* node in output_context_t.effects_list */
     struct listnode output_node;
+    /* output linked through output_node, NULL if none */
+    output_context_t *output;
     effect_config_t config;
     const effect_descriptor_t *desc;
     /* io handle of the output the effect is attached to */
     audio_io_handle_t out_handle;
     uint32_t state;
     bool offload_enabled;
+    /* node in output_context_t.pending_params_list when pending_send_flags != 0 */
+    struct listnode pending_node;
+    unsigned pending_send_flags;
     effect_ops_t ops;
 };
 
@@ -86,4 +102,8 @@ int set_config(effect_context_t *context, effect_config_t *config);
 
 bool effect_is_active(effect_context_t *context);
 
+void offload_effects_queue_params(effect_context_t *context, unsigned param_send_flags);
+
+void offload_effects_debounce_params(effect_context_t *context, unsigned param_send_flags);
+
 #endif /* OFFLOAD_EFFECT_BUNDLE_H */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "offload_effect_registry"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <cutils/log.h>
+
+#include "effect_registry.h"
+
+#define REGISTRY_MIN_CAPACITY 16
+
+/* open addressing with linear probing, kept at most half full */
+static size_t slot_of(const struct effect_registry *reg, uintptr_t key)
+{
+    uint64_t h = (uint64_t)key * 0x9E3779B97F4A7C15ull;
+
+    return (size_t)(h ^ (h >> 32)) & (reg->capacity - 1);
+}
+
+static void insert_l(struct effect_registry *reg, uintptr_t key, void *value)
+{
+    size_t i = slot_of(reg, key);
+
+    while (reg->keys[i] != 0 && reg->keys[i] != key)
+        i = (i + 1) & (reg->capacity - 1);
+    if (reg->keys[i] == 0)
+        reg->count++;
+    reg->keys[i] = key;
+    reg->values[i] = value;
+}
+
+static int grow(struct effect_registry *reg)
+{
+    struct effect_registry bigger = {
+        .capacity = reg->capacity ? reg->capacity * 2 : REGISTRY_MIN_CAPACITY,
+    };
+    size_t i;
+
+    bigger.keys = (uintptr_t *)calloc(bigger.capacity, sizeof(*bigger.keys));
+    bigger.values = (void **)calloc(bigger.capacity, sizeof(*bigger.values));
+    if (bigger.keys == NULL || bigger.values == NULL) {
+        ALOGE("%s: cannot grow to %zu entries", __func__, bigger.capacity);
+        free(bigger.keys);
+        free(bigger.values);
+        return -ENOMEM;
+    }
+    for (i = 0; i < reg->capacity; i++) {
+        if (reg->keys[i] != 0)
+            insert_l(&bigger, reg->keys[i], reg->values[i]);
+    }
+    free(reg->keys);
+    free(reg->values);
+    *reg = bigger;
+    return 0;
+}
+
+int effect_registry_add(struct effect_registry *reg, uintptr_t key, void *value)
+{
+    if (key == 0)
+        return -EINVAL;
+    if ((reg->count + 1) * 2 > reg->capacity && grow(reg) != 0)
+        return -ENOMEM;
+    insert_l(reg, key, value);
+    return 0;
+}
+
+void *effect_registry_find(const struct effect_registry *reg, uintptr_t key)
+{
+    size_t i;
+
+    if (reg->count == 0 || key == 0)
+        return NULL;
+    for (i = slot_of(reg, key); reg->keys[i] != 0; i = (i + 1) & (reg->capacity - 1)) {
+        if (reg->keys[i] == key)
+            return reg->values[i];
+    }
+    return NULL;
+}
+
+void effect_registry_remove(struct effect_registry *reg, uintptr_t key)
+{
+    size_t i, j, home;
+
+    if (reg->count == 0 || key == 0)
+        return;
+    for (i = slot_of(reg, key); reg->keys[i] != key; i = (i + 1) & (reg->capacity - 1)) {
+        if (reg->keys[i] == 0)
+            return;
+    }
+    /* shift the rest of the probe run back so lookups never stop early */
+    for (j = (i + 1) & (reg->capacity - 1); reg->keys[j] != 0;
+         j = (j + 1) & (reg->capacity - 1)) {
+        home = slot_of(reg, reg->keys[j]);
+        /* entry j may move to i only if i lies on its probe path home..j */
+        if (((j - home) & (reg->capacity - 1)) >= ((j - i) & (reg->capacity - 1))) {
+            reg->keys[i] = reg->keys[j];
+            reg->values[i] = reg->values[j];
+            i = j;
+        }
+    }
+    reg->keys[i] = 0;
+    reg->values[i] = NULL;
+    reg->count--;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OFFLOAD_EFFECT_REGISTRY_H_
+#define OFFLOAD_EFFECT_REGISTRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hash index shared by the offload effect bundle and the offload visualizer.
+ * Maps a non zero key (an effect handle or an output io handle) to a value
+ * so handle validation and output lookup don't walk the created effects and
+ * active outputs lists. Not thread safe, callers hold their library lock.
+ */
+struct effect_registry {
+    uintptr_t *keys;    /* 0 marks a free slot */
+    void **values;
+    size_t capacity;    /* power of two, 0 until the first add */
+    size_t count;
+};
+
+/* adds or replaces key, returns 0 or -ENOMEM */
+int effect_registry_add(struct effect_registry *reg, uintptr_t key, void *value);
+
+/* returns the value added for key, NULL if none */
+void *effect_registry_find(const struct effect_registry *reg, uintptr_t key);
+
+void effect_registry_remove(struct effect_registry *reg, uintptr_t key);
+
+#endif /* OFFLOAD_EFFECT_REGISTRY_H_ */
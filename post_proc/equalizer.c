@@ -107,9 +107,9 @@ int equalizer_set_band_level(equalizer_context_t *context, int32_t band,
                                equalizer_band_presets_freq,
                                context->band_levels);
     if (context->ctl)
-        offload_eq_send_params(context->ctl, &context->offload_eq,
-                               OFFLOAD_SEND_EQ_ENABLE_FLAG |
-                               OFFLOAD_SEND_EQ_BANDS_LEVEL);
+        offload_effects_debounce_params(&context->common,
+                                        OFFLOAD_SEND_EQ_ENABLE_FLAG |
+                                        OFFLOAD_SEND_EQ_BANDS_LEVEL);
     return 0;
 }
 
@@ -164,9 +164,9 @@ int equalizer_set_preset(equalizer_context_t *context, int preset)
                                equalizer_band_presets_freq,
                                context->band_levels);
     if(context->ctl)
-        offload_eq_send_params(context->ctl, &context->offload_eq,
-                               OFFLOAD_SEND_EQ_ENABLE_FLAG |
-                               OFFLOAD_SEND_EQ_PRESET);
+        offload_effects_queue_params(&context->common,
+                                     OFFLOAD_SEND_EQ_ENABLE_FLAG |
+                                     OFFLOAD_SEND_EQ_PRESET);
     return 0;
 }
 
@@ -509,9 +509,9 @@ int equalizer_enable(effect_context_t *context)
     if (!offload_eq_get_enable_flag(&(eq_ctxt->offload_eq))) {
         offload_eq_set_enable_flag(&(eq_ctxt->offload_eq), true);
         if (eq_ctxt->ctl)
-            offload_eq_send_params(eq_ctxt->ctl, &eq_ctxt->offload_eq,
-                                   OFFLOAD_SEND_EQ_ENABLE_FLAG |
-                                   OFFLOAD_SEND_EQ_BANDS_LEVEL);
+            offload_effects_queue_params(&eq_ctxt->common,
+                                         OFFLOAD_SEND_EQ_ENABLE_FLAG |
+                                         OFFLOAD_SEND_EQ_BANDS_LEVEL);
     }
     return 0;
 }
@@ -524,8 +524,8 @@ int equalizer_disable(effect_context_t *context)
     if (offload_eq_get_enable_flag(&(eq_ctxt->offload_eq))) {
         offload_eq_set_enable_flag(&(eq_ctxt->offload_eq), false);
         if (eq_ctxt->ctl)
-            offload_eq_send_params(eq_ctxt->ctl, &eq_ctxt->offload_eq,
-                                   OFFLOAD_SEND_EQ_ENABLE_FLAG);
+            offload_effects_queue_params(&eq_ctxt->common,
+                                         OFFLOAD_SEND_EQ_ENABLE_FLAG);
     }
     return 0;
 }
@@ -552,3 +552,17 @@ int equalizer_stop(effect_context_t *context, output_context_t *output __unused)
     eq_ctxt->ctl = NULL;
     return 0;
 }
+
+int equalizer_send_params(effect_context_t *context, unsigned param_send_flags)
+{
+    equalizer_context_t *eq_ctxt = (equalizer_context_t *)context;
+
+    ALOGV("%s", __func__);
+    /* a custom band setting queued after a preset replaces it */
+    if (eq_ctxt->offload_eq.config.preset_id == PRESET_CUSTOM)
+        param_send_flags &= ~OFFLOAD_SEND_EQ_PRESET;
+    if (eq_ctxt->ctl)
+        offload_eq_send_params(eq_ctxt->ctl, &eq_ctxt->offload_eq,
+                               param_send_flags);
+    return 0;
+}
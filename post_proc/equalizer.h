@@ -57,4 +57,6 @@ int equalizer_start(effect_context_t *context, output_context_t *output);
 
 int equalizer_stop(effect_context_t *context, output_context_t *output);
 
+int equalizer_send_params(effect_context_t *context, unsigned param_send_flags);
+
 #endif /*OFFLOAD_EQUALIZER_H_*/
@@ -63,6 +63,16 @@ static const audio_stream_type_t MIN_STREAM_TYPES = AUDIO_STREAM_VOICE_CALL;
 static const audio_stream_type_t MAX_STREAM_TYPES = AUDIO_STREAM_NOTIFICATION;
 static struct ma_state g_cur_state[MAX_STREAM_TYPES + 1];
 
+/* active contexts on a MaxxAudio device for one stream type, see update_aggregate_l() */
+struct ma_aggregate {
+    struct listnode contexts;
+    int count;
+    float max_vol;
+    ma_listener_context_t *max_context;  /* context holding max_vol, NULL if none */
+};
+
+static struct ma_aggregate g_aggregate[MAX_STREAM_TYPES + 1];
+
 struct ma_listener_context_s {
     const struct effect_interface_s *itfe;
     struct listnode effect_list_node;
@@ -74,6 +84,10 @@ struct ma_listener_context_s {
     uint32_t dev_id;
     float left_vol;
     float right_vol;
+    /* volume this context adds to its aggregate, valid when counted */
+    struct listnode aggregate_node;
+    float vol;
+    bool counted;
 };
 
 /* voice UUID: 4ece09c2-3728-11e8-a9f9-fc4dd4486b6d */
@@ -183,36 +197,19 @@ static inline bool valid_dev_in_context(struct ma_listener_context_s *context)
 
 static void check_and_set_ma_parameter(uint32_t stream_type)
 {
-    bool active = false;
-    float temp_vol = 0.0;
-    float max_vol = 0.0;
-    struct listnode *node = NULL;
-    ma_listener_context_t *context = NULL;
+    bool active;
+    float max_vol;
 
     ALOGV("%s .. called ..", __func__);
-    // get maximum volume for the active session with same strem type
-    list_for_each(node, &ma_effect_list) {
-        context = node_to_item(node, struct ma_listener_context_s, effect_list_node);
-        if (context->stream_type == stream_type &&
-            valid_dev_in_context(context)) {
-            if (context->state == MA_LISTENER_STATE_ACTIVE) {
-                active = true;
-                temp_vol = fmax(context->left_vol, context->right_vol);
-                if (max_vol < temp_vol)
-                    max_vol = temp_vol;
-                ALOGV("%s: check session(%d) volume(%f) for stream(%d)",
-                       __func__, context->session_id, temp_vol, stream_type);
-            }
-        }
-    }
+    if (stream_type < MIN_STREAM_TYPES || stream_type > MAX_STREAM_TYPES)
+        return;
 
-    // check volume
-    if (max_vol < 0.0) max_vol = 0;
-    else if (max_vol > 1.0) max_vol = 1.0;
+    // maximum volume of the active sessions with same stream type is
+    // maintained by update_aggregate_l()
+    active = g_aggregate[stream_type].count > 0;
+    max_vol = g_aggregate[stream_type].max_vol;
 
     if (send_ma_parameter != NULL &&
-        stream_type >= MIN_STREAM_TYPES &&
-        stream_type <= MAX_STREAM_TYPES &&
         (g_cur_state[stream_type].vol != max_vol ||
          g_cur_state[stream_type].active != active)) {
 
@@ -230,6 +227,57 @@ static void check_and_set_ma_parameter(uint32_t stream_type)
     return;
 }
 
+/* keeps the aggregate of context's stream type in step with it and sends
+ * the result, call after any change to its state/device/volume */
+static void update_aggregate_l(ma_listener_context_t *context)
+{
+    struct ma_aggregate *aggregate;
+    struct listnode *node = NULL;
+    ma_listener_context_t *item = NULL;
+    bool counted = (context->state == MA_LISTENER_STATE_ACTIVE) &&
+                   valid_dev_in_context(context);
+    float vol = fmax(context->left_vol, context->right_vol);
+
+    if (context->stream_type < MIN_STREAM_TYPES || context->stream_type > MAX_STREAM_TYPES)
+        return;
+    aggregate = &g_aggregate[context->stream_type];
+
+    // check volume
+    if (vol < 0.0) vol = 0;
+    else if (vol > 1.0) vol = 1.0;
+
+    if (context->counted && !counted) {
+        list_remove(&context->aggregate_node);
+        aggregate->count--;
+    } else if (!context->counted && counted) {
+        list_add_tail(&aggregate->contexts, &context->aggregate_node);
+        aggregate->count++;
+    }
+    context->counted = counted;
+    context->vol = counted ? vol : 0;
+
+    if (counted && (aggregate->max_context == NULL || vol >= aggregate->max_vol)) {
+        aggregate->max_vol = vol;
+        aggregate->max_context = context;
+    } else if (aggregate->max_context == context) {
+        // the loudest session got quieter or left, only then look at the others
+        aggregate->max_vol = 0;
+        aggregate->max_context = NULL;
+        list_for_each(node, &aggregate->contexts) {
+            item = node_to_item(node, struct ma_listener_context_s, aggregate_node);
+            if (aggregate->max_context == NULL || item->vol > aggregate->max_vol) {
+                aggregate->max_vol = item->vol;
+                aggregate->max_context = item;
+            }
+        }
+    }
+
+    ALOGV("%s: session(%d) volume(%f) counted(%d), stream(%d) has %d active max(%f)",
+          __func__, context->session_id, vol, counted, context->stream_type,
+          aggregate->count, aggregate->max_vol);
+    check_and_set_ma_parameter(context->stream_type);
+}
+
 /*
  * Effect Control Interface Implementation
  */
@@ -318,11 +366,8 @@ static int ma_effect_command(effect_handle_t self,
         context->state = MA_LISTENER_STATE_ACTIVE;
         *(int *)p_reply_data = 0;
 
-        // After changing the state and if device is valid
-        // check and send state
-        if (valid_dev_in_context(context)) {
-            check_and_set_ma_parameter(context->stream_type);
-        }
+        // hal is only called if the stream type aggregate changed
+        update_aggregate_l(context);
 
         break;
 
@@ -345,11 +390,8 @@ static int ma_effect_command(effect_handle_t self,
         context->state = MA_LISTENER_STATE_INITIALIZED;
         *(int *)p_reply_data = 0;
 
-        // After changing the state and if device is valid
-        // check and send state
-        if (valid_dev_in_context(context)) {
-            check_and_set_ma_parameter(context->stream_type);
-        }
+        // hal is only called if the stream type aggregate changed
+        update_aggregate_l(context);
 
         break;
 
@@ -376,11 +418,8 @@ static int ma_effect_command(effect_handle_t self,
                __func__, context->dev_id, new_device);
 
         context->dev_id = new_device;
-        // After changing the state and if device is valid
-        // check and send parameter
-        if (valid_dev_in_context(context)) {
-            check_and_set_ma_parameter(context->stream_type);
-        }
+        // hal is only called if the stream type aggregate changed
+        update_aggregate_l(context);
     }
     break;
 
@@ -404,11 +443,8 @@ static int ma_effect_command(effect_handle_t self,
         context->left_vol = left_vol;
         context->right_vol = right_vol;
 
-        // After changing the state and if device is valid
-        // check and send volume
-        if (valid_dev_in_context(context)) {
-            check_and_set_ma_parameter(context->stream_type);
-        }
+        // hal is only called if the stream type aggregate changed
+        update_aggregate_l(context);
     }
     break;
 
@@ -476,6 +512,8 @@ static void init_once()
 
     pthread_mutex_init(&ma_listner_init_lock, NULL);
     list_init(&ma_effect_list);
+    for (ret = MIN_STREAM_TYPES; ret <= MAX_STREAM_TYPES; ret++)
+        list_init(&g_aggregate[ret].contexts);
     init_state = 0;
 
     ALOGD("%s: exit ret %d", __func__, init_state);
@@ -565,6 +603,9 @@ static int ma_prc_lib_release(effect_handle_t handle)
         context = node_to_item(node, struct ma_listener_context_s, effect_list_node);
         if (context == recv_contex) {
             ALOGV("--- Found something to remove ---");
+            // a released session no longer keeps its stream type active
+            context->state = MA_LISTENER_STATE_UNINITIALIZED;
+            update_aggregate_l(context);
             list_remove(node);
             PRINT_STREAM_TYPE(context->stream_type);
             free(context);
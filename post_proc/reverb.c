@@ -132,9 +132,9 @@ void reverb_set_room_level(reverb_context_t *context, int16_t room_level)
     context->reverb_settings.roomLevel = room_level;
     offload_reverb_set_room_level(&(context->offload_reverb), room_level);
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_ROOM_LEVEL);
+        offload_effects_debounce_params(&context->common,
+                                        OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                        OFFLOAD_SEND_REVERB_ROOM_LEVEL);
 }
 
 int16_t reverb_get_room_hf_level(reverb_context_t *context)
@@ -150,9 +150,9 @@ void reverb_set_room_hf_level(reverb_context_t *context, int16_t room_hf_level)
     context->reverb_settings.roomHFLevel = room_hf_level;
     offload_reverb_set_room_hf_level(&(context->offload_reverb), room_hf_level);
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_ROOM_HF_LEVEL);
+        offload_effects_debounce_params(&context->common,
+                                        OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                        OFFLOAD_SEND_REVERB_ROOM_HF_LEVEL);
 }
 
 uint32_t reverb_get_decay_time(reverb_context_t *context)
@@ -167,9 +167,9 @@ void reverb_set_decay_time(reverb_context_t *context, uint32_t decay_time)
     context->reverb_settings.decayTime = decay_time;
     offload_reverb_set_decay_time(&(context->offload_reverb), decay_time);
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_DECAY_TIME);
+        offload_effects_debounce_params(&context->common,
+                                        OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                        OFFLOAD_SEND_REVERB_DECAY_TIME);
 }
 
 int16_t reverb_get_decay_hf_ratio(reverb_context_t *context)
@@ -185,9 +185,9 @@ void reverb_set_decay_hf_ratio(reverb_context_t *context, int16_t decay_hf_ratio
     context->reverb_settings.decayHFRatio = decay_hf_ratio;
     offload_reverb_set_decay_hf_ratio(&(context->offload_reverb), decay_hf_ratio);
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_DECAY_HF_RATIO);
+        offload_effects_debounce_params(&context->common,
+                                        OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                        OFFLOAD_SEND_REVERB_DECAY_HF_RATIO);
 }
 
 int16_t reverb_get_reverb_level(reverb_context_t *context)
@@ -202,9 +202,9 @@ void reverb_set_reverb_level(reverb_context_t *context, int16_t reverb_level)
     context->reverb_settings.reverbLevel = reverb_level;
     offload_reverb_set_reverb_level(&(context->offload_reverb), reverb_level);
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_LEVEL);
+        offload_effects_debounce_params(&context->common,
+                                        OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                        OFFLOAD_SEND_REVERB_LEVEL);
 }
 
 int16_t reverb_get_diffusion(reverb_context_t *context)
@@ -219,9 +219,9 @@ void reverb_set_diffusion(reverb_context_t *context, int16_t diffusion)
     context->reverb_settings.diffusion = diffusion;
     offload_reverb_set_diffusion(&(context->offload_reverb), diffusion);
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_DIFFUSION);
+        offload_effects_debounce_params(&context->common,
+                                        OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                        OFFLOAD_SEND_REVERB_DIFFUSION);
 }
 
 int16_t reverb_get_density(reverb_context_t *context)
@@ -236,9 +236,9 @@ void reverb_set_density(reverb_context_t *context, int16_t density)
     context->reverb_settings.density = density;
     offload_reverb_set_density(&(context->offload_reverb), density);
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_DENSITY);
+        offload_effects_debounce_params(&context->common,
+                                        OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                        OFFLOAD_SEND_REVERB_DENSITY);
 }
 
 void reverb_set_preset(reverb_context_t *context, int16_t preset)
@@ -252,9 +252,9 @@ void reverb_set_preset(reverb_context_t *context, int16_t preset)
     offload_reverb_set_enable_flag(&(context->offload_reverb), enable);
 
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_PRESET);
+        offload_effects_queue_params(&context->common,
+                                     OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                     OFFLOAD_SEND_REVERB_PRESET);
 }
 
 void reverb_set_all_properties(reverb_context_t *context,
@@ -269,15 +269,15 @@ void reverb_set_all_properties(reverb_context_t *context,
     context->reverb_settings.diffusion = reverb_settings->diffusion;
     context->reverb_settings.density = reverb_settings->density;
     if (context->ctl)
-        offload_reverb_send_params(context->ctl, &context->offload_reverb,
-                                   OFFLOAD_SEND_REVERB_ENABLE_FLAG |
-                                   OFFLOAD_SEND_REVERB_ROOM_LEVEL |
-                                   OFFLOAD_SEND_REVERB_ROOM_HF_LEVEL |
-                                   OFFLOAD_SEND_REVERB_DECAY_TIME |
-                                   OFFLOAD_SEND_REVERB_DECAY_HF_RATIO |
-                                   OFFLOAD_SEND_REVERB_LEVEL |
-                                   OFFLOAD_SEND_REVERB_DIFFUSION |
-                                   OFFLOAD_SEND_REVERB_DENSITY);
+        offload_effects_queue_params(&context->common,
+                                     OFFLOAD_SEND_REVERB_ENABLE_FLAG |
+                                     OFFLOAD_SEND_REVERB_ROOM_LEVEL |
+                                     OFFLOAD_SEND_REVERB_ROOM_HF_LEVEL |
+                                     OFFLOAD_SEND_REVERB_DECAY_TIME |
+                                     OFFLOAD_SEND_REVERB_DECAY_HF_RATIO |
+                                     OFFLOAD_SEND_REVERB_LEVEL |
+                                     OFFLOAD_SEND_REVERB_DIFFUSION |
+                                     OFFLOAD_SEND_REVERB_DENSITY);
 }
 
 void reverb_load_preset(reverb_context_t *context)
@@ -599,9 +599,8 @@ int reverb_disable(effect_context_t *context)
     if (offload_reverb_get_enable_flag(&(reverb_ctxt->offload_reverb))) {
         offload_reverb_set_enable_flag(&(reverb_ctxt->offload_reverb), false);
         if (reverb_ctxt->ctl)
-            offload_reverb_send_params(reverb_ctxt->ctl,
-                                       &reverb_ctxt->offload_reverb,
-                                       OFFLOAD_SEND_REVERB_ENABLE_FLAG);
+            offload_effects_queue_params(&reverb_ctxt->common,
+                                         OFFLOAD_SEND_REVERB_ENABLE_FLAG);
     }
     return 0;
 }
@@ -632,3 +631,13 @@ int reverb_stop(effect_context_t *context, output_context_t *output __unused)
     return 0;
 }
 
+int reverb_send_params(effect_context_t *context, unsigned param_send_flags)
+{
+    reverb_context_t *reverb_ctxt = (reverb_context_t *)context;
+
+    ALOGV("%s", __func__);
+    if (reverb_ctxt->ctl)
+        offload_reverb_send_params(reverb_ctxt->ctl, &reverb_ctxt->offload_reverb,
+                                   param_send_flags);
+    return 0;
+}
@@ -80,4 +80,6 @@ int reverb_start(effect_context_t *context, output_context_t *output);
 
 int reverb_stop(effect_context_t *context, output_context_t *output);
 
+int reverb_send_params(effect_context_t *context, unsigned param_send_flags);
+
 #endif /* OFFLOAD_REVERB_H_ */
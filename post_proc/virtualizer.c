@@ -56,9 +56,9 @@ int virtualizer_set_strength(virtualizer_context_t *context, uint32_t strength)
 
     offload_virtualizer_set_strength(&(context->offload_virt), strength);
     if (context->ctl)
-        offload_virtualizer_send_params(context->ctl, &context->offload_virt,
-                                        OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG |
-                                        OFFLOAD_SEND_VIRTUALIZER_STRENGTH);
+        offload_effects_queue_params(&context->common,
+                                     OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG |
+                                     OFFLOAD_SEND_VIRTUALIZER_STRENGTH);
     return 0;
 }
 
@@ -158,9 +158,8 @@ int virtualizer_set_device(effect_context_t *context, uint32_t device)
             if (effect_is_active(&virt_ctxt->common)) {
                 offload_virtualizer_set_enable_flag(&(virt_ctxt->offload_virt), false);
                 if (virt_ctxt->ctl)
-                    offload_virtualizer_send_params(virt_ctxt->ctl,
-                                                    &virt_ctxt->offload_virt,
-                                                    OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG);
+                    offload_effects_queue_params(&virt_ctxt->common,
+                                                 OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG);
             }
             virt_ctxt->temp_disabled = true;
         }
@@ -169,9 +168,8 @@ int virtualizer_set_device(effect_context_t *context, uint32_t device)
             if (effect_is_active(&virt_ctxt->common)) {
                 offload_virtualizer_set_enable_flag(&(virt_ctxt->offload_virt), true);
                 if (virt_ctxt->ctl)
-                    offload_virtualizer_send_params(virt_ctxt->ctl,
-                                                    &virt_ctxt->offload_virt,
-                                                    OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG);
+                    offload_effects_queue_params(&virt_ctxt->common,
+                                                 OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG);
             }
             virt_ctxt->temp_disabled = false;
         }
@@ -227,10 +225,9 @@ int virtualizer_enable(effect_context_t *context)
         !(virt_ctxt->temp_disabled)) {
         offload_virtualizer_set_enable_flag(&(virt_ctxt->offload_virt), true);
         if (virt_ctxt->ctl && virt_ctxt->strength)
-            offload_virtualizer_send_params(virt_ctxt->ctl,
-                                          &virt_ctxt->offload_virt,
-                                          OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG |
-                                          OFFLOAD_SEND_BASSBOOST_STRENGTH);
+            offload_effects_queue_params(&virt_ctxt->common,
+                                         OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG |
+                                         OFFLOAD_SEND_BASSBOOST_STRENGTH);
     }
     return 0;
 }
@@ -243,9 +240,8 @@ int virtualizer_disable(effect_context_t *context)
     if (offload_virtualizer_get_enable_flag(&(virt_ctxt->offload_virt))) {
         offload_virtualizer_set_enable_flag(&(virt_ctxt->offload_virt), false);
         if (virt_ctxt->ctl)
-            offload_virtualizer_send_params(virt_ctxt->ctl,
-                                          &virt_ctxt->offload_virt,
-                                          OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG);
+            offload_effects_queue_params(&virt_ctxt->common,
+                                         OFFLOAD_SEND_VIRTUALIZER_ENABLE_FLAG);
     }
     return 0;
 }
@@ -272,3 +268,14 @@ int virtualizer_stop(effect_context_t *context, output_context_t *output __unuse
     virt_ctxt->ctl = NULL;
     return 0;
 }
+
+int virtualizer_send_params(effect_context_t *context, unsigned param_send_flags)
+{
+    virtualizer_context_t *virt_ctxt = (virtualizer_context_t *)context;
+
+    ALOGV("%s", __func__);
+    if (virt_ctxt->ctl)
+        offload_virtualizer_send_params(virt_ctxt->ctl, &virt_ctxt->offload_virt,
+                                        param_send_flags);
+    return 0;
+}
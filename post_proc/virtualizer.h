@@ -53,4 +53,6 @@ int virtualizer_start(effect_context_t *context, output_context_t *output);
 
 int virtualizer_stop(effect_context_t *context, output_context_t *output);
 
+int virtualizer_send_params(effect_context_t *context, unsigned param_send_flags);
+
 #endif /* OFFLOAD_VIRTUALIZER_H_ */
@@ -54,6 +54,9 @@
 #define AHAL_GAIN_DEPENDENT_INTERFACE_FUNCTION "audio_hw_send_gain_dep_calibration"
 #define AHAL_GAIN_GET_MAPPING_TABLE "audio_hw_get_gain_level_mapping"
 #define DEFAULT_CAL_STEP 0
+/* a new level is only selected once the volume leaves the current step by
+ * this amplitude ratio (0.5 dB) */
+#define GAIN_DEP_CAL_HYSTERESIS 1.0593f
 
 enum {
     VOL_LISTENER_STATE_UNINITIALIZED,
@@ -69,6 +72,12 @@ static bool initialized = false;
 
 /* current gain dep cal level that was pushed succesfully */
 static int current_gain_dep_cal_level = -1;
+/* volume_curve_gain_mapping_table entry of current_gain_dep_cal_level, -1 if none */
+static int current_gain_dep_cal_index = -1;
+
+/* energy sum of the active contexts on a gain dep cal device, see update_energy_l() */
+static double sum_energy = 0.0;
+static int sum_energy_count = 0;
 
 enum STREAM_TYPE {
     MUSIC,
@@ -91,6 +100,9 @@ struct vol_listener_context_s {
     uint32_t dev_id;
     float left_vol;
     float right_vol;
+    /* energy this context adds to sum_energy, valid when energy_counted */
+    float energy;
+    bool energy_counted;
 };
 
 /* volume listener, music UUID: 08b8b058-0590-11e5-ac71-0025b32654a0 */
@@ -254,6 +266,61 @@ static inline bool valid_dev_in_context(struct vol_listener_context_s *context)
     return false;
 }
 
+/* keeps sum_energy in step with context, call after any change to its state/device/volume */
+static void update_energy_l(vol_listener_context_t *context)
+{
+    bool counted = (context->state == VOL_LISTENER_STATE_ACTIVE) &&
+                   valid_dev_in_context(context);
+    float temp_vol = fmax(context->left_vol, context->right_vol);
+
+    if (context->energy_counted) {
+        sum_energy -= context->energy;
+        sum_energy_count--;
+    }
+    context->energy_counted = counted;
+    context->energy = counted ? temp_vol * temp_vol : 0;
+    if (counted) {
+        sum_energy += context->energy;
+        sum_energy_count++;
+    }
+    // no rounding residue once nothing contributes
+    if (sum_energy_count == 0 || sum_energy < 0)
+        sum_energy = 0.0;
+}
+
+/* index of the last table step whose amp is <= vol, -1 if vol is below the first step */
+static int find_gain_dep_cal_index(float vol)
+{
+    int lo = 0, hi = total_volume_cal_step - 1, idx = -1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (volume_curve_gain_mapping_table[mid].amp <= vol) {
+            idx = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return idx;
+}
+
+/* true if vol is still within the current step widened by GAIN_DEP_CAL_HYSTERESIS */
+static bool in_current_gain_dep_cal_step(float vol)
+{
+    int idx = current_gain_dep_cal_index;
+
+    if (idx < 0 || idx >= total_volume_cal_step)
+        return false;
+
+    if (vol < volume_curve_gain_mapping_table[idx].amp / GAIN_DEP_CAL_HYSTERESIS)
+        return false;
+    if (idx + 1 < total_volume_cal_step &&
+        vol >= volume_curve_gain_mapping_table[idx + 1].amp * GAIN_DEP_CAL_HYSTERESIS)
+        return false;
+    return true;
+}
+
 static void check_and_set_gain_dep_cal()
 {
     // iterate through list and make decision to set new gain dep cal level for speaker device
@@ -262,30 +329,15 @@ static void check_and_set_gain_dep_cal()
     // 3. find the highest of all the active usecase
     // 4. if new value is different than the current value then load new calibration
 
-    struct listnode *node = NULL;
     float new_vol = -1.0;
-    int max_level = 0;
-    vol_listener_context_t *context = NULL;
     if (dumping_enabled) {
         dump_list_l();
     }
 
     ALOGV("%s ==> Start ...", __func__);
 
-    float sum_energy = 0.0;
-    bool sum_energy_used = false;
-    float temp_vol = 0;
-    // compute energy sum for the active speaker device (pick loudest of both channels)
-    list_for_each(node, &vol_effect_list) {
-        context = node_to_item(node, struct vol_listener_context_s, effect_list_node);
-        if ((context->state == VOL_LISTENER_STATE_ACTIVE) &&
-            valid_dev_in_context(context)) {
-            sum_energy_used = true;
-            temp_vol = fmax(context->left_vol, context->right_vol);
-            sum_energy += temp_vol * temp_vol;
-        }
-    }
-    if (sum_energy_used) {
+    // energy sum for the active speaker device is maintained by update_energy_l()
+    if (sum_energy_count > 0) {
         new_vol = fmin(sqrt(sum_energy), 1.0);
     }
 
@@ -296,24 +348,24 @@ static void check_and_set_gain_dep_cal()
         if (send_gain_dep_cal != NULL) {
             // send Gain dep cal level
             int gain_dep_cal_level = -1;
+            int gain_dep_cal_index = -1;
 
             if (new_vol >= 1 && total_volume_cal_step > 0) { // max amplitude, use highest DRC level
-                gain_dep_cal_level = volume_curve_gain_mapping_table[total_volume_cal_step - 1].level;
+                gain_dep_cal_index = total_volume_cal_step - 1;
             } else if (new_vol == -1) {
                 gain_dep_cal_level = DEFAULT_CAL_STEP;
             } else if (new_vol == 0) {
-                gain_dep_cal_level = volume_curve_gain_mapping_table[0].level;
+                gain_dep_cal_index = 0;
+            } else if (in_current_gain_dep_cal_step(new_vol)) {
+                // close to a step boundary, don't flap between DRC levels
+                gain_dep_cal_index = current_gain_dep_cal_index;
             } else {
-                for (max_level = 0; max_level + 1 < total_volume_cal_step; max_level++) {
-                    if (new_vol < volume_curve_gain_mapping_table[max_level + 1].amp &&
-                        new_vol >= volume_curve_gain_mapping_table[max_level].amp) {
-                        gain_dep_cal_level = volume_curve_gain_mapping_table[max_level].level;
-                        ALOGV("%s: volume(%f), gain dep cal selcetd %d ",
-                              __func__, current_vol, gain_dep_cal_level);
-                        break;
-                    }
-                }
+                gain_dep_cal_index = find_gain_dep_cal_index(new_vol);
+                ALOGV("%s: volume(%f), gain dep cal index selected %d ",
+                      __func__, new_vol, gain_dep_cal_index);
             }
+            if (gain_dep_cal_index >= 0)
+                gain_dep_cal_level = volume_curve_gain_mapping_table[gain_dep_cal_index].level;
 
             // check here if previous gain dep cal level was not same
             if (gain_dep_cal_level != -1) {
@@ -336,6 +388,7 @@ static void check_and_set_gain_dep_cal()
                     // Gain level change info send to lower layer that has logic to re-apply on
                     // failure, so change current gain level to reflect new level
                     current_gain_dep_cal_level = gain_dep_cal_level;
+                    current_gain_dep_cal_index = gain_dep_cal_index;
                     current_vol = new_vol;
                 } else {
                     if (dumping_enabled) {
@@ -458,6 +511,7 @@ static int vol_effect_command(effect_handle_t self,
 
         context->state = VOL_LISTENER_STATE_ACTIVE;
         *(int *)p_reply_data = 0;
+        update_energy_l(context);
 
         // After changing the state and if device is speaker
         // recalculate gain dep cal level
@@ -485,6 +539,7 @@ static int vol_effect_command(effect_handle_t self,
 
         context->state = VOL_LISTENER_STATE_INITIALIZED;
         *(int *)p_reply_data = 0;
+        update_energy_l(context);
 
         // After changing the state and if device is speaker
         // recalculate gain dep cal level
@@ -526,6 +581,7 @@ static int vol_effect_command(effect_handle_t self,
         }
 
         context->dev_id = new_device;
+        update_energy_l(context);
 
         if (recompute_gain_dep_cal_Level) {
             check_and_set_gain_dep_cal();
@@ -557,6 +613,7 @@ static int vol_effect_command(effect_handle_t self,
 
         context->left_vol = left_vol;
         context->right_vol = right_vol;
+        update_energy_l(context);
 
         // recompute gan dep cal level only if volume changed on speaker device
         if (recompute_gain_dep_cal_Level) {
@@ -781,6 +838,8 @@ static int vol_prc_lib_release(effect_handle_t handle)
             if (valid_dev_in_context(context)) {
                 recompute_flag = true;
             }
+            context->state = VOL_LISTENER_STATE_UNINITIALIZED;
+            update_energy_l(context);
             list_remove(&context->effect_list_node);
             free(context);
             status = 0;
@@ -799,6 +858,7 @@ static int vol_prc_lib_release(effect_handle_t handle)
     // if there are no active streams, reset cal and volume level
     if (active_stream_count == 0) {
         current_gain_dep_cal_level = -1;
+        current_gain_dep_cal_index = -1;
         current_vol = 0.0;
     }
 
@@ -17,7 +17,9 @@ LOCAL_PATH:= $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
-	offload_visualizer.c
+	offload_visualizer.c \
+	visualizer_kernels.c \
+	../post_proc/effect_registry.c
 
 LOCAL_CFLAGS+= -O2 -fvisibility=hidden
 
@@ -44,6 +46,8 @@ LOCAL_PROPRIETARY_MODULE := true
 
 LOCAL_C_INCLUDES := \
 	external/tinyalsa/include \
+	$(LOCAL_PATH)/../post_proc \
+	$(LOCAL_PATH)/../hal/audio_extn \
 	$(call include-path-for, audio-effects)
 
 LOCAL_HEADER_LIBRARIES += libsystem_headers
@@ -20,8 +20,10 @@
 #include <dlfcn.h>
 #include <math.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
 #include <sys/prctl.h>
 #include <time.h>
 #include <unistd.h>
@@ -32,6 +34,10 @@
 #include <tinyalsa/asoundlib.h>
 #include <audio_effects/effect_visualizer.h>
 
+#include "effect_registry.h"
+#include "seqlock.h"
+#include "visualizer_kernels.h"
+
 #define LIB_ACDB_LOADER "libacdbloader.so"
 #define ACDB_DEV_TYPE_OUT 1
 #define AFE_PROXY_ACDB_ID 45
@@ -50,6 +56,7 @@ enum {
 
 typedef struct effect_context_s effect_context_t;
 typedef struct output_context_s output_context_t;
+typedef struct capture_period_s capture_period_t;
 
 /* effect specific operations. Only the init() and process() operations must be defined.
  * Others are optional.
@@ -63,6 +70,9 @@ typedef struct effect_ops_s {
     int (*start)(effect_context_t *context, output_context_t *output);
     int (*stop)(effect_context_t *context, output_context_t *output);
     int (*process)(effect_context_t *context, audio_buffer_t *in, audio_buffer_t *out);
+    /* optional: consumes the analysis shared by all effects for the current capture
+     * period. Used by the capture thread instead of process() when defined. */
+    int (*process_period)(effect_context_t *context, const capture_period_t *period);
     int (*set_parameter)(effect_context_t *context, effect_param_t *param, uint32_t size);
     int (*get_parameter)(effect_context_t *context, effect_param_t *param, uint32_t *size);
     int (*command)(effect_context_t *context, uint32_t cmdCode, uint32_t cmdSize,
@@ -73,6 +83,8 @@ struct effect_context_s {
     const struct effect_interface_s *itfe;
     struct listnode effects_list_node;  /* node in created_effects_list */
     struct listnode output_node;  /* node in output_context_t.effects_list */
+    output_context_t *output;  /* output linked through output_node, NULL if none */
+    bool processing;  /* counted in processing_effects */
     effect_config_t config;
     const effect_descriptor_t *desc;
     audio_io_handle_t out_handle;  /* io handle of the output the effect is attached to */
@@ -110,19 +122,30 @@ typedef struct buffer_stats_s {
 typedef struct visualizer_context_s {
     effect_context_t common;
 
+    /* Capture state below is only written by the capture thread (or with lock held
+     * while it can't run), and published through the capture_seq seqlock: it is odd
+     * while an update is in progress. VISUALIZER_CMD_CAPTURE and
+     * VISUALIZER_CMD_MEASURE read it without taking lock and retry on a change. */
+    atomic_uint capture_seq;
     uint32_t capture_idx;
+    struct timespec buffer_update_time;
+    uint8_t capture_buf[CAPTURE_BUF_SIZE];
+    uint8_t meas_buffer_idx;
+    buffer_stats_t past_meas[MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS];
+    /* set by readers when measurements are stale, cleared by the capture thread */
+    atomic_bool meas_reset_pending;
+
+    /* reader side state, reader_lock held */
+    uint32_t last_capture_idx;
+    struct timespec idle_update_time; /* buffer update time the capture was declared idle at */
+
     uint32_t capture_size;
     uint32_t scaling_mode;
-    uint32_t last_capture_idx;
     uint32_t latency;
-    struct timespec buffer_update_time;
-    uint8_t capture_buf[CAPTURE_BUF_SIZE];
     /* for measurements */
     uint8_t channel_count; /* to avoid recomputing it every time a buffer is processed */
     uint32_t meas_mode;
     uint8_t meas_wndw_size_in_buffers;
-    uint8_t meas_buffer_idx;
-    buffer_stats_t past_meas[MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS];
 } visualizer_context_t;
 
 
@@ -161,15 +184,27 @@ struct listnode created_effects_list;
 /* list of active output streams. Updated by visualizer_hal_start_output()
  * and visualizer_hal_stop_output() */
 struct listnode active_outputs_list;
+/* created_effects_list entries by effect handle and active_outputs_list entries by io handle */
+struct effect_registry created_effects_index;
+struct effect_registry active_outputs_index;
+/* enabled effects with a process function attached to an active output, see
+ * update_processing_l() */
+int processing_effects;
 
 /* thread capturing PCM from Proxy port and calling the process function on each enabled effect
  * attached to an active output stream */
 pthread_t capture_thread;
-/* lock must be held when modifying or accessing created_effects_list or active_outputs_list */
+/* lock must be held when modifying or accessing created_effects_list or active_outputs_list,
+ * their indexes or processing_effects */
 pthread_mutex_t lock;
 /* thread_lock must be held when starting or stopping the capture thread.
- * Locking order: thread_lock -> lock */
+ * Locking order: thread_lock -> lock -> reader_lock */
 pthread_mutex_t thread_lock;
+/* reader_lock is held, on top of lock, while effects are created or released and while any
+ * command runs. VISUALIZER_CMD_CAPTURE and VISUALIZER_CMD_MEASURE take only reader_lock: it
+ * keeps the context alive and serializes its reader side state, and the capture thread never
+ * takes it. */
+pthread_mutex_t reader_lock;
 /* cond is signaled when an output is started or stopped or an effect is enabled or disable: the
  * capture thread will reevaluate the capture and effect rocess conditions. */
 pthread_cond_t cond;
@@ -201,6 +236,14 @@ struct pcm_config pcm_config_capture = {
     .avail_min = AUDIO_CAPTURE_PERIOD_SIZE / 4,
 };
 
+/* one proxy capture period, analyzed once by the capture thread and consumed by
+ * every visualizer attached to an active output */
+struct capture_period_s {
+    size_t frames;
+    int16_t mono[AUDIO_CAPTURE_PERIOD_SIZE]; /* halved left + right downmix */
+    buffer_analysis_t analysis;
+};
+
 
 /*
  *  Local functions
@@ -212,6 +255,7 @@ static void init_once() {
 
     pthread_mutex_init(&lock, NULL);
     pthread_mutex_init(&thread_lock, NULL);
+    pthread_mutex_init(&reader_lock, NULL);
     pthread_cond_init(&cond, NULL);
     exit_thread = false;
     thread_status = -1;
@@ -225,82 +269,45 @@ int lib_init() {
 }
 
 bool effect_exists(effect_context_t *context) {
-    struct listnode *node;
-
-    list_for_each(node, &created_effects_list) {
-        effect_context_t *fx_ctxt = node_to_item(node,
-                                                     effect_context_t,
-                                                     effects_list_node);
-        if (fx_ctxt == context) {
-            return true;
-        }
-    }
-    return false;
+    return effect_registry_find(&created_effects_index, (uintptr_t)context) != NULL;
 }
 
 output_context_t *get_output(audio_io_handle_t output) {
-    struct listnode *node;
+    return (output_context_t *)effect_registry_find(&active_outputs_index, (uintptr_t)output);
+}
 
-    list_for_each(node, &active_outputs_list) {
-        output_context_t *out_ctxt = node_to_item(node,
-                                                  output_context_t,
-                                                  outputs_list_node);
-        if (out_ctxt->handle == output) {
-            return out_ctxt;
-        }
-    }
-    return NULL;
+/* call after any change to the state or output of context */
+void update_processing_l(effect_context_t *context) {
+    bool processing = context->output != NULL && context->state == EFFECT_STATE_ACTIVE &&
+                      context->ops.process != NULL;
+
+    if (processing != context->processing)
+        processing_effects += processing ? 1 : -1;
+    context->processing = processing;
 }
 
 void add_effect_to_output(output_context_t * output, effect_context_t *context) {
-    struct listnode *fx_node;
-
-    list_for_each(fx_node, &output->effects_list) {
-        effect_context_t *fx_ctxt = node_to_item(fx_node,
-                                                     effect_context_t,
-                                                     output_node);
-        if (fx_ctxt == context)
-            return;
-    }
+    if (context->output == output)
+        return;
     list_add_tail(&output->effects_list, &context->output_node);
+    context->output = output;
+    update_processing_l(context);
     if (context->ops.start)
         context->ops.start(context, output);
 }
 
 void remove_effect_from_output(output_context_t * output, effect_context_t *context) {
-    struct listnode *fx_node;
-
-    list_for_each(fx_node, &output->effects_list) {
-        effect_context_t *fx_ctxt = node_to_item(fx_node,
-                                                     effect_context_t,
-                                                     output_node);
-        if (fx_ctxt == context) {
-            if (context->ops.stop)
-                context->ops.stop(context, output);
-            list_remove(&context->output_node);
-            return;
-        }
-    }
+    if (context->output != output)
+        return;
+    if (context->ops.stop)
+        context->ops.stop(context, output);
+    list_remove(&context->output_node);
+    context->output = NULL;
+    update_processing_l(context);
 }
 
 bool effects_enabled() {
-    struct listnode *out_node;
-
-    list_for_each(out_node, &active_outputs_list) {
-        struct listnode *fx_node;
-        output_context_t *out_ctxt = node_to_item(out_node,
-                                                  output_context_t,
-                                                  outputs_list_node);
-
-        list_for_each(fx_node, &out_ctxt->effects_list) {
-            effect_context_t *fx_ctxt = node_to_item(fx_node,
-                                                         effect_context_t,
-                                                         output_node);
-            if (fx_ctxt->state == EFFECT_STATE_ACTIVE && fx_ctxt->ops.process != NULL)
-                return true;
-        }
-    }
-    return false;
+    return processing_effects > 0;
 }
 
 int configure_proxy_capture(struct mixer *mixer, int value) {
@@ -326,6 +333,7 @@ void *capture_thread_loop(void *arg __unused)
 {
     int16_t data[AUDIO_CAPTURE_PERIOD_SIZE * AUDIO_CAPTURE_CHANNEL_COUNT * sizeof(int16_t)];
     audio_buffer_t buf;
+    capture_period_t period;
     buf.frameCount = AUDIO_CAPTURE_PERIOD_SIZE;
     buf.s16 = data;
     bool capture_enabled = false;
@@ -392,6 +400,7 @@ void *capture_thread_loop(void *arg __unused)
 
         if (ret == 0) {
             struct listnode *out_node;
+            bool analyzed = false;
 
             list_for_each(out_node, &active_outputs_list) {
                 output_context_t *out_ctxt = node_to_item(out_node,
@@ -403,8 +412,18 @@ void *capture_thread_loop(void *arg __unused)
                     effect_context_t *fx_ctxt = node_to_item(fx_node,
                                                                 effect_context_t,
                                                                 output_node);
-                    if (fx_ctxt->ops.process != NULL)
+                    if (fx_ctxt->ops.process_period != NULL) {
+                        /* the proxy port carries the same mix for all outputs */
+                        if (!analyzed) {
+                            period.frames = buf.frameCount;
+                            visualizer_analyze_stereo_buffer(buf.s16, buf.frameCount,
+                                                             period.mono, &period.analysis);
+                            analyzed = true;
+                        }
+                        fx_ctxt->ops.process_period(fx_ctxt, &period);
+                    } else if (fx_ctxt->ops.process != NULL) {
                         fx_ctxt->ops.process(fx_ctxt, &buf, &buf);
+                    }
                 }
             }
         } else {
@@ -454,6 +473,12 @@ int visualizer_hal_start_output(audio_io_handle_t output, int pcm_id,
     capture_config.capture_device_id = pcm_capture_id;
 
     output_context_t *out_ctxt = (output_context_t *)malloc(sizeof(output_context_t));
+    if (out_ctxt == NULL ||
+        effect_registry_add(&active_outputs_index, (uintptr_t)output, out_ctxt) != 0) {
+        free(out_ctxt);
+        ret = -ENOMEM;
+        goto exit;
+    }
     out_ctxt->handle = output;
     list_init(&out_ctxt->effects_list);
 
@@ -465,6 +490,8 @@ int visualizer_hal_start_output(audio_io_handle_t output, int pcm_id,
             if (fx_ctxt->ops.start)
                 fx_ctxt->ops.start(fx_ctxt, out_ctxt);
             list_add_tail(&out_ctxt->effects_list, &fx_ctxt->output_node);
+            fx_ctxt->output = out_ctxt;
+            update_processing_l(fx_ctxt);
         }
     }
     if (list_empty(&active_outputs_list)) {
@@ -508,8 +535,11 @@ int visualizer_hal_stop_output(audio_io_handle_t output, int pcm_id) {
                                                  output_node);
         if (fx_ctxt->ops.stop)
             fx_ctxt->ops.stop(fx_ctxt, out_ctxt);
+        fx_ctxt->output = NULL;
+        update_processing_l(fx_ctxt);
     }
     list_remove(&out_ctxt->outputs_list_node);
+    effect_registry_remove(&active_outputs_index, (uintptr_t)output);
     pthread_cond_signal(&cond);
 
     if (list_empty(&active_outputs_list)) {
@@ -564,13 +594,23 @@ void get_config(effect_context_t *context, effect_config_t *config)
  * Visualizer operations
  */
 
-uint32_t visualizer_get_delta_time_ms_from_updated_time(visualizer_context_t* visu_ctxt) {
+/* update time as seen by readers: zero once the capture was declared idle */
+static struct timespec visualizer_reader_update_time(const visualizer_context_t *visu_ctxt,
+                                                     struct timespec update_time)
+{
+    if (update_time.tv_sec == visu_ctxt->idle_update_time.tv_sec &&
+            update_time.tv_nsec == visu_ctxt->idle_update_time.tv_nsec)
+        update_time.tv_sec = 0;
+    return update_time;
+}
+
+uint32_t visualizer_get_delta_time_ms_from_updated_time(const struct timespec *update_time) {
     uint32_t delta_ms = 0;
-    if (visu_ctxt->buffer_update_time.tv_sec != 0) {
+    if (update_time->tv_sec != 0) {
         struct timespec ts;
         if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
-            time_t secs = ts.tv_sec - visu_ctxt->buffer_update_time.tv_sec;
-            long nsec = ts.tv_nsec - visu_ctxt->buffer_update_time.tv_nsec;
+            time_t secs = ts.tv_sec - update_time->tv_sec;
+            long nsec = ts.tv_nsec - update_time->tv_nsec;
             if (nsec < 0) {
                 --secs;
                 nsec += 1000000000;
@@ -585,11 +625,15 @@ int visualizer_reset(effect_context_t *context)
 {
     visualizer_context_t * visu_ctxt = (visualizer_context_t *)context;
 
+    audio_extn_seqlock_write_begin(&visu_ctxt->capture_seq);
     visu_ctxt->capture_idx = 0;
-    visu_ctxt->last_capture_idx = 0;
     visu_ctxt->buffer_update_time.tv_sec = 0;
-    visu_ctxt->latency = DSP_OUTPUT_LATENCY_MS;
     memset(visu_ctxt->capture_buf, 0x80, CAPTURE_BUF_SIZE);
+    audio_extn_seqlock_write_end(&visu_ctxt->capture_seq);
+    visu_ctxt->last_capture_idx = 0;
+    visu_ctxt->idle_update_time.tv_sec = 0;
+    visu_ctxt->idle_update_time.tv_nsec = 0;
+    visu_ctxt->latency = DSP_OUTPUT_LATENCY_MS;
     return 0;
 }
 
@@ -714,62 +758,49 @@ int visualizer_set_parameter(effect_context_t *context, effect_param_t *p, uint3
     return 0;
 }
 
-/* Real process function called from capture thread. Called with lock held */
-int visualizer_process(effect_context_t *context,
-                       audio_buffer_t *inBuffer,
-                       audio_buffer_t *outBuffer)
+/* Real process function called from capture thread with the period analysis
+ * shared by all visualizers. Called with lock held */
+int visualizer_process_period(effect_context_t *context, const capture_period_t *period)
 {
     visualizer_context_t *visu_ctxt = (visualizer_context_t *)context;
+    const buffer_analysis_t *analysis = &period->analysis;
 
     if (!effect_exists(context))
         return -EINVAL;
 
-    if (inBuffer == NULL || inBuffer->raw == NULL ||
-        outBuffer == NULL || outBuffer->raw == NULL ||
-        inBuffer->frameCount != outBuffer->frameCount ||
-        inBuffer->frameCount == 0) {
+    if (period->frames == 0 || period->frames > AUDIO_CAPTURE_PERIOD_SIZE)
         return -EINVAL;
+
+    audio_extn_seqlock_write_begin(&visu_ctxt->capture_seq);
+
+    if (atomic_exchange_explicit(&visu_ctxt->meas_reset_pending, false,
+                                 memory_order_relaxed)) {
+        uint32_t i;
+        for (i = 0; i < visu_ctxt->meas_wndw_size_in_buffers; i++) {
+            visu_ctxt->past_meas[i].is_valid = false;
+            visu_ctxt->past_meas[i].peak_u16 = 0;
+            visu_ctxt->past_meas[i].rms_squared = 0;
+        }
+        visu_ctxt->meas_buffer_idx = 0;
     }
 
-    // perform measurements if needed
+    // store measurements if needed
     if (visu_ctxt->meas_mode & MEASUREMENT_MODE_PEAK_RMS) {
-        // find the peak and RMS squared for the new buffer
-        uint32_t inIdx;
-        int16_t max_sample = 0;
-        float rms_squared_acc = 0;
-        for (inIdx = 0 ; inIdx < inBuffer->frameCount * visu_ctxt->channel_count ; inIdx++) {
-            if (inBuffer->s16[inIdx] > max_sample) {
-                max_sample = inBuffer->s16[inIdx];
-            } else if (-inBuffer->s16[inIdx] > max_sample) {
-                max_sample = -inBuffer->s16[inIdx];
-            }
-            rms_squared_acc += (inBuffer->s16[inIdx] * inBuffer->s16[inIdx]);
-        }
-        // store the measurement
-        visu_ctxt->past_meas[visu_ctxt->meas_buffer_idx].peak_u16 = (uint16_t)max_sample;
+        visu_ctxt->past_meas[visu_ctxt->meas_buffer_idx].peak_u16 = analysis->peak_u16;
         visu_ctxt->past_meas[visu_ctxt->meas_buffer_idx].rms_squared =
-                rms_squared_acc / (inBuffer->frameCount * visu_ctxt->channel_count);
+                (float)analysis->sum_squares / (period->frames * visu_ctxt->channel_count);
         visu_ctxt->past_meas[visu_ctxt->meas_buffer_idx].is_valid = true;
         if (++visu_ctxt->meas_buffer_idx >= visu_ctxt->meas_wndw_size_in_buffers) {
             visu_ctxt->meas_buffer_idx = 0;
         }
     }
 
-    /* all code below assumes stereo 16 bit PCM output and input */
     int32_t shift;
 
     if (visu_ctxt->scaling_mode == VISUALIZER_SCALING_MODE_NORMALIZED) {
         /* derive capture scaling factor from peak value in current buffer
          * this gives more interesting captures for display. */
-        shift = 32;
-        int len = inBuffer->frameCount * 2;
-        int i;
-        for (i = 0; i < len; i++) {
-            int32_t smp = inBuffer->s16[i];
-            if (smp < 0) smp = -smp - 1; /* take care to keep the max negative in range */
-            int32_t clz = __builtin_clz(smp);
-            if (shift > clz) shift = clz;
-        }
+        shift = analysis->max_norm ? __builtin_clz(analysis->max_norm) : 32;
         /* A maximum amplitude signal will have 17 leading zeros, which we want to
          * translate to a shift of 8 (for converting 16 bit to 8 bit) */
         shift = 25 - shift;
@@ -785,28 +816,27 @@ int visualizer_process(effect_context_t *context,
         shift = 9;
     }
 
-    uint32_t capt_idx;
-    uint32_t in_idx;
-    uint8_t *buf = visu_ctxt->capture_buf;
-    for (in_idx = 0, capt_idx = visu_ctxt->capture_idx;
-         in_idx < inBuffer->frameCount;
-         in_idx++, capt_idx++) {
-        if (capt_idx >= CAPTURE_BUF_SIZE) {
-            /* wrap around */
+    /* the downmix is already halved, and writing may wrap around */
+    uint32_t capt_idx = visu_ctxt->capture_idx;
+    uint32_t done = 0;
+    while (done < period->frames) {
+        uint32_t count = period->frames - done;
+        if (capt_idx >= CAPTURE_BUF_SIZE)
             capt_idx = 0;
-        }
-        int32_t smp = inBuffer->s16[2 * in_idx] + inBuffer->s16[2 * in_idx + 1];
-        smp = smp >> shift;
-        buf[capt_idx] = ((uint8_t)smp)^0x80;
+        if (count > CAPTURE_BUF_SIZE - capt_idx)
+            count = CAPTURE_BUF_SIZE - capt_idx;
+        visualizer_mono_to_capture(visu_ctxt->capture_buf + capt_idx, period->mono + done,
+                                   count, shift - 1);
+        capt_idx += count;
+        done += count;
     }
 
-    /* XXX the following two should really be atomic, though it probably doesn't
-     * matter much for visualization purposes */
     visu_ctxt->capture_idx = capt_idx;
     /* update last buffer update time stamp */
     if (clock_gettime(CLOCK_MONOTONIC, &visu_ctxt->buffer_update_time) < 0) {
         visu_ctxt->buffer_update_time.tv_sec = 0;
     }
+    audio_extn_seqlock_write_end(&visu_ctxt->capture_seq);
 
     if (context->state != EFFECT_STATE_ACTIVE) {
         ALOGV("%s DONE inactive", __func__);
@@ -816,6 +846,30 @@ int visualizer_process(effect_context_t *context,
     return 0;
 }
 
+int visualizer_process(effect_context_t *context,
+                       audio_buffer_t *inBuffer,
+                       audio_buffer_t *outBuffer)
+{
+    capture_period_t period;
+
+    if (inBuffer == NULL || inBuffer->raw == NULL ||
+        outBuffer == NULL || outBuffer->raw == NULL ||
+        inBuffer->frameCount != outBuffer->frameCount ||
+        inBuffer->frameCount == 0) {
+        return -EINVAL;
+    }
+
+    if (inBuffer->frameCount > AUDIO_CAPTURE_PERIOD_SIZE)
+        return -EINVAL;
+
+    /* all code below assumes stereo 16 bit PCM output and input */
+    period.frames = inBuffer->frameCount;
+    visualizer_analyze_stereo_buffer(inBuffer->s16, inBuffer->frameCount, period.mono,
+                                     &period.analysis);
+
+    return visualizer_process_period(context, &period);
+}
+
 int visualizer_command(effect_context_t * context, uint32_t cmdCode, uint32_t cmdSize __unused,
         void *pCmdData __unused, uint32_t *replySize, void *pReplyData)
 {
@@ -833,47 +887,60 @@ int visualizer_command(effect_context_t * context, uint32_t cmdCode, uint32_t cm
             break;
 
         if (context->state == EFFECT_STATE_ACTIVE) {
-            int32_t latency_ms = visu_ctxt->latency;
-            const uint32_t delta_ms = visualizer_get_delta_time_ms_from_updated_time(visu_ctxt);
-            if (latency_ms < delta_ms) {
-                latency_ms = 0;
-            } else {
-                latency_ms -= delta_ms;
-            }
-            const uint32_t delta_smp = context->config.inputCfg.samplingRate * latency_ms / 1000;
-
-            int32_t capture_point = 0;
-            __builtin_sub_overflow(visu_ctxt->capture_idx, visu_ctxt->capture_size + delta_smp,
-                                   &capture_point);
-            int32_t capture_size = visu_ctxt->capture_size;
-            if (capture_point < 0) {
-                int32_t size = -capture_point;
-                if (size > capture_size)
-                    size = capture_size;
-
-                memcpy(pReplyData,
-                       visu_ctxt->capture_buf + CAPTURE_BUF_SIZE + capture_point,
-                       size);
-                pReplyData = (void *)((size_t)pReplyData + size);
-                capture_size -= size;
-                capture_point = 0;
-            }
-            memcpy(pReplyData,
-                   visu_ctxt->capture_buf + capture_point,
-                   capture_size);
-
+            unsigned int seq;
+            uint32_t capture_idx;
+            struct timespec raw_update_time, update_time;
+            uint32_t delta_ms;
+
+            do {
+                seq = audio_extn_seqlock_read_begin(&visu_ctxt->capture_seq);
+                capture_idx = visu_ctxt->capture_idx;
+                raw_update_time = visu_ctxt->buffer_update_time;
+                update_time = visualizer_reader_update_time(visu_ctxt, raw_update_time);
+
+                int32_t latency_ms = visu_ctxt->latency;
+                delta_ms = visualizer_get_delta_time_ms_from_updated_time(&update_time);
+                if (latency_ms < delta_ms) {
+                    latency_ms = 0;
+                } else {
+                    latency_ms -= delta_ms;
+                }
+                const uint32_t delta_smp =
+                        context->config.inputCfg.samplingRate * latency_ms / 1000;
+
+                int32_t capture_point = 0;
+                __builtin_sub_overflow(capture_idx, visu_ctxt->capture_size + delta_smp,
+                                       &capture_point);
+                int32_t capture_size = visu_ctxt->capture_size;
+                uint8_t *dst = (uint8_t *)pReplyData;
+                if (capture_point < 0) {
+                    int32_t size = -capture_point;
+                    if (size > capture_size)
+                        size = capture_size;
+
+                    memcpy(dst,
+                           visu_ctxt->capture_buf + CAPTURE_BUF_SIZE + capture_point,
+                           size);
+                    dst += size;
+                    capture_size -= size;
+                    capture_point = 0;
+                }
+                memcpy(dst,
+                       visu_ctxt->capture_buf + capture_point,
+                       capture_size);
+            } while (audio_extn_seqlock_read_retry(&visu_ctxt->capture_seq, seq));
 
             /* if audio framework has stopped playing audio although the effect is still
              * active we must clear the capture buffer to return silence */
-            if ((visu_ctxt->last_capture_idx == visu_ctxt->capture_idx) &&
-                    (visu_ctxt->buffer_update_time.tv_sec != 0)) {
+            if ((visu_ctxt->last_capture_idx == capture_idx) &&
+                    (update_time.tv_sec != 0)) {
                 if (delta_ms > MAX_STALL_TIME_MS) {
                     ALOGV("%s capture going to idle", __func__);
-                    visu_ctxt->buffer_update_time.tv_sec = 0;
+                    visu_ctxt->idle_update_time = raw_update_time;
                     memset(pReplyData, 0x80, visu_ctxt->capture_size);
                 }
             }
-            visu_ctxt->last_capture_idx = visu_ctxt->capture_idx;
+            visu_ctxt->last_capture_idx = capture_idx;
         } else {
             memset(pReplyData, 0x80, visu_ctxt->capture_size);
         }
@@ -892,36 +959,41 @@ int visualizer_command(effect_context_t * context, uint32_t cmdCode, uint32_t cm
             android_errorWriteLog(0x534e4554, "30229821");
             return -EINVAL;
         }
-        uint16_t peak_u16 = 0;
-        float sum_rms_squared = 0.0f;
-        uint8_t nb_valid_meas = 0;
-        /* reset measurements if last measurement was too long ago (which implies stored
-         * measurements aren't relevant anymore and shouldn't bias the new one) */
-        const int32_t delay_ms = visualizer_get_delta_time_ms_from_updated_time(visu_ctxt);
-        if (delay_ms > DISCARD_MEASUREMENTS_TIME_MS) {
-            uint32_t i;
-            ALOGV("Discarding measurements, last measurement is %dms old", delay_ms);
-            for (i=0 ; i<visu_ctxt->meas_wndw_size_in_buffers ; i++) {
-                visu_ctxt->past_meas[i].is_valid = false;
-                visu_ctxt->past_meas[i].peak_u16 = 0;
-                visu_ctxt->past_meas[i].rms_squared = 0;
-            }
-            visu_ctxt->meas_buffer_idx = 0;
-        } else {
-            /* only use actual measurements, otherwise the first RMS measure happening before
-             * MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS have been played will always be artificially
-             * low */
-            uint32_t i;
-            for (i=0 ; i < visu_ctxt->meas_wndw_size_in_buffers ; i++) {
-                if (visu_ctxt->past_meas[i].is_valid) {
-                    if (visu_ctxt->past_meas[i].peak_u16 > peak_u16) {
-                        peak_u16 = visu_ctxt->past_meas[i].peak_u16;
+        uint16_t peak_u16;
+        float sum_rms_squared;
+        uint8_t nb_valid_meas;
+        unsigned int seq;
+        do {
+            seq = audio_extn_seqlock_read_begin(&visu_ctxt->capture_seq);
+            peak_u16 = 0;
+            sum_rms_squared = 0.0f;
+            nb_valid_meas = 0;
+            /* reset measurements if last measurement was too long ago (which implies stored
+             * measurements aren't relevant anymore and shouldn't bias the new one) */
+            const struct timespec update_time =
+                    visualizer_reader_update_time(visu_ctxt, visu_ctxt->buffer_update_time);
+            const int32_t delay_ms = visualizer_get_delta_time_ms_from_updated_time(&update_time);
+            if (delay_ms > DISCARD_MEASUREMENTS_TIME_MS) {
+                ALOGV("Discarding measurements, last measurement is %dms old", delay_ms);
+                /* the capture thread owns the measurements and clears them */
+                atomic_store_explicit(&visu_ctxt->meas_reset_pending, true,
+                                      memory_order_relaxed);
+            } else {
+                /* only use actual measurements, otherwise the first RMS measure happening
+                 * before MEASUREMENT_WINDOW_MAX_SIZE_IN_BUFFERS have been played will always
+                 * be artificially low */
+                uint32_t i;
+                for (i=0 ; i < visu_ctxt->meas_wndw_size_in_buffers ; i++) {
+                    if (visu_ctxt->past_meas[i].is_valid) {
+                        if (visu_ctxt->past_meas[i].peak_u16 > peak_u16) {
+                            peak_u16 = visu_ctxt->past_meas[i].peak_u16;
+                        }
+                        sum_rms_squared += visu_ctxt->past_meas[i].rms_squared;
+                        nb_valid_meas++;
                     }
-                    sum_rms_squared += visu_ctxt->past_meas[i].rms_squared;
-                    nb_valid_meas++;
                 }
             }
-        }
+        } while (audio_extn_seqlock_read_retry(&visu_ctxt->capture_seq, seq));
         float rms = nb_valid_meas == 0 ? 0.0f : sqrtf(sum_rms_squared / nb_valid_meas);
         int32_t* p_int_reply_data = (int32_t*)pReplyData;
         /* convert from I16 sample values to mB and write results */
@@ -982,6 +1054,7 @@ int effect_lib_create(const effect_uuid_t *uuid,
         context->ops.init = visualizer_init;
         context->ops.reset = visualizer_reset;
         context->ops.process = visualizer_process;
+        context->ops.process_period = visualizer_process_period;
         context->ops.set_parameter = visualizer_set_parameter;
         context->ops.get_parameter = visualizer_get_parameter;
         context->ops.command = visualizer_command;
@@ -1004,10 +1077,20 @@ int effect_lib_create(const effect_uuid_t *uuid,
     context->state = EFFECT_STATE_INITIALIZED;
 
     pthread_mutex_lock(&lock);
+    pthread_mutex_lock(&reader_lock);
+    if (effect_registry_add(&created_effects_index, (uintptr_t)context, context) != 0) {
+        pthread_mutex_unlock(&reader_lock);
+        pthread_mutex_unlock(&lock);
+        if (context->ops.release)
+            context->ops.release(context);
+        free(context);
+        return -ENOMEM;
+    }
     list_add_tail(&created_effects_list, &context->effects_list_node);
     output_context_t *out_ctxt = get_output(ioId);
     if (out_ctxt != NULL)
         add_effect_to_output(out_ctxt, context);
+    pthread_mutex_unlock(&reader_lock);
     pthread_mutex_unlock(&lock);
 
     *pHandle = (effect_handle_t)context;
@@ -1027,17 +1110,20 @@ int effect_lib_release(effect_handle_t handle) {
 
     ALOGV("%s context %p", __func__, handle);
     pthread_mutex_lock(&lock);
+    pthread_mutex_lock(&reader_lock);
     status = -EINVAL;
     if (effect_exists(context)) {
         output_context_t *out_ctxt = get_output(context->out_handle);
         if (out_ctxt != NULL)
             remove_effect_from_output(out_ctxt, context);
         list_remove(&context->effects_list_node);
+        effect_registry_remove(&created_effects_index, (uintptr_t)context);
         if (context->ops.release)
             context->ops.release(context);
         free(context);
         status = 0;
     }
+    pthread_mutex_unlock(&reader_lock);
     pthread_mutex_unlock(&lock);
 
     return status;
@@ -1103,7 +1189,23 @@ int effect_command(effect_handle_t self, uint32_t cmdCode, uint32_t cmdSize,
     int retsize;
     int status = 0;
 
+    /* Captures and measurements only read the seqlock protected capture state.
+     * They are polled by the UI and must neither wait for nor stall the capture
+     * thread, so they take reader_lock instead of lock. */
+    if (cmdCode == VISUALIZER_CMD_CAPTURE || cmdCode == VISUALIZER_CMD_MEASURE) {
+        pthread_mutex_lock(&reader_lock);
+        if (!effect_exists(context) || context->state == EFFECT_STATE_UNINITIALIZED ||
+                context->ops.command == NULL)
+            status = -EINVAL;
+        else
+            status = context->ops.command(context, cmdCode, cmdSize,
+                                          pCmdData, replySize, pReplyData);
+        pthread_mutex_unlock(&reader_lock);
+        return status;
+    }
+
     pthread_mutex_lock(&lock);
+    pthread_mutex_lock(&reader_lock);
 
     if (!effect_exists(context)) {
         status = -EINVAL;
@@ -1164,6 +1266,7 @@ int effect_command(effect_handle_t self, uint32_t cmdCode, uint32_t cmdSize,
             goto exit;
         }
         context->state = EFFECT_STATE_ACTIVE;
+        update_processing_l(context);
         if (context->ops.enable)
             context->ops.enable(context);
         pthread_cond_signal(&cond);
@@ -1180,6 +1283,7 @@ int effect_command(effect_handle_t self, uint32_t cmdCode, uint32_t cmdSize,
             goto exit;
         }
         context->state = EFFECT_STATE_INITIALIZED;
+        update_processing_l(context);
         if (context->ops.disable)
             context->ops.disable(context);
         pthread_cond_signal(&cond);
@@ -1266,6 +1370,7 @@ int effect_command(effect_handle_t self, uint32_t cmdCode, uint32_t cmdSize,
     }
 
 exit:
+    pthread_mutex_unlock(&reader_lock);
     pthread_mutex_unlock(&lock);
 
 //    ALOGV_IF(cmdCode != VISUALIZER_CMD_CAPTURE,"%s DONE", __func__);
@@ -1277,16 +1382,16 @@ int effect_get_descriptor(effect_handle_t   self,
                                     effect_descriptor_t *descriptor)
 {
     effect_context_t *context = (effect_context_t *)self;
+    int status = 0;
 
-    if (!effect_exists(context))
-        return -EINVAL;
-
-    if (descriptor == NULL)
-        return -EINVAL;
-
-    *descriptor = *context->desc;
+    pthread_mutex_lock(&lock);
+    if (!effect_exists(context) || descriptor == NULL)
+        status = -EINVAL;
+    else
+        *descriptor = *context->desc;
+    pthread_mutex_unlock(&lock);
 
-    return 0;
+    return status;
 }
 
 /* effect_handle_t interface implementation for visualizer effect */
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Sample kernels of the visualizer capture path.
+
+   They only depend on the C library and NEON, so besides libqcomvisualizer
+   the kernel benchmark under hal/tools builds them unchanged.
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "visualizer_kernels.h"
+
+/* One pass over interleaved stereo 16 bit PCM: measures peak, sum of squares
+ * and normalization magnitude, and stores the (L + R) / 2 downmix the 8 bit
+ * capture is derived from. */
+void visualizer_analyze_stereo_buffer(const int16_t *src, size_t frames,
+                                      int16_t *mono, buffer_analysis_t *res)
+{
+    uint16_t peak = 0;
+    int16_t norm = 0;
+    int64_t sum_squares = 0;
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    uint16x8_t vpeak = vdupq_n_u16(0);
+    int16x8_t vnorm = vdupq_n_s16(0);
+    int64x2_t vsq = vdupq_n_s64(0);
+
+    for (; i + 8 <= frames; i += 8, src += 16, mono += 8) {
+        int16x8x2_t lr = vld2q_s16(src);
+        int16x8_t l = lr.val[0];
+        int16x8_t r = lr.val[1];
+
+        /* vabsq leaves -32768 as is, which reads back as 32768 unsigned */
+        vpeak = vmaxq_u16(vpeak, vreinterpretq_u16_s16(vabsq_s16(l)));
+        vpeak = vmaxq_u16(vpeak, vreinterpretq_u16_s16(vabsq_s16(r)));
+        /* smp ^ (smp >> 15) is smp for positive and -smp - 1 for negative samples */
+        vnorm = vmaxq_s16(vnorm, veorq_s16(l, vshrq_n_s16(l, 15)));
+        vnorm = vmaxq_s16(vnorm, veorq_s16(r, vshrq_n_s16(r, 15)));
+        vsq = vpadalq_s32(vsq, vmull_s16(vget_low_s16(l), vget_low_s16(l)));
+        vsq = vpadalq_s32(vsq, vmull_s16(vget_high_s16(l), vget_high_s16(l)));
+        vsq = vpadalq_s32(vsq, vmull_s16(vget_low_s16(r), vget_low_s16(r)));
+        vsq = vpadalq_s32(vsq, vmull_s16(vget_high_s16(r), vget_high_s16(r)));
+        vst1q_s16(mono, vhaddq_s16(l, r));
+    }
+
+    uint16_t lanes_peak[8];
+    int16_t lanes_norm[8];
+    int j;
+    vst1q_u16(lanes_peak, vpeak);
+    vst1q_s16(lanes_norm, vnorm);
+    for (j = 0; j < 8; j++) {
+        if (lanes_peak[j] > peak) peak = lanes_peak[j];
+        if (lanes_norm[j] > norm) norm = lanes_norm[j];
+    }
+    sum_squares = vgetq_lane_s64(vsq, 0) + vgetq_lane_s64(vsq, 1);
+#endif
+    for (; i < frames; i++, src += 2, mono++) {
+        int c;
+        for (c = 0; c < 2; c++) {
+            int32_t smp = src[c];
+            uint16_t mag = (uint16_t)(smp < 0 ? -smp : smp);
+            int16_t n = (int16_t)(smp ^ (smp >> 31));
+            if (mag > peak) peak = mag;
+            if (n > norm) norm = n;
+            sum_squares += smp * smp;
+        }
+        *mono = (int16_t)(((int32_t)src[0] + (int32_t)src[1]) >> 1);
+    }
+
+    res->peak_u16 = peak;
+    res->max_norm = norm;
+    res->sum_squares = sum_squares;
+}
+
+/* converts the downmix to unsigned 8 bit capture samples */
+void visualizer_mono_to_capture(uint8_t *dst, const int16_t *mono, size_t frames,
+                                int32_t shift)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    const int16x8_t vshift = vdupq_n_s16(-shift);
+    const uint8x8_t vsign = vdup_n_u8(0x80);
+
+    for (; i + 8 <= frames; i += 8) {
+        int16x8_t smp = vshlq_s16(vld1q_s16(mono + i), vshift);
+        vst1_u8(dst + i, veor_u8(vreinterpret_u8_s8(vmovn_s16(smp)), vsign));
+    }
+#endif
+    for (; i < frames; i++)
+        dst[i] = ((uint8_t)(mono[i] >> shift)) ^ 0x80;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VISUALIZER_KERNELS_H
+#define VISUALIZER_KERNELS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* results of the single analysis pass over a capture buffer */
+typedef struct buffer_analysis_s {
+    uint16_t peak_u16; /* largest absolute sample value */
+    int16_t max_norm;  /* largest of smp and -smp - 1, gives the normalization shift */
+    int64_t sum_squares;
+} buffer_analysis_t;
+
+void visualizer_analyze_stereo_buffer(const int16_t *src, size_t frames,
+                                      int16_t *mono, buffer_analysis_t *res);
+/* mono holds the halved downmix, shift takes it to 8 bits */
+void visualizer_mono_to_capture(uint8_t *dst, const int16_t *mono, size_t frames,
+                                int32_t shift);
+
+#endif /* VISUALIZER_KERNELS_H */
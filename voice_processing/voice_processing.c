@@ -35,6 +35,9 @@
 #define EFFECTS_DESCRIPTOR_LIBRARY_PATH "/vendor/lib/soundfx/libqcomvoiceprocessingdescriptors.so"
 #define EFFECTS_DESCRIPTOR_LIBRARY_PATH2 "/system/lib/soundfx/libqcomvoiceprocessingdescriptors.so"
 
+// number of buckets in the (session ID, input handle) session index, power of 2
+#define SESSION_HASH_SIZE 16
+
 // types of pre processing modules
 enum effect_id
 {
@@ -68,7 +71,7 @@ struct effect_s {
 
 // Session context
 struct session_s {
-    struct listnode node;
+    struct listnode node;            // membership in session_hash bucket
     effect_config_t config;
     struct effect_s effects[NUM_ID]; // effects in this session
     uint32_t state;                  // current state (enum session_state)
@@ -77,6 +80,8 @@ struct session_s {
     uint32_t created_msk;            // bit field containing IDs of crested pre processors
     uint32_t enabled_msk;            // bit field containing IDs of enabled pre processors
     uint32_t processed_msk;          // bit field containing IDs of pre processors already
+    uint32_t offloaded_msk;          // bit field containing IDs of pre processors run by the DSP
+    bool dsp_offloaded;              // all enabled pre processors are run by the DSP
 };
 
 
@@ -133,7 +138,7 @@ const effect_descriptor_t *descriptors[NUM_ID] = {
 
 
 static int init_status = 1;
-struct listnode session_list;
+static struct listnode session_hash[SESSION_HASH_SIZE];
 static const struct effect_interface_s effect_interface;
 static const effect_uuid_t * uuid_to_id_table[NUM_ID];
 
@@ -164,6 +169,7 @@ static uint32_t uuid_to_id(const effect_uuid_t * uuid)
 //------------------------------------------------------------------------------
 
 static void session_set_fx_enabled(struct session_s *session, uint32_t id, bool enabled);
+static void session_set_fx_offloaded(struct session_s *session, uint32_t id, bool offloaded);
 
 #define BAD_STATE_ABORT(from, to) \
         LOG_ALWAYS_FATAL("Bad state transition from %d to %d", from, to);
@@ -303,6 +309,8 @@ static int session_create_effect(struct session_s *session,
         session->config.outputCfg.format = AUDIO_FORMAT_PCM_16_BIT;
         session->enabled_msk = 0;
         session->processed_msk = 0;
+        session->offloaded_msk = 0;
+        session->dsp_offloaded = false;
     }
     status = effect_create(&session->effects[id], session, interface);
     if (status < 0)
@@ -322,6 +330,7 @@ static int session_release_effect(struct session_s *session,
     ALOGW_IF(effect_release(fx) != 0, " session_release_effect() failed for id %d", fx->id);
 
     session->created_msk &= ~(1<<fx->id);
+    session_set_fx_offloaded(session, fx->id, false);
     if (session->created_msk == 0)
     {
         ALOGV("session_release_effect() last effect: removing session");
@@ -370,6 +379,26 @@ static void session_get_config(struct session_s *session, effect_config_t *confi
 }
 
 
+// when set, the capture path already carries the AEC/NS output and
+// fx_process() has nothing to account for
+static void session_update_offload_state(struct session_s *session)
+{
+    session->dsp_offloaded = session->enabled_msk != 0 &&
+            (session->enabled_msk & ~session->offloaded_msk) == 0;
+    ALOGV("session_update_offload_state() enabled_msk %08x offloaded_msk %08x",
+          session->enabled_msk, session->offloaded_msk);
+}
+
+static void session_set_fx_offloaded(struct session_s *session, uint32_t id, bool offloaded)
+{
+    if (offloaded)
+        session->offloaded_msk |= (1 << id);
+    else
+        session->offloaded_msk &= ~(1 << id);
+    session_update_offload_state(session);
+    session->processed_msk = 0;
+}
+
 static void session_set_fx_enabled(struct session_s *session, uint32_t id, bool enabled)
 {
     if (enabled) {
@@ -385,6 +414,7 @@ static void session_set_fx_enabled(struct session_s *session, uint32_t id, bool
     }
     ALOGV("session_set_fx_enabled() id %d, enabled %d enabled_msk %08x",
          id, enabled, session->enabled_msk);
+    session_update_offload_state(session);
     session->processed_msk = 0;
 }
 
@@ -392,30 +422,47 @@ static void session_set_fx_enabled(struct session_s *session, uint32_t id, bool
 // Global functions
 //------------------------------------------------------------------------------
 
-static struct session_s *get_session(int32_t id, int32_t  sessionId, int32_t  ioId)
+static struct listnode *session_bucket(int32_t sessionId, int32_t ioId)
+{
+    uint32_t hash = (uint32_t)sessionId * 31 + (uint32_t)ioId;
+
+    return &session_hash[hash & (SESSION_HASH_SIZE - 1)];
+}
+
+static struct session_s *find_session(int32_t sessionId, int32_t ioId)
 {
-    size_t i;
-    int free = -1;
     struct listnode *node;
     struct session_s *session;
 
-    list_for_each(node, &session_list) {
+    list_for_each(node, session_bucket(sessionId, ioId)) {
         session = node_to_item(node, struct session_s, node);
-        if (session->id == sessionId) {
-            if (session->created_msk & (1 << id)) {
-                ALOGV("get_session() effect %d already created", id);
-                return NULL;
-            }
-            ALOGV("get_session() found session %p", session);
+        if (session->id == sessionId && session->io == ioId)
             return session;
+    }
+    return NULL;
+}
+
+static struct session_s *get_session(int32_t id, int32_t  sessionId, int32_t  ioId)
+{
+    struct session_s *session;
+
+    session = find_session(sessionId, ioId);
+    if (session != NULL) {
+        if (session->created_msk & (1 << id)) {
+            ALOGV("get_session() effect %d already created", id);
+            return NULL;
         }
+        ALOGV("get_session() found session %p", session);
+        return session;
     }
 
     session = (struct session_s *)calloc(1, sizeof(struct session_s));
+    if (session == NULL)
+        return NULL;
     session_init(session);
     session->id = sessionId;
     session->io = ioId;
-    list_add_tail(&session_list, &session->node);
+    list_add_tail(session_bucket(sessionId, ioId), &session->node);
 
     ALOGV("get_session() created session %p", session);
 
@@ -467,7 +514,8 @@ static int init() {
     uuid_to_id_table[NS_ID] = FX_IID_NS;
 //ENABLE_AGC uuid_to_id_table[AGC_ID] = FX_IID_AGC;
 
-    list_init(&session_list);
+    for (size_t i = 0; i < SESSION_HASH_SIZE; i++)
+        list_init(&session_hash[i]);
 
     init_status = 0;
     return init_status;
@@ -508,6 +556,10 @@ static int fx_process(effect_handle_t     self,
 
     session = (struct session_s *)effect->session;
 
+    // AEC/NS already applied in the DSP, nothing to wait for
+    if (session->dsp_offloaded)
+        return 0;
+
     session->processed_msk |= (1<<effect->id);
 
     if ((session->processed_msk & session->enabled_msk) == session->enabled_msk) {
@@ -620,6 +672,22 @@ static int fx_command(effect_handle_t  self,
             *(int *)pReplyData  = effect_set_state(effect, EFFECT_STATE_CONFIG);
             break;
 
+        case EFFECT_CMD_OFFLOAD: {
+            if (pCmdData == NULL ||
+                    cmdSize != sizeof(effect_offload_param_t) ||
+                    pReplyData == NULL ||
+                    *replySize != sizeof(int)) {
+                ALOGV("fx_command() EFFECT_CMD_OFFLOAD invalid args");
+                return -EINVAL;
+            }
+            effect_offload_param_t *offload = (effect_offload_param_t *)pCmdData;
+
+            ALOGV("fx_command() EFFECT_CMD_OFFLOAD id %d offload %d io %d",
+                  effect->id, offload->isOffload, offload->ioHandle);
+            session_set_fx_offloaded(effect->session, effect->id, offload->isOffload);
+            *(int *)pReplyData = 0;
+        } break;
+
         case EFFECT_CMD_SET_DEVICE:
         case EFFECT_CMD_SET_INPUT_DEVICE:
         case EFFECT_CMD_SET_VOLUME:
@@ -717,7 +785,6 @@ static int lib_create(const effect_uuid_t *uuid,
 
 static int lib_release(effect_handle_t interface)
 {
-    struct listnode *node;
     struct session_s *session;
 
     ALOGV("lib_release %p", interface);
@@ -726,15 +793,15 @@ static int lib_release(effect_handle_t interface)
 
     struct effect_s *fx = (struct effect_s *)interface;
 
-    list_for_each(node, &session_list) {
-        session = node_to_item(node, struct session_s, node);
-        if (session == fx->session) {
-            session_release_effect(fx->session, fx);
-            return 0;
-        }
-    }
+    if (fx == NULL || fx->session == NULL)
+        return -EINVAL;
 
-    return -EINVAL;
+    session = find_session(fx->session->id, fx->session->io);
+    if (session != fx->session)
+        return -EINVAL;
+
+    session_release_effect(session, fx);
+    return 0;
 }
 
 static int lib_get_descriptor(const effect_uuid_t *uuid,